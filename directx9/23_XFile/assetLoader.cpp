@@ -0,0 +1,389 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: assetLoader.cpp
+//
+// Desc: A worker pool with dependencies and main thread completion.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "assetLoader.h"
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+	double Now()
+	{
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+	}
+
+	// Workers spend much of their time waiting on the disk, so there are at
+	// least two even on one core: one reads while the other decodes.
+	int ResolveThreads(int numThreads)
+	{
+		if( numThreads <= 0 )
+			numThreads = std::max((int)std::thread::hardware_concurrency(), 2);
+		return numThreads;
+	}
+}
+
+AssetLoaderStats::AssetLoaderStats()
+{
+	assets     = 0;
+	failed     = 0;
+	numThreads = 0;
+	workMs     = 0.0f;
+	longestMs  = 0.0f;
+	elapsedMs  = 0.0f;
+}
+
+AssetLoader::AssetLoader(int numThreads)
+{
+	_unfinished   = 0;
+	_quit         = false;
+	_firstRequest = 0.0;
+	_lastFinish   = 0.0;
+
+	numThreads = ResolveThreads(numThreads);
+	for(int t = 0; t < numThreads; t++)
+		_workers.push_back(std::thread(&AssetLoader::workerMain, this));
+}
+
+AssetLoader::~AssetLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_quit = true;
+		_queue.clear();
+	}
+	_queued.notify_all();
+
+	for(int t = 0; t < (int)_workers.size(); t++)
+		_workers[t].join();
+}
+
+AssetId AssetLoader::load(const char* name, const Work& work, const Finish& finish)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	std::map<std::string, AssetId>::const_iterator found = _names.find(name);
+	if( found != _names.end() )
+	{
+		// the work is done once; the finish runs with the first one's,
+		// or at the next update() if that has run already
+		AssetId id = found->second;
+		Asset& asset = _assets[id];
+		if( finish )
+		{
+			asset.finishes.push_back(finish);
+			_unfinished++;
+			if( asset.state == AssetReady || asset.state == AssetFailed )
+				makeFinishable(id);
+		}
+		return id;
+	}
+
+	if( _assets.empty() )
+		_firstRequest = Now();
+
+	AssetId id = (AssetId)_assets.size();
+	_assets.push_back(Asset());
+
+	Asset& asset    = _assets.back();
+	asset.name      = name;
+	asset.work      = work;
+	asset.finishes.push_back(finish);
+	asset.state     = AssetQueued;
+	asset.ok        = false;
+	asset.waitingOn = 0;
+	asset.workMs    = 0.0f;
+
+	_names[name] = id;
+	_queue.push_back(id);
+	_unfinished++;
+
+	lock.unlock();
+	_queued.notify_one();
+	return id;
+}
+
+void AssetLoader::addDependency(AssetId asset, AssetId dependency)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	Asset& dep = _assets[dependency];
+	if( dep.state == AssetReady || dep.state == AssetFailed )
+		return;
+
+	_assets[asset].waitingOn++;
+	dep.dependents.push_back(asset);
+}
+
+void AssetLoader::workerMain()
+{
+	for(;;)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_queued.wait(lock, [this]() { return _quit || !_queue.empty(); });
+		if( _quit )
+			return;
+
+		AssetId id = _queue.front();
+		_queue.pop_front();
+		_assets[id].state = AssetWorking;
+
+		// _assets may grow, and move, while the work runs
+		Work work;
+		work.swap(_assets[id].work);
+		lock.unlock();
+
+		double start = Now();
+		bool ok = work ? work(id) : true;
+		float ms = (float)(Now() - start);
+		work = Work();
+
+		lock.lock();
+		Asset& asset = _assets[id];
+		asset.ok     = ok;
+		asset.workMs = ms;
+		asset.state  = AssetWaiting;
+		if( asset.waitingOn == 0 )
+			makeFinishable(id);
+	}
+}
+
+void AssetLoader::makeFinishable(AssetId asset)
+{
+	// with _mutex held
+	_finishable.push_back(asset);
+	_worked.notify_all();
+}
+
+int AssetLoader::update()
+{
+	int numFinished = 0;
+
+	std::vector<AssetId> ready;
+	for(;;)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			ready.swap(_finishable);
+			_finishable.clear();
+		}
+		if( ready.empty() )
+			break;
+
+		// in request order, so finishes run in a repeatable order
+		std::sort(ready.begin(), ready.end());
+
+		for(int i = 0; i < (int)ready.size(); i++)
+		{
+			// an asset already finished is here again for the finishes of
+			// requests made since
+			std::vector<Finish> finishes;
+			bool ok;
+			bool first;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				finishes.swap(_assets[ready[i]].finishes);
+				ok    = _assets[ready[i]].ok;
+				first = _assets[ready[i]].state == AssetWaiting;
+			}
+
+			for(int f = 0; f < (int)finishes.size(); f++)
+				if( finishes[f] )
+					finishes[f](ok);
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			Asset& asset = _assets[ready[i]];
+			if( first )
+			{
+				asset.state = ok ? AssetReady : AssetFailed;
+
+				for(int d = 0; d < (int)asset.dependents.size(); d++)
+				{
+					Asset& dependent = _assets[asset.dependents[d]];
+					if( --dependent.waitingOn == 0 && dependent.state == AssetWaiting )
+						makeFinishable(asset.dependents[d]);
+				}
+				asset.dependents.clear();
+
+				// requested while the finishes above ran
+				if( !asset.finishes.empty() )
+					makeFinishable(ready[i]);
+			}
+
+			_unfinished -= (int)finishes.size();
+			_lastFinish = Now();
+			numFinished += (int)finishes.size();
+		}
+		ready.clear();
+	}
+
+	return numFinished;
+}
+
+void AssetLoader::finishAll()
+{
+	for(;;)
+	{
+		update();
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		if( _unfinished == 0 )
+			return;
+		_worked.wait(lock, [this]() { return !_finishable.empty(); });
+	}
+}
+
+bool AssetLoader::isIdle() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _unfinished == 0;
+}
+
+int AssetLoader::getState(AssetId asset) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _assets[asset].state;
+}
+
+AssetLoaderStats AssetLoader::getStats() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	AssetLoaderStats stats;
+	stats.assets     = (int)_assets.size();
+	stats.numThreads = (int)_workers.size();
+	for(int i = 0; i < (int)_assets.size(); i++)
+	{
+		const Asset& asset = _assets[i];
+		if( asset.state == AssetFailed )
+			stats.failed++;
+		stats.workMs   += asset.workMs;
+		stats.longestMs = std::max(stats.longestMs, asset.workMs);
+	}
+	if( _lastFinish > _firstRequest )
+		stats.elapsedMs = (float)(_lastFinish - _firstRequest);
+	return stats;
+}
+
+//
+// Benchmark
+//
+
+namespace
+{
+	// Waits readMs, then hashes data, seeded so each asset's hash differs.
+	DWORD FakeLoad(float readMs, const std::vector<BYTE>& data, DWORD seed)
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds((long long)(readMs * 1000.0f)));
+
+		DWORD hash = 2166136261u ^ seed;
+		for(int i = 0; i < (int)data.size(); i++)
+			hash = (hash ^ data[i]) * 16777619u;
+		return hash;
+	}
+}
+
+bool BenchmarkAssetLoader(int numMeshes, int texturesPerMesh, float readMs, int workKilobytes,
+	int numThreads, AssetLoaderBenchmark* result)
+{
+	if( numMeshes <= 0 || texturesPerMesh < 0 || !result )
+		return false;
+
+	std::vector<BYTE> data((size_t)workKilobytes * 1024);
+	for(int i = 0; i < (int)data.size(); i++)
+		data[i] = (BYTE)(i * 2654435761u >> 24);
+
+	int numAssets = numMeshes * (1 + texturesPerMesh);
+	result->assets = numAssets;
+
+	// one after another, as Setup() used to; meshes first, then textures
+	std::vector<DWORD> serialHashes(numAssets);
+	double start = Now();
+	for(int a = 0; a < numAssets; a++)
+		serialHashes[a] = FakeLoad(readMs, data, (DWORD)a);
+	result->serialMs = (float)(Now() - start);
+
+	// with the loader
+	std::vector<float> meshMs(numMeshes, 0.0f);
+	std::vector<float> textureMs(numMeshes * texturesPerMesh, 0.0f);
+	std::vector<DWORD> hashes(numAssets, 0);
+	std::vector<int>   texturesDone(numMeshes, 0);
+	int outOfOrder     = 0;
+	int sharedFinishes = 0;
+
+	start = Now();
+	AssetLoader loader(numThreads);
+	for(int m = 0; m < numMeshes; m++)
+	{
+		char name[32];
+		sprintf(name, "mesh%d", m);
+
+		loader.load(name,
+			[&, m](AssetId self) -> bool
+			{
+				double meshStart = Now();
+				hashes[m] = FakeLoad(readMs, data, (DWORD)m);
+				meshMs[m] = (float)(Now() - meshStart);
+
+				// the textures this mesh's materials name
+				for(int i = 0; i < texturesPerMesh; i++)
+				{
+					int slot = m * texturesPerMesh + i;
+
+					char textureName[32];
+					sprintf(textureName, "mesh%d.texture%d", m, i);
+
+					AssetId texture = loader.load(textureName,
+						[&, slot](AssetId) -> bool
+						{
+							double textureStart = Now();
+							hashes[numMeshes + slot] = FakeLoad(readMs, data, (DWORD)(numMeshes + slot));
+							textureMs[slot] = (float)(Now() - textureStart);
+							return true;
+						},
+						[&, m](bool) { texturesDone[m]++; });
+					loader.addDependency(self, texture);
+				}
+
+				// and one every mesh names, read once
+				loader.load("shared", AssetLoader::Work(), [&](bool) { sharedFinishes++; });
+				return true;
+			},
+			[&, m](bool)
+			{
+				if( texturesDone[m] != texturesPerMesh )
+					outOfOrder++;
+			});
+	}
+	loader.finishAll();
+	result->loaderMs = (float)(Now() - start);
+
+	// asked for again once it has finished
+	loader.load("shared", AssetLoader::Work(), [&](bool) { sharedFinishes++; });
+	loader.finishAll();
+	result->lostFinishes = numMeshes + 1 - sharedFinishes;
+
+	result->stats          = loader.getStats();
+	result->outOfOrder     = outOfOrder;
+	result->mismatches     = 0;
+	for(int a = 0; a < numAssets; a++)
+		if( hashes[a] != serialHashes[a] )
+			result->mismatches++;
+	result->longestChainMs = 0.0f;
+	for(int m = 0; m < numMeshes; m++)
+	{
+		float slowest = 0.0f;
+		for(int i = 0; i < texturesPerMesh; i++)
+			slowest = std::max(slowest, textureMs[m * texturesPerMesh + i]);
+		result->longestChainMs = std::max(result->longestChainMs, meshMs[m] + slowest);
+	}
+
+	return true;
+}
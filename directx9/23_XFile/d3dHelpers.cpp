@@ -0,0 +1,134 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: d3dHelpers.cpp
+//
+// Desc: The d3dUtility.h helpers that need neither a window nor a device:
+//       the command line, lights and materials.  Apart from d3dUtility.cpp,
+//       which needs the sample's WndProc, so tools can link them too.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "d3dUtility.h"
+#include <cstring>
+
+// Skips to the next word, or quoted string, on a command line and returns
+// where it ends; length is 0 at the end of the line.
+static const char* NextWord(const char* p, const char** word, int* length)
+{
+	while( *p == ' ' || *p == '\t' )
+		p++;
+
+	if( *p == '"' )
+	{
+		*word = ++p;
+		while( *p && *p != '"' )
+			p++;
+		*length = (int)(p - *word);
+		return *p ? p + 1 : p;
+	}
+
+	*word = p;
+	while( *p && *p != ' ' && *p != '\t' )
+		p++;
+	*length = (int)(p - *word);
+	return p;
+}
+
+bool d3d::FindSwitch(const char* cmdLine, const char* name, char* value, int valueSize)
+{
+	if( !cmdLine || !name || (value && valueSize <= 0) )
+		return false;
+
+	int nameLength = (int)::strlen(name);
+
+	const char* p = cmdLine;
+	while( *p )
+	{
+		const char* word   = 0;
+		int         length = 0;
+		p = NextWord(p, &word, &length);
+
+		if( length != nameLength || ::strncmp(word, name, length) != 0 )
+			continue;
+
+		if( !value )
+			return true;
+
+		p = NextWord(p, &word, &length);
+		if( length == 0 )
+			return false;
+
+		if( length > valueSize - 1 )
+			length = valueSize - 1;
+		::memcpy(value, word, length);
+		value[length] = '\0';
+		return true;
+	}
+	return false;
+}
+
+D3DLIGHT9 d3d::InitDirectionalLight(D3DXVECTOR3* direction, D3DXCOLOR* color)
+{
+	D3DLIGHT9 light;
+	::ZeroMemory(&light, sizeof(light));
+
+	light.Type      = D3DLIGHT_DIRECTIONAL;
+	light.Ambient   = *color * 0.4f;
+	light.Diffuse   = *color;
+	light.Specular  = *color * 0.6f;
+	light.Direction = *direction;
+
+	return light;
+}
+
+D3DLIGHT9 d3d::InitPointLight(D3DXVECTOR3* position, D3DXCOLOR* color)
+{
+	D3DLIGHT9 light;
+	::ZeroMemory(&light, sizeof(light));
+
+	light.Type      = D3DLIGHT_POINT;
+	light.Ambient   = *color * 0.4f;
+	light.Diffuse   = *color;
+	light.Specular  = *color * 0.6f;
+	light.Position  = *position;
+	light.Range        = 1000.0f;
+	light.Falloff      = 1.0f;
+	light.Attenuation0 = 1.0f;
+	light.Attenuation1 = 0.0f;
+	light.Attenuation2 = 0.0f;
+
+	return light;
+}
+
+D3DLIGHT9 d3d::InitSpotLight(D3DXVECTOR3* position, D3DXVECTOR3* direction, D3DXCOLOR* color)
+{
+	D3DLIGHT9 light;
+	::ZeroMemory(&light, sizeof(light));
+
+	light.Type      = D3DLIGHT_SPOT;
+	light.Ambient   = *color * 0.4f;
+	light.Diffuse   = *color;
+	light.Specular  = *color * 0.6f;
+	light.Position  = *position;
+	light.Direction = *direction;
+	light.Range        = 1000.0f;
+	light.Falloff      = 1.0f;
+	light.Attenuation0 = 1.0f;
+	light.Attenuation1 = 0.0f;
+	light.Attenuation2 = 0.0f;
+	light.Theta        = 0.5f;
+	light.Phi          = 0.7f;
+
+	return light;
+}
+
+D3DMATERIAL9 d3d::InitMtrl(D3DXCOLOR a, D3DXCOLOR d, D3DXCOLOR s, D3DXCOLOR e, float p)
+{
+	D3DMATERIAL9 mtrl;
+	mtrl.Ambient  = a;
+	mtrl.Diffuse  = d;
+	mtrl.Specular = s;
+	mtrl.Emissive = e;
+	mtrl.Power    = p;
+	return mtrl;
+}
@@ -34,6 +34,20 @@ namespace d3d
 		WPARAM wParam,
 		LPARAM lParam);
 
+	//
+	// Command line
+	//
+
+	// Looks for the word name, such as "-benchmark", on cmdLine.  If value is
+	// given, the word after name is copied there too, without its quotes and
+	// cut to valueSize - 1 characters, and a name with no word after it is not
+	// found.
+	bool FindSwitch(
+		const char* cmdLine,
+		const char* name,
+		char* value = 0,
+		int valueSize = 0);
+
 	template<class T> void Release(T t)
 	{
 		if( t )
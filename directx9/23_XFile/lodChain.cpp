@@ -0,0 +1,834 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: lodChain.cpp
+//
+// Desc: Level of detail chains cut from a progressive mesh, their error,
+//       and the per instance level selection.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "lodChain.h"
+#include "meshOptimizer.h"
+#include "progressiveMesh.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <emmintrin.h>
+
+namespace
+{
+	// The error grid has about this many cells per triangle, and at most
+	// this many cells along an axis.
+	const float GridCellsPerFace = 1.0f;
+	const int   MaxGridCells     = 128;
+
+	double Now()
+	{
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+	}
+
+	int ResolveThreads(int numThreads)
+	{
+		if( numThreads <= 0 )
+			numThreads = (int)std::thread::hardware_concurrency();
+		if( numThreads <= 0 )
+			numThreads = 1;
+		return numThreads;
+	}
+
+	// Calls body(begin, end) over [0, count) split into numThreads ranges,
+	// the first on the calling thread.
+	template<class Body> void ParallelFor(int count, int numThreads, Body body)
+	{
+		std::vector<std::thread> threads;
+		for(int t = 1; t < numThreads; t++)
+			threads.push_back(std::thread(body, count * t / numThreads, count * (t + 1) / numThreads));
+		body(0, count / numThreads);
+
+		for(int t = 0; t < (int)threads.size(); t++)
+			threads[t].join();
+	}
+
+	const D3DXVECTOR3& PositionOf(const void* vertices, int stride, DWORD index)
+	{
+		return *(const D3DXVECTOR3*)((const BYTE*)vertices + (size_t)index * stride);
+	}
+
+	// The point of triangle abc closest to p, by the Voronoi regions of its
+	// corners and edges (Ericson, Real-Time Collision Detection, 5.1.5).
+	D3DXVECTOR3 ClosestPointOnTriangle(const D3DXVECTOR3& p,
+		const D3DXVECTOR3& a, const D3DXVECTOR3& b, const D3DXVECTOR3& c)
+	{
+		D3DXVECTOR3 ab = b - a, ac = c - a, ap = p - a;
+		float d1 = D3DXVec3Dot(&ab, &ap);
+		float d2 = D3DXVec3Dot(&ac, &ap);
+		if( d1 <= 0.0f && d2 <= 0.0f )
+			return a;
+
+		D3DXVECTOR3 bp = p - b;
+		float d3 = D3DXVec3Dot(&ab, &bp);
+		float d4 = D3DXVec3Dot(&ac, &bp);
+		if( d3 >= 0.0f && d4 <= d3 )
+			return b;
+
+		float vc = d1 * d4 - d3 * d2;
+		if( vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f )
+			return a + ab * (d1 / (d1 - d3));
+
+		D3DXVECTOR3 cp = p - c;
+		float d5 = D3DXVec3Dot(&ab, &cp);
+		float d6 = D3DXVec3Dot(&ac, &cp);
+		if( d6 >= 0.0f && d5 <= d6 )
+			return c;
+
+		float vb = d5 * d2 - d1 * d6;
+		if( vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f )
+			return a + ac * (d2 / (d2 - d6));
+
+		float va = d3 * d6 - d5 * d4;
+		if( va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f )
+			return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+		// inside the face; a degenerate face lands here with a zero sum
+		float sum = va + vb + vc;
+		if( sum <= 0.0f )
+			return a;
+		float v = vb / sum;
+		float w = vc / sum;
+		return a + ab * v + ac * w;
+	}
+
+	// Triangles bucketed into cubic cells by their bounding boxes.
+	struct TriangleGrid
+	{
+		D3DXVECTOR3        origin;
+		float              cellSize;
+		int                dims[3];
+		std::vector<int>   cellStart;   // into faces, one past the last cell too
+		std::vector<DWORD> faces;
+
+		int cellOf(float value, int axis) const
+		{
+			int cell = (int)floorf((value - (&origin.x)[axis]) / cellSize);
+			return cell < 0 ? 0 : (cell >= dims[axis] ? dims[axis] - 1 : cell);
+		}
+	};
+
+	void BuildTriangleGrid(const D3DXVECTOR3& boxMin, const D3DXVECTOR3& boxMax,
+		const void* vertices, int stride, const DWORD* indices, int numFaces, TriangleGrid* grid)
+	{
+		D3DXVECTOR3 extent = boxMax - boxMin;
+		float largest = std::max(extent.x, std::max(extent.y, extent.z));
+		float pad = largest * 0.001f + 1e-6f;
+		extent += D3DXVECTOR3(pad, pad, pad);
+
+		// cubic cells, about GridCellsPerFace of them per face, none
+		// thinner than the flattest axis allows
+		float volume = extent.x * extent.y * extent.z;
+		float cell = powf(volume / (std::max(numFaces, 1) * GridCellsPerFace), 1.0f / 3.0f);
+		cell = std::max(cell, (largest + pad) / MaxGridCells);
+
+		grid->origin   = boxMin;
+		grid->cellSize = cell;
+		for(int axis = 0; axis < 3; axis++)
+			grid->dims[axis] = std::min(MaxGridCells, std::max(1, (int)ceilf((&extent.x)[axis] / cell)));
+
+		int numCells = grid->dims[0] * grid->dims[1] * grid->dims[2];
+		grid->cellStart.assign(numCells + 1, 0);
+
+		// two passes: count each cell's faces, then place them
+		for(int pass = 0; pass < 2; pass++)
+		{
+			if( pass == 1 )
+			{
+				for(int i = 0; i < numCells; i++)
+					grid->cellStart[i + 1] += grid->cellStart[i];
+				grid->faces.resize(grid->cellStart[numCells]);
+			}
+
+			for(int f = 0; f < numFaces; f++)
+			{
+				const D3DXVECTOR3& a = PositionOf(vertices, stride, indices[f * 3 + 0]);
+				const D3DXVECTOR3& b = PositionOf(vertices, stride, indices[f * 3 + 1]);
+				const D3DXVECTOR3& c = PositionOf(vertices, stride, indices[f * 3 + 2]);
+
+				int lo[3], hi[3];
+				for(int axis = 0; axis < 3; axis++)
+				{
+					float x = (&a.x)[axis], y = (&b.x)[axis], z = (&c.x)[axis];
+					lo[axis] = grid->cellOf(std::min(x, std::min(y, z)), axis);
+					hi[axis] = grid->cellOf(std::max(x, std::max(y, z)), axis);
+				}
+
+				for(int k = lo[2]; k <= hi[2]; k++)
+					for(int j = lo[1]; j <= hi[1]; j++)
+						for(int i = lo[0]; i <= hi[0]; i++)
+						{
+							int index = (k * grid->dims[1] + j) * grid->dims[0] + i;
+							if( pass == 0 )
+								grid->cellStart[index + 1]++;
+							else
+								grid->faces[grid->cellStart[index]++] = f;
+						}
+			}
+
+			// placing advanced every start to the next cell's; shift back
+			if( pass == 1 )
+			{
+				for(int i = numCells; i > 0; i--)
+					grid->cellStart[i] = grid->cellStart[i - 1];
+				grid->cellStart[0] = 0;
+			}
+		}
+	}
+
+	// The squared distance from p to the nearest triangle, searching shells
+	// of cells outward from p's cell until no closer triangle can remain.
+	float NearestSquared(const TriangleGrid& grid, const D3DXVECTOR3& p,
+		const void* vertices, int stride, const DWORD* indices)
+	{
+		int center[3];
+		for(int axis = 0; axis < 3; axis++)
+			center[axis] = grid.cellOf((&p.x)[axis], axis);
+
+		int maxRing = std::max(grid.dims[0], std::max(grid.dims[1], grid.dims[2]));
+		float best = FLT_MAX;
+
+		for(int ring = 0; ring <= maxRing; ring++)
+		{
+			int lo[3], hi[3];
+			for(int axis = 0; axis < 3; axis++)
+			{
+				lo[axis] = std::max(0, center[axis] - ring);
+				hi[axis] = std::min(grid.dims[axis] - 1, center[axis] + ring);
+			}
+
+			for(int k = lo[2]; k <= hi[2]; k++)
+				for(int j = lo[1]; j <= hi[1]; j++)
+				{
+					// inside the shell only its two x ends are new
+					bool inner = abs(k - center[2]) < ring && abs(j - center[1]) < ring;
+					int step = inner ? 2 * ring : 1;
+
+					for(int i = center[0] - ring; i <= center[0] + ring; i += step)
+					{
+						if( i < lo[0] || i > hi[0] )
+							continue;
+
+						int index = (k * grid.dims[1] + j) * grid.dims[0] + i;
+						for(int n = grid.cellStart[index]; n < grid.cellStart[index + 1]; n++)
+						{
+							DWORD f = grid.faces[n];
+							D3DXVECTOR3 q = ClosestPointOnTriangle(p,
+								PositionOf(vertices, stride, indices[f * 3 + 0]),
+								PositionOf(vertices, stride, indices[f * 3 + 1]),
+								PositionOf(vertices, stride, indices[f * 3 + 2]));
+							D3DXVECTOR3 d = q - p;
+							best = std::min(best, D3DXVec3LengthSq(&d));
+						}
+					}
+				}
+
+			// anything unvisited is more than ring cells away
+			float reach = ring * grid.cellSize;
+			if( best <= reach * reach )
+				break;
+		}
+
+		return best;
+	}
+}
+
+LodChainStats::LodChainStats()
+{
+	levels     = 0;
+	numThreads = 0;
+	simplifyMs = 0.0f;
+	optimizeMs = 0.0f;
+	errorMs    = 0.0f;
+
+	for(int i = 0; i < MaxLodLevels; i++)
+	{
+		faces[i]  = 0;
+		errors[i] = 0.0f;
+	}
+}
+
+//
+// Building
+//
+
+float MeasureSurfaceDistance(const D3DXVECTOR3* points, int numPoints,
+	const void* vertices, int stride, const DWORD* indices, int numFaces, int numThreads)
+{
+	if( numPoints == 0 || numFaces == 0 )
+		return 0.0f;
+
+	// the grid spans the points too, so every point starts inside it
+	D3DXVECTOR3 boxMin = points[0], boxMax = points[0];
+	for(int i = 1; i < numPoints; i++)
+	{
+		D3DXVec3Minimize(&boxMin, &boxMin, &points[i]);
+		D3DXVec3Maximize(&boxMax, &boxMax, &points[i]);
+	}
+	for(int c = 0; c < numFaces * 3; c++)
+	{
+		D3DXVec3Minimize(&boxMin, &boxMin, &PositionOf(vertices, stride, indices[c]));
+		D3DXVec3Maximize(&boxMax, &boxMax, &PositionOf(vertices, stride, indices[c]));
+	}
+
+	TriangleGrid grid;
+	BuildTriangleGrid(boxMin, boxMax, vertices, stride, indices, numFaces, &grid);
+
+	std::vector<float> distances(numPoints);
+	ParallelFor(numPoints, ResolveThreads(numThreads), [&](int begin, int end)
+	{
+		for(int i = begin; i < end; i++)
+			distances[i] = NearestSquared(grid, points[i], vertices, stride, indices);
+	});
+
+	return sqrtf(*std::max_element(distances.begin(), distances.end()));
+}
+
+bool BuildLodChain(MeshCacheData* data, int maxLevels, float faceRatio, int numThreads,
+	LodChainStats* stats)
+{
+	LodChainStats local;
+	if( !stats )
+		stats = &local;
+	*stats = LodChainStats();
+
+	data->lods.clear();
+	data->lodIndices.clear();
+	data->lodSubsets.clear();
+
+	int numVertices = (int)data->vertices.size();
+	int numFaces    = (int)data->indices.size() / 3;
+	if( numFaces == 0 || faceRatio <= 0.0f || faceRatio >= 1.0f )
+		return false;
+
+	maxLevels = std::min(maxLevels, MaxLodLevels - 1);
+
+	stats->levels     = 1;
+	stats->faces[0]   = numFaces;
+	stats->numThreads = numThreads = ResolveThreads(numThreads);
+
+	if( maxLevels <= 0 )
+		return true;
+
+	std::vector<DWORD> attributes(numFaces);
+	for(int i = 0; i < (int)data->subsets.size(); i++)
+	{
+		const D3DXATTRIBUTERANGE& s = data->subsets[i];
+		for(DWORD f = 0; f < s.FaceCount; f++)
+			attributes[s.FaceStart + f] = s.AttribId;
+	}
+
+	double start = Now();
+
+	int minFaces = std::max(1, (int)(numFaces * pow(faceRatio, maxLevels)));
+
+	ProgressiveMesh pmesh;
+	if( !pmesh.generate(&data->vertices[0], numVertices, MeshCacheVertex::FVF,
+		&data->indices[0], &attributes[0], numFaces, minFaces, numThreads, 0) )
+		return false;
+
+	stats->simplifyMs = (float)(Now() - start);
+
+	std::vector<D3DXVECTOR3> points(numVertices);
+	for(int i = 0; i < numVertices; i++)
+		points[i] = data->vertices[i].position;
+
+	// what OptimizeMesh reads the positions from; the levels never renumber,
+	// so it stays as it is
+	std::vector<BYTE> bytes((BYTE*)&data->vertices[0], (BYTE*)(&data->vertices[0] + numVertices));
+
+	std::vector<DWORD>              indices;
+	std::vector<DWORD>              levelAttributes;
+	std::vector<D3DXATTRIBUTERANGE> subsets;
+
+	int    previous = numFaces;
+	double target   = numFaces;
+	for(int level = 1; level <= maxLevels; level++)
+	{
+		target *= faceRatio;
+		pmesh.setNumFaces((int)target);
+
+		// not worth a level unless it is well short of the last one
+		int faces = pmesh.getNumFaces();
+		if( faces > previous * (1.0f + faceRatio) * 0.5f )
+			break;
+
+		// The live faces of each subset lead its range.
+		indices.clear();
+		levelAttributes.clear();
+		const std::vector<DWORD>& live = pmesh.getIndices();
+		for(int s = 0; s < (int)pmesh.getSubsets().size(); s++)
+		{
+			const D3DXATTRIBUTERANGE& subset = pmesh.getSubsets()[s];
+			indices.insert(indices.end(), live.begin() + subset.FaceStart * 3,
+				live.begin() + (subset.FaceStart + subset.FaceCount) * 3);
+			levelAttributes.insert(levelAttributes.end(), subset.FaceCount, subset.AttribId);
+		}
+
+		// Vertices stay where they are, shared with the other levels.
+		start = Now();
+		if( !OptimizeMesh(&bytes, sizeof(MeshCacheVertex), &indices, &levelAttributes,
+			MeshOptimizeAttributeSort | MeshOptimizeVertexCache | MeshOptimizeOverdraw, numThreads,
+			&subsets, 0) )
+			return false;
+		stats->optimizeMs += (float)(Now() - start);
+
+		faces = (int)indices.size() / 3;
+
+		start = Now();
+		float error = MeasureSurfaceDistance(&points[0], numVertices,
+			&data->vertices[0], sizeof(MeshCacheVertex), &indices[0], faces, numThreads);
+		stats->errorMs += (float)(Now() - start);
+
+		MeshCacheLod lod;
+		lod.numFaces    = (DWORD)faces;
+		lod.indexStart  = (DWORD)data->lodIndices.size();
+		lod.error       = error;
+		lod.firstSubset = (DWORD)data->lodSubsets.size();
+		lod.numSubsets  = (DWORD)subsets.size();
+		data->lods.push_back(lod);
+
+		for(int s = 0; s < (int)subsets.size(); s++)
+		{
+			subsets[s].FaceStart += lod.indexStart / 3;
+			data->lodSubsets.push_back(subsets[s]);
+		}
+		data->lodIndices.insert(data->lodIndices.end(), indices.begin(), indices.end());
+
+		stats->faces[level]  = faces;
+		stats->errors[level] = error;
+		stats->levels        = level + 1;
+
+		previous = faces;
+		if( pmesh.getNumFaces() <= pmesh.getMinFaces() )
+			break;
+	}
+
+	return true;
+}
+
+//
+// LodSelector
+//
+
+LodSelectStats::LodSelectStats()
+{
+	instances = 0;
+	switches  = 0;
+	ms        = 0.0f;
+
+	for(int i = 0; i < MaxLodLevels; i++)
+		counts[i] = 0;
+}
+
+LodSelector::LodSelector()
+{
+	_numLevels    = 1;
+	_radius       = 1.0f;
+	_numInstances = 0;
+
+	for(int i = 0; i < MaxLodLevels; i++)
+		_relativeErrors[i] = 0.0f;
+}
+
+void LodSelector::setLevels(const float* errors, int numLevels, float radius)
+{
+	_numLevels = std::max(1, std::min(numLevels, MaxLodLevels));
+	_radius    = radius;
+
+	float largest = 0.0f;
+	for(int i = 0; i < _numLevels; i++)
+	{
+		largest = std::max(largest, errors[i]);
+		_relativeErrors[i] = radius > 0.0f ? largest / radius : 0.0f;
+	}
+
+	std::fill(_levels.begin(), _levels.end(), 0);
+}
+
+void LodSelector::clear()
+{
+	_numInstances = 0;
+	_x.clear();
+	_y.clear();
+	_z.clear();
+	_scale.clear();
+	_levels.clear();
+}
+
+void LodSelector::grow()
+{
+	// padding instances have no size, so they never reach a real one
+	int padded = (_numInstances + 3) & ~3;
+	_x.resize(padded, 0.0f);
+	_y.resize(padded, 0.0f);
+	_z.resize(padded, 0.0f);
+	_scale.resize(padded, 0.0f);
+	_levels.resize(padded, 0);
+}
+
+int LodSelector::add(const D3DXVECTOR3& center, float scale)
+{
+	int i = _numInstances++;
+	grow();
+	set(i, center, scale);
+	_levels[i] = 0;
+	return i;
+}
+
+void LodSelector::set(int i, const D3DXVECTOR3& center, float scale)
+{
+	_x[i]     = center.x;
+	_y[i]     = center.y;
+	_z[i]     = center.z;
+	_scale[i] = scale;
+}
+
+void LodSelector::count(const std::vector<int>& previous, LodSelectStats* stats) const
+{
+	stats->instances = _numInstances;
+	stats->switches  = 0;
+	for(int i = 0; i < MaxLodLevels; i++)
+		stats->counts[i] = 0;
+
+	for(int i = 0; i < _numInstances; i++)
+	{
+		stats->counts[_levels[i]]++;
+		if( _levels[i] != previous[i] )
+			stats->switches++;
+	}
+}
+
+// The projected radius is r * projection / d, where r is the scaled radius
+// and d the distance from the eye to the nearest point of the sphere; a
+// level's error in pixels is that times its error relative to the radius.
+// Both versions do the same float operations in the same order, so they
+// agree exactly.
+void LodSelector::select(const D3DXVECTOR3& eye, float projection, float thresholdPixels, float hysteresis,
+	LodSelectStats* stats)
+{
+	double start = Now();
+
+	std::vector<int> previous;
+	if( stats )
+		previous = _levels;
+
+	__m128 eyeX    = _mm_set1_ps(eye.x);
+	__m128 eyeY    = _mm_set1_ps(eye.y);
+	__m128 eyeZ    = _mm_set1_ps(eye.z);
+	__m128 radius  = _mm_set1_ps(_radius);
+	__m128 pixels  = _mm_set1_ps(projection);
+	__m128 stay    = _mm_set1_ps(thresholdPixels);
+	__m128 coarsen = _mm_set1_ps(thresholdPixels * (1.0f - hysteresis));
+	__m128 zero    = _mm_setzero_ps();
+
+	__m128  relative[MaxLodLevels];
+	__m128i below[MaxLodLevels];
+	for(int l = 1; l < _numLevels; l++)
+	{
+		relative[l] = _mm_set1_ps(_relativeErrors[l]);
+		below[l]    = _mm_set1_epi32(l - 1);
+	}
+
+	for(int i = 0; i < (int)_levels.size(); i += 4)
+	{
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(&_x[i]), eyeX);
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(&_y[i]), eyeY);
+		__m128 dz = _mm_sub_ps(_mm_loadu_ps(&_z[i]), eyeZ);
+		__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+
+		__m128 r       = _mm_mul_ps(radius, _mm_loadu_ps(&_scale[i]));
+		__m128 d       = _mm_sub_ps(distance, r);
+		__m128 outside = _mm_cmpgt_ps(d, zero);
+		__m128 size    = _mm_div_ps(_mm_mul_ps(r, pixels), d);
+
+		// Errors never shrink with the level, so the good levels are a
+		// prefix and counting them gives the coarsest.
+		__m128i current = _mm_loadu_si128((const __m128i*)&_levels[i]);
+		__m128i level   = _mm_setzero_si128();
+		for(int l = 1; l < _numLevels; l++)
+		{
+			__m128 error = _mm_mul_ps(size, relative[l]);
+			__m128 held  = _mm_castsi128_ps(_mm_cmpgt_epi32(current, below[l]));
+			__m128 limit = _mm_or_ps(_mm_and_ps(held, stay), _mm_andnot_ps(held, coarsen));
+			__m128 good  = _mm_and_ps(_mm_cmple_ps(error, limit), outside);
+			level = _mm_sub_epi32(level, _mm_castps_si128(good));
+		}
+		_mm_storeu_si128((__m128i*)&_levels[i], level);
+	}
+
+	if( stats )
+	{
+		count(previous, stats);
+		stats->ms = (float)(Now() - start);
+	}
+}
+
+void LodSelector::selectScalar(const D3DXVECTOR3& eye, float projection, float thresholdPixels, float hysteresis,
+	LodSelectStats* stats)
+{
+	double start = Now();
+
+	std::vector<int> previous;
+	if( stats )
+		previous = _levels;
+
+	float coarsen = thresholdPixels * (1.0f - hysteresis);
+
+	for(int i = 0; i < _numInstances; i++)
+	{
+		float dx = _x[i] - eye.x;
+		float dy = _y[i] - eye.y;
+		float dz = _z[i] - eye.z;
+		float distance = sqrtf(dx * dx + dy * dy + dz * dz);
+
+		float r = _radius * _scale[i];
+		float d = distance - r;
+
+		int level = 0;
+		if( d > 0.0f )
+		{
+			float size = r * projection / d;
+			for(int l = 1; l < _numLevels; l++)
+			{
+				float limit = _levels[i] >= l ? thresholdPixels : coarsen;
+				if( size * _relativeErrors[l] > limit )
+					break;
+				level = l;
+			}
+		}
+		_levels[i] = level;
+	}
+
+	if( stats )
+	{
+		count(previous, stats);
+		stats->ms = (float)(Now() - start);
+	}
+}
+
+//
+// Benchmark
+//
+
+bool BenchmarkLodSelection(int numInstances, int numFrames, float hysteresis, LodSelectBenchmark* result)
+{
+	if( numInstances <= 0 || numFrames <= 0 )
+		return false;
+
+	// a model of radius 10 whose error doubles with every level
+	const float radius = 10.0f;
+	float errors[6] = { 0.0f, 0.02f, 0.04f, 0.08f, 0.16f, 0.32f };
+
+	// 90 degrees over 480 pixels, as in the sample
+	const float projection = 240.0f;
+	const float threshold  = 1.0f;
+
+	LodSelector simd, scalar, plain;
+	simd.setLevels(errors, 6, radius);
+	scalar.setLevels(errors, 6, radius);
+	plain.setLevels(errors, 6, radius);
+
+	// scattered over a 2000 x 2000 field
+	unsigned seed = 12345;
+	for(int i = 0; i < numInstances; i++)
+	{
+		float v[3];
+		for(int k = 0; k < 3; k++)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			v[k] = (float)(seed >> 8) / 16777216.0f;
+		}
+
+		D3DXVECTOR3 center(v[0] * 2000.0f - 1000.0f, 0.0f, v[1] * 2000.0f - 1000.0f);
+		float scale = 0.5f + v[2] * 1.5f;
+		simd.add(center, scale);
+		scalar.add(center, scale);
+		plain.add(center, scale);
+	}
+
+	result->instances       = numInstances;
+	result->frames          = numFrames;
+	result->simdMs          = 0.0f;
+	result->scalarMs        = 0.0f;
+	result->mismatches      = 0;
+	result->switches        = 0;
+	result->switchesWithout = 0;
+	result->pops            = 0;
+	result->popsWithout     = 0;
+
+	// the level each instance had before its last switch, and its level
+	std::vector<int> left[2], level[2];
+	for(int k = 0; k < 2; k++)
+	{
+		left[k].assign(numInstances, -1);
+		level[k].assign(numInstances, 0);
+	}
+
+	double simdMs = 0.0, scalarMs = 0.0;
+	for(int frame = 0; frame < numFrames; frame++)
+	{
+		// a slow sweep with a small wobble, which is what makes levels pop
+		float t = (float)frame;
+		D3DXVECTOR3 eye(0.0f, 20.0f, 800.0f * sinf(t * 0.002f) + 4.0f * sinf(t * 1.7f));
+
+		double start = Now();
+		simd.select(eye, projection, threshold, hysteresis, 0);
+		simdMs += Now() - start;
+
+		start = Now();
+		scalar.selectScalar(eye, projection, threshold, hysteresis, 0);
+		scalarMs += Now() - start;
+
+		plain.select(eye, projection, threshold, 0.0f, 0);
+
+		for(int i = 0; i < numInstances; i++)
+		{
+			if( simd.getLevel(i) != scalar.getLevel(i) )
+				result->mismatches++;
+
+			for(int k = 0; k < 2; k++)
+			{
+				int now = k == 0 ? simd.getLevel(i) : plain.getLevel(i);
+				if( now == level[k][i] )
+					continue;
+
+				(k == 0 ? result->switches : result->switchesWithout)++;
+				if( now == left[k][i] )
+					(k == 0 ? result->pops : result->popsWithout)++;
+
+				left[k][i]  = level[k][i];
+				level[k][i] = now;
+			}
+		}
+	}
+
+	result->simdMs   = (float)(simdMs / numFrames);
+	result->scalarMs = (float)(scalarMs / numFrames);
+
+	return true;
+}
+
+//
+// LodMesh
+//
+
+LodMesh::LodMesh()
+{
+	_device      = 0;
+	_mesh        = 0;
+	_indexBuffer = 0;
+	_radius      = 0.0f;
+}
+
+LodMesh::~LodMesh()
+{
+	release();
+}
+
+void LodMesh::release()
+{
+	d3d::Release<IDirect3DIndexBuffer9*>(_indexBuffer);
+	_indexBuffer = 0;
+
+	d3d::Release<ID3DXMesh*>(_mesh);
+	_mesh = 0;
+
+	_device = 0;
+	_lods.clear();
+	_subsets.clear();
+}
+
+bool LodMesh::create(IDirect3DDevice9* device, const MeshCacheView& view, ID3DXMesh* mesh)
+{
+	release();
+
+	_device = device;
+	_mesh   = mesh;
+	_mesh->AddRef();
+	_radius = view.getBounds().sphereRadius;
+
+	if( view.getNumLods() == 0 )
+		return true;
+
+	const MeshCacheHeader& header = view.getHeader();
+	UINT size = view.getNumLodIndices() * header.indexSize;
+
+	HRESULT hr = device->CreateIndexBuffer(size, D3DUSAGE_WRITEONLY,
+		header.indexSize == 2 ? D3DFMT_INDEX16 : D3DFMT_INDEX32, D3DPOOL_MANAGED, &_indexBuffer, 0);
+	if( FAILED(hr) )
+	{
+		_indexBuffer = 0;
+		return false;
+	}
+
+	void* indices = 0;
+	if( FAILED(_indexBuffer->Lock(0, 0, &indices, 0)) )
+	{
+		release();
+		return false;
+	}
+	memcpy(indices, view.getLodIndices(), size);
+	_indexBuffer->Unlock();
+
+	_lods.assign(view.getLods(), view.getLods() + view.getNumLods());
+	if( view.getLodSubsets() )
+	{
+		const MeshCacheLod& last = _lods.back();
+		_subsets.assign(view.getLodSubsets(), view.getLodSubsets() + last.firstSubset + last.numSubsets);
+	}
+
+	return true;
+}
+
+int LodMesh::getNumFaces(int level) const
+{
+	if( level == 0 )
+		return _mesh ? (int)_mesh->GetNumFaces() : 0;
+	return (int)_lods[level - 1].numFaces;
+}
+
+HRESULT LodMesh::drawSubset(int level, DWORD attribId)
+{
+	if( !_mesh )
+		return E_FAIL;
+
+	if( level <= 0 || level >= getNumLevels() || !_indexBuffer )
+		return _mesh->DrawSubset(attribId);
+
+	// The level's faces use the mesh's vertex buffer as it is.
+	const MeshCacheLod& lod = _lods[level - 1];
+	HRESULT hr = D3D_OK;
+	for(DWORD i = 0; i < lod.numSubsets; i++)
+	{
+		const D3DXATTRIBUTERANGE& subset = _subsets[lod.firstSubset + i];
+		if( subset.AttribId != attribId || subset.FaceCount == 0 )
+			continue;
+
+		IDirect3DVertexBuffer9* vb = 0;
+		if( FAILED(_mesh->GetVertexBuffer(&vb)) )
+			return E_FAIL;
+
+		_device->SetFVF(_mesh->GetFVF());
+		_device->SetStreamSource(0, vb, 0, _mesh->GetNumBytesPerVertex());
+		_device->SetIndices(_indexBuffer);
+		hr = _device->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, _mesh->GetNumVertices(),
+			subset.FaceStart * 3, subset.FaceCount);
+
+		d3d::Release<IDirect3DVertexBuffer9*>(vb);
+		if( FAILED(hr) )
+			break;
+	}
+	return hr;
+}
@@ -0,0 +1,181 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: lodChain.h
+//
+// Desc: Discrete levels of detail.  BuildLodChain cuts a progressive mesh
+//       at a few face counts, each half the last by default, optimizes each
+//       cut for the vertex cache and measures how far the full detail
+//       surface lies from it.  The levels share the full mesh's vertices,
+//       so they only add index data to a mesh cache file.
+//
+//       LodSelector picks a level for many instances at once: a level is
+//       good enough while its error, projected through the instance's
+//       bounding sphere, stays under a pixel threshold.  Moving to a coarser
+//       level takes a margin below the threshold (hysteresis), so instances
+//       near the boundary do not pop back and forth.  Four instances are
+//       selected at a time with SSE2.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __lodChainH__
+#define __lodChainH__
+
+#include "d3dUtility.h"
+#include "meshCache.h"
+#include <vector>
+
+// levels a mesh may have, full detail included
+const int MaxLodLevels = 8;
+
+struct LodChainStats
+{
+	LodChainStats();
+
+	int   levels;                    // full detail included
+	int   faces[MaxLodLevels];
+	float errors[MaxLodLevels];      // in model units, 0 at full detail
+	int   numThreads;
+
+	float simplifyMs;                // the progressive mesh
+	float optimizeMs;                // vertex cache order of every level
+	float errorMs;                   // the error measurements
+};
+
+// Appends up to maxLevels simplified levels to data->lods, lodIndices and
+// lodSubsets; data->lods[i] is level i + 1, the main index stream level 0.
+// Level k aims at faceRatio^k of the full face count and is dropped when
+// simplification cannot get it well below the level before.  A mesh that
+// does not simplify gets no levels, which is not a failure.
+// numThreads = 0 uses one thread per hardware thread.
+bool BuildLodChain(MeshCacheData* data, int maxLevels, float faceRatio, int numThreads,
+	LodChainStats* stats);
+
+// The furthest any of the numPoints points lies from the triangles, found
+// with a uniform grid over the triangles and a search outward from each
+// point's cell.  Points are measured in parallel.
+float MeasureSurfaceDistance(const D3DXVECTOR3* points, int numPoints,
+	const void* vertices, int stride, const DWORD* indices, int numFaces, int numThreads);
+
+//
+// Selection
+//
+
+struct LodSelectStats
+{
+	LodSelectStats();
+
+	int   instances;
+	int   switches;                  // instances whose level changed
+	int   counts[MaxLodLevels];      // instances per level
+	float ms;
+};
+
+class LodSelector
+{
+public:
+	LodSelector();
+
+	// errors[0..numLevels) in model units, errors[0] normally 0, and the
+	// radius of the model's bounding sphere.  Errors are made
+	// non-decreasing, as selection relies on coarser levels never being
+	// better.
+	void setLevels(const float* errors, int numLevels, float radius);
+
+	void clear();
+
+	// Instances are bounding spheres: a center in world space and the scale
+	// the model is drawn at.  New instances start at level 0.
+	int  add(const D3DXVECTOR3& center, float scale);
+	void set(int i, const D3DXVECTOR3& center, float scale);
+
+	// Picks every instance's level as seen from eye.  projection is the
+	// viewport height over 2 tan(fovY / 2), pixels per unit at distance 1.
+	// An instance takes the coarsest level whose projected error is at most
+	// thresholdPixels, or at most (1 - hysteresis) thresholdPixels for a
+	// level coarser than the one it has; inside its sphere it takes level 0.
+	void select(const D3DXVECTOR3& eye, float projection, float thresholdPixels, float hysteresis,
+		LodSelectStats* stats);
+
+	// One instance at a time, for reference; the same levels as select().
+	void selectScalar(const D3DXVECTOR3& eye, float projection, float thresholdPixels, float hysteresis,
+		LodSelectStats* stats);
+
+	int getNumLevels() const { return _numLevels; }
+	int getNumInstances() const { return _numInstances; }
+	int getLevel(int i) const { return _levels[i]; }
+	const int* getLevels() const { return _levels.empty() ? 0 : &_levels[0]; }
+
+private:
+	int   _numLevels;
+	float _radius;
+	float _relativeErrors[MaxLodLevels];   // error / radius
+
+	// structure of arrays, padded to a multiple of four
+	int _numInstances;
+	std::vector<float> _x, _y, _z, _scale;
+	std::vector<int>   _levels;
+
+	void grow();
+	void count(const std::vector<int>& previous, LodSelectStats* stats) const;
+};
+
+//
+// Headless benchmark: numInstances instances scattered over a field, a
+// camera sweeping back and forth across it for numFrames frames, selected
+// with and without hysteresis.
+//
+
+struct LodSelectBenchmark
+{
+	int   instances;
+	int   frames;
+	float simdMs;                    // per frame
+	float scalarMs;                  // per frame
+	int   mismatches;                // levels select() and selectScalar() disagree on
+	int   switches;                  // over all frames, with hysteresis
+	int   switchesWithout;           // the same, hysteresis 0
+	int   pops;                      // switches back to the level last left
+	int   popsWithout;
+};
+
+bool BenchmarkLodSelection(int numInstances, int numFrames, float hysteresis, LodSelectBenchmark* result);
+
+//
+// Direct3D
+//
+
+// The levels of a mesh cache file on top of the mesh built from it:
+// level 0 is the mesh itself, the others draw the mesh's vertex buffer with
+// an index buffer of their own.
+class LodMesh
+{
+public:
+	LodMesh();
+	~LodMesh();
+
+	// mesh is the one CreateMeshFromCache built from view; it is kept, with
+	// a reference, until release().
+	bool create(IDirect3DDevice9* device, const MeshCacheView& view, ID3DXMesh* mesh);
+	void release();
+
+	int   getNumLevels() const { return (int)_lods.size() + 1; }
+	float getError(int level) const { return level == 0 ? 0.0f : _lods[level - 1].error; }
+	int   getNumFaces(int level) const;
+	float getRadius() const { return _radius; }
+
+	HRESULT drawSubset(int level, DWORD attribId);
+
+private:
+	IDirect3DDevice9*       _device;
+	ID3DXMesh*              _mesh;
+	IDirect3DIndexBuffer9*  _indexBuffer;
+	float                   _radius;
+
+	std::vector<MeshCacheLod>       _lods;
+	std::vector<D3DXATTRIBUTERANGE> _subsets;
+
+	LodMesh(const LodMesh&);
+	LodMesh& operator=(const LodMesh&);
+};
+
+#endif // __lodChainH__
@@ -0,0 +1,42 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: mappedFile.h
+//
+// Desc: A read only view of a whole file, mapped into memory with the Win32
+//       file mapping calls on Windows and with mmap elsewhere.  Needs neither
+//       Direct3D nor windows.h, so the code reading .x and cache files can
+//       be built for tools on any platform.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __mappedFileH__
+#define __mappedFileH__
+
+#include <cstddef>
+
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	// False for a missing or empty file.
+	bool open(const char* fileName);
+	void close();
+
+	const char* getData() const { return _data; }
+	size_t      getSize() const { return _size; }
+
+private:
+#ifdef _WIN32
+	void*       _file;      // HANDLEs; mmap needs no handle once mapped
+	void*       _mapping;
+#endif
+	const char* _data;
+	size_t      _size;
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+};
+
+#endif // __mappedFileH__
@@ -0,0 +1,864 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: meshCache.cpp
+//
+// Desc: A binary mesh file that is used straight from a memory mapping,
+//       and the directory of them kept in step with the .x files.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "meshCache.h"
+#include "lodChain.h"
+#include "meshOptimizer.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+const DWORD MeshCacheVertex::FVF = D3DFVF_XYZ | D3DFVF_NORMAL | D3DFVF_TEX1;
+
+namespace
+{
+	// Bump when BuildMeshCacheData lays meshes out differently, so existing
+	// cache files are rebuilt.
+	const DWORD ConverterVersion = 4;
+
+	const DWORD NoNeighbour = 0xffffffff;
+
+	// Vertices closer than this fraction of the bounding box diagonal, with
+	// normals and texture coordinates within the default tolerances, are
+	// welded before optimizing.
+	const float WeldTolerance = 1e-5f;
+
+	// at most this many sections in a file
+	const DWORD MaxSections = 16;
+
+	double Now()
+	{
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+	}
+
+	DWORD Align16(DWORD offset)
+	{
+		return (offset + 15) & ~15u;
+	}
+
+	struct EdgeRecord
+	{
+		DWORD lo, hi;    // welded vertex ids, lo < hi
+		DWORD slot;      // face * 3 + edge
+		bool  forward;   // runs lo -> hi in its face
+
+		bool operator<(const EdgeRecord& other) const
+		{
+			if( lo != other.lo ) return lo < other.lo;
+			if( hi != other.hi ) return hi < other.hi;
+			return slot < other.slot;
+		}
+	};
+
+	struct PositionLess
+	{
+		const std::vector<MeshCacheVertex>* vertices;
+
+		bool operator()(DWORD a, DWORD b) const
+		{
+			const D3DXVECTOR3& p = (*vertices)[a].position;
+			const D3DXVECTOR3& q = (*vertices)[b].position;
+			if( p.x != q.x ) return p.x < q.x;
+			if( p.y != q.y ) return p.y < q.y;
+			return p.z < q.z;
+		}
+	};
+
+	// The parser keeps to its own types, so it builds without Direct3D.
+	D3DXVECTOR3 ToD3DX(const XFileVector3& v) { return D3DXVECTOR3(v.x, v.y, v.z); }
+	D3DXVECTOR2 ToD3DX(const XFileVector2& v) { return D3DXVECTOR2(v.x, v.y); }
+
+	D3DXMATRIX ToD3DX(const XFileMatrix& m)
+	{
+		// both are sixteen floats, row vectors, rows in order
+		D3DXMATRIX M;
+		memcpy(&M, &m, sizeof(M));
+		return M;
+	}
+
+	D3DCOLORVALUE ToD3DX(const XFileColor& c)
+	{
+		D3DCOLORVALUE color = { c.r, c.g, c.b, c.a };
+		return color;
+	}
+
+	void ToCacheMaterial(const XFileMaterial& material, MeshCacheMaterial* out)
+	{
+		ZeroMemory(&out->mtrl, sizeof(out->mtrl));
+		out->mtrl.Diffuse  = ToD3DX(material.diffuse);
+		out->mtrl.Specular = ToD3DX(material.specular);
+		out->mtrl.Emissive = ToD3DX(material.emissive);
+		out->mtrl.Power    = material.power;
+
+		size_t length = material.textureFilename.size();
+		if( length >= MeshCacheMaterial::MaxTextureName )
+			length = MeshCacheMaterial::MaxTextureName - 1;
+
+		memset(out->textureFilename, 0, sizeof(out->textureFilename));
+		memcpy(out->textureFilename, material.textureFilename.c_str(), length);
+	}
+
+	// Area weighted vertex normals, for meshes stored without any.
+	void SmoothNormals(const XFileMesh& mesh, std::vector<D3DXVECTOR3>* normals)
+	{
+		normals->assign(mesh.positions.size(), D3DXVECTOR3(0.0f, 0.0f, 0.0f));
+
+		for(int t = 0; t < mesh.getNumTriangles(); t++)
+		{
+			DWORD a = mesh.indices[t * 3 + 0];
+			DWORD b = mesh.indices[t * 3 + 1];
+			DWORD c = mesh.indices[t * 3 + 2];
+
+			D3DXVECTOR3 u = ToD3DX(mesh.positions[b]) - ToD3DX(mesh.positions[a]);
+			D3DXVECTOR3 v = ToD3DX(mesh.positions[c]) - ToD3DX(mesh.positions[a]);
+			D3DXVECTOR3 n;
+			D3DXVec3Cross(&n, &u, &v);
+
+			(*normals)[a] += n;
+			(*normals)[b] += n;
+			(*normals)[c] += n;
+		}
+
+		for(int i = 0; i < (int)normals->size(); i++)
+			D3DXVec3Normalize(&(*normals)[i], &(*normals)[i]);
+	}
+}
+
+void MeshCacheData::clear()
+{
+	vertices.clear();
+	indices.clear();
+	subsets.clear();
+	adjacency.clear();
+	materials.clear();
+	lods.clear();
+	lodIndices.clear();
+	lodSubsets.clear();
+	memset(&bounds, 0, sizeof(bounds));
+}
+
+//
+// Building
+//
+
+void BuildAdjacency(MeshCacheData* data)
+{
+	int numVertices = (int)data->vertices.size();
+	int numFaces    = (int)data->indices.size() / 3;
+
+	// Vertices split for their normals still share their edges; weld them
+	// by position first.
+	std::vector<DWORD> order(numVertices);
+	for(int i = 0; i < numVertices; i++)
+		order[i] = i;
+
+	PositionLess less;
+	less.vertices = &data->vertices;
+	std::sort(order.begin(), order.end(), less);
+
+	std::vector<DWORD> welded(numVertices);
+	for(int i = 0; i < numVertices; i++)
+	{
+		if( i > 0 && !less(order[i - 1], order[i]) )
+			welded[order[i]] = welded[order[i - 1]];
+		else
+			welded[order[i]] = order[i];
+	}
+
+	std::vector<EdgeRecord> edges(numFaces * 3);
+	for(int f = 0; f < numFaces; f++)
+	{
+		for(int e = 0; e < 3; e++)
+		{
+			DWORD a = welded[data->indices[f * 3 + e]];
+			DWORD b = welded[data->indices[f * 3 + (e + 1) % 3]];
+
+			EdgeRecord& edge = edges[f * 3 + e];
+			edge.lo      = a < b ? a : b;
+			edge.hi      = a < b ? b : a;
+			edge.slot    = f * 3 + e;
+			edge.forward = a < b;
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+
+	// Within each run of the same edge, pair faces that cross it in
+	// opposite directions; a third face on an edge gets no neighbour.
+	data->adjacency.assign(numFaces * 3, NoNeighbour);
+	for(int begin = 0; begin < (int)edges.size(); )
+	{
+		int end = begin + 1;
+		while( end < (int)edges.size() && edges[end].lo == edges[begin].lo && edges[end].hi == edges[begin].hi )
+			end++;
+
+		for(int i = begin; i < end; i++)
+		{
+			if( edges[i].lo == edges[i].hi || data->adjacency[edges[i].slot] != NoNeighbour )
+				continue;
+
+			for(int j = i + 1; j < end; j++)
+			{
+				if( edges[j].forward == edges[i].forward ||
+					data->adjacency[edges[j].slot] != NoNeighbour ||
+					edges[j].slot / 3 == edges[i].slot / 3 )
+					continue;
+
+				data->adjacency[edges[i].slot] = edges[j].slot / 3;
+				data->adjacency[edges[j].slot] = edges[i].slot / 3;
+				break;
+			}
+		}
+
+		begin = end;
+	}
+}
+
+bool MergeXFileScene(const XFileScene& scene, std::vector<MeshCacheVertex>* vertices,
+	std::vector<DWORD>* indices, std::vector<DWORD>* attributes, std::vector<MeshCacheMaterial>* materials)
+{
+	vertices->clear();
+	indices->clear();
+	attributes->clear();
+	materials->clear();
+
+	// Frames come before their children, so each parent's world transform
+	// is ready when its children need it.
+	std::vector<D3DXMATRIX> world(scene.frames.size());
+	for(int f = 0; f < (int)scene.frames.size(); f++)
+	{
+		const XFileFrame& frame = scene.frames[f];
+		if( frame.parent >= 0 )
+			world[f] = ToD3DX(frame.transform) * world[frame.parent];
+		else
+			world[f] = ToD3DX(frame.transform);
+	}
+
+	std::unordered_map<unsigned long long, DWORD> corners;
+	std::vector<D3DXVECTOR3> smoothNormals;
+
+	for(int m = 0; m < (int)scene.meshes.size(); m++)
+	{
+		const XFileMesh& mesh = scene.meshes[m];
+
+		D3DXMATRIX W, N;
+		if( mesh.frame >= 0 )
+			W = world[mesh.frame];
+		else
+			D3DXMatrixIdentity(&W);
+
+		// normals go through the inverse transpose, for scaled frames
+		D3DXMatrixInverse(&N, 0, &W);
+		D3DXMatrixTranspose(&N, &N);
+
+		DWORD firstMaterial = (DWORD)materials->size();
+		for(int i = 0; i < (int)mesh.materials.size(); i++)
+		{
+			materials->push_back(MeshCacheMaterial());
+			ToCacheMaterial(mesh.materials[i], &materials->back());
+		}
+		if( mesh.materials.empty() )
+		{
+			XFileMaterial white;
+			white.diffuse.r = white.diffuse.g = white.diffuse.b = 1.0f;
+
+			materials->push_back(MeshCacheMaterial());
+			ToCacheMaterial(white, &materials->back());
+		}
+
+		bool indexedNormals = !mesh.normalIndices.empty();
+		if( mesh.normals.empty() )
+		{
+			SmoothNormals(mesh, &smoothNormals);
+			indexedNormals = false;
+		}
+
+		// One vertex per distinct position and normal pair.
+		corners.clear();
+		for(int c = 0; c < (int)mesh.indices.size(); c++)
+		{
+			DWORD p = mesh.indices[c];
+			DWORD n = indexedNormals ? mesh.normalIndices[c] : p;
+
+			unsigned long long key = ((unsigned long long)p << 32) | n;
+			std::unordered_map<unsigned long long, DWORD>::iterator found = corners.find(key);
+			if( found == corners.end() )
+			{
+				D3DXVECTOR3 position = ToD3DX(mesh.positions[p]);
+				D3DXVECTOR3 normal   = mesh.normals.empty() ? smoothNormals[n] : ToD3DX(mesh.normals[n]);
+
+				MeshCacheVertex v;
+				D3DXVec3TransformCoord(&v.position, &position, &W);
+				D3DXVec3TransformNormal(&v.normal, &normal, &N);
+				D3DXVec3Normalize(&v.normal, &v.normal);
+				v.uv = mesh.texCoords.empty() ? D3DXVECTOR2(0.0f, 0.0f) : ToD3DX(mesh.texCoords[p]);
+
+				found = corners.insert(std::make_pair(key, (DWORD)vertices->size())).first;
+				vertices->push_back(v);
+			}
+			indices->push_back(found->second);
+		}
+
+		for(int t = 0; t < mesh.getNumTriangles(); t++)
+			attributes->push_back(firstMaterial + mesh.attributes[t]);
+	}
+
+	return !indices->empty();
+}
+
+bool BuildMeshCacheData(const XFileScene& scene, MeshCacheData* data, MeshWeldStats* weldStats)
+{
+	data->clear();
+
+	std::vector<DWORD> attributes;
+	if( !MergeXFileScene(scene, &data->vertices, &data->indices, &attributes, &data->materials) )
+		return false;
+
+	// Weld the copies along seams and shared borders between meshes, so
+	// the optimizer sees one vertex where the file had several.
+	D3DXVECTOR3 boxMin = data->vertices[0].position, boxMax = boxMin;
+	for(int i = 1; i < (int)data->vertices.size(); i++)
+	{
+		D3DXVec3Minimize(&boxMin, &boxMin, &data->vertices[i].position);
+		D3DXVec3Maximize(&boxMax, &boxMax, &data->vertices[i].position);
+	}
+	D3DXVECTOR3 diagonal = boxMax - boxMin;
+
+	MeshWeldLayout layout;
+	layout.stride       = sizeof(MeshCacheVertex);
+	layout.normalOffset = sizeof(D3DXVECTOR3);
+	layout.uvOffset     = sizeof(D3DXVECTOR3) * 2;
+
+	MeshWeldEpsilons epsilons;
+	epsilons.position = WeldTolerance * D3DXVec3Length(&diagonal);
+
+	int numWelded = 0;
+	if( !WeldVertices(&data->vertices[0], (int)data->vertices.size(), layout,
+		&data->indices[0], (int)data->indices.size(), epsilons, 0, &numWelded, weldStats) )
+		return false;
+	data->vertices.resize(numWelded);
+
+	// Sort by attribute, drop degenerate triangles, order each subset for
+	// the vertex cache and overdraw, and lay the vertices out in the order
+	// the triangles fetch them.
+	std::vector<BYTE> bytes((BYTE*)&data->vertices[0], (BYTE*)(&data->vertices[0] + data->vertices.size()));
+	if( !OptimizeMesh(&bytes, sizeof(MeshCacheVertex), &data->indices, &attributes, MeshOptimizeAll, 0,
+		&data->subsets, 0) )
+		return false;
+	data->vertices.resize(bytes.size() / sizeof(MeshCacheVertex));
+	if( !bytes.empty() )
+		memcpy(&data->vertices[0], &bytes[0], bytes.size());
+
+	if( data->indices.empty() )
+		return false;
+
+	BuildAdjacency(data);
+
+	// bounds
+	MeshCacheBounds& bounds = data->bounds;
+	bounds.boxMin = bounds.boxMax = data->vertices[0].position;
+	for(int i = 1; i < (int)data->vertices.size(); i++)
+	{
+		D3DXVec3Minimize(&bounds.boxMin, &bounds.boxMin, &data->vertices[i].position);
+		D3DXVec3Maximize(&bounds.boxMax, &bounds.boxMax, &data->vertices[i].position);
+	}
+
+	bounds.sphereCenter = (bounds.boxMin + bounds.boxMax) * 0.5f;
+	bounds.sphereRadius = 0.0f;
+	for(int i = 0; i < (int)data->vertices.size(); i++)
+	{
+		D3DXVECTOR3 d = data->vertices[i].position - bounds.sphereCenter;
+		float length = D3DXVec3Length(&d);
+		bounds.sphereRadius = length > bounds.sphereRadius ? length : bounds.sphereRadius;
+	}
+
+	return true;
+}
+
+//
+// Writing
+//
+
+unsigned long long ChecksumMeshSource(const char* data, size_t size)
+{
+	// FNV-1a, a 64 bit word at a time
+	const unsigned long long Prime = 1099511628211ULL;
+
+	unsigned long long hash = 14695981039346656037ULL ^ ConverterVersion;
+
+	size_t i = 0;
+	for( ; i + 8 <= size; i += 8)
+	{
+		unsigned long long word;
+		memcpy(&word, data + i, 8);
+		hash = (hash ^ word) * Prime;
+	}
+	for( ; i < size; i++)
+		hash = (hash ^ (BYTE)data[i]) * Prime;
+
+	return hash ^ size;
+}
+
+bool WriteMeshCache(const char* fileName, const MeshCacheData& data, unsigned long long sourceChecksum)
+{
+	if( data.vertices.empty() || data.indices.empty() )
+		return false;
+
+	DWORD indexSize = data.vertices.size() <= 0xffff ? 2 : 4;
+
+	// The index streams in the size they are stored at.
+	std::vector<BYTE> indices(data.indices.size() * indexSize);
+	std::vector<BYTE> lodIndices(data.lodIndices.size() * indexSize);
+	for(int pass = 0; pass < 2; pass++)
+	{
+		const std::vector<DWORD>& from = pass == 0 ? data.indices : data.lodIndices;
+		std::vector<BYTE>&        to   = pass == 0 ? indices : lodIndices;
+
+		for(int i = 0; i < (int)from.size(); i++)
+		{
+			if( indexSize == 2 )
+			{
+				WORD index = (WORD)from[i];
+				memcpy(&to[i * 2], &index, 2);
+			}
+			else
+			{
+				DWORD index = from[i];
+				memcpy(&to[i * 4], &index, 4);
+			}
+		}
+	}
+
+	struct Block
+	{
+		DWORD       id;
+		const void* data;
+		DWORD       size;
+		DWORD       count;
+	};
+
+	std::vector<Block> blocks;
+	Block block;
+
+	block.id = MeshSectionVertices;   block.data = &data.vertices[0];
+	block.count = (DWORD)data.vertices.size();   block.size = block.count * sizeof(MeshCacheVertex);
+	blocks.push_back(block);
+
+	block.id = MeshSectionIndices;    block.data = &indices[0];
+	block.count = (DWORD)data.indices.size();    block.size = (DWORD)indices.size();
+	blocks.push_back(block);
+
+	block.id = MeshSectionSubsets;    block.data = &data.subsets[0];
+	block.count = (DWORD)data.subsets.size();    block.size = block.count * sizeof(D3DXATTRIBUTERANGE);
+	blocks.push_back(block);
+
+	block.id = MeshSectionAdjacency;  block.data = &data.adjacency[0];
+	block.count = (DWORD)data.adjacency.size();  block.size = block.count * sizeof(DWORD);
+	blocks.push_back(block);
+
+	block.id = MeshSectionMaterials;  block.data = &data.materials[0];
+	block.count = (DWORD)data.materials.size();  block.size = block.count * sizeof(MeshCacheMaterial);
+	blocks.push_back(block);
+
+	block.id = MeshSectionBounds;     block.data = &data.bounds;
+	block.count = 1;                             block.size = sizeof(MeshCacheBounds);
+	blocks.push_back(block);
+
+	if( !data.lods.empty() )
+	{
+		block.id = MeshSectionLods;       block.data = &data.lods[0];
+		block.count = (DWORD)data.lods.size();       block.size = block.count * sizeof(MeshCacheLod);
+		blocks.push_back(block);
+
+		block.id = MeshSectionLodIndices; block.data = lodIndices.empty() ? 0 : &lodIndices[0];
+		block.count = (DWORD)data.lodIndices.size(); block.size = (DWORD)lodIndices.size();
+		blocks.push_back(block);
+
+		block.id = MeshSectionLodSubsets; block.data = data.lodSubsets.empty() ? 0 : &data.lodSubsets[0];
+		block.count = (DWORD)data.lodSubsets.size(); block.size = block.count * sizeof(D3DXATTRIBUTERANGE);
+		blocks.push_back(block);
+	}
+
+	MeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic[0] = 'M'; header.magic[1] = 'S'; header.magic[2] = 'H'; header.magic[3] = 'C';
+	header.version        = MeshCacheVersion;
+	header.sourceChecksum = sourceChecksum;
+	header.fvf            = MeshCacheVertex::FVF;
+	header.vertexSize     = sizeof(MeshCacheVertex);
+	header.indexSize      = indexSize;
+	header.numVertices    = (DWORD)data.vertices.size();
+	header.numFaces       = (DWORD)data.indices.size() / 3;
+	header.numSections    = (DWORD)blocks.size();
+
+	std::vector<MeshCacheSection> sections(blocks.size());
+	DWORD offset = Align16(sizeof(header) + (DWORD)(sections.size() * sizeof(MeshCacheSection)));
+	for(int i = 0; i < (int)blocks.size(); i++)
+	{
+		sections[i].id     = blocks[i].id;
+		sections[i].offset = offset;
+		sections[i].size   = blocks[i].size;
+		sections[i].count  = blocks[i].count;
+		offset = Align16(offset + blocks[i].size);
+	}
+	header.fileSize = offset;
+
+	std::ofstream out(fileName, std::ios_base::binary);
+	if( !out.is_open() )
+		return false;
+
+	const char padding[16] = { 0 };
+
+	out.write((const char*)&header, sizeof(header));
+	out.write((const char*)&sections[0], sections.size() * sizeof(MeshCacheSection));
+
+	DWORD written = sizeof(header) + (DWORD)(sections.size() * sizeof(MeshCacheSection));
+	for(int i = 0; i < (int)blocks.size(); i++)
+	{
+		out.write(padding, sections[i].offset - written);
+		out.write((const char*)blocks[i].data, blocks[i].size);
+		written = sections[i].offset + blocks[i].size;
+	}
+	out.write(padding, header.fileSize - written);
+
+	return !out.fail();
+}
+
+//
+// MeshCacheView
+//
+
+MeshCacheView::MeshCacheView()
+{
+	_header     = 0;
+	_vertices   = 0;
+	_indices    = 0;
+	_subsets    = 0;
+	_adjacency  = 0;
+	_materials  = 0;
+	_bounds     = 0;
+	_lods       = 0;
+	_lodIndices = 0;
+	_lodSubsets = 0;
+	_numSubsets    = 0;
+	_numMaterials  = 0;
+	_numLods       = 0;
+	_numLodIndices = 0;
+}
+
+bool MeshCacheView::open(const char* fileName, unsigned long long sourceChecksum)
+{
+	close();
+
+	if( !_file.open(fileName) )
+		return false;
+
+	if( _file.getSize() < sizeof(MeshCacheHeader) )
+	{
+		close();
+		return false;
+	}
+
+	_header = (const MeshCacheHeader*)_file.getData();
+
+	if( (sourceChecksum != 0 && _header->sourceChecksum != sourceChecksum) || !check() )
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MeshCacheView::close()
+{
+	_file.close();
+
+	_header     = 0;
+	_vertices   = 0;
+	_indices    = 0;
+	_subsets    = 0;
+	_adjacency  = 0;
+	_materials  = 0;
+	_bounds     = 0;
+	_lods       = 0;
+	_lodIndices = 0;
+	_lodSubsets = 0;
+	_numSubsets    = 0;
+	_numMaterials  = 0;
+	_numLods       = 0;
+	_numLodIndices = 0;
+}
+
+const MeshCacheSection* MeshCacheView::findSection(DWORD id) const
+{
+	const MeshCacheSection* sections = (const MeshCacheSection*)(_header + 1);
+	for(DWORD i = 0; i < _header->numSections; i++)
+		if( sections[i].id == id )
+			return &sections[i];
+	return 0;
+}
+
+DWORD MeshCacheView::getIndex(int i) const
+{
+	if( _header->indexSize == 2 )
+		return ((const WORD*)_indices)[i];
+	return ((const DWORD*)_indices)[i];
+}
+
+// Everything the renderer will trust: the header, that every section lies
+// inside the file at its alignment with the size its count implies, and
+// that every index points at something that exists.
+bool MeshCacheView::check()
+{
+	const MeshCacheHeader& h = *_header;
+	const char* base = _file.getData();
+
+	if( h.magic[0] != 'M' || h.magic[1] != 'S' || h.magic[2] != 'H' || h.magic[3] != 'C' ||
+		h.version != MeshCacheVersion || h.fileSize != _file.getSize() ||
+		h.fvf != MeshCacheVertex::FVF || h.vertexSize != sizeof(MeshCacheVertex) ||
+		(h.indexSize != 2 && h.indexSize != 4) || h.numSections > MaxSections ||
+		sizeof(MeshCacheHeader) + h.numSections * sizeof(MeshCacheSection) > h.fileSize )
+		return false;
+
+	const MeshCacheSection* sections = (const MeshCacheSection*)(_header + 1);
+	for(DWORD i = 0; i < h.numSections; i++)
+	{
+		const MeshCacheSection& s = sections[i];
+		if( s.offset % 16 != 0 || s.offset > h.fileSize || s.size > h.fileSize - s.offset )
+			return false;
+	}
+
+	// id, element size
+	const DWORD sizes[][2] =
+	{
+		{ MeshSectionVertices,   sizeof(MeshCacheVertex) },
+		{ MeshSectionIndices,    h.indexSize },
+		{ MeshSectionSubsets,    sizeof(D3DXATTRIBUTERANGE) },
+		{ MeshSectionAdjacency,  sizeof(DWORD) },
+		{ MeshSectionMaterials,  sizeof(MeshCacheMaterial) },
+		{ MeshSectionBounds,     sizeof(MeshCacheBounds) },
+		{ MeshSectionLods,       sizeof(MeshCacheLod) },
+		{ MeshSectionLodIndices, h.indexSize },
+		{ MeshSectionLodSubsets, sizeof(D3DXATTRIBUTERANGE) }
+	};
+
+	const MeshCacheSection* found[9];
+	for(int i = 0; i < 9; i++)
+	{
+		found[i] = findSection(sizes[i][0]);
+		if( found[i] && (unsigned long long)found[i]->count * sizes[i][1] != found[i]->size )
+			return false;
+		if( !found[i] && i < 6 )
+			return false;
+	}
+
+	if( found[0]->count != h.numVertices || found[1]->count != h.numFaces * 3 ||
+		found[3]->count != h.numFaces * 3 || found[5]->count != 1 ||
+		h.numVertices == 0 || h.numFaces == 0 )
+		return false;
+
+	_vertices     = (const MeshCacheVertex*)(base + found[0]->offset);
+	_indices      = base + found[1]->offset;
+	_subsets      = (const D3DXATTRIBUTERANGE*)(base + found[2]->offset);
+	_adjacency    = (const DWORD*)(base + found[3]->offset);
+	_materials    = (const MeshCacheMaterial*)(base + found[4]->offset);
+	_bounds       = (const MeshCacheBounds*)(base + found[5]->offset);
+	_numSubsets   = (int)found[2]->count;
+	_numMaterials = (int)found[4]->count;
+
+	for(int i = 0; i < (int)h.numFaces * 3; i++)
+		if( getIndex(i) >= h.numVertices )
+			return false;
+
+	for(int i = 0; i < (int)h.numFaces * 3; i++)
+		if( _adjacency[i] != NoNeighbour && _adjacency[i] >= h.numFaces )
+			return false;
+
+	for(int i = 0; i < _numSubsets; i++)
+	{
+		const D3DXATTRIBUTERANGE& s = _subsets[i];
+		if( s.AttribId >= (DWORD)_numMaterials || s.FaceStart > h.numFaces || s.FaceCount > h.numFaces - s.FaceStart )
+			return false;
+	}
+
+	for(int i = 0; i < _numMaterials; i++)
+		if( memchr(_materials[i].textureFilename, 0, MeshCacheMaterial::MaxTextureName) == 0 )
+			return false;
+
+	if( found[6] )
+	{
+		if( !found[7] || !found[8] )
+			return false;
+
+		_lods          = (const MeshCacheLod*)(base + found[6]->offset);
+		_lodIndices    = base + found[7]->offset;
+		_lodSubsets    = (const D3DXATTRIBUTERANGE*)(base + found[8]->offset);
+		_numLods       = (int)found[6]->count;
+		_numLodIndices = (int)found[7]->count;
+
+		DWORD numLodIndices = found[7]->count;
+		DWORD numLodSubsets = found[8]->count;
+		for(int i = 0; i < _numLods; i++)
+		{
+			const MeshCacheLod& lod = _lods[i];
+			if( lod.indexStart % 3 != 0 || lod.indexStart > numLodIndices || lod.numFaces > (numLodIndices - lod.indexStart) / 3 ||
+				lod.firstSubset > numLodSubsets || lod.numSubsets > numLodSubsets - lod.firstSubset )
+				return false;
+
+			// a level's subsets stay within its own faces
+			DWORD faceStart = lod.indexStart / 3;
+			for(DWORD j = 0; j < lod.numSubsets; j++)
+			{
+				const D3DXATTRIBUTERANGE& s = _lodSubsets[lod.firstSubset + j];
+				if( s.AttribId >= (DWORD)_numMaterials || s.FaceStart < faceStart ||
+					s.FaceStart - faceStart > lod.numFaces || s.FaceCount > lod.numFaces - (s.FaceStart - faceStart) )
+					return false;
+			}
+		}
+
+		for(DWORD i = 0; i < numLodIndices; i++)
+		{
+			DWORD index = h.indexSize == 2 ? ((const WORD*)_lodIndices)[i] : ((const DWORD*)_lodIndices)[i];
+			if( index >= h.numVertices )
+				return false;
+		}
+	}
+
+	return true;
+}
+
+//
+// MeshCache
+//
+
+MeshCacheStats::MeshCacheStats()
+{
+	hit        = false;
+	checksumMs = 0.0f;
+	convertMs  = 0.0f;
+	openMs     = 0.0f;
+}
+
+MeshCache::MeshCache(const char* directory)
+{
+	_directory = directory;
+	::CreateDirectory(directory, 0);
+}
+
+std::string MeshCache::getCacheFileName(const char* sourceFile) const
+{
+	const char* name = sourceFile;
+	for(const char* p = sourceFile; *p; p++)
+		if( *p == '/' || *p == '\\' )
+			name = p + 1;
+
+	return _directory + "/" + name + ".mshc";
+}
+
+bool MeshCache::load(const char* sourceFile, MeshCacheView* view, MeshCacheStats* stats)
+{
+	MeshCacheStats local;
+	if( !stats )
+		stats = &local;
+	*stats = MeshCacheStats();
+
+	double start = Now();
+
+	MappedFile source;
+	if( !source.open(sourceFile) )
+		return false;
+
+	unsigned long long checksum = ChecksumMeshSource(source.getData(), source.getSize());
+	stats->checksumMs = (float)(Now() - start);
+
+	std::string cacheFile = getCacheFileName(sourceFile);
+
+	start = Now();
+	if( view->open(cacheFile.c_str(), checksum) )
+	{
+		stats->hit    = true;
+		stats->openMs = (float)(Now() - start);
+		return true;
+	}
+
+	// Missing, damaged or stale: convert the source again.
+	XFileScene    scene;
+	MeshCacheData data;
+	if( !ParseXFile(source.getData(), source.getSize(), &scene, 0, 0) ||
+		!BuildMeshCacheData(scene, &data, &stats->weld) ||
+		!BuildLodChain(&data, MaxLodLevels, 0.5f, 0, 0) ||
+		!WriteMeshCache(cacheFile.c_str(), data, checksum) )
+		return false;
+	stats->convertMs = (float)(Now() - start);
+
+	start = Now();
+	bool ok = view->open(cacheFile.c_str(), checksum);
+	stats->openMs = (float)(Now() - start);
+
+	return ok;
+}
+
+//
+// Direct3D
+//
+
+bool CreateMeshFromCache(IDirect3DDevice9* device, const MeshCacheView& view, ID3DXMesh** mesh)
+{
+	const MeshCacheHeader& header = view.getHeader();
+
+	DWORD options = D3DXMESH_MANAGED;
+	if( header.indexSize == 4 )
+		options |= D3DXMESH_32BIT;
+
+	*mesh = 0;
+	HRESULT hr = D3DXCreateMeshFVF(header.numFaces, header.numVertices, options, header.fvf, device, mesh);
+	if( FAILED(hr) )
+		return false;
+
+	void*  vertices   = 0;
+	void*  indices    = 0;
+	DWORD* attributes = 0;
+
+	bool ok = false;
+	if( SUCCEEDED((*mesh)->LockVertexBuffer(0, &vertices)) )
+	{
+		memcpy(vertices, view.getVertices(), header.numVertices * sizeof(MeshCacheVertex));
+		(*mesh)->UnlockVertexBuffer();
+
+		if( SUCCEEDED((*mesh)->LockIndexBuffer(0, &indices)) )
+		{
+			memcpy(indices, view.getIndices(), header.numFaces * 3 * header.indexSize);
+			(*mesh)->UnlockIndexBuffer();
+
+			if( SUCCEEDED((*mesh)->LockAttributeBuffer(0, &attributes)) )
+			{
+				for(int i = 0; i < view.getNumSubsets(); i++)
+				{
+					const D3DXATTRIBUTERANGE& subset = view.getSubsets()[i];
+					for(DWORD f = 0; f < subset.FaceCount; f++)
+						attributes[subset.FaceStart + f] = subset.AttribId;
+				}
+				(*mesh)->UnlockAttributeBuffer();
+
+				ok = SUCCEEDED((*mesh)->SetAttributeTable(view.getSubsets(), view.getNumSubsets()));
+			}
+		}
+	}
+
+	if( !ok )
+	{
+		d3d::Release<ID3DXMesh*>(*mesh);
+		*mesh = 0;
+	}
+
+	return ok;
+}
@@ -0,0 +1,250 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: meshCache.h
+//
+// Desc: A binary mesh file holding what the samples otherwise rebuild on
+//       every launch: the optimized vertex and index streams, the attribute
+//       table, adjacency, materials, bounds and, optionally, levels of
+//       detail.  Every section starts on a 16 byte boundary, so a mapped
+//       file is used where it lies, without copying or parsing.
+//
+//       MeshCache keeps one such file per .x file, named after it, and
+//       rebuilds it from the .x file whenever the .x file's checksum no
+//       longer matches the one stored in it.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __meshCacheH__
+#define __meshCacheH__
+
+#include "d3dUtility.h"
+#include "meshWeld.h"
+#include "xfileParser.h"
+#include <string>
+#include <vector>
+
+//
+// File layout: a MeshCacheHeader, then numSections MeshCacheSections, then
+// the sections themselves.
+//
+
+const DWORD MeshCacheVersion = 2;
+
+enum MeshCacheSectionId
+{
+	MeshSectionVertices = 1,   // MeshCacheVertex[numVertices]
+	MeshSectionIndices,        // WORD or DWORD (indexSize) [numFaces * 3]
+	MeshSectionSubsets,        // D3DXATTRIBUTERANGE[count]
+	MeshSectionAdjacency,      // DWORD[numFaces * 3], 0xffffffff where there is no neighbour
+	MeshSectionMaterials,      // MeshCacheMaterial[count]
+	MeshSectionBounds,         // MeshCacheBounds
+	MeshSectionLods,           // MeshCacheLod[count], optional
+	MeshSectionLodIndices,     // indexSize [count], optional
+	MeshSectionLodSubsets      // D3DXATTRIBUTERANGE[count], optional
+};
+
+struct MeshCacheHeader
+{
+	char               magic[4];         // "MSHC"
+	DWORD              version;
+	unsigned long long sourceChecksum;   // of the .x file, see ChecksumMeshSource
+	DWORD              fileSize;
+	DWORD              fvf;
+	DWORD              vertexSize;
+	DWORD              indexSize;        // 2 or 4
+	DWORD              numVertices;
+	DWORD              numFaces;
+	DWORD              numSections;
+	DWORD              reserved;
+};
+
+struct MeshCacheSection
+{
+	DWORD id;
+	DWORD offset;   // from the start of the file, a multiple of 16
+	DWORD size;     // bytes
+	DWORD count;    // elements
+};
+
+struct MeshCacheVertex
+{
+	D3DXVECTOR3 position;
+	D3DXVECTOR3 normal;
+	D3DXVECTOR2 uv;
+
+	static const DWORD FVF;
+};
+
+struct MeshCacheMaterial
+{
+	enum { MaxTextureName = 128 };
+
+	D3DMATERIAL9 mtrl;
+	char         textureFilename[MaxTextureName];   // empty for none
+};
+
+struct MeshCacheBounds
+{
+	D3DXVECTOR3 boxMin;
+	D3DXVECTOR3 boxMax;
+	D3DXVECTOR3 sphereCenter;
+	float       sphereRadius;
+};
+
+// One level of detail: numFaces triangles whose indices start at
+// indexStart in the LOD index section, over the same vertices, drawn as
+// numSubsets attribute ranges starting at firstSubset in the LOD subset
+// section.  Those ranges count faces from the start of the LOD index
+// section.  error is the furthest any full detail vertex lies from the
+// level's surface, in model units.
+struct MeshCacheLod
+{
+	DWORD numFaces;
+	DWORD indexStart;
+	float error;
+	DWORD firstSubset;
+	DWORD numSubsets;
+};
+
+//
+// A mesh on its way to a cache file.
+//
+
+struct MeshCacheData
+{
+	std::vector<MeshCacheVertex>    vertices;
+	std::vector<DWORD>              indices;
+	std::vector<D3DXATTRIBUTERANGE> subsets;
+	std::vector<DWORD>              adjacency;
+	std::vector<MeshCacheMaterial>  materials;
+	MeshCacheBounds                 bounds;
+	std::vector<MeshCacheLod>       lods;
+	std::vector<DWORD>              lodIndices;
+	std::vector<D3DXATTRIBUTERANGE> lodSubsets;
+
+	void clear();
+};
+
+// Merges every mesh in the scene into one, the way D3DXLoadMeshFromX does:
+// each placed by its frame's transform, vertices split where a position
+// has more than one normal, materials appended in order.  attributes gets
+// each triangle's material.  False if the scene has no triangles.
+bool MergeXFileScene(const XFileScene& scene, std::vector<MeshCacheVertex>* vertices,
+	std::vector<DWORD>* indices, std::vector<DWORD>* attributes, std::vector<MeshCacheMaterial>* materials);
+
+// Merges the scene with MergeXFileScene, then welds the copies of a
+// vertex, optimizes it with OptimizeMesh, which also fills in the
+// attribute table, and adds adjacency and bounds.  weldStats may be null.
+bool BuildMeshCacheData(const XFileScene& scene, MeshCacheData* data, MeshWeldStats* weldStats);
+
+// Adjacency for data's indices, with vertices that share a position
+// treated as one.
+void BuildAdjacency(MeshCacheData* data);
+
+bool WriteMeshCache(const char* fileName, const MeshCacheData& data, unsigned long long sourceChecksum);
+
+// The checksum a cache file is keyed on: the source bytes and the version
+// of the code that converts them, so either changing rebuilds the file.
+unsigned long long ChecksumMeshSource(const char* data, size_t size);
+
+//
+// A cache file mapped into memory.  The pointers point into the mapping
+// and are valid until close().
+//
+
+class MeshCacheView
+{
+public:
+	MeshCacheView();
+
+	// Maps and checks the file.  A sourceChecksum other than 0 must match
+	// the one the file was written with.
+	bool open(const char* fileName, unsigned long long sourceChecksum);
+	void close();
+
+	bool isOpen() const { return _header != 0; }
+
+	const MeshCacheHeader&    getHeader() const { return *_header; }
+	const MeshCacheVertex*    getVertices() const { return _vertices; }
+	const void*               getIndices() const { return _indices; }
+	const D3DXATTRIBUTERANGE* getSubsets() const { return _subsets; }
+	const DWORD*              getAdjacency() const { return _adjacency; }
+	const MeshCacheMaterial*  getMaterials() const { return _materials; }
+	const MeshCacheBounds&    getBounds() const { return *_bounds; }
+	const MeshCacheLod*       getLods() const { return _lods; }
+	const void*               getLodIndices() const { return _lodIndices; }
+	const D3DXATTRIBUTERANGE* getLodSubsets() const { return _lodSubsets; }
+
+	int getNumVertices() const { return (int)_header->numVertices; }
+	int getNumFaces() const { return (int)_header->numFaces; }
+	int getNumSubsets() const { return _numSubsets; }
+	int getNumMaterials() const { return _numMaterials; }
+	int getNumLods() const { return _numLods; }
+	int getNumLodIndices() const { return _numLodIndices; }
+
+	// The index of the ith index; the stream is 16 or 32 bits.
+	DWORD getIndex(int i) const;
+
+private:
+	MappedFile _file;
+
+	const MeshCacheHeader*    _header;
+	const MeshCacheVertex*    _vertices;
+	const void*               _indices;
+	const D3DXATTRIBUTERANGE* _subsets;
+	const DWORD*              _adjacency;
+	const MeshCacheMaterial*  _materials;
+	const MeshCacheBounds*    _bounds;
+	const MeshCacheLod*       _lods;
+	const void*               _lodIndices;
+	const D3DXATTRIBUTERANGE* _lodSubsets;
+	int _numSubsets;
+	int _numMaterials;
+	int _numLods;
+	int _numLodIndices;
+
+	bool check();
+	const MeshCacheSection* findSection(DWORD id) const;
+
+	MeshCacheView(const MeshCacheView&);
+	MeshCacheView& operator=(const MeshCacheView&);
+};
+
+//
+// The cache directory.
+//
+
+struct MeshCacheStats
+{
+	MeshCacheStats();
+
+	bool  hit;          // the cache file was current
+	float checksumMs;   // reading and checksumming the .x file
+	float convertMs;    // parsing, optimizing and writing on a miss
+	float openMs;       // mapping and checking the cache file
+
+	MeshWeldStats weld; // on a miss
+};
+
+class MeshCache
+{
+public:
+	// Cache files go in directory, which is created if it is missing.
+	explicit MeshCache(const char* directory);
+
+	// Maps the cache file for sourceFile into view, converting sourceFile
+	// first if the cache file is missing, damaged or out of date.
+	bool load(const char* sourceFile, MeshCacheView* view, MeshCacheStats* stats);
+
+	std::string getCacheFileName(const char* sourceFile) const;
+
+private:
+	std::string _directory;
+};
+
+// Creates a managed mesh from a mapped cache file, with its attribute
+// table set so it needs no optimizing, and the materials and texture names
+// in the order of the attribute ids.
+bool CreateMeshFromCache(IDirect3DDevice9* device, const MeshCacheView& view, ID3DXMesh** mesh);
+
+#endif // __meshCacheH__
@@ -0,0 +1,998 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: meshOptimizer.cpp
+//
+// Desc: An in-tree replacement for ID3DXMesh::OptimizeInplace, with
+//       overdraw and vertex fetch ordering added.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "meshOptimizer.h"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cstring>
+#include <thread>
+
+namespace
+{
+	// Subsets larger than this are cut into pieces of this many triangles,
+	// which spreads a big subset over the threads and keeps each piece's
+	// working set small enough to stay in the CPU caches.  Seams between
+	// pieces cost a few vertex cache misses each.
+	const int MaxTaskTriangles = 1 << 18;
+
+	// A cluster ends once its cache miss ratio comes within this factor of
+	// the ratio of the run it was cut from (Sander et al.'s lambda).
+	const float OverdrawThreshold = 1.05f;
+
+	// depth buffer size for AnalyzeOverdraw
+	const int OverdrawGrid = 256;
+
+	const DWORD Unused = 0xffffffff;
+
+	double Now()
+	{
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+	}
+
+	int ResolveThreads(int numThreads)
+	{
+		if( numThreads <= 0 )
+			numThreads = (int)std::thread::hardware_concurrency();
+		if( numThreads <= 0 )
+			numThreads = 1;
+		return numThreads;
+	}
+
+	const D3DXVECTOR3& PositionOf(const void* vertices, int stride, DWORD index)
+	{
+		return *(const D3DXVECTOR3*)((const BYTE*)vertices + (size_t)index * stride);
+	}
+
+	// A run of triangles optimized on its own: a subset or a piece of one.
+	struct Task
+	{
+		int faceStart;
+		int faceCount;
+
+		bool operator<(const Task& other) const { return faceCount > other.faceCount; }
+	};
+
+	// Per thread working memory, sized for the largest task it meets.
+	struct Scratch
+	{
+		std::vector<int>   localOf;      // global vertex -> local, -1 when not in the task
+		std::vector<DWORD> globalOf;     // local vertex -> global
+		std::vector<int>   corners;      // local vertex of each corner
+		std::vector<int>   adjacencyStart;
+		std::vector<int>   adjacency;    // triangles around each local vertex
+		std::vector<int>   live;         // triangles not yet emitted around each vertex
+		std::vector<int>   cacheTime;
+		std::vector<int>   deadEnd;
+		std::vector<int>   candidates;
+		std::vector<BYTE>  emitted;
+		std::vector<int>   order;        // triangles in their new order
+		std::vector<int>   clusters;     // first triangle of each cluster in order
+		std::vector<float> clusterKeys;
+		std::vector<int>   clusterOrder;
+		std::vector<DWORD> triangles;    // the task's indices, rearranged
+	};
+
+	//
+	// Tipsify: fan around a vertex, then move to the neighbour that will
+	// still be in the cache, or back to a recent vertex with triangles left.
+	//
+	void Tipsify(const DWORD* indices, int numTriangles, int numVertices, Scratch& s)
+	{
+		// -1 throughout between calls; only the first call fills it
+		if( (int)s.localOf.size() < numVertices )
+			s.localOf.resize(numVertices, -1);
+
+		// local vertices, numbered by first use so vertex 0 starts the walk
+		int numLocal = 0;
+		s.corners.resize(numTriangles * 3);
+		for(int c = 0; c < numTriangles * 3; c++)
+		{
+			DWORD v = indices[c];
+			if( s.localOf[v] < 0 )
+			{
+				s.localOf[v] = numLocal++;
+				s.globalOf.push_back(v);
+			}
+			s.corners[c] = s.localOf[v];
+		}
+
+		s.adjacencyStart.assign(numLocal + 1, 0);
+		for(int c = 0; c < numTriangles * 3; c++)
+			s.adjacencyStart[s.corners[c] + 1]++;
+		for(int v = 0; v < numLocal; v++)
+			s.adjacencyStart[v + 1] += s.adjacencyStart[v];
+
+		s.live.resize(numLocal);
+		for(int v = 0; v < numLocal; v++)
+			s.live[v] = s.adjacencyStart[v + 1] - s.adjacencyStart[v];
+
+		s.adjacency.resize(numTriangles * 3);
+		s.cacheTime.assign(numLocal, 0);   // used as a fill cursor first
+		for(int c = 0; c < numTriangles * 3; c++)
+		{
+			int v = s.corners[c];
+			s.adjacency[s.adjacencyStart[v] + s.cacheTime[v]++] = c / 3;
+		}
+
+		s.cacheTime.assign(numLocal, 0);
+		s.emitted.assign(numTriangles, 0);
+		s.deadEnd.clear();
+		s.order.clear();
+
+		int stamp  = MeshCacheSize + 1;
+		int cursor = 0;
+		int fan    = numLocal > 0 ? 0 : -1;
+
+		while( fan >= 0 )
+		{
+			s.candidates.clear();
+
+			for(int k = s.adjacencyStart[fan]; k < s.adjacencyStart[fan + 1]; k++)
+			{
+				int t = s.adjacency[k];
+				if( s.emitted[t] )
+					continue;
+
+				for(int c = 0; c < 3; c++)
+				{
+					int v = s.corners[t * 3 + c];
+					s.deadEnd.push_back(v);
+					s.candidates.push_back(v);
+					s.live[v]--;
+					if( stamp - s.cacheTime[v] > MeshCacheSize )
+						s.cacheTime[v] = stamp++;
+				}
+
+				s.emitted[t] = 1;
+				s.order.push_back(t);
+			}
+
+			// The candidate that will still be cached once its remaining
+			// triangles are emitted, the one that entered the cache first.
+			int best = -1, bestPriority = -1;
+			for(int i = 0; i < (int)s.candidates.size(); i++)
+			{
+				int v = s.candidates[i];
+				if( s.live[v] <= 0 )
+					continue;
+
+				int priority = 0;
+				if( stamp - s.cacheTime[v] + 2 * s.live[v] <= MeshCacheSize )
+					priority = stamp - s.cacheTime[v];
+
+				if( priority > bestPriority )
+				{
+					bestPriority = priority;
+					best         = v;
+				}
+			}
+
+			if( best < 0 )
+			{
+				while( !s.deadEnd.empty() && best < 0 )
+				{
+					int v = s.deadEnd.back();
+					s.deadEnd.pop_back();
+					if( s.live[v] > 0 )
+						best = v;
+				}
+
+				for( ; cursor < numLocal && best < 0; cursor++)
+					if( s.live[cursor] > 0 )
+						best = cursor;
+			}
+
+			fan = best;
+		}
+
+		for(int v = 0; v < numLocal; v++)
+			s.localOf[s.globalOf[v]] = -1;
+		s.globalOf.clear();
+	}
+
+	// Cache misses for one triangle of a FIFO cache simulated by time
+	// stamps.
+	int CacheMisses(const int* corners, std::vector<int>& cacheTime, int* stamp)
+	{
+		int misses = 0;
+		for(int c = 0; c < 3; c++)
+		{
+			int v = corners[c];
+			if( *stamp - cacheTime[v] > MeshCacheSize )
+			{
+				cacheTime[v] = (*stamp)++;
+				misses++;
+			}
+		}
+		return misses;
+	}
+
+	//
+	// Overdraw: cut the cache ordered triangles into clusters and draw the
+	// clusters facing away from the centre first (Sander et al. 2007).
+	//
+	void OrderClusters(const void* vertices, int stride, const DWORD* indices, Scratch& s)
+	{
+		int numTriangles = (int)s.order.size();
+		int numLocal     = (int)s.live.size();
+
+		// Hard boundaries: wherever all three vertices miss, the walk
+		// jumped.  Soft ones split a run where its miss ratio so far has
+		// come down to near the run's overall ratio.
+		s.clusters.clear();
+
+		std::vector<int>& cacheTime = s.cacheTime;
+		cacheTime.assign(numLocal, 0);
+		int stamp = MeshCacheSize + 1;
+
+		std::vector<int> hard;
+		for(int i = 0; i < numTriangles; i++)
+			if( CacheMisses(&s.corners[s.order[i] * 3], cacheTime, &stamp) == 3 || i == 0 )
+				hard.push_back(i);
+		hard.push_back(numTriangles);
+
+		for(int h = 0; h + 1 < (int)hard.size(); h++)
+		{
+			int begin = hard[h], end = hard[h + 1];
+
+			stamp += MeshCacheSize + 1;
+			int misses = 0;
+			for(int i = begin; i < end; i++)
+				misses += CacheMisses(&s.corners[s.order[i] * 3], cacheTime, &stamp);
+			float threshold = OverdrawThreshold * misses / (end - begin);
+
+			s.clusters.push_back(begin);
+			stamp += MeshCacheSize + 1;
+
+			int runMisses = 0, runTriangles = 0;
+			for(int i = begin; i < end; i++)
+			{
+				runMisses += CacheMisses(&s.corners[s.order[i] * 3], cacheTime, &stamp);
+				runTriangles++;
+
+				if( (float)runMisses / runTriangles <= threshold && i + 1 < end )
+				{
+					s.clusters.push_back(i + 1);
+					stamp += MeshCacheSize + 1;
+					runMisses = runTriangles = 0;
+				}
+			}
+		}
+
+		int numClusters = (int)s.clusters.size();
+		s.clusters.push_back(numTriangles);
+
+		// area weighted centroid and normal of each cluster and of the task
+		std::vector<D3DXVECTOR3> centroids(numClusters), normals(numClusters);
+		D3DXVECTOR3 center(0.0f, 0.0f, 0.0f);
+		float totalArea = 0.0f;
+
+		for(int k = 0; k < numClusters; k++)
+		{
+			D3DXVECTOR3 centroid(0.0f, 0.0f, 0.0f), normal(0.0f, 0.0f, 0.0f);
+			float area = 0.0f;
+
+			for(int i = s.clusters[k]; i < s.clusters[k + 1]; i++)
+			{
+				const DWORD* tri = &indices[s.order[i] * 3];
+				const D3DXVECTOR3& a = PositionOf(vertices, stride, tri[0]);
+				const D3DXVECTOR3& b = PositionOf(vertices, stride, tri[1]);
+				const D3DXVECTOR3& c = PositionOf(vertices, stride, tri[2]);
+
+				D3DXVECTOR3 n, u = b - a, v = c - a;
+				D3DXVec3Cross(&n, &u, &v);
+				float twiceArea = D3DXVec3Length(&n);
+
+				centroid += (a + b + c) * (twiceArea / 3.0f);
+				normal   += n;
+				area     += twiceArea;
+			}
+
+			center    += centroid;
+			totalArea += area;
+
+			centroids[k] = area > 0.0f ? centroid / area : PositionOf(vertices, stride, indices[s.order[s.clusters[k]] * 3]);
+			D3DXVec3Normalize(&normals[k], &normal);
+		}
+		if( totalArea > 0.0f )
+			center /= totalArea;
+
+		s.clusterKeys.resize(numClusters);
+		s.clusterOrder.resize(numClusters);
+		for(int k = 0; k < numClusters; k++)
+		{
+			D3DXVECTOR3 d = centroids[k] - center;
+			s.clusterKeys[k]  = D3DXVec3Dot(&d, &normals[k]);
+			s.clusterOrder[k] = k;
+		}
+
+		struct KeyGreater
+		{
+			const std::vector<float>* keys;
+			bool operator()(int a, int b) const { return (*keys)[a] > (*keys)[b]; }
+		};
+		KeyGreater greater;
+		greater.keys = &s.clusterKeys;
+		std::stable_sort(s.clusterOrder.begin(), s.clusterOrder.end(), greater);
+
+		std::vector<int> order;
+		order.reserve(numTriangles);
+		for(int k = 0; k < numClusters; k++)
+		{
+			int c = s.clusterOrder[k];
+			for(int i = s.clusters[c]; i < s.clusters[c + 1]; i++)
+				order.push_back(s.order[i]);
+		}
+		s.order.swap(order);
+	}
+
+	struct OptimizeJob
+	{
+		const void*       vertices;
+		int               numVertices;
+		int               stride;
+		DWORD*            indices;
+		DWORD             flags;
+		const Task*       tasks;
+		int               numTasks;
+		std::atomic<int>* next;
+	};
+
+	void OptimizeTasks(const OptimizeJob* job)
+	{
+		Scratch s;
+
+		for(;;)
+		{
+			int i = (*job->next)++;
+			if( i >= job->numTasks )
+				break;
+
+			const Task& task = job->tasks[i];
+			DWORD* indices = job->indices + task.faceStart * 3;
+
+			Tipsify(indices, task.faceCount, job->numVertices, s);
+
+			if( job->flags & MeshOptimizeOverdraw )
+				OrderClusters(job->vertices, job->stride, indices, s);
+
+			s.triangles.resize(task.faceCount * 3);
+			for(int t = 0; t < task.faceCount; t++)
+			{
+				s.triangles[t * 3 + 0] = indices[s.order[t] * 3 + 0];
+				s.triangles[t * 3 + 1] = indices[s.order[t] * 3 + 1];
+				s.triangles[t * 3 + 2] = indices[s.order[t] * 3 + 2];
+			}
+			memcpy(indices, &s.triangles[0], task.faceCount * 3 * sizeof(DWORD));
+		}
+	}
+
+	//
+	// Overdraw measurement
+	//
+
+	struct OverdrawView
+	{
+		const std::vector<D3DXVECTOR3>* points;   // scaled to [0, 1]
+		const DWORD* indices;
+		int          numIndices;
+		int          axis;       // looks along +axis or -axis
+		bool         flip;
+		double       shaded;
+		double       covered;
+	};
+
+	void RasterizeView(OverdrawView* view)
+	{
+		const int G = OverdrawGrid;
+		std::vector<float> depth(G * G, FLT_MAX);
+
+		int a = view->axis, u = (a + 1) % 3, w = (a + 2) % 3;
+		const std::vector<D3DXVECTOR3>& points = *view->points;
+
+		double shaded = 0.0;
+		for(int i = 0; i + 2 < view->numIndices; i += 3)
+		{
+			float x[3], y[3], z[3];
+			for(int c = 0; c < 3; c++)
+			{
+				const float* p = (const float*)&points[view->indices[i + c]];
+				x[c] = (view->flip ? 1.0f - p[u] : p[u]) * G;
+				y[c] = p[w] * G;
+				z[c] = view->flip ? -p[a] : p[a];
+			}
+
+			// The cross product of a front face's edges points at the
+			// viewer, so front faces come out with a negative area here;
+			// swap two corners to rasterize them counterclockwise.
+			float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+			if( area >= 0.0f )
+				continue;
+
+			std::swap(x[1], x[2]);
+			std::swap(y[1], y[2]);
+			std::swap(z[1], z[2]);
+			area = -area;
+
+			int minX = (int)floorf(std::min(x[0], std::min(x[1], x[2])));
+			int maxX = (int)ceilf (std::max(x[0], std::max(x[1], x[2])));
+			int minY = (int)floorf(std::min(y[0], std::min(y[1], y[2])));
+			int maxY = (int)ceilf (std::max(y[0], std::max(y[1], y[2])));
+			minX = minX < 0 ? 0 : minX;
+			minY = minY < 0 ? 0 : minY;
+			maxX = maxX > G - 1 ? G - 1 : maxX;
+			maxY = maxY > G - 1 ? G - 1 : maxY;
+
+			float inverseArea = 1.0f / area;
+			for(int py = minY; py <= maxY; py++)
+			{
+				float cy = py + 0.5f;
+				for(int px = minX; px <= maxX; px++)
+				{
+					float cx = px + 0.5f;
+					float w0 = (x[2] - x[1]) * (cy - y[1]) - (y[2] - y[1]) * (cx - x[1]);
+					float w1 = (x[0] - x[2]) * (cy - y[2]) - (y[0] - y[2]) * (cx - x[2]);
+					float w2 = (x[1] - x[0]) * (cy - y[0]) - (y[1] - y[0]) * (cx - x[0]);
+					if( w0 < 0.0f || w1 < 0.0f || w2 < 0.0f )
+						continue;
+
+					float d = (w0 * z[0] + w1 * z[1] + w2 * z[2]) * inverseArea;
+					float& stored = depth[py * G + px];
+					if( d < stored )
+					{
+						stored = d;
+						shaded += 1.0;
+					}
+				}
+			}
+		}
+
+		double covered = 0.0;
+		for(int i = 0; i < G * G; i++)
+			if( depth[i] != FLT_MAX )
+				covered += 1.0;
+
+		view->shaded  = shaded;
+		view->covered = covered;
+	}
+
+	void BuildAttributeTable(const std::vector<DWORD>& indices, const std::vector<DWORD>& attributes,
+		std::vector<D3DXATTRIBUTERANGE>* subsets)
+	{
+		subsets->clear();
+
+		int numFaces = (int)attributes.size();
+		for(int begin = 0; begin < numFaces; )
+		{
+			int end = begin + 1;
+			while( end < numFaces && attributes[end] == attributes[begin] )
+				end++;
+
+			DWORD lowest = 0xffffffff, highest = 0;
+			for(int i = begin * 3; i < end * 3; i++)
+			{
+				lowest  = indices[i] < lowest ? indices[i] : lowest;
+				highest = indices[i] > highest ? indices[i] : highest;
+			}
+
+			D3DXATTRIBUTERANGE range;
+			range.AttribId    = attributes[begin];
+			range.FaceStart   = begin;
+			range.FaceCount   = end - begin;
+			range.VertexStart = lowest;
+			range.VertexCount = highest - lowest + 1;
+			subsets->push_back(range);
+
+			begin = end;
+		}
+	}
+}
+
+MeshOptimizeStats::MeshOptimizeStats()
+{
+	faces           = 0;
+	vertices        = 0;
+	removedFaces    = 0;
+	removedVertices = 0;
+	splitVertices   = 0;
+	subsets         = 0;
+	tasks           = 0;
+	numThreads      = 0;
+	acmrBefore      = 0.0f;
+	acmrAfter       = 0.0f;
+	atvrBefore      = 0.0f;
+	atvrAfter       = 0.0f;
+	overdrawBefore  = 0.0f;
+	overdrawAfter   = 0.0f;
+	optimizeMs      = 0.0f;
+	analyzeMs       = 0.0f;
+}
+
+//
+// Analysis
+//
+
+void AnalyzeVertexCache(const DWORD* indices, int numIndices, int numVertices, int cacheSize,
+	float* acmr, float* atvr)
+{
+	std::vector<int> cacheTime(numVertices, 0);
+	std::vector<BYTE> used(numVertices, 0);
+
+	int stamp  = cacheSize + 1;
+	int misses = 0, numUsed = 0;
+	for(int i = 0; i < numIndices; i++)
+	{
+		DWORD v = indices[i];
+		if( stamp - cacheTime[v] > cacheSize )
+		{
+			cacheTime[v] = stamp++;
+			misses++;
+		}
+		if( !used[v] )
+		{
+			used[v] = 1;
+			numUsed++;
+		}
+	}
+
+	if( acmr )
+		*acmr = numIndices >= 3 ? (float)misses / (numIndices / 3) : 0.0f;
+	if( atvr )
+		*atvr = numUsed > 0 ? (float)misses / numUsed : 0.0f;
+}
+
+float AnalyzeOverdraw(const void* vertices, int numVertices, int stride,
+	const DWORD* indices, int numIndices, int numThreads)
+{
+	if( numVertices == 0 || numIndices < 3 )
+		return 0.0f;
+
+	// Scale into the unit cube, keeping the proportions.
+	D3DXVECTOR3 lo = PositionOf(vertices, stride, 0), hi = lo;
+	for(int i = 1; i < numVertices; i++)
+	{
+		D3DXVec3Minimize(&lo, &lo, &PositionOf(vertices, stride, i));
+		D3DXVec3Maximize(&hi, &hi, &PositionOf(vertices, stride, i));
+	}
+	D3DXVECTOR3 extent = hi - lo;
+	float size = std::max(extent.x, std::max(extent.y, extent.z));
+	float scale = size > 0.0f ? 1.0f / size : 1.0f;
+
+	std::vector<D3DXVECTOR3> points(numVertices);
+	for(int i = 0; i < numVertices; i++)
+		points[i] = (PositionOf(vertices, stride, i) - lo) * scale;
+
+	OverdrawView views[6];
+	for(int v = 0; v < 6; v++)
+	{
+		views[v].points     = &points;
+		views[v].indices    = indices;
+		views[v].numIndices = numIndices;
+		views[v].axis       = v / 2;
+		views[v].flip       = (v & 1) != 0;
+	}
+
+	numThreads = std::min(ResolveThreads(numThreads), 6);
+
+	std::vector<std::thread> threads;
+	for(int t = 1; t < numThreads; t++)
+		threads.push_back(std::thread([&views, t, numThreads]()
+		{
+			for(int v = t; v < 6; v += numThreads)
+				RasterizeView(&views[v]);
+		}));
+	for(int v = 0; v < 6; v += numThreads)
+		RasterizeView(&views[v]);
+
+	for(int t = 0; t < (int)threads.size(); t++)
+		threads[t].join();
+
+	double shaded = 0.0, covered = 0.0;
+	for(int v = 0; v < 6; v++)
+	{
+		shaded  += views[v].shaded;
+		covered += views[v].covered;
+	}
+	return covered > 0.0 ? (float)(shaded / covered) : 0.0f;
+}
+
+//
+// Optimizing
+//
+
+bool OptimizeMesh(std::vector<BYTE>* vertices, int stride,
+	std::vector<DWORD>* indices, std::vector<DWORD>* attributes,
+	DWORD flags, int numThreads,
+	std::vector<D3DXATTRIBUTERANGE>* subsets, MeshOptimizeStats* stats)
+{
+	MeshOptimizeStats local;
+	if( !stats )
+		stats = &local;
+	*stats = MeshOptimizeStats();
+
+	int numFaces    = (int)indices->size() / 3;
+	int numVertices = stride > 0 ? (int)(vertices->size() / stride) : 0;
+	if( (int)attributes->size() != numFaces || numVertices <= 0 )
+		return false;
+
+	for(int i = 0; i < numFaces * 3; i++)
+		if( (*indices)[i] >= (DWORD)numVertices )
+			return false;
+
+	numThreads = ResolveThreads(numThreads);
+
+	double start = Now();
+	if( stats != &local && numFaces > 0 )
+	{
+		AnalyzeVertexCache(&(*indices)[0], numFaces * 3, numVertices, MeshCacheSize, &stats->acmrBefore, &stats->atvrBefore);
+		stats->overdrawBefore = AnalyzeOverdraw(&(*vertices)[0], numVertices, stride, &(*indices)[0], numFaces * 3, numThreads);
+	}
+	double analyzeMs = Now() - start;
+
+	start = Now();
+
+	// Degenerate triangles draw nothing.
+	if( flags & MeshOptimizeCompact )
+	{
+		int kept = 0;
+		for(int f = 0; f < numFaces; f++)
+		{
+			DWORD a = (*indices)[f * 3 + 0], b = (*indices)[f * 3 + 1], c = (*indices)[f * 3 + 2];
+			if( a == b || b == c || c == a )
+				continue;
+
+			(*indices)[kept * 3 + 0] = a;
+			(*indices)[kept * 3 + 1] = b;
+			(*indices)[kept * 3 + 2] = c;
+			(*attributes)[kept] = (*attributes)[f];
+			kept++;
+		}
+		stats->removedFaces = numFaces - kept;
+		numFaces = kept;
+		indices->resize(numFaces * 3);
+		attributes->resize(numFaces);
+	}
+
+	// Stable sort by attribute, so each subset is one draw.
+	if( flags & MeshOptimizeAttributeSort )
+	{
+		std::vector<DWORD> ids(*attributes);
+		std::sort(ids.begin(), ids.end());
+		ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+		std::vector<int> first(ids.size() + 1, 0);
+		std::vector<int> rank(numFaces);
+		for(int f = 0; f < numFaces; f++)
+		{
+			rank[f] = (int)(std::lower_bound(ids.begin(), ids.end(), (*attributes)[f]) - ids.begin());
+			first[rank[f] + 1]++;
+		}
+		for(int i = 1; i < (int)first.size(); i++)
+			first[i] += first[i - 1];
+
+		std::vector<DWORD> sortedIndices(numFaces * 3), sortedAttributes(numFaces);
+		for(int f = 0; f < numFaces; f++)
+		{
+			int to = first[rank[f]]++;
+			sortedIndices[to * 3 + 0] = (*indices)[f * 3 + 0];
+			sortedIndices[to * 3 + 1] = (*indices)[f * 3 + 1];
+			sortedIndices[to * 3 + 2] = (*indices)[f * 3 + 2];
+			sortedAttributes[to] = (*attributes)[f];
+		}
+		indices->swap(sortedIndices);
+		attributes->swap(sortedAttributes);
+	}
+
+	// Cache order, then overdraw order, subset by subset.
+	if( (flags & MeshOptimizeVertexCache) && numFaces > 0 )
+	{
+		std::vector<Task> tasks;
+		for(int begin = 0; begin < numFaces; )
+		{
+			int end = begin + 1;
+			while( end < numFaces && (*attributes)[end] == (*attributes)[begin] )
+				end++;
+
+			for(int piece = begin; piece < end; piece += MaxTaskTriangles)
+			{
+				Task task;
+				task.faceStart = piece;
+				task.faceCount = std::min(MaxTaskTriangles, end - piece);
+				tasks.push_back(task);
+			}
+			begin = end;
+		}
+
+		// largest first, so the last one to finish is short
+		std::stable_sort(tasks.begin(), tasks.end());
+
+		std::atomic<int> next(0);
+
+		OptimizeJob job;
+		job.vertices    = &(*vertices)[0];
+		job.numVertices = numVertices;
+		job.stride      = stride;
+		job.indices     = &(*indices)[0];
+		job.flags       = flags;
+		job.tasks       = &tasks[0];
+		job.numTasks    = (int)tasks.size();
+		job.next        = &next;
+
+		int useful = std::min(numThreads, (int)tasks.size());
+
+		std::vector<std::thread> threads;
+		for(int t = 1; t < useful; t++)
+			threads.push_back(std::thread(OptimizeTasks, &job));
+		OptimizeTasks(&job);
+
+		for(int t = 0; t < (int)threads.size(); t++)
+			threads[t].join();
+
+		stats->tasks      = (int)tasks.size();
+		stats->numThreads = useful;
+	}
+
+	// Number the vertices in the order they are fetched; with compaction
+	// the unused ones go, otherwise they follow.  After an attribute sort
+	// each subset gets a range of its own, a vertex shared by several
+	// subsets being copied into each, so no subset's VertexStart and
+	// VertexCount take in another's vertices.
+	int numKept = numVertices, numSplit = 0;
+	if( flags & (MeshOptimizeVertexFetch | MeshOptimizeCompact) )
+	{
+		std::vector<DWORD> sources;                 // input vertex of each output vertex
+		std::vector<DWORD> remap(numVertices, Unused);
+		std::vector<int>   groupOf(numVertices, -1); // group remap[v] was made for
+		std::vector<DWORD> found;
+
+		int group = 0;
+		for(int begin = 0; begin < numFaces; group++)
+		{
+			int end = numFaces;
+			if( flags & MeshOptimizeAttributeSort )
+			{
+				end = begin + 1;
+				while( end < numFaces && (*attributes)[end] == (*attributes)[begin] )
+					end++;
+			}
+
+			if( flags & MeshOptimizeVertexFetch )
+			{
+				for(int i = begin * 3; i < end * 3; i++)
+				{
+					DWORD v = (*indices)[i];
+					if( groupOf[v] != group )
+					{
+						groupOf[v] = group;
+						remap[v]   = (DWORD)sources.size();
+						sources.push_back(v);
+					}
+				}
+			}
+			else
+			{
+				// in their old order
+				found.clear();
+				for(int i = begin * 3; i < end * 3; i++)
+				{
+					DWORD v = (*indices)[i];
+					if( groupOf[v] != group )
+					{
+						groupOf[v] = group;
+						found.push_back(v);
+					}
+				}
+				std::sort(found.begin(), found.end());
+				for(int k = 0; k < (int)found.size(); k++)
+				{
+					remap[found[k]] = (DWORD)sources.size();
+					sources.push_back(found[k]);
+				}
+			}
+
+			for(int i = begin * 3; i < end * 3; i++)
+				(*indices)[i] = remap[(*indices)[i]];
+
+			begin = end;
+		}
+
+		int numUsed = 0;
+		for(int v = 0; v < numVertices; v++)
+			if( groupOf[v] >= 0 )
+				numUsed++;
+
+		numSplit = (int)sources.size() - numUsed;
+		if( !(flags & MeshOptimizeCompact) )
+		{
+			for(int v = 0; v < numVertices; v++)
+				if( groupOf[v] < 0 )
+					sources.push_back(v);
+		}
+		numKept = (int)sources.size();
+
+		std::vector<BYTE> copy(sources.size() * stride);
+		for(int v = 0; v < (int)sources.size(); v++)
+			memcpy(&copy[(size_t)v * stride], &(*vertices)[(size_t)sources[v] * stride], stride);
+		vertices->swap(copy);
+	}
+
+	BuildAttributeTable(*indices, *attributes, subsets);
+
+	stats->optimizeMs      = (float)(Now() - start);
+	stats->faces           = numFaces;
+	stats->vertices        = numKept;
+	stats->removedVertices = numVertices + numSplit - numKept;
+	stats->splitVertices   = numSplit;
+	stats->subsets         = (int)subsets->size();
+	if( stats->numThreads == 0 )
+		stats->numThreads = 1;
+
+	if( stats != &local && numFaces > 0 )
+	{
+		start = Now();
+		AnalyzeVertexCache(&(*indices)[0], numFaces * 3, numKept, MeshCacheSize, &stats->acmrAfter, &stats->atvrAfter);
+		stats->overdrawAfter = AnalyzeOverdraw(&(*vertices)[0], numKept, stride, &(*indices)[0], numFaces * 3, numThreads);
+		analyzeMs += Now() - start;
+	}
+	stats->analyzeMs = (float)analyzeMs;
+
+	return true;
+}
+
+bool OptimizeD3DXMesh(IDirect3DDevice9* device, ID3DXMesh** mesh, DWORD flags, int numThreads,
+	MeshOptimizeStats* stats)
+{
+	ID3DXMesh* in = *mesh;
+
+	int   numFaces    = (int)in->GetNumFaces();
+	int   numVertices = (int)in->GetNumVertices();
+	int   stride      = (int)in->GetNumBytesPerVertex();
+	DWORD options     = in->GetOptions();
+	bool  wide        = (options & D3DXMESH_32BIT) != 0;
+
+	std::vector<BYTE>  vertices((size_t)numVertices * stride);
+	std::vector<DWORD> indices(numFaces * 3);
+	std::vector<DWORD> attributes(numFaces);
+
+	void*  data = 0;
+	DWORD* ids  = 0;
+
+	if( FAILED(in->LockVertexBuffer(D3DLOCK_READONLY, &data)) )
+		return false;
+	memcpy(&vertices[0], data, vertices.size());
+	in->UnlockVertexBuffer();
+
+	if( FAILED(in->LockIndexBuffer(D3DLOCK_READONLY, &data)) )
+		return false;
+	for(int i = 0; i < numFaces * 3; i++)
+		indices[i] = wide ? ((DWORD*)data)[i] : ((WORD*)data)[i];
+	in->UnlockIndexBuffer();
+
+	if( FAILED(in->LockAttributeBuffer(D3DLOCK_READONLY, &ids)) )
+		return false;
+	memcpy(&attributes[0], ids, numFaces * sizeof(DWORD));
+	in->UnlockAttributeBuffer();
+
+	std::vector<D3DXATTRIBUTERANGE> subsets;
+	if( !OptimizeMesh(&vertices, stride, &indices, &attributes, flags, numThreads, &subsets, stats) )
+		return false;
+
+	// split vertices can take a 16 bit mesh past what its indices reach
+	int newNumVertices = (int)(vertices.size() / stride);
+	if( !wide && newNumVertices > 0xffff )
+	{
+		options |= D3DXMESH_32BIT;
+		wide     = true;
+	}
+
+	ID3DXMesh* out = 0;
+	numFaces = (int)attributes.size();
+	if( FAILED(D3DXCreateMeshFVF(numFaces, newNumVertices, options, in->GetFVF(), device, &out)) )
+		return false;
+
+	bool ok = false;
+	if( SUCCEEDED(out->LockVertexBuffer(0, &data)) )
+	{
+		memcpy(data, &vertices[0], (size_t)newNumVertices * stride);
+		out->UnlockVertexBuffer();
+
+		if( SUCCEEDED(out->LockIndexBuffer(0, &data)) )
+		{
+			for(int i = 0; i < numFaces * 3; i++)
+			{
+				if( wide )
+					((DWORD*)data)[i] = indices[i];
+				else
+					((WORD*)data)[i] = (WORD)indices[i];
+			}
+			out->UnlockIndexBuffer();
+
+			if( SUCCEEDED(out->LockAttributeBuffer(0, &ids)) )
+			{
+				memcpy(ids, &attributes[0], numFaces * sizeof(DWORD));
+				out->UnlockAttributeBuffer();
+
+				ok = SUCCEEDED(out->SetAttributeTable(&subsets[0], (DWORD)subsets.size()));
+			}
+		}
+	}
+
+	if( !ok )
+	{
+		d3d::Release<ID3DXMesh*>(out);
+		return false;
+	}
+
+	d3d::Release<ID3DXMesh*>(in);
+	*mesh = out;
+	return true;
+}
+
+//
+// Benchmark
+//
+
+bool BenchmarkMeshOptimizer(int gridSize, int numSubsets, int numThreads, bool analyze,
+	MeshOptimizeBenchmark* result)
+{
+	int side = gridSize + 1;
+	int numVertices = side * side;
+	int numFaces    = gridSize * gridSize * 2;
+
+	// a gently rolling sheet, so the overdraw views see some depth
+	std::vector<BYTE> vertices(numVertices * sizeof(D3DXVECTOR3));
+	D3DXVECTOR3* points = (D3DXVECTOR3*)&vertices[0];
+	for(int z = 0; z < side; z++)
+		for(int x = 0; x < side; x++)
+			points[z * side + x] = D3DXVECTOR3((float)x, sinf(x * 0.05f) * cosf(z * 0.05f) * 4.0f, (float)z);
+
+	std::vector<DWORD> indices(numFaces * 3);
+	std::vector<DWORD> attributes(numFaces);
+
+	// triangles in a random order, so there is something to optimize
+	std::vector<int> order(gridSize * gridSize);
+	for(int i = 0; i < (int)order.size(); i++)
+		order[i] = i;
+
+	unsigned seed = 12345;
+	for(int i = (int)order.size() - 1; i > 0; i--)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		std::swap(order[i], order[(seed >> 8) % (unsigned)(i + 1)]);
+	}
+
+	for(int q = 0; q < (int)order.size(); q++)
+	{
+		int x = order[q] % gridSize, z = order[q] / gridSize;
+		DWORD a = z * side + x, b = a + 1, c = a + side, d = c + 1;
+
+		DWORD* tri = &indices[q * 6];
+		tri[0] = a; tri[1] = c; tri[2] = b;
+		tri[3] = b; tri[4] = c; tri[5] = d;
+
+		// subsets in bands across the grid
+		attributes[q * 2] = attributes[q * 2 + 1] = (DWORD)(x * numSubsets / gridSize);
+	}
+
+	result->triangles = numFaces;
+	result->stats     = MeshOptimizeStats();
+
+	std::vector<D3DXATTRIBUTERANGE> subsets;
+
+	double start = Now();
+	bool ok = OptimizeMesh(&vertices, sizeof(D3DXVECTOR3), &indices, &attributes,
+		MeshOptimizeAll, numThreads, &subsets, analyze ? &result->stats : 0);
+	result->ms = (float)(Now() - start);
+
+	return ok;
+}
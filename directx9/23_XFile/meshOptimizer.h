@@ -0,0 +1,110 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: meshOptimizer.h
+//
+// Desc: Does what the samples ask ID3DXMesh::OptimizeInplace for, without
+//       D3DX: sorts the triangles by attribute, drops degenerate triangles
+//       and unused vertices, and orders each subset's triangles for the
+//       post-transform vertex cache (Tipsify, Sander et al. 2007).  Two
+//       steps D3DX does not have follow: triangles are gathered into
+//       clusters drawn outside-in to cut overdraw, and the vertices are
+//       renumbered in the order the triangles fetch them.
+//
+//       Subsets are optimized in parallel; very large ones are cut into
+//       pieces so a single-subset mesh uses every thread too.  Indices are
+//       32 bit throughout.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __meshOptimizerH__
+#define __meshOptimizerH__
+
+#include "d3dUtility.h"
+#include <vector>
+
+enum MeshOptimizeFlags
+{
+	MeshOptimizeAttributeSort = 0x01,
+	MeshOptimizeCompact       = 0x02,
+	MeshOptimizeVertexCache   = 0x04,
+	MeshOptimizeOverdraw      = 0x08,   // needs MeshOptimizeVertexCache
+	MeshOptimizeVertexFetch   = 0x10,
+
+	MeshOptimizeAll           = 0x1f
+};
+
+struct MeshOptimizeStats
+{
+	MeshOptimizeStats();
+
+	int   faces;              // after
+	int   vertices;           // after
+	int   removedFaces;       // degenerate
+	int   removedVertices;    // unused
+	int   splitVertices;      // copies of vertices shared by subsets
+	int   subsets;
+	int   tasks;              // pieces the subsets were cut into
+	int   numThreads;
+
+	// average cache miss ratio: misses per triangle, 0.5 at best
+	float acmrBefore, acmrAfter;
+	// average transform to vertex ratio: misses per vertex, 1.0 at best
+	float atvrBefore, atvrAfter;
+	// pixels shaded per pixel covered, averaged over six axis views
+	float overdrawBefore, overdrawAfter;
+
+	float optimizeMs;
+	float analyzeMs;
+};
+
+// The post-transform cache is simulated as a FIFO of this many vertices.
+const int MeshCacheSize = 16;
+
+// Simulates the vertex cache over numIndices indices; either output may be
+// null.
+void AnalyzeVertexCache(const DWORD* indices, int numIndices, int numVertices, int cacheSize,
+	float* acmr, float* atvr);
+
+// Rasterizes the mesh into small depth buffers from the six axis
+// directions, back faces culled, and returns pixels shaded per pixel
+// covered.  The first D3DXVECTOR3 of each vertex is its position.
+float AnalyzeOverdraw(const void* vertices, int numVertices, int stride,
+	const DWORD* indices, int numIndices, int numThreads);
+
+// Optimizes a triangle list in place.  vertices holds the vertices, stride
+// bytes each, positions first; attributes holds one id per triangle.  On
+// return vertices may be shorter, or longer where a vertex shared by
+// several subsets is copied into each, indices and attributes may be
+// shorter, and subsets is the attribute table.  Vertices are split only
+// when they are renumbered (MeshOptimizeVertexFetch or
+// MeshOptimizeCompact) after an attribute sort.  numThreads = 0 uses one
+// thread per hardware thread.  stats, if given, also gets the cache and
+// overdraw figures before and after.
+bool OptimizeMesh(std::vector<BYTE>* vertices, int stride,
+	std::vector<DWORD>* indices, std::vector<DWORD>* attributes,
+	DWORD flags, int numThreads,
+	std::vector<D3DXATTRIBUTERANGE>* subsets, MeshOptimizeStats* stats);
+
+// The same for a D3DX mesh, which is replaced by an optimized copy of the
+// right size, its attribute table set; the copy has 32 bit indices if split
+// vertices take it past 65535.
+bool OptimizeD3DXMesh(IDirect3DDevice9* device, ID3DXMesh** mesh, DWORD flags, int numThreads,
+	MeshOptimizeStats* stats);
+
+//
+// Headless benchmark: a gridSize x gridSize grid of quads, its triangles
+// shuffled and split over numSubsets attributes, then optimized.  The
+// stats, before and after, are only gathered when analyze is set.
+//
+
+struct MeshOptimizeBenchmark
+{
+	int               triangles;
+	float             ms;      // OptimizeMesh, analysis included
+	MeshOptimizeStats stats;
+};
+
+bool BenchmarkMeshOptimizer(int gridSize, int numSubsets, int numThreads, bool analyze,
+	MeshOptimizeBenchmark* result);
+
+#endif // __meshOptimizerH__
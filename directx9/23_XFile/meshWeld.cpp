@@ -0,0 +1,566 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: meshWeld.cpp
+//
+// Desc: Vertex welding over a hashed grid of position cells.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "meshWeld.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+namespace
+{
+	double Now()
+	{
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+	}
+
+	int ResolveThreads(int numThreads)
+	{
+		if( numThreads <= 0 )
+			numThreads = (int)std::thread::hardware_concurrency();
+		if( numThreads <= 0 )
+			numThreads = 1;
+		return numThreads;
+	}
+
+	// Calls body(begin, end) over [0, count) split into numThreads ranges,
+	// the first on the calling thread.
+	template<class Body> void ParallelFor(int count, int numThreads, Body body)
+	{
+		std::vector<std::thread> threads;
+		for(int t = 1; t < numThreads; t++)
+			threads.push_back(std::thread(body, count * t / numThreads, count * (t + 1) / numThreads));
+		body(0, count / numThreads);
+
+		for(int t = 0; t < (int)threads.size(); t++)
+			threads[t].join();
+	}
+
+	// A vertex's cell, and for each axis the neighbouring cell, -1 or +1,
+	// on the side of the half it lies in.
+	struct Cell
+	{
+		int x, y, z;
+		int dx, dy, dz;
+	};
+
+	// The cell of a coordinate: two tolerances wide, or the float's own bits
+	// when only exact copies weld, with -0 taken as 0.  Anything within a
+	// tolerance of v lies in v's cell or the neighbour on *side.
+	int CellOf(float v, float epsilon, int* side)
+	{
+		*side = 0;
+		if( epsilon > 0.0f )
+		{
+			double f = (double)v / (2.0 * epsilon);
+			double c = floor(f);
+			*side = f - c < 0.5 ? -1 : 1;
+			if( c < -2147483646.0 ) c = -2147483646.0;
+			if( c >  2147483646.0 ) c =  2147483646.0;
+			return (int)c;
+		}
+
+		if( v == 0.0f )
+			v = 0.0f;
+		int bits;
+		memcpy(&bits, &v, sizeof(bits));
+		return bits;
+	}
+
+	DWORD HashCell(int x, int y, int z)
+	{
+		return ((DWORD)x * 73856093u) ^ ((DWORD)y * 19349663u) ^ ((DWORD)z * 83492791u);
+	}
+
+	bool Near(const float* a, const float* b, int n, float epsilon)
+	{
+		for(int i = 0; i < n; i++)
+		{
+			float d = a[i] - b[i];
+			if( !(d <= epsilon && -d <= epsilon) )
+				return false;
+		}
+		return true;
+	}
+
+	// A run of bytes compared exactly: everything but the position, normal
+	// and texture coordinates.
+	struct Span
+	{
+		int offset;
+		int size;
+	};
+
+	// Everything WeldVertices compares two vertices with.
+	struct Matcher
+	{
+		const BYTE*       vertices;
+		int               stride;
+		int               normalOffset;   // -1 when not compared
+		int               uvOffset;       // -1 when not compared
+		MeshWeldEpsilons  epsilons;
+		std::vector<Span> exact;
+
+		bool match(DWORD a, DWORD b) const
+		{
+			const BYTE* va = vertices + (size_t)a * stride;
+			const BYTE* vb = vertices + (size_t)b * stride;
+
+			if( !Near((const float*)va, (const float*)vb, 3, epsilons.position) )
+				return false;
+			if( normalOffset >= 0 &&
+				!Near((const float*)(va + normalOffset), (const float*)(vb + normalOffset), 3, epsilons.normal) )
+				return false;
+			if( uvOffset >= 0 &&
+				!Near((const float*)(va + uvOffset), (const float*)(vb + uvOffset), 2, epsilons.uv) )
+				return false;
+
+			for(int i = 0; i < (int)exact.size(); i++)
+				if( memcmp(va + exact[i].offset, vb + exact[i].offset, exact[i].size) != 0 )
+					return false;
+
+			return true;
+		}
+	};
+
+	void FindExactSpans(const MeshWeldLayout& layout, Matcher* matcher)
+	{
+		// The normal and texture coordinates are compared with a tolerance
+		// or, when their tolerance is negative, not at all.
+		std::vector<bool> tolerant(layout.stride, false);
+		for(int i = 0; i < 12; i++)
+			tolerant[i] = true;
+		for(int i = 0; layout.normalOffset >= 0 && i < 12; i++)
+			tolerant[layout.normalOffset + i] = true;
+		for(int i = 0; layout.uvOffset >= 0 && i < 8; i++)
+			tolerant[layout.uvOffset + i] = true;
+
+		matcher->exact.clear();
+		for(int i = 0; i < layout.stride; )
+		{
+			if( tolerant[i] )
+			{
+				i++;
+				continue;
+			}
+
+			Span span;
+			span.offset = i;
+			while( i < layout.stride && !tolerant[i] )
+				i++;
+			span.size = i - span.offset;
+			matcher->exact.push_back(span);
+		}
+	}
+}
+
+MeshWeldEpsilons::MeshWeldEpsilons()
+{
+	position = 1e-5f;
+	normal   = 1e-3f;
+	uv       = 1e-4f;
+}
+
+MeshWeldLayout::MeshWeldLayout()
+{
+	stride       = sizeof(D3DXVECTOR3);
+	normalOffset = -1;
+	uvOffset     = -1;
+}
+
+MeshWeldStats::MeshWeldStats()
+{
+	verticesBefore = 0;
+	verticesAfter  = 0;
+	bytesBefore    = 0;
+	bytesAfter     = 0;
+	numThreads     = 0;
+	hashMs         = 0.0f;
+	matchMs        = 0.0f;
+	remapMs        = 0.0f;
+	totalMs        = 0.0f;
+}
+
+bool WeldVertices(void* vertices, int numVertices, const MeshWeldLayout& layout,
+	DWORD* indices, int numIndices, const MeshWeldEpsilons& epsilons, int numThreads,
+	int* newNumVertices, MeshWeldStats* stats)
+{
+	MeshWeldStats local;
+	if( !stats )
+		stats = &local;
+	*stats = MeshWeldStats();
+
+	if( numVertices <= 0 || layout.stride < (int)sizeof(D3DXVECTOR3) ||
+		layout.normalOffset + 12 > layout.stride || layout.uvOffset + 8 > layout.stride )
+		return false;
+
+	for(int i = 0; i < numIndices; i++)
+		if( indices[i] >= (DWORD)numVertices )
+			return false;
+
+	int T = ResolveThreads(numThreads);
+	double begin = Now();
+	double start = begin;
+
+	Matcher matcher;
+	matcher.vertices     = (const BYTE*)vertices;
+	matcher.stride       = layout.stride;
+	matcher.normalOffset = epsilons.normal >= 0.0f ? layout.normalOffset : -1;
+	matcher.uvOffset     = epsilons.uv >= 0.0f ? layout.uvOffset : -1;
+	matcher.epsilons     = epsilons;
+	if( matcher.epsilons.position < 0.0f )
+		matcher.epsilons.position = 0.0f;
+	FindExactSpans(layout, &matcher);
+
+	//
+	// Hash every vertex's cell, in parallel, then sort the vertices by
+	// bucket.  Each bucket lists its vertices in increasing order.
+	//
+
+	DWORD numBuckets = 1;
+	while( numBuckets < (DWORD)numVertices * 2 )
+		numBuckets <<= 1;
+
+	std::vector<Cell>  cells(numVertices);
+	std::vector<DWORD> buckets(numVertices);
+
+	ParallelFor(numVertices, T, [&](int first, int last)
+	{
+		for(int i = first; i < last; i++)
+		{
+			const float* p = (const float*)(matcher.vertices + (size_t)i * layout.stride);
+			Cell& c = cells[i];
+			c.x = CellOf(p[0], matcher.epsilons.position, &c.dx);
+			c.y = CellOf(p[1], matcher.epsilons.position, &c.dy);
+			c.z = CellOf(p[2], matcher.epsilons.position, &c.dz);
+			buckets[i] = HashCell(c.x, c.y, c.z) & (numBuckets - 1);
+		}
+	});
+
+	std::vector<DWORD> bucketStart(numBuckets + 1, 0);
+	for(int i = 0; i < numVertices; i++)
+		bucketStart[buckets[i] + 1]++;
+	for(DWORD b = 0; b < numBuckets; b++)
+		bucketStart[b + 1] += bucketStart[b];
+
+	std::vector<DWORD> sorted(numVertices);
+	{
+		std::vector<DWORD> cursor(bucketStart.begin(), bucketStart.end() - 1);
+		for(int i = 0; i < numVertices; i++)
+			sorted[cursor[buckets[i]]++] = (DWORD)i;
+	}
+
+	stats->hashMs = (float)(Now() - start);
+	start = Now();
+
+	//
+	// Each vertex goes to the first vertex in its cell or a neighbouring one
+	// that matches it, or stays.  With cells two tolerances wide, only the
+	// eight cells on the vertex's side of its own can hold a match; exact
+	// welds only look in their own cell.
+	//
+
+	int numCells = matcher.epsilons.position > 0.0f ? 8 : 1;
+	std::vector<DWORD> target(numVertices);
+
+	ParallelFor(numVertices, T, [&](int first, int last)
+	{
+		for(int i = first; i < last; i++)
+		{
+			DWORD best = (DWORD)i;
+			const Cell& c = cells[i];
+
+			for(int n = 0; n < numCells; n++)
+			{
+				int x = c.x + (n & 1 ? c.dx : 0);
+				int y = c.y + (n & 2 ? c.dy : 0);
+				int z = c.z + (n & 4 ? c.dz : 0);
+
+				DWORD b = HashCell(x, y, z) & (numBuckets - 1);
+				for(DWORD k = bucketStart[b]; k < bucketStart[b + 1]; k++)
+				{
+					DWORD j = sorted[k];
+					if( j >= best )
+						break;
+					if( matcher.match(j, (DWORD)i) )
+					{
+						best = j;
+						break;
+					}
+				}
+			}
+
+			target[i] = best;
+		}
+	});
+
+	stats->matchMs = (float)(Now() - start);
+	start = Now();
+
+	//
+	// Keep the vertices that went to themselves, in order.  A vertex that
+	// went to an earlier one takes wherever that one went.
+	//
+
+	BYTE* bytes = (BYTE*)vertices;
+	int kept = 0;
+	for(int i = 0; i < numVertices; i++)
+	{
+		if( target[i] == (DWORD)i )
+		{
+			if( kept != i )
+				memcpy(bytes + (size_t)kept * layout.stride, bytes + (size_t)i * layout.stride, layout.stride);
+			target[i] = (DWORD)kept++;
+		}
+		else
+		{
+			target[i] = target[target[i]];
+		}
+	}
+
+	ParallelFor(numIndices, T, [&](int first, int last)
+	{
+		for(int i = first; i < last; i++)
+			indices[i] = target[indices[i]];
+	});
+
+	stats->remapMs = (float)(Now() - start);
+	stats->totalMs = (float)(Now() - begin);
+
+	stats->verticesBefore = numVertices;
+	stats->verticesAfter  = kept;
+	stats->bytesBefore    = numVertices * layout.stride;
+	stats->bytesAfter     = kept * layout.stride;
+	stats->numThreads     = T;
+
+	if( newNumVertices )
+		*newNumVertices = kept;
+	return true;
+}
+
+bool WeldD3DXMesh(IDirect3DDevice9* device, ID3DXMesh** mesh, const MeshWeldEpsilons& epsilons,
+	int numThreads, MeshWeldStats* stats)
+{
+	ID3DXMesh* in = *mesh;
+
+	D3DVERTEXELEMENT9 decl[MAX_FVF_DECL_SIZE];
+	if( FAILED(in->GetDeclaration(decl)) )
+		return false;
+
+	MeshWeldLayout layout;
+	layout.stride = (int)in->GetNumBytesPerVertex();
+	for(int i = 0; decl[i].Stream != 0xff; i++)
+	{
+		if( decl[i].Stream != 0 || decl[i].UsageIndex != 0 )
+			continue;
+		if( decl[i].Usage == D3DDECLUSAGE_POSITION && (decl[i].Offset != 0 || decl[i].Type != D3DDECLTYPE_FLOAT3) )
+			return false;
+		if( decl[i].Usage == D3DDECLUSAGE_NORMAL && decl[i].Type == D3DDECLTYPE_FLOAT3 )
+			layout.normalOffset = decl[i].Offset;
+		if( decl[i].Usage == D3DDECLUSAGE_TEXCOORD && decl[i].Type == D3DDECLTYPE_FLOAT2 )
+			layout.uvOffset = decl[i].Offset;
+	}
+
+	int   numFaces    = (int)in->GetNumFaces();
+	int   numVertices = (int)in->GetNumVertices();
+	DWORD options     = in->GetOptions();
+	bool  wide        = (options & D3DXMESH_32BIT) != 0;
+
+	std::vector<BYTE>  vertices((size_t)numVertices * layout.stride);
+	std::vector<DWORD> indices(numFaces * 3);
+	std::vector<DWORD> attributes(numFaces);
+
+	void*  data = 0;
+	DWORD* ids  = 0;
+
+	if( FAILED(in->LockVertexBuffer(D3DLOCK_READONLY, &data)) )
+		return false;
+	memcpy(&vertices[0], data, vertices.size());
+	in->UnlockVertexBuffer();
+
+	if( FAILED(in->LockIndexBuffer(D3DLOCK_READONLY, &data)) )
+		return false;
+	for(int i = 0; i < numFaces * 3; i++)
+		indices[i] = wide ? ((DWORD*)data)[i] : ((WORD*)data)[i];
+	in->UnlockIndexBuffer();
+
+	if( FAILED(in->LockAttributeBuffer(D3DLOCK_READONLY, &ids)) )
+		return false;
+	memcpy(&attributes[0], ids, numFaces * sizeof(DWORD));
+	in->UnlockAttributeBuffer();
+
+	int newNumVertices = 0;
+	if( !WeldVertices(&vertices[0], numVertices, layout, &indices[0], (int)indices.size(),
+		epsilons, numThreads, &newNumVertices, stats) )
+		return false;
+
+	// The attribute table's vertex ranges no longer hold, so the copy has
+	// none; OptimizeD3DXMesh builds a new one.
+	ID3DXMesh* out = 0;
+	if( FAILED(D3DXCreateMesh(numFaces, newNumVertices, options, decl, device, &out)) )
+		return false;
+
+	bool ok = false;
+	if( SUCCEEDED(out->LockVertexBuffer(0, &data)) )
+	{
+		memcpy(data, &vertices[0], (size_t)newNumVertices * layout.stride);
+		out->UnlockVertexBuffer();
+
+		if( SUCCEEDED(out->LockIndexBuffer(0, &data)) )
+		{
+			for(int i = 0; i < numFaces * 3; i++)
+			{
+				if( wide )
+					((DWORD*)data)[i] = indices[i];
+				else
+					((WORD*)data)[i] = (WORD)indices[i];
+			}
+			out->UnlockIndexBuffer();
+
+			if( SUCCEEDED(out->LockAttributeBuffer(0, &ids)) )
+			{
+				memcpy(ids, &attributes[0], numFaces * sizeof(DWORD));
+				out->UnlockAttributeBuffer();
+				ok = true;
+			}
+		}
+	}
+
+	if( !ok )
+	{
+		d3d::Release<ID3DXMesh*>(out);
+		return false;
+	}
+
+	d3d::Release<ID3DXMesh*>(in);
+	*mesh = out;
+	return true;
+}
+
+//
+// Benchmark
+//
+
+namespace
+{
+	struct GridVertex
+	{
+		D3DXVECTOR3 position;
+		D3DXVECTOR3 normal;
+		D3DXVECTOR2 uv;
+	};
+
+	// A gridSize x gridSize grid of quads with four vertices each, jittered
+	// by up to a quarter of epsilon either way.
+	void MakeWeldGrid(int gridSize, float epsilon, std::vector<GridVertex>* vertices, std::vector<DWORD>* indices)
+	{
+		unsigned seed = 12345;
+		float jitterScale = epsilon * 0.25f / 32768.0f;
+
+		vertices->resize(gridSize * gridSize * 4);
+		indices->resize(gridSize * gridSize * 6);
+		for(int z = 0; z < gridSize; z++)
+		{
+			for(int x = 0; x < gridSize; x++)
+			{
+				int q = z * gridSize + x;
+				for(int k = 0; k < 4; k++)
+				{
+					int cx = x + (k & 1), cz = z + (k >> 1);
+
+					float jitter[3];
+					for(int j = 0; j < 3; j++)
+					{
+						seed = seed * 1664525u + 1013904223u;
+						jitter[j] = ((int)((seed >> 8) & 0xffff) - 32768) * jitterScale;
+					}
+
+					GridVertex& v = (*vertices)[q * 4 + k];
+					v.position = D3DXVECTOR3((float)cx + jitter[0], jitter[1], (float)cz + jitter[2]);
+					v.normal   = D3DXVECTOR3(0.0f, 1.0f, 0.0f);
+					v.uv       = D3DXVECTOR2((float)cx / gridSize, (float)cz / gridSize);
+				}
+
+				DWORD a = q * 4, b = a + 1, c = a + 2, d = a + 3;
+				DWORD tri[6] = { a, c, b, b, c, d };
+				memcpy(&(*indices)[q * 6], tri, sizeof(tri));
+			}
+		}
+	}
+
+	// The weld WeldVertices promises, found by comparing every vertex with
+	// every earlier one: the indices it should leave.
+	void BruteForceWeld(const std::vector<GridVertex>& vertices, const MeshWeldLayout& layout,
+		const MeshWeldEpsilons& epsilons, std::vector<DWORD>* indices)
+	{
+		Matcher matcher;
+		matcher.vertices     = (const BYTE*)&vertices[0];
+		matcher.stride       = layout.stride;
+		matcher.normalOffset = layout.normalOffset;
+		matcher.uvOffset     = layout.uvOffset;
+		matcher.epsilons     = epsilons;
+		FindExactSpans(layout, &matcher);
+
+		std::vector<DWORD> target(vertices.size());
+		DWORD kept = 0;
+		for(DWORD i = 0; i < (DWORD)vertices.size(); i++)
+		{
+			DWORD j = 0;
+			while( j < i && !matcher.match(j, i) )
+				j++;
+			target[i] = (j == i) ? kept++ : target[j];
+		}
+
+		for(int i = 0; i < (int)indices->size(); i++)
+			(*indices)[i] = target[(*indices)[i]];
+	}
+}
+
+bool BenchmarkMeshWeld(int gridSize, int numThreads, MeshWeldBenchmark* result)
+{
+	MeshWeldEpsilons epsilons;
+	epsilons.position = 1e-3f;
+
+	MeshWeldLayout layout;
+	layout.stride       = sizeof(GridVertex);
+	layout.normalOffset = sizeof(D3DXVECTOR3);
+	layout.uvOffset     = sizeof(D3DXVECTOR3) * 2;
+
+	std::vector<GridVertex> vertices;
+	std::vector<DWORD>      indices;
+	MakeWeldGrid(gridSize, epsilons.position, &vertices, &indices);
+
+	result->vertices = (int)vertices.size();
+	result->expected = (gridSize + 1) * (gridSize + 1);
+
+	int kept = 0;
+	double start = Now();
+	bool ok = WeldVertices(&vertices[0], (int)vertices.size(), layout, &indices[0], (int)indices.size(),
+		epsilons, numThreads, &kept, &result->stats);
+	result->ms = (float)(Now() - start);
+
+	// A grid small enough to weld by brute force, the same way.
+	int small = std::min(gridSize, 32);
+	MakeWeldGrid(small, epsilons.position, &vertices, &indices);
+
+	std::vector<DWORD> expected = indices;
+	BruteForceWeld(vertices, layout, epsilons, &expected);
+
+	ok = ok && WeldVertices(&vertices[0], (int)vertices.size(), layout, &indices[0], (int)indices.size(),
+		epsilons, numThreads, &kept, 0);
+
+	result->mismatches = 0;
+	for(int i = 0; i < (int)indices.size(); i++)
+		if( indices[i] != expected[i] )
+			result->mismatches++;
+
+	return ok;
+}
@@ -0,0 +1,95 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: meshWeld.h
+//
+// Desc: Merges vertices that differ by no more than a tolerance in
+//       position, normal and texture coordinates, such as the copies a
+//       .x file or a generated primitive carries along its seams.  Run
+//       before the vertex cache optimization, it shrinks the vertex buffer
+//       and lets faces on either side of a seam share their vertices.
+//
+//       Positions are quantized to a grid of cells two position tolerances
+//       wide and hashed.  Each vertex is compared, in parallel, with the
+//       vertices in its own cell and the seven cells on its side of it,
+//       and goes to the first of them that matches; so a weld does not
+//       depend on the number of threads.  Other vertex data must match
+//       exactly.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __meshWeldH__
+#define __meshWeldH__
+
+#include "d3dUtility.h"
+#include <vector>
+
+// How far apart, per component, two vertices may be and still be welded.
+// 0 welds exact copies only.  A negative normal or texture coordinate
+// tolerance ignores them, and the vertex welded to keeps its own.
+struct MeshWeldEpsilons
+{
+	MeshWeldEpsilons();
+
+	float position;
+	float normal;
+	float uv;
+};
+
+// Where the normal and the texture coordinates lie in a vertex, in bytes;
+// -1 for none.  The position is the vertex's first D3DXVECTOR3.
+struct MeshWeldLayout
+{
+	MeshWeldLayout();
+
+	int stride;
+	int normalOffset;
+	int uvOffset;
+};
+
+struct MeshWeldStats
+{
+	MeshWeldStats();
+
+	int   verticesBefore;
+	int   verticesAfter;
+	int   bytesBefore;
+	int   bytesAfter;
+	int   numThreads;
+
+	float hashMs;      // cells hashed and sorted
+	float matchMs;     // each vertex compared with its neighbours
+	float remapMs;     // indices remapped, vertices compacted
+	float totalMs;
+};
+
+// Welds numVertices vertices in place: the vertices kept move to the front,
+// in their original order, and indices is remapped to them.  Vertices no
+// index uses are kept.  numThreads = 0 uses one thread per hardware thread.
+bool WeldVertices(void* vertices, int numVertices, const MeshWeldLayout& layout,
+	DWORD* indices, int numIndices, const MeshWeldEpsilons& epsilons, int numThreads,
+	int* newNumVertices, MeshWeldStats* stats);
+
+// The same for a D3DX mesh, which is replaced by a welded copy of the right
+// size; its layout comes from its declaration.
+bool WeldD3DXMesh(IDirect3DDevice9* device, ID3DXMesh** mesh, const MeshWeldEpsilons& epsilons,
+	int numThreads, MeshWeldStats* stats);
+
+//
+// Headless benchmark: a gridSize x gridSize grid of quads, each with four
+// vertices of its own jittered by less than the tolerance, welded back to
+// (gridSize + 1)^2 vertices.  A grid of at most 32 x 32 is also welded by
+// comparing every vertex with every earlier one, and the two compared.
+//
+
+struct MeshWeldBenchmark
+{
+	int           vertices;    // before
+	int           expected;    // after, if every seam welds
+	float         ms;
+	int           mismatches;  // small grid indices differing from brute force
+	MeshWeldStats stats;
+};
+
+bool BenchmarkMeshWeld(int gridSize, int numThreads, MeshWeldBenchmark* result);
+
+#endif // __meshWeldH__
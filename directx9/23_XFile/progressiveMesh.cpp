@@ -0,0 +1,1257 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: progressiveMesh.cpp
+//
+// Desc: Quadric error half-edge collapses recorded as index edits, and the
+//       mesh that plays them forward and back.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "progressiveMesh.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+
+namespace
+{
+	// Normals and texture coordinates enter the quadrics scaled by the mesh
+	// radius times these, which makes their error comparable with a
+	// positional one.
+	const float NormalWeight   = 0.1f;
+	const float TexCoordWeight = 0.1f;
+
+	// weight of the planes that hold seams and borders in place
+	const double BorderWeight = 10.0;
+
+	// A collapse may not turn a face by more than about 75 degrees, nor
+	// flatten it.
+	const float MinFaceCosine = 0.25f;
+
+	// position, normal, texture coordinates
+	const int Dimensions   = 8;
+	const int QuadricTerms = Dimensions * (Dimensions + 1) / 2;
+
+	const DWORD Nil = 0xffffffff;
+
+	double Now()
+	{
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+	}
+
+	int ResolveThreads(int numThreads)
+	{
+		if( numThreads <= 0 )
+			numThreads = (int)std::thread::hardware_concurrency();
+		if( numThreads <= 0 )
+			numThreads = 1;
+		return numThreads;
+	}
+
+	// Calls body(begin, end) over [0, count) split into numThreads ranges,
+	// the first on the calling thread.
+	template<class Body> void ParallelFor(int count, int numThreads, Body body)
+	{
+		std::vector<std::thread> threads;
+		for(int t = 1; t < numThreads; t++)
+			threads.push_back(std::thread(body, count * t / numThreads, count * (t + 1) / numThreads));
+		body(0, count / numThreads);
+
+		for(int t = 0; t < (int)threads.size(); t++)
+			threads[t].join();
+	}
+
+	// Where the FVF puts the normal and first texture coordinates, -1 for
+	// none.
+	bool VertexLayout(DWORD fvf, int* stride, int* normalOffset, int* texCoordOffset)
+	{
+		// positions must be plain XYZ, texture coordinates two-dimensional
+		if( (fvf & D3DFVF_POSITION_MASK) != D3DFVF_XYZ || (fvf >> 16) != 0 )
+			return false;
+
+		int offset = 12;
+		*normalOffset   = -1;
+		*texCoordOffset = -1;
+
+		if( fvf & D3DFVF_NORMAL )
+		{
+			*normalOffset = offset;
+			offset += 12;
+		}
+		if( fvf & D3DFVF_PSIZE )
+			offset += 4;
+		if( fvf & D3DFVF_DIFFUSE )
+			offset += 4;
+		if( fvf & D3DFVF_SPECULAR )
+			offset += 4;
+
+		int numTexCoords = (fvf & D3DFVF_TEXCOUNT_MASK) >> D3DFVF_TEXCOUNT_SHIFT;
+		if( numTexCoords > 0 )
+			*texCoordOffset = offset;
+		offset += numTexCoords * 8;
+
+		*stride = offset;
+		return true;
+	}
+
+	//
+	// Quadrics over (position, normal, texture coordinates): the squared
+	// distance from a point to a set of planes, x'Ax + 2b'x + c.
+	//
+
+	struct Quadric
+	{
+		double a[QuadricTerms];   // upper triangle of A, row by row
+		double b[Dimensions];
+		double c;
+
+		void clear()
+		{
+			memset(this, 0, sizeof(*this));
+		}
+
+		void add(const Quadric& q)
+		{
+			for(int i = 0; i < QuadricTerms; i++)
+				a[i] += q.a[i];
+			for(int i = 0; i < Dimensions; i++)
+				b[i] += q.b[i];
+			c += q.c;
+		}
+
+		double evaluate(const float* x) const
+		{
+			double r = c;
+			int k = 0;
+			for(int i = 0; i < Dimensions; i++)
+			{
+				r += 2.0 * b[i] * x[i] + a[k++] * x[i] * x[i];
+				for(int j = i + 1; j < Dimensions; j++)
+					r += 2.0 * a[k++] * x[i] * x[j];
+			}
+			return r;
+		}
+	};
+
+	// The squared distance to the plane of a triangle in the full space,
+	// weighted by the triangle's area (Garland & Heckbert 1998).
+	bool TriangleQuadric(const float* p, const float* q, const float* r, double weight, Quadric* out)
+	{
+		double e1[Dimensions], e2[Dimensions];
+		double length1 = 0.0, along = 0.0;
+		for(int i = 0; i < Dimensions; i++)
+		{
+			e1[i] = q[i] - p[i];
+			e2[i] = r[i] - p[i];
+			length1 += e1[i] * e1[i];
+		}
+		if( length1 <= 0.0 )
+			return false;
+
+		length1 = sqrt(length1);
+		for(int i = 0; i < Dimensions; i++)
+		{
+			e1[i] /= length1;
+			along += e1[i] * e2[i];
+		}
+
+		double length2 = 0.0;
+		for(int i = 0; i < Dimensions; i++)
+		{
+			e2[i] -= along * e1[i];
+			length2 += e2[i] * e2[i];
+		}
+		if( length2 <= 1e-20 )
+			return false;
+
+		length2 = sqrt(length2);
+		double pe1 = 0.0, pe2 = 0.0, pp = 0.0;
+		for(int i = 0; i < Dimensions; i++)
+		{
+			e2[i] /= length2;
+			pe1 += p[i] * e1[i];
+			pe2 += p[i] * e2[i];
+			pp  += (double)p[i] * p[i];
+		}
+
+		int k = 0;
+		for(int i = 0; i < Dimensions; i++)
+		{
+			for(int j = i; j < Dimensions; j++)
+				out->a[k++] = weight * ((i == j ? 1.0 : 0.0) - e1[i] * e1[j] - e2[i] * e2[j]);
+			out->b[i] = weight * (pe1 * e1[i] + pe2 * e2[i] - p[i]);
+		}
+		out->c = weight * (pp - pe1 * pe1 - pe2 * pe2);
+		return true;
+	}
+
+	// The squared distance to a plane in position space, weighted.
+	void PlaneQuadric(const D3DXVECTOR3& normal, float d, double weight, Quadric* out)
+	{
+		out->clear();
+
+		const float* n = (const float*)&normal;
+		int k = 0;
+		for(int i = 0; i < Dimensions; i++)
+		{
+			for(int j = i; j < Dimensions; j++)
+				out->a[k++] = i < 3 && j < 3 ? weight * n[i] * n[j] : 0.0;
+			out->b[i] = i < 3 ? weight * d * n[i] : 0.0;
+		}
+		out->c = weight * d * d;
+	}
+
+	enum VertexKind
+	{
+		KindManifold,   // may collapse onto any neighbour
+		KindBorder,     // only along its open or material boundary
+		KindSeam,       // only along its seam, together with its twin
+		KindLocked      // never
+	};
+
+	struct EdgeInfo
+	{
+		int   count;
+		DWORD attribute;
+		bool  mixed;      // faces of more than one attribute
+	};
+
+	struct Candidate
+	{
+		DWORD  target;
+		DWORD  twinSource;   // the seam twin collapsing along, or Nil
+		DWORD  twinTarget;
+		double cost;
+	};
+
+	struct HeapEntry
+	{
+		double cost;
+		DWORD  vertex;
+		DWORD  version;
+
+		// std::priority_queue keeps the largest on top; we want the cheapest
+		bool operator<(const HeapEntry& other) const { return cost > other.cost; }
+	};
+
+	struct RawChange
+	{
+		DWORD corner;   // face * 3 + k in the input order
+		DWORD from;
+		DWORD to;
+	};
+
+	unsigned long long EdgeKey(DWORD a, DWORD b)
+	{
+		return a < b ? ((unsigned long long)a << 32) | b : ((unsigned long long)b << 32) | a;
+	}
+
+	//
+	// The simplifier's working state.
+	//
+
+	class Simplifier
+	{
+	public:
+		int numVertices;
+		int numFaces;
+		int numThreads;
+
+		std::vector<float>  points;        // Dimensions floats per vertex
+		std::vector<DWORD>  indices;       // rewritten as vertices collapse
+		std::vector<DWORD>  attributes;
+		std::vector<BYTE>   alive;
+		std::vector<std::vector<DWORD> > facesOf;
+
+		std::vector<DWORD>   wedge;        // next vertex at the same position, a ring
+		std::vector<BYTE>    kind;
+		std::vector<Quadric> quadrics;
+		std::vector<BYTE>    dead;
+		std::vector<DWORD>   version;
+
+		std::unordered_map<unsigned long long, EdgeInfo> edges;
+
+		// what the collapses did
+		std::vector<int>       removedAt;  // collapse that removed each face, -1 for none
+		std::vector<RawChange> changes;
+		std::vector<DWORD>     removedFaces;
+		std::vector<ProgressiveMeshCollapse> collapses;
+
+		const float* point(DWORD v) const { return &points[v * Dimensions]; }
+		const D3DXVECTOR3& position(DWORD v) const { return *(const D3DXVECTOR3*)&points[v * Dimensions]; }
+
+		void weld();
+		void buildQuadrics();
+		void classify();
+
+		bool isBoundaryEdge(DWORD u, DWORD w) const;
+		DWORD findTwinTarget(DWORD u2, DWORD w) const;
+		bool flips(DWORD u, DWORD v) const;
+		bool findCollapse(DWORD u, Candidate* out) const;
+		void collapse(DWORD u, DWORD v, int collapseIndex, int* liveFaces);
+		void run(int minFaces, int liveFaces, ProgressiveMeshStats* stats);
+	};
+
+	// Rings of vertices that share a position.
+	void Simplifier::weld()
+	{
+		std::vector<DWORD> order(numVertices);
+		for(int v = 0; v < numVertices; v++)
+			order[v] = v;
+
+		struct PositionLess
+		{
+			const Simplifier* s;
+			bool operator()(DWORD a, DWORD b) const
+			{
+				const D3DXVECTOR3& p = s->position(a);
+				const D3DXVECTOR3& q = s->position(b);
+				if( p.x != q.x ) return p.x < q.x;
+				if( p.y != q.y ) return p.y < q.y;
+				if( p.z != q.z ) return p.z < q.z;
+				return a < b;
+			}
+		};
+		PositionLess less;
+		less.s = this;
+		std::sort(order.begin(), order.end(), less);
+
+		wedge.resize(numVertices);
+		for(int begin = 0; begin < numVertices; )
+		{
+			int end = begin + 1;
+			while( end < numVertices && position(order[end]) == position(order[begin]) )
+				end++;
+
+			for(int i = begin; i < end; i++)
+				wedge[order[i]] = order[i + 1 < end ? i + 1 : begin];
+			begin = end;
+		}
+	}
+
+	// Face quadrics, then each vertex's sum of them plus the planes that
+	// hold its boundary edges, one vertex range per thread.
+	void Simplifier::buildQuadrics()
+	{
+		for(int f = 0; f < numFaces; f++)
+		{
+			if( !alive[f] )
+				continue;
+			for(int k = 0; k < 3; k++)
+			{
+				DWORD a = indices[f * 3 + k], b = indices[f * 3 + (k + 1) % 3];
+				std::unordered_map<unsigned long long, EdgeInfo>::iterator found = edges.find(EdgeKey(a, b));
+				if( found == edges.end() )
+				{
+					EdgeInfo info;
+					info.count     = 1;
+					info.attribute = attributes[f];
+					info.mixed     = false;
+					edges.insert(std::make_pair(EdgeKey(a, b), info));
+				}
+				else
+				{
+					found->second.count++;
+					found->second.mixed |= found->second.attribute != attributes[f];
+				}
+			}
+		}
+
+		std::vector<Quadric> faceQuadrics(numFaces);
+		std::vector<BYTE>    faceValid(numFaces, 0);
+
+		ParallelFor(numFaces, numThreads, [&](int begin, int end)
+		{
+			for(int f = begin; f < end; f++)
+			{
+				if( !alive[f] )
+					continue;
+
+				const DWORD* tri = &indices[f * 3];
+				D3DXVECTOR3 n, e1 = position(tri[1]) - position(tri[0]), e2 = position(tri[2]) - position(tri[0]);
+				D3DXVec3Cross(&n, &e1, &e2);
+				double area = 0.5 * D3DXVec3Length(&n);
+
+				faceValid[f] = TriangleQuadric(point(tri[0]), point(tri[1]), point(tri[2]), area, &faceQuadrics[f]);
+			}
+		});
+
+		quadrics.resize(numVertices);
+
+		ParallelFor(numVertices, numThreads, [&](int begin, int end)
+		{
+			Quadric plane;
+			for(int v = begin; v < end; v++)
+			{
+				Quadric& q = quadrics[v];
+				q.clear();
+
+				for(int i = 0; i < (int)facesOf[v].size(); i++)
+				{
+					DWORD f = facesOf[v][i];
+					if( faceValid[f] )
+						q.add(faceQuadrics[f]);
+
+					const DWORD* tri = &indices[f * 3];
+					D3DXVECTOR3 faceNormal, e1 = position(tri[1]) - position(tri[0]), e2 = position(tri[2]) - position(tri[0]);
+					D3DXVec3Cross(&faceNormal, &e1, &e2);
+					D3DXVec3Normalize(&faceNormal, &faceNormal);
+
+					// the two edges of this face that meet at v
+					for(int k = 0; k < 3; k++)
+					{
+						DWORD a = tri[k], b = tri[(k + 1) % 3];
+						if( a != (DWORD)v && b != (DWORD)v )
+							continue;
+
+						const EdgeInfo& info = edges.find(EdgeKey(a, b))->second;
+						if( info.count == 2 && !info.mixed )
+							continue;
+
+						// a plane through the edge, square to the face
+						D3DXVECTOR3 edge = position(b) - position(a), n;
+						D3DXVec3Cross(&n, &edge, &faceNormal);
+						if( D3DXVec3Length(&n) == 0.0f )
+							continue;
+						D3DXVec3Normalize(&n, &n);
+
+						PlaneQuadric(n, -D3DXVec3Dot(&n, &position(a)),
+							BorderWeight * D3DXVec3LengthSq(&edge), &plane);
+						q.add(plane);
+					}
+				}
+			}
+		});
+	}
+
+	// What each vertex may do, from the boundary edges around it and its
+	// twins at the same position.
+	void Simplifier::classify()
+	{
+		std::vector<DWORD> boundary(numVertices * 2, Nil);
+		std::vector<int>   numBoundary(numVertices, 0);
+
+		ParallelFor(numVertices, numThreads, [&](int begin, int end)
+		{
+			for(int v = begin; v < end; v++)
+			{
+				for(int i = 0; i < (int)facesOf[v].size(); i++)
+				{
+					const DWORD* tri = &indices[facesOf[v][i] * 3];
+					for(int k = 0; k < 3; k++)
+					{
+						DWORD w = tri[k];
+						if( w == (DWORD)v )
+							continue;
+
+						const EdgeInfo& info = edges.find(EdgeKey(v, w))->second;
+						if( info.count == 2 && !info.mixed )
+							continue;
+
+						if( boundary[v * 2] == w || boundary[v * 2 + 1] == w )
+							continue;
+						if( numBoundary[v] < 2 )
+							boundary[v * 2 + numBoundary[v]] = w;
+						numBoundary[v]++;
+					}
+				}
+			}
+		});
+
+		kind.resize(numVertices);
+
+		ParallelFor(numVertices, numThreads, [&](int begin, int end)
+		{
+			for(int v = begin; v < end; v++)
+			{
+				DWORD twin = wedge[v];
+				if( facesOf[v].empty() )
+					kind[v] = KindLocked;
+				else if( twin == (DWORD)v )
+					kind[v] = numBoundary[v] == 0 ? KindManifold : numBoundary[v] == 2 ? KindBorder : KindLocked;
+				else if( wedge[twin] == (DWORD)v && numBoundary[v] == 2 && numBoundary[twin] == 2 )
+				{
+					// a seam: both twins' boundaries lead to the same two positions
+					const D3DXVECTOR3& a = position(boundary[v * 2]);
+					const D3DXVECTOR3& b = position(boundary[v * 2 + 1]);
+					const D3DXVECTOR3& c = position(boundary[twin * 2]);
+					const D3DXVECTOR3& d = position(boundary[twin * 2 + 1]);
+					bool matched = (a == c && b == d) || (a == d && b == c);
+					kind[v] = matched && !(a == b) ? KindSeam : KindLocked;
+				}
+				else
+					kind[v] = KindLocked;
+			}
+		});
+	}
+
+	// An open edge, one between materials, or a non-manifold one.
+	bool Simplifier::isBoundaryEdge(DWORD u, DWORD w) const
+	{
+		int count = 0;
+		DWORD attribute = 0;
+		bool mixed = false;
+
+		const std::vector<DWORD>& faces = facesOf[u];
+		for(int i = 0; i < (int)faces.size(); i++)
+		{
+			DWORD f = faces[i];
+			if( !alive[f] )
+				continue;
+			if( indices[f * 3] != w && indices[f * 3 + 1] != w && indices[f * 3 + 2] != w )
+				continue;
+
+			if( count > 0 && attributes[f] != attribute )
+				mixed = true;
+			attribute = attributes[f];
+			count++;
+		}
+		return count > 0 && (count != 2 || mixed);
+	}
+
+	// The twin of w that u2, the twin of u, shares a boundary edge with.
+	DWORD Simplifier::findTwinTarget(DWORD u2, DWORD w) const
+	{
+		for(DWORD x = wedge[w]; x != w; x = wedge[x])
+			if( !dead[x] && isBoundaryEdge(u2, x) )
+				return x;
+		return Nil;
+	}
+
+	// Whether moving u onto v would turn or flatten one of u's faces.
+	bool Simplifier::flips(DWORD u, DWORD v) const
+	{
+		const D3DXVECTOR3& target = position(v);
+
+		const std::vector<DWORD>& faces = facesOf[u];
+		for(int i = 0; i < (int)faces.size(); i++)
+		{
+			DWORD f = faces[i];
+			if( !alive[f] )
+				continue;
+
+			const DWORD* tri = &indices[f * 3];
+			if( tri[0] == v || tri[1] == v || tri[2] == v )
+				continue;
+
+			D3DXVECTOR3 p[3], q[3];
+			for(int k = 0; k < 3; k++)
+			{
+				p[k] = position(tri[k]);
+				q[k] = tri[k] == u ? target : p[k];
+			}
+
+			D3DXVECTOR3 before, after;
+			D3DXVECTOR3 a = p[1] - p[0], b = p[2] - p[0], c = q[1] - q[0], d = q[2] - q[0];
+			D3DXVec3Cross(&before, &a, &b);
+			D3DXVec3Cross(&after, &c, &d);
+
+			float lengths = D3DXVec3Length(&before) * D3DXVec3Length(&after);
+			if( lengths <= 0.0f || D3DXVec3Dot(&before, &after) <= MinFaceCosine * lengths )
+				return true;
+		}
+		return false;
+	}
+
+	// u's cheapest sound collapse, if it has one.
+	bool Simplifier::findCollapse(DWORD u, Candidate* out) const
+	{
+		if( dead[u] || kind[u] == KindLocked )
+			return false;
+
+		DWORD tried[64];
+		int numTried = 0;
+
+		out->cost = DBL_MAX;
+		out->target = Nil;
+
+		const std::vector<DWORD>& faces = facesOf[u];
+		for(int i = 0; i < (int)faces.size(); i++)
+		{
+			DWORD f = faces[i];
+			if( !alive[f] )
+				continue;
+
+			for(int k = 0; k < 3; k++)
+			{
+				DWORD w = indices[f * 3 + k];
+				if( w == u || position(w) == position(u) )
+					continue;
+
+				bool seen = false;
+				for(int t = 0; t < numTried && !seen; t++)
+					seen = tried[t] == w;
+				if( seen )
+					continue;
+				if( numTried < 64 )
+					tried[numTried++] = w;
+
+				if( kind[u] != KindManifold && !isBoundaryEdge(u, w) )
+					continue;
+
+				DWORD u2 = Nil, w2 = Nil;
+				if( kind[u] == KindSeam )
+				{
+					u2 = wedge[u];
+					w2 = findTwinTarget(u2, w);
+					if( w2 == Nil )
+						continue;
+				}
+
+				double cost = quadrics[u].evaluate(point(w));
+				if( u2 != Nil )
+					cost += quadrics[u2].evaluate(point(w2));
+				if( cost >= out->cost )
+					continue;
+
+				if( flips(u, w) || (u2 != Nil && flips(u2, w2)) )
+					continue;
+
+				out->cost       = cost;
+				out->target     = w;
+				out->twinSource = u2;
+				out->twinTarget = w2;
+			}
+		}
+		return out->target != Nil;
+	}
+
+	// Moves u onto v, removing the faces between them.
+	void Simplifier::collapse(DWORD u, DWORD v, int collapseIndex, int* liveFaces)
+	{
+		std::vector<DWORD>& faces = facesOf[u];
+		for(int i = 0; i < (int)faces.size(); i++)
+		{
+			DWORD f = faces[i];
+			if( !alive[f] )
+				continue;
+
+			DWORD* tri = &indices[f * 3];
+			if( tri[0] == v || tri[1] == v || tri[2] == v )
+			{
+				alive[f]     = 0;
+				removedAt[f] = collapseIndex;
+				removedFaces.push_back(f);
+				(*liveFaces)--;
+				continue;
+			}
+
+			for(int k = 0; k < 3; k++)
+			{
+				if( tri[k] != u )
+					continue;
+
+				RawChange change;
+				change.corner = f * 3 + k;
+				change.from   = u;
+				change.to     = v;
+				changes.push_back(change);
+
+				tri[k] = v;
+			}
+			facesOf[v].push_back(f);
+		}
+
+		faces.clear();
+		dead[u] = 1;
+		quadrics[v].add(quadrics[u]);
+
+		// drop v's removed faces while we are here
+		std::vector<DWORD>& target = facesOf[v];
+		int kept = 0;
+		for(int i = 0; i < (int)target.size(); i++)
+			if( alive[target[i]] )
+				target[kept++] = target[i];
+		target.resize(kept);
+	}
+
+	// Collapses cheapest first until minFaces.  Heap entries are never
+	// updated in place: a vertex whose cost may have changed gets a new
+	// entry and a new version, and stale entries are skipped when they come
+	// to the top.  The top entry is checked again before it is used, as a
+	// collapse elsewhere may have made it unsound or dearer.
+	void Simplifier::run(int minFaces, int liveFaces, ProgressiveMeshStats* stats)
+	{
+		double start = Now();
+
+		std::vector<Candidate> first(numVertices);
+		std::vector<BYTE>      found(numVertices, 0);
+
+		ParallelFor(numVertices, numThreads, [&](int begin, int end)
+		{
+			for(int v = begin; v < end; v++)
+				found[v] = findCollapse(v, &first[v]);
+		});
+
+		std::vector<HeapEntry> entries;
+		for(int v = 0; v < numVertices; v++)
+		{
+			if( !found[v] )
+				continue;
+
+			HeapEntry entry;
+			entry.cost    = first[v].cost;
+			entry.vertex  = v;
+			entry.version = 0;
+			entries.push_back(entry);
+		}
+
+		std::priority_queue<HeapEntry> heap(std::less<HeapEntry>(), entries);
+
+		stats->candidateMs = (float)(Now() - start);
+		start = Now();
+
+		std::vector<DWORD> touched;
+		double error = 0.0;
+
+		while( liveFaces > minFaces && !heap.empty() )
+		{
+			HeapEntry top = heap.top();
+			heap.pop();
+
+			DWORD u = top.vertex;
+			if( dead[u] || top.version != version[u] )
+				continue;
+
+			Candidate c;
+			if( !findCollapse(u, &c) )
+			{
+				// nothing sound now; a neighbour's collapse may requeue it
+				version[u]++;
+				continue;
+			}
+			if( c.cost > top.cost * 1.0001 + 1e-12 )
+			{
+				top.cost    = c.cost;
+				top.version = ++version[u];
+				heap.push(top);
+				continue;
+			}
+
+			ProgressiveMeshCollapse record;
+			record.firstChange  = (DWORD)changes.size();
+			record.firstRemoved = (DWORD)removedFaces.size();
+
+			int index = (int)collapses.size();
+			collapse(u, c.target, index, &liveFaces);
+			if( c.twinSource != Nil )
+				collapse(c.twinSource, c.twinTarget, index, &liveFaces);
+
+			error = std::max(error, sqrt(std::max(c.cost, 0.0)));
+
+			record.numChanges = (DWORD)changes.size() - record.firstChange;
+			record.numRemoved = (DWORD)removedFaces.size() - record.firstRemoved;
+			record.numFaces   = (DWORD)liveFaces;
+			record.error      = (float)error;
+			collapses.push_back(record);
+
+			// v and everything around it has new costs
+			touched.clear();
+			DWORD targets[2] = { c.target, c.twinTarget };
+			for(int t = 0; t < 2; t++)
+			{
+				if( targets[t] == Nil )
+					continue;
+
+				touched.push_back(targets[t]);
+				const std::vector<DWORD>& faces = facesOf[targets[t]];
+				for(int i = 0; i < (int)faces.size(); i++)
+					for(int k = 0; k < 3; k++)
+						touched.push_back(indices[faces[i] * 3 + k]);
+			}
+			std::sort(touched.begin(), touched.end());
+			touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+			for(int i = 0; i < (int)touched.size(); i++)
+			{
+				DWORD w = touched[i];
+				version[w]++;
+
+				Candidate next;
+				if( findCollapse(w, &next) )
+				{
+					HeapEntry entry;
+					entry.cost    = next.cost;
+					entry.vertex  = w;
+					entry.version = version[w];
+					heap.push(entry);
+				}
+			}
+		}
+
+		stats->collapseMs = (float)(Now() - start);
+	}
+}
+
+ProgressiveMeshStats::ProgressiveMeshStats()
+{
+	maxFaces       = 0;
+	minFaces       = 0;
+	vertices       = 0;
+	collapses      = 0;
+	seamVertices   = 0;
+	borderVertices = 0;
+	lockedVertices = 0;
+	numThreads     = 0;
+	quadricMs      = 0.0f;
+	candidateMs    = 0.0f;
+	collapseMs     = 0.0f;
+	totalMs        = 0.0f;
+}
+
+ProgressiveMesh::ProgressiveMesh()
+{
+	_numVertices = 0;
+	_fvf         = 0;
+	_stride      = 0;
+	_level       = 0;
+	_maxFaces    = 0;
+	_numFaces    = 0;
+	_lastChanges = 0;
+	_mesh        = 0;
+}
+
+ProgressiveMesh::~ProgressiveMesh()
+{
+	release();
+}
+
+void ProgressiveMesh::release()
+{
+	d3d::Release<ID3DXMesh*>(_mesh);
+	_mesh = 0;
+
+	_vertices.clear();
+	_indices.clear();
+	_subsets.clear();
+	_fullFaceCounts.clear();
+	_collapses.clear();
+	_changes.clear();
+	_removedSubsets.clear();
+
+	_numVertices = 0;
+	_level       = 0;
+	_maxFaces    = 0;
+	_numFaces    = 0;
+	_lastChanges = 0;
+}
+
+bool ProgressiveMesh::generate(const void* vertices, int numVertices, DWORD fvf,
+	const DWORD* indices, const DWORD* attributes, int numFaces,
+	int minFaces, int numThreads, ProgressiveMeshStats* stats)
+{
+	ProgressiveMeshStats local;
+	if( !stats )
+		stats = &local;
+	*stats = ProgressiveMeshStats();
+
+	double start = Now();
+
+	release();
+
+	int stride, normalOffset, texCoordOffset;
+	if( numVertices <= 0 || numFaces <= 0 || !VertexLayout(fvf, &stride, &normalOffset, &texCoordOffset) )
+		return false;
+
+	for(int i = 0; i < numFaces * 3; i++)
+		if( indices[i] >= (DWORD)numVertices )
+			return false;
+
+	Simplifier s;
+	s.numVertices = numVertices;
+	s.numFaces    = numFaces;
+	s.numThreads  = ResolveThreads(numThreads);
+
+	// Points in the full space.  Attributes are scaled to the mesh.
+	const BYTE* bytes = (const BYTE*)vertices;
+	D3DXVECTOR3 lo = *(const D3DXVECTOR3*)bytes, hi = lo;
+	for(int v = 1; v < numVertices; v++)
+	{
+		D3DXVec3Minimize(&lo, &lo, (const D3DXVECTOR3*)(bytes + v * stride));
+		D3DXVec3Maximize(&hi, &hi, (const D3DXVECTOR3*)(bytes + v * stride));
+	}
+	D3DXVECTOR3 diagonal = hi - lo;
+	float radius = 0.5f * D3DXVec3Length(&diagonal);
+
+	s.points.assign(numVertices * Dimensions, 0.0f);
+	for(int v = 0; v < numVertices; v++)
+	{
+		const BYTE* vertex = bytes + v * stride;
+		float* p = &s.points[v * Dimensions];
+
+		memcpy(p, vertex, 12);
+		if( normalOffset >= 0 )
+		{
+			const float* n = (const float*)(vertex + normalOffset);
+			for(int i = 0; i < 3; i++)
+				p[3 + i] = n[i] * radius * NormalWeight;
+		}
+		if( texCoordOffset >= 0 )
+		{
+			const float* uv = (const float*)(vertex + texCoordOffset);
+			for(int i = 0; i < 2; i++)
+				p[6 + i] = uv[i] * radius * TexCoordWeight;
+		}
+	}
+
+	s.indices.assign(indices, indices + numFaces * 3);
+	s.attributes.assign(attributes, attributes + numFaces);
+	s.alive.assign(numFaces, 1);
+	s.removedAt.assign(numFaces, -1);
+	s.dead.assign(numVertices, 0);
+	s.version.assign(numVertices, 0);
+
+	// Degenerate triangles stay as they are and take no part.
+	s.facesOf.resize(numVertices);
+	std::vector<BYTE> degenerate(numFaces, 0);
+	int liveFaces = 0;
+	for(int f = 0; f < numFaces; f++)
+	{
+		const DWORD* tri = &indices[f * 3];
+		if( tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0] )
+		{
+			degenerate[f] = 1;
+			s.alive[f]    = 0;
+			continue;
+		}
+		for(int k = 0; k < 3; k++)
+			s.facesOf[tri[k]].push_back(f);
+		liveFaces++;
+	}
+	int numDegenerate = numFaces - liveFaces;
+
+	s.weld();
+	s.buildQuadrics();
+	s.classify();
+
+	for(int v = 0; v < numVertices; v++)
+	{
+		stats->seamVertices   += s.kind[v] == KindSeam;
+		stats->borderVertices += s.kind[v] == KindBorder;
+		stats->lockedVertices += s.kind[v] == KindLocked && !s.facesOf[v].empty();
+	}
+	stats->quadricMs = (float)(Now() - start);
+
+	s.run(std::max(minFaces - numDegenerate, 1), liveFaces, stats);
+
+	//
+	// Lay the faces out so that each subset's live faces are a prefix of
+	// it at every level: those never removed, then the rest in reverse order
+	// of removal.
+	//
+
+	std::vector<DWORD> ids(attributes, attributes + numFaces);
+	std::sort(ids.begin(), ids.end());
+	ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+	std::vector<DWORD> rank(numFaces);
+	for(int f = 0; f < numFaces; f++)
+		rank[f] = (DWORD)(std::lower_bound(ids.begin(), ids.end(), attributes[f]) - ids.begin());
+
+	struct FaceOrder
+	{
+		const std::vector<DWORD>* rank;
+		const std::vector<int>*   removedAt;
+		bool operator()(DWORD a, DWORD b) const
+		{
+			if( (*rank)[a] != (*rank)[b] )
+				return (*rank)[a] < (*rank)[b];
+			unsigned ra = (unsigned)(*removedAt)[a], rb = (unsigned)(*removedAt)[b];   // -1 sorts first
+			return ra > rb;
+		}
+	};
+	FaceOrder faceOrder;
+	faceOrder.rank      = &rank;
+	faceOrder.removedAt = &s.removedAt;
+
+	std::vector<DWORD> order(numFaces);
+	for(int f = 0; f < numFaces; f++)
+		order[f] = f;
+	std::stable_sort(order.begin(), order.end(), faceOrder);
+
+	std::vector<DWORD> position(numFaces);
+	for(int i = 0; i < numFaces; i++)
+		position[order[i]] = i;
+
+	_indices.resize(numFaces * 3);
+	for(int i = 0; i < numFaces; i++)
+		for(int k = 0; k < 3; k++)
+			_indices[i * 3 + k] = indices[order[i] * 3 + k];
+
+	_changes.resize(s.changes.size());
+	for(int i = 0; i < (int)s.changes.size(); i++)
+	{
+		const RawChange& raw = s.changes[i];
+		_changes[i].corner = position[raw.corner / 3] * 3 + raw.corner % 3;
+		_changes[i].from   = raw.from;
+		_changes[i].to     = raw.to;
+	}
+
+	_removedSubsets.resize(s.removedFaces.size());
+	for(int i = 0; i < (int)s.removedFaces.size(); i++)
+		_removedSubsets[i] = rank[s.removedFaces[i]];
+
+	_collapses.swap(s.collapses);
+	for(int i = 0; i < (int)_collapses.size(); i++)
+		_collapses[i].numFaces += numDegenerate;
+
+	// Vertex ranges cover every level.
+	_subsets.resize(ids.size());
+	for(int r = 0; r < (int)ids.size(); r++)
+	{
+		_subsets[r].AttribId    = ids[r];
+		_subsets[r].FaceStart   = 0;
+		_subsets[r].FaceCount   = 0;
+		_subsets[r].VertexStart = 0xffffffff;
+		_subsets[r].VertexCount = 0;
+	}
+
+	std::vector<DWORD> highest(ids.size(), 0);
+	for(int i = 0; i < numFaces; i++)
+	{
+		D3DXATTRIBUTERANGE& subset = _subsets[rank[order[i]]];
+		if( subset.FaceCount == 0 )
+			subset.FaceStart = i;
+		subset.FaceCount++;
+
+		for(int k = 0; k < 3; k++)
+		{
+			DWORD v = _indices[i * 3 + k];
+			subset.VertexStart = std::min(subset.VertexStart, v);
+			highest[rank[order[i]]] = std::max(highest[rank[order[i]]], v);
+		}
+	}
+	for(int i = 0; i < (int)_changes.size(); i++)
+	{
+		DWORD r = rank[order[_changes[i].corner / 3]];
+		_subsets[r].VertexStart = std::min(_subsets[r].VertexStart, _changes[i].to);
+		highest[r] = std::max(highest[r], _changes[i].to);
+	}
+	for(int r = 0; r < (int)ids.size(); r++)
+	{
+		_subsets[r].VertexCount = highest[r] - _subsets[r].VertexStart + 1;
+		_fullFaceCounts.push_back(_subsets[r].FaceCount);
+	}
+
+	_numVertices = numVertices;
+	_fvf         = fvf;
+	_stride      = stride;
+	_vertices.assign(bytes, bytes + numVertices * stride);
+	_level       = 0;
+	_maxFaces    = numFaces;
+	_numFaces    = numFaces;
+	_lastChanges = 0;
+
+	stats->maxFaces   = _maxFaces;
+	stats->minFaces   = getMinFaces();
+	stats->vertices   = numVertices;
+	stats->collapses  = (int)_collapses.size();
+	stats->numThreads = s.numThreads;
+	stats->totalMs    = (float)(Now() - start);
+
+	return true;
+}
+
+bool ProgressiveMesh::createFromMesh(IDirect3DDevice9* device, ID3DXMesh* source,
+	int minFaces, int numThreads, ProgressiveMeshStats* stats)
+{
+	int   numFaces    = (int)source->GetNumFaces();
+	int   numVertices = (int)source->GetNumVertices();
+	DWORD fvf         = source->GetFVF();
+	bool  wide        = (source->GetOptions() & D3DXMESH_32BIT) != 0;
+
+	int stride, normalOffset, texCoordOffset;
+	if( !VertexLayout(fvf, &stride, &normalOffset, &texCoordOffset) || stride != (int)source->GetNumBytesPerVertex() )
+		return false;
+
+	std::vector<DWORD> indices(numFaces * 3);
+	std::vector<DWORD> attributes(numFaces);
+
+	void*  data = 0;
+	DWORD* ids  = 0;
+
+	if( FAILED(source->LockIndexBuffer(D3DLOCK_READONLY, &data)) )
+		return false;
+	for(int i = 0; i < numFaces * 3; i++)
+		indices[i] = wide ? ((DWORD*)data)[i] : ((WORD*)data)[i];
+	source->UnlockIndexBuffer();
+
+	if( FAILED(source->LockAttributeBuffer(D3DLOCK_READONLY, &ids)) )
+		return false;
+	memcpy(&attributes[0], ids, numFaces * sizeof(DWORD));
+	source->UnlockAttributeBuffer();
+
+	if( FAILED(source->LockVertexBuffer(D3DLOCK_READONLY, &data)) )
+		return false;
+	bool ok = generate(data, numVertices, fvf, &indices[0], &attributes[0], numFaces, minFaces, numThreads, stats);
+	source->UnlockVertexBuffer();
+
+	if( !ok )
+		return false;
+
+	//
+	// The mesh the levels are drawn from: same vertices, full detail indices.
+	//
+
+	if( FAILED(D3DXCreateMeshFVF(_maxFaces, _numVertices, D3DXMESH_MANAGED | (wide ? D3DXMESH_32BIT : 0),
+		_fvf, device, &_mesh)) )
+		return false;
+
+	ok = false;
+	if( SUCCEEDED(_mesh->LockVertexBuffer(0, &data)) )
+	{
+		memcpy(data, &_vertices[0], _vertices.size());
+		_mesh->UnlockVertexBuffer();
+
+		if( SUCCEEDED(_mesh->LockIndexBuffer(0, &data)) )
+		{
+			for(int i = 0; i < _maxFaces * 3; i++)
+			{
+				if( wide )
+					((DWORD*)data)[i] = _indices[i];
+				else
+					((WORD*)data)[i] = (WORD)_indices[i];
+			}
+			_mesh->UnlockIndexBuffer();
+
+			if( SUCCEEDED(_mesh->LockAttributeBuffer(0, &ids)) )
+			{
+				for(int r = 0; r < (int)_subsets.size(); r++)
+					for(DWORD f = 0; f < _subsets[r].FaceCount; f++)
+						ids[_subsets[r].FaceStart + f] = _subsets[r].AttribId;
+				_mesh->UnlockAttributeBuffer();
+
+				ok = SUCCEEDED(_mesh->SetAttributeTable(&_subsets[0], (DWORD)_subsets.size()));
+			}
+		}
+	}
+
+	if( !ok )
+	{
+		d3d::Release<ID3DXMesh*>(_mesh);
+		_mesh = 0;
+	}
+	return ok;
+}
+
+void ProgressiveMesh::setNumFaces(int numFaces)
+{
+	// the first level with at most numFaces faces, the last if none has
+	int target = 0;
+	if( numFaces < _maxFaces && !_collapses.empty() )
+	{
+		int lo = 1, hi = (int)_collapses.size();
+		while( lo < hi )
+		{
+			int mid = (lo + hi) / 2;
+			if( (int)_collapses[mid - 1].numFaces <= numFaces )
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		target = lo;
+	}
+
+	DWORD firstCorner = 0xffffffff, lastCorner = 0;
+	int changes = 0;
+	bool moved = _level != target;
+
+	// collapses
+	while( _level < target )
+	{
+		const ProgressiveMeshCollapse& c = _collapses[_level++];
+		for(DWORD i = c.firstChange; i < c.firstChange + c.numChanges; i++)
+		{
+			const ProgressiveMeshChange& change = _changes[i];
+			_indices[change.corner] = change.to;
+			firstCorner = std::min(firstCorner, change.corner);
+			lastCorner  = std::max(lastCorner, change.corner);
+		}
+		for(DWORD i = c.firstRemoved; i < c.firstRemoved + c.numRemoved; i++)
+			_subsets[_removedSubsets[i]].FaceCount--;
+		changes += c.numChanges;
+	}
+
+	// vertex splits
+	while( _level > target )
+	{
+		const ProgressiveMeshCollapse& c = _collapses[--_level];
+		for(DWORD i = c.firstChange + c.numChanges; i-- > c.firstChange; )
+		{
+			const ProgressiveMeshChange& change = _changes[i];
+			_indices[change.corner] = change.from;
+			firstCorner = std::min(firstCorner, change.corner);
+			lastCorner  = std::max(lastCorner, change.corner);
+		}
+		for(DWORD i = c.firstRemoved; i < c.firstRemoved + c.numRemoved; i++)
+			_subsets[_removedSubsets[i]].FaceCount++;
+		changes += c.numChanges;
+	}
+
+	_numFaces    = _level == 0 ? _maxFaces : (int)_collapses[_level - 1].numFaces;
+	_lastChanges = changes;
+
+	if( moved )
+		upload(firstCorner, lastCorner);
+}
+
+// Rewrites the changed stretch of the index buffer and the face counts.
+bool ProgressiveMesh::upload(DWORD firstCorner, DWORD lastCorner)
+{
+	if( !_mesh )
+		return true;
+
+	if( firstCorner <= lastCorner )
+	{
+		IDirect3DIndexBuffer9* ib = 0;
+		if( FAILED(_mesh->GetIndexBuffer(&ib)) )
+			return false;
+
+		bool wide = (_mesh->GetOptions() & D3DXMESH_32BIT) != 0;
+		UINT size = wide ? 4 : 2;
+
+		void* data = 0;
+		HRESULT hr = ib->Lock(firstCorner * size, (lastCorner - firstCorner + 1) * size, &data, 0);
+		if( SUCCEEDED(hr) )
+		{
+			for(DWORD i = firstCorner; i <= lastCorner; i++)
+			{
+				if( wide )
+					((DWORD*)data)[i - firstCorner] = _indices[i];
+				else
+					((WORD*)data)[i - firstCorner] = (WORD)_indices[i];
+			}
+			ib->Unlock();
+		}
+		d3d::Release<IDirect3DIndexBuffer9*>(ib);
+
+		if( FAILED(hr) )
+			return false;
+	}
+
+	return SUCCEEDED(_mesh->SetAttributeTable(&_subsets[0], (DWORD)_subsets.size()));
+}
+
+HRESULT ProgressiveMesh::drawSubset(DWORD attribId)
+{
+	if( !_mesh )
+		return E_FAIL;
+
+	for(int r = 0; r < (int)_subsets.size(); r++)
+	{
+		if( _subsets[r].AttribId != attribId )
+			continue;
+
+		// a subset collapsed away entirely draws nothing
+		if( _subsets[r].FaceCount == 0 )
+			return D3D_OK;
+		return _mesh->DrawSubset(attribId);
+	}
+	return D3D_OK;
+}
@@ -0,0 +1,837 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: vertexCompression.cpp
+//
+// Desc: Quantized vertex formats and their SSE2 encode and decode kernels.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "vertexCompression.h"
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <emmintrin.h>
+
+namespace
+{
+	double Now()
+	{
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+	}
+
+	int ResolveThreads(int numThreads)
+	{
+		if( numThreads <= 0 )
+			numThreads = (int)std::thread::hardware_concurrency();
+		if( numThreads <= 0 )
+			numThreads = 1;
+		return numThreads;
+	}
+
+	// Calls body(begin, end) over [0, count) split into numThreads ranges,
+	// the first on the calling thread.
+	template<class Body> void ParallelFor(int count, int numThreads, Body body)
+	{
+		std::vector<std::thread> threads;
+		for(int t = 1; t < numThreads; t++)
+			threads.push_back(std::thread(body, count * t / numThreads, count * (t + 1) / numThreads));
+		body(0, count / numThreads);
+
+		for(int t = 0; t < (int)threads.size(); t++)
+			threads[t].join();
+	}
+
+	// Byte offsets in a compressed vertex.
+	const int PositionOffset = 0;
+	const int Normal16Offset = 8;
+
+	int UvOffset(const CompressedVertexFormat& format)
+	{
+		return format.normal == VertexNormalOct16 ? 12 : 8;
+	}
+
+	int ColorOffset(const CompressedVertexFormat& format)
+	{
+		return UvOffset(format) + 4;
+	}
+
+	// What the kernels need, in both forms.
+	struct Constants
+	{
+		bool  oct16;
+		bool  color;
+		int   size;
+		int   uvOffset;
+		int   colorOffset;
+
+		float offset[3];
+		float scale[3];
+		float invScale[3];
+		float normalRange;   // 127 or 32767
+		float invNormalRange;
+	};
+
+	void SetConstants(const CompressedVertexFormat& format, const VertexQuantization& q, Constants* c)
+	{
+		c->oct16       = format.normal == VertexNormalOct16;
+		c->color       = format.color;
+		c->size        = GetCompressedVertexSize(format);
+		c->uvOffset    = UvOffset(format);
+		c->colorOffset = ColorOffset(format);
+
+		const float* offset = (const float*)&q.offset;
+		const float* scale  = (const float*)&q.scale;
+		for(int i = 0; i < 3; i++)
+		{
+			c->offset[i]   = offset[i];
+			c->scale[i]    = scale[i];
+			c->invScale[i] = scale[i] > 0.0f ? 1.0f / scale[i] : 0.0f;
+		}
+
+		c->normalRange    = c->oct16 ? 32767.0f : 127.0f;
+		c->invNormalRange = 1.0f / c->normalRange;
+	}
+
+	//
+	// Scalar kernels.  Each step is the same single precision operation the
+	// SSE2 kernels do, so the two give the same bytes.
+	//
+
+	int Round(float x)
+	{
+		// to nearest, ties to even, as cvtps2dq does
+		return _mm_cvtss_si32(_mm_set_ss(x));
+	}
+
+	float Clamp(float x, float lo, float hi)
+	{
+		return x < lo ? lo : (x > hi ? hi : x);
+	}
+
+	float SignNotZero(float x)
+	{
+		return x >= 0.0f ? 1.0f : -1.0f;
+	}
+
+	float AsFloat(DWORD x) { float f; memcpy(&f, &x, 4); return f; }
+	DWORD AsDword(float f) { DWORD x = 0; memcpy(&x, &f, 4); return x; }
+
+	// Round to nearest even; overflow goes to infinity, NaN stays NaN.
+	WORD FloatToHalf(float f)
+	{
+		DWORD x    = AsDword(f);
+		DWORD sign = (x >> 16) & 0x8000;
+		DWORD abs  = x & 0x7fffffff;
+
+		DWORD h;
+		if( abs >= 0x47800000 )                 // 65536 and up, infinity, NaN
+			h = 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+		else if( abs < 0x38800000 )             // below 2^-14: a subnormal half
+			h = AsDword(AsFloat(abs) + AsFloat(126u << 23)) - (126u << 23);
+		else
+			h = (abs + 0xfff - (112u << 23) + ((abs >> 13) & 1)) >> 13;
+
+		return (WORD)(h | sign);
+	}
+
+	float HalfToFloat(WORD h)
+	{
+		DWORD expmant = h & 0x7fff;
+		float f = AsFloat(expmant << 13) * AsFloat(239u << 23);
+		DWORD x = AsDword(f) | ((DWORD)(h & 0x8000) << 16);
+		if( expmant > 0x7bff )
+			x |= 255u << 23;
+		return AsFloat(x);
+	}
+
+	void EncodeVertex(const float* v, const D3DXCOLOR* color, BYTE* out, const Constants& c)
+	{
+		short p[4];
+		for(int i = 0; i < 3; i++)
+			p[i] = (short)Round(Clamp((v[i] - c.offset[i]) * c.invScale[i], -32767.0f, 32767.0f));
+
+		// octahedral normal
+		float l1 = fabsf(v[3]) + fabsf(v[4]) + fabsf(v[5]);
+		if( l1 < 1e-20f )
+			l1 = 1e-20f;
+		float ox = v[3] / l1;
+		float oy = v[4] / l1;
+		if( v[5] < 0.0f )
+		{
+			float fx = (1.0f - fabsf(oy)) * SignNotZero(ox);
+			float fy = (1.0f - fabsf(ox)) * SignNotZero(oy);
+			ox = fx;
+			oy = fy;
+		}
+		int qx = Round(Clamp(ox * c.normalRange, -c.normalRange, c.normalRange));
+		int qy = Round(Clamp(oy * c.normalRange, -c.normalRange, c.normalRange));
+
+		if( c.oct16 )
+		{
+			p[3] = 0;
+			short n[2] = { (short)qx, (short)qy };
+			memcpy(out + Normal16Offset, n, 4);
+		}
+		else
+		{
+			p[3] = (short)(((qy + 127) << 8 | (qx + 127)) - 32768);
+		}
+		memcpy(out + PositionOffset, p, 8);
+
+		WORD uv[2] = { FloatToHalf(v[6]), FloatToHalf(v[7]) };
+		memcpy(out + c.uvOffset, uv, 4);
+
+		if( c.color )
+		{
+			DWORD d = 0xffffffff;
+			if( color )
+			{
+				DWORD a = Round(Clamp(color->a, 0.0f, 1.0f) * 255.0f);
+				DWORD r = Round(Clamp(color->r, 0.0f, 1.0f) * 255.0f);
+				DWORD g = Round(Clamp(color->g, 0.0f, 1.0f) * 255.0f);
+				DWORD b = Round(Clamp(color->b, 0.0f, 1.0f) * 255.0f);
+				d = (a << 24) | (r << 16) | (g << 8) | b;
+			}
+			memcpy(out + c.colorOffset, &d, 4);
+		}
+	}
+
+	void DecodeVertex(const BYTE* in, float* v, D3DXCOLOR* color, const Constants& c)
+	{
+		short p[4];
+		memcpy(p, in + PositionOffset, 8);
+		for(int i = 0; i < 3; i++)
+			v[i] = c.offset[i] + c.scale[i] * (float)p[i];
+
+		int qx, qy;
+		if( c.oct16 )
+		{
+			short n[2];
+			memcpy(n, in + Normal16Offset, 4);
+			qx = n[0];
+			qy = n[1];
+		}
+		else
+		{
+			int w = p[3] + 32768;
+			qx = (w & 255) - 127;
+			qy = (w >> 8) - 127;
+		}
+
+		float x = (float)qx * c.invNormalRange;
+		float y = (float)qy * c.invNormalRange;
+		float z = 1.0f - fabsf(x) - fabsf(y);
+		if( z < 0.0f )
+		{
+			float fx = (1.0f - fabsf(y)) * SignNotZero(x);
+			float fy = (1.0f - fabsf(x)) * SignNotZero(y);
+			x = fx;
+			y = fy;
+		}
+		float length = sqrtf(x * x + y * y + z * z);
+		v[3] = x / length;
+		v[4] = y / length;
+		v[5] = z / length;
+
+		WORD uv[2];
+		memcpy(uv, in + c.uvOffset, 4);
+		v[6] = HalfToFloat(uv[0]);
+		v[7] = HalfToFloat(uv[1]);
+
+		if( c.color && color )
+		{
+			DWORD d = 0;
+			memcpy(&d, in + c.colorOffset, 4);
+			color->a = (float)(d >> 24) * (1.0f / 255.0f);
+			color->r = (float)((d >> 16) & 255) * (1.0f / 255.0f);
+			color->g = (float)((d >> 8) & 255) * (1.0f / 255.0f);
+			color->b = (float)(d & 255) * (1.0f / 255.0f);
+		}
+	}
+
+	//
+	// SSE2 kernels, four vertices at a time.
+	//
+
+	__m128 Abs(__m128 x)
+	{
+		return _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+	}
+
+	__m128 Select(__m128 mask, __m128 a, __m128 b)
+	{
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+
+	__m128 SignNotZero(__m128 x)
+	{
+		return Select(_mm_cmpge_ps(x, _mm_setzero_ps()), _mm_set1_ps(1.0f), _mm_set1_ps(-1.0f));
+	}
+
+	__m128 Clamp(__m128 x, __m128 lo, __m128 hi)
+	{
+		return _mm_min_ps(_mm_max_ps(x, lo), hi);
+	}
+
+	// Fabian Giesen's float to half with round to nearest even, the same
+	// steps as FloatToHalf; four halves in the low words of the lanes.
+	__m128i FloatToHalf(__m128 f)
+	{
+		__m128i signMask  = _mm_set1_epi32((int)0x80000000u);
+		__m128i halfMax   = _mm_set1_epi32(0x47800000);
+		__m128i minNormal = _mm_set1_epi32(0x38800000);
+		__m128i subMagic  = _mm_set1_epi32(126 << 23);
+		__m128i bias      = _mm_set1_epi32(0xfff - (112 << 23));
+
+		__m128  sign    = _mm_and_ps(_mm_castsi128_ps(signMask), f);
+		__m128  absf    = _mm_xor_ps(f, sign);
+		__m128i abs     = _mm_castps_si128(absf);
+
+		__m128i isNan     = _mm_castps_si128(_mm_cmpunord_ps(absf, absf));
+		__m128i isRegular = _mm_cmpgt_epi32(halfMax, abs);
+		__m128i infOrNan  = _mm_or_si128(_mm_and_si128(isNan, _mm_set1_epi32(0x200)), _mm_set1_epi32(0x7c00));
+
+		__m128i isSub     = _mm_cmpgt_epi32(minNormal, abs);
+		__m128i sub       = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absf, _mm_castsi128_ps(subMagic))), subMagic);
+
+		__m128i odd       = _mm_and_si128(_mm_srli_epi32(abs, 13), _mm_set1_epi32(1));
+		__m128i normal    = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(abs, bias), odd), 13);
+
+		__m128i finite    = _mm_or_si128(_mm_and_si128(isSub, sub), _mm_andnot_si128(isSub, normal));
+		__m128i h         = _mm_or_si128(_mm_and_si128(isRegular, finite), _mm_andnot_si128(isRegular, infOrNan));
+
+		return _mm_or_si128(h, _mm_srli_epi32(_mm_castps_si128(sign), 16));
+	}
+
+	__m128 HalfToFloat(__m128i h)
+	{
+		__m128i expmant = _mm_and_si128(h, _mm_set1_epi32(0x7fff));
+		__m128i sign    = _mm_slli_epi32(_mm_xor_si128(h, expmant), 16);
+		__m128  scaled  = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(expmant, 13)),
+			_mm_castsi128_ps(_mm_set1_epi32(239 << 23)));
+		__m128i infNan  = _mm_and_si128(_mm_cmpgt_epi32(expmant, _mm_set1_epi32(0x7bff)), _mm_set1_epi32(255 << 23));
+
+		return _mm_or_ps(scaled, _mm_castsi128_ps(_mm_or_si128(sign, infNan)));
+	}
+
+	// Sign extends the low and high words of each lane.
+	__m128i LowShorts(__m128i x)  { return _mm_srai_epi32(_mm_slli_epi32(x, 16), 16); }
+	__m128i HighShorts(__m128i x) { return _mm_srai_epi32(x, 16); }
+
+	__m128i LoadDwords(const BYTE* const in[4], int offset)
+	{
+		int d[4];
+		for(int k = 0; k < 4; k++)
+			memcpy(&d[k], in[k] + offset, 4);
+		return _mm_loadu_si128((const __m128i*)d);
+	}
+
+	void StoreDwords(__m128i x, BYTE* const out[4], int offset)
+	{
+		int d[4];
+		_mm_storeu_si128((__m128i*)d, x);
+		for(int k = 0; k < 4; k++)
+			memcpy(out[k] + offset, &d[k], 4);
+	}
+
+	void Encode4(const float* const v[4], const D3DXCOLOR* const color[4], BYTE* const out[4],
+		const Constants& c)
+	{
+		__m128 px = _mm_loadu_ps(v[0]),     py = _mm_loadu_ps(v[1]),     pz = _mm_loadu_ps(v[2]),     nx = _mm_loadu_ps(v[3]);
+		__m128 ny = _mm_loadu_ps(v[0] + 4), nz = _mm_loadu_ps(v[1] + 4), tu = _mm_loadu_ps(v[2] + 4), tv = _mm_loadu_ps(v[3] + 4);
+		_MM_TRANSPOSE4_PS(px, py, pz, nx);
+		_MM_TRANSPOSE4_PS(ny, nz, tu, tv);
+
+		// position
+		__m128 lo = _mm_set1_ps(-32767.0f), hi = _mm_set1_ps(32767.0f);
+		__m128i qx = _mm_cvtps_epi32(Clamp(_mm_mul_ps(_mm_sub_ps(px, _mm_set1_ps(c.offset[0])), _mm_set1_ps(c.invScale[0])), lo, hi));
+		__m128i qy = _mm_cvtps_epi32(Clamp(_mm_mul_ps(_mm_sub_ps(py, _mm_set1_ps(c.offset[1])), _mm_set1_ps(c.invScale[1])), lo, hi));
+		__m128i qz = _mm_cvtps_epi32(Clamp(_mm_mul_ps(_mm_sub_ps(pz, _mm_set1_ps(c.offset[2])), _mm_set1_ps(c.invScale[2])), lo, hi));
+
+		// octahedral normal
+		__m128 l1 = _mm_max_ps(_mm_add_ps(_mm_add_ps(Abs(nx), Abs(ny)), Abs(nz)), _mm_set1_ps(1e-20f));
+		__m128 ox = _mm_div_ps(nx, l1);
+		__m128 oy = _mm_div_ps(ny, l1);
+		__m128 lower = _mm_cmplt_ps(nz, _mm_setzero_ps());
+		__m128 one = _mm_set1_ps(1.0f);
+		__m128 fx = _mm_mul_ps(_mm_sub_ps(one, Abs(oy)), SignNotZero(ox));
+		__m128 fy = _mm_mul_ps(_mm_sub_ps(one, Abs(ox)), SignNotZero(oy));
+		ox = Select(lower, fx, ox);
+		oy = Select(lower, fy, oy);
+
+		__m128 range = _mm_set1_ps(c.normalRange), negRange = _mm_set1_ps(-c.normalRange);
+		__m128i nqx = _mm_cvtps_epi32(Clamp(_mm_mul_ps(ox, range), negRange, range));
+		__m128i nqy = _mm_cvtps_epi32(Clamp(_mm_mul_ps(oy, range), negRange, range));
+
+		__m128i qw;
+		if( c.oct16 )
+		{
+			qw = _mm_setzero_si128();
+			__m128i n = _mm_or_si128(_mm_and_si128(nqx, _mm_set1_epi32(0xffff)), _mm_slli_epi32(nqy, 16));
+			StoreDwords(n, out, Normal16Offset);
+		}
+		else
+		{
+			__m128i bias = _mm_set1_epi32(127);
+			qw = _mm_sub_epi32(_mm_or_si128(_mm_slli_epi32(_mm_add_epi32(nqy, bias), 8), _mm_add_epi32(nqx, bias)),
+				_mm_set1_epi32(32768));
+		}
+
+		// x y z w of each vertex, side by side
+		__m128i xy  = _mm_packs_epi32(qx, qy);                     // x0 x1 x2 x3 y0 y1 y2 y3
+		__m128i zw  = _mm_packs_epi32(qz, qw);
+		__m128i xyi = _mm_unpacklo_epi16(xy, _mm_unpackhi_epi64(xy, xy));   // x0 y0 x1 y1 ...
+		__m128i zwi = _mm_unpacklo_epi16(zw, _mm_unpackhi_epi64(zw, zw));
+		__m128i p01 = _mm_unpacklo_epi32(xyi, zwi);
+		__m128i p23 = _mm_unpackhi_epi32(xyi, zwi);
+		_mm_storel_epi64((__m128i*)(out[0] + PositionOffset), p01);
+		_mm_storel_epi64((__m128i*)(out[1] + PositionOffset), _mm_unpackhi_epi64(p01, p01));
+		_mm_storel_epi64((__m128i*)(out[2] + PositionOffset), p23);
+		_mm_storel_epi64((__m128i*)(out[3] + PositionOffset), _mm_unpackhi_epi64(p23, p23));
+
+		// texture coordinates
+		StoreDwords(_mm_or_si128(FloatToHalf(tu), _mm_slli_epi32(FloatToHalf(tv), 16)), out, c.uvOffset);
+
+		if( c.color )
+		{
+			__m128i d = _mm_set1_epi32(-1);
+			if( color[0] )
+			{
+				__m128 r = _mm_loadu_ps((const float*)color[0]), g = _mm_loadu_ps((const float*)color[1]);
+				__m128 b = _mm_loadu_ps((const float*)color[2]), a = _mm_loadu_ps((const float*)color[3]);
+				_MM_TRANSPOSE4_PS(r, g, b, a);
+
+				__m128 zero = _mm_setzero_ps(), scale = _mm_set1_ps(255.0f);
+				__m128i ri = _mm_cvtps_epi32(_mm_mul_ps(Clamp(r, zero, one), scale));
+				__m128i gi = _mm_cvtps_epi32(_mm_mul_ps(Clamp(g, zero, one), scale));
+				__m128i bi = _mm_cvtps_epi32(_mm_mul_ps(Clamp(b, zero, one), scale));
+				__m128i ai = _mm_cvtps_epi32(_mm_mul_ps(Clamp(a, zero, one), scale));
+				d = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(ai, 24), _mm_slli_epi32(ri, 16)),
+					_mm_or_si128(_mm_slli_epi32(gi, 8), bi));
+			}
+			StoreDwords(d, out, c.colorOffset);
+		}
+	}
+
+	void Decode4(const BYTE* const in[4], float* const v[4], D3DXCOLOR* const color[4], const Constants& c)
+	{
+		// x y z w of each vertex into a lane each
+		__m128i p01 = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(in[0] + PositionOffset)),
+			_mm_loadl_epi64((const __m128i*)(in[1] + PositionOffset)));
+		__m128i p23 = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(in[2] + PositionOffset)),
+			_mm_loadl_epi64((const __m128i*)(in[3] + PositionOffset)));
+		__m128i a   = _mm_unpacklo_epi16(p01, p23);   // x0 x2 y0 y2 z0 z2 w0 w2
+		__m128i b   = _mm_unpackhi_epi16(p01, p23);   // x1 x3 y1 y3 z1 z3 w1 w3
+		__m128i xy  = _mm_unpacklo_epi16(a, b);       // x0 x1 x2 x3 y0 y1 y2 y3
+		__m128i zw  = _mm_unpackhi_epi16(a, b);
+		__m128i qx  = _mm_srai_epi32(_mm_unpacklo_epi16(xy, xy), 16);
+		__m128i qy  = _mm_srai_epi32(_mm_unpackhi_epi16(xy, xy), 16);
+		__m128i qz  = _mm_srai_epi32(_mm_unpacklo_epi16(zw, zw), 16);
+		__m128i qw  = _mm_srai_epi32(_mm_unpackhi_epi16(zw, zw), 16);
+
+		__m128 px = _mm_add_ps(_mm_set1_ps(c.offset[0]), _mm_mul_ps(_mm_set1_ps(c.scale[0]), _mm_cvtepi32_ps(qx)));
+		__m128 py = _mm_add_ps(_mm_set1_ps(c.offset[1]), _mm_mul_ps(_mm_set1_ps(c.scale[1]), _mm_cvtepi32_ps(qy)));
+		__m128 pz = _mm_add_ps(_mm_set1_ps(c.offset[2]), _mm_mul_ps(_mm_set1_ps(c.scale[2]), _mm_cvtepi32_ps(qz)));
+
+		__m128i nqx, nqy;
+		if( c.oct16 )
+		{
+			__m128i n = LoadDwords(in, Normal16Offset);
+			nqx = LowShorts(n);
+			nqy = HighShorts(n);
+		}
+		else
+		{
+			__m128i w    = _mm_add_epi32(qw, _mm_set1_epi32(32768));
+			__m128i bias = _mm_set1_epi32(127);
+			nqx = _mm_sub_epi32(_mm_and_si128(w, _mm_set1_epi32(255)), bias);
+			nqy = _mm_sub_epi32(_mm_srli_epi32(w, 8), bias);
+		}
+
+		__m128 one = _mm_set1_ps(1.0f);
+		__m128 x = _mm_mul_ps(_mm_cvtepi32_ps(nqx), _mm_set1_ps(c.invNormalRange));
+		__m128 y = _mm_mul_ps(_mm_cvtepi32_ps(nqy), _mm_set1_ps(c.invNormalRange));
+		__m128 z = _mm_sub_ps(_mm_sub_ps(one, Abs(x)), Abs(y));
+		__m128 lower = _mm_cmplt_ps(z, _mm_setzero_ps());
+		__m128 fx = _mm_mul_ps(_mm_sub_ps(one, Abs(y)), SignNotZero(x));
+		__m128 fy = _mm_mul_ps(_mm_sub_ps(one, Abs(x)), SignNotZero(y));
+		x = Select(lower, fx, x);
+		y = Select(lower, fy, y);
+
+		__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+		__m128 nx = _mm_div_ps(x, length);
+		__m128 ny = _mm_div_ps(y, length);
+		__m128 nz = _mm_div_ps(z, length);
+
+		__m128i uv = LoadDwords(in, c.uvOffset);
+		__m128 tu = HalfToFloat(_mm_and_si128(uv, _mm_set1_epi32(0xffff)));
+		__m128 tv = HalfToFloat(_mm_srli_epi32(uv, 16));
+
+		_MM_TRANSPOSE4_PS(px, py, pz, nx);
+		_MM_TRANSPOSE4_PS(ny, nz, tu, tv);
+		_mm_storeu_ps(v[0], px); _mm_storeu_ps(v[0] + 4, ny);
+		_mm_storeu_ps(v[1], py); _mm_storeu_ps(v[1] + 4, nz);
+		_mm_storeu_ps(v[2], pz); _mm_storeu_ps(v[2] + 4, tu);
+		_mm_storeu_ps(v[3], nx); _mm_storeu_ps(v[3] + 4, tv);
+
+		if( c.color && color[0] )
+		{
+			__m128i d = LoadDwords(in, c.colorOffset);
+			__m128i byteMask = _mm_set1_epi32(255);
+			__m128  scale = _mm_set1_ps(1.0f / 255.0f);
+			__m128 r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(d, 16), byteMask)), scale);
+			__m128 g = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(d, 8), byteMask)), scale);
+			__m128 b = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(d, byteMask)), scale);
+			__m128 a = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(d, 24)), scale);
+			_MM_TRANSPOSE4_PS(r, g, b, a);
+			_mm_storeu_ps((float*)color[0], r);
+			_mm_storeu_ps((float*)color[1], g);
+			_mm_storeu_ps((float*)color[2], b);
+			_mm_storeu_ps((float*)color[3], a);
+		}
+	}
+
+	// Runs a kernel over [first, last) four vertices at a time, or one at a
+	// time when simd is off.  The last group repeats its last vertex and
+	// writes the copies to scratch.
+	void EncodeRange(const BYTE* vertices, int stride, const D3DXCOLOR* colors, BYTE* out,
+		int first, int last, const Constants& c, bool simd)
+	{
+		BYTE scratch[4][32];
+
+		for(int i = first; i < last; i += simd ? 4 : 1)
+		{
+			if( !simd )
+			{
+				EncodeVertex((const float*)(vertices + (size_t)i * stride), colors ? &colors[i] : 0,
+					out + (size_t)i * c.size, c);
+				continue;
+			}
+
+			const float*     v[4];
+			const D3DXCOLOR* color[4];
+			BYTE*            o[4];
+			for(int k = 0; k < 4; k++)
+			{
+				int j = i + k < last ? i + k : last - 1;
+				v[k]     = (const float*)(vertices + (size_t)j * stride);
+				color[k] = colors ? &colors[j] : 0;
+				o[k]     = i + k < last ? out + (size_t)j * c.size : scratch[k];
+			}
+			Encode4(v, color, o, c);
+		}
+	}
+
+	void DecodeRange(const BYTE* in, BYTE* vertices, int stride, D3DXCOLOR* colors,
+		int first, int last, const Constants& c, bool simd)
+	{
+		float     scratch[4][8];
+		D3DXCOLOR scratchColors[4];
+
+		for(int i = first; i < last; i += simd ? 4 : 1)
+		{
+			if( !simd )
+			{
+				DecodeVertex(in + (size_t)i * c.size, (float*)(vertices + (size_t)i * stride),
+					colors ? &colors[i] : 0, c);
+				continue;
+			}
+
+			const BYTE* p[4];
+			float*      v[4];
+			D3DXCOLOR*  color[4];
+			for(int k = 0; k < 4; k++)
+			{
+				int j = i + k < last ? i + k : last - 1;
+				p[k]     = in + (size_t)j * c.size;
+				v[k]     = i + k < last ? (float*)(vertices + (size_t)j * stride) : scratch[k];
+				color[k] = colors ? (i + k < last ? &colors[j] : &scratchColors[k]) : 0;
+			}
+			Decode4(p, v, color, c);
+		}
+	}
+
+	bool Compress(const void* vertices, int numVertices, int stride, const D3DXCOLOR* colors,
+		const CompressedVertexFormat& format, const VertexQuantization& quantization,
+		void* out, int numThreads, bool simd)
+	{
+		if( numVertices < 0 || stride < 32 )
+			return false;
+
+		Constants c;
+		SetConstants(format, quantization, &c);
+
+		// Threads take whole groups of four.
+		int numGroups = (numVertices + 3) / 4;
+		ParallelFor(numGroups, ResolveThreads(numThreads), [&](int first, int last)
+		{
+			EncodeRange((const BYTE*)vertices, stride, colors, (BYTE*)out,
+				first * 4, last * 4 < numVertices ? last * 4 : numVertices, c, simd);
+		});
+		return true;
+	}
+
+	bool Decompress(const void* compressed, int numVertices, const CompressedVertexFormat& format,
+		const VertexQuantization& quantization, void* vertices, int stride, D3DXCOLOR* colors,
+		int numThreads, bool simd)
+	{
+		if( numVertices < 0 || stride < 32 )
+			return false;
+
+		Constants c;
+		SetConstants(format, quantization, &c);
+
+		int numGroups = (numVertices + 3) / 4;
+		ParallelFor(numGroups, ResolveThreads(numThreads), [&](int first, int last)
+		{
+			DecodeRange((const BYTE*)compressed, (BYTE*)vertices, stride, colors,
+				first * 4, last * 4 < numVertices ? last * 4 : numVertices, c, simd);
+		});
+		return true;
+	}
+}
+
+CompressedVertexFormat::CompressedVertexFormat()
+{
+	normal = VertexNormalOct16;
+	color  = false;
+}
+
+VertexCompressionStats::VertexCompressionStats()
+{
+	vertices      = 0;
+	bytesBefore   = 0;
+	bytesAfter    = 0;
+	numThreads    = 0;
+	positionError = 0.0f;
+	normalError   = 0.0f;
+	uvError       = 0.0f;
+	colorError    = 0.0f;
+	encodeMs      = 0.0f;
+	decodeMs      = 0.0f;
+}
+
+int GetCompressedVertexSize(const CompressedVertexFormat& format)
+{
+	return ColorOffset(format) + (format.color ? 4 : 0);
+}
+
+void GetCompressedVertexDeclaration(const CompressedVertexFormat& format,
+	D3DVERTEXELEMENT9 decl[MAX_FVF_DECL_SIZE])
+{
+	D3DVERTEXELEMENT9 position = {0, PositionOffset, D3DDECLTYPE_SHORT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_POSITION, 0};
+	D3DVERTEXELEMENT9 normal   = {0, Normal16Offset, D3DDECLTYPE_SHORT2, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_NORMAL, 0};
+	D3DVERTEXELEMENT9 texcoord = {0, 0, D3DDECLTYPE_FLOAT16_2, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 0};
+	D3DVERTEXELEMENT9 color    = {0, 0, D3DDECLTYPE_D3DCOLOR, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_COLOR, 0};
+	D3DVERTEXELEMENT9 end      = D3DDECL_END();
+
+	texcoord.Offset = (WORD)UvOffset(format);
+	color.Offset    = (WORD)ColorOffset(format);
+
+	int n = 0;
+	decl[n++] = position;
+	if( format.normal == VertexNormalOct16 )
+		decl[n++] = normal;
+	decl[n++] = texcoord;
+	if( format.color )
+		decl[n++] = color;
+	decl[n++] = end;
+}
+
+void ComputeVertexQuantization(const void* vertices, int numVertices, int stride,
+	VertexQuantization* quantization)
+{
+	D3DXVECTOR3 boxMin(0.0f, 0.0f, 0.0f), boxMax(0.0f, 0.0f, 0.0f);
+	for(int i = 0; i < numVertices; i++)
+	{
+		const D3DXVECTOR3& p = *(const D3DXVECTOR3*)((const BYTE*)vertices + (size_t)i * stride);
+		if( i == 0 )
+			boxMin = boxMax = p;
+		D3DXVec3Minimize(&boxMin, &boxMin, &p);
+		D3DXVec3Maximize(&boxMax, &boxMax, &p);
+	}
+
+	quantization->offset = (boxMin + boxMax) * 0.5f;
+	quantization->scale  = (boxMax - boxMin) * (0.5f / 32767.0f);
+}
+
+bool CompressVertices(const void* vertices, int numVertices, int stride, const D3DXCOLOR* colors,
+	const CompressedVertexFormat& format, const VertexQuantization& quantization,
+	void* out, int numThreads)
+{
+	return Compress(vertices, numVertices, stride, colors, format, quantization, out, numThreads, true);
+}
+
+bool DecompressVertices(const void* compressed, int numVertices,
+	const CompressedVertexFormat& format, const VertexQuantization& quantization,
+	void* vertices, int stride, D3DXCOLOR* colors, int numThreads)
+{
+	return Decompress(compressed, numVertices, format, quantization, vertices, stride, colors, numThreads, true);
+}
+
+bool MeasureVertexCompression(const void* vertices, int numVertices, int stride, const D3DXCOLOR* colors,
+	const CompressedVertexFormat& format, int numThreads,
+	std::vector<BYTE>* compressed, VertexQuantization* quantization, VertexCompressionStats* stats)
+{
+	VertexCompressionStats local;
+	if( !stats )
+		stats = &local;
+	*stats = VertexCompressionStats();
+
+	if( numVertices <= 0 || stride < 32 )
+		return false;
+
+	VertexQuantization q;
+	ComputeVertexQuantization(vertices, numVertices, stride, &q);
+	if( quantization )
+		*quantization = q;
+
+	int size = GetCompressedVertexSize(format);
+	std::vector<BYTE> packed;
+	if( !compressed )
+		compressed = &packed;
+	compressed->resize((size_t)numVertices * size);
+
+	double start = Now();
+	CompressVertices(vertices, numVertices, stride, colors, format, q, &(*compressed)[0], numThreads);
+	stats->encodeMs = (float)(Now() - start);
+
+	std::vector<float>     decoded((size_t)numVertices * 8);
+	std::vector<D3DXCOLOR> decodedColors(format.color && colors ? numVertices : 0);
+
+	start = Now();
+	DecompressVertices(&(*compressed)[0], numVertices, format, q, &decoded[0], 32,
+		decodedColors.empty() ? 0 : &decodedColors[0], numThreads);
+	stats->decodeMs = (float)(Now() - start);
+
+	float minCos = 1.0f;
+	for(int i = 0; i < numVertices; i++)
+	{
+		const float* a = (const float*)((const BYTE*)vertices + (size_t)i * stride);
+		const float* b = &decoded[(size_t)i * 8];
+
+		D3DXVECTOR3 d(a[0] - b[0], a[1] - b[1], a[2] - b[2]);
+		float distance = D3DXVec3Length(&d);
+		if( distance > stats->positionError )
+			stats->positionError = distance;
+
+		D3DXVECTOR3 n(a[3], a[4], a[5]);
+		float length = D3DXVec3Length(&n);
+		if( length > 0.0f )
+		{
+			float cosine = (n.x * b[3] + n.y * b[4] + n.z * b[5]) / length;
+			if( cosine < minCos )
+				minCos = cosine;
+		}
+
+		for(int k = 6; k < 8; k++)
+			if( fabsf(a[k] - b[k]) > stats->uvError )
+				stats->uvError = fabsf(a[k] - b[k]);
+
+		if( !decodedColors.empty() )
+		{
+			const float* ca = (const float*)&colors[i];
+			const float* cb = (const float*)&decodedColors[i];
+			for(int k = 0; k < 4; k++)
+			{
+				float e = fabsf(Clamp(ca[k], 0.0f, 1.0f) - cb[k]);
+				if( e > stats->colorError )
+					stats->colorError = e;
+			}
+		}
+	}
+	stats->normalError = acosf(Clamp(minCos, -1.0f, 1.0f)) * 180.0f / D3DX_PI;
+
+	stats->vertices    = numVertices;
+	stats->bytesBefore = numVertices * stride;
+	stats->bytesAfter  = numVertices * size;
+	stats->numThreads  = ResolveThreads(numThreads);
+	return true;
+}
+
+//
+// Benchmark
+//
+
+bool BenchmarkVertexCompression(int numVertices, const CompressedVertexFormat& format, int numThreads,
+	VertexCompressionBenchmark* result)
+{
+	if( numVertices <= 0 )
+		return false;
+
+	// random points on a sphere of radius 10, with their normals, texture
+	// coordinates from their angles and colors from their normals
+	std::vector<float>     vertices((size_t)numVertices * 8);
+	std::vector<D3DXCOLOR> colors(numVertices);
+
+	unsigned seed = 12345;
+	for(int i = 0; i < numVertices; i++)
+	{
+		float r[2];
+		for(int k = 0; k < 2; k++)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			r[k] = (float)(seed >> 8) / 16777216.0f;
+		}
+
+		float z = r[0] * 2.0f - 1.0f;
+		float phi = r[1] * 2.0f * D3DX_PI;
+		float s = sqrtf(1.0f - z * z);
+
+		float* v = &vertices[(size_t)i * 8];
+		v[3] = s * cosf(phi);
+		v[4] = s * sinf(phi);
+		v[5] = z;
+		v[0] = v[3] * 10.0f;
+		v[1] = v[4] * 10.0f;
+		v[2] = v[5] * 10.0f;
+		v[6] = r[1];
+		v[7] = r[0];
+
+		colors[i] = D3DXCOLOR(v[3] * 0.5f + 0.5f, v[4] * 0.5f + 0.5f, v[5] * 0.5f + 0.5f, 1.0f);
+	}
+
+	result->vertices = numVertices;
+
+	std::vector<BYTE> compressed;
+	VertexQuantization q;
+	if( !MeasureVertexCompression(&vertices[0], numVertices, 32, &colors[0], format, numThreads,
+		&compressed, &q, &result->stats) )
+		return false;
+
+	int size = GetCompressedVertexSize(format);
+	std::vector<BYTE>      scalar(compressed.size());
+	std::vector<float>     decoded(vertices.size()), decodedScalar(vertices.size());
+	std::vector<D3DXCOLOR> decodedColors(numVertices), decodedColorsScalar(numVertices);
+
+	double start = Now();
+	Compress(&vertices[0], numVertices, 32, &colors[0], format, q, &compressed[0], numThreads, true);
+	result->encodeMs = (float)(Now() - start);
+
+	start = Now();
+	Compress(&vertices[0], numVertices, 32, &colors[0], format, q, &scalar[0], numThreads, false);
+	result->encodeScalarMs = (float)(Now() - start);
+
+	start = Now();
+	Decompress(&compressed[0], numVertices, format, q, &decoded[0], 32, &decodedColors[0], numThreads, true);
+	result->decodeMs = (float)(Now() - start);
+
+	start = Now();
+	Decompress(&compressed[0], numVertices, format, q, &decodedScalar[0], 32, &decodedColorsScalar[0],
+		numThreads, false);
+	result->decodeScalarMs = (float)(Now() - start);
+
+	result->mismatches = 0;
+	for(int i = 0; i < numVertices; i++)
+	{
+		if( memcmp(&compressed[(size_t)i * size], &scalar[(size_t)i * size], size) != 0 ||
+			memcmp(&decoded[(size_t)i * 8], &decodedScalar[(size_t)i * 8], 32) != 0 ||
+			(format.color && memcmp(&decodedColors[i], &decodedColorsScalar[i], sizeof(D3DXCOLOR)) != 0) )
+			result->mismatches++;
+	}
+
+	return true;
+}
@@ -0,0 +1,128 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: vertexCompression.h
+//
+// Desc: Packs 32 byte vertices (three float positions, three float normals
+//       and two float texture coordinates, as MeshCacheVertex and
+//       d3d::Vertex are laid out) into 12 to 20 bytes:
+//
+//       position   SHORT4    x, y, z quantized to 16 bits over the mesh's
+//                            bounds; w holds an 8 bit octahedral normal
+//       normal     SHORT2    16 bit octahedral normal, when asked for
+//       texcoord   FLOAT16_2 half floats
+//       color      D3DCOLOR  8 bits a channel, when asked for
+//
+//       An octahedral normal is the unit vector projected onto the
+//       octahedron |x| + |y| + |z| = 1 and the lower half folded over the
+//       upper, two numbers in [-1, 1].  A vertex shader undoes the packing
+//       with the constants in VertexQuantization; DecompressVertices does
+//       it on the CPU.
+//
+//       The kernels encode and decode four vertices at a time with SSE2,
+//       and split the vertices over threads.  Scalar versions of both give
+//       the same bytes and are kept for the benchmark.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __vertexCompressionH__
+#define __vertexCompressionH__
+
+#include "d3dUtility.h"
+#include <vector>
+
+enum VertexNormalEncoding
+{
+	VertexNormalOct8  = 0,   // in the position's w: 12 bytes a vertex
+	VertexNormalOct16 = 1    // a SHORT2 of its own: 16 bytes a vertex
+};
+
+struct CompressedVertexFormat
+{
+	CompressedVertexFormat();
+
+	int  normal;   // VertexNormalEncoding
+	bool color;    // a D3DCOLOR after the texture coordinates
+};
+
+// position = offset + scale * (x, y, z) of the SHORT4.  The 8 bit normal in
+// w is (w + 32768) = (y + 127) * 256 + (x + 127), each over 127; the 16 bit
+// one is its SHORT2 over 32767.
+struct VertexQuantization
+{
+	D3DXVECTOR3 offset;   // the center of the bounds
+	D3DXVECTOR3 scale;    // half their extent over 32767
+};
+
+int  GetCompressedVertexSize(const CompressedVertexFormat& format);
+
+// Fills decl, D3DDECL_END() included, for a stream 0 of compressed
+// vertices.  FLOAT16_2 needs D3DDTCAPS_FLOAT16_2.
+void GetCompressedVertexDeclaration(const CompressedVertexFormat& format,
+	D3DVERTEXELEMENT9 decl[MAX_FVF_DECL_SIZE]);
+
+// The quantization covering the positions' bounding box.
+void ComputeVertexQuantization(const void* vertices, int numVertices, int stride,
+	VertexQuantization* quantization);
+
+// vertices are stride bytes apart, stride at least 32; colors, if the format
+// has them, is one per vertex, or null for white.  out holds numVertices *
+// GetCompressedVertexSize(format) bytes.  numThreads = 0 uses one thread
+// per hardware thread.
+bool CompressVertices(const void* vertices, int numVertices, int stride, const D3DXCOLOR* colors,
+	const CompressedVertexFormat& format, const VertexQuantization& quantization,
+	void* out, int numThreads);
+
+// The reverse: fills the first 32 bytes of each vertex and, if the format
+// has them and colors is not null, the colors.  Normals come out unit
+// length.
+bool DecompressVertices(const void* compressed, int numVertices,
+	const CompressedVertexFormat& format, const VertexQuantization& quantization,
+	void* vertices, int stride, D3DXCOLOR* colors, int numThreads);
+
+struct VertexCompressionStats
+{
+	VertexCompressionStats();
+
+	int   vertices;
+	int   bytesBefore;
+	int   bytesAfter;
+	int   numThreads;
+
+	// the furthest any vertex moved, in model units; the largest angle
+	// between a normal and its unit length original, in degrees; and the
+	// largest texture coordinate and color channel differences
+	float positionError;
+	float normalError;
+	float uvError;
+	float colorError;
+
+	float encodeMs;
+	float decodeMs;
+};
+
+// Compresses a mesh's vertices into *compressed, which may be null, and
+// measures what was lost by decompressing them again.
+bool MeasureVertexCompression(const void* vertices, int numVertices, int stride, const D3DXCOLOR* colors,
+	const CompressedVertexFormat& format, int numThreads,
+	std::vector<BYTE>* compressed, VertexQuantization* quantization, VertexCompressionStats* stats);
+
+//
+// Headless benchmark: numVertices random vertices on a sphere, encoded and
+// decoded with the SSE2 kernels and the scalar ones.
+//
+
+struct VertexCompressionBenchmark
+{
+	int   vertices;
+	float encodeMs;          // SSE2
+	float decodeMs;
+	float encodeScalarMs;
+	float decodeScalarMs;
+	int   mismatches;        // vertices the two disagree on, either way
+	VertexCompressionStats stats;
+};
+
+bool BenchmarkVertexCompression(int numVertices, const CompressedVertexFormat& format, int numThreads,
+	VertexCompressionBenchmark* result);
+
+#endif // __vertexCompressionH__
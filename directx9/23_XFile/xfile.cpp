@@ -6,14 +6,26 @@
 //
 // System: AMD Athlon 1800+ XP, 512 DDR, Geforce 3, Windows XP, MSVC++ 7.0 
 //
-// Desc: Demonstrates how to load and render an XFile.
+// Desc: Demonstrates how to load and render an XFile.  Run with
+//       -benchmark, it instead times the .x parser and the mesh
+//       processing code, without a device, and exits.
 //          
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "d3dUtility.h"
+#include "assetLoader.h"
+#include "lodChain.h"
+#include "meshCache.h"
+#include "meshOptimizer.h"
+#include "meshWeld.h"
+#include "vertexCompression.h"
+#include "xfileParser.h"
+#include <map>
+#include <memory>
 #include <vector>
 #include <iostream>
 #include <stdio.h>
+#include <math.h>
 
 //
 // Globals
@@ -29,9 +41,204 @@ std::vector<D3DMATERIAL9>       Mtrls(0);
 std::vector<IDirect3DTexture9*> Textures(0);
 
 //
-// Framework functions
+// A field of ships, each drawn at the level of detail its distance allows.
 //
-bool Setup()
+
+const int   Rows    = 11;
+const int   Columns = 11;
+const float Spacing = 30.0f;
+
+// A level may be off by at most LodPixels on screen; a coarser level has to
+// be a quarter under that before a ship switches to it.
+const float LodPixels     = 1.0f;
+const float LodHysteresis = 0.25f;
+
+const D3DXVECTOR3 Eye(4.0f, 4.0f, -13.0f);
+const float       FovY = D3DX_PI * 0.5f;
+
+LodMesh                  Lods;
+LodSelector              Selector;
+std::vector<D3DXVECTOR3> Positions;
+D3DXVECTOR3              SphereCenter(0.0f, 0.0f, 0.0f);
+
+//
+// The ship loads in the background; a box is drawn in its place until it
+// and its textures are ready.
+//
+
+AssetLoader*  Loader       = 0;
+ID3DXMesh*    Placeholder  = 0;
+D3DMATERIAL9  PlaceholderMtrl;
+DWORD         SetupTime    = 0;
+DWORD         FirstFrame   = 0;   // when Display() first ran
+bool          LoadReported = false;
+
+// textures read by the loader, by file name, until the ship takes them
+std::map<std::string, IDirect3DTexture9*> LoadedTextures;
+
+bool LoadFromXFile();
+void Benchmark();
+
+//
+// Loading
+//
+
+// Reads a texture file on a worker, checks it is an image D3DX can read,
+// and creates the texture on the main thread.
+AssetId RequestTexture(const char* fileName)
+{
+	std::shared_ptr<std::vector<BYTE> > data(new std::vector<BYTE>);
+	std::string name = fileName;
+
+	return Loader->load(fileName,
+		[data, name](AssetId) -> bool
+		{
+			FILE* file = fopen(name.c_str(), "rb");
+			if( !file )
+				return false;
+
+			fseek(file, 0, SEEK_END);
+			long size = ftell(file);
+			fseek(file, 0, SEEK_SET);
+			if( size > 0 )
+			{
+				data->resize(size);
+				if( fread(&(*data)[0], 1, size, file) != (size_t)size )
+					data->clear();
+			}
+			fclose(file);
+
+			D3DXIMAGE_INFO info;
+			return !data->empty() &&
+				SUCCEEDED(D3DXGetImageInfoFromFileInMemory(&(*data)[0], (UINT)data->size(), &info));
+		},
+		[data, name](bool ok)
+		{
+			// a file named by several materials is read for the first; the
+			// others' finishes find its texture here
+			if( LoadedTextures.count(name) )
+				return;
+
+			IDirect3DTexture9* tex = 0;
+			if( ok )
+				D3DXCreateTextureFromFileInMemory(Device, &(*data)[0], (UINT)data->size(), &tex);
+			LoadedTextures[name] = tex;
+			data->clear();
+		});
+}
+
+// What the mesh needs once it and its textures are in.
+void FinishShip()
+{
+	std::vector<float> errors(Lods.getNumLevels());
+	for(int i = 0; i < (int)errors.size(); i++)
+		errors[i] = Lods.getError(i);
+	Selector.setLevels(&errors[0], (int)errors.size(), Lods.getRadius());
+
+	// the materials hold their own references
+	for(std::map<std::string, IDirect3DTexture9*>::iterator i = LoadedTextures.begin();
+		i != LoadedTextures.end(); ++i)
+		d3d::Release<IDirect3DTexture9*>(i->second);
+	LoadedTextures.clear();
+}
+
+// Maps bigship1.x's cache file on a worker, converting the .x file first if
+// the cache is missing or out of date, and asks for the textures its
+// materials name.  Once they are all in, builds the mesh straight from the
+// cache, which already holds the optimized mesh; without a cache, falls
+// back to D3DX on the main thread.
+void RequestShip()
+{
+	struct ShipLoad
+	{
+		MeshCacheView  view;
+		MeshCacheStats stats;
+		float          ms;
+	};
+	std::shared_ptr<ShipLoad> ship(new ShipLoad);
+
+	Loader->load("bigship1.x",
+		[ship](AssetId self) -> bool
+		{
+			DWORD start = timeGetTime();
+
+			MeshCache cache("cache");
+			if( !cache.load("bigship1.x", &ship->view, &ship->stats) )
+				return false;
+
+			const MeshCacheMaterial* mtrls = ship->view.getMaterials();
+			for(int i = 0; i < ship->view.getNumMaterials(); i++)
+				if( mtrls[i].textureFilename[0] != 0 )
+					Loader->addDependency(self, RequestTexture(mtrls[i].textureFilename));
+
+			ship->ms = (float)(timeGetTime() - start);
+			return true;
+		},
+		[ship](bool ok)
+		{
+			const MeshCacheView& view = ship->view;
+			if( !ok || !CreateMeshFromCache(Device, view, &Mesh) )
+			{
+				if( !LoadFromXFile() )
+					::MessageBox(0, "Loading bigship1.x - FAILED", 0, 0);
+				else
+					FinishShip();
+				return;
+			}
+
+			if( !Lods.create(Device, view, Mesh) )
+				Lods.release();
+			SphereCenter = view.getBounds().sphereCenter;
+
+			const MeshCacheMaterial* mtrls = view.getMaterials();
+			for(int i = 0; i < view.getNumMaterials(); i++)
+			{
+				D3DMATERIAL9 mtrl = mtrls[i].mtrl;
+				mtrl.Ambient = mtrl.Diffuse;
+				Mtrls.push_back( mtrl );
+
+				IDirect3DTexture9* tex = 0;
+				if( mtrls[i].textureFilename[0] != 0 )
+				{
+					tex = LoadedTextures[mtrls[i].textureFilename];
+					if( tex )
+						tex->AddRef();
+				}
+				Textures.push_back( tex );
+			}
+
+			const MeshCacheStats& stats = ship->stats;
+
+			char report[256];
+			sprintf(report,
+				"Mesh cache %s: %d vertices, %d faces, %d subsets; checksum %.3f ms, "
+				"convert %.3f ms, map %.3f ms, %.0f ms in all\n",
+				stats.hit ? "hit" : "miss", view.getNumVertices(), view.getNumFaces(), view.getNumSubsets(),
+				stats.checksumMs, stats.convertMs, stats.openMs, ship->ms);
+			::OutputDebugString(report);
+
+			if( !stats.hit )
+			{
+				sprintf(report, "  welded %d vertices to %d (%d to %d bytes), %.3f ms on %d threads\n",
+					stats.weld.verticesBefore, stats.weld.verticesAfter, stats.weld.bytesBefore,
+					stats.weld.bytesAfter, stats.weld.totalMs, stats.weld.numThreads);
+				::OutputDebugString(report);
+			}
+
+			for(int i = 0; i < Lods.getNumLevels(); i++)
+			{
+				sprintf(report, "  level %d: %d faces, error %.4f (radius %.2f)\n",
+					i, Lods.getNumFaces(i), Lods.getError(i), Lods.getRadius());
+				::OutputDebugString(report);
+			}
+
+			ship->view.close();
+			FinishShip();
+		});
+}
+
+// The D3DX path, used when there is no cache.
+bool LoadFromXFile()
 {
 	HRESULT hr = 0;
 
@@ -39,7 +246,6 @@ bool Setup()
 	// Load the XFile data.
 	//
 
-	ID3DXBuffer* adjBuffer  = 0;
 	ID3DXBuffer* mtrlBuffer = 0;
 	DWORD        numMtrls   = 0;
 
@@ -47,7 +253,7 @@ bool Setup()
 		"bigship1.x",
 		D3DXMESH_MANAGED,
 		Device,
-		&adjBuffer,
+		0,
 		&mtrlBuffer,
 		0,
 		&numMtrls,
@@ -101,24 +307,176 @@ bool Setup()
 	d3d::Release<ID3DXBuffer*>(mtrlBuffer); // done w/ buffer
 
 	//
-	// Optimize the mesh.
+	// Weld the copies D3DX left along seams, then optimize the mesh.
 	//
 
-	hr = Mesh->OptimizeInplace(		
-		D3DXMESHOPT_ATTRSORT |
-		D3DXMESHOPT_COMPACT  |
-		D3DXMESHOPT_VERTEXCACHE,
-		(DWORD*)adjBuffer->GetBufferPointer(),
-		0, 0, 0);
+	MeshWeldStats weldStats;
+	if( !WeldD3DXMesh(Device, &Mesh, MeshWeldEpsilons(), 0, &weldStats) )
+	{
+		::MessageBox(0, "WeldD3DXMesh() - FAILED", 0, 0);
+		return false;
+	}
 
-	d3d::Release<ID3DXBuffer*>(adjBuffer); // done w/ buffer
+	char report[256];
+	sprintf(report, "Welded: %d vertices to %d (%d to %d bytes), %.3f ms on %d threads\n",
+		weldStats.verticesBefore, weldStats.verticesAfter, weldStats.bytesBefore,
+		weldStats.bytesAfter, weldStats.totalMs, weldStats.numThreads);
+	::OutputDebugString(report);
 
-	if(FAILED(hr))
+	MeshOptimizeStats stats;
+	if( !OptimizeD3DXMesh(Device, &Mesh, MeshOptimizeAll, 0, &stats) )
 	{
-		::MessageBox(0, "OptimizeInplace() - FAILED", 0, 0);
+		::MessageBox(0, "OptimizeD3DXMesh() - FAILED", 0, 0);
 		return false;
 	}
 
+	sprintf(report,
+		"Optimized: %d faces, %d vertices (%d degenerate, %d unused removed, %d split), "
+		"ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, overdraw %.3f -> %.3f, "
+		"%.3f ms on %d threads\n",
+		stats.faces, stats.vertices, stats.removedFaces, stats.removedVertices, stats.splitVertices,
+		stats.acmrBefore, stats.acmrAfter, stats.atvrBefore, stats.atvrAfter,
+		stats.overdrawBefore, stats.overdrawAfter, stats.optimizeMs, stats.numThreads);
+	::OutputDebugString(report);
+
+	return true;
+}
+
+// What bigship1.x's vertices, as the cache holds them, would lose in each
+// compressed format.  The fixed function pipeline cannot unpack octahedral
+// normals, so the sample still draws the float vertices.
+void ReportVertexCompression()
+{
+	XFileScene    scene;
+	MeshCacheData data;
+	if( !LoadXFile("bigship1.x", &scene, 0, 0) || !BuildMeshCacheData(scene, &data, 0) )
+		return;
+
+	for(int normal = VertexNormalOct8; normal <= VertexNormalOct16; normal++)
+	{
+		CompressedVertexFormat format;
+		format.normal = normal;
+
+		VertexCompressionStats stats;
+		if( MeasureVertexCompression(&data.vertices[0], (int)data.vertices.size(), sizeof(MeshCacheVertex),
+			0, format, 0, 0, 0, &stats) )
+		{
+			char report[256];
+			sprintf(report,
+				"Compressed, %d bit normals: %d to %d bytes; error %.5f units, %.3f degrees, "
+				"%.6f in texture coordinates; %.3f ms to encode, %.3f to decode\n",
+				normal == VertexNormalOct8 ? 8 : 16, stats.bytesBefore, stats.bytesAfter,
+				stats.positionError, stats.normalError, stats.uvError, stats.encodeMs, stats.decodeMs);
+			::OutputDebugString(report);
+		}
+	}
+}
+
+//
+// Run with -benchmark in place of the sample.  Needs no device.
+//
+void Benchmark()
+{
+	XFileBenchmark parseBench;
+	if( BenchmarkXFileParse("bigship1.x", 5, 0, &parseBench) )
+	{
+		char report[256];
+		sprintf(report,
+			"Native .x parse: %d vertices, %d triangles, %.3f ms, %.1f MB/s on %d threads\n",
+			parseBench.vertices, parseBench.triangles, parseBench.parseMs,
+			parseBench.megabytesPerSecond, parseBench.numThreads);
+		::OutputDebugString(report);
+	}
+
+	ReportVertexCompression();
+
+	LodSelectBenchmark lodBench;
+	if( BenchmarkLodSelection(10000, 200, LodHysteresis, &lodBench) )
+	{
+		char report[256];
+		sprintf(report,
+			"LOD selection, %d instances: %.4f ms SSE, %.4f ms scalar (%d mismatches); "
+			"%d switches, %d pops (%d, %d without hysteresis)\n",
+			lodBench.instances, lodBench.simdMs, lodBench.scalarMs, lodBench.mismatches,
+			lodBench.switches, lodBench.pops, lodBench.switchesWithout, lodBench.popsWithout);
+		::OutputDebugString(report);
+	}
+
+	CompressedVertexFormat compressedFormat;
+	compressedFormat.color = true;
+
+	VertexCompressionBenchmark compressBench;
+	if( BenchmarkVertexCompression(250000, compressedFormat, 0, &compressBench) )
+	{
+		char report[256];
+		sprintf(report,
+			"Vertex compression, %d vertices: encode %.2f ms SSE2, %.2f scalar; "
+			"decode %.2f, %.2f (%d mismatches)\n",
+			compressBench.vertices, compressBench.encodeMs, compressBench.encodeScalarMs,
+			compressBench.decodeMs, compressBench.decodeScalarMs, compressBench.mismatches);
+		::OutputDebugString(report);
+	}
+
+	AssetLoaderBenchmark loaderBench;
+	if( BenchmarkAssetLoader(8, 3, 5.0f, 256, 0, &loaderBench) )
+	{
+		char report[256];
+		sprintf(report,
+			"Asset loader, %d assets: %.1f ms one after another, %.1f ms loaded "
+			"(longest chain %.1f ms) on %d threads; %d out of order, %d mismatches, %d finishes lost\n",
+			loaderBench.assets, loaderBench.serialMs, loaderBench.loaderMs, loaderBench.longestChainMs,
+			loaderBench.stats.numThreads, loaderBench.outOfOrder, loaderBench.mismatches,
+			loaderBench.lostFinishes);
+		::OutputDebugString(report);
+	}
+
+	MeshWeldBenchmark weldBench;
+	if( BenchmarkMeshWeld(500, 0, &weldBench) )
+	{
+		char report[256];
+		sprintf(report,
+			"Weld, %d vertices: %d left (%d expected), %.1f ms "
+			"(hash %.1f, match %.1f, remap %.1f) on %d threads; %d mismatches against brute force\n",
+			weldBench.vertices, weldBench.stats.verticesAfter, weldBench.expected, weldBench.ms,
+			weldBench.stats.hashMs, weldBench.stats.matchMs, weldBench.stats.remapMs,
+			weldBench.stats.numThreads, weldBench.mismatches);
+		::OutputDebugString(report);
+	}
+}
+
+//
+// Framework functions
+//
+bool Setup()
+{
+	SetupTime = timeGetTime();
+
+	//
+	// Start loading the XFile data; the box stands in until it is done.
+	//
+
+	if( FAILED(D3DXCreateBox(Device, 6.0f, 4.0f, 12.0f, &Placeholder, 0)) )
+		return false;
+	PlaceholderMtrl = d3d::WHITE_MTRL;
+
+	Loader = new AssetLoader(0);
+	RequestShip();
+
+	//
+	// Place the ships; until the levels are in every one is drawn at full
+	// detail.
+	//
+
+	for(int row = 0; row < Rows; row++)
+	{
+		for(int column = 0; column < Columns; column++)
+		{
+			D3DXVECTOR3 position((column - Columns / 2) * Spacing, 0.0f, row * Spacing);
+			Positions.push_back(position);
+			Selector.add(position, 1.0f);
+		}
+	}
+
 	//
 	// Set texture filters.
 	//
@@ -144,7 +502,7 @@ bool Setup()
 	// Set camera.
 	//
 
-	D3DXVECTOR3 pos(4.0f, 4.0f, -13.0f);
+	D3DXVECTOR3 pos = Eye;
 	D3DXVECTOR3 target(0.0f, 0.0f, 0.0f);
 	D3DXVECTOR3 up(0.0f, 1.0f, 0.0f);
 
@@ -164,7 +522,7 @@ bool Setup()
 	D3DXMATRIX proj;
 	D3DXMatrixPerspectiveFovLH(
 			&proj,
-			D3DX_PI * 0.5f, // 90 - degree
+			FovY, // 90 - degree
 			(float)Width / (float)Height,
 			1.0f,
 			1000.0f);
@@ -175,6 +533,16 @@ bool Setup()
 
 void Cleanup()
 {
+	// first, so no worker is still using what follows
+	d3d::Delete<AssetLoader*>(Loader);
+
+	for(std::map<std::string, IDirect3DTexture9*>::iterator i = LoadedTextures.begin();
+		i != LoadedTextures.end(); ++i)
+		d3d::Release<IDirect3DTexture9*>(i->second);
+	LoadedTextures.clear();
+
+	d3d::Release<ID3DXMesh*>(Placeholder);
+	Lods.release();
 	d3d::Release<ID3DXMesh*>(Mesh);
 
 	for(int i = 0; i < Textures.size(); i++)
@@ -186,9 +554,27 @@ bool Display(float timeDelta)
 	if( Device )
 	{
 		//
-		// Update: Rotate the mesh.
+		// Update: finish whatever the loader has read, and rotate the mesh.
 		//
 
+		if( FirstFrame == 0 )
+			FirstFrame = timeGetTime();
+
+		Loader->update();
+		if( !LoadReported && Loader->isIdle() )
+		{
+			AssetLoaderStats stats = Loader->getStats();
+
+			char report[256];
+			sprintf(report,
+				"Assets: %d loaded (%d failed) in %.1f ms, %.1f ms of work, the longest %.1f ms, "
+				"on %d threads; first frame %d ms after Setup()\n",
+				stats.assets, stats.failed, stats.elapsedMs, stats.workMs, stats.longestMs,
+				stats.numThreads, (int)(FirstFrame - SetupTime));
+			::OutputDebugString(report);
+			LoadReported = true;
+		}
+
 		static float y = 0.0f;
 		D3DXMATRIX yRot;
 		D3DXMatrixRotationY(&yRot, y);
@@ -197,9 +583,18 @@ bool Display(float timeDelta)
 		if( y >= 6.28f )
 			y = 0.0f;
 
-		D3DXMATRIX World = yRot;
+		//
+		// Pick each ship's level from where its bounding sphere is now.
+		//
+
+		D3DXVECTOR3 center;
+		D3DXVec3TransformCoord(&center, &SphereCenter, &yRot);
+		for(int i = 0; i < (int)Positions.size(); i++)
+			Selector.set(i, Positions[i] + center, 1.0f);
 
-		Device->SetTransform(D3DTS_WORLD, &World);
+		float projection = (float)Height / (2.0f * tanf(FovY * 0.5f));
+		if( Mesh )
+			Selector.select(Eye, projection, LodPixels, LodHysteresis, 0);
 
 		//
 		// Render
@@ -208,11 +603,41 @@ bool Display(float timeDelta)
 		Device->Clear(0, 0, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, 0xffffffff, 1.0f, 0);
 		Device->BeginScene();
 
+		if( !Mesh )
+		{
+			Device->SetMaterial( &PlaceholderMtrl );
+			Device->SetTexture(0, 0);
+
+			for(int j = 0; j < (int)Positions.size(); j++)
+			{
+				D3DXMATRIX T;
+				D3DXMatrixTranslation(&T, Positions[j].x, Positions[j].y, Positions[j].z);
+
+				D3DXMATRIX World = yRot * T;
+				Device->SetTransform(D3DTS_WORLD, &World);
+				Placeholder->DrawSubset(0);
+			}
+		}
+
 		for(int i = 0; i < Mtrls.size(); i++)
 		{
 			Device->SetMaterial( &Mtrls[i] );
 			Device->SetTexture(0, Textures[i]);
-			Mesh->DrawSubset(i);
+
+			for(int j = 0; j < (int)Positions.size(); j++)
+			{
+				D3DXMATRIX T;
+				D3DXMatrixTranslation(&T, Positions[j].x, Positions[j].y, Positions[j].z);
+
+				D3DXMATRIX World = yRot * T;
+				Device->SetTransform(D3DTS_WORLD, &World);
+
+				int level = Selector.getLevel(j);
+				if( level > 0 )
+					Lods.drawSubset(level, i);
+				else
+					Mesh->DrawSubset(i);
+			}
 		}	
 
 		Device->EndScene();
@@ -248,6 +673,12 @@ int WINAPI WinMain(HINSTANCE hinstance,
 				   PSTR cmdLine,
 				   int showCmd)
 {
+	if( d3d::FindSwitch(cmdLine, "-benchmark") )
+	{
+		Benchmark();
+		return 0;
+	}
+
 	if(!d3d::InitD3D(hinstance,
 		Width, Height, true, D3DDEVTYPE_HAL, &Device))
 	{
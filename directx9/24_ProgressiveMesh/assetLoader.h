@@ -0,0 +1,157 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: assetLoader.h
+//
+// Desc: Loads assets on a pool of worker threads while the sample keeps
+//       drawing.  An asset comes in two halves: its work, run on a worker,
+//       reads and decodes the file into memory; its finish, run on the
+//       main thread from update(), creates the device resources.  The
+//       device is not created multithreaded, so only the main thread may
+//       touch it.
+//
+//       An asset may depend on others, added before or while its work
+//       runs: a mesh learns which textures it needs once it has been read.
+//       It finishes only after all of them have, so a mesh appears with its
+//       textures, and loading costs about as long as its longest chain of
+//       assets rather than all of them end to end.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __assetLoaderH__
+#define __assetLoaderH__
+
+#include "d3dUtility.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef int AssetId;
+const AssetId NoAsset = -1;
+
+enum AssetState
+{
+	AssetQueued,    // waiting for a worker
+	AssetWorking,   // on a worker
+	AssetWaiting,   // worked; waiting on its dependencies, or for update()
+	AssetReady,     // finished
+	AssetFailed     // its work failed; finished with false
+};
+
+struct AssetLoaderStats
+{
+	AssetLoaderStats();
+
+	int   assets;
+	int   failed;
+	int   numThreads;
+
+	float workMs;      // summed over the assets: loading them one after another
+	float longestMs;   // the longest single asset's work
+	float elapsedMs;   // from the first request to the last finish
+};
+
+class AssetLoader
+{
+public:
+	// Work gets the asset's id, to add the dependencies it finds, and
+	// returns false if the asset could not be loaded.  Finish gets what the
+	// work returned; a dependency failing does not fail the assets
+	// depending on it.
+	typedef std::function<bool(AssetId)> Work;
+	typedef std::function<void(bool)>    Finish;
+
+	// numThreads = 0 uses one worker per hardware thread, and at least two.
+	explicit AssetLoader(int numThreads);
+
+	// Waits for the work running, drops the work still queued, and runs no
+	// more finishes.
+	~AssetLoader();
+
+	// Queues an asset.  A second request for the same name returns the
+	// first asset and drops work; its finish runs after the first one's
+	// with the same result, at the next update() if the asset has finished
+	// already.  Any thread, work included.
+	AssetId load(const char* name, const Work& work, const Finish& finish);
+
+	// asset finishes only after dependency has.  Any thread, up to the
+	// moment asset's work returns; dependencies must not form a cycle.
+	void addDependency(AssetId asset, AssetId dependency);
+
+	// Runs the finishes of every asset ready for them, dependencies first.
+	// Main thread only, once a frame.  Returns the number of finishes run.
+	int update();
+
+	// Waits for everything queued and finishes it.  Main thread only.
+	void finishAll();
+
+	// All the assets requested have finished.
+	bool isIdle() const;
+
+	int getState(AssetId asset) const;
+	AssetLoaderStats getStats() const;
+
+private:
+	struct Asset
+	{
+		std::string          name;
+		Work                 work;
+		std::vector<Finish>  finishes;     // one per request not yet run
+		int                  state;
+		bool                 ok;
+		int                  waitingOn;    // dependencies not yet finished
+		std::vector<AssetId> dependents;
+		float                workMs;
+	};
+
+	mutable std::mutex       _mutex;
+	std::condition_variable  _queued;       // workers wait for work
+	std::condition_variable  _worked;       // finishAll waits for workers
+
+	std::vector<Asset>             _assets;
+	std::map<std::string, AssetId> _names;
+	std::deque<AssetId>            _queue;
+	std::vector<AssetId>           _finishable;   // worked, no dependencies left
+	int                            _unfinished;
+	bool                           _quit;
+
+	std::vector<std::thread> _workers;
+
+	double _firstRequest;
+	double _lastFinish;
+
+	void workerMain();
+	void makeFinishable(AssetId asset);
+
+	AssetLoader(const AssetLoader&);
+	AssetLoader& operator=(const AssetLoader&);
+};
+
+//
+// Headless benchmark: numMeshes meshes, each of which, once read, asks for
+// texturesPerMesh textures of its own.  Every asset waits readMs, standing
+// in for the disk, and hashes workKilobytes, standing in for decoding.
+// Loaded one after another on the calling thread, then with the loader.
+// Every mesh also names one texture they share, requested once more after
+// everything has finished; each of those requests must see its finish run.
+//
+
+struct AssetLoaderBenchmark
+{
+	int   assets;
+	float serialMs;
+	float loaderMs;
+	float longestChainMs;   // a mesh and its slowest texture, end to end
+	int   outOfOrder;       // meshes finished before one of their textures
+	int   mismatches;       // assets whose data came out different
+	int   lostFinishes;     // requests for the shared texture never finished
+	AssetLoaderStats stats;
+};
+
+bool BenchmarkAssetLoader(int numMeshes, int texturesPerMesh, float readMs, int workKilobytes,
+	int numThreads, AssetLoaderBenchmark* result);
+
+#endif // __assetLoaderH__
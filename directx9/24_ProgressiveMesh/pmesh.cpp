@@ -6,15 +6,23 @@
 //
 // System: AMD Athlon 1800+ XP, 512 DDR, Geforce 3, Windows XP, MSVC++ 7.0 
 //
-// Desc: Demonstrates how to use the progressive mesh interface (ID3DXPMesh).  Use
+// Desc: Demonstrates how to use a progressive mesh (see progressiveMesh.h).  Use
 //       the 'A' key to add triangles, use the 'S' key to remove triangles.  Note
 //       that we outline the triangles in yellow so that you can see them get 
-//       removed and added.
+//       removed and added.  The .x file and its textures are read on worker
+//       threads (see assetLoader.h); the meshes are built on the main thread
+//       once they are in.
 //          
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "d3dUtility.h"
+#include "assetLoader.h"
+#include "progressiveMesh.h"
+#include <map>
+#include <memory>
+#include <string>
 #include <vector>
+#include <stdio.h>
 
 //
 // Globals
@@ -26,14 +34,89 @@ const int Width  = 640;
 const int Height = 480;
 
 ID3DXMesh*                      SourceMesh = 0;
-ID3DXPMesh*                     PMesh      = 0; // progressive mesh
+ProgressiveMesh                 PMesh;          // progressive mesh
 std::vector<D3DMATERIAL9>       Mtrls(0);
 std::vector<IDirect3DTexture9*> Textures(0);
 
 //
-// Framework functions
+// bigship1.x is read in the background and nothing is drawn until its
+// progressive mesh is built; a subset is drawn untextured until its
+// texture is in.
 //
-bool Setup()
+
+AssetLoader* Loader = 0;
+
+// the subsets waiting on each texture file
+std::map<std::string, std::vector<int> > TextureSubsets;
+
+//
+// Loading
+//
+
+// Reads a whole file into data; false if it is missing or empty.
+bool ReadWholeFile(const std::string& fileName, std::vector<BYTE>* data)
+{
+	FILE* file = fopen(fileName.c_str(), "rb");
+	if( !file )
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if( size > 0 )
+	{
+		data->resize(size);
+		if( fread(&(*data)[0], 1, size, file) != (size_t)size )
+			data->clear();
+	}
+	fclose(file);
+
+	return !data->empty();
+}
+
+// Reads a texture file on a worker, checks it is an image D3DX can read,
+// and creates the texture on the main thread for every subset asking for
+// it; a file named by several materials is read once.
+void RequestTexture(const char* fileName, int subset)
+{
+	std::shared_ptr<std::vector<BYTE> > data(new std::vector<BYTE>);
+	std::string name = fileName;
+
+	// the first request reads the file for every subset naming it
+	std::vector<int>& subsets = TextureSubsets[name];
+	subsets.push_back(subset);
+	if( subsets.size() > 1 )
+		return;
+
+	Loader->load(fileName,
+		[data, name](AssetId) -> bool
+		{
+			D3DXIMAGE_INFO info;
+			return ReadWholeFile(name, data.get()) &&
+				SUCCEEDED(D3DXGetImageInfoFromFileInMemory(&(*data)[0], (UINT)data->size(), &info));
+		},
+		[data, name](bool ok)
+		{
+			IDirect3DTexture9* tex = 0;
+			if( ok )
+				D3DXCreateTextureFromFileInMemory(Device, &(*data)[0], (UINT)data->size(), &tex);
+
+			// each subset holds its own reference
+			std::vector<int>& subsets = TextureSubsets[name];
+			for(int i = 0; i < (int)subsets.size(); i++)
+			{
+				if( tex && i > 0 )
+					tex->AddRef();
+				Textures[subsets[i]] = tex;
+			}
+			TextureSubsets.erase(name);
+			data->clear();
+		});
+}
+
+// Builds the progressive mesh from the bytes of the .x file, on the main
+// thread, and asks for the textures its materials name.
+bool FinishShip(const std::vector<BYTE>& data)
 {
 	HRESULT hr = 0;
 
@@ -45,8 +128,9 @@ bool Setup()
 	ID3DXBuffer* mtrlBuffer = 0;
 	DWORD        numMtrls   = 0;
 
-	hr = D3DXLoadMeshFromX(  
-		"bigship1.x",
+	hr = D3DXLoadMeshFromXInMemory(  
+		&data[0],
+		(DWORD)data.size(),
 		D3DXMESH_MANAGED,
 		Device,
 		&adjBuffer,
@@ -57,7 +141,7 @@ bool Setup()
 
 	if(FAILED(hr))
 	{
-		::MessageBox(0, "D3DXLoadMeshFromX() - FAILED", 0, 0);
+		::MessageBox(0, "D3DXLoadMeshFromXInMemory() - FAILED", 0, 0);
 		return false;
 	}
 
@@ -69,6 +153,9 @@ bool Setup()
 	{
 		D3DXMATERIAL* mtrls = (D3DXMATERIAL*)mtrlBuffer->GetBufferPointer();
 
+		Mtrls.resize(numMtrls);
+		Textures.resize(numMtrls, 0);   // filled in as the textures come in
+
 		for(int i = 0; i < numMtrls; i++)
 		{
 			// the MatD3D property doesn't have an ambient value set
@@ -76,26 +163,11 @@ bool Setup()
 			mtrls[i].MatD3D.Ambient = mtrls[i].MatD3D.Diffuse;
 
 			// save the ith material
-			Mtrls.push_back( mtrls[i].MatD3D );
+			Mtrls[i] = mtrls[i].MatD3D;
 
 			// check if the ith material has an associative texture
 			if( mtrls[i].pTextureFilename != 0 )
-			{
-				// yes, load the texture for the ith subset
-				IDirect3DTexture9* tex = 0;
-				D3DXCreateTextureFromFile(
-					Device,
-					mtrls[i].pTextureFilename,
-					&tex);
-
-				// save the loaded texture
-				Textures.push_back( tex );
-			}
-			else
-			{
-				// no texture for the ith subset
-				Textures.push_back( 0 );
-			}
+				RequestTexture(mtrls[i].pTextureFilename, i);
 		}
 	}
 	d3d::Release<ID3DXBuffer*>(mtrlBuffer); // done w/ buffer
@@ -109,13 +181,15 @@ bool Setup()
 		D3DXMESHOPT_COMPACT  |
 		D3DXMESHOPT_VERTEXCACHE,
 		(DWORD*)adjBuffer->GetBufferPointer(),
-		(DWORD*)adjBuffer->GetBufferPointer(), // new adjacency info
-		0, 0);
+		0, 0, 0);
+
+	d3d::Release<ID3DXBuffer*>(adjBuffer); // done w/ buffer
 
 	if(FAILED(hr))
 	{
 		::MessageBox(0, "OptimizeInplace() - FAILED", 0, 0);
-		d3d::Release<ID3DXBuffer*>(adjBuffer); // free
+		SourceMesh->Release();
+		SourceMesh = 0;
 		return false;
 	}
 
@@ -123,27 +197,62 @@ bool Setup()
 	// Generate the progressive mesh. 
 	//
 
-	hr = D3DXGeneratePMesh(
+	ProgressiveMeshStats stats;
+	bool generated = PMesh.createFromMesh(
+		Device,
 		SourceMesh,
-		(DWORD*)adjBuffer->GetBufferPointer(), // adjacency
-		0,                  // default vertex attribute weights
-		0,                  // default vertex weights
 		1,                  // simplify as low as possible
-		D3DXMESHSIMP_FACE,  // simplify by face count
-		&PMesh);
+		0,                  // one thread per core
+		&stats);
 
-	d3d::Release<ID3DXMesh*>(SourceMesh);  // done w/ source mesh
-	d3d::Release<ID3DXBuffer*>(adjBuffer); // done w/ buffer
+	SourceMesh->Release();  // done w/ source mesh
+	SourceMesh = 0;
 
-	if(FAILED(hr))
+	if( !generated )
 	{
-		::MessageBox(0, "D3DXGeneratePMesh() - FAILED", 0, 0);
+		::MessageBox(0, "ProgressiveMesh::createFromMesh() - FAILED", 0, 0);
 		return false;
 	}
 
+	char report[256];
+	sprintf(report,
+		"Progressive mesh: %d to %d faces in %d collapses, %.3f ms on %d threads "
+		"(quadrics %.3f, candidates %.3f, collapses %.3f)\n",
+		stats.maxFaces, stats.minFaces, stats.collapses, stats.totalMs, stats.numThreads,
+		stats.quadricMs, stats.candidateMs, stats.collapseMs);
+	::OutputDebugString(report);
+
 	// set to original detail
-	DWORD maxFaces = PMesh->GetMaxFaces();
-	PMesh->SetNumFaces(maxFaces);
+	PMesh.setNumFaces(PMesh.getMaxFaces());
+
+	return true;
+}
+
+// Reads bigship1.x on a worker and builds its mesh once it is in.
+void RequestShip()
+{
+	std::shared_ptr<std::vector<BYTE> > data(new std::vector<BYTE>);
+
+	Loader->load("bigship1.x",
+		[data](AssetId) -> bool
+		{
+			return ReadWholeFile("bigship1.x", data.get());
+		},
+		[data](bool ok)
+		{
+			if( !ok || !FinishShip(*data) )
+				::MessageBox(0, "Loading bigship1.x - FAILED", 0, 0);
+			data->clear();
+		});
+}
+
+//
+// Framework functions
+//
+bool Setup()
+{
+	Loader = new AssetLoader(0);
+	RequestShip();
 
 	//
 	// Set texture filters.
@@ -201,7 +310,10 @@ bool Setup()
 
 void Cleanup()
 {
-	d3d::Release<ID3DXPMesh*>(PMesh);
+	// first, so no worker is still reading when the rest goes
+	d3d::Delete<AssetLoader*>(Loader);
+
+	PMesh.release();
 
 	for(int i = 0; i < Textures.size(); i++)
 		d3d::Release<IDirect3DTexture9*>( Textures[i] );
@@ -212,27 +324,31 @@ bool Display(float timeDelta)
 	if( Device )
 	{
 		//
-		// Update: Mesh resolution.
+		// Update: finish whatever the loader has read, and the mesh
+		// resolution.
 		//
 
+		Loader->update();
+		bool loaded = PMesh.getMaxFaces() > 0;
+
 		// Get the current number of faces the pmesh has.
-		int numFaces = PMesh->GetNumFaces();
+		int numFaces = PMesh.getNumFaces();
 
-		// Add a face, note the SetNumFaces() will  automatically
+		// Add a face, note the setNumFaces() will  automatically
 		// clamp the specified value if it goes out of bounds.
-		if( ::GetAsyncKeyState('A') & 0x8000f )
+		if( loaded && (::GetAsyncKeyState('A') & 0x8000f) )
 		{
 			// Sometimes we must add more than one face to invert
-			// an edge collapse transformation
-			PMesh->SetNumFaces( numFaces + 1 );
-			if( PMesh->GetNumFaces() == numFaces )
-				PMesh->SetNumFaces( numFaces + 2 );
+			// an edge collapse transformation; a collapse along a
+			// seam removes four.
+			for(int add = 1; PMesh.getNumFaces() == numFaces && numFaces < PMesh.getMaxFaces(); add++)
+				PMesh.setNumFaces( numFaces + add );
 		}
 
-		// Remove a face, note the SetNumFaces() will  automatically
+		// Remove a face, note the setNumFaces() will  automatically
 		// clamp the specified value if it goes out of bounds.
-		if( ::GetAsyncKeyState('S') & 0x8000f )
-			PMesh->SetNumFaces( numFaces - 1 );
+		if( loaded && (::GetAsyncKeyState('S') & 0x8000f) )
+			PMesh.setNumFaces( numFaces - 1 );
 		
 		//
 		// Render
@@ -241,17 +357,18 @@ bool Display(float timeDelta)
 		Device->Clear(0, 0, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, 0xffffffff, 1.0f, 0);
 		Device->BeginScene();
 
-		for(int i = 0; i < Mtrls.size(); i++)
+		// nothing to draw until the mesh is in
+		for(int i = 0; loaded && i < Mtrls.size(); i++)
 		{
 			// draw pmesh
 			Device->SetMaterial( &Mtrls[i] );
 			Device->SetTexture(0, Textures[i]);
-			PMesh->DrawSubset(i);
+			PMesh.drawSubset(i);
 
 			// draw wireframe outline
 			Device->SetMaterial(&d3d::YELLOW_MTRL);
 			Device->SetRenderState(D3DRS_FILLMODE, D3DFILL_WIREFRAME);
-			PMesh->DrawSubset(i);
+			PMesh.drawSubset(i);
 			Device->SetRenderState(D3DRS_FILLMODE, D3DFILL_SOLID);
 		}	
 
@@ -0,0 +1,138 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: progressiveMesh.h
+//
+// Desc: A progressive mesh built without D3DXGeneratePMesh.  The mesh is
+//       simplified by half-edge collapses, cheapest first by a quadric error
+//       metric that also covers normals and texture coordinates (Garland &
+//       Heckbert 1998).  Texture and normal seams, open borders and material
+//       boundaries only collapse along themselves, so they neither crack nor
+//       wander.
+//
+//       A half-edge collapse moves one vertex onto a neighbour, so the vertex
+//       buffer never changes: each collapse is recorded as the corners it
+//       rewrites and the faces it removes, and the faces are ordered so that
+//       every subset's live faces are a prefix of it.  setNumFaces then walks
+//       the records forward (collapse) or backward (vertex split), touching
+//       only the indices those steps change.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __progressiveMeshH__
+#define __progressiveMeshH__
+
+#include "d3dUtility.h"
+#include <vector>
+
+struct ProgressiveMeshStats
+{
+	ProgressiveMeshStats();
+
+	int   maxFaces;
+	int   minFaces;
+	int   vertices;
+	int   collapses;
+	int   seamVertices;     // on a normal or texture seam
+	int   borderVertices;   // on an open edge or a material boundary
+	int   lockedVertices;   // where seams or borders meet; never move
+	int   numThreads;
+
+	float quadricMs;        // quadrics and vertex classes, in parallel
+	float candidateMs;      // every vertex's first collapse, in parallel
+	float collapseMs;       // the collapses themselves, one at a time
+	float totalMs;
+};
+
+// One corner rewritten by a collapse: corner goes from 'from' to 'to', and
+// back again on the vertex split.
+struct ProgressiveMeshChange
+{
+	DWORD corner;
+	DWORD from;
+	DWORD to;
+};
+
+struct ProgressiveMeshCollapse
+{
+	DWORD firstChange;
+	DWORD numChanges;
+	DWORD firstRemoved;     // into the removed face subsets
+	DWORD numRemoved;
+	DWORD numFaces;         // left after this collapse
+	float error;            // square root of the quadric error so far
+};
+
+class ProgressiveMesh
+{
+public:
+	ProgressiveMesh();
+	~ProgressiveMesh();
+
+	// Builds the collapse records for a triangle list.  vertices holds
+	// numVertices vertices of the given FVF, which must have D3DFVF_XYZ
+	// positions; its normal and first texture coordinates, when present,
+	// weigh in on the costs.  Simplification stops at minFaces faces or when
+	// no collapse is left that keeps the mesh sound.  numThreads = 0 uses
+	// one thread per hardware thread.
+	bool generate(const void* vertices, int numVertices, DWORD fvf,
+		const DWORD* indices, const DWORD* attributes, int numFaces,
+		int minFaces, int numThreads, ProgressiveMeshStats* stats);
+
+	// generate() on a D3DX mesh, then a managed mesh of the same format to
+	// draw the levels with.  The source mesh is only read.
+	bool createFromMesh(IDirect3DDevice9* device, ID3DXMesh* source,
+		int minFaces, int numThreads, ProgressiveMeshStats* stats);
+
+	void release();
+
+	// Moves to the most detailed level with at most numFaces faces, clamped
+	// between getMinFaces() and getMaxFaces(); like ID3DXPMesh, adding one
+	// face may take adding two.
+	void setNumFaces(int numFaces);
+
+	int getNumFaces() const { return _numFaces; }
+	int getMaxFaces() const { return _maxFaces; }
+	int getMinFaces() const { return _collapses.empty() ? _maxFaces : (int)_collapses.back().numFaces; }
+	int getNumVertices() const { return _numVertices; }
+
+	// collapses applied, 0 at full detail
+	int getLevel() const { return _level; }
+	int getNumLevels() const { return (int)_collapses.size() + 1; }
+
+	// corners the last setNumFaces rewrote
+	int getLastChanges() const { return _lastChanges; }
+
+	const std::vector<DWORD>&              getIndices() const { return _indices; }
+	const std::vector<D3DXATTRIBUTERANGE>& getSubsets() const { return _subsets; }
+	const std::vector<ProgressiveMeshCollapse>& getCollapses() const { return _collapses; }
+
+	// Draws the live faces of the subset with this attribute id.
+	HRESULT drawSubset(DWORD attribId);
+
+private:
+	int   _numVertices;
+	DWORD _fvf;
+	int   _stride;
+	std::vector<BYTE> _vertices;
+
+	std::vector<DWORD>                   _indices;        // at the current level
+	std::vector<D3DXATTRIBUTERANGE>      _subsets;        // FaceCount at the current level
+	std::vector<DWORD>                   _fullFaceCounts;
+	std::vector<ProgressiveMeshCollapse> _collapses;
+	std::vector<ProgressiveMeshChange>   _changes;
+	std::vector<DWORD>                   _removedSubsets; // subset of each removed face
+
+	int _level;
+	int _maxFaces;
+	int _numFaces;
+	int _lastChanges;
+
+	ID3DXMesh* _mesh;
+
+	bool upload(DWORD firstCorner, DWORD lastCorner);
+
+	ProgressiveMesh(const ProgressiveMesh&);
+	ProgressiveMesh& operator=(const ProgressiveMesh&);
+};
+
+#endif // __progressiveMeshH__
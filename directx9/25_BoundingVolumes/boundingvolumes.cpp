@@ -6,14 +6,29 @@
 //
 // System: AMD Athlon 1800+ XP, 512 DDR, Geforce 3, Windows XP, MSVC++ 7.0 
 //
-// Desc: Demonstrates how to use D3DXComputeBoundingSphere and D3DXComputeBoundingBox.
+// Desc: Demonstrates bounding volumes, drawing the tighter ones from bounds.h
+//       around a mesh.  Run with -benchmark, it instead compares them with
+//       D3DXComputeBoundingSphere and D3DXComputeBoundingBox on bigship1.x's
+//       vertices, times the collision detection from collision.h on 50,000
+//       moving volumes, and exits.  The .x file and its
+//       textures are read on worker threads (see assetLoader.h); the meshes
+//       are built on the main thread once they are in.
 //
-//      -The spacebar key switches between rendering the mesh's bounding sphere and box.
+//      -The spacebar key cycles between rendering the mesh's bounding sphere, box
+//       and oriented box.
 //          
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "d3dUtility.h"
+#include "assetLoader.h"
+#include "bounds.h"
+#include "collision.h"
+#include "xfileParser.h"
+#include <map>
+#include <memory>
+#include <string>
 #include <vector>
+#include <cstdio>
 
 //
 // Globals
@@ -30,20 +45,102 @@ std::vector<IDirect3DTexture9*> Textures(0);
 
 ID3DXMesh* SphereMesh = 0;
 ID3DXMesh* BoxMesh    = 0;
+ID3DXMesh* OBBMesh    = 0;
 
-bool RenderBoundingSphere = true;
+// the volume meshes are created at the origin; these place them on the mesh
+D3DXMATRIX SphereOffset;
+D3DXMATRIX BoxOffset;
+D3DXMATRIX OBBOffset;
+
+enum { RENDER_SPHERE, RENDER_BOX, RENDER_OBB, NUM_RENDER_MODES };
+int RenderVolume = RENDER_SPHERE;
+
+//
+// bigship1.x is read in the background and nothing is drawn until its mesh
+// and volumes are built; a subset is drawn untextured until its texture is
+// in.
+//
+
+AssetLoader* Loader = 0;
+
+// the subsets waiting on each texture file
+std::map<std::string, std::vector<int> > TextureSubsets;
 
 //
 // Prototypes
 //
 
-bool ComputeBoundingSphere(ID3DXMesh* mesh, d3d::BoundingSphere* sphere);
-bool    ComputeBoundingBox(ID3DXMesh* mesh, d3d::BoundingBox*    box);
+void ReportBoundingVolumes(const char* fileName);
+void ReportCollision();
 
 //
-// Framework functions
+// Loading
 //
-bool Setup()
+
+// Reads a whole file into data; false if it is missing or empty.
+bool ReadWholeFile(const std::string& fileName, std::vector<BYTE>* data)
+{
+	FILE* file = fopen(fileName.c_str(), "rb");
+	if( !file )
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if( size > 0 )
+	{
+		data->resize(size);
+		if( fread(&(*data)[0], 1, size, file) != (size_t)size )
+			data->clear();
+	}
+	fclose(file);
+
+	return !data->empty();
+}
+
+// Reads a texture file on a worker, checks it is an image D3DX can read,
+// and creates the texture on the main thread for every subset asking for
+// it; a file named by several materials is read once.
+void RequestTexture(const char* fileName, int subset)
+{
+	std::shared_ptr<std::vector<BYTE> > data(new std::vector<BYTE>);
+	std::string name = fileName;
+
+	// the first request reads the file for every subset naming it
+	std::vector<int>& subsets = TextureSubsets[name];
+	subsets.push_back(subset);
+	if( subsets.size() > 1 )
+		return;
+
+	Loader->load(fileName,
+		[data, name](AssetId) -> bool
+		{
+			D3DXIMAGE_INFO info;
+			return ReadWholeFile(name, data.get()) &&
+				SUCCEEDED(D3DXGetImageInfoFromFileInMemory(&(*data)[0], (UINT)data->size(), &info));
+		},
+		[data, name](bool ok)
+		{
+			IDirect3DTexture9* tex = 0;
+			if( ok )
+				D3DXCreateTextureFromFileInMemory(Device, &(*data)[0], (UINT)data->size(), &tex);
+
+			// each subset holds its own reference
+			std::vector<int>& subsets = TextureSubsets[name];
+			for(int i = 0; i < (int)subsets.size(); i++)
+			{
+				if( tex && i > 0 )
+					tex->AddRef();
+				Textures[subsets[i]] = tex;
+			}
+			TextureSubsets.erase(name);
+			data->clear();
+		});
+}
+
+// Builds the mesh and its bounding volumes from the bytes of the .x file,
+// on the main thread, and asks for the textures its materials name.
+bool FinishShip(const std::vector<BYTE>& data)
 {
 	HRESULT hr = 0;
 
@@ -54,8 +151,9 @@ bool Setup()
 	ID3DXBuffer* mtrlBuffer = 0;
 	DWORD        numMtrls   = 0;
 
-	hr = D3DXLoadMeshFromX(  
-		"bigship1.x",
+	hr = D3DXLoadMeshFromXInMemory(  
+		&data[0],
+		(DWORD)data.size(),
 		D3DXMESH_MANAGED,
 		Device,
 		&adjBuffer,
@@ -66,7 +164,7 @@ bool Setup()
 
 	if(FAILED(hr))
 	{
-		::MessageBox(0, "D3DXLoadMeshFromX() - FAILED", 0, 0);
+		::MessageBox(0, "D3DXLoadMeshFromXInMemory() - FAILED", 0, 0);
 		return false;
 	}
 
@@ -78,6 +176,9 @@ bool Setup()
 	{
 		D3DXMATERIAL* mtrls = (D3DXMATERIAL*)mtrlBuffer->GetBufferPointer();
 
+		Mtrls.resize(numMtrls);
+		Textures.resize(numMtrls, 0);   // filled in as the textures come in
+
 		for(int i = 0; i < numMtrls; i++)
 		{
 			// the MatD3D property doesn't have an ambient value set
@@ -85,26 +186,11 @@ bool Setup()
 			mtrls[i].MatD3D.Ambient = mtrls[i].MatD3D.Diffuse;
 
 			// save the ith material
-			Mtrls.push_back( mtrls[i].MatD3D );
+			Mtrls[i] = mtrls[i].MatD3D;
 
 			// check if the ith material has an associative texture
 			if( mtrls[i].pTextureFilename != 0 )
-			{
-				// yes, load the texture for the ith subset
-				IDirect3DTexture9* tex = 0;
-				D3DXCreateTextureFromFile(
-					Device,
-					mtrls[i].pTextureFilename,
-					&tex);
-
-				// save the loaded texture
-				Textures.push_back( tex );
-			}
-			else
-			{
-				// no texture for the ith subset
-				Textures.push_back( 0 );
-			}
+				RequestTexture(mtrls[i].pTextureFilename, i);
 		}
 	}
 	d3d::Release<ID3DXBuffer*>(mtrlBuffer); // done w/ buffer
@@ -125,6 +211,8 @@ bool Setup()
 	if(FAILED(hr))
 	{
 		::MessageBox(0, "OptimizeInplace() - FAILED", 0, 0);
+		Mesh->Release();
+		Mesh = 0;
 		return false;
 	}
 
@@ -134,9 +222,19 @@ bool Setup()
     
 	d3d::BoundingSphere boundingSphere;
 	d3d::BoundingBox    boundingBox;
+	BoundingOBB         boundingOBB;
+
+	ComputeBoundingSphereEPOS(Mesh, &boundingSphere, 0);
+	ComputeBoundingBox(Mesh, &boundingBox, 0);
+	ComputeBoundingOBB(Mesh, &boundingOBB, 0);
+
+	D3DXMatrixTranslation(&SphereOffset,
+		boundingSphere._center.x, boundingSphere._center.y, boundingSphere._center.z);
 
-	ComputeBoundingSphere(Mesh, &boundingSphere);
-	ComputeBoundingBox(Mesh, &boundingBox);
+	D3DXVECTOR3 boxCenter = (boundingBox._min + boundingBox._max) * 0.5f;
+	D3DXMatrixTranslation(&BoxOffset, boxCenter.x, boxCenter.y, boxCenter.z);
+
+	boundingOBB.getTransform(&OBBOffset);
 
 	D3DXCreateSphere(
 		Device,
@@ -154,6 +252,43 @@ bool Setup()
 		&BoxMesh,
 		0);
 
+	D3DXCreateBox(
+		Device,
+		boundingOBB._extent.x * 2.0f,
+		boundingOBB._extent.y * 2.0f,
+		boundingOBB._extent.z * 2.0f,
+		&OBBMesh,
+		0);
+
+	return true;
+}
+
+// Reads bigship1.x on a worker and builds its mesh once it is in.
+void RequestShip()
+{
+	std::shared_ptr<std::vector<BYTE> > data(new std::vector<BYTE>);
+
+	Loader->load("bigship1.x",
+		[data](AssetId) -> bool
+		{
+			return ReadWholeFile("bigship1.x", data.get());
+		},
+		[data](bool ok)
+		{
+			if( !ok || !FinishShip(*data) )
+				::MessageBox(0, "Loading bigship1.x - FAILED", 0, 0);
+			data->clear();
+		});
+}
+
+//
+// Framework functions
+//
+bool Setup()
+{
+	Loader = new AssetLoader(0);
+	RequestShip();
+
 	//
 	// Set texture filters.
 	//
@@ -210,6 +345,9 @@ bool Setup()
 
 void Cleanup()
 {
+	// first, so no worker is still reading when the rest goes
+	d3d::Delete<AssetLoader*>(Loader);
+
 	d3d::Release<ID3DXMesh*>(Mesh);
 
 	for(int i = 0; i < Textures.size(); i++)
@@ -217,6 +355,7 @@ void Cleanup()
 
 	d3d::Release<ID3DXMesh*>(SphereMesh);
 	d3d::Release<ID3DXMesh*>(BoxMesh);
+	d3d::Release<ID3DXMesh*>(OBBMesh);
 }
 
 bool Display(float timeDelta)
@@ -224,9 +363,11 @@ bool Display(float timeDelta)
 	if( Device )
 	{
 		//
-		// Update: Rotate the mesh.
+		// Update: finish whatever the loader has read, and rotate the mesh.
 		//
 
+		Loader->update();
+
 		static float y = 0.0f;
 		D3DXMATRIX yRot;
 		D3DXMatrixRotationY(&yRot, y);
@@ -246,6 +387,14 @@ bool Display(float timeDelta)
 		Device->Clear(0, 0, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, 0xffffffff, 1.0f, 0);
 		Device->BeginScene();
 
+		// nothing to draw until the mesh and its volumes are in
+		if( !OBBMesh )
+		{
+			Device->EndScene();
+			Device->Present(0, 0, 0, 0);
+			return true;
+		}
+
 		// draw the mesh
 		for(int i = 0; i < Mtrls.size(); i++)
 		{
@@ -266,10 +415,27 @@ bool Display(float timeDelta)
 		Device->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
 		Device->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
 
-		if( RenderBoundingSphere )
+		D3DXMATRIX volumeWorld;
+		switch( RenderVolume )
+		{
+		case RENDER_SPHERE:
+			volumeWorld = SphereOffset * World;
+			Device->SetTransform(D3DTS_WORLD, &volumeWorld);
 			SphereMesh->DrawSubset(0);
-		else
+			break;
+
+		case RENDER_BOX:
+			volumeWorld = BoxOffset * World;
+			Device->SetTransform(D3DTS_WORLD, &volumeWorld);
 			BoxMesh->DrawSubset(0);
+			break;
+
+		case RENDER_OBB:
+			volumeWorld = OBBOffset * World;
+			Device->SetTransform(D3DTS_WORLD, &volumeWorld);
+			OBBMesh->DrawSubset(0);
+			break;
+		}
 
 		Device->SetRenderState(D3DRS_ALPHABLENDENABLE, false);
 
@@ -295,7 +461,7 @@ LRESULT CALLBACK d3d::WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 			::DestroyWindow(hwnd);
 
 		if( wParam == VK_SPACE )
-			RenderBoundingSphere = !RenderBoundingSphere;
+			RenderVolume = (RenderVolume + 1) % NUM_RENDER_MODES;
 
 		break;
 	}
@@ -310,6 +476,14 @@ int WINAPI WinMain(HINSTANCE hinstance,
 				   PSTR cmdLine,
 				   int showCmd)
 {
+	// the benchmarks need no device
+	if( d3d::FindSwitch(cmdLine, "-benchmark") )
+	{
+		ReportBoundingVolumes("bigship1.x");
+		ReportCollision();
+		return 0;
+	}
+
 	if(!d3d::InitD3D(hinstance,
 		Width, Height, true, D3DDEVTYPE_HAL, &Device))
 	{
@@ -332,46 +506,82 @@ int WINAPI WinMain(HINSTANCE hinstance,
 	return 0;
 }
 
-bool ComputeBoundingSphere(ID3DXMesh* mesh, d3d::BoundingSphere* sphere)
+//
+// Writes the D3DX volumes of fileName's vertices next to the ones from
+// bounds.h to the debugger output, with the time each took.  The positions
+// are read with the .x parser, so no device is needed.
+//
+void ReportBoundingVolumes(const char* fileName)
 {
-	HRESULT hr = 0;
-
-	BYTE* v = 0;
-	mesh->LockVertexBuffer(0, (void**)&v);
-
-	hr = D3DXComputeBoundingSphere(
-			(D3DXVECTOR3*)v,
-			mesh->GetNumVertices(),
-			D3DXGetFVFVertexSize(mesh->GetFVF()),
-			&sphere->_center,
-			&sphere->_radius);
-
-	mesh->UnlockVertexBuffer();
-
-	if( FAILED(hr) )
-		return false;
-
-	return true;
+	XFileScene scene;
+	if( !LoadXFile(fileName, &scene, 0, 0) )
+		return;
+
+	std::vector<XFileVector3> positions;
+	for(int i = 0; i < (int)scene.meshes.size(); i++)
+		positions.insert(positions.end(), scene.meshes[i].positions.begin(), scene.meshes[i].positions.end());
+	if( positions.empty() )
+		return;
+
+	const BYTE* v      = (const BYTE*)&positions[0];
+	DWORD       stride = sizeof(XFileVector3);
+	DWORD       num    = (DWORD)positions.size();
+
+	LARGE_INTEGER frequency, t[6];
+	::QueryPerformanceFrequency(&frequency);
+
+	d3d::BoundingSphere d3dxSphere, eposSphere, welzlSphere;
+	d3d::BoundingBox    d3dxBox;
+	BoundingOBB         obb;
+
+	::QueryPerformanceCounter(&t[0]);
+	D3DXComputeBoundingSphere((const D3DXVECTOR3*)v, num, stride, &d3dxSphere._center, &d3dxSphere._radius);
+	::QueryPerformanceCounter(&t[1]);
+	ComputeBoundingSphereEPOS(v, stride, num, &eposSphere, 0);
+	::QueryPerformanceCounter(&t[2]);
+	ComputeBoundingSphereWelzl(v, stride, num, &welzlSphere);
+	::QueryPerformanceCounter(&t[3]);
+	D3DXComputeBoundingBox((const D3DXVECTOR3*)v, num, stride, &d3dxBox._min, &d3dxBox._max);
+	::QueryPerformanceCounter(&t[4]);
+	ComputeBoundingOBB(v, stride, num, &obb, 0);
+	::QueryPerformanceCounter(&t[5]);
+
+	float ms[5];
+	for(int i = 0; i < 5; i++)
+		ms[i] = (float)((t[i + 1].QuadPart - t[i].QuadPart) * 1000.0 / frequency.QuadPart);
+
+	D3DXVECTOR3 size = d3dxBox._max - d3dxBox._min;
+
+	char report[512];
+	::sprintf(report,
+		"%s, %d vertices\n"
+		"  sphere radius: D3DX %.3f (%.3f ms), EPOS %.3f (%.3f ms), Welzl %.3f (%.3f ms)\n"
+		"  box volume: D3DX %.3f (%.3f ms), oriented %.3f (%.3f ms)\n",
+		fileName, (int)num,
+		d3dxSphere._radius, ms[0], eposSphere._radius, ms[1], welzlSphere._radius, ms[2],
+		size.x * size.y * size.z, ms[3], obb.volume(), ms[4]);
+	::OutputDebugString(report);
 }
 
-bool ComputeBoundingBox(ID3DXMesh* mesh, d3d::BoundingBox* box)
+//
+// Writes the collision benchmark's timings to the debugger output, on one
+// thread and on all of them.
+//
+void ReportCollision()
 {
-	HRESULT hr = 0;
-
-	BYTE* v = 0;
-	mesh->LockVertexBuffer(0, (void**)&v);
-
-	hr = D3DXComputeBoundingBox(
-			(D3DXVECTOR3*)v,
-			mesh->GetNumVertices(),
-			D3DXGetFVFVertexSize(mesh->GetFVF()),
-			&box->_min,
-			&box->_max);
-
-	mesh->UnlockVertexBuffer();
-
-	if( FAILED(hr) )
-		return false;
-
-	return true;
+	int threads[2] = { 1, 0 };
+	for(int i = 0; i < 2; i++)
+	{
+		CollisionBenchmark bench;
+		if( !BenchmarkCollision(50000, 60, threads[i], &bench) )
+			continue;
+
+		char report[256];
+		::sprintf(report,
+			"Collision: %d bodies on %d thread(s): %.3f ms per frame (sort %.3f, sweep %.3f), "
+			"%.0f candidates, %.0f contacts, %s brute force\n",
+			bench.numBodies, bench.numThreads, bench.collideMs, bench.sortMs, bench.sweepMs,
+			bench.candidatePairs, bench.contacts, bench.matches ? "matches" : "DIFFERS FROM");
+		::OutputDebugString(report);
+	}
 }
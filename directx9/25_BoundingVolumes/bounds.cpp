@@ -0,0 +1,806 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: bounds.cpp
+//
+// Desc: Bounding volume fitting.  See bounds.h.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "bounds.h"
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <cfloat>
+#include <cmath>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+namespace
+{
+	// Below this many vertices per thread, starting the thread costs more
+	// than it saves.
+	const DWORD MinVerticesPerThread = 32768;
+
+	// EPOS directions.  The first three give the box, the rest the cube's
+	// diagonals and its edges' diagonals.  They need not be normalized since
+	// only the extreme points along them are used.
+	const int NumDirections = 13;
+	const int NumDirectionLanes = 16; // padded to four SSE groups
+
+	const float DirectionX[NumDirectionLanes] = { 1, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0,  0,  0,  0 };
+	const float DirectionY[NumDirectionLanes] = { 0, 1, 0, 1, 1,-1,-1, 1,-1, 0, 0, 1, 1,  1,  1,  1 };
+	const float DirectionZ[NumDirectionLanes] = { 0, 0, 1, 1,-1, 1,-1, 0, 0, 1,-1, 1,-1, -1, -1, -1 };
+
+	const D3DXVECTOR3& Position(const BYTE* vertices, DWORD stride, DWORD i)
+	{
+		return *(const D3DXVECTOR3*)(vertices + i * stride);
+	}
+
+	int WorkerCount(int numThreads, DWORD numVertices)
+	{
+		if( numThreads <= 0 )
+			numThreads = (int)std::thread::hardware_concurrency();
+		if( numThreads <= 0 )
+			numThreads = 1;
+
+		int useful = (int)(numVertices / MinVerticesPerThread);
+		if( useful < 1 )
+			useful = 1;
+
+		return numThreads < useful ? numThreads : useful;
+	}
+
+	// Calls func(worker, begin, end) over equal slices of [0, numVertices),
+	// the first slice on the calling thread.
+	template<typename Func>
+	void ParallelRanges(DWORD numVertices, int workers, Func func)
+	{
+		if( workers <= 1 )
+		{
+			func(0, 0, numVertices);
+			return;
+		}
+
+		std::vector<std::thread> threads;
+		for(int w = 1; w < workers; w++)
+		{
+			DWORD begin = (DWORD)((unsigned long long)numVertices * w / workers);
+			DWORD end   = (DWORD)((unsigned long long)numVertices * (w + 1) / workers);
+			threads.push_back(std::thread(func, w, begin, end));
+		}
+
+		func(0, 0, (DWORD)((unsigned long long)numVertices / workers));
+
+		for(int w = 0; w < (int)threads.size(); w++)
+			threads[w].join();
+	}
+
+	//
+	// Box reduction.  With Rotate set, each position is first expressed in
+	// the frame of three axes, which gives the extents of an oriented box.
+	//
+
+	struct Extents
+	{
+		float mn[4];
+		float mx[4];
+	};
+
+	template<bool Rotate>
+	__m128 ToFrame(__m128 p, __m128 ax, __m128 ay, __m128 az)
+	{
+		if( !Rotate )
+			return p;
+
+		__m128 x = _mm_shuffle_ps(p, p, _MM_SHUFFLE(0, 0, 0, 0));
+		__m128 y = _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1));
+		__m128 z = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2));
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, ax), _mm_mul_ps(y, ay)), _mm_mul_ps(z, az));
+	}
+
+	template<bool Rotate>
+	void ExtentsRange(
+		const BYTE* vertices, DWORD stride, DWORD numVertices,
+		DWORD begin, DWORD end,
+		const D3DXVECTOR3* axes, Extents* out)
+	{
+		__m128 ax = _mm_setzero_ps(), ay = _mm_setzero_ps(), az = _mm_setzero_ps();
+		if( Rotate )
+		{
+			ax = _mm_setr_ps(axes[0].x, axes[1].x, axes[2].x, 0.0f);
+			ay = _mm_setr_ps(axes[0].y, axes[1].y, axes[2].y, 0.0f);
+			az = _mm_setr_ps(axes[0].z, axes[1].z, axes[2].z, 0.0f);
+		}
+
+		// two sets of accumulators so consecutive min/max do not wait on each other
+		__m128 mn0 = _mm_set1_ps( FLT_MAX), mn1 = mn0;
+		__m128 mx0 = _mm_set1_ps(-FLT_MAX), mx1 = mx0;
+
+		// A 16 byte load reads past the position into the next vertex, which
+		// is only missing after the buffer's last one.
+		DWORD safeEnd = (stride >= 16 || end < numVertices) ? end : end - 1;
+
+		const BYTE* p = vertices + begin * stride;
+		DWORD i = begin;
+
+		for(; i + 4 <= safeEnd; i += 4, p += 4 * stride)
+		{
+			__m128 a = ToFrame<Rotate>(_mm_loadu_ps((const float*)(p             )), ax, ay, az);
+			__m128 b = ToFrame<Rotate>(_mm_loadu_ps((const float*)(p +     stride)), ax, ay, az);
+			__m128 c = ToFrame<Rotate>(_mm_loadu_ps((const float*)(p + 2 * stride)), ax, ay, az);
+			__m128 d = ToFrame<Rotate>(_mm_loadu_ps((const float*)(p + 3 * stride)), ax, ay, az);
+
+			mn0 = _mm_min_ps(mn0, a); mx0 = _mm_max_ps(mx0, a);
+			mn1 = _mm_min_ps(mn1, b); mx1 = _mm_max_ps(mx1, b);
+			mn0 = _mm_min_ps(mn0, c); mx0 = _mm_max_ps(mx0, c);
+			mn1 = _mm_min_ps(mn1, d); mx1 = _mm_max_ps(mx1, d);
+		}
+
+		for(; i < end; i++, p += stride)
+		{
+			const float* f = (const float*)p;
+			__m128 a = i < safeEnd ? _mm_loadu_ps(f) : _mm_setr_ps(f[0], f[1], f[2], 0.0f);
+			a = ToFrame<Rotate>(a, ax, ay, az);
+
+			mn0 = _mm_min_ps(mn0, a);
+			mx0 = _mm_max_ps(mx0, a);
+		}
+
+		_mm_storeu_ps(out->mn, _mm_min_ps(mn0, mn1));
+		_mm_storeu_ps(out->mx, _mm_max_ps(mx0, mx1));
+	}
+
+	// Reduces the whole buffer; axes = 0 for the axis-aligned box.
+	void ComputeExtents(
+		const BYTE* vertices, DWORD stride, DWORD numVertices,
+		const D3DXVECTOR3* axes, int numThreads,
+		D3DXVECTOR3* mn, D3DXVECTOR3* mx)
+	{
+		int workers = WorkerCount(numThreads, numVertices);
+		std::vector<Extents> partial(workers);
+
+		ParallelRanges(numVertices, workers, [&](int w, DWORD begin, DWORD end)
+		{
+			if( axes )
+				ExtentsRange<true>(vertices, stride, numVertices, begin, end, axes, &partial[w]);
+			else
+				ExtentsRange<false>(vertices, stride, numVertices, begin, end, 0, &partial[w]);
+		});
+
+		*mn = D3DXVECTOR3( FLT_MAX,  FLT_MAX,  FLT_MAX);
+		*mx = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for(int w = 0; w < workers; w++)
+		{
+			for(int a = 0; a < 3; a++)
+			{
+				(*mn)[a] = partial[w].mn[a] < (*mn)[a] ? partial[w].mn[a] : (*mn)[a];
+				(*mx)[a] = partial[w].mx[a] > (*mx)[a] ? partial[w].mx[a] : (*mx)[a];
+			}
+		}
+	}
+
+	//
+	// Spheres through one to four boundary points, and Welzl's algorithm.
+	//
+
+	struct Sphere
+	{
+		D3DXVECTOR3 c;
+		float       r2;   // squared radius, negative for the empty sphere
+	};
+
+	bool Inside(const Sphere& s, const D3DXVECTOR3& p)
+	{
+		D3DXVECTOR3 d = p - s.c;
+		// relative slack so points on the boundary stay inside after rounding
+		return D3DXVec3LengthSq(&d) <= s.r2 * 1.00001f + 1e-10f;
+	}
+
+	Sphere SphereFrom(const D3DXVECTOR3* b, int count)
+	{
+		Sphere s;
+		s.c  = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+		s.r2 = -1.0f;
+
+		if( count == 1 )
+		{
+			s.c  = b[0];
+			s.r2 = 0.0f;
+		}
+		else if( count == 2 )
+		{
+			s.c = (b[0] + b[1]) * 0.5f;
+			D3DXVECTOR3 d = b[0] - s.c;
+			s.r2 = D3DXVec3LengthSq(&d);
+		}
+		else if( count == 3 )
+		{
+			// circumcenter of the triangle
+			D3DXVECTOR3 a = b[1] - b[0];
+			D3DXVECTOR3 c = b[2] - b[0];
+			D3DXVECTOR3 n;
+			D3DXVec3Cross(&n, &a, &c);
+
+			float denom = 2.0f * D3DXVec3LengthSq(&n);
+			if( denom < 1e-12f )
+			{
+				// collinear: the sphere through the two points farthest apart
+				D3DXVECTOR3 e = b[2] - b[1];
+				float la = D3DXVec3LengthSq(&a), lc = D3DXVec3LengthSq(&c), le = D3DXVec3LengthSq(&e);
+				D3DXVECTOR3 pair[2] = { b[0], b[1] };
+				if( lc >= la && lc >= le ) pair[1] = b[2];
+				else if( le >= la )        pair[0] = b[2];
+				return SphereFrom(pair, 2);
+			}
+
+			D3DXVECTOR3 t = c * D3DXVec3LengthSq(&a) - a * D3DXVec3LengthSq(&c);
+			D3DXVECTOR3 offset;
+			D3DXVec3Cross(&offset, &t, &n);
+			offset /= denom;
+
+			s.c  = b[0] + offset;
+			s.r2 = D3DXVec3LengthSq(&offset);
+		}
+		else if( count == 4 )
+		{
+			// circumcenter of the tetrahedron
+			D3DXVECTOR3 a = b[1] - b[0];
+			D3DXVECTOR3 c = b[2] - b[0];
+			D3DXVECTOR3 d = b[3] - b[0];
+
+			D3DXVECTOR3 cd, da, ac;
+			D3DXVec3Cross(&cd, &c, &d);
+			D3DXVec3Cross(&da, &d, &a);
+			D3DXVec3Cross(&ac, &a, &c);
+
+			float det = 2.0f * D3DXVec3Dot(&a, &cd);
+			if( fabsf(det) < 1e-12f )
+				return SphereFrom(b, 3); // coplanar
+
+			D3DXVECTOR3 offset =
+				(cd * D3DXVec3LengthSq(&a) + da * D3DXVec3LengthSq(&c) + ac * D3DXVec3LengthSq(&d)) / det;
+
+			s.c  = b[0] + offset;
+			s.r2 = D3DXVec3LengthSq(&offset);
+		}
+
+		return s;
+	}
+
+	// Minimal sphere of points[0, count) with boundary[0, numBoundary) on its
+	// surface.  Points found outside are moved to the front, so the ones that
+	// define the sphere are tested first from then on.  The recursion is at
+	// most four deep.
+	Sphere MoveToFront(std::vector<D3DXVECTOR3>& points, int count, D3DXVECTOR3* boundary, int numBoundary)
+	{
+		Sphere s = SphereFrom(boundary, numBoundary);
+		if( numBoundary == 4 )
+			return s;
+
+		for(int i = 0; i < count; i++)
+		{
+			if( Inside(s, points[i]) )
+				continue;
+
+			boundary[numBoundary] = points[i];
+			s = MoveToFront(points, i, boundary, numBoundary + 1);
+
+			std::rotate(points.begin(), points.begin() + i, points.begin() + i + 1);
+		}
+
+		return s;
+	}
+
+	Sphere Welzl(std::vector<D3DXVECTOR3>& points)
+	{
+		// a fixed shuffle gives the expected linear time without making the
+		// result depend on rand()'s state
+		DWORD seed = 0x9e3779b9;
+		for(int i = (int)points.size() - 1; i > 0; i--)
+		{
+			seed = seed * 1664525 + 1013904223;
+			std::swap(points[i], points[(seed >> 8) % (i + 1)]);
+		}
+
+		D3DXVECTOR3 boundary[4];
+		return MoveToFront(points, (int)points.size(), boundary, 0);
+	}
+
+	//
+	// EPOS extremal points, four directions per SSE instruction.
+	//
+
+	struct ExtremalPoints
+	{
+		float mn[NumDirectionLanes];
+		float mx[NumDirectionLanes];
+		int   imn[NumDirectionLanes];
+		int   imx[NumDirectionLanes];
+	};
+
+	__m128 Select(__m128 mask, __m128 a, __m128 b)
+	{
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+
+	// Running extremes along four directions.
+	struct DirectionGroup
+	{
+		DirectionGroup()
+		{
+		}
+
+		DirectionGroup(__m128 x, __m128 y, __m128 z, __m128 lo, __m128 hi, __m128 ilo, __m128 ihi)
+			: dx(x), dy(y), dz(z), mn(lo), mx(hi), imn(ilo), imx(ihi)
+		{
+		}
+
+		void add(const float* f, DWORD i)
+		{
+			__m128 d = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(_mm_set1_ps(f[0]), dx),
+				_mm_mul_ps(_mm_set1_ps(f[1]), dy)),
+				_mm_mul_ps(_mm_set1_ps(f[2]), dz));
+			__m128 index = _mm_castsi128_ps(_mm_set1_epi32((int)i));
+
+			__m128 lower = _mm_cmplt_ps(d, mn);
+			__m128 upper = _mm_cmpgt_ps(d, mx);
+
+			mn  = _mm_min_ps(mn, d);
+			mx  = _mm_max_ps(mx, d);
+			imn = Select(lower, index, imn);
+			imx = Select(upper, index, imx);
+		}
+
+		void merge(const DirectionGroup& other)
+		{
+			__m128 lower = _mm_cmplt_ps(other.mn, mn);
+			__m128 upper = _mm_cmpgt_ps(other.mx, mx);
+
+			mn  = _mm_min_ps(mn, other.mn);
+			mx  = _mm_max_ps(mx, other.mx);
+			imn = Select(lower, other.imn, imn);
+			imx = Select(upper, other.imx, imx);
+		}
+
+		__m128 dx, dy, dz;
+		__m128 mn, mx, imn, imx; // indices kept as float bit patterns
+	};
+
+	void ExtremalRange(const BYTE* vertices, DWORD stride, DWORD begin, DWORD end, ExtremalPoints* out)
+	{
+		__m128 first = _mm_castsi128_ps(_mm_set1_epi32((int)begin));
+
+		// on the stack: heap blocks are not 16 byte aligned on x86
+		DirectionGroup groups[4];
+		for(int g = 0; g < 4; g++)
+		{
+			groups[g] = DirectionGroup(
+				_mm_loadu_ps(&DirectionX[4 * g]),
+				_mm_loadu_ps(&DirectionY[4 * g]),
+				_mm_loadu_ps(&DirectionZ[4 * g]),
+				_mm_set1_ps(FLT_MAX), _mm_set1_ps(-FLT_MAX), first, first);
+		}
+
+		// All sixteen running values do not fit in registers at once, so
+		// the vertices go by in blocks that stay in the cache while each
+		// group of four directions takes its turn.
+		const DWORD BlockSize = 1024;
+
+		for(DWORD block = begin; block < end; block += BlockSize)
+		{
+			DWORD blockEnd = block + BlockSize < end ? block + BlockSize : end;
+
+			for(int g = 0; g < 4; g++)
+			{
+				// even and odd vertices run separately so the compare and
+				// select chains overlap
+				DirectionGroup even = groups[g];
+				DirectionGroup odd  = groups[g];
+
+				const BYTE* p = vertices + block * stride;
+				DWORD i = block;
+				for(; i + 2 <= blockEnd; i += 2, p += 2 * stride)
+				{
+					even.add((const float*)p, i);
+					odd.add((const float*)(p + stride), i + 1);
+				}
+				if( i < blockEnd )
+					even.add((const float*)p, i);
+
+				even.merge(odd);
+				groups[g] = even;
+			}
+		}
+
+		for(int g = 0; g < 4; g++)
+		{
+			_mm_storeu_ps(&out->mn[4 * g], groups[g].mn);
+			_mm_storeu_ps(&out->mx[4 * g], groups[g].mx);
+			_mm_storeu_si128((__m128i*)&out->imn[4 * g], _mm_castps_si128(groups[g].imn));
+			_mm_storeu_si128((__m128i*)&out->imx[4 * g], _mm_castps_si128(groups[g].imx));
+		}
+	}
+
+	struct Farthest
+	{
+		float dist2;
+		DWORD index;
+	};
+
+	void FarthestRange(
+		const BYTE* vertices, DWORD stride, DWORD begin, DWORD end,
+		const D3DXVECTOR3& center, Farthest* out)
+	{
+		out->dist2 = -1.0f;
+		out->index = begin;
+
+		const BYTE* p = vertices + begin * stride;
+		for(DWORD i = begin; i < end; i++, p += stride)
+		{
+			const float* f = (const float*)p;
+			float x = f[0] - center.x;
+			float y = f[1] - center.y;
+			float z = f[2] - center.z;
+			float d2 = x * x + y * y + z * z;
+			if( d2 > out->dist2 )
+			{
+				out->dist2 = d2;
+				out->index = i;
+			}
+		}
+	}
+
+	Farthest ComputeFarthest(
+		const BYTE* vertices, DWORD stride, DWORD numVertices,
+		const D3DXVECTOR3& center, int workers)
+	{
+		std::vector<Farthest> partial(workers);
+		ParallelRanges(numVertices, workers, [&](int w, DWORD begin, DWORD end)
+		{
+			FarthestRange(vertices, stride, begin, end, center, &partial[w]);
+		});
+
+		Farthest best = partial[0];
+		for(int w = 1; w < workers; w++)
+		{
+			if( partial[w].dist2 > best.dist2 )
+				best = partial[w];
+		}
+		return best;
+	}
+
+	//
+	// Eigenvectors of a symmetric 3x3 matrix by cyclic Jacobi rotations.
+	// The columns of v receive the eigenvectors.
+	//
+
+	void Jacobi(double a[3][3], double v[3][3])
+	{
+		for(int i = 0; i < 3; i++)
+			for(int j = 0; j < 3; j++)
+				v[i][j] = i == j ? 1.0 : 0.0;
+
+		for(int sweep = 0; sweep < 32; sweep++)
+		{
+			double off = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+			if( off < 1e-24 )
+				break;
+
+			for(int p = 0; p < 2; p++)
+			{
+				for(int q = p + 1; q < 3; q++)
+				{
+					if( fabs(a[p][q]) < 1e-30 )
+						continue;
+
+					double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+					double t = (theta >= 0.0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+					double c = 1.0 / sqrt(t * t + 1.0);
+					double s = t * c;
+
+					// a = J^T a J, v = v J
+					for(int k = 0; k < 3; k++)
+					{
+						double akp = a[k][p], akq = a[k][q];
+						a[k][p] = c * akp - s * akq;
+						a[k][q] = s * akp + c * akq;
+					}
+					for(int k = 0; k < 3; k++)
+					{
+						double apk = a[p][k], aqk = a[q][k];
+						a[p][k] = c * apk - s * aqk;
+						a[q][k] = s * apk + c * aqk;
+					}
+					for(int k = 0; k < 3; k++)
+					{
+						double vkp = v[k][p], vkq = v[k][q];
+						v[k][p] = c * vkp - s * vkq;
+						v[k][q] = s * vkp + c * vkq;
+					}
+				}
+			}
+		}
+	}
+
+	struct Moments
+	{
+		double n;
+		double sx, sy, sz;
+		double sxx, sxy, sxz, syy, syz, szz;
+	};
+
+	void MomentsRange(const BYTE* vertices, DWORD stride, DWORD begin, DWORD end, Moments* out)
+	{
+		Moments m = {};
+
+		// per-range sums stay in double, so a million vertices far from the
+		// origin do not lose the covariance to cancellation
+		const BYTE* p = vertices + begin * stride;
+		for(DWORD i = begin; i < end; i++, p += stride)
+		{
+			const float* f = (const float*)p;
+			double x = f[0], y = f[1], z = f[2];
+
+			m.sx  += x;     m.sy  += y;     m.sz  += z;
+			m.sxx += x * x; m.sxy += x * y; m.sxz += x * z;
+			m.syy += y * y; m.syz += y * z; m.szz += z * z;
+		}
+		m.n = (double)(end - begin);
+
+		*out = m;
+	}
+
+	struct ScopedVertexLock
+	{
+		ScopedVertexLock(ID3DXMesh* mesh) : _mesh(mesh), _data(0)
+		{
+			if( FAILED(_mesh->LockVertexBuffer(D3DLOCK_READONLY, (void**)&_data)) )
+				_data = 0;
+		}
+
+		~ScopedVertexLock()
+		{
+			if( _data )
+				_mesh->UnlockVertexBuffer();
+		}
+
+		ID3DXMesh* _mesh;
+		BYTE*      _data;
+	};
+}
+
+BoundingOBB::BoundingOBB()
+{
+	_center  = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+	_axis[0] = D3DXVECTOR3(1.0f, 0.0f, 0.0f);
+	_axis[1] = D3DXVECTOR3(0.0f, 1.0f, 0.0f);
+	_axis[2] = D3DXVECTOR3(0.0f, 0.0f, 1.0f);
+	_extent  = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+}
+
+float BoundingOBB::volume() const
+{
+	return 8.0f * _extent.x * _extent.y * _extent.z;
+}
+
+void BoundingOBB::getTransform(D3DXMATRIX* m) const
+{
+	// rows are the axes, so local x maps to _axis[0] with row vectors
+	*m = D3DXMATRIX(
+		_axis[0].x, _axis[0].y, _axis[0].z, 0.0f,
+		_axis[1].x, _axis[1].y, _axis[1].z, 0.0f,
+		_axis[2].x, _axis[2].y, _axis[2].z, 0.0f,
+		_center.x,  _center.y,  _center.z,  1.0f);
+}
+
+bool ComputeBoundingBox(
+	const BYTE* vertices, DWORD stride, DWORD numVertices,
+	d3d::BoundingBox* box, int numThreads)
+{
+	if( !vertices || numVertices == 0 || stride < sizeof(D3DXVECTOR3) || !box )
+		return false;
+
+	ComputeExtents(vertices, stride, numVertices, 0, numThreads, &box->_min, &box->_max);
+	return true;
+}
+
+bool ComputeBoundingSphereEPOS(
+	const BYTE* vertices, DWORD stride, DWORD numVertices,
+	d3d::BoundingSphere* sphere, int numThreads)
+{
+	if( !vertices || numVertices == 0 || stride < sizeof(D3DXVECTOR3) || !sphere )
+		return false;
+
+	int workers = WorkerCount(numThreads, numVertices);
+
+	//
+	// Extreme points along each direction, and their exact minimal sphere.
+	//
+
+	std::vector<ExtremalPoints> partial(workers);
+	ParallelRanges(numVertices, workers, [&](int w, DWORD begin, DWORD end)
+	{
+		ExtremalRange(vertices, stride, begin, end, &partial[w]);
+	});
+
+	std::vector<D3DXVECTOR3> extremes;
+	extremes.reserve(2 * NumDirections);
+	for(int d = 0; d < NumDirections; d++)
+	{
+		int lo = 0, hi = 0;
+		for(int w = 1; w < workers; w++)
+		{
+			if( partial[w].mn[d] < partial[lo].mn[d] ) lo = w;
+			if( partial[w].mx[d] > partial[hi].mx[d] ) hi = w;
+		}
+		extremes.push_back(Position(vertices, stride, (DWORD)partial[lo].imn[d]));
+		extremes.push_back(Position(vertices, stride, (DWORD)partial[hi].imx[d]));
+	}
+
+	Sphere s = Welzl(extremes);
+	float radius = sqrtf(s.r2 > 0.0f ? s.r2 : 0.0f);
+
+	//
+	// Most meshes have no point outside the extreme points' sphere.  If one
+	// is, grow the sphere in a single Ritter pass: each point outside moves
+	// the center toward it just far enough to take it in.
+	//
+
+	Farthest farthest = ComputeFarthest(vertices, stride, numVertices, s.c, workers);
+	if( farthest.dist2 <= radius * radius * 1.0001f )
+	{
+		// at most rounding away from the sphere
+		radius = sqrtf(farthest.dist2 > radius * radius ? farthest.dist2 : radius * radius);
+	}
+	else
+	{
+		const BYTE* p = vertices;
+		for(DWORD i = 0; i < numVertices; i++, p += stride)
+		{
+			D3DXVECTOR3 toPoint = *(const D3DXVECTOR3*)p - s.c;
+			float dist2 = D3DXVec3LengthSq(&toPoint);
+			if( dist2 <= radius * radius )
+				continue;
+
+			float dist = sqrtf(dist2);
+			float newRadius = (radius + dist) * 0.5f;
+			s.c += toPoint * ((newRadius - radius) / dist);
+			radius = newRadius;
+		}
+	}
+
+	sphere->_center = s.c;
+	sphere->_radius = radius;
+	return true;
+}
+
+bool ComputeBoundingSphereWelzl(
+	const BYTE* vertices, DWORD stride, DWORD numVertices,
+	d3d::BoundingSphere* sphere)
+{
+	if( !vertices || numVertices == 0 || stride < sizeof(D3DXVECTOR3) || !sphere )
+		return false;
+
+	std::vector<D3DXVECTOR3> points(numVertices);
+	for(DWORD i = 0; i < numVertices; i++)
+		points[i] = Position(vertices, stride, i);
+
+	Sphere s = Welzl(points);
+
+	// the inside test has some slack; the farthest point makes sure every
+	// vertex really is covered
+	Farthest farthest = ComputeFarthest(vertices, stride, numVertices, s.c, 1);
+
+	sphere->_center = s.c;
+	sphere->_radius = sqrtf(farthest.dist2);
+	return true;
+}
+
+bool ComputeBoundingOBB(
+	const BYTE* vertices, DWORD stride, DWORD numVertices,
+	BoundingOBB* obb, int numThreads)
+{
+	if( !vertices || numVertices == 0 || stride < sizeof(D3DXVECTOR3) || !obb )
+		return false;
+
+	int workers = WorkerCount(numThreads, numVertices);
+
+	//
+	// Covariance of the positions.
+	//
+
+	std::vector<Moments> partial(workers);
+	ParallelRanges(numVertices, workers, [&](int w, DWORD begin, DWORD end)
+	{
+		MomentsRange(vertices, stride, begin, end, &partial[w]);
+	});
+
+	Moments m = {};
+	for(int w = 0; w < workers; w++)
+	{
+		m.n   += partial[w].n;
+		m.sx  += partial[w].sx;  m.sy  += partial[w].sy;  m.sz  += partial[w].sz;
+		m.sxx += partial[w].sxx; m.sxy += partial[w].sxy; m.sxz += partial[w].sxz;
+		m.syy += partial[w].syy; m.syz += partial[w].syz; m.szz += partial[w].szz;
+	}
+
+	double mx = m.sx / m.n, my = m.sy / m.n, mz = m.sz / m.n;
+	double cov[3][3];
+	cov[0][0] = m.sxx / m.n - mx * mx;
+	cov[1][1] = m.syy / m.n - my * my;
+	cov[2][2] = m.szz / m.n - mz * mz;
+	cov[0][1] = cov[1][0] = m.sxy / m.n - mx * my;
+	cov[0][2] = cov[2][0] = m.sxz / m.n - mx * mz;
+	cov[1][2] = cov[2][1] = m.syz / m.n - my * mz;
+
+	double v[3][3];
+	Jacobi(cov, v);
+
+	D3DXVECTOR3 axes[3];
+	for(int a = 0; a < 3; a++)
+	{
+		axes[a] = D3DXVECTOR3((float)v[0][a], (float)v[1][a], (float)v[2][a]);
+		D3DXVec3Normalize(&axes[a], &axes[a]);
+	}
+	// exactly orthogonal and right handed, whatever the rounding did
+	D3DXVec3Cross(&axes[2], &axes[0], &axes[1]);
+	D3DXVec3Normalize(&axes[2], &axes[2]);
+	D3DXVec3Cross(&axes[1], &axes[2], &axes[0]);
+
+	//
+	// Extents along the axes; keep the axis-aligned box if it is smaller.
+	//
+
+	D3DXVECTOR3 lo, hi;
+	ComputeExtents(vertices, stride, numVertices, axes, numThreads, &lo, &hi);
+
+	D3DXVECTOR3 boxMin, boxMax;
+	ComputeExtents(vertices, stride, numVertices, 0, numThreads, &boxMin, &boxMax);
+
+	D3DXVECTOR3 size    = hi - lo;
+	D3DXVECTOR3 boxSize = boxMax - boxMin;
+
+	if( boxSize.x * boxSize.y * boxSize.z <= size.x * size.y * size.z )
+	{
+		*obb = BoundingOBB();
+		obb->_center = (boxMin + boxMax) * 0.5f;
+		obb->_extent = boxSize * 0.5f;
+		return true;
+	}
+
+	D3DXVECTOR3 mid = (lo + hi) * 0.5f;
+	for(int a = 0; a < 3; a++)
+		obb->_axis[a] = axes[a];
+	obb->_center = axes[0] * mid.x + axes[1] * mid.y + axes[2] * mid.z;
+	obb->_extent = size * 0.5f;
+	return true;
+}
+
+bool ComputeBoundingBox(ID3DXMesh* mesh, d3d::BoundingBox* box, int numThreads)
+{
+	ScopedVertexLock lock(mesh);
+	return ComputeBoundingBox(
+		lock._data, D3DXGetFVFVertexSize(mesh->GetFVF()), mesh->GetNumVertices(), box, numThreads);
+}
+
+bool ComputeBoundingSphereEPOS(ID3DXMesh* mesh, d3d::BoundingSphere* sphere, int numThreads)
+{
+	ScopedVertexLock lock(mesh);
+	return ComputeBoundingSphereEPOS(
+		lock._data, D3DXGetFVFVertexSize(mesh->GetFVF()), mesh->GetNumVertices(), sphere, numThreads);
+}
+
+bool ComputeBoundingSphereWelzl(ID3DXMesh* mesh, d3d::BoundingSphere* sphere)
+{
+	ScopedVertexLock lock(mesh);
+	return ComputeBoundingSphereWelzl(
+		lock._data, D3DXGetFVFVertexSize(mesh->GetFVF()), mesh->GetNumVertices(), sphere);
+}
+
+bool ComputeBoundingOBB(ID3DXMesh* mesh, BoundingOBB* obb, int numThreads)
+{
+	ScopedVertexLock lock(mesh);
+	return ComputeBoundingOBB(
+		lock._data, D3DXGetFVFVertexSize(mesh->GetFVF()), mesh->GetNumVertices(), obb, numThreads);
+}
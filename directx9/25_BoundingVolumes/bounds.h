@@ -0,0 +1,70 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: bounds.h
+//
+// Desc: Bounding volumes fitted to strided vertex buffers, tighter than the
+//       D3DX ones: boxes reduced with SSE, minimal spheres (EPOS or exact
+//       Welzl), and oriented boxes fitted by principal component analysis.
+//       Large buffers are split across threads and the partial results
+//       merged.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __boundsH__
+#define __boundsH__
+
+#include "d3dUtility.h"
+
+struct BoundingOBB
+{
+	BoundingOBB();
+
+	// Box of half-extents _extent along _axis[0..2], centered at _center.
+	// The axes are orthonormal.
+	D3DXVECTOR3 _center;
+	D3DXVECTOR3 _axis[3];
+	D3DXVECTOR3 _extent;
+
+	float volume() const;
+
+	// Rotation and translation from the box's frame: a box of size
+	// 2 * _extent centered at the origin, drawn with it, covers the volume.
+	void getTransform(D3DXMATRIX* m) const;
+};
+
+//
+// All functions read the position from the first 12 bytes of each vertex.
+// numThreads = 0 uses one thread per hardware thread; buffers too small to
+// be worth splitting are done on the calling thread either way.
+//
+
+bool ComputeBoundingBox(
+	const BYTE* vertices, DWORD stride, DWORD numVertices,
+	d3d::BoundingBox* box, int numThreads);
+
+// Larsson's extremal points optimal sphere: the minimal sphere of the
+// extreme points along 13 directions, grown to cover the rest.  Within a
+// few percent of minimal at about the cost of a bounding box.
+bool ComputeBoundingSphereEPOS(
+	const BYTE* vertices, DWORD stride, DWORD numVertices,
+	d3d::BoundingSphere* sphere, int numThreads);
+
+// Welzl's exact minimal sphere, with the move-to-front heuristic.  Expected
+// linear time but with a much larger constant than EPOS.
+bool ComputeBoundingSphereWelzl(
+	const BYTE* vertices, DWORD stride, DWORD numVertices,
+	d3d::BoundingSphere* sphere);
+
+// Axes from the eigenvectors of the vertex covariance.  When the result is
+// bigger than the axis-aligned box, the axis-aligned box is returned.
+bool ComputeBoundingOBB(
+	const BYTE* vertices, DWORD stride, DWORD numVertices,
+	BoundingOBB* obb, int numThreads);
+
+// The same, reading a mesh's vertex buffer.
+bool ComputeBoundingBox(ID3DXMesh* mesh, d3d::BoundingBox* box, int numThreads);
+bool ComputeBoundingSphereEPOS(ID3DXMesh* mesh, d3d::BoundingSphere* sphere, int numThreads);
+bool ComputeBoundingSphereWelzl(ID3DXMesh* mesh, d3d::BoundingSphere* sphere);
+bool ComputeBoundingOBB(ID3DXMesh* mesh, BoundingOBB* obb, int numThreads);
+
+#endif // __boundsH__
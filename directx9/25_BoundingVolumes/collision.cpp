@@ -0,0 +1,757 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: collision.cpp
+//
+// Desc: Broadphase and narrowphase collision.  See collision.h.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "collision.h"
+#include <algorithm>
+#include <thread>
+#include <functional>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <xmmintrin.h>
+
+namespace
+{
+	// Below this many bodies per thread the sweep is not worth splitting.
+	const int MinBodiesPerThread = 4096;
+
+	float Component(const D3DXVECTOR3& v, int axis)
+	{
+		return ((const float*)&v)[axis];
+	}
+
+	// The AABB as an oriented box, for the box / oriented box test.
+	BoundingOBB ToOBB(const d3d::BoundingBox& box)
+	{
+		BoundingOBB obb;
+		obb._center  = (box._min + box._max) * 0.5f;
+		obb._extent  = (box._max - box._min) * 0.5f;
+		obb._axis[0] = D3DXVECTOR3(1.0f, 0.0f, 0.0f);
+		obb._axis[1] = D3DXVECTOR3(0.0f, 1.0f, 0.0f);
+		obb._axis[2] = D3DXVECTOR3(0.0f, 0.0f, 1.0f);
+		return obb;
+	}
+
+	d3d::BoundingBox SphereBounds(const d3d::BoundingSphere& sphere)
+	{
+		D3DXVECTOR3 r(sphere._radius, sphere._radius, sphere._radius);
+
+		d3d::BoundingBox box;
+		box._min = sphere._center - r;
+		box._max = sphere._center + r;
+		return box;
+	}
+
+	struct KeyLess
+	{
+		KeyLess(const std::vector<d3d::BoundingBox>& bounds, int axis) : _bounds(bounds), _axis(axis) {}
+
+		bool operator()(int a, int b) const
+		{
+			return Component(_bounds[a]._min, _axis) < Component(_bounds[b]._min, _axis);
+		}
+
+		const std::vector<d3d::BoundingBox>& _bounds;
+		int _axis;
+	};
+
+	double Now()
+	{
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+	}
+}
+
+//
+// Narrowphase
+//
+
+bool Intersects(const d3d::BoundingSphere& a, const d3d::BoundingSphere& b)
+{
+	D3DXVECTOR3 d = b._center - a._center;
+	float r = a._radius + b._radius;
+	return D3DXVec3Dot(&d, &d) <= r * r;
+}
+
+bool Intersects(const d3d::BoundingSphere& sphere, const d3d::BoundingBox& box)
+{
+	// squared distance from the center to the closest point of the box
+	float dist2 = 0.0f;
+	for(int i = 0; i < 3; i++)
+	{
+		float c = Component(sphere._center, i);
+		float lo = Component(box._min, i), hi = Component(box._max, i);
+
+		if( c < lo )
+			dist2 += (lo - c) * (lo - c);
+		else if( c > hi )
+			dist2 += (c - hi) * (c - hi);
+	}
+	return dist2 <= sphere._radius * sphere._radius;
+}
+
+bool Intersects(const d3d::BoundingBox& a, const d3d::BoundingBox& b)
+{
+	return a._min.x <= b._max.x && a._max.x >= b._min.x &&
+	       a._min.y <= b._max.y && a._max.y >= b._min.y &&
+	       a._min.z <= b._max.z && a._max.z >= b._min.z;
+}
+
+bool Intersects(const d3d::BoundingSphere& sphere, const BoundingOBB& obb)
+{
+	// the same as the box test, in the oriented box's frame
+	D3DXVECTOR3 d = sphere._center - obb._center;
+
+	float dist2 = 0.0f;
+	for(int i = 0; i < 3; i++)
+	{
+		float excess = fabsf(D3DXVec3Dot(&d, &obb._axis[i])) - Component(obb._extent, i);
+		if( excess > 0.0f )
+			dist2 += excess * excess;
+	}
+	return dist2 <= sphere._radius * sphere._radius;
+}
+
+bool Intersects(const BoundingOBB& a, const BoundingOBB& b)
+{
+	// Gottschalk's test, as written up by Ericson.  Everything is expressed
+	// in a's frame: R takes b's axes there and t is the offset between the
+	// centers.
+	const float* ea = (const float*)&a._extent;
+	const float* eb = (const float*)&b._extent;
+
+	D3DXVECTOR3 offset = b._center - a._center;
+
+	float R[3][3], absR[3][3], t[3];
+	for(int i = 0; i < 3; i++)
+	{
+		for(int j = 0; j < 3; j++)
+		{
+			R[i][j] = D3DXVec3Dot(&a._axis[i], &b._axis[j]);
+
+			// the epsilon keeps near parallel edges from producing a cross
+			// product axis that is only noise
+			absR[i][j] = fabsf(R[i][j]) + 1e-6f;
+		}
+		t[i] = D3DXVec3Dot(&offset, &a._axis[i]);
+	}
+
+	// a's face normals
+	for(int i = 0; i < 3; i++)
+	{
+		float rb = eb[0] * absR[i][0] + eb[1] * absR[i][1] + eb[2] * absR[i][2];
+		if( fabsf(t[i]) > ea[i] + rb )
+			return false;
+	}
+
+	// b's face normals
+	for(int j = 0; j < 3; j++)
+	{
+		float ra = ea[0] * absR[0][j] + ea[1] * absR[1][j] + ea[2] * absR[2][j];
+		float d  = t[0] * R[0][j] + t[1] * R[1][j] + t[2] * R[2][j];
+		if( fabsf(d) > ra + eb[j] )
+			return false;
+	}
+
+	// a's axis i crossed with b's axis j
+	for(int i = 0; i < 3; i++)
+	{
+		int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+		for(int j = 0; j < 3; j++)
+		{
+			int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+
+			float ra = ea[i1] * absR[i2][j] + ea[i2] * absR[i1][j];
+			float rb = eb[j1] * absR[i][j2] + eb[j2] * absR[i][j1];
+			float d  = t[i2] * R[i1][j] - t[i1] * R[i2][j];
+			if( fabsf(d) > ra + rb )
+				return false;
+		}
+	}
+
+	return true;
+}
+
+void ComputeBoundingBox(const BoundingOBB& obb, d3d::BoundingBox* box)
+{
+	D3DXVECTOR3 half(0.0f, 0.0f, 0.0f);
+	for(int i = 0; i < 3; i++)
+	{
+		float e = Component(obb._extent, i);
+		half.x += fabsf(obb._axis[i].x) * e;
+		half.y += fabsf(obb._axis[i].y) * e;
+		half.z += fabsf(obb._axis[i].z) * e;
+	}
+
+	box->_min = obb._center - half;
+	box->_max = obb._center + half;
+}
+
+//
+// CollisionWorld
+//
+
+CollisionStats::CollisionStats()
+{
+	bodies         = 0;
+	sweepAxis      = 0;
+	sortMoves      = 0;
+	candidatePairs = 0;
+	contacts       = 0;
+	numThreads     = 0;
+	sortMs         = 0.0f;
+	sweepMs        = 0.0f;
+}
+
+CollisionWorld::CollisionWorld()
+{
+	_axis = 0;
+}
+
+void CollisionWorld::clear()
+{
+	_shape.clear();
+	_slot.clear();
+	_spheres.clear();
+	_boxes.clear();
+	_obbs.clear();
+	_bounds.clear();
+	_order.clear();
+}
+
+int CollisionWorld::addBody(BYTE shape, int slot, const d3d::BoundingBox& bounds)
+{
+	_shape.push_back(shape);
+	_slot.push_back(slot);
+	_bounds.push_back(bounds);
+	return (int)_shape.size() - 1;
+}
+
+int CollisionWorld::addSphere(const d3d::BoundingSphere& sphere)
+{
+	_spheres.push_back(sphere);
+	return addBody(SHAPE_SPHERE, (int)_spheres.size() - 1, SphereBounds(sphere));
+}
+
+int CollisionWorld::addBox(const d3d::BoundingBox& box)
+{
+	_boxes.push_back(box);
+	return addBody(SHAPE_BOX, (int)_boxes.size() - 1, box);
+}
+
+int CollisionWorld::addOBB(const BoundingOBB& obb)
+{
+	d3d::BoundingBox bounds;
+	ComputeBoundingBox(obb, &bounds);
+
+	_obbs.push_back(obb);
+	return addBody(SHAPE_OBB, (int)_obbs.size() - 1, bounds);
+}
+
+void CollisionWorld::setSphere(int body, const d3d::BoundingSphere& sphere)
+{
+	_spheres[_slot[body]] = sphere;
+	_bounds[body] = SphereBounds(sphere);
+}
+
+void CollisionWorld::setBox(int body, const d3d::BoundingBox& box)
+{
+	_boxes[_slot[body]] = box;
+	_bounds[body] = box;
+}
+
+void CollisionWorld::setOBB(int body, const BoundingOBB& obb)
+{
+	_obbs[_slot[body]] = obb;
+	ComputeBoundingBox(obb, &_bounds[body]);
+}
+
+bool CollisionWorld::testPair(int a, int b) const
+{
+	int sa = _shape[a], sb = _shape[b];
+	if( sa > sb )
+	{
+		std::swap(a, b);
+		std::swap(sa, sb);
+	}
+
+	const int ia = _slot[a], ib = _slot[b];
+
+	switch( sa * 3 + sb )
+	{
+	case SHAPE_SPHERE * 3 + SHAPE_SPHERE: return Intersects(_spheres[ia], _spheres[ib]);
+	case SHAPE_SPHERE * 3 + SHAPE_BOX:    return Intersects(_spheres[ia], _boxes[ib]);
+	case SHAPE_SPHERE * 3 + SHAPE_OBB:    return Intersects(_spheres[ia], _obbs[ib]);
+	case SHAPE_BOX    * 3 + SHAPE_BOX:    return Intersects(_boxes[ia], _boxes[ib]);
+	case SHAPE_BOX    * 3 + SHAPE_OBB:    return Intersects(ToOBB(_boxes[ia]), _obbs[ib]);
+	case SHAPE_OBB    * 3 + SHAPE_OBB:    return Intersects(_obbs[ia], _obbs[ib]);
+	}
+	return false;
+}
+
+void CollisionWorld::sortBodies()
+{
+	int n = (int)_shape.size();
+
+	//
+	// Sweep along the axis the bodies are most spread out on.  Switch only
+	// for a clear winner, since a switch costs a full sort.
+	//
+
+	double sum[3] = { 0.0, 0.0, 0.0 }, sum2[3] = { 0.0, 0.0, 0.0 };
+	for(int i = 0; i < n; i++)
+	{
+		D3DXVECTOR3 c = _bounds[i]._min + _bounds[i]._max;
+		for(int k = 0; k < 3; k++)
+		{
+			double v = Component(c, k);
+			sum[k]  += v;
+			sum2[k] += v * v;
+		}
+	}
+
+	double variance[3];
+	for(int k = 0; k < 3; k++)
+		variance[k] = n ? sum2[k] / n - (sum[k] / n) * (sum[k] / n) : 0.0;
+
+	int best = _axis;
+	for(int k = 0; k < 3; k++)
+		best = variance[k] > variance[best] ? k : best;
+
+	bool resort = (int)_order.size() != n;
+	if( best != _axis && variance[best] > 1.5 * variance[_axis] )
+	{
+		_axis  = best;
+		resort = true;
+	}
+
+	_stats.sortMoves = 0;
+
+	if( resort )
+	{
+		_order.resize(n);
+		for(int i = 0; i < n; i++)
+			_order[i] = i;
+		std::sort(_order.begin(), _order.end(), KeyLess(_bounds, _axis));
+
+		_key.resize(n);
+		for(int i = 0; i < n; i++)
+			_key[i] = Component(_bounds[_order[i]]._min, _axis);
+	}
+	else
+	{
+		// The last frame's order is nearly right: an insertion sort fixes it
+		// in close to linear time.
+		_key.resize(n);
+		for(int i = 0; i < n; i++)
+			_key[i] = Component(_bounds[_order[i]]._min, _axis);
+
+		for(int i = 1; i < n; i++)
+		{
+			float key = _key[i];
+			int   body = _order[i];
+
+			int j = i - 1;
+			while( j >= 0 && _key[j] > key )
+			{
+				_key[j + 1]   = _key[j];
+				_order[j + 1] = _order[j];
+				j--;
+			}
+			_key[j + 1]   = key;
+			_order[j + 1] = body;
+
+			_stats.sortMoves += i - 1 - j;
+		}
+	}
+
+	//
+	// Gather the boxes in sweep order.
+	//
+
+	int u = (_axis + 1) % 3, v = (_axis + 2) % 3;
+
+	_minS.resize(n + 4); _maxS.resize(n + 4);
+	_minU.resize(n + 4); _maxU.resize(n + 4);
+	_minV.resize(n + 4); _maxV.resize(n + 4);
+
+	for(int i = 0; i < n; i++)
+	{
+		const d3d::BoundingBox& box = _bounds[_order[i]];
+		_minS[i] = _key[i];
+		_maxS[i] = Component(box._max, _axis);
+		_minU[i] = Component(box._min, u);
+		_maxU[i] = Component(box._max, u);
+		_minV[i] = Component(box._min, v);
+		_maxV[i] = Component(box._max, v);
+	}
+
+	// the padding starts after every box ends
+	for(int i = n; i < n + 4; i++)
+	{
+		_minS[i] = _minU[i] = _minV[i] =  FLT_MAX;
+		_maxS[i] = _maxU[i] = _maxV[i] = -FLT_MAX;
+	}
+}
+
+void CollisionWorld::sweepRange(
+	int begin, int end, std::vector<ContactPair>& out, ContactSink* sink, int* candidates) const
+{
+	int found = 0;
+
+	for(int i = begin; i < end; i++)
+	{
+		__m128 maxS = _mm_set1_ps(_maxS[i]);
+		__m128 minU = _mm_set1_ps(_minU[i]), maxU = _mm_set1_ps(_maxU[i]);
+		__m128 minV = _mm_set1_ps(_minV[i]), maxV = _mm_set1_ps(_maxV[i]);
+
+		// The boxes after i start after it does; they overlap it along the
+		// sweep axis until one starts after it ends.  The padding stops the
+		// loop at the end of the arrays.
+		for(int j = i + 1; ; j += 4)
+		{
+			__m128 inS = _mm_cmple_ps(_mm_loadu_ps(&_minS[j]), maxS);
+			int sweepMask = _mm_movemask_ps(inS);
+			if( !sweepMask )
+				break;
+
+			__m128 inU = _mm_and_ps(
+				_mm_cmple_ps(_mm_loadu_ps(&_minU[j]), maxU),
+				_mm_cmpge_ps(_mm_loadu_ps(&_maxU[j]), minU));
+			__m128 inV = _mm_and_ps(
+				_mm_cmple_ps(_mm_loadu_ps(&_minV[j]), maxV),
+				_mm_cmpge_ps(_mm_loadu_ps(&_maxV[j]), minV));
+
+			int mask = _mm_movemask_ps(_mm_and_ps(inS, _mm_and_ps(inU, inV)));
+			for(int k = 0; mask; k++, mask >>= 1)
+			{
+				if( !(mask & 1) )
+					continue;
+
+				int a = _order[i], b = _order[j + k];
+				found++;
+
+				if( testPair(a, b) )
+				{
+					ContactPair pair;
+					pair.a = a < b ? a : b;
+					pair.b = a < b ? b : a;
+					out.push_back(pair);
+
+					if( sink && (int)out.size() == BatchSize )
+					{
+						sink->onContacts(&out[0], BatchSize);
+						out.clear();
+					}
+				}
+			}
+
+			// the keys are sorted, so a partial mask is the last one
+			if( sweepMask != 0xf )
+				break;
+		}
+	}
+
+	*candidates = found;
+}
+
+int CollisionWorld::collide(ContactSink* sink, int numThreads)
+{
+	double start = Now();
+
+	sortBodies();
+
+	double sorted = Now();
+
+	int n = (int)_shape.size();
+
+	if( numThreads <= 0 )
+		numThreads = (int)std::thread::hardware_concurrency();
+	if( numThreads <= 0 )
+		numThreads = 1;
+
+	int useful = n / MinBodiesPerThread;
+	if( useful < 1 )
+		useful = 1;
+	numThreads = numThreads < useful ? numThreads : useful;
+
+	int contacts = 0, candidates = 0;
+
+	if( numThreads == 1 )
+	{
+		// stream: the batch goes out whenever it fills
+		std::vector<ContactPair> batch;
+		batch.reserve(BatchSize);
+
+		int streamed = 0;
+		struct CountingSink : public ContactSink
+		{
+			CountingSink(ContactSink* sink, int* count) : _sink(sink), _count(count) {}
+			void onContacts(const ContactPair* pairs, int count)
+			{
+				*_count += count;
+				if( _sink )
+					_sink->onContacts(pairs, count);
+			}
+			ContactSink* _sink;
+			int*         _count;
+		} counter(sink, &streamed);
+
+		sweepRange(0, n, batch, &counter, &candidates);
+
+		if( !batch.empty() )
+			counter.onContacts(&batch[0], (int)batch.size());
+		contacts = streamed;
+	}
+	else
+	{
+		// Each thread sweeps a slice of the sorted bodies into its own list.
+		// The slices' pairs are disjoint since a pair is found only from the
+		// body that starts first.
+		std::vector< std::vector<ContactPair> > found(numThreads);
+		std::vector<int> counts(numThreads, 0);
+		std::vector<std::thread> threads;
+
+		for(int t = 1; t < numThreads; t++)
+		{
+			int begin = (int)((long long)n * t / numThreads);
+			int end   = (int)((long long)n * (t + 1) / numThreads);
+			threads.push_back(std::thread(&CollisionWorld::sweepRange, this,
+				begin, end, std::ref(found[t]), (ContactSink*)0, &counts[t]));
+		}
+		sweepRange(0, n / numThreads, found[0], 0, &counts[0]);
+
+		for(int t = 0; t < (int)threads.size(); t++)
+			threads[t].join();
+
+		for(int t = 0; t < numThreads; t++)
+		{
+			candidates += counts[t];
+			contacts   += (int)found[t].size();
+
+			if( !sink )
+				continue;
+
+			for(int first = 0; first < (int)found[t].size(); first += BatchSize)
+			{
+				int count = (int)found[t].size() - first;
+				sink->onContacts(&found[t][first], count < BatchSize ? count : BatchSize);
+			}
+		}
+	}
+
+	_stats.bodies         = n;
+	_stats.sweepAxis      = _axis;
+	_stats.candidatePairs = candidates;
+	_stats.contacts       = contacts;
+	_stats.numThreads     = numThreads;
+	_stats.sortMs         = (float)(sorted - start);
+	_stats.sweepMs        = (float)(Now() - sorted);
+
+	return contacts;
+}
+
+//
+// Benchmark
+//
+
+namespace
+{
+	float Random(float lo, float hi)
+	{
+		return lo + (hi - lo) * ((float)rand() / (float)RAND_MAX);
+	}
+
+	class CollectContacts : public ContactSink
+	{
+	public:
+		CollectContacts() : _keep(false) {}
+
+		void onContacts(const ContactPair* pairs, int count)
+		{
+			if( _keep )
+				_pairs.insert(_pairs.end(), pairs, pairs + count);
+		}
+
+		bool _keep;
+		std::vector<ContactPair> _pairs;
+	};
+}
+
+bool BenchmarkCollision(int numBodies, int numFrames, int numThreads, CollisionBenchmark* result)
+{
+	if( !result || numBodies <= 0 || numFrames <= 0 )
+		return false;
+
+	// wide and flat, with a few percent of the bodies touching at a time
+	const float WorldSize   = 1000.0f;
+	const float WorldHeight = 40.0f;
+	const float TimeStep    = 1.0f / 60.0f;
+
+	srand(1234);
+
+	CollisionWorld world;
+	std::vector<D3DXVECTOR3> velocity(numBodies);
+	std::vector<d3d::BoundingSphere> spheres;
+	std::vector<d3d::BoundingBox>    boxes;
+	std::vector<BoundingOBB>         obbs;
+
+	for(int i = 0; i < numBodies; i++)
+	{
+		D3DXVECTOR3 center(
+			Random(-WorldSize * 0.5f, WorldSize * 0.5f),
+			Random(0.0f, WorldHeight),
+			Random(-WorldSize * 0.5f, WorldSize * 0.5f));
+		velocity[i] = D3DXVECTOR3(Random(-10.0f, 10.0f), Random(-2.0f, 2.0f), Random(-10.0f, 10.0f));
+
+		switch( i % 3 )
+		{
+		case 0:
+			{
+				d3d::BoundingSphere sphere;
+				sphere._center = center;
+				sphere._radius = Random(0.5f, 1.5f);
+				world.addSphere(sphere);
+				spheres.push_back(sphere);
+			}
+			break;
+
+		case 1:
+			{
+				D3DXVECTOR3 half(Random(0.5f, 1.5f), Random(0.5f, 1.5f), Random(0.5f, 1.5f));
+				d3d::BoundingBox box;
+				box._min = center - half;
+				box._max = center + half;
+				world.addBox(box);
+				boxes.push_back(box);
+			}
+			break;
+
+		case 2:
+			{
+				D3DXVECTOR3 axis(Random(-1.0f, 1.0f), Random(-1.0f, 1.0f), Random(-1.0f, 1.0f));
+				if( D3DXVec3Length(&axis) < 0.01f )
+					axis = D3DXVECTOR3(0.0f, 1.0f, 0.0f);
+
+				D3DXMATRIX rotation;
+				D3DXMatrixRotationAxis(&rotation, &axis, Random(0.0f, 2.0f * D3DX_PI));
+
+				BoundingOBB obb;
+				obb._center  = center;
+				obb._extent  = D3DXVECTOR3(Random(0.5f, 1.5f), Random(0.5f, 1.5f), Random(0.5f, 1.5f));
+				obb._axis[0] = D3DXVECTOR3(rotation._11, rotation._12, rotation._13);
+				obb._axis[1] = D3DXVECTOR3(rotation._21, rotation._22, rotation._23);
+				obb._axis[2] = D3DXVECTOR3(rotation._31, rotation._32, rotation._33);
+				world.addOBB(obb);
+				obbs.push_back(obb);
+			}
+			break;
+		}
+	}
+
+	CollectContacts sink;
+	double collideMs = 0.0, sortMs = 0.0, sweepMs = 0.0;
+	double contacts = 0.0, candidates = 0.0, moves = 0.0;
+
+	for(int frame = 0; frame < numFrames; frame++)
+	{
+		//
+		// Move everything, bouncing off the walls.
+		//
+
+		for(int i = 0; i < numBodies; i++)
+		{
+			D3DXVECTOR3* center = 0;
+			switch( i % 3 )
+			{
+			case 0: center = &spheres[i / 3]._center; break;
+			case 1: center = 0; break;
+			case 2: center = &obbs[i / 3]._center; break;
+			}
+
+			D3DXVECTOR3 step = velocity[i] * TimeStep;
+			D3DXVECTOR3 position = center ? *center : (boxes[i / 3]._min + boxes[i / 3]._max) * 0.5f;
+			position += step;
+
+			if( fabsf(position.x) > WorldSize * 0.5f )         velocity[i].x = -velocity[i].x;
+			if( position.y < 0.0f || position.y > WorldHeight ) velocity[i].y = -velocity[i].y;
+			if( fabsf(position.z) > WorldSize * 0.5f )         velocity[i].z = -velocity[i].z;
+
+			switch( i % 3 )
+			{
+			case 0:
+				*center += step;
+				world.setSphere(i, spheres[i / 3]);
+				break;
+			case 1:
+				boxes[i / 3]._min += step;
+				boxes[i / 3]._max += step;
+				world.setBox(i, boxes[i / 3]);
+				break;
+			case 2:
+				*center += step;
+				world.setOBB(i, obbs[i / 3]);
+				break;
+			}
+		}
+
+		sink._keep = frame == numFrames - 1;
+
+		double start = Now();
+		world.collide(&sink, numThreads);
+		collideMs += Now() - start;
+
+		const CollisionStats& stats = world.getStats();
+		sortMs     += stats.sortMs;
+		sweepMs    += stats.sweepMs;
+		contacts   += stats.contacts;
+		candidates += stats.candidatePairs;
+		moves      += stats.sortMoves;
+	}
+
+	//
+	// Check the last frame against brute force for every 64th body.
+	//
+
+	const int SampleStep = 64;
+
+	std::vector< std::pair<int, int> > expected, reported;
+	for(int s = 0; s < numBodies; s += SampleStep)
+	{
+		for(int b = 0; b < numBodies; b++)
+		{
+			if( b != s && world.testPair(s, b) )
+				expected.push_back(std::make_pair(s, b));
+		}
+	}
+
+	for(int i = 0; i < (int)sink._pairs.size(); i++)
+	{
+		const ContactPair& p = sink._pairs[i];
+		if( p.a % SampleStep == 0 )
+			reported.push_back(std::make_pair(p.a, p.b));
+		if( p.b % SampleStep == 0 )
+			reported.push_back(std::make_pair(p.b, p.a));
+	}
+
+	std::sort(expected.begin(), expected.end());
+	std::sort(reported.begin(), reported.end());
+
+	result->numBodies      = numBodies;
+	result->numThreads     = world.getStats().numThreads;
+	result->collideMs      = (float)(collideMs / numFrames);
+	result->sortMs         = (float)(sortMs / numFrames);
+	result->sweepMs        = (float)(sweepMs / numFrames);
+	result->contacts       = (float)(contacts / numFrames);
+	result->candidatePairs = (float)(candidates / numFrames);
+	result->sortMoves      = (float)(moves / numFrames);
+	result->matches        = expected == reported;
+	return true;
+}
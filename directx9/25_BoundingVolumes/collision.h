@@ -0,0 +1,153 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: collision.h
+//
+// Desc: Collision detection between many moving bounding volumes.  The
+//       broadphase sorts the bodies' boxes along one axis and sweeps them;
+//       since bodies move little from frame to frame, the order is kept and
+//       repaired with an insertion sort instead of sorted from scratch.  The
+//       boxes overlapping along the sweep axis are checked against the
+//       other two four at a time with SSE, and the survivors go to the
+//       exact test for their pair of shapes.  Contacts are handed out in
+//       batches.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __collisionH__
+#define __collisionH__
+
+#include "d3dUtility.h"
+#include "bounds.h"
+#include <vector>
+
+//
+// Narrowphase tests.  Touching counts as intersecting.
+//
+
+bool Intersects(const d3d::BoundingSphere& a, const d3d::BoundingSphere& b);
+bool Intersects(const d3d::BoundingSphere& sphere, const d3d::BoundingBox& box);
+bool Intersects(const d3d::BoundingBox& a, const d3d::BoundingBox& b);
+bool Intersects(const d3d::BoundingSphere& sphere, const BoundingOBB& obb);
+
+// Separating axis test over the 15 candidate axes: the 3 + 3 face normals
+// and the 9 cross products of the edge directions.
+bool Intersects(const BoundingOBB& a, const BoundingOBB& b);
+
+// The axis-aligned box that contains the oriented one.
+void ComputeBoundingBox(const BoundingOBB& obb, d3d::BoundingBox* box);
+
+//
+// Broadphase and narrowphase together.
+//
+
+struct ContactPair
+{
+	int a, b;  // body indices, a < b
+};
+
+class ContactSink
+{
+public:
+	virtual ~ContactSink() {}
+
+	// Receives up to CollisionWorld::BatchSize contacts at a time, always on
+	// the thread that called collide().
+	virtual void onContacts(const ContactPair* pairs, int count) = 0;
+};
+
+struct CollisionStats
+{
+	CollisionStats();
+
+	int   bodies;
+	int   sweepAxis;
+	int   sortMoves;       // insertion sort shifts, small when the order held
+	int   candidatePairs;  // boxes overlapping, handed to the narrowphase
+	int   contacts;
+	int   numThreads;
+	float sortMs;          // bounds, sorting and the sweep arrays
+	float sweepMs;         // sweep and narrowphase
+};
+
+class CollisionWorld
+{
+public:
+	enum Shape { SHAPE_SPHERE, SHAPE_BOX, SHAPE_OBB };
+	enum { BatchSize = 256 };
+
+	CollisionWorld();
+
+	void clear();
+	int  size() const { return (int)_shape.size(); }
+
+	// Each returns the new body's index.
+	int addSphere(const d3d::BoundingSphere& sphere);
+	int addBox(const d3d::BoundingBox& box);
+	int addOBB(const BoundingOBB& obb);
+
+	// Moves a body.  The shape must be the one it was added with.
+	void setSphere(int body, const d3d::BoundingSphere& sphere);
+	void setBox(int body, const d3d::BoundingBox& box);
+	void setOBB(int body, const BoundingOBB& obb);
+
+	Shape getShape(int body) const { return (Shape)_shape[body]; }
+
+	// Finds every intersecting pair of bodies.  numThreads = 0 uses one
+	// thread per hardware thread.  With one thread the contacts stream out
+	// as they are found; with more, each thread collects its share and the
+	// batches are delivered once all are done.  Returns the contact count.
+	int collide(ContactSink* sink, int numThreads);
+
+	// Exact test between two bodies, for checking the broadphase.
+	bool testPair(int a, int b) const;
+
+	const CollisionStats& getStats() const { return _stats; }
+
+private:
+	std::vector<BYTE> _shape;
+	std::vector<int>  _slot;     // index into the array of the body's shape
+
+	std::vector<d3d::BoundingSphere> _spheres;
+	std::vector<d3d::BoundingBox>    _boxes;
+	std::vector<BoundingOBB>         _obbs;
+
+	std::vector<d3d::BoundingBox>    _bounds;  // per body
+
+	// Broadphase: bodies by the minimum along the sweep axis, kept from the
+	// last frame, and their boxes gathered in that order (structure of
+	// arrays, padded with four boxes that overlap nothing).
+	int                _axis;
+	std::vector<int>   _order;
+	std::vector<float> _key;
+	std::vector<float> _minS, _maxS;   // along the sweep axis
+	std::vector<float> _minU, _maxU;   // along the other two
+	std::vector<float> _minV, _maxV;
+
+	CollisionStats _stats;
+
+	int  addBody(BYTE shape, int slot, const d3d::BoundingBox& bounds);
+	void sortBodies();
+	void sweepRange(int begin, int end, std::vector<ContactPair>& out, ContactSink* sink, int* candidates) const;
+};
+
+//
+// Headless benchmark: numBodies spheres, boxes and oriented boxes moving
+// through a wide, flat world, the way objects spread over a level.
+//
+
+struct CollisionBenchmark
+{
+	int   numBodies;
+	int   numThreads;
+	float collideMs;       // average per frame, broadphase and narrowphase
+	float sortMs;
+	float sweepMs;
+	float contacts;        // average per frame
+	float candidatePairs;
+	float sortMoves;
+	bool  matches;         // against brute force for a sample of the bodies
+};
+
+bool BenchmarkCollision(int numBodies, int numFrames, int numThreads, CollisionBenchmark* result);
+
+#endif // __collisionH__
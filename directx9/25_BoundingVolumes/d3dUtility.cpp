@@ -11,6 +11,7 @@
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "d3dUtility.h"
+#include <cstring>
 
 bool d3d::InitD3D(
 	HINSTANCE hInstance,
@@ -166,6 +167,62 @@ int d3d::EnterMsgLoop( bool (*ptr_display)(float timeDelta) )
 	return msg.wParam;
 }
 
+// Skips to the next word, or quoted string, on a command line and returns
+// where it ends; length is 0 at the end of the line.
+static const char* NextWord(const char* p, const char** word, int* length)
+{
+	while( *p == ' ' || *p == '\t' )
+		p++;
+
+	if( *p == '"' )
+	{
+		*word = ++p;
+		while( *p && *p != '"' )
+			p++;
+		*length = (int)(p - *word);
+		return *p ? p + 1 : p;
+	}
+
+	*word = p;
+	while( *p && *p != ' ' && *p != '\t' )
+		p++;
+	*length = (int)(p - *word);
+	return p;
+}
+
+bool d3d::FindSwitch(const char* cmdLine, const char* name, char* value, int valueSize)
+{
+	if( !cmdLine || !name || (value && valueSize <= 0) )
+		return false;
+
+	int nameLength = (int)::strlen(name);
+
+	const char* p = cmdLine;
+	while( *p )
+	{
+		const char* word   = 0;
+		int         length = 0;
+		p = NextWord(p, &word, &length);
+
+		if( length != nameLength || ::strncmp(word, name, length) != 0 )
+			continue;
+
+		if( !value )
+			return true;
+
+		p = NextWord(p, &word, &length);
+		if( length == 0 )
+			return false;
+
+		if( length > valueSize - 1 )
+			length = valueSize - 1;
+		::memcpy(value, word, length);
+		value[length] = '\0';
+		return true;
+	}
+	return false;
+}
+
 D3DLIGHT9 d3d::InitDirectionalLight(D3DXVECTOR3* direction, D3DXCOLOR* color)
 {
 	D3DLIGHT9 light;
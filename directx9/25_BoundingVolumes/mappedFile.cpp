@@ -0,0 +1,121 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: mappedFile.cpp
+//
+// Desc: A read only view of a whole file.  See mappedFile.h.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "mappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+{
+#ifdef _WIN32
+	_file    = INVALID_HANDLE_VALUE;
+	_mapping = 0;
+#endif
+	_data    = 0;
+	_size    = 0;
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const char* fileName)
+{
+	close();
+
+	_file = ::CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, 0,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if( _file == INVALID_HANDLE_VALUE )
+		return false;
+
+	LARGE_INTEGER size;
+	if( !::GetFileSizeEx(_file, &size) || size.QuadPart == 0 )
+	{
+		close();
+		return false;
+	}
+
+	_mapping = ::CreateFileMapping(_file, 0, PAGE_READONLY, 0, 0, 0);
+	if( _mapping )
+		_data = (const char*)::MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+
+	if( !_data )
+	{
+		close();
+		return false;
+	}
+
+	_size = (size_t)size.QuadPart;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if( _data )
+		::UnmapViewOfFile(_data);
+	if( _mapping )
+		::CloseHandle(_mapping);
+	if( _file != INVALID_HANDLE_VALUE )
+		::CloseHandle(_file);
+
+	_file    = INVALID_HANDLE_VALUE;
+	_mapping = 0;
+	_data    = 0;
+	_size    = 0;
+}
+
+#else
+
+bool MappedFile::open(const char* fileName)
+{
+	close();
+
+	int file = ::open(fileName, O_RDONLY);
+	if( file < 0 )
+		return false;
+
+	struct stat info;
+	if( ::fstat(file, &info) != 0 || info.st_size == 0 )
+	{
+		::close(file);
+		return false;
+	}
+
+	// the mapping keeps the file open by itself
+	void* data = ::mmap(0, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	::close(file);
+	if( data == MAP_FAILED )
+		return false;
+
+	::madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+
+	_data = (const char*)data;
+	_size = (size_t)info.st_size;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if( _data )
+		::munmap((void*)_data, _size);
+
+	_data = 0;
+	_size = 0;
+}
+
+#endif
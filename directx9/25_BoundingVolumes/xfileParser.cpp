@@ -0,0 +1,1449 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: xfileParser.cpp
+//
+// Desc: Reads .x files without D3DX, in both the text and the binary
+//       format.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "xfileParser.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+// Before Visual C++ 2015 the std::chrono clocks tick only every millisecond
+// or so, too coarse for a parse timer.
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define XFILE_TIMER_QPC
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace
+{
+	// Text float arrays at least this long are converted on several threads,
+	// in chunks of ChunkFloats numbers.
+	const int ParallelMinFloats = 16384;
+	const int ChunkFloats       = 4096;
+
+	// binary format tokens
+	enum
+	{
+		TOKEN_NAME         = 1,
+		TOKEN_STRING       = 2,
+		TOKEN_INTEGER      = 3,
+		TOKEN_GUID         = 5,
+		TOKEN_INTEGER_LIST = 6,
+		TOKEN_FLOAT_LIST   = 7,
+		TOKEN_OBRACE       = 10,
+		TOKEN_CBRACE       = 11,
+		TOKEN_COMMA        = 19,
+		TOKEN_SEMICOLON    = 20,
+		TOKEN_TEMPLATE     = 31
+	};
+
+	double Now()
+	{
+#ifdef XFILE_TIMER_QPC
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+#else
+		return std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	// powers of ten a double holds exactly
+	const double PowersOfTen[] =
+	{
+		1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	bool IsDigit(char c)
+	{
+		return (unsigned)(c - '0') < 10;
+	}
+
+	// Converts the number at p and returns the first character after it, or
+	// p itself if there is no number there.  Up to 19 significant digits are
+	// gathered into an integer and scaled by one exact power of ten, which
+	// is as close as a float needs; exponents past that range go to strtod.
+	const char* ParseFloat(const char* p, const char* end, float* out)
+	{
+		const char* start = p;
+
+		bool negative = false;
+		if( p < end && (*p == '-' || *p == '+') )
+		{
+			negative = *p == '-';
+			p++;
+		}
+
+		unsigned long long mantissa = 0;
+		int  digits   = 0;   // significant digits in mantissa
+		int  exponent = 0;
+		bool any      = false;
+
+		for( ; p < end && IsDigit(*p); p++)
+		{
+			any = true;
+			if( digits < 19 )
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				if( mantissa != 0 )
+					digits++;
+			}
+			else
+				exponent++;
+		}
+
+		if( p < end && *p == '.' )
+		{
+			for(p++; p < end && IsDigit(*p); p++)
+			{
+				any = true;
+				if( digits < 19 )
+				{
+					mantissa = mantissa * 10 + (*p - '0');
+					if( mantissa != 0 )
+						digits++;
+					exponent--;
+				}
+			}
+		}
+
+		if( !any )
+			return start;
+
+		if( p < end && (*p == 'e' || *p == 'E') )
+		{
+			const char* q = p + 1;
+
+			bool negativeExponent = false;
+			if( q < end && (*q == '-' || *q == '+') )
+			{
+				negativeExponent = *q == '-';
+				q++;
+			}
+
+			if( q < end && IsDigit(*q) )
+			{
+				int e = 0;
+				for( ; q < end && IsDigit(*q); q++)
+					if( e < 10000 )
+						e = e * 10 + (*q - '0');
+
+				exponent += negativeExponent ? -e : e;
+				p = q;
+			}
+		}
+
+		double value = (double)mantissa;
+		if( mantissa != 0 && exponent != 0 )
+		{
+			if( exponent >= -22 && exponent <= 22 )
+			{
+				value = exponent < 0 ? value / PowersOfTen[-exponent] : value * PowersOfTen[exponent];
+			}
+			else
+			{
+				char text[64];
+				size_t length = (size_t)(p - start) < sizeof(text) - 1 ? (size_t)(p - start) : sizeof(text) - 1;
+				memcpy(text, start, length);
+				text[length] = 0;
+
+				*out = (float)strtod(text, 0);
+				return p;
+			}
+		}
+
+		*out = (float)(negative ? -value : value);
+		return p;
+	}
+
+	const char* ParseDword(const char* p, const char* end, unsigned* out)
+	{
+		const char* start = p;
+
+		bool negative = false;
+		if( p < end && *p == '-' )
+		{
+			negative = true;
+			p++;
+		}
+
+		if( p >= end || !IsDigit(*p) )
+			return start;
+
+		unsigned value = 0;
+		for( ; p < end && IsDigit(*p); p++)
+			value = value * 10 + (unsigned)(*p - '0');
+
+		*out = negative ? (unsigned)(0 - value) : value;
+		return p;
+	}
+
+	// Skips white space, comments and the ';' and ',' separators.
+	const char* SkipSpace(const char* p, const char* end)
+	{
+		while( p < end )
+		{
+			char c = *p;
+			if( c <= ' ' || c == ';' || c == ',' )
+				p++;
+			else if( c == '#' || (c == '/' && p + 1 < end && p[1] == '/') )
+			{
+				while( p < end && *p != '\n' )
+					p++;
+			}
+			else
+				break;
+		}
+		return p;
+	}
+
+	const char* SkipNumber(const char* p, const char* end)
+	{
+		while( p < end && (IsDigit(*p) || *p == '.' || *p == '-' || *p == '+' || *p == 'e' || *p == 'E') )
+			p++;
+		return p;
+	}
+
+	bool IsNameChar(char c)
+	{
+		return c > ' ' && c != '{' && c != '}' && c != ';' && c != ',' &&
+			c != '<' && c != '>' && c != '"';
+	}
+
+	unsigned short ReadWord(const char* p)
+	{
+		const unsigned char* b = (const unsigned char*)p;
+		return (unsigned short)(b[0] | (b[1] << 8));
+	}
+
+	unsigned ReadDword(const char* p)
+	{
+		const unsigned char* b = (const unsigned char*)p;
+		return (unsigned)b[0] | ((unsigned)b[1] << 8) | ((unsigned)b[2] << 16) | ((unsigned)b[3] << 24);
+	}
+
+	float ReadFloat32(const char* p)
+	{
+		float f;
+		memcpy(&f, p, sizeof(f));
+		return f;
+	}
+
+	float ReadFloat64(const char* p)
+	{
+		double d;
+		memcpy(&d, p, sizeof(d));
+		return (float)d;
+	}
+
+	// Converts count numbers starting at the chunk starts, ChunkFloats per
+	// chunk, for chunks [begin, end).
+	void ParseFloatChunks(
+		const std::vector<const char*>* starts, const char* bufferEnd,
+		float* out, int count, int begin, int end, bool* ok)
+	{
+		*ok = true;
+		for(int c = begin; c < end; c++)
+		{
+			const char* p = (*starts)[c];
+
+			int first = c * ChunkFloats;
+			int last  = first + ChunkFloats < count ? first + ChunkFloats : count;
+			for(int i = first; i < last; i++)
+			{
+				p = SkipSpace(p, bufferEnd);
+				const char* next = ParseFloat(p, bufferEnd, &out[i]);
+				if( next == p )
+				{
+					*ok = false;
+					return;
+				}
+				p = next;
+			}
+		}
+	}
+
+	//
+	// Walks the data objects of either format.  Only names and strings are
+	// copied; numbers are converted straight from the mapped bytes.
+	//
+
+	class Reader
+	{
+	public:
+		Reader(const char* begin, const char* end, bool binary, int floatBits, int numThreads);
+
+		bool failed() const { return _failed; }
+		const std::string& getError() const { return _error; }
+		size_t getRemaining() const { return (size_t)(_end - _p); }
+		int getFloatsRead() const { return _floatsRead; }
+		int getParallelArrays() const { return _parallelArrays; }
+
+		// Opens the next data object: its template name and, if it has one,
+		// its own name.  A reference to a named object, { name }, comes back
+		// with an empty type and is already closed.  Returns false at the
+		// '}' that closes the current object (and consumes it) or at the end
+		// of the file.
+		bool beginObject(std::string* type, std::string* name);
+
+		// Skips the rest of the object just opened, children and all.
+		bool skipObject();
+
+		// Skips any children left in the object just opened and closes it.
+		bool endObject();
+
+		bool readDword(unsigned* value);
+		bool readDwords(unsigned* values, int count);
+		bool readFloat(float* value);
+		bool readFloats(float* values, int count);
+		bool readString(std::string* value);
+
+		bool fail(const char* why);
+
+	private:
+		const char* _p;
+		const char* _end;
+		bool        _binary;
+		int         _floatBytes;
+		int         _numThreads;
+		int         _depth;
+
+		// the binary number list being read from
+		unsigned short _listToken;
+		unsigned       _listLeft;
+
+		int         _floatsRead;
+		int         _parallelArrays;
+
+		bool        _failed;
+		std::string _error;
+
+		bool atEnd();
+
+		// text
+		void readName(std::string* name);
+		bool readFloatsParallel(float* values, int count);
+
+		// binary
+		bool take(size_t bytes, const char** at);
+		bool nextToken(unsigned short* token);
+		bool readBinaryName(std::string* name);
+		bool skipPayload(unsigned short token);
+		bool nextListValue();
+	};
+
+	Reader::Reader(const char* begin, const char* end, bool binary, int floatBits, int numThreads)
+	{
+		_p              = begin;
+		_end            = end;
+		_binary         = binary;
+		_floatBytes     = floatBits / 8;
+		_numThreads     = numThreads;
+		_depth          = 0;
+		_listToken      = 0;
+		_listLeft       = 0;
+		_floatsRead     = 0;
+		_parallelArrays = 0;
+		_failed         = false;
+	}
+
+	bool Reader::fail(const char* why)
+	{
+		if( !_failed )
+		{
+			_failed = true;
+			_error  = why;
+		}
+		return false;
+	}
+
+	bool Reader::atEnd()
+	{
+		if( _depth > 0 )
+			fail("unexpected end of file");
+		return false;
+	}
+
+	//
+	// Text
+	//
+
+	void Reader::readName(std::string* name)
+	{
+		const char* start = _p;
+		while( _p < _end && IsNameChar(*_p) )
+			_p++;
+		name->assign(start, _p);
+	}
+
+	bool Reader::readFloatsParallel(float* values, int count)
+	{
+		// Find where each chunk starts; stepping over a number is far cheaper
+		// than converting it, so this pass is short.
+		int numChunks = (count + ChunkFloats - 1) / ChunkFloats;
+
+		std::vector<const char*> starts(numChunks);
+		const char* p = _p;
+		for(int i = 0; i < count; i++)
+		{
+			p = SkipSpace(p, _end);
+			if( p >= _end )
+				return fail("float array runs past the end of the file");
+
+			if( i % ChunkFloats == 0 )
+				starts[i / ChunkFloats] = p;
+
+			const char* next = SkipNumber(p, _end);
+			if( next == p )
+				return fail("expected a number");
+			p = next;
+		}
+		_p = p;
+
+		int numThreads = _numThreads < numChunks ? _numThreads : numChunks;
+
+		bool okay[64];
+		numThreads = numThreads < 64 ? numThreads : 64;
+
+		std::vector<std::thread> threads;
+		for(int t = 1; t < numThreads; t++)
+		{
+			int begin = (int)((long long)numChunks * t / numThreads);
+			int end   = (int)((long long)numChunks * (t + 1) / numThreads);
+			threads.push_back(std::thread(ParseFloatChunks, &starts, _end, values, count, begin, end, &okay[t]));
+		}
+		ParseFloatChunks(&starts, _end, values, count, 0, numChunks / numThreads, &okay[0]);
+
+		for(int t = 0; t < (int)threads.size(); t++)
+			threads[t].join();
+
+		for(int t = 0; t < numThreads; t++)
+			if( !okay[t] )
+				return fail("expected a number");
+
+		_parallelArrays++;
+		return true;
+	}
+
+	//
+	// Binary
+	//
+
+	bool Reader::take(size_t bytes, const char** at)
+	{
+		if( (size_t)(_end - _p) < bytes )
+			return fail("unexpected end of file");
+
+		*at = _p;
+		_p += bytes;
+		return true;
+	}
+
+	bool Reader::nextToken(unsigned short* token)
+	{
+		const char* at;
+		if( !take(2, &at) )
+			return false;
+
+		*token = ReadWord(at);
+		return true;
+	}
+
+	bool Reader::readBinaryName(std::string* name)
+	{
+		const char* at;
+		if( !take(4, &at) )
+			return false;
+
+		unsigned length = ReadDword(at);
+		if( !take(length, &at) )
+			return false;
+
+		name->assign(at, at + length);
+		return true;
+	}
+
+	bool Reader::skipPayload(unsigned short token)
+	{
+		const char* at;
+		switch( token )
+		{
+		case TOKEN_NAME:
+		case TOKEN_STRING:
+			{
+				if( !take(4, &at) || !take(ReadDword(at), &at) )
+					return false;
+				return token == TOKEN_STRING ? take(2, &at) : true;
+			}
+
+		case TOKEN_INTEGER:
+			return take(4, &at);
+
+		case TOKEN_GUID:
+			return take(16, &at);
+
+		case TOKEN_INTEGER_LIST:
+		case TOKEN_FLOAT_LIST:
+			{
+				if( !take(4, &at) )
+					return false;
+
+				size_t count = ReadDword(at);
+				size_t size  = token == TOKEN_INTEGER_LIST ? 4 : _floatBytes;
+				if( count > getRemaining() / size )
+					return fail("list runs past the end of the file");
+
+				return take(count * size, &at);
+			}
+		}
+		return true;
+	}
+
+	// Makes sure _p is at a number in a list, reading list headers as needed.
+	bool Reader::nextListValue()
+	{
+		while( _listLeft == 0 )
+		{
+			unsigned short token;
+			if( !nextToken(&token) )
+				return false;
+
+			if( token == TOKEN_COMMA || token == TOKEN_SEMICOLON )
+				continue;
+
+			if( token == TOKEN_INTEGER )
+			{
+				_listToken = TOKEN_INTEGER_LIST;
+				_listLeft  = 1;
+			}
+			else if( token == TOKEN_INTEGER_LIST || token == TOKEN_FLOAT_LIST )
+			{
+				const char* at;
+				if( !take(4, &at) )
+					return false;
+
+				_listToken = token;
+				_listLeft  = ReadDword(at);
+
+				size_t size = token == TOKEN_INTEGER_LIST ? 4 : _floatBytes;
+				if( _listLeft > getRemaining() / size )
+					return fail("list runs past the end of the file");
+			}
+			else
+				return fail("expected a number");
+		}
+		return true;
+	}
+
+	//
+	// Both
+	//
+
+	bool Reader::beginObject(std::string* type, std::string* name)
+	{
+		name->clear();
+		type->clear();
+
+		if( _failed )
+			return false;
+
+		if( !_binary )
+		{
+			_p = SkipSpace(_p, _end);
+			if( _p >= _end )
+				return atEnd();
+
+			if( *_p == '}' )
+			{
+				_p++;
+				_depth--;
+				return false;
+			}
+
+			if( *_p == '{' )
+			{
+				_p = SkipSpace(_p + 1, _end);
+				readName(name);
+				_p = SkipSpace(_p, _end);
+				if( _p < _end && *_p == '<' )
+				{
+					while( _p < _end && *_p != '>' )
+						_p++;
+					_p = SkipSpace(_p + 1, _end);
+				}
+				if( _p >= _end || *_p != '}' )
+					return fail("expected '}' after a reference");
+
+				_p++;
+				return true;
+			}
+
+			readName(type);
+			if( type->empty() )
+				return fail("expected a template name");
+
+			_p = SkipSpace(_p, _end);
+			if( _p < _end && *_p != '{' && *_p != '<' )
+			{
+				readName(name);
+				_p = SkipSpace(_p, _end);
+			}
+			if( _p < _end && *_p == '<' )
+			{
+				while( _p < _end && *_p != '>' )
+					_p++;
+				_p = SkipSpace(_p + 1, _end);
+			}
+			if( _p >= _end || *_p != '{' )
+				return fail("expected '{'");
+
+			_p++;
+			_depth++;
+			return true;
+		}
+
+		_listLeft = 0;
+
+		for(;;)
+		{
+			if( _p >= _end )
+				return atEnd();
+
+			unsigned short token;
+			if( !nextToken(&token) )
+				return false;
+
+			switch( token )
+			{
+			case TOKEN_COMMA:
+			case TOKEN_SEMICOLON:
+				continue;
+
+			case TOKEN_CBRACE:
+				_depth--;
+				return false;
+
+			case TOKEN_OBRACE:
+				{
+					if( !nextToken(&token) || token != TOKEN_NAME )
+						return fail("expected a name in a reference");
+					if( !readBinaryName(name) || !nextToken(&token) )
+						return false;
+
+					if( token == TOKEN_GUID )
+					{
+						if( !skipPayload(token) || !nextToken(&token) )
+							return false;
+					}
+					if( token != TOKEN_CBRACE )
+						return fail("expected '}' after a reference");
+
+					return true;
+				}
+
+			case TOKEN_TEMPLATE:
+			case TOKEN_NAME:
+				{
+					if( token == TOKEN_TEMPLATE )
+					{
+						*type = "template";
+						if( !nextToken(&token) || token != TOKEN_NAME )
+							return fail("expected a template name");
+						if( !readBinaryName(name) || !nextToken(&token) )
+							return false;
+					}
+					else
+					{
+						if( !readBinaryName(type) || !nextToken(&token) )
+							return false;
+
+						if( token == TOKEN_NAME )
+						{
+							if( !readBinaryName(name) || !nextToken(&token) )
+								return false;
+						}
+						if( token == TOKEN_GUID )
+						{
+							if( !skipPayload(token) || !nextToken(&token) )
+								return false;
+						}
+					}
+
+					if( token != TOKEN_OBRACE )
+						return fail("expected '{'");
+
+					_depth++;
+					return true;
+				}
+
+			default:
+				return fail("unexpected token");
+			}
+		}
+	}
+
+	bool Reader::skipObject()
+	{
+		int depth = 1;
+
+		if( !_binary )
+		{
+			while( _p < _end )
+			{
+				char c = *_p++;
+				if( c == '{' )
+					depth++;
+				else if( c == '}' )
+				{
+					if( --depth == 0 )
+					{
+						_depth--;
+						return true;
+					}
+				}
+				else if( c == '"' )
+				{
+					while( _p < _end && *_p != '"' )
+						_p++;
+					if( _p < _end )
+						_p++;
+				}
+				else if( c == '#' || (c == '/' && _p < _end && *_p == '/') )
+				{
+					while( _p < _end && *_p != '\n' )
+						_p++;
+				}
+			}
+			return fail("unexpected end of file");
+		}
+
+		_listLeft = 0;
+
+		while( depth > 0 )
+		{
+			unsigned short token;
+			if( !nextToken(&token) )
+				return false;
+
+			if( token == TOKEN_OBRACE )
+				depth++;
+			else if( token == TOKEN_CBRACE )
+				depth--;
+			else if( !skipPayload(token) )
+				return false;
+		}
+
+		_depth--;
+		return true;
+	}
+
+	bool Reader::endObject()
+	{
+		std::string type, name;
+		while( beginObject(&type, &name) )
+		{
+			if( !type.empty() && !skipObject() )
+				return false;
+		}
+		return !_failed;
+	}
+
+	bool Reader::readDword(unsigned* value)
+	{
+		if( _failed )
+			return false;
+
+		if( !_binary )
+		{
+			_p = SkipSpace(_p, _end);
+			const char* next = ParseDword(_p, _end, value);
+			if( next == _p )
+				return fail("expected an integer");
+
+			_p = next;
+			return true;
+		}
+
+		if( !nextListValue() )
+			return false;
+
+		if( _listToken == TOKEN_INTEGER_LIST )
+		{
+			*value = ReadDword(_p);
+			_p += 4;
+		}
+		else
+		{
+			*value = (unsigned)(_floatBytes == 4 ? ReadFloat32(_p) : ReadFloat64(_p));
+			_p += _floatBytes;
+		}
+		_listLeft--;
+		return true;
+	}
+
+	bool Reader::readDwords(unsigned* values, int count)
+	{
+		for(int i = 0; i < count; i++)
+			if( !readDword(&values[i]) )
+				return false;
+		return true;
+	}
+
+	bool Reader::readFloat(float* value)
+	{
+		if( _failed )
+			return false;
+
+		if( !_binary )
+		{
+			_p = SkipSpace(_p, _end);
+			const char* next = ParseFloat(_p, _end, value);
+			if( next == _p )
+				return fail("expected a number");
+
+			_p = next;
+			return true;
+		}
+
+		if( !nextListValue() )
+			return false;
+
+		if( _listToken == TOKEN_FLOAT_LIST )
+		{
+			*value = _floatBytes == 4 ? ReadFloat32(_p) : ReadFloat64(_p);
+			_p += _floatBytes;
+		}
+		else
+		{
+			*value = (float)ReadDword(_p);
+			_p += 4;
+		}
+		_listLeft--;
+		return true;
+	}
+
+	bool Reader::readFloats(float* values, int count)
+	{
+		_floatsRead += count;
+
+		if( !_binary )
+		{
+			if( count >= ParallelMinFloats && _numThreads > 1 )
+				return readFloatsParallel(values, count);
+
+			for(int i = 0; i < count; i++)
+				if( !readFloat(&values[i]) )
+					return false;
+			return true;
+		}
+
+		// Binary float lists are copied a run at a time.
+		int i = 0;
+		while( i < count )
+		{
+			if( !nextListValue() )
+				return false;
+
+			if( _listToken == TOKEN_FLOAT_LIST && _floatBytes == 4 )
+			{
+				int run = (int)_listLeft < count - i ? (int)_listLeft : count - i;
+				memcpy(&values[i], _p, run * sizeof(float));
+				_p        += run * sizeof(float);
+				_listLeft -= run;
+				i         += run;
+			}
+			else if( !readFloat(&values[i++]) )
+				return false;
+		}
+		return true;
+	}
+
+	bool Reader::readString(std::string* value)
+	{
+		if( _failed )
+			return false;
+
+		if( !_binary )
+		{
+			_p = SkipSpace(_p, _end);
+			if( _p >= _end || *_p != '"' )
+				return fail("expected a string");
+
+			const char* start = ++_p;
+			while( _p < _end && *_p != '"' )
+				_p++;
+			if( _p >= _end )
+				return fail("unterminated string");
+
+			value->assign(start, _p++);
+			return true;
+		}
+
+		_listLeft = 0;
+
+		unsigned short token;
+		do
+		{
+			if( !nextToken(&token) )
+				return false;
+		}
+		while( token == TOKEN_COMMA || token == TOKEN_SEMICOLON );
+
+		if( token != TOKEN_STRING )
+			return fail("expected a string");
+
+		const char* at;
+		if( !readBinaryName(value) || !take(2, &at) )
+			return false;
+
+		return true;
+	}
+
+	//
+	// Templates
+	//
+
+	class Parser
+	{
+	public:
+		Parser(Reader& reader, XFileScene* scene) : _reader(reader), _scene(scene) {}
+
+		bool parse();
+
+	private:
+		Reader&     _reader;
+		XFileScene* _scene;
+
+		// materials declared at the top level, for references
+		std::vector<XFileMaterial> _namedMaterials;
+
+		bool parseFrame(const std::string& name, int parent);
+		bool parseMesh(const std::string& name, int frame);
+		bool parseFaces(int numVertices, std::vector<unsigned>* indices, std::vector<int>* polygonStarts);
+		bool parseNormals(XFileMesh& mesh, const std::vector<int>& polygonStarts);
+		bool parseTexCoords(XFileMesh& mesh);
+		bool parseMaterialList(XFileMesh& mesh, const std::vector<int>& polygonStarts);
+		bool parseMaterial(XFileMaterial* material);
+		bool parseSkinWeights(XFileMesh& mesh);
+		bool parseDuplicationIndices(XFileMesh& mesh);
+	};
+
+	bool Parser::parse()
+	{
+		std::string type, name;
+		while( _reader.beginObject(&type, &name) )
+		{
+			bool ok;
+			if( type == "Frame" )
+				ok = parseFrame(name, -1);
+			else if( type == "Mesh" )
+				ok = parseMesh(name, -1);
+			else if( type == "Material" )
+			{
+				XFileMaterial material;
+				ok = parseMaterial(&material);
+				material.name = name;
+				_namedMaterials.push_back(material);
+			}
+			else if( !type.empty() )
+				ok = _reader.skipObject();
+			else
+				ok = true;
+
+			if( !ok )
+				return false;
+		}
+		return !_reader.failed();
+	}
+
+	bool Parser::parseFrame(const std::string& name, int parent)
+	{
+		int index = (int)_scene->frames.size();
+
+		_scene->frames.push_back(XFileFrame());
+		_scene->frames[index].name   = name;
+		_scene->frames[index].parent = parent;
+		XFileMatrix& transform = _scene->frames[index].transform;
+		memset(&transform, 0, sizeof(transform));
+		transform.m[0][0] = transform.m[1][1] = transform.m[2][2] = transform.m[3][3] = 1.0f;
+
+		std::string type, childName;
+		while( _reader.beginObject(&type, &childName) )
+		{
+			bool ok;
+			if( type == "FrameTransformMatrix" )
+				ok = _reader.readFloats((float*)&_scene->frames[index].transform, 16) && _reader.endObject();
+			else if( type == "Frame" )
+				ok = parseFrame(childName, index);
+			else if( type == "Mesh" )
+				ok = parseMesh(childName, index);
+			else if( !type.empty() )
+				ok = _reader.skipObject();
+			else
+				ok = true;
+
+			if( !ok )
+				return false;
+		}
+		return !_reader.failed();
+	}
+
+	// Reads a face count and that many polygons, splitting each into a fan
+	// of triangles.  polygonStarts gets each polygon's first triangle, plus
+	// one past the last.
+	bool Parser::parseFaces(int numVertices, std::vector<unsigned>* indices, std::vector<int>* polygonStarts)
+	{
+		unsigned numFaces;
+		if( !_reader.readDword(&numFaces) )
+			return false;
+		if( numFaces > _reader.getRemaining() / 2 )
+			return _reader.fail("face count larger than the file");
+
+		indices->clear();
+		indices->reserve(numFaces * 3);
+
+		if( polygonStarts )
+		{
+			polygonStarts->resize(numFaces + 1);
+			(*polygonStarts)[0] = 0;
+		}
+
+		for(unsigned f = 0; f < numFaces; f++)
+		{
+			unsigned corners;
+			if( !_reader.readDword(&corners) )
+				return false;
+
+			unsigned first = 0, previous = 0;
+			for(unsigned k = 0; k < corners; k++)
+			{
+				unsigned index;
+				if( !_reader.readDword(&index) )
+					return false;
+				if( index >= (unsigned)numVertices )
+					return _reader.fail("face index out of range");
+
+				if( k == 0 )
+					first = index;
+				else if( k >= 2 )
+				{
+					indices->push_back(first);
+					indices->push_back(previous);
+					indices->push_back(index);
+				}
+				previous = index;
+			}
+
+			if( polygonStarts )
+				(*polygonStarts)[f + 1] = (int)indices->size() / 3;
+		}
+		return true;
+	}
+
+	bool Parser::parseMesh(const std::string& name, int frame)
+	{
+		int index = (int)_scene->meshes.size();
+		if( frame >= 0 )
+			_scene->frames[frame].meshes.push_back(index);
+
+		_scene->meshes.push_back(XFileMesh());
+		XFileMesh& mesh = _scene->meshes[index];
+		mesh.name  = name;
+		mesh.frame = frame;
+
+		unsigned numVertices;
+		if( !_reader.readDword(&numVertices) )
+			return false;
+		if( numVertices > _reader.getRemaining() / 3 )
+			return _reader.fail("vertex count larger than the file");
+
+		mesh.positions.resize(numVertices);
+		if( numVertices > 0 && !_reader.readFloats((float*)&mesh.positions[0], numVertices * 3) )
+			return false;
+
+		std::vector<int> polygonStarts;
+		if( !parseFaces(numVertices, &mesh.indices, &polygonStarts) )
+			return false;
+
+		std::string type, childName;
+		while( _reader.beginObject(&type, &childName) )
+		{
+			bool ok;
+			if( type == "MeshNormals" )
+				ok = parseNormals(mesh, polygonStarts);
+			else if( type == "MeshTextureCoords" )
+				ok = parseTexCoords(mesh);
+			else if( type == "MeshMaterialList" )
+				ok = parseMaterialList(mesh, polygonStarts);
+			else if( type == "XSkinMeshHeader" )
+			{
+				unsigned values[3];
+				ok = _reader.readDwords(values, 3) && _reader.endObject();
+				mesh.hasSkinHeader           = true;
+				mesh.maxSkinWeightsPerVertex = (unsigned short)values[0];
+				mesh.maxSkinWeightsPerFace   = (unsigned short)values[1];
+				mesh.numBones                = (unsigned short)values[2];
+			}
+			else if( type == "SkinWeights" )
+				ok = parseSkinWeights(mesh);
+			else if( type == "VertexDuplicationIndices" )
+				ok = parseDuplicationIndices(mesh);
+			else if( !type.empty() )
+				ok = _reader.skipObject();
+			else
+				ok = true;
+
+			if( !ok )
+				return false;
+		}
+
+		if( mesh.attributes.empty() )
+			mesh.attributes.resize(mesh.getNumTriangles(), 0);
+
+		return !_reader.failed();
+	}
+
+	bool Parser::parseNormals(XFileMesh& mesh, const std::vector<int>& polygonStarts)
+	{
+		unsigned numNormals;
+		if( !_reader.readDword(&numNormals) )
+			return false;
+		if( numNormals > _reader.getRemaining() / 3 )
+			return _reader.fail("normal count larger than the file");
+
+		mesh.normals.resize(numNormals);
+		if( numNormals > 0 && !_reader.readFloats((float*)&mesh.normals[0], numNormals * 3) )
+			return false;
+
+		std::vector<int> normalStarts;
+		if( !parseFaces(numNormals, &mesh.normalIndices, &normalStarts) )
+			return false;
+
+		if( normalStarts != polygonStarts )
+			return _reader.fail("MeshNormals faces do not match the mesh");
+
+		return _reader.endObject();
+	}
+
+	bool Parser::parseTexCoords(XFileMesh& mesh)
+	{
+		unsigned numCoords;
+		if( !_reader.readDword(&numCoords) )
+			return false;
+		if( numCoords != mesh.positions.size() )
+			return _reader.fail("MeshTextureCoords count does not match the vertices");
+
+		mesh.texCoords.resize(numCoords);
+		if( numCoords > 0 && !_reader.readFloats((float*)&mesh.texCoords[0], numCoords * 2) )
+			return false;
+
+		return _reader.endObject();
+	}
+
+	bool Parser::parseMaterialList(XFileMesh& mesh, const std::vector<int>& polygonStarts)
+	{
+		unsigned numMaterials, numFaceIndices;
+		if( !_reader.readDword(&numMaterials) || !_reader.readDword(&numFaceIndices) )
+			return false;
+		if( numFaceIndices > _reader.getRemaining() )
+			return _reader.fail("material face count larger than the file");
+
+		// Exporters may list fewer faces than the mesh has; the last one
+		// listed carries on.
+		int numPolygons = (int)polygonStarts.size() - 1;
+
+		mesh.attributes.assign(mesh.getNumTriangles(), 0);
+		unsigned attribute = 0;
+		for(unsigned f = 0; f < numFaceIndices; f++)
+		{
+			if( !_reader.readDword(&attribute) )
+				return false;
+			if( attribute >= numMaterials )
+				return _reader.fail("material index out of range");
+
+			if( (int)f < numPolygons )
+				for(int t = polygonStarts[f]; t < polygonStarts[f + 1]; t++)
+					mesh.attributes[t] = attribute;
+		}
+		for(int f = (int)numFaceIndices; f < numPolygons; f++)
+			for(int t = polygonStarts[f]; t < polygonStarts[f + 1]; t++)
+				mesh.attributes[t] = attribute;
+
+		std::string type, name;
+		while( _reader.beginObject(&type, &name) )
+		{
+			if( type == "Material" )
+			{
+				mesh.materials.push_back(XFileMaterial());
+				if( !parseMaterial(&mesh.materials.back()) )
+					return false;
+			}
+			else if( type.empty() )
+			{
+				int found = -1;
+				for(int i = 0; i < (int)_namedMaterials.size() && found < 0; i++)
+					if( _namedMaterials[i].name == name )
+						found = i;
+
+				if( found < 0 )
+					return _reader.fail("reference to an unknown material");
+
+				mesh.materials.push_back(_namedMaterials[found]);
+			}
+			else if( !_reader.skipObject() )
+				return false;
+		}
+		return !_reader.failed();
+	}
+
+	bool Parser::parseMaterial(XFileMaterial* material)
+	{
+		// faceColor (RGBA), power, specularColor (RGB), emissiveColor (RGB)
+		float values[11];
+		if( !_reader.readFloats(values, 11) )
+			return false;
+
+		material->diffuse.r  = values[0];
+		material->diffuse.g  = values[1];
+		material->diffuse.b  = values[2];
+		material->diffuse.a  = values[3];
+		material->power      = values[4];
+		material->specular.r = values[5];
+		material->specular.g = values[6];
+		material->specular.b = values[7];
+		material->specular.a = 1.0f;
+		material->emissive.r = values[8];
+		material->emissive.g = values[9];
+		material->emissive.b = values[10];
+		material->emissive.a = 1.0f;
+
+		std::string type, name;
+		while( _reader.beginObject(&type, &name) )
+		{
+			if( type == "TextureFilename" || type == "TextureFileName" )
+			{
+				if( !_reader.readString(&material->textureFilename) || !_reader.endObject() )
+					return false;
+			}
+			else if( !type.empty() && !_reader.skipObject() )
+				return false;
+		}
+		return !_reader.failed();
+	}
+
+	bool Parser::parseSkinWeights(XFileMesh& mesh)
+	{
+		mesh.skinWeights.push_back(XFileSkinWeights());
+		XFileSkinWeights& skin = mesh.skinWeights.back();
+
+		unsigned numWeights;
+		if( !_reader.readString(&skin.transformNodeName) || !_reader.readDword(&numWeights) )
+			return false;
+		if( numWeights > _reader.getRemaining() / 2 )
+			return _reader.fail("weight count larger than the file");
+
+		skin.vertexIndices.resize(numWeights);
+		skin.weights.resize(numWeights);
+		if( numWeights > 0 )
+		{
+			if( !_reader.readDwords(&skin.vertexIndices[0], numWeights) ||
+				!_reader.readFloats(&skin.weights[0], numWeights) )
+				return false;
+		}
+
+		for(unsigned i = 0; i < numWeights; i++)
+			if( skin.vertexIndices[i] >= mesh.positions.size() )
+				return _reader.fail("skin weight vertex out of range");
+
+		return _reader.readFloats((float*)&skin.matrixOffset, 16) && _reader.endObject();
+	}
+
+	bool Parser::parseDuplicationIndices(XFileMesh& mesh)
+	{
+		unsigned numIndices;
+		if( !_reader.readDword(&numIndices) || !_reader.readDword(&mesh.numOriginalVertices) )
+			return false;
+		if( numIndices > _reader.getRemaining() / 2 )
+			return _reader.fail("index count larger than the file");
+
+		mesh.duplicationIndices.resize(numIndices);
+		if( numIndices > 0 && !_reader.readDwords(&mesh.duplicationIndices[0], numIndices) )
+			return false;
+
+		return _reader.endObject();
+	}
+}
+
+XFileMaterial::XFileMaterial()
+{
+	XFileColor black = { 0.0f, 0.0f, 0.0f, 1.0f };
+	diffuse  = black;
+	power    = 0.0f;
+	specular = black;
+	emissive = black;
+}
+
+XFileMesh::XFileMesh()
+{
+	frame                   = -1;
+	hasSkinHeader           = false;
+	maxSkinWeightsPerVertex = 0;
+	maxSkinWeightsPerFace   = 0;
+	numBones                = 0;
+	numOriginalVertices     = 0;
+}
+
+void XFileScene::clear()
+{
+	frames.clear();
+	meshes.clear();
+}
+
+XFileParseStats::XFileParseStats()
+{
+	binary         = false;
+	floatBits      = 0;
+	numThreads     = 0;
+	bytes          = 0;
+	frames         = 0;
+	meshes         = 0;
+	vertices       = 0;
+	triangles      = 0;
+	floats         = 0;
+	parallelArrays = 0;
+	parseMs        = 0.0f;
+}
+
+//
+// Parsing
+//
+
+bool ParseXFile(const char* data, size_t size, XFileScene* scene, int numThreads, XFileParseStats* stats)
+{
+	double start = Now();
+
+	XFileParseStats local;
+	if( !stats )
+		stats = &local;
+	*stats = XFileParseStats();
+	stats->bytes = size;
+
+	scene->clear();
+
+	// "xof 0303txt 0032": magic, version, format, float size
+	if( size < 16 || memcmp(data, "xof ", 4) != 0 )
+	{
+		stats->error = "not an .x file";
+		return false;
+	}
+
+	bool binary;
+	if( memcmp(data + 8, "txt ", 4) == 0 )
+		binary = false;
+	else if( memcmp(data + 8, "bin ", 4) == 0 )
+		binary = true;
+	else
+	{
+		stats->error = "compressed .x files are not supported";
+		return false;
+	}
+
+	int floatBits;
+	if( memcmp(data + 12, "0032", 4) == 0 )
+		floatBits = 32;
+	else if( memcmp(data + 12, "0064", 4) == 0 )
+		floatBits = 64;
+	else
+	{
+		stats->error = "unknown float size";
+		return false;
+	}
+
+	if( numThreads <= 0 )
+		numThreads = (int)std::thread::hardware_concurrency();
+	if( numThreads <= 0 )
+		numThreads = 1;
+
+	Reader reader(data + 16, data + size, binary, floatBits, numThreads);
+	Parser parser(reader, scene);
+	bool ok = parser.parse();
+
+	stats->binary         = binary;
+	stats->floatBits      = floatBits;
+	stats->numThreads     = numThreads;
+	stats->frames         = (int)scene->frames.size();
+	stats->meshes         = (int)scene->meshes.size();
+	stats->floats         = reader.getFloatsRead();
+	stats->parallelArrays = reader.getParallelArrays();
+	for(int i = 0; i < (int)scene->meshes.size(); i++)
+	{
+		stats->vertices  += (int)scene->meshes[i].positions.size();
+		stats->triangles += scene->meshes[i].getNumTriangles();
+	}
+
+	if( !ok )
+	{
+		stats->error = reader.getError();
+		scene->clear();
+	}
+
+	stats->parseMs = (float)(Now() - start);
+	return ok;
+}
+
+bool LoadXFile(const char* fileName, XFileScene* scene, int numThreads, XFileParseStats* stats)
+{
+	MappedFile file;
+	if( !file.open(fileName) )
+	{
+		if( stats )
+		{
+			*stats = XFileParseStats();
+			stats->error = "could not open the file";
+		}
+		return false;
+	}
+
+	return ParseXFile(file.getData(), file.getSize(), scene, numThreads, stats);
+}
+
+bool BenchmarkXFileParse(const char* fileName, int numPasses, int numThreads, XFileBenchmark* result)
+{
+	MappedFile file;
+	if( !file.open(fileName) )
+		return false;
+
+	XFileScene      scene;
+	XFileParseStats stats;
+
+	float best = 0.0f;
+	for(int pass = 0; pass < numPasses; pass++)
+	{
+		if( !ParseXFile(file.getData(), file.getSize(), &scene, numThreads, &stats) )
+			return false;
+
+		if( pass == 0 || stats.parseMs < best )
+			best = stats.parseMs;
+	}
+
+	result->bytes              = file.getSize();
+	result->numThreads         = stats.numThreads;
+	result->meshes             = stats.meshes;
+	result->vertices           = stats.vertices;
+	result->triangles          = stats.triangles;
+	result->parseMs            = best;
+	result->megabytesPerSecond = best > 0.0f ? (float)(file.getSize() / (1024.0 * 1024.0) / (best / 1000.0)) : 0.0f;
+
+	return true;
+}
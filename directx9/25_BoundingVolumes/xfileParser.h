@@ -0,0 +1,148 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: xfileParser.h
+//
+// Desc: Reads .x files without D3DX, in both the text and the binary
+//       format.  The file is mapped into memory and tokenized in place;
+//       only names and strings are copied out.  Long float arrays in text
+//       files (vertices, normals, texture coordinates) are converted by a
+//       hand written parser, split into chunks over several threads.
+//
+//       Understands Frame, FrameTransformMatrix, Mesh, MeshNormals,
+//       MeshTextureCoords, MeshMaterialList, Material, TextureFilename and
+//       the skinning templates (XSkinMeshHeader, SkinWeights,
+//       VertexDuplicationIndices); anything else is skipped.
+//
+//       Needs neither Direct3D nor windows.h: the results use the plain
+//       types below, laid out like D3DXVECTOR2, D3DXVECTOR3, D3DCOLORVALUE
+//       and D3DXMATRIX, so the tools can read .x files on any platform.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __xfileParserH__
+#define __xfileParserH__
+
+#include "mappedFile.h"
+#include <string>
+#include <vector>
+
+struct XFileVector2 { float x, y; };
+struct XFileVector3 { float x, y, z; };
+struct XFileColor   { float r, g, b, a; };
+struct XFileMatrix  { float m[4][4]; };   // row vectors, as D3DXMATRIX
+
+struct XFileMaterial
+{
+	XFileMaterial();
+
+	std::string name;              // empty unless defined at the top level
+	XFileColor  diffuse;           // no ambient in the file; D3DX leaves it black
+	float       power;
+	XFileColor  specular;          // alpha 1, the file has none
+	XFileColor  emissive;          // alpha 1
+	std::string textureFilename;
+};
+
+struct XFileSkinWeights
+{
+	std::string           transformNodeName;
+	std::vector<unsigned> vertexIndices;
+	std::vector<float>    weights;
+	XFileMatrix           matrixOffset;
+};
+
+struct XFileMesh
+{
+	XFileMesh();
+
+	std::string name;
+	int         frame;   // the frame it was declared in, -1 at the top level
+
+	std::vector<XFileVector3> positions;
+
+	// Polygons are split into fans of triangles, three indices each.
+	// normalIndices and attributes follow the triangles.
+	std::vector<unsigned> indices;
+	std::vector<unsigned> attributes;
+
+	std::vector<XFileVector3> normals;
+	std::vector<unsigned>     normalIndices;
+
+	std::vector<XFileVector2> texCoords;   // one per position
+
+	std::vector<XFileMaterial> materials;
+
+	// skinning
+	bool           hasSkinHeader;
+	unsigned short maxSkinWeightsPerVertex;
+	unsigned short maxSkinWeightsPerFace;
+	unsigned short numBones;
+	std::vector<XFileSkinWeights> skinWeights;
+
+	unsigned              numOriginalVertices;
+	std::vector<unsigned> duplicationIndices;
+
+	int getNumTriangles() const { return (int)indices.size() / 3; }
+};
+
+struct XFileFrame
+{
+	std::string      name;
+	int              parent;      // -1 for a root
+	XFileMatrix      transform;   // relative to the parent
+	std::vector<int> meshes;
+};
+
+struct XFileScene
+{
+	std::vector<XFileFrame> frames;
+	std::vector<XFileMesh>  meshes;
+
+	void clear();
+};
+
+struct XFileParseStats
+{
+	XFileParseStats();
+
+	bool        binary;
+	int         floatBits;   // 32 or 64, from the header
+	int         numThreads;
+	size_t      bytes;
+	int         frames;
+	int         meshes;
+	int         vertices;
+	int         triangles;
+	int         floats;      // numbers read into float arrays
+	int         parallelArrays;
+	float       parseMs;
+	std::string error;       // why the parse failed
+};
+
+// Parses size bytes of .x data into scene.  numThreads = 0 uses one thread
+// per hardware thread for the long float arrays.  Returns false, with the
+// reason in stats->error, on a malformed or compressed file.
+bool ParseXFile(const char* data, size_t size, XFileScene* scene, int numThreads, XFileParseStats* stats);
+
+// Maps fileName and parses it.
+bool LoadXFile(const char* fileName, XFileScene* scene, int numThreads, XFileParseStats* stats);
+
+//
+// Headless benchmark: the best of numPasses parses of an already mapped
+// file, so the disk is not timed.
+//
+
+struct XFileBenchmark
+{
+	size_t bytes;
+	int    numThreads;
+	int    meshes;
+	int    vertices;
+	int    triangles;
+	float  parseMs;
+	float  megabytesPerSecond;
+};
+
+bool BenchmarkXFileParse(const char* fileName, int numPasses, int numThreads, XFileBenchmark* result);
+
+#endif // __xfileParserH__
@@ -6,30 +6,79 @@
 //
 // System: AMD Athlon 1800+ XP, 512 DDR, Geforce 3, Windows XP, MSVC++ 7.0 
 //
-// Desc: Defines a camera's position and orientation.
+// Desc: Defines a camera's position, orientation and projection.
 //         
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "camera.h"
+#include <cmath>
+#include <vector>
+#include <xmmintrin.h>
 
-Camera::Camera()
+namespace
 {
-	_cameraType = AIRCRAFT;
+	// The rows of the quaternion's rotation matrix: where it takes the x, y
+	// and z axes.  The same terms as D3DXMatrixRotationQuaternion.
+	void AxesFromQuaternion(const D3DXQUATERNION& q, D3DXVECTOR3* right, D3DXVECTOR3* up, D3DXVECTOR3* look)
+	{
+		float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+		float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+		float xw = q.x * q.w, yw = q.y * q.w, zw = q.z * q.w;
+
+		*right = D3DXVECTOR3(1.0f - 2.0f * (yy + zz), 2.0f * (xy + zw),        2.0f * (xz - yw));
+		*up    = D3DXVECTOR3(2.0f * (xy - zw),        1.0f - 2.0f * (xx + zz), 2.0f * (yz + xw));
+		*look  = D3DXVECTOR3(2.0f * (xz + yw),        2.0f * (yz - xw),        1.0f - 2.0f * (xx + yy));
+	}
+
+	void ViewFromAxes(
+		const D3DXVECTOR3& right, const D3DXVECTOR3& up, const D3DXVECTOR3& look, const D3DXVECTOR3& pos,
+		D3DXMATRIX* V)
+	{
+		float x = -D3DXVec3Dot(&right, &pos);
+		float y = -D3DXVec3Dot(&up, &pos);
+		float z = -D3DXVec3Dot(&look, &pos);
+
+		(*V)(0,0) = right.x; (*V)(0, 1) = up.x; (*V)(0, 2) = look.x; (*V)(0, 3) = 0.0f;
+		(*V)(1,0) = right.y; (*V)(1, 1) = up.y; (*V)(1, 2) = look.y; (*V)(1, 3) = 0.0f;
+		(*V)(2,0) = right.z; (*V)(2, 1) = up.z; (*V)(2, 2) = look.z; (*V)(2, 3) = 0.0f;
+		(*V)(3,0) = x;       (*V)(3, 1) = y;    (*V)(3, 2) = z;      (*V)(3, 3) = 1.0f;
+	}
 
-	_pos   = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
-	_right = D3DXVECTOR3(1.0f, 0.0f, 0.0f);
-	_up    = D3DXVECTOR3(0.0f, 1.0f, 0.0f);
-	_look  = D3DXVECTOR3(0.0f, 0.0f, 1.0f);
+	double Now()
+	{
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+	}
+}
+
+Camera::Camera()
+{
+	init(AIRCRAFT);
 }
 
 Camera::Camera(CameraType cameraType)
+{
+	init(cameraType);
+}
+
+void Camera::init(CameraType cameraType)
 {
 	_cameraType = cameraType;
 
-	_pos   = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
-	_right = D3DXVECTOR3(1.0f, 0.0f, 0.0f);
-	_up    = D3DXVECTOR3(0.0f, 1.0f, 0.0f);
-	_look  = D3DXVECTOR3(0.0f, 0.0f, 1.0f);
+	_pos = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+	D3DXQuaternionIdentity(&_orientation);
+	updateAxes();
+
+	_fovY   = D3DX_PI * 0.25f;
+	_aspect = 4.0f / 3.0f;
+	_nearZ  = 1.0f;
+	_farZ   = 1000.0f;
+
+	_viewDirty = true;
+	_projDirty = true;
+	_snapshot.version = 0;
 }
 
 Camera::~Camera()
@@ -45,6 +94,7 @@ void Camera::getPosition(D3DXVECTOR3* pos)
 void Camera::setPosition(D3DXVECTOR3* pos)
 {
 	_pos = *pos;
+	_viewDirty = true;
 }
 
 void Camera::getRight(D3DXVECTOR3* right)
@@ -64,6 +114,8 @@ void Camera::getLook(D3DXVECTOR3* look)
 
 void Camera::walk(float units)
 {
+	_viewDirty = true;
+
 	// move only on xz plane for land object
 	if( _cameraType == LANDOBJECT )
 		_pos += D3DXVECTOR3(_look.x, 0.0f, _look.z) * units;
@@ -74,6 +126,8 @@ void Camera::walk(float units)
 
 void Camera::strafe(float units)
 {
+	_viewDirty = true;
+
 	// move only on xz plane for land object
 	if( _cameraType == LANDOBJECT )
 		_pos += D3DXVECTOR3(_right.x, 0.0f, _right.z) * units;
@@ -84,6 +138,8 @@ void Camera::strafe(float units)
 
 void Camera::fly(float units)
 {
+	_viewDirty = true;
+
 	// move only on y-axis for land object
 	if( _cameraType == LANDOBJECT )
 		_pos.y += units;
@@ -92,70 +148,353 @@ void Camera::fly(float units)
 		_pos += _up * units;
 }
 
-void Camera::pitch(float angle)
+void Camera::rotate(const D3DXVECTOR3* axis, float angle)
 {
-	D3DXMATRIX T;
-	D3DXMatrixRotationAxis(&T, &_right,	angle);
+	D3DXQUATERNION turn;
+	D3DXQuaternionRotationAxis(&turn, axis, angle);
+
+	// the current orientation followed by the turn; renormalizing keeps
+	// the rounding from accumulating
+	D3DXQuaternionMultiply(&_orientation, &_orientation, &turn);
+	D3DXQuaternionNormalize(&_orientation, &_orientation);
+
+	updateAxes();
+	_viewDirty = true;
+}
+
+void Camera::updateAxes()
+{
+	AxesFromQuaternion(_orientation, &_right, &_up, &_look);
+}
 
+void Camera::pitch(float angle)
+{
 	// rotate _up and _look around _right vector
-	D3DXVec3TransformCoord(&_up,&_up, &T);
-	D3DXVec3TransformCoord(&_look,&_look, &T);
+	rotate(&_right, angle);
 }
 
 void Camera::yaw(float angle)
 {
-	D3DXMATRIX T;
-
 	// rotate around world y (0, 1, 0) always for land object
 	if( _cameraType == LANDOBJECT )
-		D3DXMatrixRotationY(&T, angle);
+	{
+		D3DXVECTOR3 y(0.0f, 1.0f, 0.0f);
+		rotate(&y, angle);
+	}
 
 	// rotate around own up vector for aircraft
 	if( _cameraType == AIRCRAFT )
-		D3DXMatrixRotationAxis(&T, &_up, angle);
-
-	// rotate _right and _look around _up or y-axis
-	D3DXVec3TransformCoord(&_right,&_right, &T);
-	D3DXVec3TransformCoord(&_look,&_look, &T);
+		rotate(&_up, angle);
 }
 
 void Camera::roll(float angle)
 {
 	// only roll for aircraft type
 	if( _cameraType == AIRCRAFT )
+		rotate(&_look, angle);
+}
+
+void Camera::getOrientation(D3DXQUATERNION* q)
+{
+	*q = _orientation;
+}
+
+void Camera::setOrientation(const D3DXQUATERNION* q)
+{
+	D3DXQuaternionNormalize(&_orientation, q);
+	updateAxes();
+	_viewDirty = true;
+}
+
+void Camera::turnTowards(const D3DXQUATERNION* target, float rate, float timeDelta)
+{
+	// q and -q are the same orientation; take the one on the short way round
+	D3DXQUATERNION to = *target;
+	if( D3DXQuaternionDot(&_orientation, &to) < 0.0f )
+		to = -to;
+
+	float t = 1.0f - expf(-rate * timeDelta);
+	D3DXQuaternionSlerp(&_orientation, &_orientation, &to, t);
+	D3DXQuaternionNormalize(&_orientation, &_orientation);
+
+	updateAxes();
+	_viewDirty = true;
+}
+
+void Camera::setLens(float fovY, float aspect, float nearZ, float farZ)
+{
+	_fovY   = fovY;
+	_aspect = aspect;
+	_nearZ  = nearZ;
+	_farZ   = farZ;
+	_projDirty = true;
+}
+
+void Camera::update()
+{
+	if( !_viewDirty && !_projDirty )
+		return;
+
+	if( _viewDirty )
 	{
-		D3DXMATRIX T;
-		D3DXMatrixRotationAxis(&T, &_look,	angle);
+		// the axes come from a unit quaternion and are orthonormal already
+		ViewFromAxes(_right, _up, _look, _pos, &_snapshot.view);
+
+		// the inverse of a rotation and translation: the axes are its rows
+		D3DXMATRIX& I = _snapshot.viewInverse;
+		I(0,0) = _right.x; I(0, 1) = _right.y; I(0, 2) = _right.z; I(0, 3) = 0.0f;
+		I(1,0) = _up.x;    I(1, 1) = _up.y;    I(1, 2) = _up.z;    I(1, 3) = 0.0f;
+		I(2,0) = _look.x;  I(2, 1) = _look.y;  I(2, 2) = _look.z;  I(2, 3) = 0.0f;
+		I(3,0) = _pos.x;   I(3, 1) = _pos.y;   I(3, 2) = _pos.z;   I(3, 3) = 1.0f;
+
+		_snapshot.position = _pos;
+		_snapshot.right    = _right;
+		_snapshot.up       = _up;
+		_snapshot.look     = _look;
+	}
 
-		// rotate _up and _right around _look vector
-		D3DXVec3TransformCoord(&_right,&_right, &T);
-		D3DXVec3TransformCoord(&_up,&_up, &T);
+	if( _projDirty )
+	{
+		D3DXMatrixPerspectiveFovLH(&_snapshot.proj, _fovY, _aspect, _nearZ, _farZ);
+		D3DXMatrixInverse(&_snapshot.projInverse, 0, &_snapshot.proj);
+
+		_snapshot.fovY   = _fovY;
+		_snapshot.aspect = _aspect;
+		_snapshot.nearZ  = _nearZ;
+		_snapshot.farZ   = _farZ;
 	}
+
+	_snapshot.viewProj        = _snapshot.view * _snapshot.proj;
+	_snapshot.viewProjInverse = _snapshot.projInverse * _snapshot.viewInverse;
+	_snapshot.frustum.extract(&_snapshot.viewProj);
+
+	_snapshot.version++;
+	_viewDirty = false;
+	_projDirty = false;
+}
+
+const CameraSnapshot& Camera::getSnapshot()
+{
+	update();
+	return _snapshot;
+}
+
+DWORD Camera::getVersion()
+{
+	update();
+	return _snapshot.version;
 }
 
 void Camera::getViewMatrix(D3DXMATRIX* V)
 {
-	// Keep camera's axes orthogonal to eachother
-	D3DXVec3Normalize(&_look, &_look);
+	update();
+	*V = _snapshot.view;
+}
 
-	D3DXVec3Cross(&_up, &_look, &_right);
-	D3DXVec3Normalize(&_up, &_up);
+void Camera::getProjMatrix(D3DXMATRIX* P)
+{
+	update();
+	*P = _snapshot.proj;
+}
 
-	D3DXVec3Cross(&_right, &_up, &_look);
-	D3DXVec3Normalize(&_right, &_right);
+void Camera::getViewProjMatrix(D3DXMATRIX* VP)
+{
+	update();
+	*VP = _snapshot.viewProj;
+}
+
+void Camera::getFrustum(Frustum* frustum)
+{
+	update();
+	*frustum = _snapshot.frustum;
+}
 
-	// Build the view matrix:
-	float x = -D3DXVec3Dot(&_right, &_pos);
-	float y = -D3DXVec3Dot(&_up, &_pos);
-	float z = -D3DXVec3Dot(&_look, &_pos);
+void Camera::getFrustum(const D3DXMATRIX* proj, Frustum* frustum)
+{
+	update();
 
-	(*V)(0,0) = _right.x; (*V)(0, 1) = _up.x; (*V)(0, 2) = _look.x; (*V)(0, 3) = 0.0f;
-	(*V)(1,0) = _right.y; (*V)(1, 1) = _up.y; (*V)(1, 2) = _look.y; (*V)(1, 3) = 0.0f;
-	(*V)(2,0) = _right.z; (*V)(2, 1) = _up.z; (*V)(2, 2) = _look.z; (*V)(2, 3) = 0.0f;
-	(*V)(3,0) = x;        (*V)(3, 1) = y;     (*V)(3, 2) = z;       (*V)(3, 3) = 1.0f;
+	D3DXMATRIX viewProj = _snapshot.view * (*proj);
+	frustum->extract(&viewProj);
 }
 
 void Camera::setCameraType(CameraType cameraType)
 {
 	_cameraType = cameraType;
 }
+
+//
+// Many cameras
+//
+
+void BuildViewMatrices(
+	const D3DXVECTOR3* positions, const D3DXQUATERNION* orientations,
+	int count, D3DXMATRIX* views)
+{
+	__m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f);
+
+	int i = 0;
+	for(; i + 4 <= count; i += 4)
+	{
+		const D3DXQUATERNION* q = orientations + i;
+		const D3DXVECTOR3*    p = positions + i;
+
+		// four cameras side by side
+		__m128 x = _mm_loadu_ps(&q[0].x);
+		__m128 y = _mm_loadu_ps(&q[1].x);
+		__m128 z = _mm_loadu_ps(&q[2].x);
+		__m128 w = _mm_loadu_ps(&q[3].x);
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+
+		__m128 px = _mm_setr_ps(p[0].x, p[1].x, p[2].x, p[3].x);
+		__m128 py = _mm_setr_ps(p[0].y, p[1].y, p[2].y, p[3].y);
+		__m128 pz = _mm_setr_ps(p[0].z, p[1].z, p[2].z, p[3].z);
+
+		__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+		__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+		__m128 xw = _mm_mul_ps(x, w), yw = _mm_mul_ps(y, w), zw = _mm_mul_ps(z, w);
+
+		__m128 rx = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz)));
+		__m128 ry = _mm_mul_ps(two, _mm_add_ps(xy, zw));
+		__m128 rz = _mm_mul_ps(two, _mm_sub_ps(xz, yw));
+
+		__m128 ux = _mm_mul_ps(two, _mm_sub_ps(xy, zw));
+		__m128 uy = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz)));
+		__m128 uz = _mm_mul_ps(two, _mm_add_ps(yz, xw));
+
+		__m128 lx = _mm_mul_ps(two, _mm_add_ps(xz, yw));
+		__m128 ly = _mm_mul_ps(two, _mm_sub_ps(yz, xw));
+		__m128 lz = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)));
+
+		__m128 zero = _mm_setzero_ps();
+		__m128 tx = _mm_sub_ps(zero, _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, px), _mm_mul_ps(ry, py)), _mm_mul_ps(rz, pz)));
+		__m128 ty = _mm_sub_ps(zero, _mm_add_ps(_mm_add_ps(_mm_mul_ps(ux, px), _mm_mul_ps(uy, py)), _mm_mul_ps(uz, pz)));
+		__m128 tz = _mm_sub_ps(zero, _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, px), _mm_mul_ps(ly, py)), _mm_mul_ps(lz, pz)));
+
+		// Each matrix row holds one component of the three axes; transposing
+		// a group of four rows hands every camera its own row.
+		__m128 row0[4] = { rx, ux, lx, zero };
+		__m128 row1[4] = { ry, uy, ly, zero };
+		__m128 row2[4] = { rz, uz, lz, zero };
+		__m128 row3[4] = { tx, ty, tz, one };
+
+		_MM_TRANSPOSE4_PS(row0[0], row0[1], row0[2], row0[3]);
+		_MM_TRANSPOSE4_PS(row1[0], row1[1], row1[2], row1[3]);
+		_MM_TRANSPOSE4_PS(row2[0], row2[1], row2[2], row2[3]);
+		_MM_TRANSPOSE4_PS(row3[0], row3[1], row3[2], row3[3]);
+
+		for(int k = 0; k < 4; k++)
+		{
+			_mm_storeu_ps(&views[i + k]._11, row0[k]);
+			_mm_storeu_ps(&views[i + k]._21, row1[k]);
+			_mm_storeu_ps(&views[i + k]._31, row2[k]);
+			_mm_storeu_ps(&views[i + k]._41, row3[k]);
+		}
+	}
+
+	for(; i < count; i++)
+	{
+		D3DXVECTOR3 right, up, look;
+		AxesFromQuaternion(orientations[i], &right, &up, &look);
+		ViewFromAxes(right, up, look, positions[i], &views[i]);
+	}
+}
+
+void OrientationFromAxes(
+	const D3DXVECTOR3* right, const D3DXVECTOR3* up, const D3DXVECTOR3* look,
+	D3DXQUATERNION* q)
+{
+	D3DXMATRIX R(
+		right->x, right->y, right->z, 0.0f,
+		up->x,    up->y,    up->z,    0.0f,
+		look->x,  look->y,  look->z,  0.0f,
+		0.0f,     0.0f,     0.0f,     1.0f);
+
+	D3DXQuaternionRotationMatrix(q, &R);
+	D3DXQuaternionNormalize(q, q);
+}
+
+void GetCubeFaceOrientations(D3DXQUATERNION faces[6])
+{
+	// look and up for +x, -x, +y, -y, +z, -z
+	static const float Look[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+	static const float Up[6][3]   = { { 0, 1, 0 }, {  0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 }, { 0, 1, 0 }, { 0, 1,  0 } };
+
+	for(int i = 0; i < 6; i++)
+	{
+		D3DXVECTOR3 look(Look[i][0], Look[i][1], Look[i][2]);
+		D3DXVECTOR3 up(Up[i][0], Up[i][1], Up[i][2]);
+
+		D3DXVECTOR3 right;
+		D3DXVec3Cross(&right, &up, &look);
+
+		OrientationFromAxes(&right, &up, &look, &faces[i]);
+	}
+}
+
+bool BenchmarkCameraBatch(int numCameras, CameraBatchBenchmark* result)
+{
+	if( !result || numCameras <= 0 )
+		return false;
+
+	std::vector<D3DXVECTOR3>    positions(numCameras);
+	std::vector<D3DXQUATERNION> orientations(numCameras);
+
+	for(int i = 0; i < numCameras; i++)
+	{
+		positions[i] = D3DXVECTOR3(
+			(float)rand() / RAND_MAX * 200.0f - 100.0f,
+			(float)rand() / RAND_MAX * 200.0f - 100.0f,
+			(float)rand() / RAND_MAX * 200.0f - 100.0f);
+
+		D3DXVECTOR3 axis(
+			(float)rand() / RAND_MAX - 0.5f,
+			(float)rand() / RAND_MAX - 0.5f,
+			(float)rand() / RAND_MAX - 0.5f + 0.01f);
+		D3DXQuaternionRotationAxis(&orientations[i], &axis, (float)rand() / RAND_MAX * 2.0f * D3DX_PI);
+	}
+
+	//
+	// One at a time: a rotation matrix from the quaternion, then the view
+	// as its inverse.
+	//
+
+	std::vector<D3DXMATRIX> scalar(numCameras, D3DXMATRIX()), batch(numCameras, D3DXMATRIX());
+
+	// best of a few passes, so neither side pays for first touching memory
+	double scalarMs = 1e9, batchMs = 1e9;
+	for(int pass = 0; pass < 5; pass++)
+	{
+		double start = Now();
+		for(int i = 0; i < numCameras; i++)
+		{
+			D3DXMATRIX R;
+			D3DXMatrixRotationQuaternion(&R, &orientations[i]);
+
+			D3DXVECTOR3 right(R._11, R._12, R._13), up(R._21, R._22, R._23), look(R._31, R._32, R._33);
+			ViewFromAxes(right, up, look, positions[i], &scalar[i]);
+		}
+		double ms = Now() - start;
+		scalarMs = ms < scalarMs ? ms : scalarMs;
+
+		start = Now();
+		BuildViewMatrices(&positions[0], &orientations[0], numCameras, &batch[0]);
+		ms = Now() - start;
+		batchMs = ms < batchMs ? ms : batchMs;
+	}
+
+	float maxError = 0.0f;
+	for(int i = 0; i < numCameras; i++)
+	{
+		for(int k = 0; k < 16; k++)
+		{
+			float e = fabsf(((const float*)&scalar[i])[k] - ((const float*)&batch[i])[k]);
+			maxError = e > maxError ? e : maxError;
+		}
+	}
+
+	result->numCameras = numCameras;
+	result->scalarMs   = (float)scalarMs;
+	result->batchMs    = (float)batchMs;
+	result->maxError   = maxError;
+	return true;
+}
@@ -6,7 +6,11 @@
 //
 // System: AMD Athlon 1800+ XP, 512 DDR, Geforce 3, Windows XP, MSVC++ 7.0 
 //
-// Desc: Defines a camera's position and orientation.
+// Desc: Defines a camera's position, orientation and projection.  The
+//       orientation is a unit quaternion, so rotations compose without the
+//       axes drifting apart, and the axes are read off it.  The matrices and
+//       frustum derived from the camera are cached and only rebuilt after
+//       it changes.
 //         
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -14,6 +18,34 @@
 #define __cameraH__
 
 #include <d3dx9.h>
+#include "frustumCull.h"
+
+//
+// Everything derived from the camera's state, for the code that reads it
+// every frame: culling, picking, sorting.  version changes whenever any of
+// it does, so a reader can keep its own results until then.
+//
+
+struct CameraSnapshot
+{
+	DWORD       version;
+
+	D3DXVECTOR3 position;
+	D3DXVECTOR3 right;
+	D3DXVECTOR3 up;
+	D3DXVECTOR3 look;
+
+	D3DXMATRIX  view;
+	D3DXMATRIX  proj;
+	D3DXMATRIX  viewProj;
+	D3DXMATRIX  viewInverse;
+	D3DXMATRIX  projInverse;
+	D3DXMATRIX  viewProjInverse;
+
+	Frustum     frustum;  // world space planes
+
+	float fovY, aspect, nearZ, farZ;
+};
 
 class Camera
 {
@@ -32,7 +64,30 @@ public:
 	void yaw(float angle);   // rotate on up vector
 	void roll(float angle);  // rotate on look vector
 
+	// Takes camera space to world space: the rotated x, y and z axes are the
+	// right, up and look vectors.
+	void getOrientation(D3DXQUATERNION* q);
+	void setOrientation(const D3DXQUATERNION* q);
+
+	// Slerps towards target by 1 - e^(-rate * timeDelta) of the remaining
+	// angle, which converges at the same speed at any frame rate.
+	void turnTowards(const D3DXQUATERNION* target, float rate, float timeDelta);
+
+	// The projection, 45 degrees, 4:3, 1 to 1000 until set.
+	void setLens(float fovY, float aspect, float nearZ, float farZ);
+
 	void getViewMatrix(D3DXMATRIX* V); 
+	void getProjMatrix(D3DXMATRIX* P);
+	void getViewProjMatrix(D3DXMATRIX* VP);
+	void getFrustum(Frustum* frustum);                         // world space planes
+	void getFrustum(const D3DXMATRIX* proj, Frustum* frustum); // with another projection
+
+	// Rebuilds whatever changed since the last call, if anything.  The
+	// reference stays valid for the camera's lifetime but its contents
+	// change with the next call after a change.
+	const CameraSnapshot& getSnapshot();
+	DWORD getVersion();
+
 	void setCameraType(CameraType cameraType); 
 	void getPosition(D3DXVECTOR3* pos); 
 	void setPosition(D3DXVECTOR3* pos); 
@@ -41,10 +96,56 @@ public:
 	void getUp(D3DXVECTOR3* up);
 	void getLook(D3DXVECTOR3* look);
 private:
-	CameraType  _cameraType;
-	D3DXVECTOR3 _right;
-	D3DXVECTOR3 _up;
-	D3DXVECTOR3 _look;
-	D3DXVECTOR3 _pos;
+	CameraType     _cameraType;
+	D3DXQUATERNION _orientation;
+	D3DXVECTOR3    _right;  // read off _orientation after every change
+	D3DXVECTOR3    _up;
+	D3DXVECTOR3    _look;
+	D3DXVECTOR3    _pos;
+
+	float _fovY, _aspect, _nearZ, _farZ;
+
+	bool _viewDirty;  // position or orientation changed
+	bool _projDirty;  // lens changed
+	CameraSnapshot _snapshot;
+
+	void init(CameraType cameraType);
+	void rotate(const D3DXVECTOR3* axis, float angle); // world space axis
+	void updateAxes();
+	void update();
+};
+
+//
+// Many cameras at once, for shadow cascades, cube map faces and split
+// screen views.  Builds the view matrices of count cameras from their
+// positions and orientations, four at a time with SSE.
+//
+
+void BuildViewMatrices(
+	const D3DXVECTOR3* positions, const D3DXQUATERNION* orientations,
+	int count, D3DXMATRIX* views);
+
+// The orientation with these axes, which must be orthonormal and left handed.
+void OrientationFromAxes(
+	const D3DXVECTOR3* right, const D3DXVECTOR3* up, const D3DXVECTOR3* look,
+	D3DXQUATERNION* q);
+
+// The six cube map faces' orientations, in D3DCUBEMAP_FACES order.
+void GetCubeFaceOrientations(D3DXQUATERNION faces[6]);
+
+//
+// Headless benchmark: view matrices for numCameras cameras, one camera at a
+// time through D3DX and with BuildViewMatrices.
+//
+
+struct CameraBatchBenchmark
+{
+	int   numCameras;
+	float scalarMs;
+	float batchMs;
+	float maxError;  // largest difference between the two
 };
+
+bool BenchmarkCameraBatch(int numCameras, CameraBatchBenchmark* result);
+
 #endif // __cameraH__
\ No newline at end of file
@@ -6,12 +6,27 @@
 //
 // System: AMD Athlon 1800+ XP, 512 DDR, Geforce 3, Windows XP, MSVC++ 7.0 
 //
-// Desc: Demonstrates using the Camera class.
+// Desc: Demonstrates using the Camera class.  A field of spheres around the
+//       basic scene is culled against the camera's frustum; press 'C' to
+//       turn culling on and off and write the visible count to the debugger.
+//       The spheres are only culled again when the camera's snapshot
+//       version changes.  'K' starts and stops recording the camera's path
+//       to camera.path and 'L' plays it back at fixed steps, writing the
+//       frame times to flythrough.txt.  Run with -flythrough <path> to play
+//       a path with no window or device, timing the camera and culling
+//       work, and exit.
+//       Run with -benchmark to time frustum culling a million objects and
+//       building view matrices for 100,000 cameras, write the results to
+//       the debugger and exit.
 //         
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "d3dUtility.h"
 #include "camera.h"
+#include "frustumCull.h"
+#include "cameraPath.h"
+#include <cstdio>
+#include <cstring>
 
 //
 // Globals
@@ -23,6 +38,117 @@ const int Width  = 640;
 const int Height = 480;
 
 Camera TheCamera(Camera::LANDOBJECT);
+D3DXQUATERNION HomeOrientation;  // 'H' eases the camera back to it
+
+//
+// Field of spheres, culled before drawing.
+//
+
+const int   FieldSize    = 41;    // spheres per side
+const float FieldSpacing = 2.5f;
+
+ID3DXMesh*       FieldSphere = 0;
+SphereCullSet    FieldSet;
+std::vector<int> FieldVisible;
+bool             CullField = true;
+DWORD            CulledVersion = 0;  // camera snapshot FieldVisible was culled with
+
+//
+// Recorded camera paths.
+//
+
+const char* PathFileName   = "camera.path";
+const char* ReportFileName = "flythrough.txt";
+const float PlaybackStep   = 1.0f / 60.0f;
+
+CameraPath         Path;
+bool               Recording     = false;
+bool               Playing       = false;
+float              PathTime      = 0.0f;
+double             LastFrameTime = 0.0;
+std::vector<float> PlaybackFrameMs;
+
+double Now()
+{
+	LARGE_INTEGER count, frequency;
+	::QueryPerformanceCounter(&count);
+	::QueryPerformanceFrequency(&frequency);
+	return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+}
+
+// The per frame work that does not need the device: the camera and culling.
+class CullFrame : public FlythroughFrame
+{
+public:
+	void onFrame(const D3DXVECTOR3& position, const D3DXQUATERNION& orientation, float timeDelta)
+	{
+		D3DXVECTOR3 pos = position;
+		TheCamera.setPosition(&pos);
+		TheCamera.setOrientation(&orientation);
+
+		const CameraSnapshot& camera = TheCamera.getSnapshot();
+		FieldSet.cull(camera.frustum, FieldVisible);
+	}
+};
+
+//
+// Run with -benchmark in place of the sample.  Needs no device.
+//
+void Benchmark()
+{
+	FrustumCullBenchmark benchmark;
+	if( BenchmarkFrustumCulling(1000000, 30, &benchmark) )
+	{
+		char report[256];
+		::sprintf(report,
+			"Frustum culling %d objects: spheres %.3f ms, boxes %.3f ms, "
+			"flat %.3f / %.3f ms, scalar %.3f ms, %.1f%% visible%s\n",
+			benchmark.numObjects, benchmark.sphereMs, benchmark.boxMs,
+			benchmark.flatSphereMs, benchmark.flatBoxMs, benchmark.scalarMs,
+			benchmark.visibleRatio * 100.0f, benchmark.matches ? "" : ", MISMATCH");
+		::OutputDebugString(report);
+	}
+
+	CameraBatchBenchmark batch;
+	if( BenchmarkCameraBatch(100000, &batch) )
+	{
+		char report[256];
+		::sprintf(report,
+			"View matrices for %d cameras: one at a time %.3f ms, batched %.3f ms, max error %g\n",
+			batch.numCameras, batch.scalarMs, batch.batchMs, batch.maxError);
+		::OutputDebugString(report);
+	}
+}
+
+//
+// The field and the camera, all a flythrough needs; no device.
+//
+void SetupField()
+{
+	//
+	// Lay the spheres out row by row so neighbours share cull blocks.
+	//
+
+	float half = (FieldSize - 1) * FieldSpacing * 0.5f;
+	for(int z = 0; z < FieldSize; z++)
+	{
+		for(int x = 0; x < FieldSize; x++)
+		{
+			d3d::BoundingSphere sphere;
+			sphere._center = D3DXVECTOR3(x * FieldSpacing - half, -2.0f, z * FieldSpacing - half);
+			sphere._radius = 0.5f;
+			FieldSet.add(sphere);
+		}
+	}
+
+	TheCamera.getOrientation(&HomeOrientation);
+
+	TheCamera.setLens(
+			D3DX_PI * 0.25f, // 45 - degree
+			(float)Width / (float)Height,
+			1.0f,
+			1000.0f);
+}
 
 //
 // Framework functions
@@ -36,17 +162,16 @@ bool Setup()
 
 	d3d::DrawBasicScene(Device, 0.0f); 
 
+	D3DXCreateSphere(Device, 0.5f, 12, 12, &FieldSphere, 0);
+
+	SetupField();
+
 	//
 	// Set projection matrix.
 	//
 
 	D3DXMATRIX proj;
-	D3DXMatrixPerspectiveFovLH(
-			&proj,
-			D3DX_PI * 0.25f, // 45 - degree
-			(float)Width / (float)Height,
-			1.0f,
-			1000.0f);
+	TheCamera.getProjMatrix(&proj);
 	Device->SetTransform(D3DTS_PROJECTION, &proj);
 
 	return true;
@@ -56,57 +181,103 @@ void Cleanup()
 {
 	// pass 0 for the first parameter to instruct cleanup.
 	d3d::DrawBasicScene(0, 0.0f);
+
+	d3d::Release<ID3DXMesh*>(FieldSphere);
 }
 
-bool Display(float timeDelta)
+//
+// Update: Update the camera.
+//
+void UpdateCameraFromKeys(float timeDelta)
 {
-	if( Device )
-	{
-		//
-		// Update: Update the camera.
-		//
+	if( ::GetAsyncKeyState('W') & 0x8000f )
+		TheCamera.walk(4.0f * timeDelta);
 
-		if( ::GetAsyncKeyState('W') & 0x8000f )
-			TheCamera.walk(4.0f * timeDelta);
+	if( ::GetAsyncKeyState('S') & 0x8000f )
+		TheCamera.walk(-4.0f * timeDelta);
 
-		if( ::GetAsyncKeyState('S') & 0x8000f )
-			TheCamera.walk(-4.0f * timeDelta);
+	if( ::GetAsyncKeyState('A') & 0x8000f )
+		TheCamera.strafe(-4.0f * timeDelta);
 
-		if( ::GetAsyncKeyState('A') & 0x8000f )
-			TheCamera.strafe(-4.0f * timeDelta);
+	if( ::GetAsyncKeyState('D') & 0x8000f )
+		TheCamera.strafe(4.0f * timeDelta);
 
-		if( ::GetAsyncKeyState('D') & 0x8000f )
-			TheCamera.strafe(4.0f * timeDelta);
+	if( ::GetAsyncKeyState('R') & 0x8000f )
+		TheCamera.fly(4.0f * timeDelta);
 
-		if( ::GetAsyncKeyState('R') & 0x8000f )
-			TheCamera.fly(4.0f * timeDelta);
+	if( ::GetAsyncKeyState('F') & 0x8000f )
+		TheCamera.fly(-4.0f * timeDelta);
 
-		if( ::GetAsyncKeyState('F') & 0x8000f )
-			TheCamera.fly(-4.0f * timeDelta);
+	if( ::GetAsyncKeyState(VK_UP) & 0x8000f )
+		TheCamera.pitch(1.0f * timeDelta);
 
-		if( ::GetAsyncKeyState(VK_UP) & 0x8000f )
-			TheCamera.pitch(1.0f * timeDelta);
+	if( ::GetAsyncKeyState(VK_DOWN) & 0x8000f )
+		TheCamera.pitch(-1.0f * timeDelta);
 
-		if( ::GetAsyncKeyState(VK_DOWN) & 0x8000f )
-			TheCamera.pitch(-1.0f * timeDelta);
+	if( ::GetAsyncKeyState(VK_LEFT) & 0x8000f )
+		TheCamera.yaw(-1.0f * timeDelta);
+		
+	if( ::GetAsyncKeyState(VK_RIGHT) & 0x8000f )
+		TheCamera.yaw(1.0f * timeDelta);
 
-		if( ::GetAsyncKeyState(VK_LEFT) & 0x8000f )
-			TheCamera.yaw(-1.0f * timeDelta);
-			
-		if( ::GetAsyncKeyState(VK_RIGHT) & 0x8000f )
-			TheCamera.yaw(1.0f * timeDelta);
+	if( ::GetAsyncKeyState('N') & 0x8000f )
+		TheCamera.roll(1.0f * timeDelta);
 
-		if( ::GetAsyncKeyState('N') & 0x8000f )
-			TheCamera.roll(1.0f * timeDelta);
+	if( ::GetAsyncKeyState('M') & 0x8000f )
+		TheCamera.roll(-1.0f * timeDelta);
 
-		if( ::GetAsyncKeyState('M') & 0x8000f )
-			TheCamera.roll(-1.0f * timeDelta);
+	if( ::GetAsyncKeyState('H') & 0x8000f )
+		TheCamera.turnTowards(&HomeOrientation, 4.0f, timeDelta);
+}
+
+bool Display(float timeDelta)
+{
+	if( Device )
+	{
+		if( Playing )
+		{
+			// Every frame moves the path on by the same step whatever the
+			// clock says, so each run draws the same frames.
+			double now = Now();
+			if( PathTime > 0.0f )
+				PlaybackFrameMs.push_back((float)(now - LastFrameTime));
+			LastFrameTime = now;
+
+			D3DXVECTOR3    pos;
+			D3DXQUATERNION orientation;
+			Path.sample(PathTime, &pos, &orientation);
+			TheCamera.setPosition(&pos);
+			TheCamera.setOrientation(&orientation);
+
+			PathTime += PlaybackStep;
+			if( PathTime > Path.getDuration() )
+			{
+				FlythroughReport report;
+				SummarizeFrameTimes(PlaybackFrameMs, &report);
+				WriteFlythroughReport(ReportFileName, PathFileName, report);
+				Playing = false;
+			}
+		}
+		else
+		{
+			UpdateCameraFromKeys(timeDelta);
+		}
+
+		if( Recording )
+		{
+			D3DXVECTOR3    pos;
+			D3DXQUATERNION orientation;
+			TheCamera.getPosition(&pos);
+			TheCamera.getOrientation(&orientation);
+
+			PathTime += timeDelta;
+			Path.record(PathTime, pos, orientation);
+		}
 
 		// Update the view matrix representing the cameras 
         // new position/orientation.
-		D3DXMATRIX V;
-		TheCamera.getViewMatrix(&V);
-		Device->SetTransform(D3DTS_VIEW, &V);
+		const CameraSnapshot& camera = TheCamera.getSnapshot();
+		Device->SetTransform(D3DTS_VIEW, &camera.view);
 
 		//
 		// Render
@@ -117,6 +288,42 @@ bool Display(float timeDelta)
 
 		d3d::DrawBasicScene(Device, 1.0f);
 
+		//
+		// Draw the spheres that survive culling.
+		//
+
+		if( CullField )
+		{
+			// the last result holds until the camera moves
+			if( CulledVersion != camera.version )
+			{
+				FieldSet.cull(camera.frustum, FieldVisible);
+				CulledVersion = camera.version;
+			}
+		}
+		else
+		{
+			FieldVisible.resize(FieldSet.size());
+			for(int i = 0; i < FieldSet.size(); i++)
+				FieldVisible[i] = i;
+			CulledVersion = 0;
+		}
+
+		Device->SetMaterial(&d3d::YELLOW_MTRL);
+		Device->SetTexture(0, 0);
+
+		float half = (FieldSize - 1) * FieldSpacing * 0.5f;
+		for(int i = 0; i < (int)FieldVisible.size(); i++)
+		{
+			int x = FieldVisible[i] % FieldSize;
+			int z = FieldVisible[i] / FieldSize;
+
+			D3DXMATRIX T;
+			D3DXMatrixTranslation(&T, x * FieldSpacing - half, -2.0f, z * FieldSpacing - half);
+			Device->SetTransform(D3DTS_WORLD, &T);
+			FieldSphere->DrawSubset(0);
+		}
+
 		Device->EndScene();
 		Device->Present(0, 0, 0, 0);
 	}
@@ -138,6 +345,40 @@ LRESULT CALLBACK d3d::WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 		if( wParam == VK_ESCAPE )
 			::DestroyWindow(hwnd);
 
+		if( wParam == 'K' && !Playing )
+		{
+			Recording = !Recording;
+			if( Recording )
+			{
+				Path.clear();
+				PathTime = 0.0f;
+			}
+			else
+			{
+				char msg[128];
+				::sprintf(msg, "Recorded %.1f s of camera path in %d keys%s\n",
+					Path.getDuration(), Path.size(), Path.save(PathFileName) ? "" : ", SAVE FAILED");
+				::OutputDebugString(msg);
+			}
+		}
+
+		if( wParam == 'L' && !Recording )
+		{
+			Playing = !Playing && Path.load(PathFileName) && Path.size() > 0;
+			PathTime = 0.0f;
+			PlaybackFrameMs.clear();
+		}
+
+		if( wParam == 'C' )
+		{
+			CullField = !CullField;
+
+			char msg[128];
+			::sprintf(msg, "Culling %s, %d of %d spheres drawn\n",
+				CullField ? "on" : "off", (int)FieldVisible.size(), FieldSet.size());
+			::OutputDebugString(msg);
+		}
+
 		break;
 	}
 	return ::DefWindowProc(hwnd, msg, wParam, lParam);
@@ -151,6 +392,29 @@ int WINAPI WinMain(HINSTANCE hinstance,
 				   PSTR cmdLine,
 				   int showCmd)
 {
+	// -flythrough <path> plays the path through the camera and culling,
+	// with no window or device, and exits; it times nothing else
+	char fileName[260] = { 0 };
+	if( d3d::FindSwitch(cmdLine, "-flythrough", fileName, sizeof(fileName)) )
+	{
+		SetupField();
+
+		CameraPath       path;
+		CullFrame        frame;
+		FlythroughReport report;
+		if( path.load(fileName) && RunFlythrough(path, PlaybackStep, &frame, &report, 0) )
+			WriteFlythroughReport(ReportFileName, fileName, report);
+		else
+			::OutputDebugString("Flythrough: could not load the path\n");
+		return 0;
+	}
+
+	if( d3d::FindSwitch(cmdLine, "-benchmark") )
+	{
+		Benchmark();
+		return 0;
+	}
+
 	if(!d3d::InitD3D(hinstance,
 		Width, Height, true, D3DDEVTYPE_HAL, &Device))
 	{
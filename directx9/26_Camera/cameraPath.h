@@ -0,0 +1,103 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: cameraPath.h
+//
+// Desc: Records the camera's pose as it moves and plays it back, so a
+//       flythrough can be repeated exactly.  Poses are recorded, not key
+//       presses, so playback does not depend on the frame rate it was
+//       recorded at; it samples the path at fixed time steps.  Keys that a
+//       straight line through their neighbours already predicts are dropped
+//       while recording, and the file stores the orientation in 16 bits per
+//       component.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __cameraPathH__
+#define __cameraPathH__
+
+#include "d3dUtility.h"
+#include <vector>
+
+class CameraPath
+{
+public:
+	CameraPath();
+
+	void clear();
+	int  size() const { return (int)_keys.size(); }
+
+	// Seconds from the first key to the last.
+	float getDuration() const;
+
+	// Adds the pose at time seconds since recording began; times must
+	// increase.
+	void record(float time, const D3DXVECTOR3& position, const D3DXQUATERNION& orientation);
+
+	// The pose time seconds after the first key, between the keys around
+	// it: positions are interpolated linearly, orientations with slerp.
+	// Clamps to the ends.
+	void sample(float time, D3DXVECTOR3* position, D3DXQUATERNION* orientation) const;
+
+	bool save(const char* fileName) const;
+	bool load(const char* fileName);
+
+private:
+	struct Key
+	{
+		float          _time;
+		D3DXVECTOR3    _position;
+		D3DXQUATERNION _orientation;
+	};
+
+	std::vector<Key> _keys;
+	std::vector<Key> _skipped;  // folded into the last key since the one before it
+
+	// playback runs forward, so sampling starts its search at the last key
+	// it found
+	mutable int _cursor;
+
+	static bool predicts(const Key& a, const Key& b, const Key& k);
+	static void interpolate(const Key& a, const Key& b, float time, D3DXVECTOR3* position, D3DXQUATERNION* orientation);
+};
+
+//
+// Playing a path back at fixed steps and timing each frame.
+//
+
+class FlythroughFrame
+{
+public:
+	virtual ~FlythroughFrame() {}
+
+	// Does one frame's work with the camera at this pose.
+	virtual void onFrame(const D3DXVECTOR3& position, const D3DXQUATERNION& orientation, float timeDelta) = 0;
+};
+
+struct FlythroughReport
+{
+	FlythroughReport();
+
+	int   frames;
+	float totalMs;
+	float averageMs;
+	float minMs;
+	float medianMs;
+	float p95Ms;
+	float p99Ms;
+	float maxMs;
+};
+
+// Fills the report from a list of frame times.
+void SummarizeFrameTimes(const std::vector<float>& frameMs, FlythroughReport* report);
+
+// Plays the whole path at step seconds per frame without waiting on a
+// clock, calling frame for each pose.  With frameMs, also returns each
+// frame's time.
+bool RunFlythrough(const CameraPath& path, float step, FlythroughFrame* frame,
+	FlythroughReport* report, std::vector<float>* frameMs);
+
+// One line per report, appended to fileName (when given) and written to the
+// debugger.
+void WriteFlythroughReport(const char* fileName, const char* pathName, const FlythroughReport& report);
+
+#endif // __cameraPathH__
@@ -0,0 +1,619 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: frustumCull.cpp
+//
+// Desc: View frustum culling.  See frustumCull.h.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "frustumCull.h"
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <xmmintrin.h>
+
+namespace
+{
+	// Padding volumes: a radius or extent this negative puts them outside
+	// every plane.
+	const float Nothing = -1e30f;
+
+	// Lane order and count for each 4 bit visibility mask, so the visible
+	// indices of a group are written without branches.
+	const BYTE LaneCount[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+	const BYTE LaneOrder[16][4] =
+	{
+		{ 0, 0, 0, 0 }, { 0, 0, 0, 0 }, { 1, 0, 0, 0 }, { 0, 1, 0, 0 },
+		{ 2, 0, 0, 0 }, { 0, 2, 0, 0 }, { 1, 2, 0, 0 }, { 0, 1, 2, 0 },
+		{ 3, 0, 0, 0 }, { 0, 3, 0, 0 }, { 1, 3, 0, 0 }, { 0, 1, 3, 0 },
+		{ 2, 3, 0, 0 }, { 0, 2, 3, 0 }, { 1, 2, 3, 0 }, { 0, 1, 2, 3 }
+	};
+
+	int* Emit(int* out, int first, int visibleMask)
+	{
+		const BYTE* order = LaneOrder[visibleMask];
+		out[0] = first + order[0];
+		out[1] = first + order[1];
+		out[2] = first + order[2];
+		out[3] = first + order[3];
+		return out + LaneCount[visibleMask];
+	}
+
+	// The planes that take part in a test, splatted across the lanes.
+	struct PlaneLanes
+	{
+		int    count;
+		int    index[Frustum::NUM_PLANES];
+		__m128 a[Frustum::NUM_PLANES], b[Frustum::NUM_PLANES];
+		__m128 c[Frustum::NUM_PLANES], d[Frustum::NUM_PLANES];
+	};
+
+	void SplatPlanes(const Frustum& frustum, DWORD planeMask, bool absolute, PlaneLanes* lanes)
+	{
+		lanes->count = 0;
+		for(int p = 0; p < Frustum::NUM_PLANES; p++)
+		{
+			if( !(planeMask & (1 << p)) )
+				continue;
+
+			const D3DXPLANE& plane = frustum._planes[p];
+			int k = lanes->count++;
+			lanes->index[k] = p;
+			lanes->a[k] = _mm_set1_ps(absolute ? fabsf(plane.a) : plane.a);
+			lanes->b[k] = _mm_set1_ps(absolute ? fabsf(plane.b) : plane.b);
+			lanes->c[k] = _mm_set1_ps(absolute ? fabsf(plane.c) : plane.c);
+			lanes->d[k] = _mm_set1_ps(plane.d);
+		}
+	}
+
+	__m128 Dot(__m128 a, __m128 b, __m128 c, __m128 d, __m128 x, __m128 y, __m128 z)
+	{
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, x), _mm_mul_ps(b, y)), _mm_add_ps(_mm_mul_ps(c, z), d));
+	}
+
+	__m128 Abs(__m128 v)
+	{
+		return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+	}
+
+	// Records p as the rejecting plane of the lanes that are newly outside.
+	void Remember(BYTE* lastPlane, int fresh, int p)
+	{
+		for(int lane = 0; fresh; lane++, fresh >>= 1)
+		{
+			if( fresh & 1 )
+				lastPlane[lane] = (BYTE)p;
+		}
+	}
+
+	double Now()
+	{
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+	}
+
+	float Random(float lo, float hi)
+	{
+		return lo + (hi - lo) * ((float)rand() / (float)RAND_MAX);
+	}
+}
+
+//
+// Frustum
+//
+
+void Frustum::extract(const D3DXMATRIX* viewProj)
+{
+	const D3DXMATRIX& m = *viewProj;
+
+	// clip space z runs from 0 to 1
+	_planes[LEFT]       = D3DXPLANE(m._14 + m._11, m._24 + m._21, m._34 + m._31, m._44 + m._41);
+	_planes[RIGHT]      = D3DXPLANE(m._14 - m._11, m._24 - m._21, m._34 - m._31, m._44 - m._41);
+	_planes[BOTTOM]     = D3DXPLANE(m._14 + m._12, m._24 + m._22, m._34 + m._32, m._44 + m._42);
+	_planes[TOP]        = D3DXPLANE(m._14 - m._12, m._24 - m._22, m._34 - m._32, m._44 - m._42);
+	_planes[NEAR_PLANE] = D3DXPLANE(m._13,         m._23,         m._33,         m._43);
+	_planes[FAR_PLANE]  = D3DXPLANE(m._14 - m._13, m._24 - m._23, m._34 - m._33, m._44 - m._43);
+
+	for(int i = 0; i < NUM_PLANES; i++)
+		D3DXPlaneNormalize(&_planes[i], &_planes[i]);
+}
+
+bool Frustum::isVisible(const d3d::BoundingSphere& sphere) const
+{
+	for(int i = 0; i < NUM_PLANES; i++)
+	{
+		if( D3DXPlaneDotCoord(&_planes[i], &sphere._center) < -sphere._radius )
+			return false;
+	}
+	return true;
+}
+
+bool Frustum::isVisible(const d3d::BoundingBox& box) const
+{
+	D3DXVECTOR3 center = (box._min + box._max) * 0.5f;
+	D3DXVECTOR3 extent = (box._max - box._min) * 0.5f;
+
+	for(int i = 0; i < NUM_PLANES; i++)
+	{
+		const D3DXPLANE& p = _planes[i];
+		float r = fabsf(p.a) * extent.x + fabsf(p.b) * extent.y + fabsf(p.c) * extent.z;
+		if( D3DXPlaneDotCoord(&p, &center) < -r )
+			return false;
+	}
+	return true;
+}
+
+CullStats::CullStats()
+{
+	objects         = 0;
+	visible         = 0;
+	blocksOutside   = 0;
+	blocksInside    = 0;
+	blocksTested    = 0;
+	coherentRejects = 0;
+}
+
+//
+// CullSet
+//
+
+CullSet::CullSet()
+{
+	_count = 0;
+}
+
+CullSet::~CullSet()
+{
+
+}
+
+void CullSet::clear()
+{
+	_count = 0;
+	_blocks.clear();
+	_lastPlane.clear();
+	growArrays(0);
+}
+
+int CullSet::grow()
+{
+	int index = _count++;
+
+	if( index % BlockSize == 0 )
+	{
+		// a new block; the arrays always cover whole blocks
+		Block block;
+		block.center    = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+		block.extent    = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+		block.lastPlane = 0;
+		block.dirty     = true;
+		_blocks.push_back(block);
+
+		int capacity = (int)_blocks.size() * BlockSize;
+		_lastPlane.resize(capacity, 0);
+		growArrays(capacity);
+	}
+
+	touch(index);
+	return index;
+}
+
+int CullSet::cull(const Frustum& frustum, std::vector<int>& visible, DWORD flags)
+{
+	_stats = CullStats();
+	_stats.objects = _count;
+
+	visible.clear();
+	if( _count == 0 )
+		return 0;
+
+	bool hierarchy = (flags & CULL_HIERARCHY) != 0;
+	bool coherent  = (flags & CULL_COHERENCE) != 0;
+
+	// Emit writes four entries at a time
+	if( (int)_scratch.size() < _count + 4 )
+		_scratch.resize(_count + 4);
+
+	int* out = &_scratch[0];
+
+	for(int b = 0; b < (int)_blocks.size(); b++)
+	{
+		int begin = b * BlockSize;
+		int end   = begin + BlockSize < _count ? begin + BlockSize : _count;
+
+		DWORD planeMask = (1 << Frustum::NUM_PLANES) - 1;
+
+		if( hierarchy )
+		{
+			Block& block = _blocks[b];
+			if( block.dirty )
+			{
+				D3DXVECTOR3 bmin, bmax;
+				computeBlockBounds(b, &bmin, &bmax);
+				block.center = (bmin + bmax) * 0.5f;
+				block.extent = (bmax - bmin) * 0.5f;
+				block.dirty  = false;
+			}
+
+			// planes the block is fully inside need not be tested again
+			// for its objects
+			bool outside = false;
+			for(int k = -1; k < Frustum::NUM_PLANES && !outside; k++)
+			{
+				int p = k < 0 ? block.lastPlane : k;
+				if( k < 0 && !coherent )
+					continue;
+
+				const D3DXPLANE& plane = frustum._planes[p];
+				float r = fabsf(plane.a) * block.extent.x +
+				          fabsf(plane.b) * block.extent.y +
+				          fabsf(plane.c) * block.extent.z;
+				float d = D3DXPlaneDotCoord(&plane, &block.center);
+
+				if( d < -r )
+				{
+					block.lastPlane = (BYTE)p;
+					outside = true;
+				}
+				else if( d >= r )
+				{
+					planeMask &= ~(1 << p);
+				}
+			}
+
+			if( outside )
+			{
+				_stats.blocksOutside++;
+				continue;
+			}
+
+			if( planeMask == 0 )
+			{
+				_stats.blocksInside++;
+				for(int i = begin; i < end; i++)
+					*out++ = i;
+				continue;
+			}
+		}
+
+		_stats.blocksTested++;
+		out = testGroups(frustum, planeMask, coherent, begin, (end - begin + 3) / 4, out);
+	}
+
+	int count = (int)(out - &_scratch[0]);
+	visible.assign(_scratch.begin(), _scratch.begin() + count);
+
+	_stats.visible = count;
+	return count;
+}
+
+//
+// SphereCullSet
+//
+
+int SphereCullSet::add(const d3d::BoundingSphere& sphere)
+{
+	int index = grow();
+	set(index, sphere);
+	return index;
+}
+
+void SphereCullSet::set(int index, const d3d::BoundingSphere& sphere)
+{
+	_x[index]      = sphere._center.x;
+	_y[index]      = sphere._center.y;
+	_z[index]      = sphere._center.z;
+	_radius[index] = sphere._radius;
+	touch(index);
+}
+
+void SphereCullSet::growArrays(int capacity)
+{
+	_x.resize(capacity, 0.0f);
+	_y.resize(capacity, 0.0f);
+	_z.resize(capacity, 0.0f);
+	_radius.resize(capacity, Nothing);
+}
+
+void SphereCullSet::computeBlockBounds(int block, D3DXVECTOR3* bmin, D3DXVECTOR3* bmax) const
+{
+	int begin = block * BlockSize;
+	int end   = begin + BlockSize < _count ? begin + BlockSize : _count;
+
+	*bmin = D3DXVECTOR3( FLT_MAX,  FLT_MAX,  FLT_MAX);
+	*bmax = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+	for(int i = begin; i < end; i++)
+	{
+		float r = _radius[i];
+		bmin->x = _x[i] - r < bmin->x ? _x[i] - r : bmin->x;
+		bmin->y = _y[i] - r < bmin->y ? _y[i] - r : bmin->y;
+		bmin->z = _z[i] - r < bmin->z ? _z[i] - r : bmin->z;
+		bmax->x = _x[i] + r > bmax->x ? _x[i] + r : bmax->x;
+		bmax->y = _y[i] + r > bmax->y ? _y[i] + r : bmax->y;
+		bmax->z = _z[i] + r > bmax->z ? _z[i] + r : bmax->z;
+	}
+}
+
+int* SphereCullSet::testGroups(
+	const Frustum& frustum, DWORD planeMask, bool coherent,
+	int begin, int numGroups, int* out)
+{
+	PlaneLanes planes;
+	SplatPlanes(frustum, planeMask, false, &planes);
+
+	for(int g = 0; g < numGroups; g++)
+	{
+		int i = begin + 4 * g;
+
+		__m128 x = _mm_loadu_ps(&_x[i]);
+		__m128 y = _mm_loadu_ps(&_y[i]);
+		__m128 z = _mm_loadu_ps(&_z[i]);
+		__m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&_radius[i]));
+
+		int outside = 0;
+
+		if( coherent )
+		{
+			// each lane against its own last rejecting plane
+			BYTE* last = &_lastPlane[i];
+			const D3DXPLANE& p0 = frustum._planes[last[0]];
+			const D3DXPLANE& p1 = frustum._planes[last[1]];
+			const D3DXPLANE& p2 = frustum._planes[last[2]];
+			const D3DXPLANE& p3 = frustum._planes[last[3]];
+
+			__m128 dist = Dot(
+				_mm_setr_ps(p0.a, p1.a, p2.a, p3.a), _mm_setr_ps(p0.b, p1.b, p2.b, p3.b),
+				_mm_setr_ps(p0.c, p1.c, p2.c, p3.c), _mm_setr_ps(p0.d, p1.d, p2.d, p3.d),
+				x, y, z);
+
+			outside = _mm_movemask_ps(_mm_cmplt_ps(dist, negRadius));
+			if( outside == 15 )
+			{
+				_stats.coherentRejects++;
+				continue;
+			}
+		}
+
+		for(int k = 0; k < planes.count && outside != 15; k++)
+		{
+			__m128 dist = Dot(planes.a[k], planes.b[k], planes.c[k], planes.d[k], x, y, z);
+
+			int fresh = _mm_movemask_ps(_mm_cmplt_ps(dist, negRadius)) & ~outside;
+			if( fresh )
+			{
+				Remember(&_lastPlane[i], fresh, planes.index[k]);
+				outside |= fresh;
+			}
+		}
+
+		out = Emit(out, i, ~outside & 15);
+	}
+
+	return out;
+}
+
+//
+// BoxCullSet
+//
+
+int BoxCullSet::add(const d3d::BoundingBox& box)
+{
+	int index = grow();
+	set(index, box);
+	return index;
+}
+
+void BoxCullSet::set(int index, const d3d::BoundingBox& box)
+{
+	_cx[index] = (box._min.x + box._max.x) * 0.5f;
+	_cy[index] = (box._min.y + box._max.y) * 0.5f;
+	_cz[index] = (box._min.z + box._max.z) * 0.5f;
+	_ex[index] = (box._max.x - box._min.x) * 0.5f;
+	_ey[index] = (box._max.y - box._min.y) * 0.5f;
+	_ez[index] = (box._max.z - box._min.z) * 0.5f;
+	touch(index);
+}
+
+void BoxCullSet::growArrays(int capacity)
+{
+	_cx.resize(capacity, 0.0f);
+	_cy.resize(capacity, 0.0f);
+	_cz.resize(capacity, 0.0f);
+	_ex.resize(capacity, Nothing);
+	_ey.resize(capacity, Nothing);
+	_ez.resize(capacity, Nothing);
+}
+
+void BoxCullSet::computeBlockBounds(int block, D3DXVECTOR3* bmin, D3DXVECTOR3* bmax) const
+{
+	int begin = block * BlockSize;
+	int end   = begin + BlockSize < _count ? begin + BlockSize : _count;
+
+	*bmin = D3DXVECTOR3( FLT_MAX,  FLT_MAX,  FLT_MAX);
+	*bmax = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+	for(int i = begin; i < end; i++)
+	{
+		bmin->x = _cx[i] - _ex[i] < bmin->x ? _cx[i] - _ex[i] : bmin->x;
+		bmin->y = _cy[i] - _ey[i] < bmin->y ? _cy[i] - _ey[i] : bmin->y;
+		bmin->z = _cz[i] - _ez[i] < bmin->z ? _cz[i] - _ez[i] : bmin->z;
+		bmax->x = _cx[i] + _ex[i] > bmax->x ? _cx[i] + _ex[i] : bmax->x;
+		bmax->y = _cy[i] + _ey[i] > bmax->y ? _cy[i] + _ey[i] : bmax->y;
+		bmax->z = _cz[i] + _ez[i] > bmax->z ? _cz[i] + _ez[i] : bmax->z;
+	}
+}
+
+int* BoxCullSet::testGroups(
+	const Frustum& frustum, DWORD planeMask, bool coherent,
+	int begin, int numGroups, int* out)
+{
+	PlaneLanes planes, absPlanes;
+	SplatPlanes(frustum, planeMask, false, &planes);
+	SplatPlanes(frustum, planeMask, true,  &absPlanes);
+
+	for(int g = 0; g < numGroups; g++)
+	{
+		int i = begin + 4 * g;
+
+		__m128 cx = _mm_loadu_ps(&_cx[i]);
+		__m128 cy = _mm_loadu_ps(&_cy[i]);
+		__m128 cz = _mm_loadu_ps(&_cz[i]);
+		__m128 ex = _mm_loadu_ps(&_ex[i]);
+		__m128 ey = _mm_loadu_ps(&_ey[i]);
+		__m128 ez = _mm_loadu_ps(&_ez[i]);
+
+		int outside = 0;
+
+		if( coherent )
+		{
+			BYTE* last = &_lastPlane[i];
+			const D3DXPLANE& p0 = frustum._planes[last[0]];
+			const D3DXPLANE& p1 = frustum._planes[last[1]];
+			const D3DXPLANE& p2 = frustum._planes[last[2]];
+			const D3DXPLANE& p3 = frustum._planes[last[3]];
+
+			__m128 a = _mm_setr_ps(p0.a, p1.a, p2.a, p3.a);
+			__m128 b = _mm_setr_ps(p0.b, p1.b, p2.b, p3.b);
+			__m128 c = _mm_setr_ps(p0.c, p1.c, p2.c, p3.c);
+			__m128 d = _mm_setr_ps(p0.d, p1.d, p2.d, p3.d);
+
+			// the box's reach toward the plane
+			__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(Abs(a), ex), _mm_mul_ps(Abs(b), ey)), _mm_mul_ps(Abs(c), ez));
+			__m128 dist = _mm_add_ps(Dot(a, b, c, d, cx, cy, cz), r);
+
+			outside = _mm_movemask_ps(_mm_cmplt_ps(dist, _mm_setzero_ps()));
+			if( outside == 15 )
+			{
+				_stats.coherentRejects++;
+				continue;
+			}
+		}
+
+		for(int k = 0; k < planes.count && outside != 15; k++)
+		{
+			__m128 r = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(absPlanes.a[k], ex), _mm_mul_ps(absPlanes.b[k], ey)), _mm_mul_ps(absPlanes.c[k], ez));
+			__m128 dist = _mm_add_ps(Dot(planes.a[k], planes.b[k], planes.c[k], planes.d[k], cx, cy, cz), r);
+
+			int fresh = _mm_movemask_ps(_mm_cmplt_ps(dist, _mm_setzero_ps())) & ~outside;
+			if( fresh )
+			{
+				Remember(&_lastPlane[i], fresh, planes.index[k]);
+				outside |= fresh;
+			}
+		}
+
+		out = Emit(out, i, ~outside & 15);
+	}
+
+	return out;
+}
+
+//
+// Benchmark
+//
+
+bool BenchmarkFrustumCulling(int numObjects, int numFrames, FrustumCullBenchmark* result)
+{
+	if( numObjects <= 0 || numFrames <= 0 || !result )
+		return false;
+
+	//
+	// Objects on a square grid of cells, one block's worth per cell, added
+	// cell by cell so each block is one cell.
+	//
+
+	const float cellSize = 16.0f;
+	int numCells = (numObjects + CullSet::BlockSize - 1) / CullSet::BlockSize;
+	int side = (int)ceilf(sqrtf((float)numCells));
+	float half = side * cellSize * 0.5f;
+
+	std::vector<d3d::BoundingSphere> spheres;
+	SphereCullSet sphereSet;
+	BoxCullSet    boxSet;
+
+	for(int i = 0; i < numObjects; i++)
+	{
+		int cell = i / CullSet::BlockSize;
+		float x0 = (cell % side) * cellSize - half;
+		float z0 = (cell / side) * cellSize - half;
+
+		d3d::BoundingSphere sphere;
+		sphere._center = D3DXVECTOR3(x0 + Random(0.0f, cellSize), Random(0.0f, 8.0f), z0 + Random(0.0f, cellSize));
+		sphere._radius = Random(0.25f, 1.0f);
+		spheres.push_back(sphere);
+		sphereSet.add(sphere);
+
+		d3d::BoundingBox box;
+		box._min = sphere._center - D3DXVECTOR3(sphere._radius, sphere._radius, sphere._radius);
+		box._max = sphere._center + D3DXVECTOR3(sphere._radius, sphere._radius, sphere._radius);
+		boxSet.add(box);
+	}
+
+	D3DXMATRIX proj;
+	D3DXMatrixPerspectiveFovLH(&proj, D3DX_PI * 0.25f, 4.0f / 3.0f, 1.0f, half);
+
+	std::vector<int> visible;
+	double sphereMs = 0.0, boxMs = 0.0, flatSphereMs = 0.0, flatBoxMs = 0.0, scalarMs = 0.0;
+	double visibleSum = 0.0;
+	bool matches = true;
+
+	for(int frame = 0; frame < numFrames; frame++)
+	{
+		// turn slowly in place, as a player would
+		float angle = frame * 0.01f;
+		D3DXVECTOR3 eye(0.0f, 4.0f, 0.0f);
+		D3DXVECTOR3 at(sinf(angle), 4.0f, cosf(angle));
+		D3DXVECTOR3 up(0.0f, 1.0f, 0.0f);
+
+		D3DXMATRIX view;
+		D3DXMatrixLookAtLH(&view, &eye, &at, &up);
+
+		D3DXMATRIX viewProj = view * proj;
+		Frustum frustum;
+		frustum.extract(&viewProj);
+
+		double start = Now();
+		int numVisible = sphereSet.cull(frustum, visible);
+		sphereMs += Now() - start;
+		visibleSum += (double)numVisible / numObjects;
+
+		start = Now();
+		int scalarVisible = 0;
+		for(int i = 0; i < numObjects; i++)
+		{
+			if( frustum.isVisible(spheres[i]) )
+				scalarVisible++;
+		}
+		scalarMs += Now() - start;
+
+		if( scalarVisible != numVisible )
+			matches = false;
+
+		start = Now();
+		boxSet.cull(frustum, visible);
+		boxMs += Now() - start;
+
+		start = Now();
+		if( sphereSet.cull(frustum, visible, 0) != numVisible )
+			matches = false;
+		flatSphereMs += Now() - start;
+
+		start = Now();
+		boxSet.cull(frustum, visible, 0);
+		flatBoxMs += Now() - start;
+	}
+
+	result->numObjects   = numObjects;
+	result->sphereMs     = (float)(sphereMs / numFrames);
+	result->boxMs        = (float)(boxMs / numFrames);
+	result->flatSphereMs = (float)(flatSphereMs / numFrames);
+	result->flatBoxMs    = (float)(flatBoxMs / numFrames);
+	result->scalarMs     = (float)(scalarMs / numFrames);
+	result->visibleRatio = (float)(visibleSum / numFrames);
+	result->matches      = matches;
+	return true;
+}
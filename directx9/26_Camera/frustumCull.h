@@ -0,0 +1,163 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: frustumCull.h
+//
+// Desc: View frustum culling for large sets of bounding spheres and boxes.
+//       The volumes are kept as structures of arrays and tested four at a
+//       time with SSE.  They are grouped in blocks of consecutive objects,
+//       each with a box around it, so whole blocks outside or inside the
+//       frustum are settled with one test.  Every object and block also
+//       remembers the plane that rejected it last, which is tried first the
+//       next frame.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __frustumCullH__
+#define __frustumCullH__
+
+#include "d3dUtility.h"
+#include <vector>
+
+struct Frustum
+{
+	enum { LEFT, RIGHT, BOTTOM, TOP, NEAR_PLANE, FAR_PLANE, NUM_PLANES };
+
+	// Extracts the planes from a view * projection matrix (Gribb and
+	// Hartmann).  The normals are normalized and point into the frustum.
+	void extract(const D3DXMATRIX* viewProj);
+
+	// Scalar tests, for single objects and for checking the batched ones.
+	bool isVisible(const d3d::BoundingSphere& sphere) const;
+	bool isVisible(const d3d::BoundingBox& box) const;
+
+	D3DXPLANE _planes[NUM_PLANES];
+};
+
+struct CullStats
+{
+	CullStats();
+
+	int objects;
+	int visible;
+	int blocksOutside;   // rejected without looking at their objects
+	int blocksInside;    // accepted without looking at their objects
+	int blocksTested;    // straddling a plane, tested object by object
+	int coherentRejects; // groups of four rejected by their last planes alone
+};
+
+enum CullFlags
+{
+	CULL_HIERARCHY = 1,  // test the blocks' boxes first
+	CULL_COHERENCE = 2,  // test the last rejecting planes first
+	CULL_DEFAULT   = CULL_HIERARCHY | CULL_COHERENCE
+};
+
+//
+// Objects near each other should be added one after another: the blocks
+// are runs of consecutive indices, and a block only settles its objects at
+// once when they are close together.
+//
+
+class CullSet
+{
+public:
+	CullSet();
+	virtual ~CullSet();
+
+	void clear();
+	int  size() const { return _count; }
+
+	// Writes the indices of the visible objects, in increasing order, to
+	// visible and returns how many there are.
+	int cull(const Frustum& frustum, std::vector<int>& visible, DWORD flags = CULL_DEFAULT);
+
+	const CullStats& getStats() const { return _stats; }
+
+	enum { BlockSize = 64 };
+
+protected:
+	struct Block
+	{
+		D3DXVECTOR3 center;
+		D3DXVECTOR3 extent;
+		BYTE        lastPlane;
+		bool        dirty;
+	};
+
+	int                _count;
+	std::vector<Block> _blocks;
+	std::vector<BYTE>  _lastPlane;  // per object, padded like the arrays
+	std::vector<int>   _scratch;    // visible indices, before copying out
+
+	int  grow();          // makes room for one more object, returns its index
+	void touch(int index) { _blocks[index / BlockSize].dirty = true; }
+
+	// The derived sets store the volumes.  Arrays are padded to whole blocks
+	// with volumes that are outside every plane.
+	virtual void growArrays(int capacity) = 0;
+	virtual void computeBlockBounds(int block, D3DXVECTOR3* bmin, D3DXVECTOR3* bmax) const = 0;
+
+	// Tests objects [begin, begin + 4 * numGroups) against the planes in
+	// planeMask and appends the visible ones to out.  Returns the new end.
+	virtual int* testGroups(
+		const Frustum& frustum, DWORD planeMask, bool coherent,
+		int begin, int numGroups, int* out) = 0;
+
+	CullStats _stats;
+};
+
+class SphereCullSet : public CullSet
+{
+public:
+	int  add(const d3d::BoundingSphere& sphere);
+	void set(int index, const d3d::BoundingSphere& sphere);
+
+private:
+	std::vector<float> _x, _y, _z, _radius;
+
+	void growArrays(int capacity);
+	void computeBlockBounds(int block, D3DXVECTOR3* bmin, D3DXVECTOR3* bmax) const;
+	int* testGroups(
+		const Frustum& frustum, DWORD planeMask, bool coherent,
+		int begin, int numGroups, int* out);
+};
+
+// Boxes are stored as center and half extents, which is what the plane
+// test needs.
+class BoxCullSet : public CullSet
+{
+public:
+	int  add(const d3d::BoundingBox& box);
+	void set(int index, const d3d::BoundingBox& box);
+
+private:
+	std::vector<float> _cx, _cy, _cz;
+	std::vector<float> _ex, _ey, _ez;
+
+	void growArrays(int capacity);
+	void computeBlockBounds(int block, D3DXVECTOR3* bmin, D3DXVECTOR3* bmax) const;
+	int* testGroups(
+		const Frustum& frustum, DWORD planeMask, bool coherent,
+		int begin, int numGroups, int* out);
+};
+
+//
+// Headless benchmark: numObjects spheres and as many boxes laid out in
+// spatial order on a large grid, culled while the camera turns.
+//
+
+struct FrustumCullBenchmark
+{
+	int   numObjects;
+	float sphereMs;      // average cull, all features on
+	float boxMs;
+	float flatSphereMs;  // without hierarchy or coherence
+	float flatBoxMs;
+	float scalarMs;      // Frustum::isVisible over the spheres
+	float visibleRatio;
+	bool  matches;       // batched and scalar results agree
+};
+
+bool BenchmarkFrustumCulling(int numObjects, int numFrames, FrustumCullBenchmark* result);
+
+#endif // __frustumCullH__
@@ -0,0 +1,971 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: aabbTree.cpp
+//
+// Desc: Dynamic AABB tree.  See aabbTree.h.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "aabbTree.h"
+#include <cstdlib>
+#include <cmath>
+#include <xmmintrin.h>
+
+namespace
+{
+	// How many entries ahead updateBatch's loops prefetch.
+	const int PrefetchDistance = 16;
+
+	float SurfaceArea(const D3DXVECTOR3& bmin, const D3DXVECTOR3& bmax)
+	{
+		D3DXVECTOR3 d = bmax - bmin;
+		return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	void Union(
+		D3DXVECTOR3* bmin, D3DXVECTOR3* bmax,
+		const D3DXVECTOR3& amin, const D3DXVECTOR3& amax,
+		const D3DXVECTOR3& cmin, const D3DXVECTOR3& cmax)
+	{
+		bmin->x = amin.x < cmin.x ? amin.x : cmin.x;
+		bmin->y = amin.y < cmin.y ? amin.y : cmin.y;
+		bmin->z = amin.z < cmin.z ? amin.z : cmin.z;
+		bmax->x = amax.x > cmax.x ? amax.x : cmax.x;
+		bmax->y = amax.y > cmax.y ? amax.y : cmax.y;
+		bmax->z = amax.z > cmax.z ? amax.z : cmax.z;
+	}
+
+	float UnionArea(
+		const D3DXVECTOR3& amin, const D3DXVECTOR3& amax,
+		const D3DXVECTOR3& cmin, const D3DXVECTOR3& cmax)
+	{
+		D3DXVECTOR3 bmin, bmax;
+		Union(&bmin, &bmax, amin, amax, cmin, cmax);
+		return SurfaceArea(bmin, bmax);
+	}
+
+	bool Contains(
+		const D3DXVECTOR3& outerMin, const D3DXVECTOR3& outerMax,
+		const D3DXVECTOR3& innerMin, const D3DXVECTOR3& innerMax)
+	{
+		return outerMin.x <= innerMin.x && outerMin.y <= innerMin.y && outerMin.z <= innerMin.z &&
+		       outerMax.x >= innerMax.x && outerMax.y >= innerMax.y && outerMax.z >= innerMax.z;
+	}
+
+	// Box enlarged by margin, then stretched in the direction of travel.
+	void Enlarge(
+		D3DXVECTOR3& bmin, D3DXVECTOR3& bmax,
+		const d3d::BoundingBox& box, float margin, const D3DXVECTOR3* displacement)
+	{
+		bmin = box._min - D3DXVECTOR3(margin, margin, margin);
+		bmax = box._max + D3DXVECTOR3(margin, margin, margin);
+
+		if( !displacement )
+			return;
+
+		if( displacement->x < 0.0f ) bmin.x += displacement->x; else bmax.x += displacement->x;
+		if( displacement->y < 0.0f ) bmin.y += displacement->y; else bmax.y += displacement->y;
+		if( displacement->z < 0.0f ) bmin.z += displacement->z; else bmax.z += displacement->z;
+	}
+
+	bool Overlaps(
+		const D3DXVECTOR3& amin, const D3DXVECTOR3& amax,
+		const D3DXVECTOR3& bmin, const D3DXVECTOR3& bmax)
+	{
+		return amin.x <= bmax.x && amax.x >= bmin.x &&
+		       amin.y <= bmax.y && amax.y >= bmin.y &&
+		       amin.z <= bmax.z && amax.z >= bmin.z;
+	}
+
+	double Now()
+	{
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+	}
+
+	float Random(float lo, float hi)
+	{
+		return lo + (hi - lo) * (float)rand() / (float)RAND_MAX;
+	}
+}
+
+AABBTreeStats::AABBTreeStats()
+{
+	numObjects  = 0;
+	numNodes    = 0;
+	height      = 0;
+	surfaceArea = 0.0f;
+	refitNodes  = 0;
+	rotations   = 0;
+}
+
+AABBTree::AABBTree(float margin)
+{
+	_root          = -1;
+	_freeList      = -1;
+	_freeProxies   = -1;
+	_numObjects    = 0;
+	_margin        = margin;
+	_stamp         = 0;
+	_lastRefit     = 0;
+	_lastRotations = 0;
+}
+
+AABBTree::~AABBTree()
+{
+}
+
+int AABBTree::allocateNode()
+{
+	int node = _freeList;
+	if( node == -1 )
+	{
+		node = (int)_nodes.size();
+		_nodes.resize(_nodes.size() + 1);
+		_links.resize(_links.size() + 1);
+	}
+	else
+	{
+		_freeList = _links[node].parent;
+	}
+
+	Node& n    = _nodes[node];
+	n.child1   = -1;
+	n.child2   = -1;
+	n.userData = 0;
+
+	Link& link  = _links[node];
+	link.parent = -1;
+	link.height = 0;
+	link.stamp  = 0;
+
+	return node;
+}
+
+void AABBTree::freeNode(int node)
+{
+	_links[node].parent = _freeList;
+	_links[node].height = -1;
+	_freeList = node;
+}
+
+int AABBTree::insert(const d3d::BoundingBox& box, void* userData)
+{
+	int proxy = _freeProxies;
+	if( proxy == -1 )
+	{
+		proxy = (int)_proxies.size();
+		_proxies.resize(_proxies.size() + 1);
+	}
+	else
+	{
+		_freeProxies = _proxies[proxy].leaf;
+	}
+
+	int leaf = allocateNode();
+
+	D3DXVECTOR3 margin(_margin, _margin, _margin);
+
+	Node& n    = _nodes[leaf];
+	n.bmin     = box._min - margin;
+	n.bmax     = box._max + margin;
+	n.child1   = proxy;
+	n.userData = userData;
+
+	Proxy& p = _proxies[proxy];
+	p.bmin   = n.bmin;
+	p.bmax   = n.bmax;
+	p.leaf   = leaf;
+
+	insertLeaf(leaf);
+	_numObjects++;
+
+	return proxy;
+}
+
+void AABBTree::remove(int proxy)
+{
+	int leaf = _proxies[proxy].leaf;
+	removeLeaf(leaf);
+	freeNode(leaf);
+
+	_proxies[proxy].leaf = _freeProxies;
+	_freeProxies = proxy;
+	_numObjects--;
+}
+
+bool AABBTree::move(int proxy, const d3d::BoundingBox& box, const D3DXVECTOR3& displacement)
+{
+	Proxy& p = _proxies[proxy];
+	if( Contains(p.bmin, p.bmax, box._min, box._max) )
+		return false;
+
+	removeLeaf(p.leaf);
+
+	Enlarge(p.bmin, p.bmax, box, _margin, &displacement);
+	_nodes[p.leaf].bmin = p.bmin;
+	_nodes[p.leaf].bmax = p.bmax;
+	insertLeaf(p.leaf);
+
+	return true;
+}
+
+void AABBTree::getFatBox(int proxy, d3d::BoundingBox* box) const
+{
+	box->_min = _proxies[proxy].bmin;
+	box->_max = _proxies[proxy].bmax;
+}
+
+void AABBTree::insertLeaf(int leaf)
+{
+	if( _root == -1 )
+	{
+		_root = leaf;
+		_links[leaf].parent = -1;
+		return;
+	}
+
+	//
+	// Walk down to the best sibling: at each node, compare the cost of
+	// pairing with the node itself against descending into either child.
+	// Every node on the way grows by the leaf, which is the inherited cost.
+	//
+
+	D3DXVECTOR3 leafMin = _nodes[leaf].bmin;
+	D3DXVECTOR3 leafMax = _nodes[leaf].bmax;
+
+	int index = _root;
+	while( !isLeaf(index) )
+	{
+		const Node& n = _nodes[index];
+
+		float area         = SurfaceArea(n.bmin, n.bmax);
+		float combinedArea = UnionArea(n.bmin, n.bmax, leafMin, leafMax);
+
+		float cost        = 2.0f * combinedArea;
+		float inheritance = 2.0f * (combinedArea - area);
+
+		float childCost[2];
+		int   children[2] = { n.child1, n.child2 };
+		for(int i = 0; i < 2; i++)
+		{
+			const Node& c = _nodes[children[i]];
+			float grown = UnionArea(c.bmin, c.bmax, leafMin, leafMax);
+			childCost[i] = isLeaf(children[i]) ? grown + inheritance : grown - SurfaceArea(c.bmin, c.bmax) + inheritance;
+		}
+
+		if( cost < childCost[0] && cost < childCost[1] )
+			break;
+
+		index = childCost[0] < childCost[1] ? children[0] : children[1];
+	}
+
+	int sibling   = index;
+	int oldParent = _links[sibling].parent;
+	int newParent = allocateNode();
+
+	Node& p = _nodes[newParent];
+	p.child1 = sibling;
+	p.child2 = leaf;
+	_links[newParent].parent = oldParent;
+	_links[newParent].height = _links[sibling].height + 1;
+	Union(&p.bmin, &p.bmax, _nodes[sibling].bmin, _nodes[sibling].bmax, leafMin, leafMax);
+
+	if( oldParent != -1 )
+	{
+		if( _nodes[oldParent].child1 == sibling )
+			_nodes[oldParent].child1 = newParent;
+		else
+			_nodes[oldParent].child2 = newParent;
+	}
+	else
+	{
+		_root = newParent;
+	}
+
+	_links[sibling].parent = newParent;
+	_links[leaf].parent    = newParent;
+
+	// back up the tree fixing heights and boxes
+	index = _links[leaf].parent;
+	while( index != -1 )
+	{
+		index = balance(index);
+		refit(index);
+		index = _links[index].parent;
+	}
+}
+
+void AABBTree::removeLeaf(int leaf)
+{
+	if( leaf == _root )
+	{
+		_root = -1;
+		return;
+	}
+
+	int parent      = _links[leaf].parent;
+	int grandParent = _links[parent].parent;
+	int sibling     = _nodes[parent].child1 == leaf ? _nodes[parent].child2 : _nodes[parent].child1;
+
+	if( grandParent != -1 )
+	{
+		// the sibling takes the parent's place
+		if( _nodes[grandParent].child1 == parent )
+			_nodes[grandParent].child1 = sibling;
+		else
+			_nodes[grandParent].child2 = sibling;
+
+		_links[sibling].parent = grandParent;
+		freeNode(parent);
+
+		int index = grandParent;
+		while( index != -1 )
+		{
+			index = balance(index);
+			refit(index);
+			index = _links[index].parent;
+		}
+	}
+	else
+	{
+		_root = sibling;
+		_links[sibling].parent = -1;
+		freeNode(parent);
+	}
+}
+
+void AABBTree::refit(int node)
+{
+	Node& n = _nodes[node];
+	const Node& c1 = _nodes[n.child1];
+	const Node& c2 = _nodes[n.child2];
+
+	Union(&n.bmin, &n.bmax, c1.bmin, c1.bmax, c2.bmin, c2.bmax);
+
+	int h1 = _links[n.child1].height;
+	int h2 = _links[n.child2].height;
+	_links[node].height = 1 + (h1 > h2 ? h1 : h2);
+}
+
+//
+// AVL style rotation used by insert and remove: if one child of A is two
+// levels taller than the other, promote it.  Returns the node now at A's
+// position.
+//
+
+int AABBTree::balance(int iA)
+{
+	if( isLeaf(iA) || _links[iA].height < 2 )
+		return iA;
+
+	int iB = _nodes[iA].child1;
+	int iC = _nodes[iA].child2;
+
+	int heightDiff = _links[iC].height - _links[iB].height;
+
+	if( heightDiff > 1 || heightDiff < -1 )
+	{
+		// the taller child moves up, A takes its place
+		bool promoteC = heightDiff > 1;
+		int  iUp      = promoteC ? iC : iB;
+
+		int iF = _nodes[iUp].child1;
+		int iG = _nodes[iUp].child2;
+
+		_nodes[iUp].child1 = iA;
+		_links[iUp].parent = _links[iA].parent;
+		_links[iA].parent  = iUp;
+
+		int upParent = _links[iUp].parent;
+		if( upParent != -1 )
+		{
+			if( _nodes[upParent].child1 == iA )
+				_nodes[upParent].child1 = iUp;
+			else
+				_nodes[upParent].child2 = iUp;
+		}
+		else
+		{
+			_root = iUp;
+		}
+
+		// the taller grandchild stays with the promoted node
+		int iKeep = _links[iF].height > _links[iG].height ? iF : iG;
+		int iMove = iKeep == iF ? iG : iF;
+
+		_nodes[iUp].child2 = iKeep;
+
+		if( promoteC )
+			_nodes[iA].child2 = iMove;
+		else
+			_nodes[iA].child1 = iMove;
+		_links[iMove].parent = iA;
+
+		refit(iA);
+		refit(iUp);
+
+		return iUp;
+	}
+
+	return iA;
+}
+
+//
+// Surface area rotation used by updateBatch: swap one of the node's children
+// with one of the other child's children if that shrinks the child that
+// receives the swapped node.  Returns true if a rotation was made.
+//
+
+bool AABBTree::rotate(int node)
+{
+	int children[2] = { _nodes[node].child1, _nodes[node].child2 };
+
+	float bestGain  = 0.0f;
+	int   bestMove  = -1;  // child of node that moves down
+	int   bestInner = -1;  // the internal child it moves into
+	int   bestSwap  = -1;  // grandchild that moves up
+
+	for(int i = 0; i < 2; i++)
+	{
+		int inner = children[i];
+		int other = children[1 - i];
+		if( isLeaf(inner) )
+			continue;
+
+		const Node& in = _nodes[inner];
+		float area = SurfaceArea(in.bmin, in.bmax);
+
+		int grandChildren[2] = { in.child1, in.child2 };
+		for(int j = 0; j < 2; j++)
+		{
+			// other swaps with grandChildren[j]: inner becomes other + the remaining grandchild
+			const Node& keep = _nodes[grandChildren[1 - j]];
+			const Node& o    = _nodes[other];
+
+			float gain = area - UnionArea(keep.bmin, keep.bmax, o.bmin, o.bmax);
+			if( gain > bestGain )
+			{
+				bestGain  = gain;
+				bestMove  = other;
+				bestInner = inner;
+				bestSwap  = grandChildren[j];
+			}
+		}
+	}
+
+	if( bestMove == -1 )
+		return false;
+
+	// node: bestMove <-> bestSwap
+	if( _nodes[node].child1 == bestMove )
+		_nodes[node].child1 = bestSwap;
+	else
+		_nodes[node].child2 = bestSwap;
+	_links[bestSwap].parent = node;
+
+	if( _nodes[bestInner].child1 == bestSwap )
+		_nodes[bestInner].child1 = bestMove;
+	else
+		_nodes[bestInner].child2 = bestMove;
+	_links[bestMove].parent = bestInner;
+
+	refit(bestInner);
+	refit(node);
+
+	return true;
+}
+
+void AABBTree::updateBatch(
+	const int* proxies, const d3d::BoundingBox* boxes, const D3DXVECTOR3* displacements,
+	int count, bool rotate)
+{
+	_stamp++;
+	_dirty.clear();
+	_level.clear();
+	_lastRotations = 0;
+
+	//
+	// Enlarge the leaves that escaped.  The packed boxes make this a stream
+	// through two arrays for the usual caller that passes every proxy in
+	// order.
+	//
+
+	for(int i = 0; i < count; i++)
+	{
+		if( i + PrefetchDistance < count )
+			_mm_prefetch((const char*)&_proxies[proxies[i + PrefetchDistance]], _MM_HINT_T0);
+
+		Proxy& p = _proxies[proxies[i]];
+		if( Contains(p.bmin, p.bmax, boxes[i]._min, boxes[i]._max) )
+			continue;
+
+		Enlarge(p.bmin, p.bmax, boxes[i], _margin, displacements ? &displacements[i] : 0);
+		_nodes[p.leaf].bmin = p.bmin;
+		_nodes[p.leaf].bmax = p.bmax;
+		_level.push_back(p.leaf);
+	}
+
+	//
+	// Collect their ancestors once each, a level at a time, so the parent
+	// links of a whole level can be prefetched instead of chased one walk
+	// after another.  A stamped node's ancestors are already collected.
+	//
+
+	int maxHeight = 0;
+	while( !_level.empty() )
+	{
+		_nextLevel.clear();
+
+		int n = (int)_level.size();
+		for(int i = 0; i < n; i++)
+		{
+			if( i + PrefetchDistance < n && _level[i + PrefetchDistance] != -1 )
+				_mm_prefetch((const char*)&_links[_level[i + PrefetchDistance]], _MM_HINT_T0);
+
+			int index = _level[i];
+			if( index == -1 || _links[index].stamp == _stamp )
+				continue;
+
+			Link& link = _links[index];
+			link.stamp = _stamp;
+			if( link.height > 0 )
+			{
+				_dirty.push_back(index);
+				if( link.height > maxHeight )
+					maxHeight = link.height;
+			}
+
+			_nextLevel.push_back(link.parent);
+		}
+
+		_level.swap(_nextLevel);
+	}
+
+	_lastRefit = (int)_dirty.size();
+	if( _dirty.empty() )
+		return;
+
+	//
+	// Refit children before parents: counting sort by height.
+	//
+
+	_offsets.assign(maxHeight + 2, 0);
+	for(int i = 0; i < (int)_dirty.size(); i++)
+		_offsets[_links[_dirty[i]].height + 1]++;
+	for(int h = 1; h < (int)_offsets.size(); h++)
+		_offsets[h] += _offsets[h - 1];
+
+	_order.resize(_dirty.size());
+	for(int i = 0; i < (int)_dirty.size(); i++)
+		_order[_offsets[_links[_dirty[i]].height]++] = _dirty[i];
+
+	// Two stages of prefetch: a node well ahead, then the children of the
+	// node whose own line has arrived by now.
+	int n = (int)_order.size();
+	for(int i = 0; i < n; i++)
+	{
+		if( i + 2 * PrefetchDistance < n )
+			_mm_prefetch((const char*)&_nodes[_order[i + 2 * PrefetchDistance]], _MM_HINT_T0);
+
+		if( i + PrefetchDistance < n )
+		{
+			const Node& ahead = _nodes[_order[i + PrefetchDistance]];
+			_mm_prefetch((const char*)&_nodes[ahead.child1], _MM_HINT_T0);
+			_mm_prefetch((const char*)&_nodes[ahead.child2], _MM_HINT_T0);
+			_mm_prefetch((const char*)&_links[ahead.child1], _MM_HINT_T0);
+			_mm_prefetch((const char*)&_links[ahead.child2], _MM_HINT_T0);
+		}
+
+		refit(_order[i]);
+
+		if( rotate && _links[_order[i]].height >= 2 && this->rotate(_order[i]) )
+			_lastRotations++;
+	}
+}
+
+void AABBTree::queryBox(const d3d::BoundingBox& box, std::vector<int>& proxies) const
+{
+	if( _root == -1 )
+		return;
+
+	std::vector<int> stack;
+	stack.reserve(64);
+	stack.push_back(_root);
+
+	while( !stack.empty() )
+	{
+		int index = stack.back();
+		stack.pop_back();
+
+		const Node& n = _nodes[index];
+		if( !Overlaps(n.bmin, n.bmax, box._min, box._max) )
+			continue;
+
+		if( isLeaf(index) )
+		{
+			proxies.push_back(n.child1);
+		}
+		else
+		{
+			stack.push_back(n.child1);
+			stack.push_back(n.child2);
+		}
+	}
+}
+
+void AABBTree::querySphere(const d3d::BoundingSphere& sphere, std::vector<int>& proxies) const
+{
+	if( _root == -1 )
+		return;
+
+	const D3DXVECTOR3& c = sphere._center;
+	float radiusSq = sphere._radius * sphere._radius;
+
+	std::vector<int> stack;
+	stack.reserve(64);
+	stack.push_back(_root);
+
+	while( !stack.empty() )
+	{
+		int index = stack.back();
+		stack.pop_back();
+
+		// squared distance from the center to the box
+		const Node& n = _nodes[index];
+		float distSq = 0.0f;
+		for(int a = 0; a < 3; a++)
+		{
+			if( c[a] < n.bmin[a] )
+				distSq += (n.bmin[a] - c[a]) * (n.bmin[a] - c[a]);
+			else if( c[a] > n.bmax[a] )
+				distSq += (c[a] - n.bmax[a]) * (c[a] - n.bmax[a]);
+		}
+
+		if( distSq > radiusSq )
+			continue;
+
+		if( isLeaf(index) )
+		{
+			proxies.push_back(n.child1);
+		}
+		else
+		{
+			stack.push_back(n.child1);
+			stack.push_back(n.child2);
+		}
+	}
+}
+
+void AABBTree::queryRay(const d3d::Ray& ray, float maxDist, std::vector<int>& proxies) const
+{
+	if( _root == -1 )
+		return;
+
+	const D3DXVECTOR3& o = ray._origin;
+	const D3DXVECTOR3& d = ray._direction;
+
+	// a zero component gets a huge, finite reciprocal
+	float inv[3];
+	for(int a = 0; a < 3; a++)
+		inv[a] = d[a] != 0.0f ? 1.0f / d[a] : FLT_MAX;
+
+	std::vector<int> stack;
+	stack.reserve(64);
+	stack.push_back(_root);
+
+	while( !stack.empty() )
+	{
+		int index = stack.back();
+		stack.pop_back();
+
+		const Node& n = _nodes[index];
+
+		float tmin = 0.0f;
+		float tmax = maxDist;
+		for(int a = 0; a < 3 && tmin <= tmax; a++)
+		{
+			float t1 = (n.bmin[a] - o[a]) * inv[a];
+			float t2 = (n.bmax[a] - o[a]) * inv[a];
+			if( t1 > t2 )
+			{
+				float temp = t1;
+				t1 = t2;
+				t2 = temp;
+			}
+
+			tmin = t1 > tmin ? t1 : tmin;
+			tmax = t2 < tmax ? t2 : tmax;
+		}
+
+		if( tmin > tmax )
+			continue;
+
+		if( isLeaf(index) )
+		{
+			proxies.push_back(n.child1);
+		}
+		else
+		{
+			stack.push_back(n.child1);
+			stack.push_back(n.child2);
+		}
+	}
+}
+
+void AABBTree::queryFrustum(const D3DXPLANE planes[6], std::vector<int>& proxies) const
+{
+	if( _root == -1 )
+		return;
+
+	// Each entry carries a bit per plane the node is still straddling; a
+	// node inside every plane takes its whole subtree without more tests.
+	std::vector<std::pair<int, int> > stack;
+	stack.reserve(64);
+	stack.push_back(std::make_pair(_root, 0x3f));
+
+	while( !stack.empty() )
+	{
+		int index = stack.back().first;
+		int mask  = stack.back().second;
+		stack.pop_back();
+
+		const Node& n = _nodes[index];
+
+		bool outside = false;
+		for(int p = 0; p < 6 && !outside; p++)
+		{
+			if( !(mask & (1 << p)) )
+				continue;
+
+			const D3DXPLANE& plane = planes[p];
+
+			// the corners furthest along and against the normal
+			D3DXVECTOR3 pos(
+				plane.a >= 0.0f ? n.bmax.x : n.bmin.x,
+				plane.b >= 0.0f ? n.bmax.y : n.bmin.y,
+				plane.c >= 0.0f ? n.bmax.z : n.bmin.z);
+			D3DXVECTOR3 neg(
+				plane.a >= 0.0f ? n.bmin.x : n.bmax.x,
+				plane.b >= 0.0f ? n.bmin.y : n.bmax.y,
+				plane.c >= 0.0f ? n.bmin.z : n.bmax.z);
+
+			if( D3DXPlaneDotCoord(&plane, &pos) < 0.0f )
+				outside = true;
+			else if( D3DXPlaneDotCoord(&plane, &neg) >= 0.0f )
+				mask &= ~(1 << p);
+		}
+
+		if( outside )
+			continue;
+
+		if( isLeaf(index) )
+		{
+			proxies.push_back(n.child1);
+		}
+		else
+		{
+			stack.push_back(std::make_pair(n.child1, mask));
+			stack.push_back(std::make_pair(n.child2, mask));
+		}
+	}
+}
+
+AABBTreeStats AABBTree::getStats() const
+{
+	AABBTreeStats stats;
+	stats.numObjects = _numObjects;
+	stats.height     = _root != -1 ? _links[_root].height : 0;
+	stats.refitNodes = _lastRefit;
+	stats.rotations  = _lastRotations;
+
+	for(int i = 0; i < (int)_nodes.size(); i++)
+	{
+		if( _links[i].height < 0 )
+			continue;
+
+		stats.numNodes++;
+		if( !isLeaf(i) )
+			stats.surfaceArea += SurfaceArea(_nodes[i].bmin, _nodes[i].bmax);
+	}
+
+	return stats;
+}
+
+bool AABBTree::validate() const
+{
+	if( _root == -1 )
+		return _numObjects == 0;
+
+	if( _links[_root].parent != -1 )
+		return false;
+
+	int numLeaves = 0;
+
+	std::vector<int> stack;
+	stack.push_back(_root);
+	while( !stack.empty() )
+	{
+		int index = stack.back();
+		stack.pop_back();
+
+		const Node& n = _nodes[index];
+		const Link& link = _links[index];
+		if( link.height < 0 )
+			return false;
+
+		if( isLeaf(index) )
+		{
+			if( link.height != 0 || _proxies[n.child1].leaf != index ||
+				!Contains(_proxies[n.child1].bmin, _proxies[n.child1].bmax, n.bmin, n.bmax) ||
+				!Contains(n.bmin, n.bmax, _proxies[n.child1].bmin, _proxies[n.child1].bmax) )
+				return false;
+			numLeaves++;
+			continue;
+		}
+
+		const Node& c1 = _nodes[n.child1];
+		const Node& c2 = _nodes[n.child2];
+		const Link& l1 = _links[n.child1];
+		const Link& l2 = _links[n.child2];
+
+		if( l1.parent != index || l2.parent != index )
+			return false;
+
+		if( link.height != 1 + (l1.height > l2.height ? l1.height : l2.height) )
+			return false;
+
+		if( !Contains(n.bmin, n.bmax, c1.bmin, c1.bmax) || !Contains(n.bmin, n.bmax, c2.bmin, c2.bmax) )
+			return false;
+
+		stack.push_back(n.child1);
+		stack.push_back(n.child2);
+	}
+
+	return numLeaves == _numObjects;
+}
+
+void ComputeFrustumPlanes(D3DXPLANE planes[6], const D3DXMATRIX* viewProj)
+{
+	const D3DXMATRIX& m = *viewProj;
+
+	// left, right, bottom, top, near, far; clip space z runs from 0 to 1
+	planes[0] = D3DXPLANE(m._14 + m._11, m._24 + m._21, m._34 + m._31, m._44 + m._41);
+	planes[1] = D3DXPLANE(m._14 - m._11, m._24 - m._21, m._34 - m._31, m._44 - m._41);
+	planes[2] = D3DXPLANE(m._14 + m._12, m._24 + m._22, m._34 + m._32, m._44 + m._42);
+	planes[3] = D3DXPLANE(m._14 - m._12, m._24 - m._22, m._34 - m._32, m._44 - m._42);
+	planes[4] = D3DXPLANE(m._13,         m._23,         m._33,         m._43);
+	planes[5] = D3DXPLANE(m._14 - m._13, m._24 - m._23, m._34 - m._33, m._44 - m._43);
+
+	for(int i = 0; i < 6; i++)
+		D3DXPlaneNormalize(&planes[i], &planes[i]);
+}
+
+bool BenchmarkAABBTree(int numObjects, int numFrames, int rotateInterval, AABBTreeBenchmark* result)
+{
+	if( numObjects <= 0 || numFrames <= 0 || !result )
+		return false;
+
+	// unit boxes spread so that about one in eight of the space is filled
+	float extent = powf((float)numObjects * 8.0f, 1.0f / 3.0f) * 0.5f;
+	const float dt = 1.0f / 60.0f;
+
+	std::vector<d3d::BoundingBox> boxes(numObjects);
+	std::vector<D3DXVECTOR3>      velocities(numObjects);
+	std::vector<D3DXVECTOR3>      displacements(numObjects);
+	std::vector<int>              proxies(numObjects);
+
+	AABBTree tree(0.1f);
+
+	double start = Now();
+	for(int i = 0; i < numObjects; i++)
+	{
+		D3DXVECTOR3 p(Random(-extent, extent), Random(-extent, extent), Random(-extent, extent));
+		boxes[i]._min = p - D3DXVECTOR3(0.5f, 0.5f, 0.5f);
+		boxes[i]._max = p + D3DXVECTOR3(0.5f, 0.5f, 0.5f);
+		velocities[i] = D3DXVECTOR3(Random(-1.0f, 1.0f), Random(-1.0f, 1.0f), Random(-1.0f, 1.0f));
+
+		proxies[i] = tree.insert(boxes[i], 0);
+	}
+	result->buildMs = (float)(Now() - start);
+
+	double updateMs = 0.0;
+	double worstMs  = 0.0;
+	double queryMs  = 0.0;
+	int    found    = 0;
+
+	std::vector<int> hits;
+
+	D3DXMATRIX view, proj;
+	D3DXVECTOR3 eye(0.0f, 0.0f, -extent * 2.0f), at(0.0f, 0.0f, 0.0f), up(0.0f, 1.0f, 0.0f);
+	D3DXMatrixLookAtLH(&view, &eye, &at, &up);
+	D3DXMatrixPerspectiveFovLH(&proj, D3DX_PI * 0.25f, 4.0f / 3.0f, 1.0f, extent * 4.0f);
+
+	D3DXMATRIX viewProj = view * proj;
+	D3DXPLANE planes[6];
+	ComputeFrustumPlanes(planes, &viewProj);
+
+	for(int frame = 0; frame < numFrames; frame++)
+	{
+		// move, bouncing off the walls
+		for(int i = 0; i < numObjects; i++)
+		{
+			D3DXVECTOR3 step = velocities[i] * dt;
+			boxes[i]._min += step;
+			boxes[i]._max += step;
+
+			for(int a = 0; a < 3; a++)
+			{
+				if( (boxes[i]._min[a] < -extent && velocities[i][a] < 0.0f) ||
+					(boxes[i]._max[a] >  extent && velocities[i][a] > 0.0f) )
+					velocities[i][a] = -velocities[i][a];
+			}
+
+			// stretch escaped boxes over the next few frames of travel
+			displacements[i] = velocities[i] * (dt * 8.0f);
+		}
+
+		bool rotate = rotateInterval > 0 && frame % rotateInterval == 0;
+
+		start = Now();
+		tree.updateBatch(&proxies[0], &boxes[0], &displacements[0], numObjects, rotate);
+		double frameMs = Now() - start;
+		updateMs += frameMs;
+		worstMs   = frameMs > worstMs ? frameMs : worstMs;
+
+		// one of each query, roughly the size a game would use
+		start = Now();
+
+		d3d::BoundingBox box;
+		box._min = D3DXVECTOR3(-5.0f, -5.0f, -5.0f);
+		box._max = D3DXVECTOR3( 5.0f,  5.0f,  5.0f);
+
+		d3d::BoundingSphere sphere;
+		sphere._center = D3DXVECTOR3(extent * 0.5f, 0.0f, 0.0f);
+		sphere._radius = 5.0f;
+
+		d3d::Ray ray;
+		ray._origin    = eye;
+		ray._direction = D3DXVECTOR3(0.0f, 0.0f, 1.0f);
+
+		hits.clear();
+		tree.queryBox(box, hits);
+		tree.querySphere(sphere, hits);
+		tree.queryRay(ray, extent * 4.0f, hits);
+		tree.queryFrustum(planes, hits);
+		found += (int)hits.size();
+
+		queryMs += Now() - start;
+	}
+
+	result->numObjects = numObjects;
+	result->numFrames  = numFrames;
+	result->updateMs   = (float)(updateMs / numFrames);
+	result->worstMs    = (float)worstMs;
+	result->queryMs    = (float)(queryMs / numFrames / 4.0);
+	result->height     = tree.getStats().height;
+
+	return tree.validate() && found > 0;
+}
@@ -0,0 +1,155 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: aabbTree.h
+//
+// Desc: Dynamic AABB tree for scenes of moving objects.  Each object is a leaf
+//       holding its box enlarged by a margin, so small moves do not touch the
+//       tree at all.  Single objects are moved by reinsertion; large batches
+//       are refit in place bottom-up and the refit nodes can be improved with
+//       tree rotations.  Batches are memory bound, so the enlarged boxes are
+//       also kept packed by proxy, and the walks up the tree go a level at a
+//       time with the next nodes prefetched.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __aabbTreeH__
+#define __aabbTreeH__
+
+#include "d3dUtility.h"
+#include <vector>
+
+struct AABBTreeStats
+{
+	AABBTreeStats();
+
+	int   numObjects;
+	int   numNodes;
+	int   height;
+	float surfaceArea;   // sum over the internal nodes, lower is better
+	int   refitNodes;    // by the last updateBatch
+	int   rotations;     // by the last updateBatch
+};
+
+class AABBTree
+{
+public:
+	AABBTree(float margin); // boxes are enlarged by margin on every side
+	~AABBTree();
+
+	// Returns the proxy that identifies the object from now on.
+	int  insert(const d3d::BoundingBox& box, void* userData);
+	void remove(int proxy);
+
+	// Reinserts the object if its box left the enlarged box.  displacement
+	// is how far it will move next frame, the enlarged box is stretched that
+	// way.  Returns true if the tree changed.
+	bool move(int proxy, const d3d::BoundingBox& box, const D3DXVECTOR3& displacement);
+
+	// Moves many objects at once.  Leaves whose box escaped are enlarged in
+	// place, stretched by displacements like move() when it is not null, and
+	// their ancestors refit in a single bottom-up pass; with rotate set, every
+	// refit node also tries the rotation that most reduces its children's
+	// surface area.
+	void updateBatch(
+		const int* proxies, const d3d::BoundingBox* boxes, const D3DXVECTOR3* displacements,
+		int count, bool rotate);
+
+	// Queries append the proxies whose enlarged boxes pass the test; callers
+	// that need exact results test their own volumes afterwards.
+	void queryBox(const d3d::BoundingBox& box, std::vector<int>& proxies) const;
+	void querySphere(const d3d::BoundingSphere& sphere, std::vector<int>& proxies) const;
+	void queryRay(const d3d::Ray& ray, float maxDist, std::vector<int>& proxies) const;
+
+	// The planes' normals point into the frustum.
+	void queryFrustum(const D3DXPLANE planes[6], std::vector<int>& proxies) const;
+
+	void* getUserData(int proxy) const { return _nodes[_proxies[proxy].leaf].userData; }
+	void  getFatBox(int proxy, d3d::BoundingBox* box) const;
+
+	AABBTreeStats getStats() const;
+	bool validate() const;
+
+private:
+	// What queries read.
+	struct Node
+	{
+		D3DXVECTOR3 bmin;
+		D3DXVECTOR3 bmax;
+		int   child1;    // the proxy, for leaves
+		int   child2;    // -1 for leaves
+		void* userData;
+	};
+
+	// What the walks up the tree read, kept apart so they chase pointers
+	// through a small array.
+	struct Link
+	{
+		int   parent;    // next free node while on the free list
+		int   height;    // leaves are 0, free nodes -1
+		DWORD stamp;     // last updateBatch that walked through this node
+	};
+
+	// What updateBatch's escape test reads: a copy of the leaf's box, in
+	// proxy order rather than spread among the internal nodes.
+	struct Proxy
+	{
+		D3DXVECTOR3 bmin;
+		D3DXVECTOR3 bmax;
+		int   leaf;      // next free proxy while on the free list
+	};
+
+	std::vector<Node>  _nodes;
+	std::vector<Link>  _links;
+	std::vector<Proxy> _proxies;
+	int   _root;
+	int   _freeList;
+	int   _freeProxies;
+	int   _numObjects;
+	float _margin;
+	DWORD _stamp;
+
+	int   _lastRefit;
+	int   _lastRotations;
+
+	// scratch for updateBatch
+	std::vector<int> _dirty;
+	std::vector<int> _level;
+	std::vector<int> _nextLevel;
+	std::vector<int> _order;
+	std::vector<int> _offsets;
+
+	int  allocateNode();
+	void freeNode(int node);
+	void insertLeaf(int leaf);
+	void removeLeaf(int leaf);
+	int  balance(int node);
+	bool rotate(int node);
+	void refit(int node);
+
+	bool isLeaf(int node) const { return _nodes[node].child2 == -1; }
+};
+
+// Extracts the view frustum from a view * projection matrix, normals inward.
+void ComputeFrustumPlanes(D3DXPLANE planes[6], const D3DXMATRIX* viewProj);
+
+//
+// Headless benchmark: numObjects boxes wander around a cube, and every frame
+// all of them are updated with updateBatch, rotating the tree every
+// rotateInterval frames (0 never rotates).
+//
+
+struct AABBTreeBenchmark
+{
+	int   numObjects;
+	int   numFrames;
+	float buildMs;      // inserting all objects
+	float updateMs;     // average updateBatch
+	float worstMs;      // slowest updateBatch: the frames where many boxes
+	                    // escape at once
+	float queryMs;      // average of one box, sphere, ray and frustum query
+	int   height;
+};
+
+bool BenchmarkAABBTree(int numObjects, int numFrames, int rotateInterval, AABBTreeBenchmark* result);
+
+#endif // __aabbTreeH__
@@ -0,0 +1,677 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: meshBvh.cpp
+//
+// Desc: Triangle bounding volume hierarchy.  See meshBvh.h.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "meshBvh.h"
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <limits>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+namespace
+{
+	const int   NumBins     = 16;
+	const DWORD MinLeafSize = 4;   // one packet
+	const DWORD MaxLeafSize = 16;
+	const int   MaxDepth    = 64;  // also the traversal stack size
+
+	float SurfaceArea(const D3DXVECTOR3& bmin, const D3DXVECTOR3& bmax)
+	{
+		D3DXVECTOR3 d = bmax - bmin;
+		return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	void Grow(D3DXVECTOR3& bmin, D3DXVECTOR3& bmax, const D3DXVECTOR3& pmin, const D3DXVECTOR3& pmax)
+	{
+		// written as selects so they compile to minss/maxss, not branches
+		bmin.x = pmin.x < bmin.x ? pmin.x : bmin.x;
+		bmin.y = pmin.y < bmin.y ? pmin.y : bmin.y;
+		bmin.z = pmin.z < bmin.z ? pmin.z : bmin.z;
+		bmax.x = pmax.x > bmax.x ? pmax.x : bmax.x;
+		bmax.y = pmax.y > bmax.y ? pmax.y : bmax.y;
+		bmax.z = pmax.z > bmax.z ? pmax.z : bmax.z;
+	}
+
+	double Now()
+	{
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+	}
+}
+
+//
+// A subtree small enough to hand to a worker thread.  Workers build into
+// their own node list which is spliced into the tree afterwards.
+//
+
+struct MeshBVH::BuildTask
+{
+	DWORD node;
+	DWORD begin;
+	DWORD end;
+	int   depth;
+	std::vector<Node> nodes;
+};
+
+BVHStats::BVHStats()
+{
+	numTriangles = 0;
+	numNodes     = 0;
+	numLeaves    = 0;
+	maxDepth     = 0;
+	numThreads   = 0;
+	buildMs      = 0.0f;
+}
+
+MeshBVH::MeshBVH()
+{
+}
+
+bool MeshBVH::build(ID3DXMesh* mesh, int numThreads)
+{
+	if( !mesh )
+		return false;
+
+	BYTE* vertices = 0;
+	void* indices  = 0;
+
+	if( FAILED(mesh->LockVertexBuffer(D3DLOCK_READONLY, (void**)&vertices)) )
+		return false;
+
+	if( FAILED(mesh->LockIndexBuffer(D3DLOCK_READONLY, &indices)) )
+	{
+		mesh->UnlockVertexBuffer();
+		return false;
+	}
+
+	bool result = build(
+		vertices,
+		mesh->GetNumBytesPerVertex(),
+		mesh->GetNumVertices(),
+		indices,
+		(mesh->GetOptions() & D3DXMESH_32BIT) != 0,
+		mesh->GetNumFaces(),
+		numThreads);
+
+	mesh->UnlockIndexBuffer();
+	mesh->UnlockVertexBuffer();
+
+	return result;
+}
+
+bool MeshBVH::build(
+	const BYTE* vertices,
+	DWORD stride,
+	DWORD numVertices,
+	const void* indices,
+	bool indices32,
+	DWORD numFaces,
+	int numThreads)
+{
+	_nodes.clear();
+	_packets.clear();
+	_stats = BVHStats();
+
+	if( !vertices || !indices || numFaces == 0 )
+		return false;
+
+	double start = Now();
+
+	if( numThreads <= 0 )
+		numThreads = (int)std::thread::hardware_concurrency();
+	if( numThreads <= 0 )
+		numThreads = 1;
+
+	//
+	// Copy out the positions and indices, then precompute each triangle's box
+	// and centroid; the builder touches nothing else.
+	//
+
+	_positions.resize(numVertices);
+	for(DWORD i = 0; i < numVertices; i++)
+		_positions[i] = *(const D3DXVECTOR3*)(vertices + i * stride);
+
+	_faces.resize(numFaces * 3);
+	for(DWORD i = 0; i < numFaces * 3; i++)
+	{
+		_faces[i] = indices32 ? ((const DWORD*)indices)[i] : ((const WORD*)indices)[i];
+		if( _faces[i] >= numVertices )
+			return false;
+	}
+
+	_refs.resize(numFaces);
+
+	for(DWORD i = 0; i < numFaces; i++)
+	{
+		const D3DXVECTOR3& a = _positions[_faces[i * 3]];
+		const D3DXVECTOR3& b = _positions[_faces[i * 3 + 1]];
+		const D3DXVECTOR3& c = _positions[_faces[i * 3 + 2]];
+
+		BuildRef& ref = _refs[i];
+		ref.bmin = a;
+		ref.bmax = a;
+		Grow(ref.bmin, ref.bmax, b, b);
+		Grow(ref.bmin, ref.bmax, c, c);
+
+		ref.centroid = (ref.bmin + ref.bmax) * 0.5f;
+		ref.face     = i;
+	}
+
+	//
+	// Build the top of the tree on this thread.  Once a node is small enough
+	// it becomes a task, and the tasks are built in parallel.
+	//
+
+	std::vector<BuildTask> tasks;
+
+	DWORD taskSize = numFaces / (numThreads * 8);
+	if( taskSize < 1024 )
+		taskSize = 1024;
+
+	_nodes.reserve(numFaces / 2 + 1);
+	_nodes.resize(1);
+	buildNode(_nodes, 0, 0, numFaces, 0, taskSize, numThreads > 1 ? &tasks : 0);
+
+	if( !tasks.empty() )
+	{
+		std::atomic<int> nextTask(0);
+		std::vector<std::thread> workers;
+
+		int numWorkers = std::min(numThreads, (int)tasks.size());
+		for(int i = 0; i < numWorkers; i++)
+		{
+			workers.push_back(std::thread([this, &tasks, &nextTask]()
+			{
+				for(;;)
+				{
+					int t = nextTask++;
+					if( t >= (int)tasks.size() )
+						break;
+
+					BuildTask& task = tasks[t];
+					task.nodes.resize(1);
+					buildNode(task.nodes, 0, task.begin, task.end, task.depth, 0, 0);
+				}
+			}));
+		}
+
+		for(int i = 0; i < (int)workers.size(); i++)
+			workers[i].join();
+
+		//
+		// Splice: a task's root replaces its placeholder, the rest are
+		// appended.  Children are allocated in pairs and never at local
+		// index 0, so local index i simply moves to offset + i - 1.
+		//
+
+		for(int t = 0; t < (int)tasks.size(); t++)
+		{
+			std::vector<Node>& local = tasks[t].nodes;
+			DWORD offset = (DWORD)_nodes.size();
+
+			for(DWORD i = 0; i < local.size(); i++)
+			{
+				if( local[i].count == 0 )
+					local[i].first += offset - 1;
+			}
+
+			_nodes[tasks[t].node] = local[0];
+			_nodes.insert(_nodes.end(), local.begin() + 1, local.end());
+		}
+	}
+
+	packLeaves();
+
+	//
+	// Stats, and free the build data.
+	//
+
+	_stats.numTriangles = numFaces;
+	_stats.numNodes     = (int)_nodes.size();
+	_stats.numThreads   = numThreads;
+
+	std::vector<std::pair<DWORD, int> > stack;
+	stack.push_back(std::make_pair(0, 1));
+	while( !stack.empty() )
+	{
+		DWORD node  = stack.back().first;
+		int   depth = stack.back().second;
+		stack.pop_back();
+
+		_stats.maxDepth = std::max(_stats.maxDepth, depth);
+
+		if( _nodes[node].count > 0 )
+		{
+			_stats.numLeaves++;
+		}
+		else
+		{
+			stack.push_back(std::make_pair(_nodes[node].first,     depth + 1));
+			stack.push_back(std::make_pair(_nodes[node].first + 1, depth + 1));
+		}
+	}
+
+	std::vector<D3DXVECTOR3>().swap(_positions);
+	std::vector<DWORD>().swap(_faces);
+	std::vector<BuildRef>().swap(_refs);
+
+	_stats.buildMs = (float)(Now() - start);
+
+	return true;
+}
+
+void MeshBVH::buildNode(
+	std::vector<Node>& nodes,
+	DWORD node,
+	DWORD begin,
+	DWORD end,
+	int depth,
+	DWORD taskSize,
+	std::vector<BuildTask>* tasks)
+{
+	// the node's box and the box of the centroids, in one pass
+	D3DXVECTOR3 bmin = _refs[begin].bmin;
+	D3DXVECTOR3 bmax = _refs[begin].bmax;
+	D3DXVECTOR3 cmin = _refs[begin].centroid;
+	D3DXVECTOR3 cmax = cmin;
+	for(DWORD i = begin + 1; i < end; i++)
+	{
+		Grow(bmin, bmax, _refs[i].bmin, _refs[i].bmax);
+		Grow(cmin, cmax, _refs[i].centroid, _refs[i].centroid);
+	}
+
+	Node& n = nodes[node];
+	n.bmin[0] = bmin.x; n.bmin[1] = bmin.y; n.bmin[2] = bmin.z;
+	n.bmax[0] = bmax.x; n.bmax[1] = bmax.y; n.bmax[2] = bmax.z;
+
+	// until packLeaves runs a leaf refers to a range of _refs
+	n.first = begin;
+	n.count = end - begin;
+
+	DWORD count = end - begin;
+	if( count <= MinLeafSize || depth >= MaxDepth - 1 )
+		return;
+
+	if( tasks && count <= taskSize )
+	{
+		BuildTask task;
+		task.node  = node;
+		task.begin = begin;
+		task.end   = end;
+		task.depth = depth;
+		tasks->push_back(task);
+		return;
+	}
+
+	int   axis     = 0;
+	float position = 0.0f;
+	DWORD mid      = begin;
+
+	if( findSplit(begin, end, bmin, bmax, cmin, cmax, &axis, &position) )
+	{
+		mid = (DWORD)(std::partition(_refs.begin() + begin, _refs.begin() + end,
+			[axis, position](const BuildRef& r) { return r.centroid[axis] < position; }) - _refs.begin());
+	}
+	else if( count <= MaxLeafSize )
+	{
+		return;
+	}
+
+	// everything landed on one side (coincident centroids): split in half
+	if( mid == begin || mid == end )
+		mid = begin + count / 2;
+
+	DWORD left = (DWORD)nodes.size();
+	nodes.resize(left + 2);
+
+	nodes[node].first = left;
+	nodes[node].count = 0;
+
+	buildNode(nodes, left,     begin, mid, depth + 1, taskSize, tasks);
+	buildNode(nodes, left + 1, mid,   end, depth + 1, taskSize, tasks);
+}
+
+bool MeshBVH::findSplit(
+	DWORD begin,
+	DWORD end,
+	const D3DXVECTOR3& bmin,
+	const D3DXVECTOR3& bmax,
+	const D3DXVECTOR3& cmin,
+	const D3DXVECTOR3& cmax,
+	int* axis,
+	float* position)
+{
+	struct Bin
+	{
+		D3DXVECTOR3 bmin, bmax;
+		DWORD count;
+	};
+
+	//
+	// Bin the centroids along all three axes in a single pass.
+	//
+
+	Bin   bins[3][NumBins];
+	float scale[3];
+
+	for(int a = 0; a < 3; a++)
+	{
+		float extent = cmax[a] - cmin[a];
+		scale[a] = extent > 0.0f ? (float)NumBins / extent : 0.0f;
+
+		for(int b = 0; b < NumBins; b++)
+		{
+			bins[a][b].bmin  = D3DXVECTOR3( FLT_MAX,  FLT_MAX,  FLT_MAX);
+			bins[a][b].bmax  = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			bins[a][b].count = 0;
+		}
+	}
+
+	for(DWORD i = begin; i < end; i++)
+	{
+		const BuildRef& r = _refs[i];
+		for(int a = 0; a < 3; a++)
+		{
+			int b = (int)((r.centroid[a] - cmin[a]) * scale[a]);
+			b = b < NumBins - 1 ? b : NumBins - 1;
+
+			Grow(bins[a][b].bmin, bins[a][b].bmax, r.bmin, r.bmax);
+			bins[a][b].count++;
+		}
+	}
+
+	//
+	// Evaluate every plane between bins: sweep from the right to get the
+	// right hand sides, then from the left.
+	//
+
+	DWORD count    = end - begin;
+	float leafCost = (float)count * SurfaceArea(bmin, bmax);
+	float bestCost = std::numeric_limits<float>::max();
+
+	for(int a = 0; a < 3; a++)
+	{
+		if( scale[a] == 0.0f )
+			continue;
+
+		float rightArea[NumBins - 1];
+		DWORD rightCount[NumBins - 1];
+
+		D3DXVECTOR3 rmin( FLT_MAX,  FLT_MAX,  FLT_MAX);
+		D3DXVECTOR3 rmax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		DWORD rcount = 0;
+		for(int b = NumBins - 1; b > 0; b--)
+		{
+			Grow(rmin, rmax, bins[a][b].bmin, bins[a][b].bmax);
+			rcount += bins[a][b].count;
+			rightArea[b - 1]  = rcount ? SurfaceArea(rmin, rmax) : 0.0f;
+			rightCount[b - 1] = rcount;
+		}
+
+		D3DXVECTOR3 lmin( FLT_MAX,  FLT_MAX,  FLT_MAX);
+		D3DXVECTOR3 lmax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		DWORD lcount = 0;
+		for(int b = 0; b < NumBins - 1; b++)
+		{
+			Grow(lmin, lmax, bins[a][b].bmin, bins[a][b].bmax);
+			lcount += bins[a][b].count;
+
+			if( lcount == 0 || rightCount[b] == 0 )
+				continue;
+
+			float cost = (float)lcount * SurfaceArea(lmin, lmax) + (float)rightCount[b] * rightArea[b];
+			if( cost < bestCost )
+			{
+				bestCost  = cost;
+				*axis     = a;
+				*position = cmin[a] + (float)(b + 1) / scale[a];
+			}
+		}
+	}
+
+	if( bestCost == std::numeric_limits<float>::max() )
+		return false;
+
+	// one traversal step costs about as much as a triangle test
+	return bestCost + SurfaceArea(bmin, bmax) < leafCost || count > MaxLeafSize;
+}
+
+void MeshBVH::packLeaves()
+{
+	for(DWORD i = 0; i < _nodes.size(); i++)
+	{
+		Node& n = _nodes[i];
+		if( n.count == 0 )
+			continue;
+
+		DWORD first      = n.first;
+		DWORD count      = n.count;
+		DWORD numPackets = (count + 3) / 4;
+
+		n.first = (DWORD)_packets.size();
+		n.count = numPackets;
+
+		for(DWORD p = 0; p < numPackets; p++)
+		{
+			TrianglePacket packet;
+			::ZeroMemory(&packet, sizeof(packet));
+
+			for(DWORD k = 0; k < 4; k++)
+			{
+				DWORD j = p * 4 + k;
+				if( j >= count )
+				{
+					// zero edges give a zero determinant, which never hits
+					packet.face[k] = 0xffffffff;
+					continue;
+				}
+
+				DWORD t = _refs[first + j].face;
+				const D3DXVECTOR3& a = _positions[_faces[t * 3]];
+				const D3DXVECTOR3& b = _positions[_faces[t * 3 + 1]];
+				const D3DXVECTOR3& c = _positions[_faces[t * 3 + 2]];
+
+				packet.v0x[k] = a.x;       packet.v0y[k] = a.y;       packet.v0z[k] = a.z;
+				packet.e1x[k] = b.x - a.x; packet.e1y[k] = b.y - a.y; packet.e1z[k] = b.z - a.z;
+				packet.e2x[k] = c.x - a.x; packet.e2y[k] = c.y - a.y; packet.e2z[k] = c.z - a.z;
+				packet.face[k] = t;
+			}
+
+			_packets.push_back(packet);
+		}
+	}
+}
+
+bool MeshBVH::intersect(const d3d::Ray& ray, BVHHit* hit) const
+{
+	if( _nodes.empty() )
+		return false;
+
+	const D3DXVECTOR3& o = ray._origin;
+	const D3DXVECTOR3& d = ray._direction;
+
+	// a zero component gives a huge reciprocal, which the slab test handles
+	float inv[3];
+	for(int a = 0; a < 3; a++)
+		inv[a] = d[a] != 0.0f ? 1.0f / d[a] : (d[a] < 0.0f ? -FLT_MAX : FLT_MAX);
+
+	__m128 ox = _mm_set1_ps(o.x), oy = _mm_set1_ps(o.y), oz = _mm_set1_ps(o.z);
+	__m128 dx = _mm_set1_ps(d.x), dy = _mm_set1_ps(d.y), dz = _mm_set1_ps(d.z);
+	__m128 zero    = _mm_setzero_ps();
+	__m128 one     = _mm_set1_ps(1.0f);
+	__m128 epsilon = _mm_set1_ps(1e-12f);
+	__m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+	float closest = FLT_MAX;
+	DWORD face    = 0xffffffff;
+	float hitU    = 0.0f;
+	float hitV    = 0.0f;
+
+	// slab test against a node's box, returns the entry distance
+	struct Slab
+	{
+		static bool test(const Node& n, const D3DXVECTOR3& o, const float* inv, float tmax, float* tEntry)
+		{
+			float tmin = 0.0f;
+			for(int a = 0; a < 3; a++)
+			{
+				float t0 = (n.bmin[a] - o[a]) * inv[a];
+				float t1 = (n.bmax[a] - o[a]) * inv[a];
+				if( t0 > t1 )
+					std::swap(t0, t1);
+
+				tmin = t0 > tmin ? t0 : tmin;
+				tmax = t1 < tmax ? t1 : tmax;
+				if( tmin > tmax )
+					return false;
+			}
+
+			*tEntry = tmin;
+			return true;
+		}
+	};
+
+	float entry = 0.0f;
+	if( !Slab::test(_nodes[0], o, inv, closest, &entry) )
+		return false;
+
+	DWORD stack[MaxDepth];
+	int   top  = 0;
+	DWORD node = 0;
+
+	for(;;)
+	{
+		const Node& n = _nodes[node];
+
+		if( n.count > 0 )
+		{
+			//
+			// Moller-Trumbore against four triangles at a time.
+			//
+
+			for(DWORD p = n.first; p < n.first + n.count; p++)
+			{
+				const TrianglePacket& tri = _packets[p];
+
+				__m128 e1x = _mm_loadu_ps(tri.e1x), e1y = _mm_loadu_ps(tri.e1y), e1z = _mm_loadu_ps(tri.e1z);
+				__m128 e2x = _mm_loadu_ps(tri.e2x), e2y = _mm_loadu_ps(tri.e2y), e2z = _mm_loadu_ps(tri.e2z);
+
+				// p = d x e2
+				__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+				__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+				__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+				__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+				__m128 invDet = _mm_div_ps(one, det);
+
+				// s = o - v0
+				__m128 sx = _mm_sub_ps(ox, _mm_loadu_ps(tri.v0x));
+				__m128 sy = _mm_sub_ps(oy, _mm_loadu_ps(tri.v0y));
+				__m128 sz = _mm_sub_ps(oz, _mm_loadu_ps(tri.v0z));
+
+				__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+				// q = s x e1
+				__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+				__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+				__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+
+				__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+				__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+				__m128 mask = _mm_cmpgt_ps(_mm_and_ps(det, absMask), epsilon);
+				mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+				mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+				mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+				mask = _mm_and_ps(mask, _mm_cmpge_ps(t, zero));
+				mask = _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_set1_ps(closest)));
+
+				int bits = _mm_movemask_ps(mask);
+				if( bits == 0 )
+					continue;
+
+				float ts[4], us[4], vs[4];
+				_mm_storeu_ps(ts, t);
+				_mm_storeu_ps(us, u);
+				_mm_storeu_ps(vs, v);
+
+				for(int k = 0; k < 4; k++)
+				{
+					if( (bits & (1 << k)) && ts[k] < closest )
+					{
+						closest = ts[k];
+						hitU    = us[k];
+						hitV    = vs[k];
+						face    = tri.face[k];
+					}
+				}
+			}
+		}
+		else
+		{
+			//
+			// Visit the nearer child first and push the other.
+			//
+
+			DWORD left  = n.first;
+			DWORD right = n.first + 1;
+
+			float tLeft = 0.0f, tRight = 0.0f;
+			bool hitLeft  = Slab::test(_nodes[left],  o, inv, closest, &tLeft);
+			bool hitRight = Slab::test(_nodes[right], o, inv, closest, &tRight);
+
+			if( hitLeft && hitRight )
+			{
+				if( tRight < tLeft )
+					std::swap(left, right);
+
+				stack[top++] = right;
+				node = left;
+				continue;
+			}
+
+			if( hitLeft )
+			{
+				node = left;
+				continue;
+			}
+
+			if( hitRight )
+			{
+				node = right;
+				continue;
+			}
+		}
+
+		// pop, skipping nodes that are now further than the closest hit
+		for(;;)
+		{
+			if( top == 0 )
+			{
+				if( face == 0xffffffff )
+					return false;
+
+				if( hit )
+				{
+					hit->t    = closest;
+					hit->u    = hitU;
+					hit->v    = hitV;
+					hit->face = face;
+				}
+				return true;
+			}
+
+			node = stack[--top];
+			if( Slab::test(_nodes[node], o, inv, closest, &entry) )
+				break;
+		}
+	}
+}
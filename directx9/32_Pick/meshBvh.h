@@ -0,0 +1,123 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: meshBvh.h
+//
+// Desc: Triangle bounding volume hierarchy for picking meshes.  Built with a
+//       binned surface area heuristic, with the subtrees split across threads.
+//       Leaves store their triangles four at a time so a ray is tested
+//       against four triangles at once with SSE.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __meshBvhH__
+#define __meshBvhH__
+
+#include "d3dUtility.h"
+#include <vector>
+
+struct BVHHit
+{
+	float t;    // distance along the ray
+	float u, v; // barycentrics of the hit, relative to the face's second and third vertex
+	DWORD face; // face index in the source mesh
+};
+
+struct BVHStats
+{
+	BVHStats();
+
+	int   numTriangles;
+	int   numNodes;
+	int   numLeaves;
+	int   maxDepth;
+	int   numThreads;
+	float buildMs;
+};
+
+class MeshBVH
+{
+public:
+	MeshBVH();
+
+	// Builds from the mesh's vertex and index buffers.  The position must be
+	// the first element of the vertex.  numThreads = 0 uses one thread per
+	// hardware thread.
+	bool build(ID3DXMesh* mesh, int numThreads);
+
+	bool build(
+		const BYTE* vertices,
+		DWORD stride,
+		DWORD numVertices,
+		const void* indices,
+		bool indices32,
+		DWORD numFaces,
+		int numThreads);
+
+	// The ray must be in the mesh's local space.  The direction need not be
+	// normalized; t is in units of its length.  Returns the closest hit.
+	bool intersect(const d3d::Ray& ray, BVHHit* hit) const;
+
+	const BVHStats& getStats() const { return _stats; }
+
+private:
+	struct Node
+	{
+		float bmin[3];
+		DWORD first;   // inner node: left child, the right child follows it
+		               // leaf: first triangle packet
+		float bmax[3];
+		DWORD count;   // leaf: number of packets, 0 for inner nodes
+	};
+
+	// Four triangles in structure of arrays form, as the intersection kernel
+	// wants them: a vertex and the two edges leaving it.
+	struct TrianglePacket
+	{
+		float v0x[4], v0y[4], v0z[4];
+		float e1x[4], e1y[4], e1z[4];
+		float e2x[4], e2y[4], e2z[4];
+		DWORD face[4];   // 0xffffffff pads a partly filled packet
+	};
+
+	// a triangle's box and centroid, partitioned in place while building
+	struct BuildRef
+	{
+		D3DXVECTOR3 bmin;
+		D3DXVECTOR3 bmax;
+		D3DXVECTOR3 centroid;
+		DWORD       face;
+	};
+
+	struct BuildTask;
+
+	std::vector<Node>           _nodes;
+	std::vector<TrianglePacket> _packets;
+	BVHStats                    _stats;
+
+	// build time only
+	std::vector<D3DXVECTOR3> _positions;
+	std::vector<DWORD>       _faces;     // 3 per triangle
+	std::vector<BuildRef>    _refs;      // leaves own ranges of it
+
+	void buildNode(
+		std::vector<Node>& nodes,
+		DWORD node,
+		DWORD begin,
+		DWORD end,
+		int depth,
+		DWORD taskSize,
+		std::vector<BuildTask>* tasks);
+
+	bool findSplit(
+		DWORD begin,
+		DWORD end,
+		const D3DXVECTOR3& bmin,
+		const D3DXVECTOR3& bmax,
+		const D3DXVECTOR3& cmin,
+		const D3DXVECTOR3& cmax,
+		int* axis,
+		float* position);
+	void packLeaves();
+};
+
+#endif // __meshBvhH__
@@ -6,11 +6,22 @@
 //
 // System: AMD Athlon 1800+ XP, 512 DDR, Geforce 3, Windows XP, MSVC++ 7.0 
 //
-// Desc: Demonstrates picking.
+// Desc: Demonstrates picking.  The bounding sphere rejects rays that miss
+//       the teapot entirely, then a triangle BVH finds the face that was hit.
+//       Run with -benchmark, the sample instead times the BVH on bigship1.x,
+//       the packet ray tests against the scalar ones, the scene tree and the
+//       pick service, writes the results to the debugger output and quits.
+//       Clicks are turned into rays by a PickService that reads the camera
+//       state once per frame.
 //          
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "d3dUtility.h"
+#include "aabbTree.h"
+#include "meshBvh.h"
+#include "rayPackets.h"
+#include "pickService.h"
+#include <cstdio>
 
 //
 // Globals
@@ -26,31 +37,12 @@ ID3DXMesh* Sphere = 0;
 
 D3DXMATRIX World;
 d3d::BoundingSphere BSphere;
+MeshBVH TeapotBVH;
+PickService Picker;
 
 //
 // Functions
 //
-d3d::Ray CalcPickingRay(int x, int y)
-{
-	float px = 0.0f;
-	float py = 0.0f;
-
-	D3DVIEWPORT9 vp;
-	Device->GetViewport(&vp);
-
-	D3DXMATRIX proj;
-	Device->GetTransform(D3DTS_PROJECTION, &proj);
-
-	px = ((( 2.0f*x) / vp.Width)  - 1.0f) / proj(0, 0);
-	py = (((-2.0f*y) / vp.Height) + 1.0f) / proj(1, 1);
-
-	d3d::Ray ray;
-	ray._origin    = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
-	ray._direction = D3DXVECTOR3(px, py, 1.0f);
-
-	return ray;
-}
-
 void TransformRay(d3d::Ray* ray, D3DXMATRIX* T)
 {
 	// transform the ray's origin, w = 1.
@@ -95,6 +87,212 @@ bool RaySphereIntTest(d3d::Ray* ray, d3d::BoundingSphere* sphere)
 	return false;
 }
 
+double GetMilliseconds()
+{
+	LARGE_INTEGER count, frequency;
+	::QueryPerformanceCounter(&count);
+	::QueryPerformanceFrequency(&frequency);
+	return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+}
+
+//
+// Builds a BVH for bigship1.x with one thread and with all of them, then
+// times random rays fired at the ship's bounding box.
+//
+void BenchmarkBVH()
+{
+	ID3DXMesh* ship = 0;
+	HRESULT hr = D3DXLoadMeshFromX("bigship1.x", D3DXMESH_MANAGED, Device, 0, 0, 0, 0, &ship);
+	if( FAILED(hr) )
+		return;
+
+	MeshBVH bvh;
+	bvh.build(ship, 1);
+	float serialMs = bvh.getStats().buildMs;
+
+	bvh.build(ship, 0);
+	BVHStats stats = bvh.getStats();
+
+	d3d::BoundingBox box;
+	BYTE* v = 0;
+	ship->LockVertexBuffer(D3DLOCK_READONLY, (void**)&v);
+	D3DXComputeBoundingBox(
+		(D3DXVECTOR3*)v,
+		ship->GetNumVertices(),
+		D3DXGetFVFVertexSize(ship->GetFVF()),
+		&box._min,
+		&box._max);
+	ship->UnlockVertexBuffer();
+
+	d3d::Release<ID3DXMesh*>(ship);
+
+	// rays from a sphere around the ship towards random points inside its box
+	const int numRays = 100000;
+	std::vector<d3d::Ray> rays(numRays);
+
+	D3DXVECTOR3 center = (box._min + box._max) * 0.5f;
+	D3DXVECTOR3 extent = box._max - box._min;
+	float radius = D3DXVec3Length(&extent);
+
+	for(int i = 0; i < numRays; i++)
+	{
+		D3DXVECTOR3 dir(
+			(float)rand() / RAND_MAX - 0.5f,
+			(float)rand() / RAND_MAX - 0.5f,
+			(float)rand() / RAND_MAX - 0.5f);
+		D3DXVec3Normalize(&dir, &dir);
+
+		D3DXVECTOR3 target(
+			box._min.x + extent.x * (float)rand() / RAND_MAX,
+			box._min.y + extent.y * (float)rand() / RAND_MAX,
+			box._min.z + extent.z * (float)rand() / RAND_MAX);
+
+		rays[i]._origin = center + dir * radius;
+		rays[i]._direction = target - rays[i]._origin;
+		D3DXVec3Normalize(&rays[i]._direction, &rays[i]._direction);
+	}
+
+	int numHits = 0;
+	double start = GetMilliseconds();
+	for(int i = 0; i < numRays; i++)
+	{
+		BVHHit hit;
+		if( bvh.intersect(rays[i], &hit) )
+			numHits++;
+	}
+	double queryMs = GetMilliseconds() - start;
+
+	char report[512];
+	::sprintf(report,
+		"bigship1.x BVH: %d triangles, %d nodes, depth %d\n"
+		"  build %.2f ms on 1 thread, %.2f ms on %d threads\n"
+		"  %d rays, %d hits, %.3f us per ray\n",
+		stats.numTriangles, stats.numNodes, stats.maxDepth,
+		serialMs, stats.buildMs, stats.numThreads,
+		numRays, numHits, queryMs * 1000.0 / numRays);
+	::OutputDebugString(report);
+}
+
+//
+// Times one ray against 10000 boxes, as a selection or line of sight check
+// would, with the scalar test and with the packet kernels.
+//
+void BenchmarkRayPackets()
+{
+	const int numBoxes = 10000;
+	const int numRays  = 100;
+
+	std::vector<d3d::BoundingBox> boxes(numBoxes);
+	BoxSoA boxSoA;
+
+	for(int i = 0; i < numBoxes; i++)
+	{
+		D3DXVECTOR3 center(
+			(float)rand() / RAND_MAX * 200.0f - 100.0f,
+			(float)rand() / RAND_MAX * 200.0f - 100.0f,
+			(float)rand() / RAND_MAX * 200.0f - 100.0f);
+
+		boxes[i]._min = center - D3DXVECTOR3(1.0f, 1.0f, 1.0f);
+		boxes[i]._max = center + D3DXVECTOR3(1.0f, 1.0f, 1.0f);
+		boxSoA.add(boxes[i]);
+	}
+
+	std::vector<d3d::Ray> rays(numRays);
+	for(int i = 0; i < numRays; i++)
+	{
+		rays[i]._origin    = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+		rays[i]._direction = D3DXVECTOR3(
+			(float)rand() / RAND_MAX - 0.5f,
+			(float)rand() / RAND_MAX - 0.5f,
+			(float)rand() / RAND_MAX - 0.5f);
+		D3DXVec3Normalize(&rays[i]._direction, &rays[i]._direction);
+	}
+
+	int scalarHits = 0;
+	double start = GetMilliseconds();
+	for(int r = 0; r < numRays; r++)
+	{
+		for(int i = 0; i < numBoxes; i++)
+		{
+			float dist = 0.0f;
+			if( RayBoxIntTest(&rays[r], &boxes[i], &dist) )
+				scalarHits++;
+		}
+	}
+	double scalarMs = GetMilliseconds() - start;
+
+	std::vector<float> dists(numBoxes);
+
+	int packetHits = 0;
+	start = GetMilliseconds();
+	for(int r = 0; r < numRays; r++)
+		packetHits += RayBoxesIntTest(rays[r], boxSoA, FLT_MAX, &dists[0]);
+	double packetMs = GetMilliseconds() - start;
+
+	char report[256];
+	::sprintf(report,
+		"Ray vs %d boxes: scalar %.1f ns, packet %.1f ns per box (%d / %d hits)\n",
+		numBoxes,
+		scalarMs * 1e6 / ((double)numRays * numBoxes),
+		packetMs * 1e6 / ((double)numRays * numBoxes),
+		scalarHits, packetHits);
+	::OutputDebugString(report);
+}
+
+//
+// Moves 100000 boxes through a dynamic AABB tree, without rotations and with
+// a rotation pass every eighth frame.
+//
+void BenchmarkSceneTree()
+{
+	for(int pass = 0; pass < 2; pass++)
+	{
+		AABBTreeBenchmark result;
+		if( !BenchmarkAABBTree(100000, 120, pass * 8, &result) )
+			continue;
+
+		char report[256];
+		::sprintf(report,
+			"AABB tree, %d objects, rotate %s: build %.1f ms, update %.3f ms (worst %.3f ms), "
+			"queries %.3f ms, height %d\n",
+			result.numObjects, pass ? "every 8 frames" : "never",
+			result.buildMs, result.updateMs, result.worstMs, result.queryMs, result.height);
+		::OutputDebugString(report);
+	}
+}
+
+//
+// Converts 1000 clicks to rays the old way and with the pick service, and
+// times rectangle and lasso selection of 5000 objects.
+//
+void BenchmarkPicking()
+{
+	PickBenchmark result;
+	if( !BenchmarkPickService(5000, &result) )
+		return;
+
+	char report[256];
+	::sprintf(report,
+		"Pick service, %d objects: 1000 rays %.3f ms (per pick path %.3f ms), pick %.3f ms, "
+		"rect %.3f ms (%d), lasso %.3f ms (%d), %s\n",
+		result.numObjects, result.raysMs, result.scalarRaysMs, result.pickMs,
+		result.rectMs, result.rectSelected, result.lassoMs, result.lassoSelected,
+		result.matches ? "matches scalar" : "DIFFERS FROM scalar");
+	::OutputDebugString(report);
+}
+
+//
+// Run with -benchmark in place of the sample.  The BVH benchmark loads
+// bigship1.x, so this needs the device.
+//
+void Benchmark()
+{
+	BenchmarkBVH();
+	BenchmarkRayPackets();
+	BenchmarkSceneTree();
+	BenchmarkPicking();
+}
+
 //
 // Framework functions
 //
@@ -128,6 +326,16 @@ bool Setup()
 
 	D3DXCreateSphere(Device, BSphere._radius, 20, 20, &Sphere, 0);
 
+	//
+	// Build the triangle BVH used to find the face that was picked.
+	//
+
+	if( !TeapotBVH.build(Teapot, 0) )
+	{
+		::MessageBox(0, "MeshBVH::build() - FAILED", 0, 0);
+		return false;
+	}
+
 	//
 	// Set light.
 	//
@@ -209,6 +417,9 @@ bool Display(float timeDelta)
 		// Render
 		//
 
+		// the camera is set for this frame: cache it for the clicks
+		Picker.beginFrame(Device);
+
 		Device->Clear(0, 0, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, 0xffffffff, 1.0f, 0);
 		Device->BeginScene();
 
@@ -254,21 +465,34 @@ LRESULT CALLBACK d3d::WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 		break;
 	case WM_LBUTTONDOWN:
 
-		// compute the ray in view space given the clicked screen point
-		d3d::Ray ray = CalcPickingRay(LOWORD(lParam), HIWORD(lParam));
+		// the world space ray through the clicked screen point
+		d3d::Ray ray = Picker.getRay(LOWORD(lParam), HIWORD(lParam));
 
-		// transform the ray to world space
-		D3DXMATRIX view;
-		Device->GetTransform(D3DTS_VIEW, &view);
+		// test for a hit: the sphere is a cheap reject, then find the face
+		// with the ray in the teapot's local space
+		if( RaySphereIntTest(&ray, &BSphere) )
+		{
+			D3DXMATRIX worldInverse;
+			D3DXMatrixInverse(&worldInverse, 0, &World);
 
-		D3DXMATRIX viewInverse;
-		D3DXMatrixInverse(&viewInverse,	0, &view);
+			d3d::Ray localRay = ray;
+			TransformRay(&localRay, &worldInverse);
 
-		TransformRay(&ray, &viewInverse);
+			double start = GetMilliseconds();
 
-		// test for a hit
-		if( RaySphereIntTest(&ray, &BSphere) )
-			::MessageBox(0, "Hit!", "HIT", 0);
+			BVHHit hit;
+			bool picked = TeapotBVH.intersect(localRay, &hit);
+
+			double us = (GetMilliseconds() - start) * 1000.0;
+
+			if( picked )
+			{
+				char msg[256];
+				::sprintf(msg, "Hit face %d at distance %.2f, barycentrics (%.2f, %.2f) in %.2f us",
+					hit.face, hit.t, hit.u, hit.v, us);
+				::MessageBox(0, msg, "HIT", 0);
+			}
+		}
 
 		break;
 	}
@@ -289,6 +513,13 @@ int WINAPI WinMain(HINSTANCE hinstance,
 		::MessageBox(0, "InitD3D() - FAILED", 0, 0);
 		return 0;
 	}
+
+	if( d3d::FindSwitch(cmdLine, "-benchmark") )
+	{
+		Benchmark();
+		Device->Release();
+		return 0;
+	}
 		
 	if(!Setup())
 	{
@@ -0,0 +1,533 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: pickService.cpp
+//
+// Desc: Screen space picking and selection.  See pickService.h.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "pickService.h"
+#include <cmath>
+#include <cfloat>
+#include <cstdlib>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+namespace
+{
+	// Screen position of object i, times w, the way the selection kernels
+	// compute it: same operations in the same order, so the scalar tail and
+	// the vector lanes agree to the bit.
+	void ScreenPoint(const D3DXMATRIX& m, const SphereSoA& objects, int i, float* x, float* y, float* z, float* w)
+	{
+		float px = objects._x[i], py = objects._y[i], pz = objects._z[i];
+		*x = px * m._11 + py * m._21 + pz * m._31 + m._41;
+		*y = px * m._12 + py * m._22 + pz * m._32 + m._42;
+		*z = px * m._13 + py * m._23 + pz * m._33 + m._43;
+		*w = px * m._14 + py * m._24 + pz * m._34 + m._44;
+	}
+
+	// Four objects starting at i.
+	void ScreenPoints(const D3DXMATRIX& m, const SphereSoA& objects, int i, __m128* x, __m128* y, __m128* z, __m128* w)
+	{
+		__m128 px = _mm_loadu_ps(&objects._x[i]);
+		__m128 py = _mm_loadu_ps(&objects._y[i]);
+		__m128 pz = _mm_loadu_ps(&objects._z[i]);
+
+		*x = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(m._11)), _mm_mul_ps(py, _mm_set1_ps(m._21))), _mm_mul_ps(pz, _mm_set1_ps(m._31))), _mm_set1_ps(m._41));
+		*y = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(m._12)), _mm_mul_ps(py, _mm_set1_ps(m._22))), _mm_mul_ps(pz, _mm_set1_ps(m._32))), _mm_set1_ps(m._42));
+		*z = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(m._13)), _mm_mul_ps(py, _mm_set1_ps(m._23))), _mm_mul_ps(pz, _mm_set1_ps(m._33))), _mm_set1_ps(m._43));
+		*w = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(m._14)), _mm_mul_ps(py, _mm_set1_ps(m._24))), _mm_mul_ps(pz, _mm_set1_ps(m._34))), _mm_set1_ps(m._44));
+	}
+
+	// A lasso edge, set up for the even-odd crossing test.
+	struct LassoEdge
+	{
+		float x0, y0, y1;
+		float slope;  // dx / dy, unused for horizontal edges
+	};
+
+	double Now()
+	{
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+	}
+}
+
+PickService::PickService()
+{
+	D3DVIEWPORT9 viewport = { 0, 0, 1, 1, 0.0f, 1.0f };
+	D3DXMATRIX identity;
+	D3DXMatrixIdentity(&identity);
+	beginFrame(viewport, identity, identity);
+}
+
+void PickService::beginFrame(IDirect3DDevice9* device)
+{
+	D3DVIEWPORT9 viewport;
+	device->GetViewport(&viewport);
+
+	D3DXMATRIX view, proj;
+	device->GetTransform(D3DTS_VIEW, &view);
+	device->GetTransform(D3DTS_PROJECTION, &proj);
+
+	beginFrame(viewport, view, proj);
+}
+
+void PickService::beginFrame(const D3DVIEWPORT9& viewport, const D3DXMATRIX& view, const D3DXMATRIX& proj)
+{
+	_viewport = viewport;
+	_view     = view;
+	_proj     = proj;
+	D3DXMatrixInverse(&_viewInverse, 0, &_view);
+
+	float width  = (float)viewport.Width;
+	float height = (float)viewport.Height;
+
+	// px = ((2 (x - X) / Width) - 1) / proj(0, 0), and likewise for y
+	_scaleX  =  2.0f / (width * proj(0, 0));
+	_offsetX = (-2.0f * viewport.X / width - 1.0f) / proj(0, 0);
+	_scaleY  = -2.0f / (height * proj(1, 1));
+	_offsetY = ( 2.0f * viewport.Y / height + 1.0f) / proj(1, 1);
+
+	// clip space -> viewport pixels, still multiplied by w
+	D3DXMATRIX toViewport(
+		width * 0.5f,               0.0f,                         0.0f, 0.0f,
+		0.0f,                      -height * 0.5f,                0.0f, 0.0f,
+		0.0f,                       0.0f,                         1.0f, 0.0f,
+		viewport.X + width * 0.5f,  viewport.Y + height * 0.5f,   0.0f, 1.0f);
+
+	_screen = _view * _proj * toViewport;
+}
+
+d3d::Ray PickService::getRay(int x, int y) const
+{
+	D3DXVECTOR3 direction(x * _scaleX + _offsetX, y * _scaleY + _offsetY, 1.0f);
+
+	d3d::Ray ray;
+	ray._origin = D3DXVECTOR3(_viewInverse._41, _viewInverse._42, _viewInverse._43);
+	D3DXVec3TransformNormal(&ray._direction, &direction, &_viewInverse);
+	D3DXVec3Normalize(&ray._direction, &ray._direction);
+	return ray;
+}
+
+void PickService::getRays(const POINT* points, int count, d3d::Ray* rays) const
+{
+	D3DXVECTOR3 origin(_viewInverse._41, _viewInverse._42, _viewInverse._43);
+	const D3DXMATRIX& m = _viewInverse;
+
+	int i = 0;
+	for(; i + 4 <= count; i += 4)
+	{
+		__m128 x = _mm_setr_ps((float)points[i].x, (float)points[i + 1].x, (float)points[i + 2].x, (float)points[i + 3].x);
+		__m128 y = _mm_setr_ps((float)points[i].y, (float)points[i + 1].y, (float)points[i + 2].y, (float)points[i + 3].y);
+
+		// view space directions, z = 1
+		__m128 px = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(_scaleX)), _mm_set1_ps(_offsetX));
+		__m128 py = _mm_add_ps(_mm_mul_ps(y, _mm_set1_ps(_scaleY)), _mm_set1_ps(_offsetY));
+
+		// rotated into world space
+		__m128 dx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(m._11)), _mm_mul_ps(py, _mm_set1_ps(m._21))), _mm_set1_ps(m._31));
+		__m128 dy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(m._12)), _mm_mul_ps(py, _mm_set1_ps(m._22))), _mm_set1_ps(m._32));
+		__m128 dz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(m._13)), _mm_mul_ps(py, _mm_set1_ps(m._23))), _mm_set1_ps(m._33));
+
+		__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+		__m128 inv    = _mm_div_ps(_mm_set1_ps(1.0f), length);
+
+		float fx[4], fy[4], fz[4];
+		_mm_storeu_ps(fx, _mm_mul_ps(dx, inv));
+		_mm_storeu_ps(fy, _mm_mul_ps(dy, inv));
+		_mm_storeu_ps(fz, _mm_mul_ps(dz, inv));
+
+		for(int k = 0; k < 4; k++)
+		{
+			rays[i + k]._origin    = origin;
+			rays[i + k]._direction = D3DXVECTOR3(fx[k], fy[k], fz[k]);
+		}
+	}
+
+	for(; i < count; i++)
+		rays[i] = getRay(points[i].x, points[i].y);
+}
+
+int PickService::pick(const POINT* points, int count, const SphereSoA& objects, PickResult* results) const
+{
+	const int Chunk = 64;
+	d3d::Ray rays[Chunk];
+
+	int hits = 0;
+	for(int first = 0; first < count; first += Chunk)
+	{
+		int n = count - first < Chunk ? count - first : Chunk;
+		getRays(points + first, n, rays);
+
+		for(int i = 0; i < n; i++)
+		{
+			PickResult& result = results[first + i];
+			result.dist   = FLT_MAX;
+			result.object = RaySpheresNearest(rays[i], objects, FLT_MAX, &result.dist);
+			hits += result.object >= 0;
+		}
+	}
+	return hits;
+}
+
+int PickService::pick(const POINT* points, int count, const BoxSoA& objects, PickResult* results) const
+{
+	const int Chunk = 64;
+	d3d::Ray rays[Chunk];
+
+	int hits = 0;
+	for(int first = 0; first < count; first += Chunk)
+	{
+		int n = count - first < Chunk ? count - first : Chunk;
+		getRays(points + first, n, rays);
+
+		for(int i = 0; i < n; i++)
+		{
+			PickResult& result = results[first + i];
+			result.dist   = FLT_MAX;
+			result.object = RayBoxesNearest(rays[i], objects, FLT_MAX, &result.dist);
+			hits += result.object >= 0;
+		}
+	}
+	return hits;
+}
+
+int PickService::selectRect(const RECT& rect, const SphereSoA& objects, std::vector<int>& selected) const
+{
+	// inside when left <= x / w < right, which with w > 0 is
+	// left * w <= x < right * w: no division
+	float left = (float)rect.left, right = (float)rect.right;
+	float top  = (float)rect.top,  bottom = (float)rect.bottom;
+
+	__m128 vLeft = _mm_set1_ps(left), vRight  = _mm_set1_ps(right);
+	__m128 vTop  = _mm_set1_ps(top),  vBottom = _mm_set1_ps(bottom);
+	__m128 zero  = _mm_setzero_ps();
+
+	int n = objects.size();
+	int found = 0;
+
+	int i = 0;
+	for(; i + 4 <= n; i += 4)
+	{
+		__m128 x, y, z, w;
+		ScreenPoints(_screen, objects, i, &x, &y, &z, &w);
+
+		__m128 in = _mm_and_ps(_mm_cmpge_ps(z, zero), _mm_cmpgt_ps(w, zero));
+		in = _mm_and_ps(in, _mm_cmpge_ps(x, _mm_mul_ps(vLeft, w)));
+		in = _mm_and_ps(in, _mm_cmplt_ps(x, _mm_mul_ps(vRight, w)));
+		in = _mm_and_ps(in, _mm_cmpge_ps(y, _mm_mul_ps(vTop, w)));
+		in = _mm_and_ps(in, _mm_cmplt_ps(y, _mm_mul_ps(vBottom, w)));
+
+		int mask = _mm_movemask_ps(in);
+		for(int k = 0; mask; k++, mask >>= 1)
+		{
+			if( mask & 1 )
+			{
+				selected.push_back(i + k);
+				found++;
+			}
+		}
+	}
+
+	for(; i < n; i++)
+	{
+		float x, y, z, w;
+		ScreenPoint(_screen, objects, i, &x, &y, &z, &w);
+
+		if( z >= 0.0f && w > 0.0f &&
+			x >= left * w && x < right * w && y >= top * w && y < bottom * w )
+		{
+			selected.push_back(i);
+			found++;
+		}
+	}
+
+	return found;
+}
+
+int PickService::selectLasso(const POINT* lasso, int numPoints, const SphereSoA& objects, std::vector<int>& selected) const
+{
+	if( numPoints < 3 )
+		return 0;
+
+	//
+	// Edges for the crossing test, and the lasso's bounds to skip most of
+	// the objects with the rectangle test.
+	//
+
+	std::vector<LassoEdge> edges(numPoints);
+	float left = FLT_MAX, right = -FLT_MAX, top = FLT_MAX, bottom = -FLT_MAX;
+
+	for(int i = 0; i < numPoints; i++)
+	{
+		const POINT& a = lasso[i];
+		const POINT& b = lasso[(i + 1) % numPoints];
+
+		edges[i].x0 = (float)a.x;
+		edges[i].y0 = (float)a.y;
+		edges[i].y1 = (float)b.y;
+		edges[i].slope = a.y != b.y ? (float)(b.x - a.x) / (float)(b.y - a.y) : 0.0f;
+
+		left   = (float)a.x < left   ? (float)a.x : left;
+		right  = (float)a.x > right  ? (float)a.x : right;
+		top    = (float)a.y < top    ? (float)a.y : top;
+		bottom = (float)a.y > bottom ? (float)a.y : bottom;
+	}
+
+	__m128 vLeft = _mm_set1_ps(left), vRight  = _mm_set1_ps(right);
+	__m128 vTop  = _mm_set1_ps(top),  vBottom = _mm_set1_ps(bottom);
+	__m128 zero  = _mm_setzero_ps();
+
+	int n = objects.size();
+	int found = 0;
+
+	for(int i = 0; i < n; i += 4)
+	{
+		__m128 x, y, z, w;
+		int lanes = n - i < 4 ? n - i : 4;
+
+		if( lanes == 4 )
+			ScreenPoints(_screen, objects, i, &x, &y, &z, &w);
+		else
+		{
+			// the tail, padded with points behind the camera
+			float fx[4] = { 0, 0, 0, 0 }, fy[4] = { 0, 0, 0, 0 }, fz[4] = { -1, -1, -1, -1 }, fw[4] = { 0, 0, 0, 0 };
+			for(int k = 0; k < lanes; k++)
+				ScreenPoint(_screen, objects, i + k, &fx[k], &fy[k], &fz[k], &fw[k]);
+			x = _mm_loadu_ps(fx); y = _mm_loadu_ps(fy);
+			z = _mm_loadu_ps(fz); w = _mm_loadu_ps(fw);
+		}
+
+		__m128 in = _mm_and_ps(_mm_cmpge_ps(z, zero), _mm_cmpgt_ps(w, zero));
+		in = _mm_and_ps(in, _mm_cmpge_ps(x, _mm_mul_ps(vLeft, w)));
+		in = _mm_and_ps(in, _mm_cmple_ps(x, _mm_mul_ps(vRight, w)));
+		in = _mm_and_ps(in, _mm_cmpge_ps(y, _mm_mul_ps(vTop, w)));
+		in = _mm_and_ps(in, _mm_cmple_ps(y, _mm_mul_ps(vBottom, w)));
+
+		if( !_mm_movemask_ps(in) )
+			continue;
+
+		// The survivors are divided through and counted against the edges:
+		// a horizontal ray to the left crossing an odd number of edges
+		// starts inside.
+		__m128 invW = _mm_div_ps(_mm_set1_ps(1.0f), _mm_or_ps(_mm_and_ps(in, w), _mm_andnot_ps(in, _mm_set1_ps(1.0f))));
+		__m128 sx = _mm_mul_ps(x, invW);
+		__m128 sy = _mm_mul_ps(y, invW);
+
+		__m128 inside = _mm_setzero_ps();
+		for(int e = 0; e < numPoints; e++)
+		{
+			const LassoEdge& edge = edges[e];
+			__m128 y0 = _mm_set1_ps(edge.y0);
+
+			__m128 spans = _mm_xor_ps(_mm_cmpgt_ps(y0, sy), _mm_cmpgt_ps(_mm_set1_ps(edge.y1), sy));
+			__m128 cross = _mm_add_ps(_mm_set1_ps(edge.x0), _mm_mul_ps(_mm_sub_ps(sy, y0), _mm_set1_ps(edge.slope)));
+
+			inside = _mm_xor_ps(inside, _mm_and_ps(spans, _mm_cmplt_ps(sx, cross)));
+		}
+
+		int mask = _mm_movemask_ps(_mm_and_ps(in, inside));
+		for(int k = 0; mask; k++, mask >>= 1)
+		{
+			if( mask & 1 )
+			{
+				selected.push_back(i + k);
+				found++;
+			}
+		}
+	}
+
+	return found;
+}
+
+bool PickService::project(const D3DXVECTOR3& p, float* x, float* y) const
+{
+	D3DXVECTOR4 s;
+	D3DXVec3Transform(&s, &p, &_screen);
+	if( s.z < 0.0f || s.w <= 0.0f )
+		return false;
+
+	*x = s.x / s.w;
+	*y = s.y / s.w;
+	return true;
+}
+
+//
+// Benchmark
+//
+
+bool BenchmarkPickService(int numObjects, PickBenchmark* result)
+{
+	if( !result || numObjects <= 0 )
+		return false;
+
+	D3DVIEWPORT9 viewport = { 0, 0, 640, 480, 0.0f, 1.0f };
+
+	D3DXVECTOR3 eye(0.0f, 20.0f, -60.0f), at(0.0f, 0.0f, 0.0f), up(0.0f, 1.0f, 0.0f);
+	D3DXMATRIX view, proj;
+	D3DXMatrixLookAtLH(&view, &eye, &at, &up);
+	D3DXMatrixPerspectiveFovLH(&proj, D3DX_PI * 0.25f, 640.0f / 480.0f, 1.0f, 1000.0f);
+
+	// objects in a slab around the target, some behind the camera
+	SphereSoA objects;
+	for(int i = 0; i < numObjects; i++)
+	{
+		d3d::BoundingSphere sphere;
+		sphere._center = D3DXVECTOR3(
+			(float)rand() / RAND_MAX * 120.0f - 60.0f,
+			(float)rand() / RAND_MAX *  10.0f,
+			(float)rand() / RAND_MAX * 140.0f - 80.0f);
+		sphere._radius = 0.5f;
+		objects.add(sphere);
+	}
+
+	const int numPoints = 1000;
+	std::vector<POINT> points(numPoints);
+	for(int i = 0; i < numPoints; i++)
+	{
+		points[i].x = rand() % 640;
+		points[i].y = rand() % 480;
+	}
+
+	bool matches = true;
+
+	//
+	// Rays: what every click cost before, a device query for the viewport
+	// and projection and a matrix inverse per pick, against the cached batch.
+	//
+
+	std::vector<d3d::Ray> scalarRays(numPoints), rays(numPoints);
+
+	double start = Now();
+	for(int i = 0; i < numPoints; i++)
+	{
+		D3DVIEWPORT9 vp = viewport;
+		D3DXMATRIX p = proj;
+
+		d3d::Ray& ray = scalarRays[i];
+		ray._origin    = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+		ray._direction = D3DXVECTOR3(
+			((( 2.0f * points[i].x) / vp.Width)  - 1.0f) / p(0, 0),
+			(((-2.0f * points[i].y) / vp.Height) + 1.0f) / p(1, 1),
+			1.0f);
+
+		D3DXMATRIX viewInverse;
+		D3DXMatrixInverse(&viewInverse, 0, &view);
+		D3DXVec3TransformCoord(&ray._origin, &ray._origin, &viewInverse);
+		D3DXVec3TransformNormal(&ray._direction, &ray._direction, &viewInverse);
+		D3DXVec3Normalize(&ray._direction, &ray._direction);
+	}
+	double scalarRaysMs = Now() - start;
+
+	PickService service;
+
+	start = Now();
+	service.beginFrame(viewport, view, proj);
+	service.getRays(&points[0], numPoints, &rays[0]);
+	double raysMs = Now() - start;
+
+	for(int i = 0; i < numPoints; i++)
+	{
+		D3DXVECTOR3 d = rays[i]._direction - scalarRays[i]._direction;
+		D3DXVECTOR3 o = rays[i]._origin    - scalarRays[i]._origin;
+		if( D3DXVec3Length(&d) > 1e-4f || D3DXVec3Length(&o) > 1e-3f )
+			matches = false;
+	}
+
+	std::vector<PickResult> picks(numPoints);
+	start = Now();
+	service.pick(&points[0], numPoints, objects, &picks[0]);
+	double pickMs = Now() - start;
+
+	//
+	// Selection, checked against projecting each center with project().
+	//
+
+	RECT rect = { 100, 80, 540, 400 };
+
+	// a star around the middle of the screen
+	const int lassoPoints = 64;
+	POINT lasso[lassoPoints];
+	for(int i = 0; i < lassoPoints; i++)
+	{
+		float angle  = 2.0f * D3DX_PI * i / lassoPoints;
+		float radius = i % 2 ? 100.0f : 220.0f;
+		lasso[i].x = 320 + (LONG)(cosf(angle) * radius);
+		lasso[i].y = 240 + (LONG)(sinf(angle) * radius * 0.8f);
+	}
+
+	const int repeats = 20;
+	std::vector<int> rectSelected, lassoSelected;
+
+	start = Now();
+	for(int r = 0; r < repeats; r++)
+	{
+		rectSelected.clear();
+		service.selectRect(rect, objects, rectSelected);
+	}
+	double rectMs = (Now() - start) / repeats;
+
+	start = Now();
+	for(int r = 0; r < repeats; r++)
+	{
+		lassoSelected.clear();
+		service.selectLasso(lasso, lassoPoints, objects, lassoSelected);
+	}
+	double lassoMs = (Now() - start) / repeats;
+
+	std::vector<bool> inRect(numObjects, false), inLasso(numObjects, false);
+	for(int i = 0; i < (int)rectSelected.size(); i++)
+		inRect[rectSelected[i]] = true;
+	for(int i = 0; i < (int)lassoSelected.size(); i++)
+		inLasso[lassoSelected[i]] = true;
+
+	for(int i = 0; i < numObjects; i++)
+	{
+		float x = 0.0f, y = 0.0f;
+		bool front = service.project(D3DXVECTOR3(objects._x[i], objects._y[i], objects._z[i]), &x, &y);
+
+		// Points a rounding error from an edge may land either way; only
+		// count clear disagreements.
+		bool clearRect = fabsf(x - rect.left) > 0.01f && fabsf(x - rect.right) > 0.01f &&
+		                 fabsf(y - rect.top)  > 0.01f && fabsf(y - rect.bottom) > 0.01f;
+		bool expectRect = front && x >= rect.left && x < rect.right && y >= rect.top && y < rect.bottom;
+		if( clearRect && expectRect != inRect[i] )
+			matches = false;
+
+		bool expectLasso = false;
+		bool clearLasso = true;
+		if( front )
+		{
+			for(int e = 0; e < lassoPoints; e++)
+			{
+				const POINT& a = lasso[e];
+				const POINT& b = lasso[(e + 1) % lassoPoints];
+				if( (a.y > y) != (b.y > y) )
+				{
+					float cross = a.x + (y - a.y) * (float)(b.x - a.x) / (float)(b.y - a.y);
+					if( x < cross )
+						expectLasso = !expectLasso;
+					if( fabsf(x - cross) < 0.01f )
+						clearLasso = false;
+				}
+			}
+		}
+		if( clearLasso && expectLasso != inLasso[i] )
+			matches = false;
+	}
+
+	result->numObjects    = numObjects;
+	result->scalarRaysMs  = (float)scalarRaysMs;
+	result->raysMs        = (float)raysMs;
+	result->pickMs        = (float)pickMs;
+	result->rectMs        = (float)rectMs;
+	result->lassoMs       = (float)lassoMs;
+	result->rectSelected  = (int)rectSelected.size();
+	result->lassoSelected = (int)lassoSelected.size();
+	result->matches       = matches;
+	return true;
+}
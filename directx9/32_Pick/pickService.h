@@ -0,0 +1,95 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: pickService.h
+//
+// Desc: Screen space picking and selection for many points and objects.  The
+//       viewport, view and projection matrices and the inverse view are read
+//       once per frame and kept, instead of queried from the device on every
+//       pick.  Screen points become world rays four at a time with SSE, and
+//       rectangle and lasso selection project the objects four at a time.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __pickServiceH__
+#define __pickServiceH__
+
+#include "d3dUtility.h"
+#include "rayPackets.h"
+#include <vector>
+
+struct PickResult
+{
+	int   object;  // index of the nearest object hit, -1 for none
+	float dist;    // along the normalized ray
+};
+
+class PickService
+{
+public:
+	PickService();
+
+	// Caches the camera state for the frame: once per frame, after the view
+	// and projection are set.
+	void beginFrame(IDirect3DDevice9* device);
+	void beginFrame(const D3DVIEWPORT9& viewport, const D3DXMATRIX& view, const D3DXMATRIX& proj);
+
+	// The world space ray through a screen point, normalized.  The same ray
+	// CalcPickingRay and TransformRay give.
+	d3d::Ray getRay(int x, int y) const;
+
+	// The same for count points.
+	void getRays(const POINT* points, int count, d3d::Ray* rays) const;
+
+	// Converts the points to rays and finds the nearest object under each.
+	// Returns how many points hit something.
+	int pick(const POINT* points, int count, const SphereSoA& objects, PickResult* results) const;
+	int pick(const POINT* points, int count, const BoxSoA& objects, PickResult* results) const;
+
+	// Append the indices of the objects whose centers project inside the
+	// rectangle or the lasso (a closed polygon, even-odd rule) and lie in
+	// front of the near plane.  Return how many were selected.
+	int selectRect(const RECT& rect, const SphereSoA& objects, std::vector<int>& selected) const;
+	int selectLasso(const POINT* lasso, int numPoints, const SphereSoA& objects, std::vector<int>& selected) const;
+
+	// Where a world point lands on screen; false behind the near plane.
+	bool project(const D3DXVECTOR3& p, float* x, float* y) const;
+
+private:
+	D3DVIEWPORT9 _viewport;
+	D3DXMATRIX   _view;
+	D3DXMATRIX   _proj;
+	D3DXMATRIX   _viewInverse;
+
+	// world -> (x * w, y * w, w) in viewport pixels: view * projection with
+	// the viewport scale and offset folded in, so a point is on screen
+	// without dividing by w
+	D3DXMATRIX   _screen;
+
+	// view space ray direction = (x * _scaleX + _offsetX, y * _scaleY + _offsetY, 1)
+	float _scaleX, _offsetX;
+	float _scaleY, _offsetY;
+};
+
+//
+// Headless benchmark: numObjects spheres in front of a 640x480 camera.
+// Times 1000 screen points converted to rays (against the per pick device
+// query path's math), a rectangle and a 64 point lasso selection, and
+// checks them against scalar code.
+//
+
+struct PickBenchmark
+{
+	int   numObjects;
+	float scalarRaysMs;  // CalcPickingRay + matrix inverse + TransformRay per point
+	float raysMs;        // getRays for all points
+	float pickMs;        // pick against the spheres for all points
+	float rectMs;
+	float lassoMs;
+	int   rectSelected;
+	int   lassoSelected;
+	bool  matches;
+};
+
+bool BenchmarkPickService(int numObjects, PickBenchmark* result);
+
+#endif // __pickServiceH__
@@ -0,0 +1,540 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: rayPackets.cpp
+//
+// Desc: Ray tests against many bounding volumes at once.  See rayPackets.h.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "rayPackets.h"
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#else
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+	//
+	// A thin layer over the vector instructions so the kernels are written
+	// once for both SSE and AVX.
+	//
+
+#if defined(__AVX__)
+
+	typedef __m256 vfloat;
+	const int Lanes = 8;
+
+	inline vfloat VLoad(const float* p)            { return _mm256_loadu_ps(p); }
+	inline void   VStore(float* p, vfloat a)       { _mm256_storeu_ps(p, a); }
+	inline vfloat VSet(float f)                    { return _mm256_set1_ps(f); }
+	inline vfloat VIota()                          { return _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f); }
+	inline vfloat VAdd(vfloat a, vfloat b)         { return _mm256_add_ps(a, b); }
+	inline vfloat VSub(vfloat a, vfloat b)         { return _mm256_sub_ps(a, b); }
+	inline vfloat VMul(vfloat a, vfloat b)         { return _mm256_mul_ps(a, b); }
+	inline vfloat VDiv(vfloat a, vfloat b)         { return _mm256_div_ps(a, b); }
+	inline vfloat VMin(vfloat a, vfloat b)         { return _mm256_min_ps(a, b); }
+	inline vfloat VMax(vfloat a, vfloat b)         { return _mm256_max_ps(a, b); }
+	inline vfloat VSqrt(vfloat a)                  { return _mm256_sqrt_ps(a); }
+	inline vfloat VAnd(vfloat a, vfloat b)         { return _mm256_and_ps(a, b); }
+	inline vfloat VLess(vfloat a, vfloat b)        { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+	inline vfloat VLessEqual(vfloat a, vfloat b)   { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+	inline vfloat VEqual(vfloat a, vfloat b)       { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+	inline int    VMask(vfloat a)                  { return _mm256_movemask_ps(a); }
+	inline vfloat VSelect(vfloat m, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, m); }
+
+#else
+
+	typedef __m128 vfloat;
+	const int Lanes = 4;
+
+	inline vfloat VLoad(const float* p)            { return _mm_loadu_ps(p); }
+	inline void   VStore(float* p, vfloat a)       { _mm_storeu_ps(p, a); }
+	inline vfloat VSet(float f)                    { return _mm_set1_ps(f); }
+	inline vfloat VIota()                          { return _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f); }
+	inline vfloat VAdd(vfloat a, vfloat b)         { return _mm_add_ps(a, b); }
+	inline vfloat VSub(vfloat a, vfloat b)         { return _mm_sub_ps(a, b); }
+	inline vfloat VMul(vfloat a, vfloat b)         { return _mm_mul_ps(a, b); }
+	inline vfloat VDiv(vfloat a, vfloat b)         { return _mm_div_ps(a, b); }
+	inline vfloat VMin(vfloat a, vfloat b)         { return _mm_min_ps(a, b); }
+	inline vfloat VMax(vfloat a, vfloat b)         { return _mm_max_ps(a, b); }
+	inline vfloat VSqrt(vfloat a)                  { return _mm_sqrt_ps(a); }
+	inline vfloat VAnd(vfloat a, vfloat b)         { return _mm_and_ps(a, b); }
+	inline vfloat VLess(vfloat a, vfloat b)        { return _mm_cmplt_ps(a, b); }
+	inline vfloat VLessEqual(vfloat a, vfloat b)   { return _mm_cmple_ps(a, b); }
+	inline vfloat VEqual(vfloat a, vfloat b)       { return _mm_cmpeq_ps(a, b); }
+	inline int    VMask(vfloat a)                  { return _mm_movemask_ps(a); }
+	inline vfloat VSelect(vfloat m, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+
+#endif
+
+	// Loads lanes [i, i + Lanes) of an array, zero filling past its end.
+	inline vfloat LoadLanes(const std::vector<float>& a, int i)
+	{
+		int n = (int)a.size();
+		if( i + Lanes <= n )
+			return VLoad(&a[i]);
+
+		float tail[Lanes] = { 0.0f };
+		for(int k = 0; i + k < n; k++)
+			tail[k] = a[i + k];
+		return VLoad(tail);
+	}
+
+	// Mask of the lanes that hold real elements.
+	inline vfloat ValidLanes(int i, int n)
+	{
+		if( i + Lanes <= n )
+			return VEqual(VSet(0.0f), VSet(0.0f));
+		return VLess(VIota(), VSet((float)(n - i)));
+	}
+
+	// A zero direction component gets a huge, finite reciprocal so the slab
+	// test never computes 0 * infinity.
+	inline float SafeInverse(float d)
+	{
+		return d != 0.0f ? 1.0f / d : FLT_MAX;
+	}
+
+	inline vfloat SafeInverse(vfloat d)
+	{
+		vfloat zero = VSet(0.0f);
+		return VDiv(VSet(1.0f), VSelect(VEqual(d, zero), VSet(1e-30f), d));
+	}
+
+	//
+	// One ray, broadcast across the lanes.
+	//
+
+	struct RayLanes
+	{
+		RayLanes(const d3d::Ray& ray)
+		{
+			const D3DXVECTOR3& o = ray._origin;
+			const D3DXVECTOR3& d = ray._direction;
+
+			ox = VSet(o.x); oy = VSet(o.y); oz = VSet(o.z);
+			dx = VSet(d.x); dy = VSet(d.y); dz = VSet(d.z);
+			ix = VSet(SafeInverse(d.x));
+			iy = VSet(SafeInverse(d.y));
+			iz = VSet(SafeInverse(d.z));
+
+			// a zero length ray gets a = 1, 1 / a = 0 and never hits
+			float lengthSq = d.x * d.x + d.y * d.y + d.z * d.z;
+			a    = VSet(lengthSq > 0.0f ? lengthSq : 1.0f);
+			invA = VSet(lengthSq > 0.0f ? 1.0f / lengthSq : 0.0f);
+		}
+
+		vfloat ox, oy, oz;
+		vfloat dx, dy, dz;
+		vfloat ix, iy, iz;
+		vfloat a, invA;    // |d|^2 and its reciprocal
+	};
+
+	//
+	// Block kernels: test lanes [i, i + Lanes) and return a bit per hit, with
+	// the distances in *t.  Hits further than limit are rejected.
+	//
+
+	// |o + td - c|^2 = r^2, with b and c halved: t = (-b -+ sqrt(b^2 - ac)) / a
+	inline int SphereLanes(
+		vfloat ox, vfloat oy, vfloat oz,
+		vfloat dx, vfloat dy, vfloat dz,
+		vfloat a, vfloat invA,
+		vfloat cx, vfloat cy, vfloat cz, vfloat r,
+		vfloat valid,
+		vfloat limit,
+		vfloat* t)
+	{
+		vfloat vx = VSub(ox, cx);
+		vfloat vy = VSub(oy, cy);
+		vfloat vz = VSub(oz, cz);
+
+		vfloat b = VAdd(VAdd(VMul(dx, vx), VMul(dy, vy)), VMul(dz, vz));
+		vfloat c = VSub(VAdd(VAdd(VMul(vx, vx), VMul(vy, vy)), VMul(vz, vz)), VMul(r, r));
+
+		vfloat discriminant = VSub(VMul(b, b), VMul(a, c));
+
+		vfloat zero = VSet(0.0f);
+		vfloat mask = VAnd(valid, VLessEqual(zero, discriminant));
+
+		// early out before the square root
+		if( VMask(mask) == 0 )
+			return 0;
+
+		vfloat s  = VSqrt(VMax(discriminant, zero));
+		vfloat t0 = VMul(VSub(VSub(zero, b), s), invA);
+		vfloat t1 = VMul(VSub(s, b), invA);
+
+		// t1 < 0: the sphere is behind the ray.  t0 < 0: the origin is inside.
+		mask = VAnd(mask, VLessEqual(zero, t1));
+
+		*t = VMax(t0, zero);
+		mask = VAnd(mask, VLessEqual(*t, limit));
+
+		return VMask(mask);
+	}
+
+	inline int BoxLanes(
+		vfloat ox, vfloat oy, vfloat oz,
+		vfloat ix, vfloat iy, vfloat iz,
+		vfloat minX, vfloat minY, vfloat minZ,
+		vfloat maxX, vfloat maxY, vfloat maxZ,
+		vfloat valid,
+		vfloat limit,
+		vfloat* t)
+	{
+		vfloat zero = VSet(0.0f);
+
+		vfloat t1 = VMul(VSub(minX, ox), ix);
+		vfloat t2 = VMul(VSub(maxX, ox), ix);
+		vfloat tmin = VMin(t1, t2);
+		vfloat tmax = VMax(t1, t2);
+
+		t1 = VMul(VSub(minY, oy), iy);
+		t2 = VMul(VSub(maxY, oy), iy);
+		tmin = VMax(tmin, VMin(t1, t2));
+		tmax = VMin(tmax, VMax(t1, t2));
+
+		vfloat mask = VAnd(valid, VLessEqual(tmin, tmax));
+		mask = VAnd(mask, VLessEqual(zero, tmax));
+		mask = VAnd(mask, VLessEqual(tmin, limit));
+
+		// early out before the z slab
+		if( VMask(mask) == 0 )
+			return 0;
+
+		t1 = VMul(VSub(minZ, oz), iz);
+		t2 = VMul(VSub(maxZ, oz), iz);
+		tmin = VMax(tmin, VMin(t1, t2));
+		tmax = VMin(tmax, VMax(t1, t2));
+
+		mask = VAnd(mask, VLessEqual(tmin, tmax));
+		mask = VAnd(mask, VLessEqual(zero, tmax));
+		mask = VAnd(mask, VLessEqual(tmin, limit));
+
+		*t = VMax(tmin, zero);
+
+		return VMask(mask);
+	}
+
+	inline int SphereBlock(const RayLanes& r, const SphereSoA& s, int i, vfloat limit, vfloat* t)
+	{
+		return SphereLanes(
+			r.ox, r.oy, r.oz, r.dx, r.dy, r.dz, r.a, r.invA,
+			LoadLanes(s._x, i), LoadLanes(s._y, i), LoadLanes(s._z, i), LoadLanes(s._radius, i),
+			ValidLanes(i, s.size()),
+			limit,
+			t);
+	}
+
+	inline int BoxBlock(const RayLanes& r, const BoxSoA& b, int i, vfloat limit, vfloat* t)
+	{
+		return BoxLanes(
+			r.ox, r.oy, r.oz, r.ix, r.iy, r.iz,
+			LoadLanes(b._minX, i), LoadLanes(b._minY, i), LoadLanes(b._minZ, i),
+			LoadLanes(b._maxX, i), LoadLanes(b._maxY, i), LoadLanes(b._maxZ, i),
+			ValidLanes(i, b.size()),
+			limit,
+			t);
+	}
+
+	//
+	// The three reductions, shared by spheres and boxes.
+	//
+
+	template<class Volumes, class Block>
+	int IntTestAll(const d3d::Ray& ray, const Volumes& volumes, float maxDist, float* dists, Block block)
+	{
+		RayLanes r(ray);
+		vfloat limit = VSet(maxDist);
+
+		int n = volumes.size();
+		int numHits = 0;
+
+		for(int i = 0; i < n; i += Lanes)
+		{
+			vfloat t = VSet(0.0f);
+			int bits = block(r, volumes, i, limit, &t);
+
+			float ts[Lanes];
+			VStore(ts, t);
+
+			for(int k = 0; k < Lanes && i + k < n; k++)
+			{
+				if( bits & (1 << k) )
+				{
+					dists[i + k] = ts[k];
+					numHits++;
+				}
+				else
+				{
+					dists[i + k] = -1.0f;
+				}
+			}
+		}
+
+		return numHits;
+	}
+
+	template<class Volumes, class Block>
+	int Nearest(const d3d::Ray& ray, const Volumes& volumes, float maxDist, float* dist, Block block)
+	{
+		RayLanes r(ray);
+
+		int   n       = volumes.size();
+		int   nearest = -1;
+		float best    = maxDist;
+
+		for(int i = 0; i < n; i += Lanes)
+		{
+			// the limit shrinks as hits are found, culling the lanes behind them
+			vfloat t = VSet(0.0f);
+			int bits = block(r, volumes, i, VSet(best), &t);
+			if( bits == 0 )
+				continue;
+
+			float ts[Lanes];
+			VStore(ts, t);
+
+			for(int k = 0; k < Lanes; k++)
+			{
+				if( (bits & (1 << k)) && (ts[k] < best || nearest == -1) )
+				{
+					best    = ts[k];
+					nearest = i + k;
+				}
+			}
+		}
+
+		if( nearest >= 0 && dist )
+			*dist = best;
+
+		return nearest;
+	}
+
+	template<class Volumes, class Block>
+	bool AnyHit(const d3d::Ray& ray, const Volumes& volumes, float maxDist, Block block)
+	{
+		RayLanes r(ray);
+		vfloat limit = VSet(maxDist);
+
+		int n = volumes.size();
+		for(int i = 0; i < n; i += Lanes)
+		{
+			vfloat t = VSet(0.0f);
+			if( block(r, volumes, i, limit, &t) )
+				return true;
+		}
+
+		return false;
+	}
+}
+
+//
+// Containers
+//
+
+void SphereSoA::clear()
+{
+	_x.clear(); _y.clear(); _z.clear();
+	_radius.clear();
+}
+
+void SphereSoA::add(const d3d::BoundingSphere& sphere)
+{
+	_x.push_back(sphere._center.x);
+	_y.push_back(sphere._center.y);
+	_z.push_back(sphere._center.z);
+	_radius.push_back(sphere._radius);
+}
+
+void BoxSoA::clear()
+{
+	_minX.clear(); _minY.clear(); _minZ.clear();
+	_maxX.clear(); _maxY.clear(); _maxZ.clear();
+}
+
+void BoxSoA::add(const d3d::BoundingBox& box)
+{
+	_minX.push_back(box._min.x);
+	_minY.push_back(box._min.y);
+	_minZ.push_back(box._min.z);
+	_maxX.push_back(box._max.x);
+	_maxY.push_back(box._max.y);
+	_maxZ.push_back(box._max.z);
+}
+
+void RayPacketSoA::clear()
+{
+	_ox.clear(); _oy.clear(); _oz.clear();
+	_dx.clear(); _dy.clear(); _dz.clear();
+}
+
+void RayPacketSoA::add(const d3d::Ray& ray)
+{
+	_ox.push_back(ray._origin.x);
+	_oy.push_back(ray._origin.y);
+	_oz.push_back(ray._origin.z);
+	_dx.push_back(ray._direction.x);
+	_dy.push_back(ray._direction.y);
+	_dz.push_back(ray._direction.z);
+}
+
+//
+// Scalar
+//
+
+bool RayBoxIntTest(d3d::Ray* ray, d3d::BoundingBox* box, float* dist)
+{
+	float tmin = 0.0f;
+	float tmax = FLT_MAX;
+
+	for(int a = 0; a < 3; a++)
+	{
+		float inv = SafeInverse(ray->_direction[a]);
+		float t1  = (box->_min[a] - ray->_origin[a]) * inv;
+		float t2  = (box->_max[a] - ray->_origin[a]) * inv;
+
+		if( t1 > t2 )
+		{
+			float temp = t1;
+			t1 = t2;
+			t2 = temp;
+		}
+
+		tmin = t1 > tmin ? t1 : tmin;
+		tmax = t2 < tmax ? t2 : tmax;
+
+		if( tmin > tmax )
+			return false;
+	}
+
+	if( dist )
+		*dist = tmin;
+
+	return true;
+}
+
+//
+// One ray against N volumes
+//
+
+int RaySpheresIntTest(const d3d::Ray& ray, const SphereSoA& spheres, float maxDist, float* dists)
+{
+	return IntTestAll(ray, spheres, maxDist, dists, SphereBlock);
+}
+
+int RaySpheresNearest(const d3d::Ray& ray, const SphereSoA& spheres, float maxDist, float* dist)
+{
+	return Nearest(ray, spheres, maxDist, dist, SphereBlock);
+}
+
+bool RaySpheresAnyHit(const d3d::Ray& ray, const SphereSoA& spheres, float maxDist)
+{
+	return AnyHit(ray, spheres, maxDist, SphereBlock);
+}
+
+int RayBoxesIntTest(const d3d::Ray& ray, const BoxSoA& boxes, float maxDist, float* dists)
+{
+	return IntTestAll(ray, boxes, maxDist, dists, BoxBlock);
+}
+
+int RayBoxesNearest(const d3d::Ray& ray, const BoxSoA& boxes, float maxDist, float* dist)
+{
+	return Nearest(ray, boxes, maxDist, dist, BoxBlock);
+}
+
+bool RayBoxesAnyHit(const d3d::Ray& ray, const BoxSoA& boxes, float maxDist)
+{
+	return AnyHit(ray, boxes, maxDist, BoxBlock);
+}
+
+//
+// N rays against one volume
+//
+
+int RayPacketSphereIntTest(const RayPacketSoA& rays, const d3d::BoundingSphere& sphere, float maxDist, float* dists)
+{
+	vfloat cx = VSet(sphere._center.x);
+	vfloat cy = VSet(sphere._center.y);
+	vfloat cz = VSet(sphere._center.z);
+	vfloat r  = VSet(sphere._radius);
+	vfloat limit = VSet(maxDist);
+
+	int n = rays.size();
+	int numHits = 0;
+
+	for(int i = 0; i < n; i += Lanes)
+	{
+		vfloat dx = LoadLanes(rays._dx, i);
+		vfloat dy = LoadLanes(rays._dy, i);
+		vfloat dz = LoadLanes(rays._dz, i);
+
+		// zero length rays and the padding are masked off, with a = 1
+		vfloat a     = VAdd(VAdd(VMul(dx, dx), VMul(dy, dy)), VMul(dz, dz));
+		vfloat valid = VAnd(ValidLanes(i, n), VLess(VSet(0.0f), a));
+		a = VSelect(valid, a, VSet(1.0f));
+		vfloat invA  = VDiv(VSet(1.0f), a);
+
+		vfloat t = VSet(0.0f);
+		int bits = SphereLanes(
+			LoadLanes(rays._ox, i), LoadLanes(rays._oy, i), LoadLanes(rays._oz, i),
+			dx, dy, dz, a, invA,
+			cx, cy, cz, r,
+			valid,
+			limit,
+			&t);
+
+		float ts[Lanes];
+		VStore(ts, t);
+
+		for(int k = 0; k < Lanes && i + k < n; k++)
+		{
+			dists[i + k] = (bits & (1 << k)) ? ts[k] : -1.0f;
+			if( bits & (1 << k) )
+				numHits++;
+		}
+	}
+
+	return numHits;
+}
+
+int RayPacketBoxIntTest(const RayPacketSoA& rays, const d3d::BoundingBox& box, float maxDist, float* dists)
+{
+	vfloat minX = VSet(box._min.x), minY = VSet(box._min.y), minZ = VSet(box._min.z);
+	vfloat maxX = VSet(box._max.x), maxY = VSet(box._max.y), maxZ = VSet(box._max.z);
+	vfloat limit = VSet(maxDist);
+
+	int n = rays.size();
+	int numHits = 0;
+
+	for(int i = 0; i < n; i += Lanes)
+	{
+		vfloat t = VSet(0.0f);
+		int bits = BoxLanes(
+			LoadLanes(rays._ox, i), LoadLanes(rays._oy, i), LoadLanes(rays._oz, i),
+			SafeInverse(LoadLanes(rays._dx, i)),
+			SafeInverse(LoadLanes(rays._dy, i)),
+			SafeInverse(LoadLanes(rays._dz, i)),
+			minX, minY, minZ,
+			maxX, maxY, maxZ,
+			ValidLanes(i, n),
+			limit,
+			&t);
+
+		float ts[Lanes];
+		VStore(ts, t);
+
+		for(int k = 0; k < Lanes && i + k < n; k++)
+		{
+			dists[i + k] = (bits & (1 << k)) ? ts[k] : -1.0f;
+			if( bits & (1 << k) )
+				numHits++;
+		}
+	}
+
+	return numHits;
+}
@@ -0,0 +1,84 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: rayPackets.h
+//
+// Desc: Ray tests against many bounding volumes at once.  The volumes (or the
+//       rays) are stored as structures of arrays so the kernels can test four
+//       of them per SSE instruction, or eight when compiled with /arch:AVX.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __rayPacketsH__
+#define __rayPacketsH__
+
+#include "d3dUtility.h"
+#include <vector>
+
+//
+// Structure of arrays containers.
+//
+
+struct SphereSoA
+{
+	void clear();
+	void add(const d3d::BoundingSphere& sphere);
+	int  size() const { return (int)_x.size(); }
+
+	std::vector<float> _x, _y, _z;
+	std::vector<float> _radius;
+};
+
+struct BoxSoA
+{
+	void clear();
+	void add(const d3d::BoundingBox& box);
+	int  size() const { return (int)_minX.size(); }
+
+	std::vector<float> _minX, _minY, _minZ;
+	std::vector<float> _maxX, _maxY, _maxZ;
+};
+
+struct RayPacketSoA
+{
+	void clear();
+	void add(const d3d::Ray& ray);
+	int  size() const { return (int)_ox.size(); }
+
+	std::vector<float> _ox, _oy, _oz;
+	std::vector<float> _dx, _dy, _dz;
+};
+
+//
+// Scalar test, for one ray against one box.  dist receives the distance to
+// the entry point, or 0 if the origin is inside the box.
+//
+
+bool RayBoxIntTest(d3d::Ray* ray, d3d::BoundingBox* box, float* dist);
+
+//
+// One ray against N volumes.  Only hits closer than maxDist count, and
+// distances are in units of the ray direction's length.
+//
+//   ...IntTest:  dists[i] receives the distance to volume i, or -1 for a
+//                miss.  Returns the number of hits.
+//   ...Nearest:  returns the index of the closest volume hit, or -1.
+//   ...AnyHit:   returns as soon as any volume is hit (line of sight).
+//
+
+int  RaySpheresIntTest(const d3d::Ray& ray, const SphereSoA& spheres, float maxDist, float* dists);
+int  RaySpheresNearest(const d3d::Ray& ray, const SphereSoA& spheres, float maxDist, float* dist);
+bool RaySpheresAnyHit(const d3d::Ray& ray, const SphereSoA& spheres, float maxDist);
+
+int  RayBoxesIntTest(const d3d::Ray& ray, const BoxSoA& boxes, float maxDist, float* dists);
+int  RayBoxesNearest(const d3d::Ray& ray, const BoxSoA& boxes, float maxDist, float* dist);
+bool RayBoxesAnyHit(const d3d::Ray& ray, const BoxSoA& boxes, float maxDist);
+
+//
+// N rays against one volume.  dists[i] receives ray i's distance, or -1 for
+// a miss.  Returns the number of rays that hit.
+//
+
+int RayPacketSphereIntTest(const RayPacketSoA& rays, const d3d::BoundingSphere& sphere, float maxDist, float* dists);
+int RayPacketBoxIntTest(const RayPacketSoA& rays, const d3d::BoundingBox& box, float maxDist, float* dists);
+
+#endif // __rayPacketsH__
@@ -0,0 +1,572 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: meshTopology.cpp
+//
+// Desc: Face adjacency, unique edges and vertex to face maps, built from
+//       the half-edges around each vertex, in parallel.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "meshTopology.h"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+namespace
+{
+	double Now()
+	{
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+	}
+
+	int ResolveThreads(int numThreads)
+	{
+		if( numThreads <= 0 )
+			numThreads = (int)std::thread::hardware_concurrency();
+		if( numThreads <= 0 )
+			numThreads = 1;
+		return numThreads;
+	}
+
+	// Calls body(begin, end) over [0, count) split into numThreads ranges,
+	// the first on the calling thread.
+	template<class Body> void ParallelFor(int count, int numThreads, Body body)
+	{
+		std::vector<std::thread> threads;
+		for(int t = 1; t < numThreads; t++)
+			threads.push_back(std::thread(body, count * t / numThreads, count * (t + 1) / numThreads));
+		body(0, count / numThreads);
+
+		for(int t = 0; t < (int)threads.size(); t++)
+			threads[t].join();
+	}
+
+	// A half-edge filed under its lower vertex: the upper vertex, then its
+	// slot (face * 3 + edge), then whether it runs from lower to upper.
+	// Sorting the packed values sorts by upper vertex, then face.
+	unsigned long long PackHalfEdge(DWORD upper, DWORD slot, bool forward)
+	{
+		return ((unsigned long long)upper << 32) | ((unsigned long long)slot << 1) | (forward ? 1 : 0);
+	}
+
+	DWORD UpperOf(unsigned long long h) { return (DWORD)(h >> 32); }
+	DWORD SlotOf(unsigned long long h)  { return (DWORD)(h & 0xffffffff) >> 1; }
+	DWORD ForwardOf(unsigned long long h) { return (DWORD)(h & 1); }
+
+	// Thread t owns the vertices from RangeStart(t) to RangeStart(t + 1).
+	int RangeStart(int t, int numVertices, int T)
+	{
+		return (int)((long long)numVertices * t / T);
+	}
+
+	DWORD PositionHash(const D3DXVECTOR3& p)
+	{
+		// +0 and -0 are the same position
+		float v[3] = { p.x + 0.0f, p.y + 0.0f, p.z + 0.0f };
+		DWORD bits[3];
+		memcpy(bits, v, sizeof(bits));
+		return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+	}
+}
+
+MeshTopologyStats::MeshTopologyStats()
+{
+	faces               = 0;
+	vertices            = 0;
+	edges               = 0;
+	boundaryEdges       = 0;
+	nonManifoldEdges    = 0;
+	boundaryVertices    = 0;
+	nonManifoldVertices = 0;
+	numThreads          = 0;
+	weldMs              = 0.0f;
+	bucketMs            = 0.0f;
+	sortMs              = 0.0f;
+	vertexMs            = 0.0f;
+	totalMs             = 0.0f;
+}
+
+void BuildPositionRemap(const void* vertices, int numVertices, int stride, std::vector<DWORD>* remap)
+{
+	remap->resize(numVertices);
+
+	int size = 1;
+	while( size < numVertices * 2 )
+		size *= 2;
+
+	// open addressing, each slot holding the first vertex at a position
+	std::vector<DWORD> table(size, MeshNoNeighbour);
+	for(int i = 0; i < numVertices; i++)
+	{
+		const D3DXVECTOR3& p = *(const D3DXVECTOR3*)((const BYTE*)vertices + (size_t)i * stride);
+
+		DWORD slot = PositionHash(p) & (size - 1);
+		for( ; ; slot = (slot + 1) & (size - 1))
+		{
+			DWORD first = table[slot];
+			if( first == MeshNoNeighbour )
+			{
+				table[slot]  = i;
+				(*remap)[i] = i;
+				break;
+			}
+
+			const D3DXVECTOR3& q = *(const D3DXVECTOR3*)((const BYTE*)vertices + (size_t)first * stride);
+			if( p == q )
+			{
+				(*remap)[i] = first;
+				break;
+			}
+		}
+	}
+}
+
+//
+// MeshTopology
+//
+
+MeshTopology::MeshTopology()
+{
+	_numFaces    = 0;
+	_numVertices = 0;
+}
+
+void MeshTopology::clear()
+{
+	_numFaces    = 0;
+	_numVertices = 0;
+	_indices.clear();
+	_adjacency.clear();
+	_edges.clear();
+	_faceEdges.clear();
+	_vertexFaceStart.clear();
+	_vertexFaces.clear();
+	_vertexFlags.clear();
+	_tailEdges.clear();
+}
+
+bool MeshTopology::build(const DWORD* indices, int numFaces, int numVertices, const DWORD* remap,
+	int numThreads, MeshTopologyStats* stats)
+{
+	MeshTopologyStats local;
+	if( !stats )
+		stats = &local;
+	float weldMs = stats->weldMs;
+	*stats = MeshTopologyStats();
+	stats->weldMs = weldMs;
+
+	if( numFaces <= 0 || numVertices <= 0 )
+	{
+		clear();
+		return false;
+	}
+
+	// The arrays every build writes in full keep their size, and are
+	// only resized, not cleared, so a rebuild does not zero them first.
+	_edges.clear();
+
+	int T = ResolveThreads(numThreads);
+	T = std::max(1, std::min(T, std::min(numFaces, numVertices)));
+
+	_numFaces    = numFaces;
+	_numVertices = numVertices;
+
+	int numCorners = numFaces * 3;
+
+	double begin = Now();
+	double start = begin;
+
+	//
+	// Faces around each vertex: every thread owns a range of vertices and
+	// scans all the faces for the corners it owns.  Scanning is cheap next
+	// to sharing counters, and keeps each vertex's faces in face order.
+	//
+
+	_indices.resize(numCorners);
+	_adjacency.resize(numCorners);
+	_faceEdges.resize(numCorners);
+	std::vector<BYTE> valid(T, 1);
+
+	ParallelFor(T, T, [&](int first, int last)
+	{
+		int begin = (int)((long long)numFaces * first / T) * 3;
+		int end   = (int)((long long)numFaces * last / T) * 3;
+
+		bool ok = true;
+		for(int c = begin; c < end; c += 3)
+		{
+			DWORD face[3] = { indices[c], indices[c + 1], indices[c + 2] };
+			for(int e = 0; e < 3; e++)
+			{
+				if( remap && face[e] < (DWORD)numVertices )
+					face[e] = remap[face[e]];
+				if( face[e] >= (DWORD)numVertices )
+				{
+					ok      = false;
+					face[e] = 0;
+				}
+				_indices[c + e] = face[e];
+			}
+
+			// Edges from a vertex to itself belong to no edge; every other
+			// slot is written when its edge is merged.
+			if( face[0] == face[1] || face[1] == face[2] || face[2] == face[0] )
+				for(int e = 0; e < 3; e++)
+					if( face[e] == face[(e + 1) % 3] )
+					{
+						_adjacency[c + e] = MeshNoNeighbour;
+						_faceEdges[c + e] = MeshNoNeighbour;
+					}
+		}
+		valid[first] = ok;
+	});
+
+	for(int t = 0; t < T; t++)
+		if( !valid[t] )
+		{
+			clear();
+			return false;
+		}
+
+	// Counted two ahead, so that placing the faces below leaves each
+	// vertex's start where it belongs, without a cursor per vertex.
+	_vertexFaceStart.assign(numVertices + 2, 0);
+	DWORD* counts = &_vertexFaceStart[1];
+
+	ParallelFor(T, T, [&](int first, int last)
+	{
+		DWORD lo    = (DWORD)RangeStart(first, numVertices, T);
+		DWORD owned = (DWORD)RangeStart(last, numVertices, T) - lo;
+
+		const DWORD* face = &_indices[0];
+		for(int f = 0; f < numFaces; f++, face += 3)
+		{
+			// a face is listed once per vertex, however many corners it has
+			if( face[0] - lo < owned )
+				counts[face[0] + 1]++;
+			if( face[1] - lo < owned && face[1] != face[0] )
+				counts[face[1] + 1]++;
+			if( face[2] - lo < owned && face[2] != face[0] && face[2] != face[1] )
+				counts[face[2] + 1]++;
+		}
+	});
+
+	for(int v = 0; v < numVertices; v++)
+		counts[v + 1] += counts[v];
+
+	_vertexFaces.resize(_vertexFaceStart[numVertices + 1]);
+
+	ParallelFor(T, T, [&](int first, int last)
+	{
+		DWORD lo    = (DWORD)RangeStart(first, numVertices, T);
+		DWORD owned = (DWORD)RangeStart(last, numVertices, T) - lo;
+
+		DWORD* vertexFaces = _vertexFaces.empty() ? 0 : &_vertexFaces[0];
+		const DWORD* face  = &_indices[0];
+		for(DWORD f = 0; f < (DWORD)numFaces; f++, face += 3)
+		{
+			if( face[0] - lo < owned )
+				vertexFaces[counts[face[0]]++] = f;
+			if( face[1] - lo < owned && face[1] != face[0] )
+				vertexFaces[counts[face[1]]++] = f;
+			if( face[2] - lo < owned && face[2] != face[0] && face[2] != face[1] )
+				vertexFaces[counts[face[2]]++] = f;
+		}
+	});
+
+	_vertexFaceStart.pop_back();
+
+	stats->bucketMs = (float)(Now() - start);
+	start = Now();
+
+	//
+	// Edges: each thread gathers the half-edges leaving the faces around
+	// each of its vertices, keeps those whose lower vertex it is, and sorts
+	// them by their upper vertex; each run is one edge.  Edges are numbered
+	// in vertex order, so all but the last thread count theirs first.
+	//
+
+	std::vector<DWORD> rangeEdges(T + 1, 0);
+
+	// Returns the half-edges whose lower vertex is v, sorted.
+	auto gather = [&](DWORD v, std::vector<unsigned long long>& h) -> int
+	{
+		static const int next[3] = { 1, 2, 0 };
+		static const int prev[3] = { 2, 0, 1 };
+
+		DWORD k   = _vertexFaceStart[v];
+		DWORD end = _vertexFaceStart[v + 1];
+
+		// at most two per corner, and a face has v at up to three
+		if( h.size() < (end - k) * 6 )
+			h.resize((end - k) * 6);
+		unsigned long long* out = h.empty() ? 0 : &h[0];
+
+		const DWORD* vertexFaces = _vertexFaces.empty() ? 0 : &_vertexFaces[0];
+		const DWORD* faces       = &_indices[0];
+
+		int n = 0;
+		for( ; k < end; k++)
+		{
+			DWORD f = vertexFaces[k];
+			const DWORD* face = faces + f * 3;
+
+			// v is at one corner, unless the face is degenerate
+			int first = face[0] == v ? 0 : (face[1] == v ? 1 : 2);
+			int last  = first;
+			if( face[0] == face[1] || face[1] == face[2] || face[2] == face[0] )
+				last = 2;
+
+			for(int e = first; e <= last; e++)
+			{
+				if( face[e] != v )
+					continue;
+
+				DWORD b = face[next[e]];
+				DWORD p = face[prev[e]];
+				if( v < b ) out[n++] = PackHalfEdge(b, f * 3 + e, true);
+				if( v < p ) out[n++] = PackHalfEdge(p, f * 3 + prev[e], false);
+			}
+		}
+
+		// insertion sort: a vertex has a handful of half-edges
+		if( n > 32 )
+			std::sort(out, out + n);
+		else
+			for(int i = 1; i < n; i++)
+			{
+				unsigned long long x = out[i];
+				int j = i;
+				for( ; j > 0 && x < out[j - 1]; j--)
+					out[j] = out[j - 1];
+				out[j] = x;
+			}
+		return n;
+	};
+
+	if( T > 1 )
+	{
+		ParallelFor(T - 1, T - 1, [&](int first, int last)
+		{
+			int lo = RangeStart(first, numVertices, T);
+			int hi = RangeStart(last, numVertices, T);
+
+			std::vector<unsigned long long> h;
+			DWORD numEdges = 0;
+			for(int v = lo; v < hi; v++)
+			{
+				int n = gather(v, h);
+				for(int i = 0; i < n; i++)
+					if( i == 0 || UpperOf(h[i]) != UpperOf(h[i - 1]) )
+						numEdges++;
+			}
+			rangeEdges[last] = numEdges;
+		});
+
+		for(int t = 0; t < T - 1; t++)
+			rangeEdges[t + 1] += rangeEdges[t];
+	}
+
+	// Merge: within each run of the same edge, pair faces that cross it in
+	// opposite directions; any other face gets no neighbour.  A run's
+	// half-edges all belong to one thread, so the threads write disjoint
+	// slots.  The last thread, whose edges were not counted, appends its
+	// own: straight onto _edges when it is the only one.
+	_edges.reserve(std::min(numCorners, numFaces + numVertices));
+	_edges.resize(rangeEdges[T - 1]);
+	_tailEdges.clear();
+	std::vector<MeshEdge>& tail = (T == 1) ? _edges : _tailEdges;
+
+	std::vector<std::vector<DWORD> > flagged(T);
+
+	ParallelFor(T, T, [&](int first, int last)
+	{
+		int lo = RangeStart(first, numVertices, T);
+		int hi = RangeStart(last, numVertices, T);
+
+		DWORD id = rangeEdges[first];
+
+		std::vector<unsigned long long> h;
+		for(int v = lo; v < hi; v++)
+		{
+			int groupEnd = gather(v, h);
+			for(int i = 0; i < groupEnd; id++)
+			{
+				int end = i + 1;
+				while( end < groupEnd && UpperOf(h[end]) == UpperOf(h[i]) )
+					end++;
+
+				for(int j = i; j < end; j++)
+				{
+					DWORD slot = SlotOf(h[j]);
+					_faceEdges[slot] = id;
+					_adjacency[slot] = MeshNoNeighbour;
+				}
+
+				// most edges have two faces, which nearly always pair
+				if( end - i == 2 )
+				{
+					DWORD s0 = SlotOf(h[i]), s1 = SlotOf(h[i + 1]);
+					if( ForwardOf(h[i]) != ForwardOf(h[i + 1]) && s0 / 3 != s1 / 3 )
+					{
+						_adjacency[s0] = s1 / 3;
+						_adjacency[s1] = s0 / 3;
+					}
+				}
+				else for(int j = i; j < end; j++)
+				{
+					DWORD slot = SlotOf(h[j]);
+					if( _adjacency[slot] != MeshNoNeighbour )
+						continue;
+
+					for(int k = j + 1; k < end; k++)
+					{
+						DWORD other = SlotOf(h[k]);
+						if( ForwardOf(h[k]) == ForwardOf(h[j]) ||
+							_adjacency[other] != MeshNoNeighbour || other / 3 == slot / 3 )
+							continue;
+
+						_adjacency[slot]  = other / 3;
+						_adjacency[other] = slot / 3;
+						break;
+					}
+				}
+
+				MeshEdge edge;
+				edge.v0       = v;
+				edge.v1       = UpperOf(h[i]);
+				edge.face0    = SlotOf(h[i]) / 3;
+				edge.face1    = _adjacency[SlotOf(h[i])];
+				edge.numFaces = end - i;
+				edge.flags    = 0;
+				if( edge.numFaces == 1 )
+					edge.flags |= MeshBoundary;
+				else if( edge.numFaces > 2 || edge.face1 == MeshNoNeighbour )
+					edge.flags |= MeshNonManifold;
+				if( edge.flags )
+					flagged[first].push_back(id);
+
+				if( last == T )
+					tail.push_back(edge);
+				else
+					_edges[id] = edge;
+
+				i = end;
+			}
+		}
+	});
+
+	if( T > 1 )
+		_edges.insert(_edges.end(), _tailEdges.begin(), _tailEdges.end());
+
+	stats->sortMs = (float)(Now() - start);
+	start = Now();
+
+	// Only the flagged edges, a few in a closed mesh, mark their vertices.
+	_vertexFlags.assign(numVertices, 0);
+	for(int t = 0; t < T; t++)
+	{
+		for(int i = 0; i < (int)flagged[t].size(); i++)
+		{
+			const MeshEdge& edge = _edges[flagged[t][i]];
+
+			_vertexFlags[edge.v0] |= (BYTE)edge.flags;
+			_vertexFlags[edge.v1] |= (BYTE)edge.flags;
+
+			if( edge.flags & MeshBoundary )    stats->boundaryEdges++;
+			if( edge.flags & MeshNonManifold ) stats->nonManifoldEdges++;
+		}
+	}
+
+	for(int v = 0; v < numVertices; v++)
+	{
+		if( _vertexFlags[v] & MeshBoundary )    stats->boundaryVertices++;
+		if( _vertexFlags[v] & MeshNonManifold ) stats->nonManifoldVertices++;
+	}
+
+	stats->vertexMs   = (float)(Now() - start);
+	stats->totalMs    = (float)(Now() - begin) + stats->weldMs;
+	stats->faces      = numFaces;
+	stats->vertices   = numVertices;
+	stats->edges      = (int)_edges.size();
+	stats->numThreads = T;
+
+	return true;
+}
+
+bool MeshTopology::buildFromMesh(ID3DXMesh* mesh, int numThreads, MeshTopologyStats* stats)
+{
+	MeshTopologyStats local;
+	if( !stats )
+		stats = &local;
+	*stats = MeshTopologyStats();
+
+	int numFaces    = (int)mesh->GetNumFaces();
+	int numVertices = (int)mesh->GetNumVertices();
+
+	double start = Now();
+
+	std::vector<DWORD> remap;
+	void* vertices = 0;
+	if( FAILED(mesh->LockVertexBuffer(D3DLOCK_READONLY, &vertices)) )
+		return false;
+	BuildPositionRemap(vertices, numVertices, mesh->GetNumBytesPerVertex(), &remap);
+	mesh->UnlockVertexBuffer();
+
+	stats->weldMs = (float)(Now() - start);
+
+	std::vector<DWORD> indices(numFaces * 3);
+	void* data = 0;
+	if( FAILED(mesh->LockIndexBuffer(D3DLOCK_READONLY, &data)) )
+		return false;
+	if( mesh->GetOptions() & D3DXMESH_32BIT )
+		memcpy(&indices[0], data, indices.size() * sizeof(DWORD));
+	else
+		for(int i = 0; i < (int)indices.size(); i++)
+			indices[i] = ((const WORD*)data)[i];
+	mesh->UnlockIndexBuffer();
+
+	return build(&indices[0], numFaces, numVertices, &remap[0], numThreads, stats);
+}
+
+//
+// Benchmark
+//
+
+bool BenchmarkMeshTopology(int gridSize, int numThreads, MeshTopologyBenchmark* result)
+{
+	int side = gridSize + 1;
+
+	std::vector<DWORD> indices;
+	indices.reserve(gridSize * gridSize * 6);
+	for(int z = 0; z < gridSize; z++)
+	{
+		for(int x = 0; x < gridSize; x++)
+		{
+			// a hole every so often, for some borders
+			if( x % 61 == 30 && z % 53 == 26 )
+				continue;
+
+			DWORD a = z * side + x, b = a + 1, c = a + side, d = c + 1;
+			DWORD tri[6] = { a, c, b, b, c, d };
+			indices.insert(indices.end(), tri, tri + 6);
+		}
+	}
+
+	result->triangles = (int)indices.size() / 3;
+
+	// The second build reuses the first one's memory.
+	MeshTopology topology;
+	double start = Now();
+	bool ok = topology.build(&indices[0], result->triangles, side * side, 0, numThreads, &result->stats);
+	result->ms = (float)(Now() - start);
+
+	start = Now();
+	ok = ok && topology.build(&indices[0], result->triangles, side * side, 0, numThreads, &result->stats);
+	result->rebuildMs = (float)(Now() - start);
+
+	return ok;
+}
@@ -0,0 +1,143 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: meshTopology.h
+//
+// Desc: Edge topology of a triangle list, built without D3DX: the
+//       neighbour across each face edge (laid out like a D3DX adjacency
+//       buffer), the list of unique edges with the faces on either side,
+//       the faces around each vertex, and which edges and vertices lie on
+//       an open border or where more than two faces meet.
+//
+//       Each thread owns a range of vertices and lists the faces around
+//       them.  From those faces it gathers the few half-edges whose lower
+//       vertex is each of its own, sorts them and merges runs of the same
+//       edge into one edge record; nothing is sent between threads.  The
+//       result does not depend on the number of threads.  Indices are 32
+//       bit throughout, and 0xffffffff marks a missing neighbour.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __meshTopologyH__
+#define __meshTopologyH__
+
+#include "d3dUtility.h"
+#include <vector>
+
+const DWORD MeshNoNeighbour = 0xffffffff;
+
+enum MeshTopologyFlags
+{
+	MeshBoundary    = 0x01,   // an edge with one face, or a vertex on one
+	MeshNonManifold = 0x02    // an edge with three or more faces, or with
+	                          // two that disagree on winding; or a vertex on one
+};
+
+struct MeshEdge
+{
+	DWORD v0, v1;        // v0 < v1, after welding
+	DWORD face0;         // the first face, in face order
+	DWORD face1;         // the face across from it, MeshNoNeighbour if none
+	DWORD numFaces;
+	DWORD flags;
+};
+
+struct MeshTopologyStats
+{
+	MeshTopologyStats();
+
+	int   faces;
+	int   vertices;
+	int   edges;
+	int   boundaryEdges;
+	int   nonManifoldEdges;
+	int   boundaryVertices;
+	int   nonManifoldVertices;
+	int   numThreads;
+
+	float weldMs;          // BuildPositionRemap, when building from a mesh
+	float bucketMs;        // indices remapped, faces listed around their vertices
+	float sortMs;          // half-edges gathered, sorted and merged into edges
+	float vertexMs;        // vertex flags
+	float totalMs;         // weld included
+};
+
+// Maps every vertex to the first vertex with the same position, so faces
+// split only for their normals or texture coordinates still share edges.
+// The first D3DXVECTOR3 of each vertex is its position.
+void BuildPositionRemap(const void* vertices, int numVertices, int stride, std::vector<DWORD>* remap);
+
+class MeshTopology
+{
+public:
+	MeshTopology();
+
+	// Builds the topology of numFaces triangles over numVertices vertices.
+	// remap, if given, replaces each index first (see BuildPositionRemap);
+	// vertex results are then for the vertices remapped to.  numThreads = 0
+	// uses one thread per hardware thread.
+	bool build(const DWORD* indices, int numFaces, int numVertices, const DWORD* remap,
+		int numThreads, MeshTopologyStats* stats);
+
+	// The same for a D3DX mesh with 16 or 32 bit indices, welded by
+	// position.
+	bool buildFromMesh(ID3DXMesh* mesh, int numThreads, MeshTopologyStats* stats);
+
+	// Empties the topology, keeping its memory for the next build.
+	void clear();
+
+	int getNumFaces() const { return _numFaces; }
+	int getNumVertices() const { return _numVertices; }
+	int getNumEdges() const { return (int)_edges.size(); }
+
+	// The face across edge e of face f, which runs from corner e to corner
+	// (e + 1) % 3, at f * 3 + e; MeshNoNeighbour on a border and past the
+	// first two faces of a non-manifold edge.
+	const std::vector<DWORD>&    getAdjacency() const { return _adjacency; }
+
+	// Unique edges, and the edge each face edge is, at f * 3 + e.
+	const std::vector<MeshEdge>& getEdges() const { return _edges; }
+	const std::vector<DWORD>&    getFaceEdges() const { return _faceEdges; }
+
+	// The faces around vertex v are getVertexFaces()[start[v] .. start[v + 1]),
+	// in face order.
+	const std::vector<DWORD>&    getVertexFaceStart() const { return _vertexFaceStart; }
+	const std::vector<DWORD>&    getVertexFaces() const { return _vertexFaces; }
+
+	// MeshTopologyFlags of each vertex
+	const std::vector<BYTE>&     getVertexFlags() const { return _vertexFlags; }
+
+	// The remapped index at corner c, as the topology saw it.
+	const std::vector<DWORD>&    getIndices() const { return _indices; }
+
+private:
+	int _numFaces;
+	int _numVertices;
+
+	std::vector<DWORD>    _indices;
+	std::vector<DWORD>    _adjacency;
+	std::vector<MeshEdge> _edges;
+	std::vector<DWORD>    _faceEdges;
+	std::vector<DWORD>    _vertexFaceStart;
+	std::vector<DWORD>    _vertexFaces;
+	std::vector<BYTE>     _vertexFlags;
+
+	// working memory, kept for the next build
+	std::vector<MeshEdge> _tailEdges;   // the last thread's edges
+};
+
+//
+// Headless benchmark: the topology of a gridSize x gridSize grid of quads,
+// 2 gridSize^2 triangles, with a few holes punched in it.
+//
+
+struct MeshTopologyBenchmark
+{
+	int               triangles;
+	float             ms;          // the first build, allocating as it goes
+	float             rebuildMs;   // a second build into the same memory
+	MeshTopologyStats stats;       // of the second build
+};
+
+bool BenchmarkMeshTopology(int gridSize, int numThreads, MeshTopologyBenchmark* result);
+
+#endif // __meshTopologyH__
@@ -8,6 +8,7 @@
 //
 // Desc: Generates the silhouette geometry of a mesh and renders it.  Note
 //       that we assume mesh vertex formats as described in MeshVertex.
+//       Each edge of the mesh, found with MeshTopology, gets one quad.
 //      
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -15,6 +16,8 @@
 #define __silhouetteEdgesH__
 
 #include "d3dUtility.h"
+#include "meshTopology.h"
+#include <vector>
 
 struct EdgeVertex
 {
@@ -36,8 +39,7 @@ class SilhouetteEdges
 public:
 	SilhouetteEdges(
 		IDirect3DDevice9* device,
-		ID3DXMesh* mesh, 
-		ID3DXBuffer* adjBuffer);
+		ID3DXMesh* mesh);
 
 	~SilhouetteEdges();
 
@@ -56,23 +58,15 @@ private:
 
 	bool createVertexDeclaration();
 
-	void getFaceNormal(
-		ID3DXMesh* mesh,
-		DWORD faceIndex,
-		D3DXVECTOR3* faceNormal);
-
 	void getFaceNormals(
-		ID3DXMesh* mesh,
-		ID3DXBuffer* adjBuffer,
-		D3DXVECTOR3* currentFaceNormal,
-		D3DXVECTOR3 adjFaceNormals[3],
-		DWORD       faceIndex);
+		const MeshVertex* vertices,
+		const std::vector<DWORD>& indices,
+		std::vector<D3DXVECTOR3>* faceNormals);
 
-	void genEdgeVertices(
+	bool genEdgeVertices(
 		ID3DXMesh* mesh,
-		ID3DXBuffer* adjBuffer);
+		const MeshTopology& topology);
 
-	void genEdgeIndices(
-		ID3DXMesh* mesh);	
+	bool genEdgeIndices();
 };
 #endif // __silhouetteEdgesH__
\ No newline at end of file
@@ -10,11 +10,15 @@
 //       vertex shader.  Note that you will have to switch to the REF device 
 //       to view this sample if your graphics card does not support vertex shaders.  Or you
 //       can use software vertex processing: D3DCREATE_SOFTWARE_VERTEXPROCESSING.
+//       Run with -benchmark, it instead times MeshTopology on a million
+//       triangles and exits.
 //          
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "d3dUtility.h"
 #include "silhouetteEdges.h"
+#include "meshTopology.h"
+#include <stdio.h>
 
 //
 // Globals
@@ -48,6 +52,8 @@ ID3DXConstantTable* OutlineConstTable = 0;
 D3DXHANDLE OutlineWorldViewHandle = 0;
 D3DXHANDLE OutlineProjHandle = 0;
 
+void ReportTopology();
+
 //
 // Framework functions
 //
@@ -60,12 +66,10 @@ bool Setup()
 	// for each mesh.
 	//
 
-	ID3DXBuffer* adjBuffer[4] = {0, 0, 0, 0};
-
-	D3DXCreateTeapot(Device, &Meshes[0], &adjBuffer[0]);
-	D3DXCreateSphere(Device, 1.0f, 20, 20, &Meshes[1], &adjBuffer[1]);
-	D3DXCreateTorus(Device, 0.5f, 1.0f, 20, 20, &Meshes[2], &adjBuffer[2]);
-	D3DXCreateCylinder(Device, 0.5f, 0.5f, 2.0f, 20, 20, &Meshes[3], &adjBuffer[3]);
+	D3DXCreateTeapot(Device, &Meshes[0], 0);
+	D3DXCreateSphere(Device, 1.0f, 20, 20, &Meshes[1], 0);
+	D3DXCreateTorus(Device, 0.5f, 1.0f, 20, 20, &Meshes[2], 0);
+	D3DXCreateCylinder(Device, 0.5f, 0.5f, 2.0f, 20, 20, &Meshes[3], 0);
 
 	D3DXMatrixTranslation(&WorldMatrices[0],  0.0f,  2.0f, 0.0f);
 	D3DXMatrixTranslation(&WorldMatrices[1],  0.0f, -2.0f, 0.0f);
@@ -81,15 +85,27 @@ bool Setup()
 	// Allocate mesh outlines
 	//
 
-	MeshOutlines[0] = new SilhouetteEdges(Device, Meshes[0], adjBuffer[0]);
-	MeshOutlines[1] = new SilhouetteEdges(Device, Meshes[1], adjBuffer[1]);
-	MeshOutlines[2] = new SilhouetteEdges(Device, Meshes[2], adjBuffer[2]);
-	MeshOutlines[3] = new SilhouetteEdges(Device, Meshes[3], adjBuffer[3]);
+	MeshOutlines[0] = new SilhouetteEdges(Device, Meshes[0]);
+	MeshOutlines[1] = new SilhouetteEdges(Device, Meshes[1]);
+	MeshOutlines[2] = new SilhouetteEdges(Device, Meshes[2]);
+	MeshOutlines[3] = new SilhouetteEdges(Device, Meshes[3]);
+
+	//
+	// Report the meshes' topology.
+	//
 
-	d3d::Release<ID3DXBuffer*>(adjBuffer[0]);
-	d3d::Release<ID3DXBuffer*>(adjBuffer[1]);
-	d3d::Release<ID3DXBuffer*>(adjBuffer[2]);
-	d3d::Release<ID3DXBuffer*>(adjBuffer[3]);
+	char report[256];
+	for(int i = 0; i < 4; i++)
+	{
+		MeshTopology topology;
+		MeshTopologyStats stats;
+		topology.buildFromMesh(Meshes[i], 0, &stats);
+
+		sprintf(report,
+			"Mesh %d: %d faces, %d edges, %d boundary, %d non-manifold; %.3f ms\n",
+			i, stats.faces, stats.edges, stats.boundaryEdges, stats.nonManifoldEdges, stats.totalMs);
+		::OutputDebugString(report);
+	}
 
 	//
 	// Compile Toon Shader
@@ -363,6 +379,13 @@ int WINAPI WinMain(HINSTANCE hinstance,
 				   PSTR cmdLine,
 				   int showCmd)
 {
+	// the topology benchmark needs no device
+	if( d3d::FindSwitch(cmdLine, "-benchmark") )
+	{
+		ReportTopology();
+		return 0;
+	}
+
 	if(!d3d::InitD3D(hinstance,
 		Width, Height, true, D3DDEVTYPE_HAL, &Device))
 	{
@@ -385,4 +408,25 @@ int WINAPI WinMain(HINSTANCE hinstance,
 	return 0;
 }
 
-
+//
+// Writes the topology benchmark's timings, a million triangles on one
+// thread and on all of them, to the debugger output.
+//
+void ReportTopology()
+{
+	int threads[2] = { 1, 0 };
+	for(int i = 0; i < 2; i++)
+	{
+		MeshTopologyBenchmark bench;
+		if( !BenchmarkMeshTopology(708, threads[i], &bench) )
+			continue;
+
+		char report[256];
+		sprintf(report,
+			"Topology benchmark: %d triangles, %d thread(s); %.1f ms, rebuilt in %.1f ms "
+			"(bucket %.1f, sort %.1f, vertex %.1f)\n",
+			bench.triangles, bench.stats.numThreads, bench.ms, bench.rebuildMs,
+			bench.stats.bucketMs, bench.stats.sortMs, bench.stats.vertexMs);
+		::OutputDebugString(report);
+	}
+}
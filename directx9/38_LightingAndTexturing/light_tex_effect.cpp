@@ -7,12 +7,18 @@
 // System: AMD Athlon 1800+ XP, 512 DDR, Geforce 3, Windows XP, MSVC++ 7.0 
 //
 // Desc: Deomstrates using an effect file to light and texture a 3D model.
-//       Use the arrow keys to rotate.
+//       Use the arrow keys to rotate.  The .x file and the terrain texture
+//       are read on worker threads (see assetLoader.h); the mesh and the
+//       texture are created on the main thread once they are in.
 //        
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "d3dUtility.h"
+#include "assetLoader.h"
+#include <memory>
+#include <string>
 #include <vector>
+#include <stdio.h>
 
 //
 // Globals
@@ -23,9 +29,8 @@ IDirect3DDevice9* Device = 0;
 const int Width  = 640;
 const int Height = 480;
 
-ID3DXMesh*                      Mesh = 0;
-std::vector<D3DMATERIAL9>       Mtrls(0);
-std::vector<IDirect3DTexture9*> Textures(0);
+ID3DXMesh*                Mesh = 0;
+std::vector<D3DMATERIAL9> Mtrls(0);
 
 ID3DXEffect* LightTexEffect = 0;
 
@@ -37,9 +42,41 @@ D3DXHANDLE TexHandle          = 0;
 D3DXHANDLE LightTexTechHandle = 0;
 
 //
-// Framework functions
+// mountain.x is read in the background and nothing is drawn until it and
+// the terrain texture are in.
 //
-bool Setup()
+
+AssetLoader* Loader = 0;
+
+//
+// Loading
+//
+
+// Reads a whole file into data; false if it is missing or empty.
+bool ReadWholeFile(const std::string& fileName, std::vector<BYTE>* data)
+{
+	FILE* file = fopen(fileName.c_str(), "rb");
+	if( !file )
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if( size > 0 )
+	{
+		data->resize(size);
+		if( fread(&(*data)[0], 1, size, file) != (size_t)size )
+			data->clear();
+	}
+	fclose(file);
+
+	return !data->empty();
+}
+
+// Creates the mesh from the bytes of the .x file, on the main thread.  The
+// effect samples the terrain texture itself, so the texture the material
+// names is not loaded again for the subset.
+bool FinishMountain(const std::vector<BYTE>& data)
 {
 	HRESULT hr = 0;
 
@@ -50,8 +87,9 @@ bool Setup()
 	ID3DXBuffer* mtrlBuffer = 0;
 	DWORD        numMtrls   = 0;
 
-	hr = D3DXLoadMeshFromX(  
-		"mountain.x",
+	hr = D3DXLoadMeshFromXInMemory(  
+		&data[0],
+		(DWORD)data.size(),
 		D3DXMESH_MANAGED,
 		Device,
 		0,
@@ -62,7 +100,7 @@ bool Setup()
 
 	if(FAILED(hr))
 	{
-		::MessageBox(0, "D3DXLoadMeshFromX() - FAILED", 0, 0);
+		::MessageBox(0, "D3DXLoadMeshFromXInMemory() - FAILED", 0, 0);
 		return false;
 	}
 
@@ -82,29 +120,61 @@ bool Setup()
 
 			// save the ith material
 			Mtrls.push_back( mtrls[i].MatD3D );
-
-			// check if the ith material has an associative texture
-			if( mtrls[i].pTextureFilename != 0 )
-			{
-				// yes, load the texture for the ith subset
-				IDirect3DTexture9* tex = 0;
-				D3DXCreateTextureFromFile(
-					Device,
-					mtrls[i].pTextureFilename,
-					&tex);
-
-				// save the loaded texture
-				Textures.push_back( tex );
-			}
-			else
-			{
-				// no texture for the ith subset
-				Textures.push_back( 0 );
-			}
 		}
 	}
 	d3d::Release<ID3DXBuffer*>(mtrlBuffer); // done w/ buffer
 
+	return true;
+}
+
+// Reads the terrain texture and mountain.x on workers.  The mountain waits
+// for the texture, so it never appears untextured; both are created on the
+// main thread.
+void RequestMountain()
+{
+	std::shared_ptr<std::vector<BYTE> > texData(new std::vector<BYTE>);
+	std::shared_ptr<std::vector<BYTE> > meshData(new std::vector<BYTE>);
+
+	AssetId terrain = Loader->load("Terrain_3x_diffcol.jpg",
+		[texData](AssetId) -> bool
+		{
+			D3DXIMAGE_INFO info;
+			return ReadWholeFile("Terrain_3x_diffcol.jpg", texData.get()) &&
+				SUCCEEDED(D3DXGetImageInfoFromFileInMemory(&(*texData)[0], (UINT)texData->size(), &info));
+		},
+		[texData](bool ok)
+		{
+			IDirect3DTexture9* tex = 0;
+			if( ok )
+				D3DXCreateTextureFromFileInMemory(Device, &(*texData)[0], (UINT)texData->size(), &tex);
+
+			LightTexEffect->SetTexture(TexHandle, tex);
+
+			d3d::Release<IDirect3DTexture9*>(tex);
+			texData->clear();
+		});
+
+	Loader->load("mountain.x",
+		[meshData, terrain](AssetId self) -> bool
+		{
+			Loader->addDependency(self, terrain);
+			return ReadWholeFile("mountain.x", meshData.get());
+		},
+		[meshData](bool ok)
+		{
+			if( !ok || !FinishMountain(*meshData) )
+				::MessageBox(0, "Loading mountain.x - FAILED", 0, 0);
+			meshData->clear();
+		});
+}
+
+//
+// Framework functions
+//
+bool Setup()
+{
+	HRESULT hr = 0;
+
 	//
 	// Create effect.
 	//
@@ -163,23 +233,20 @@ bool Setup()
 	LightTexEffect->SetMatrix( ProjMatrixHandle, &P);
 
 	//
-	// Set texture
-	IDirect3DTexture9* tex = 0;
-	D3DXCreateTextureFromFile(Device, "Terrain_3x_diffcol.jpg", &tex);
-
-	LightTexEffect->SetTexture(TexHandle, tex);
-
-	d3d::Release<IDirect3DTexture9*>(tex);
+	// Load the mesh and set the texture, in the background; the effect
+	// must exist before the texture comes in.
+	Loader = new AssetLoader(0);
+	RequestMountain();
 
 	return true;
 }
 
 void Cleanup()
 {
-	d3d::Release<ID3DXMesh*>(Mesh);
+	// first, so no worker is still reading when the rest goes
+	d3d::Delete<AssetLoader*>(Loader);
 
-	for(int i = 0; i < Textures.size(); i++)
-		d3d::Release<IDirect3DTexture9*>( Textures[i] );
+	d3d::Release<ID3DXMesh*>(Mesh);
 
 	d3d::Release<ID3DXEffect*>(LightTexEffect);
 }
@@ -189,9 +256,12 @@ bool Display(float timeDelta)
 	if( Device )
 	{
 		// 
-		// Update the scene: Allow user to rotate around scene.
+		// Update the scene: finish whatever the loader has read, and allow
+		// user to rotate around scene.
 		//
 		
+		Loader->update();
+
 		static float angle  = (3.0f * D3DX_PI) / 2.0f;
 		static float height = 5.0f;
 	
@@ -228,7 +298,8 @@ bool Display(float timeDelta)
 		UINT numPasses = 0;
     	LightTexEffect->Begin(&numPasses, 0);
 
-		for(int i = 0; i < numPasses; i++)
+		// nothing to draw until the mesh is in
+		for(int i = 0; Mesh && i < numPasses; i++)
 		{
 			LightTexEffect->BeginPass(i);
 
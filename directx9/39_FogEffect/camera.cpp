@@ -62,6 +62,41 @@ void Camera::getLook(D3DXVECTOR3* look)
 	*look = _look;
 }
 
+void Camera::getOrientation(D3DXQUATERNION* q)
+{
+	// the axes drift between view matrix updates; square them up first
+	D3DXVECTOR3 look, up, right;
+	D3DXVec3Normalize(&look, &_look);
+
+	D3DXVec3Cross(&up, &look, &_right);
+	D3DXVec3Normalize(&up, &up);
+
+	D3DXVec3Cross(&right, &up, &look);
+	D3DXVec3Normalize(&right, &right);
+
+	D3DXMATRIX R(
+		right.x, right.y, right.z, 0.0f,
+		up.x,    up.y,    up.z,    0.0f,
+		look.x,  look.y,  look.z,  0.0f,
+		0.0f,    0.0f,    0.0f,    1.0f);
+
+	D3DXQuaternionRotationMatrix(q, &R);
+	D3DXQuaternionNormalize(q, q);
+}
+
+void Camera::setOrientation(const D3DXQUATERNION* q)
+{
+	D3DXQUATERNION n;
+	D3DXQuaternionNormalize(&n, q);
+
+	D3DXMATRIX R;
+	D3DXMatrixRotationQuaternion(&R, &n);
+
+	_right = D3DXVECTOR3(R._11, R._12, R._13);
+	_up    = D3DXVECTOR3(R._21, R._22, R._23);
+	_look  = D3DXVECTOR3(R._31, R._32, R._33);
+}
+
 void Camera::walk(float units)
 {
 	// move only on xz plane for land object
@@ -40,6 +40,11 @@ public:
 	void getRight(D3DXVECTOR3* right);
 	void getUp(D3DXVECTOR3* up);
 	void getLook(D3DXVECTOR3* look);
+
+	// The rotation taking the x, y and z axes to right, up and look; for
+	// recording and replaying the camera's path.
+	void getOrientation(D3DXQUATERNION* q);
+	void setOrientation(const D3DXQUATERNION* q);
 private:
 	CameraType  _cameraType;
 	D3DXVECTOR3 _right;
@@ -0,0 +1,342 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: cameraPath.cpp
+//
+// Desc: Records the camera's pose as it moves and plays it back, so a
+//       flythrough can be repeated exactly.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "cameraPath.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+namespace
+{
+	// A recorded key is dropped when the keys on either side of it predict
+	// it this closely.
+	const float PositionTolerance    = 0.001f;
+	const float OrientationTolerance = 1e-6f;   // 1 - |dot|, about 0.16 degrees
+
+	// at most this many samples are folded into one key
+	const int MaxSkipped = 64;
+
+	struct PathFileHeader
+	{
+		char  magic[4];  // "CPTH"
+		DWORD version;
+		DWORD numKeys;
+	};
+
+	struct PathFileKey
+	{
+		float time;
+		float position[3];
+		short orientation[4];  // x, y, z, w * 32767
+	};
+
+	double Now()
+	{
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+	}
+
+	short Quantize(float v)
+	{
+		v = v < -1.0f ? -1.0f : (v > 1.0f ? 1.0f : v);
+		return (short)floorf(v * 32767.0f + 0.5f);
+	}
+}
+
+CameraPath::CameraPath()
+{
+	_cursor = 0;
+}
+
+void CameraPath::clear()
+{
+	_keys.clear();
+	_skipped.clear();
+	_cursor = 0;
+}
+
+float CameraPath::getDuration() const
+{
+	if( _keys.empty() )
+		return 0.0f;
+
+	return _keys.back()._time - _keys.front()._time;
+}
+
+void CameraPath::interpolate(
+	const Key& a, const Key& b, float time,
+	D3DXVECTOR3* position, D3DXQUATERNION* orientation)
+{
+	float span = b._time - a._time;
+	float t    = span > 0.0f ? (time - a._time) / span : 0.0f;
+
+	D3DXVec3Lerp(position, &a._position, &b._position, t);
+	D3DXQuaternionSlerp(orientation, &a._orientation, &b._orientation, t);
+}
+
+bool CameraPath::predicts(const Key& a, const Key& b, const Key& k)
+{
+	D3DXVECTOR3    position;
+	D3DXQUATERNION orientation;
+	interpolate(a, b, k._time, &position, &orientation);
+
+	D3DXVECTOR3 d = position - k._position;
+	if( D3DXVec3Dot(&d, &d) > PositionTolerance * PositionTolerance )
+		return false;
+
+	return 1.0f - fabsf(D3DXQuaternionDot(&orientation, &k._orientation)) <= OrientationTolerance;
+}
+
+void CameraPath::record(float time, const D3DXVECTOR3& position, const D3DXQUATERNION& orientation)
+{
+	Key key;
+	key._time     = time;
+	key._position = position;
+	D3DXQuaternionNormalize(&key._orientation, &orientation);
+
+	// q and -q are the same orientation; keep neighbours on the same side so
+	// slerp takes the short way
+	if( !_keys.empty() && D3DXQuaternionDot(&_keys.back()._orientation, &key._orientation) < 0.0f )
+		key._orientation = -key._orientation;
+
+	int n = (int)_keys.size();
+	if( n >= 2 && (int)_skipped.size() < MaxSkipped )
+	{
+		// Could the last key go, with the line from the one before it to the
+		// new key standing in for it and for everything it replaced?
+		const Key& from = _keys[n - 2];
+
+		bool fits = predicts(from, key, _keys[n - 1]);
+		for(int i = 0; fits && i < (int)_skipped.size(); i++)
+			fits = predicts(from, key, _skipped[i]);
+
+		if( fits )
+		{
+			_skipped.push_back(_keys[n - 1]);
+			_keys[n - 1] = key;
+			return;
+		}
+	}
+
+	_skipped.clear();
+	_keys.push_back(key);
+}
+
+void CameraPath::sample(float time, D3DXVECTOR3* position, D3DXQUATERNION* orientation) const
+{
+	if( _keys.empty() )
+	{
+		*position = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+		D3DXQuaternionIdentity(orientation);
+		return;
+	}
+
+	time += _keys[0]._time;
+
+	int last = (int)_keys.size() - 1;
+	if( time <= _keys[0]._time || last == 0 )
+	{
+		*position    = _keys[0]._position;
+		*orientation = _keys[0]._orientation;
+		return;
+	}
+
+	if( time >= _keys[last]._time )
+	{
+		*position    = _keys[last]._position;
+		*orientation = _keys[last]._orientation;
+		return;
+	}
+
+	if( _cursor > last - 1 || _keys[_cursor]._time > time )
+		_cursor = 0;
+
+	while( _keys[_cursor + 1]._time <= time )
+		_cursor++;
+
+	interpolate(_keys[_cursor], _keys[_cursor + 1], time, position, orientation);
+	D3DXQuaternionNormalize(orientation, orientation);
+}
+
+bool CameraPath::save(const char* fileName) const
+{
+	std::ofstream out(fileName, std::ios_base::binary);
+	if( !out.is_open() )
+		return false;
+
+	PathFileHeader header;
+	header.magic[0] = 'C'; header.magic[1] = 'P'; header.magic[2] = 'T'; header.magic[3] = 'H';
+	header.version = 1;
+	header.numKeys = (DWORD)_keys.size();
+
+	out.write((const char*)&header, sizeof(header));
+
+	for(int i = 0; i < (int)_keys.size(); i++)
+	{
+		const Key& key = _keys[i];
+
+		PathFileKey record;
+		record.time           = key._time;
+		record.position[0]    = key._position.x;
+		record.position[1]    = key._position.y;
+		record.position[2]    = key._position.z;
+		record.orientation[0] = Quantize(key._orientation.x);
+		record.orientation[1] = Quantize(key._orientation.y);
+		record.orientation[2] = Quantize(key._orientation.z);
+		record.orientation[3] = Quantize(key._orientation.w);
+
+		out.write((const char*)&record, sizeof(record));
+	}
+
+	return !out.fail();
+}
+
+bool CameraPath::load(const char* fileName)
+{
+	std::ifstream in(fileName, std::ios_base::binary);
+	if( !in.is_open() )
+		return false;
+
+	PathFileHeader header;
+	in.read((char*)&header, sizeof(header));
+	if( in.fail() ||
+		header.magic[0] != 'C' || header.magic[1] != 'P' ||
+		header.magic[2] != 'T' || header.magic[3] != 'H' ||
+		header.version != 1 )
+		return false;
+
+	// the count is not trusted to size anything until the file is known
+	// to hold that many keys
+	std::streamoff start = in.tellg();
+	in.seekg(0, std::ios_base::end);
+	std::streamoff remaining = in.tellg() - start;
+	in.seekg(start);
+	if( in.fail() || remaining < 0 ||
+		(unsigned long long)header.numKeys * sizeof(PathFileKey) > (unsigned long long)remaining )
+		return false;
+
+	std::vector<PathFileKey> records(header.numKeys);
+	if( header.numKeys > 0 )
+		in.read((char*)&records[0], records.size() * sizeof(PathFileKey));
+	if( in.fail() )
+		return false;
+
+	clear();
+	_keys.resize(records.size());
+	for(int i = 0; i < (int)records.size(); i++)
+	{
+		const PathFileKey& record = records[i];
+
+		Key& key = _keys[i];
+		key._time     = record.time;
+		key._position = D3DXVECTOR3(record.position[0], record.position[1], record.position[2]);
+
+		D3DXQUATERNION q(
+			record.orientation[0] / 32767.0f,
+			record.orientation[1] / 32767.0f,
+			record.orientation[2] / 32767.0f,
+			record.orientation[3] / 32767.0f);
+		D3DXQuaternionNormalize(&key._orientation, &q);
+	}
+
+	return true;
+}
+
+//
+// Flythroughs
+//
+
+FlythroughReport::FlythroughReport()
+{
+	frames    = 0;
+	totalMs   = 0.0f;
+	averageMs = 0.0f;
+	minMs     = 0.0f;
+	medianMs  = 0.0f;
+	p95Ms     = 0.0f;
+	p99Ms     = 0.0f;
+	maxMs     = 0.0f;
+}
+
+void SummarizeFrameTimes(const std::vector<float>& frameMs, FlythroughReport* report)
+{
+	*report = FlythroughReport();
+	if( frameMs.empty() )
+		return;
+
+	std::vector<float> sorted(frameMs);
+	std::sort(sorted.begin(), sorted.end());
+
+	int n = (int)sorted.size();
+
+	double total = 0.0;
+	for(int i = 0; i < n; i++)
+		total += sorted[i];
+
+	report->frames    = n;
+	report->totalMs   = (float)total;
+	report->averageMs = (float)(total / n);
+	report->minMs     = sorted[0];
+	report->medianMs  = sorted[(int)(0.50f * (n - 1) + 0.5f)];
+	report->p95Ms     = sorted[(int)(0.95f * (n - 1) + 0.5f)];
+	report->p99Ms     = sorted[(int)(0.99f * (n - 1) + 0.5f)];
+	report->maxMs     = sorted[n - 1];
+}
+
+bool RunFlythrough(const CameraPath& path, float step, FlythroughFrame* frame,
+	FlythroughReport* report, std::vector<float>* frameMs)
+{
+	if( path.size() == 0 || step <= 0.0f || !frame || !report )
+		return false;
+
+	int numFrames = (int)(path.getDuration() / step) + 1;
+
+	std::vector<float> times(numFrames);
+	for(int i = 0; i < numFrames; i++)
+	{
+		D3DXVECTOR3    position;
+		D3DXQUATERNION orientation;
+		path.sample(i * step, &position, &orientation);
+
+		double start = Now();
+		frame->onFrame(position, orientation, step);
+		times[i] = (float)(Now() - start);
+	}
+
+	SummarizeFrameTimes(times, report);
+	if( frameMs )
+		frameMs->swap(times);
+
+	return true;
+}
+
+void WriteFlythroughReport(const char* fileName, const char* pathName, const FlythroughReport& report)
+{
+	// the path name can be any length, so only the numbers are formatted
+	char numbers[512];
+	::sprintf(numbers,
+		": %d frames, %.3f ms total, average %.3f ms, min %.3f, "
+		"median %.3f, 95%% %.3f, 99%% %.3f, max %.3f ms\n",
+		report.frames, report.totalMs, report.averageMs, report.minMs,
+		report.medianMs, report.p95Ms, report.p99Ms, report.maxMs);
+
+	std::string line = std::string("Flythrough ") + (pathName ? pathName : "") + numbers;
+
+	::OutputDebugString(line.c_str());
+
+	if( fileName )
+	{
+		std::ofstream out(fileName, std::ios_base::app);
+		out << line;
+	}
+}
@@ -7,13 +7,36 @@
 // System: AMD Athlon 1800+ XP, 512 DDR, Geforce 3, Windows XP, MSVC++ 7.0 
 //
 // Desc: Deomstrates fog using an effect file.  Use the arrow keys, 
-//       and M, N, W, S, keys to move.
+//       and M, N, W, S, keys to move.  C toggles the compact terrain
+//       vertex format, T toggles the out-of-core streamed terrain.
+//       O toggles culling the pillars hidden behind the terrain with a
+//       software occlusion buffer.  K starts and stops recording the
+//       camera's path to fog.path and L plays it back at fixed steps,
+//       writing the frame times to flythrough.txt.  Run with
+//       -flythrough <path> to play a path with no window or device, timing
+//       the camera and culling work, and exit.  G toggles the camera's
+//       collision with the terrain and the pillars; a crowd of walkers
+//       roams the terrain, moved in one batch with the same collision.
+//       Run with -streamcheck to fly a loop over the streamed terrain
+//       without a window, appending how the streamer kept up to
+//       streaming.txt, and exit; with -benchmark to time the occlusion
+//       buffer and the swept collision, write the results to the debugger
+//       and exit.
 //        
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "d3dUtility.h"
 #include "terrain.h"
+#include "terrainStream.h"
 #include "camera.h"
+#include "occlusionCull.h"
+#include "cameraPath.h"
+#include "sweptCollision.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
 
 //
 // Globals
@@ -29,6 +52,229 @@ Camera   TheCamera(Camera::AIRCRAFT);
 ID3DXEffect* FogEffect   = 0;
 D3DXHANDLE FogTechHandle = 0;
 
+// 'C' switches between the TIN and the compact vertex format
+bool UseCompactTerrain = false;
+D3DXVECTOR3 LightDirection(0.0f, 1.0f, 0.0f);
+
+// 'T' draws the same heightmap streamed from a tile file instead, with room
+// for about a dozen 16x16 cell tiles
+const char*  TileFileName   = "coastMountain64.til";
+const char*  StreamFileName = "streaming.txt";
+const size_t StreamBudget   = 12 * 19 * 19 * sizeof(float) + 12 * 17 * 17 * 24;
+
+// -streamcheck has no device, so its tiles hold only their heights.  Room
+// for six of the sixteen, and a radius that needs at most four, so the loop
+// has to evict tiles and read them again.
+const size_t StreamCheckBudget = 6 * 19 * 19 * sizeof(float);
+const float  StreamCheckRadius = 40.0f;
+
+TerrainStreamer* TheStreamer = 0;
+bool UseStreamedTerrain = false;
+D3DXVECTOR3 LastCameraPos(0.0f, 0.0f, 0.0f);
+
+// 'O' toggles occlusion culling of the pillars against the terrain
+OcclusionBuffer* TheOccluder = 0;
+bool UseOcclusionCulling = true;
+std::vector<D3DXVECTOR3> OccluderPositions;
+std::vector<DWORD>       OccluderIndices;
+
+const int   NumPillars = 2000;
+ID3DXMesh*  PillarMesh = 0;
+std::vector<d3d::BoundingBox> Pillars;
+std::vector<int> VisiblePillars;
+float ReportTime = 0.0f;
+
+// 'G' toggles the camera's collision; the walkers always collide
+SweptCollider TheCollider;
+bool          UseCollision = true;
+const float   CameraRadius = 2.0f;
+
+const int                NumWalkers = 500;
+ID3DXMesh*               WalkerMesh = 0;
+std::vector<D3DXVECTOR3> WalkerPositions;
+std::vector<D3DXVECTOR3> WalkerHeadings;
+std::vector<D3DXVECTOR3> WalkerMoves;
+std::vector<float>       WalkerRadii;
+std::vector<BYTE>        WalkerTouched;
+
+// 'K' records the camera's path, 'L' plays it back
+const char* PathFileName   = "fog.path";
+const char* ReportFileName = "flythrough.txt";
+const float PlaybackStep   = 1.0f / 60.0f;
+
+CameraPath         Path;
+bool               Recording     = false;
+bool               Playing       = false;
+float              PathTime      = 0.0f;
+double             LastFrameTime = 0.0;
+std::vector<float> PlaybackFrameMs;
+
+double Now()
+{
+	LARGE_INTEGER count, frequency;
+	::QueryPerformanceCounter(&count);
+	::QueryPerformanceFrequency(&frequency);
+	return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+}
+
+//
+// A coarse copy of the terrain for the occlusion buffer.  Each vertex takes
+// the lowest height around it, so the coarse surface stays under the real
+// one and never hides something the terrain does not.
+//
+void BuildTerrainOccluder(Terrain* terrain, int numVertsPerRow, float cellSpacing, int step)
+{
+	int last = numVertsPerRow - 1;
+
+	std::vector<int> samples;
+	for(int i = 0; i < last; i += step)
+		samples.push_back(i);
+	samples.push_back(last);
+
+	int n = (int)samples.size();
+	float halfSize = last * cellSpacing * 0.5f;
+
+	OccluderPositions.clear();
+	for(int r = 0; r < n; r++)
+	{
+		for(int c = 0; c < n; c++)
+		{
+			int row0 = samples[r > 0 ? r - 1 : r], row1 = samples[r < n - 1 ? r + 1 : r];
+			int col0 = samples[c > 0 ? c - 1 : c], col1 = samples[c < n - 1 ? c + 1 : c];
+
+			float lowest = (float)terrain->getHeightmapEntry(row0, col0);
+			for(int i = row0; i <= row1; i++)
+			{
+				for(int j = col0; j <= col1; j++)
+				{
+					float h = (float)terrain->getHeightmapEntry(i, j);
+					lowest = h < lowest ? h : lowest;
+				}
+			}
+
+			OccluderPositions.push_back(D3DXVECTOR3(
+				-halfSize + samples[c] * cellSpacing,
+				lowest,
+				 halfSize - samples[r] * cellSpacing));
+		}
+	}
+
+	// same winding as the terrain's own triangles
+	OccluderIndices.clear();
+	for(int r = 0; r < n - 1; r++)
+	{
+		for(int c = 0; c < n - 1; c++)
+		{
+			OccluderIndices.push_back( r      * n + c);
+			OccluderIndices.push_back( r      * n + c + 1);
+			OccluderIndices.push_back((r + 1) * n + c);
+
+			OccluderIndices.push_back((r + 1) * n + c);
+			OccluderIndices.push_back( r      * n + c + 1);
+			OccluderIndices.push_back((r + 1) * n + c + 1);
+		}
+	}
+}
+
+//
+// Writes the heightmap out as 16x16 cell tiles, unless the tile file from an
+// earlier run is still current.
+//
+bool ConvertTerrainTiles()
+{
+	if( TerrainStreamer::IsTileFileCurrent("coastMountain64.raw", 64, 64, 6.0f, 0.5f, 16, TileFileName) )
+		return true;
+
+	return TerrainStreamer::ConvertRawFile("coastMountain64.raw", 64, 64, 6.0f, 0.5f, 16, TileFileName);
+}
+
+//
+// Run with -streamcheck: flies a loop over the terrain at walking speed, in
+// real time and with no device, and reports the tiles the streamer had not
+// loaded in time and the memory it used.
+//
+bool RunStreamingCheck()
+{
+	if( !ConvertTerrainTiles() )
+		return false;
+
+	std::vector<D3DXVECTOR3> waypoints;
+	waypoints.push_back(D3DXVECTOR3(-150.0f, 100.0f, -150.0f));
+	waypoints.push_back(D3DXVECTOR3( 150.0f, 100.0f, -150.0f));
+	waypoints.push_back(D3DXVECTOR3( 150.0f, 100.0f,  150.0f));
+	waypoints.push_back(D3DXVECTOR3(-150.0f, 100.0f,  150.0f));
+	waypoints.push_back(D3DXVECTOR3(-150.0f, 100.0f, -150.0f));
+	waypoints.push_back(D3DXVECTOR3( 150.0f, 100.0f,  150.0f));
+
+	StreamStats stats;
+	if( !SimulateStreamingPath(TileFileName, StreamCheckBudget, StreamCheckRadius, 1.0f, waypoints, 100.0f,
+		1.0f / 60.0f, &stats) )
+		return false;
+
+	char line[256];
+	::sprintf(line, "Streaming: %d frames, %d tiles requested, %d loaded in %.0f ms, %d evicted, "
+		"%d missed, peak %u of %u bytes%s\n",
+		stats.frames, stats.requests, stats.loads, stats.loadMs, stats.evictions,
+		stats.misses, (unsigned)stats.peakBytes, (unsigned)StreamCheckBudget,
+		stats.peakBytes > StreamCheckBudget ? ", OVER BUDGET" : "");
+	::OutputDebugString(line);
+
+	std::ofstream out(StreamFileName, std::ios_base::app);
+	out << line;
+	return true;
+}
+
+//
+// Run with -benchmark in place of the sample.  Needs no device.
+//
+void Benchmark()
+{
+	OcclusionBenchmark bench;
+	if( BenchmarkOcclusion(0, &bench) )
+	{
+		char report[256];
+		::sprintf(report, "Occlusion: %d triangles raster %.3f ms, %d boxes tested in %.3f ms, "
+			"%d culled (reference %d, %d wrong)\n",
+			bench.numOccluderTriangles, bench.rasterMs, bench.numBoxes, bench.testMs,
+			bench.occluded, bench.referenceOccluded, bench.wrong);
+		::OutputDebugString(report);
+	}
+
+	SweepBenchmark sweepBench;
+	if( BenchmarkSweptCollision(2000, 120, 1, &sweepBench) )
+	{
+		char report[256];
+		::sprintf(report, "Swept collision: %d agents against %d volumes in %.3f ms per frame on %d threads, "
+			"%.0f volume tests, %d left inside%s\n",
+			sweepBench.numAgents, sweepBench.numObstacles, sweepBench.moveMs, sweepBench.numThreads,
+			sweepBench.obstacleTests, sweepBench.penetrations, sweepBench.matches ? "" : ", MISMATCH");
+		::OutputDebugString(report);
+	}
+}
+
+//
+// Scatters the pillars over TheTerrain and sets up the occlusion buffer
+// that culls them.  Needs no device.
+//
+void PlacePillars()
+{
+	srand(7);
+	for(int i = 0; i < NumPillars; i++)
+	{
+		float x = -180.0f + 360.0f * ((float)rand() / (float)RAND_MAX);
+		float z = -180.0f + 360.0f * ((float)rand() / (float)RAND_MAX);
+		float y = TheTerrain->getHeight(x, z);
+
+		d3d::BoundingBox box;
+		box._min = D3DXVECTOR3(x - 1.0f, y,        z - 1.0f);
+		box._max = D3DXVECTOR3(x + 1.0f, y + 8.0f, z + 1.0f);
+		Pillars.push_back(box);
+	}
+
+	BuildTerrainOccluder(TheTerrain, 64, 6.0f, 4);
+	TheOccluder = new OcclusionBuffer(320, 240, 0);
+}
+
 //
 // Framework functions
 //
@@ -40,9 +286,102 @@ bool Setup()
 	// Init Scene. 
 	//
 
-	D3DXVECTOR3 lightDirection(0.0f, 1.0f, 0.0f);
 	TheTerrain = new Terrain(Device, "coastMountain64.raw", 64, 64, 6, 0.5f);
-	TheTerrain->genTexture(&lightDirection);
+	TheTerrain->genTexture(&LightDirection);
+
+	if( !TheTerrain->buildCompact(32) )
+	{
+		::MessageBox(0, "buildCompact() - FAILED", 0, 0);
+		return false;
+	}
+
+	//
+	// Replace the regular grid with an adaptive TIN.
+	//
+
+	TinStats tinStats;
+	if( !TheTerrain->simplify(1.0f, 32, &tinStats) )
+	{
+		::MessageBox(0, "simplify() - FAILED", 0, 0);
+		return false;
+	}
+
+	char tinReport[256];
+	::sprintf(tinReport, "Terrain TIN: %d -> %d triangles (%.2fx fewer), %d tiles, %.0f ms\n",
+		tinStats.gridTriangles, tinStats.tinTriangles, tinStats.reduction,
+		tinStats.numTiles, tinStats.buildMs);
+	::OutputDebugString(tinReport);
+
+	//
+	// Stream the same heightmap from its tiles.
+	//
+
+	if( !ConvertTerrainTiles() )
+	{
+		::MessageBox(0, "ConvertRawFile() - FAILED", 0, 0);
+		return false;
+	}
+
+	TheStreamer = new TerrainStreamer(Device);
+	if( !TheStreamer->open(TileFileName, StreamBudget) )
+	{
+		::MessageBox(0, "TerrainStreamer::open() - FAILED", 0, 0);
+		return false;
+	}
+	TheStreamer->setRadius(100.0f, 1.0f);
+
+	//
+	// Scatter pillars over the terrain, most of them hidden behind the hills
+	// from any one spot, and set up the occlusion buffer that culls them.
+	//
+
+	if( FAILED(D3DXCreateBox(Device, 2.0f, 8.0f, 2.0f, &PillarMesh, 0)) )
+	{
+		::MessageBox(0, "D3DXCreateBox() - FAILED", 0, 0);
+		return false;
+	}
+
+	PlacePillars();
+
+	//
+	// Collision against the terrain and the pillars, and a crowd of walkers
+	// that use it.
+	//
+
+	std::vector<float> heights(64 * 64);
+	for(int i = 0; i < 64; i++)
+		for(int j = 0; j < 64; j++)
+			heights[i * 64 + j] = (float)TheTerrain->getHeightmapEntry(i, j);
+
+	TheCollider.setHeightfield(heights, 64, 64, 6.0f);
+	for(int i = 0; i < (int)Pillars.size(); i++)
+		TheCollider.addBox(Pillars[i]);
+	TheCollider.build(0.0f);
+
+	if( FAILED(D3DXCreateSphere(Device, 1.0f, 8, 8, &WalkerMesh, 0)) )
+	{
+		::MessageBox(0, "D3DXCreateSphere() - FAILED", 0, 0);
+		return false;
+	}
+
+	for(int i = 0; i < NumWalkers; i++)
+	{
+		float x = -170.0f + 340.0f * ((float)rand() / (float)RAND_MAX);
+		float z = -170.0f + 340.0f * ((float)rand() / (float)RAND_MAX);
+		float angle = 2.0f * D3DX_PI * ((float)rand() / (float)RAND_MAX);
+
+		WalkerPositions.push_back(D3DXVECTOR3(x, TheTerrain->getHeight(x, z) + 10.0f, z));
+		WalkerHeadings.push_back(D3DXVECTOR3(cosf(angle), 0.0f, sinf(angle)));
+		WalkerRadii.push_back(1.0f + (float)rand() / (float)RAND_MAX);
+	}
+	WalkerMoves.resize(NumWalkers);
+	WalkerTouched.resize(NumWalkers, 0);
+
+	D3DXVECTOR3 lightDir = -LightDirection;
+	D3DXCOLOR   white    = d3d::WHITE;
+	D3DLIGHT9   light    = d3d::InitDirectionalLight(&lightDir, &white);
+	Device->SetLight(0, &light);
+	Device->LightEnable(0, true);
 
 	//
 	// Set texture filters.
@@ -111,45 +450,214 @@ bool Setup()
 void Cleanup()
 {
 	d3d::Delete<Terrain*>(TheTerrain);
+	d3d::Delete<TerrainStreamer*>(TheStreamer);
+	d3d::Delete<OcclusionBuffer*>(TheOccluder);
+	d3d::Release<ID3DXMesh*>(PillarMesh);
+	d3d::Release<ID3DXMesh*>(WalkerMesh);
 	d3d::Release<ID3DXEffect*>(FogEffect);
 }
 
+//
+// Update the scene: Allow user to rotate around scene.
+//
+void UpdateCameraFromKeys(float timeDelta)
+{
+	if( ::GetAsyncKeyState(VK_UP) & 0x8000f )
+		TheCamera.walk(100.0f * timeDelta);
+
+	if( ::GetAsyncKeyState(VK_DOWN) & 0x8000f )
+		TheCamera.walk(-100.0f * timeDelta);
+
+	if( ::GetAsyncKeyState(VK_LEFT) & 0x8000f )
+		TheCamera.yaw(-1.0f * timeDelta);
+	
+	if( ::GetAsyncKeyState(VK_RIGHT) & 0x8000f )
+		TheCamera.yaw(1.0f * timeDelta);
+
+	if( ::GetAsyncKeyState('N') & 0x8000f )
+		TheCamera.strafe(-100.0f * timeDelta);
+
+	if( ::GetAsyncKeyState('M') & 0x8000f )
+		TheCamera.strafe(100.0f * timeDelta);
+
+	if( ::GetAsyncKeyState('W') & 0x8000f )
+		TheCamera.pitch(1.0f * timeDelta);
+
+	if( ::GetAsyncKeyState('S') & 0x8000f )
+		TheCamera.pitch(-1.0f * timeDelta);
+}
+
+//
+// Fills VisiblePillars with the pillars the terrain does not hide.
+//
+void CullPillars(const D3DXMATRIX& V, const D3DXMATRIX& P)
+{
+	VisiblePillars.clear();
+	if( UseOcclusionCulling && TheOccluder )
+	{
+		D3DXMATRIX I, VP;
+		D3DXMatrixIdentity(&I);
+		VP = V * P;
+
+		TheOccluder->begin(&VP);
+		TheOccluder->addOccluder(&OccluderPositions[0], (int)OccluderPositions.size(),
+			&OccluderIndices[0], (int)OccluderIndices.size() / 3, &I, true);
+		TheOccluder->rasterize();
+		TheOccluder->testBoxes(&Pillars[0], (int)Pillars.size(), VisiblePillars);
+	}
+	else
+	{
+		for(int i = 0; i < (int)Pillars.size(); i++)
+			VisiblePillars.push_back(i);
+	}
+}
+
+//
+// Walk the crowd: straight ahead under gravity, turning now and then after
+// bumping into something and at the edge of the terrain.
+//
+void UpdateWalkers(float timeDelta)
+{
+	for(int i = 0; i < NumWalkers; i++)
+	{
+		D3DXVECTOR3& heading = WalkerHeadings[i];
+		const D3DXVECTOR3& p = WalkerPositions[i];
+
+		if( (p.x < -170.0f && heading.x < 0.0f) || (p.x > 170.0f && heading.x > 0.0f) )
+			heading.x = -heading.x;
+		if( (p.z < -170.0f && heading.z < 0.0f) || (p.z > 170.0f && heading.z > 0.0f) )
+			heading.z = -heading.z;
+
+		if( WalkerTouched[i] && rand() % 32 == 0 )
+		{
+			float angle = 2.0f * D3DX_PI * ((float)rand() / (float)RAND_MAX);
+			heading = D3DXVECTOR3(cosf(angle), 0.0f, sinf(angle));
+		}
+
+		WalkerMoves[i] = heading * 6.0f * timeDelta + D3DXVECTOR3(0.0f, -10.0f * timeDelta, 0.0f);
+	}
+
+	TheCollider.moveAgents(&WalkerPositions[0], &WalkerRadii[0], &WalkerMoves[0], NumWalkers, 0, &WalkerTouched[0]);
+}
+
+// The per frame work that does not need the device: the camera and
+// culling.  The walkers are left out; -benchmark times their collision on
+// its own.
+class CullFrame : public FlythroughFrame
+{
+public:
+	void onFrame(const D3DXVECTOR3& position, const D3DXQUATERNION& orientation, float timeDelta)
+	{
+		D3DXVECTOR3 pos = position;
+		TheCamera.setPosition(&pos);
+		TheCamera.setOrientation(&orientation);
+
+		D3DXMATRIX V, P;
+		TheCamera.getViewMatrix(&V);
+		D3DXMatrixPerspectiveFovLH(&P, D3DX_PI * 0.25f, (float)Width / (float)Height, 1.0f, 1000.0f);
+
+		CullPillars(V, P);
+	}
+};
+
 bool Display(float timeDelta)
 {
 	if( Device )
 	{
-		// 
-		// Update the scene: Allow user to rotate around scene.
-		//
-		
-		if( ::GetAsyncKeyState(VK_UP) & 0x8000f )
-			TheCamera.walk(100.0f * timeDelta);
+		if( Playing )
+		{
+			// Every frame moves the path on by the same step whatever the
+			// clock says, so each run draws the same frames.
+			double now = Now();
+			if( PathTime > 0.0f )
+				PlaybackFrameMs.push_back((float)(now - LastFrameTime));
+			LastFrameTime = now;
+
+			D3DXVECTOR3    pos;
+			D3DXQUATERNION orientation;
+			Path.sample(PathTime, &pos, &orientation);
+			TheCamera.setPosition(&pos);
+			TheCamera.setOrientation(&orientation);
+
+			timeDelta = PlaybackStep;
+			PathTime += PlaybackStep;
+			if( PathTime > Path.getDuration() )
+			{
+				FlythroughReport report;
+				SummarizeFrameTimes(PlaybackFrameMs, &report);
+				WriteFlythroughReport(ReportFileName, PathFileName, report);
+				Playing = false;
+			}
+		}
+		else
+		{
+			D3DXVECTOR3 from;
+			TheCamera.getPosition(&from);
 
-		if( ::GetAsyncKeyState(VK_DOWN) & 0x8000f )
-			TheCamera.walk(-100.0f * timeDelta);
+			UpdateCameraFromKeys(timeDelta);
 
-		if( ::GetAsyncKeyState(VK_LEFT) & 0x8000f )
-			TheCamera.yaw(-1.0f * timeDelta);
-		
-		if( ::GetAsyncKeyState(VK_RIGHT) & 0x8000f )
-			TheCamera.yaw(1.0f * timeDelta);
+			// replay the move as a sweep from where the camera was
+			if( UseCollision )
+			{
+				D3DXVECTOR3 to;
+				TheCamera.getPosition(&to);
 
-		if( ::GetAsyncKeyState('N') & 0x8000f )
-			TheCamera.strafe(-100.0f * timeDelta);
+				TheCollider.move(&from, CameraRadius, to - from);
+				TheCamera.setPosition(&from);
+			}
+		}
 
-		if( ::GetAsyncKeyState('M') & 0x8000f )
-			TheCamera.strafe(100.0f * timeDelta);
+		UpdateWalkers(timeDelta);
 
-		if( ::GetAsyncKeyState('W') & 0x8000f )
-			TheCamera.pitch(1.0f * timeDelta);
+		if( Recording )
+		{
+			D3DXVECTOR3    pos;
+			D3DXQUATERNION orientation;
+			TheCamera.getPosition(&pos);
+			TheCamera.getOrientation(&orientation);
 
-		if( ::GetAsyncKeyState('S') & 0x8000f )
-			TheCamera.pitch(-1.0f * timeDelta);
+			PathTime += timeDelta;
+			Path.record(PathTime, pos, orientation);
+		}
 
 		D3DXMATRIX V;
 		TheCamera.getViewMatrix(&V);
 		Device->SetTransform(D3DTS_VIEW, &V);
 
+		D3DXVECTOR3 cameraPos;
+		TheCamera.getPosition(&cameraPos);
+
+		if( TheStreamer && timeDelta > 0.0f )
+		{
+			D3DXVECTOR3 velocity = (cameraPos - LastCameraPos) / timeDelta;
+			TheStreamer->update(cameraPos, velocity);
+		}
+		LastCameraPos = cameraPos;
+
+		//
+		// Rasterize the coarse terrain and test the pillars against it.
+		//
+
+		D3DXMATRIX P;
+		Device->GetTransform(D3DTS_PROJECTION, &P);
+
+		CullPillars(V, P);
+
+		ReportTime += timeDelta;
+		if( ReportTime > 1.0f )
+		{
+			const OcclusionStats& stats = TheOccluder->getStats();
+			const SweepStats& sweep = TheCollider.getStats();
+
+			char report[256];
+			::sprintf(report, "Pillars drawn: %d of %d (occlusion %s, setup %.3f ms, raster %.3f ms), "
+				"%d walkers moved in %.3f ms\n",
+				(int)VisiblePillars.size(), (int)Pillars.size(), UseOcclusionCulling ? "on" : "off",
+				stats.setupMs, stats.rasterMs, sweep.agents, sweep.moveMs);
+			::OutputDebugString(report);
+			ReportTime = 0.0f;
+		}
+
 		//
 		// Activate the Technique and Render
 		//
@@ -157,24 +665,70 @@ bool Display(float timeDelta)
 		Device->Clear(0, 0, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, 0x00CCCCCC, 1.0f, 0);
 		Device->BeginScene();
 
-		// set the technique to use
-		FogEffect->SetTechnique( FogTechHandle );
-
-		UINT numPasses = 0;
-    	FogEffect->Begin(&numPasses, 0);
-
-		D3DXMATRIX I;
-		D3DXMatrixIdentity(&I);
-		for(int i = 0; i < numPasses; i++)
+		if( UseCompactTerrain )
 		{
-			FogEffect->BeginPass(i);
+			D3DXMATRIX I, VP;
+			D3DXMatrixIdentity(&I);
+			VP = V * P;
+
+			D3DXVECTOR3 eye;
+			TheCamera.getPosition(&eye);
 
 			if( TheTerrain )
-				TheTerrain->draw(&I, false);
-			FogEffect->CommitChanges();
-			FogEffect->EndPass();
+				TheTerrain->drawCompact(&I, &VP, &eye, &LightDirection);
+		}
+		else
+		{
+			// set the technique to use
+			FogEffect->SetTechnique( FogTechHandle );
+
+			UINT numPasses = 0;
+			FogEffect->Begin(&numPasses, 0);
+
+			D3DXMATRIX I;
+			D3DXMatrixIdentity(&I);
+			for(int i = 0; i < numPasses; i++)
+			{
+				FogEffect->BeginPass(i);
+
+				if( UseStreamedTerrain && TheStreamer )
+					TheStreamer->draw(&I);
+				else if( TheTerrain )
+					TheTerrain->draw(&I, false);
+
+				Device->SetTexture(0, 0);
+				Device->SetMaterial(&d3d::WHITE_MTRL);
+				for(int j = 0; j < (int)VisiblePillars.size(); j++)
+				{
+					const d3d::BoundingBox& box = Pillars[VisiblePillars[j]];
+					D3DXVECTOR3 center = (box._min + box._max) * 0.5f;
+
+					D3DXMATRIX T;
+					D3DXMatrixTranslation(&T, center.x, center.y, center.z);
+					Device->SetTransform(D3DTS_WORLD, &T);
+					PillarMesh->DrawSubset(0);
+				}
+
+				Device->SetMaterial(&d3d::YELLOW_MTRL);
+				for(int j = 0; j < NumWalkers; j++)
+				{
+					const D3DXVECTOR3& p = WalkerPositions[j];
+					float r = WalkerRadii[j];
+
+					D3DXMATRIX S, T;
+					D3DXMatrixScaling(&S, r, r, r);
+					D3DXMatrixTranslation(&T, p.x, p.y, p.z);
+					D3DXMATRIX W = S * T;
+					Device->SetTransform(D3DTS_WORLD, &W);
+					WalkerMesh->DrawSubset(0);
+				}
+				Device->SetTransform(D3DTS_WORLD, &I);
+
+				FogEffect->CommitChanges();
+				FogEffect->EndPass();
+			}
+			FogEffect->End();
 		}
-		FogEffect->End();
 
 		Device->EndScene();
 		Device->Present(0, 0, 0, 0);
@@ -197,6 +751,42 @@ LRESULT CALLBACK d3d::WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 		if( wParam == VK_ESCAPE )
 			::DestroyWindow(hwnd);
 
+		if( wParam == 'C' )
+			UseCompactTerrain = !UseCompactTerrain;
+
+		if( wParam == 'T' )
+			UseStreamedTerrain = !UseStreamedTerrain;
+
+		if( wParam == 'O' )
+			UseOcclusionCulling = !UseOcclusionCulling;
+
+		if( wParam == 'G' )
+			UseCollision = !UseCollision;
+
+		if( wParam == 'K' && !Playing )
+		{
+			Recording = !Recording;
+			if( Recording )
+			{
+				Path.clear();
+				PathTime = 0.0f;
+			}
+			else
+			{
+				char msg[128];
+				::sprintf(msg, "Recorded %.1f s of camera path in %d keys%s\n",
+					Path.getDuration(), Path.size(), Path.save(PathFileName) ? "" : ", SAVE FAILED");
+				::OutputDebugString(msg);
+			}
+		}
+
+		if( wParam == 'L' && !Recording )
+		{
+			Playing = !Playing && Path.load(PathFileName) && Path.size() > 0;
+			PathTime = 0.0f;
+			PlaybackFrameMs.clear();
+		}
+
 		break;
 	}
 	return ::DefWindowProc(hwnd, msg, wParam, lParam);
@@ -210,6 +800,42 @@ int WINAPI WinMain(HINSTANCE hinstance,
 				   PSTR cmdLine,
 				   int showCmd)
 {
+	// -flythrough <path> plays the path through the camera and the
+	// pillars' culling, over the heightmap alone with no window or device,
+	// and exits; it times nothing else
+	char fileName[260] = { 0 };
+	if( d3d::FindSwitch(cmdLine, "-flythrough", fileName, sizeof(fileName)) )
+	{
+		TheTerrain = new Terrain(0, "coastMountain64.raw", 64, 64, 6, 0.5f);
+		PlacePillars();
+
+		CameraPath       path;
+		CullFrame        frame;
+		FlythroughReport report;
+		if( path.load(fileName) && RunFlythrough(path, PlaybackStep, &frame, &report, 0) )
+			WriteFlythroughReport(ReportFileName, fileName, report);
+		else
+			::OutputDebugString("Flythrough: could not load the path\n");
+
+		d3d::Delete<Terrain*>(TheTerrain);
+		d3d::Delete<OcclusionBuffer*>(TheOccluder);
+		return 0;
+	}
+
+	// -streamcheck needs neither a window nor the device
+	if( d3d::FindSwitch(cmdLine, "-streamcheck") )
+	{
+		if( !RunStreamingCheck() )
+			::OutputDebugString("Streaming: could not convert or open the tile file\n");
+		return 0;
+	}
+
+	if( d3d::FindSwitch(cmdLine, "-benchmark") )
+	{
+		Benchmark();
+		return 0;
+	}
+
 	if(!d3d::InitD3D(hinstance,
 		Width, Height, true, D3DDEVTYPE_HAL, &Device))
 	{
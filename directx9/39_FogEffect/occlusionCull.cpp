@@ -0,0 +1,837 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: occlusionCull.cpp
+//
+// Desc: Masked software occlusion culling.  See occlusionCull.h.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "occlusionCull.h"
+#include <cmath>
+#include <cfloat>
+#include <cstdlib>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+namespace
+{
+	const DWORD FullRow = 0xffffffff;
+
+	// Bits [begin, end) of a 32 bit row, 0 <= begin < end <= 32.
+	DWORD RowBits(int begin, int end)
+	{
+		DWORD upTo = end >= 32 ? FullRow : ((1u << end) - 1);
+		return upTo & ~((1u << begin) - 1);
+	}
+
+	// ceil and floor for the span ends.  SSE2 only truncates, so correct
+	// the lanes that truncation moved the wrong way.
+	__m128i Ceil(__m128 x)
+	{
+		__m128i t = _mm_cvttps_epi32(x);
+		__m128 below = _mm_cmpgt_ps(x, _mm_cvtepi32_ps(t));
+		return _mm_sub_epi32(t, _mm_castps_si128(below)); // mask is -1
+	}
+
+	__m128i Floor(__m128 x)
+	{
+		__m128i t = _mm_cvttps_epi32(x);
+		__m128 above = _mm_cmplt_ps(x, _mm_cvtepi32_ps(t));
+		return _mm_add_epi32(t, _mm_castps_si128(above));
+	}
+
+	// Clips a polygon against z >= 0, the D3D near plane.
+	int ClipNear(const D3DXVECTOR4* in, int count, D3DXVECTOR4* out)
+	{
+		int n = 0;
+		for(int i = 0; i < count; i++)
+		{
+			const D3DXVECTOR4& a = in[i];
+			const D3DXVECTOR4& b = in[(i + 1) % count];
+
+			if( a.z >= 0.0f )
+				out[n++] = a;
+
+			if( (a.z >= 0.0f) != (b.z >= 0.0f) )
+			{
+				float t = a.z / (a.z - b.z);
+				out[n++] = a + (b - a) * t;
+			}
+		}
+		return n;
+	}
+
+	double Now()
+	{
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+	}
+
+	float Random(float lo, float hi)
+	{
+		return lo + (hi - lo) * ((float)rand() / (float)RAND_MAX);
+	}
+}
+
+OcclusionStats::OcclusionStats()
+{
+	occluderTriangles = 0;
+	rasterTriangles   = 0;
+	binnedTriangles   = 0;
+	tileUpdates       = 0;
+	boxesTested       = 0;
+	boxesOccluded     = 0;
+	numThreads        = 0;
+	setupMs           = 0.0f;
+	rasterMs          = 0.0f;
+}
+
+OcclusionBuffer::OcclusionBuffer(int width, int height, int numThreads)
+{
+	_tilesX = (width  + TileWidth  - 1) / TileWidth;
+	_tilesY = (height + TileHeight - 1) / TileHeight;
+	_width  = _tilesX * TileWidth;
+	_height = _tilesY * TileHeight;
+
+	if( numThreads <= 0 )
+		numThreads = (int)std::thread::hardware_concurrency();
+	if( numThreads <= 0 )
+		numThreads = 1;
+	_numThreads = numThreads;
+
+	// a few bands per thread so an expensive band does not hold up the rest
+	_numBands = _numThreads * 4 < _tilesY ? _numThreads * 4 : _tilesY;
+
+	_tiles.resize(_tilesX * _tilesY);
+	_setup.resize(_numThreads);
+	_bins.resize(_numThreads);
+	for(int t = 0; t < _numThreads; t++)
+		_bins[t].resize(_numBands);
+
+	D3DXMatrixIdentity(&_viewProj);
+	begin(&_viewProj);
+}
+
+OcclusionBuffer::~OcclusionBuffer()
+{
+
+}
+
+void OcclusionBuffer::begin(const D3DXMATRIX* viewProj)
+{
+	_viewProj = *viewProj;
+
+	for(int i = 0; i < (int)_tiles.size(); i++)
+	{
+		Tile& tile = _tiles[i];
+		for(int r = 0; r < TileHeight; r++)
+			tile.mask[r] = 0;
+		tile.zMax0 = 1.0f; // the far plane
+		tile.zMax1 = 0.0f;
+	}
+
+	_clip.clear();
+	_indices.clear();
+	_cullBack.clear();
+
+	_stats = OcclusionStats();
+	_stats.numThreads = _numThreads;
+}
+
+void OcclusionBuffer::addOccluder(
+	const D3DXVECTOR3* positions, int numVertices,
+	const DWORD* indices, int numTriangles,
+	const D3DXMATRIX* world, bool cullBackFaces)
+{
+	D3DXMATRIX worldViewProj = (*world) * _viewProj;
+
+	DWORD base = (DWORD)_clip.size();
+	_clip.resize(base + numVertices);
+	for(int i = 0; i < numVertices; i++)
+		D3DXVec3Transform(&_clip[base + i], &positions[i], &worldViewProj);
+
+	for(int i = 0; i < numTriangles * 3; i++)
+		_indices.push_back(base + indices[i]);
+
+	_cullBack.resize(_cullBack.size() + numTriangles, cullBackFaces);
+	_stats.occluderTriangles += numTriangles;
+}
+
+void OcclusionBuffer::setupRange(int thread, int first, int last)
+{
+	_setup[thread].clear();
+	for(int b = 0; b < _numBands; b++)
+		_bins[thread][b].clear();
+
+	for(int i = first; i < last; i++)
+	{
+		D3DXVECTOR4 v[3] =
+		{
+			_clip[_indices[3 * i + 0]],
+			_clip[_indices[3 * i + 1]],
+			_clip[_indices[3 * i + 2]]
+		};
+		setupTriangle(thread, v, _cullBack[i]);
+	}
+}
+
+void OcclusionBuffer::setupTriangle(int thread, const D3DXVECTOR4* v, bool cullBack)
+{
+	// entirely outside one of the side or far planes
+	if( (v[0].x >  v[0].w && v[1].x >  v[1].w && v[2].x >  v[2].w) ||
+		(v[0].x < -v[0].w && v[1].x < -v[1].w && v[2].x < -v[2].w) ||
+		(v[0].y >  v[0].w && v[1].y >  v[1].w && v[2].y >  v[2].w) ||
+		(v[0].y < -v[0].w && v[1].y < -v[1].w && v[2].y < -v[2].w) ||
+		(v[0].z >  v[0].w && v[1].z >  v[1].w && v[2].z >  v[2].w) )
+		return;
+
+	D3DXVECTOR4 poly[4];
+	int count = ClipNear(v, 3, poly);
+	if( count < 3 )
+		return;
+
+	D3DXVECTOR3 screen[4];
+	for(int i = 0; i < count; i++)
+	{
+		float invW = 1.0f / poly[i].w;
+		screen[i].x = (poly[i].x * invW *  0.5f + 0.5f) * _width;
+		screen[i].y = (poly[i].y * invW * -0.5f + 0.5f) * _height;
+		screen[i].z =  poly[i].z * invW;
+	}
+
+	int rowsPerBand = (_tilesY + _numBands - 1) / _numBands;
+
+	for(int f = 1; f + 1 < count; f++)
+	{
+		D3DXVECTOR3 p[3] = { screen[0], screen[f], screen[f + 1] };
+
+		// clockwise on screen (y down) is positive
+		float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+		if( cullBack && area <= 0.0f )
+			continue;
+		if( fabsf(area) < 1e-8f )
+			continue;
+		if( area < 0.0f )
+		{
+			std::swap(p[1], p[2]);
+			area = -area;
+		}
+
+		ScreenTriangle tri;
+		float minX = p[0].x, maxX = p[0].x, minY = p[0].y, maxY = p[0].y;
+		tri.zMin = tri.zMax = p[0].z;
+		for(int i = 1; i < 3; i++)
+		{
+			minX = p[i].x < minX ? p[i].x : minX;
+			maxX = p[i].x > maxX ? p[i].x : maxX;
+			minY = p[i].y < minY ? p[i].y : minY;
+			maxY = p[i].y > maxY ? p[i].y : maxY;
+			tri.zMin = p[i].z < tri.zMin ? p[i].z : tri.zMin;
+			tri.zMax = p[i].z > tri.zMax ? p[i].z : tri.zMax;
+		}
+
+		// pixels whose centers may be inside
+		tri.minX = (int)floorf(minX - 0.5f) + 1; if( tri.minX < 0 ) tri.minX = 0;
+		tri.minY = (int)floorf(minY - 0.5f) + 1; if( tri.minY < 0 ) tri.minY = 0;
+		tri.maxX = (int)floorf(maxX - 0.5f);     if( tri.maxX > _width  - 1 ) tri.maxX = _width  - 1;
+		tri.maxY = (int)floorf(maxY - 0.5f);     if( tri.maxY > _height - 1 ) tri.maxY = _height - 1;
+		if( tri.minX > tri.maxX || tri.minY > tri.maxY )
+			continue;
+
+		for(int e = 0; e < 3; e++)
+		{
+			const D3DXVECTOR3& a = p[e];
+			const D3DXVECTOR3& b = p[(e + 1) % 3];
+			tri.edgeA[e] = a.y - b.y;
+			tri.edgeB[e] = b.x - a.x;
+			tri.edgeC[e] = -(tri.edgeA[e] * a.x + tri.edgeB[e] * a.y);
+		}
+
+		float dz1 = p[1].z - p[0].z, dz2 = p[2].z - p[0].z;
+		tri.zA = (dz1 * (p[2].y - p[0].y) - dz2 * (p[1].y - p[0].y)) / area;
+		tri.zB = ((p[1].x - p[0].x) * dz2 - (p[2].x - p[0].x) * dz1) / area;
+		tri.zC = p[0].z - tri.zA * p[0].x - tri.zB * p[0].y;
+
+		int index = (int)_setup[thread].size();
+		_setup[thread].push_back(tri);
+
+		int firstBand = tri.minY / TileHeight / rowsPerBand;
+		int lastBand  = tri.maxY / TileHeight / rowsPerBand;
+		for(int b = firstBand; b <= lastBand; b++)
+			_bins[thread][b].push_back(index);
+	}
+}
+
+void OcclusionBuffer::rasterize()
+{
+	double start = Now();
+
+	//
+	// Setup: every thread takes a slice of the triangles and bins them into
+	// its own lists, so nothing is shared.
+	//
+
+	int numTriangles = (int)_indices.size() / 3;
+	{
+		std::vector<std::thread> workers;
+		for(int t = 1; t < _numThreads; t++)
+		{
+			int first = numTriangles * t / _numThreads;
+			int last  = numTriangles * (t + 1) / _numThreads;
+			workers.push_back(std::thread(&OcclusionBuffer::setupRange, this, t, first, last));
+		}
+		setupRange(0, 0, numTriangles / _numThreads);
+
+		for(int i = 0; i < (int)workers.size(); i++)
+			workers[i].join();
+	}
+
+	for(int t = 0; t < _numThreads; t++)
+	{
+		_stats.rasterTriangles += (int)_setup[t].size();
+		for(int b = 0; b < _numBands; b++)
+			_stats.binnedTriangles += (int)_bins[t][b].size();
+	}
+
+	double setupDone = Now();
+
+	//
+	// Raster: bands own disjoint tile rows, so threads pull whole bands.
+	//
+
+	std::atomic<int> nextBand(0);
+	std::vector<int> tileUpdates(_numThreads, 0);
+
+	auto work = [this, &nextBand, &tileUpdates](int t)
+	{
+		for(;;)
+		{
+			int band = nextBand++;
+			if( band >= _numBands )
+				break;
+			rasterizeBand(band, &tileUpdates[t]);
+		}
+	};
+
+	{
+		std::vector<std::thread> workers;
+		for(int t = 1; t < _numThreads; t++)
+			workers.push_back(std::thread(work, t));
+		work(0);
+
+		for(int i = 0; i < (int)workers.size(); i++)
+			workers[i].join();
+	}
+
+	for(int t = 0; t < _numThreads; t++)
+		_stats.tileUpdates += tileUpdates[t];
+
+	_stats.setupMs  = (float)(setupDone - start);
+	_stats.rasterMs = (float)(Now() - setupDone);
+}
+
+void OcclusionBuffer::rasterizeBand(int band, int* tileUpdates)
+{
+	int rowsPerBand  = (_tilesY + _numBands - 1) / _numBands;
+	int firstTileRow = band * rowsPerBand;
+	int lastTileRow  = firstTileRow + rowsPerBand - 1;
+	if( lastTileRow > _tilesY - 1 )
+		lastTileRow = _tilesY - 1;
+	if( firstTileRow > lastTileRow )
+		return;
+
+	// triangles from every setup thread, in submission order
+	for(int t = 0; t < _numThreads; t++)
+	{
+		const std::vector<int>& bin = _bins[t][band];
+		for(int i = 0; i < (int)bin.size(); i++)
+			rasterizeTriangle(_setup[t][bin[i]], firstTileRow, lastTileRow, tileUpdates);
+	}
+}
+
+void OcclusionBuffer::rasterizeTriangle(
+	const ScreenTriangle& tri, int firstTileRow, int lastTileRow, int* tileUpdates)
+{
+	int y0 = tri.minY > firstTileRow * TileHeight ? tri.minY : firstTileRow * TileHeight;
+	int y1 = tri.maxY < (lastTileRow + 1) * TileHeight - 1 ? tri.maxY : (lastTileRow + 1) * TileHeight - 1;
+	if( y0 > y1 )
+		return;
+
+	int tx0 = tri.minX / TileWidth;
+	int tx1 = tri.maxX / TileWidth;
+
+	// Each edge bounds the span from the left (A > 0) or the right (A < 0)
+	// at x = -(B y + C) / A.  Flat edges (A = 0) bound it from neither side
+	// but empty the rows they face away from.
+	__m128 zero = _mm_setzero_ps();
+	__m128 half = _mm_set1_ps(0.5f);
+
+	__m128 slope[3], offset[3];
+	int    side[3];
+	for(int e = 0; e < 3; e++)
+	{
+		float a = tri.edgeA[e];
+		side[e] = a > 0.0f ? 1 : (a < 0.0f ? -1 : 0);
+		float inv = side[e] ? -1.0f / a : 0.0f;
+		slope[e]  = _mm_set1_ps(side[e] ? tri.edgeB[e] * inv : tri.edgeB[e]);
+		offset[e] = _mm_set1_ps(side[e] ? tri.edgeC[e] * inv : tri.edgeC[e]);
+	}
+
+	DWORD cover[TileHeight * 64];   // rows of the tiles in [tx0, tx1], at most 64 tiles wide
+	int numTiles = tx1 - tx0 + 1;
+	if( numTiles > 64 )
+		numTiles = 64;
+
+	for(int ty = y0 / TileHeight; ty <= y1 / TileHeight; ty++)
+	{
+		for(int i = 0; i < numTiles * TileHeight; i++)
+			cover[i] = 0;
+
+		int rowBegin = ty * TileHeight > y0 ? ty * TileHeight : y0;
+		int rowEnd   = ty * TileHeight + TileHeight - 1 < y1 ? ty * TileHeight + TileHeight - 1 : y1;
+		bool any = false;
+
+		// four scanlines at a time
+		for(int y = ty * TileHeight; y < ty * TileHeight + TileHeight; y += 4)
+		{
+			__m128 yc = _mm_add_ps(_mm_setr_ps((float)y, (float)(y + 1), (float)(y + 2), (float)(y + 3)), half);
+
+			__m128 left  = zero;
+			__m128 right = _mm_set1_ps((float)_width);
+
+			for(int e = 0; e < 3; e++)
+			{
+				__m128 v = _mm_add_ps(_mm_mul_ps(slope[e], yc), offset[e]);
+				if( side[e] > 0 )
+					left = _mm_max_ps(left, v);
+				else if( side[e] < 0 )
+					right = _mm_min_ps(right, v);
+				else
+				{
+					// B y + C < 0: the row is outside this edge
+					__m128 outside = _mm_cmplt_ps(v, zero);
+					right = _mm_or_ps(_mm_andnot_ps(outside, right), _mm_and_ps(outside, _mm_set1_ps(-1.0f)));
+				}
+			}
+
+			// first and one past the last pixel whose center is inside
+			__m128i first = Ceil(_mm_sub_ps(left, half));
+			__m128i end   = _mm_add_epi32(Floor(_mm_sub_ps(right, half)), _mm_set1_epi32(1));
+
+			int xs[4], xe[4];
+			_mm_storeu_si128((__m128i*)xs, first);
+			_mm_storeu_si128((__m128i*)xe, end);
+
+			for(int r = 0; r < 4; r++)
+			{
+				int row = y + r;
+				if( row < rowBegin || row > rowEnd )
+					continue;
+
+				int a = xs[r] > tri.minX ? xs[r] : tri.minX;
+				int b = xe[r] < tri.maxX + 1 ? xe[r] : tri.maxX + 1;
+				if( a >= b )
+					continue;
+
+				any = true;
+				for(int tx = a / TileWidth; tx <= (b - 1) / TileWidth && tx - tx0 < numTiles; tx++)
+				{
+					int tileBegin = tx * TileWidth;
+					int lo = a > tileBegin ? a - tileBegin : 0;
+					int hi = b < tileBegin + TileWidth ? b - tileBegin : TileWidth;
+					cover[(tx - tx0) * TileHeight + (row - ty * TileHeight)] |= RowBits(lo, hi);
+				}
+			}
+		}
+
+		if( !any )
+			continue;
+
+		//
+		// Merge into the tiles, with the triangle's farthest depth over the
+		// part of each tile its bounds overlap.
+		//
+
+		for(int i = 0; i < numTiles; i++)
+		{
+			const DWORD* mask = &cover[i * TileHeight];
+			DWORD used = 0;
+			for(int r = 0; r < TileHeight; r++)
+				used |= mask[r];
+			if( !used )
+				continue;
+
+			int tx = tx0 + i;
+			float x0 = (float)(tx * TileWidth > tri.minX ? tx * TileWidth : tri.minX);
+			float x1 = (float)(tx * TileWidth + TileWidth - 1 < tri.maxX ? tx * TileWidth + TileWidth - 1 : tri.maxX) + 1.0f;
+			float yA = (float)rowBegin;
+			float yB = (float)rowEnd + 1.0f;
+
+			float z00 = tri.zA * x0 + tri.zB * yA + tri.zC;
+			float z10 = tri.zA * x1 + tri.zB * yA + tri.zC;
+			float z01 = tri.zA * x0 + tri.zB * yB + tri.zC;
+			float z11 = tri.zA * x1 + tri.zB * yB + tri.zC;
+
+			float zTri = z00;
+			zTri = z10 > zTri ? z10 : zTri;
+			zTri = z01 > zTri ? z01 : zTri;
+			zTri = z11 > zTri ? z11 : zTri;
+			zTri = zTri < tri.zMax ? zTri : tri.zMax;
+			zTri = zTri > tri.zMin ? zTri : tri.zMin;
+
+			mergeTile(_tiles[ty * _tilesX + tx], mask, zTri);
+			(*tileUpdates)++;
+		}
+	}
+}
+
+void OcclusionBuffer::mergeTile(Tile& tile, const DWORD* mask, float zTri)
+{
+	// nothing to gain behind what already covers the whole tile
+	if( zTri >= tile.zMax0 )
+		return;
+
+	// A triangle much nearer than the working layer starts a new one: the
+	// old layer's depth would only hold the new coverage back.
+	float dist1t = tile.zMax1 - zTri;
+	float dist01 = tile.zMax0 - tile.zMax1;
+	if( dist1t > dist01 )
+	{
+		tile.zMax1 = 0.0f;
+		for(int r = 0; r < TileHeight; r++)
+			tile.mask[r] = 0;
+	}
+
+	tile.zMax1 = zTri > tile.zMax1 ? zTri : tile.zMax1;
+
+	DWORD full = FullRow;
+	for(int r = 0; r < TileHeight; r++)
+	{
+		tile.mask[r] |= mask[r];
+		full &= tile.mask[r];
+	}
+
+	// a full working layer becomes the tile's depth
+	if( full == FullRow )
+	{
+		tile.zMax0 = tile.zMax1;
+		tile.zMax1 = 0.0f;
+		for(int r = 0; r < TileHeight; r++)
+			tile.mask[r] = 0;
+	}
+}
+
+float OcclusionBuffer::getDepth(int x, int y) const
+{
+	const Tile& tile = _tiles[(y / TileHeight) * _tilesX + x / TileWidth];
+	if( tile.mask[y % TileHeight] & (1u << (x % TileWidth)) )
+		return tile.zMax1;
+	return tile.zMax0;
+}
+
+bool OcclusionBuffer::isVisible(const d3d::BoundingBox& box)
+{
+	_stats.boxesTested++;
+
+	float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX, zNear = FLT_MAX;
+	int outside[4] = { 0, 0, 0, 0 };
+
+	for(int i = 0; i < 8; i++)
+	{
+		D3DXVECTOR3 corner(
+			i & 1 ? box._max.x : box._min.x,
+			i & 2 ? box._max.y : box._min.y,
+			i & 4 ? box._max.z : box._min.z);
+
+		D3DXVECTOR4 c;
+		D3DXVec3Transform(&c, &corner, &_viewProj);
+
+		// crossing the near plane: the box surrounds the eye
+		if( c.z < 0.0f || c.w < 1e-6f )
+			return true;
+
+		outside[0] += c.x < -c.w;
+		outside[1] += c.x >  c.w;
+		outside[2] += c.y < -c.w;
+		outside[3] += c.y >  c.w;
+
+		float invW = 1.0f / c.w;
+		float sx = (c.x * invW *  0.5f + 0.5f) * _width;
+		float sy = (c.y * invW * -0.5f + 0.5f) * _height;
+		float sz =  c.z * invW;
+
+		minX  = sx < minX ? sx : minX;
+		maxX  = sx > maxX ? sx : maxX;
+		minY  = sy < minY ? sy : minY;
+		maxY  = sy > maxY ? sy : maxY;
+		zNear = sz < zNear ? sz : zNear;
+	}
+
+	if( outside[0] == 8 || outside[1] == 8 || outside[2] == 8 || outside[3] == 8 )
+	{
+		_stats.boxesOccluded++;
+		return false;
+	}
+
+	// every pixel the projected box touches
+	int px0 = (int)floorf(minX); if( px0 < 0 ) px0 = 0;
+	int py0 = (int)floorf(minY); if( py0 < 0 ) py0 = 0;
+	int px1 = (int)floorf(maxX); if( px1 > _width  - 1 ) px1 = _width  - 1;
+	int py1 = (int)floorf(maxY); if( py1 > _height - 1 ) py1 = _height - 1;
+
+	for(int ty = py0 / TileHeight; ty <= py1 / TileHeight; ty++)
+	{
+		for(int tx = px0 / TileWidth; tx <= px1 / TileWidth; tx++)
+		{
+			const Tile& tile = _tiles[ty * _tilesX + tx];
+
+			if( zNear > tile.zMax0 )
+				continue;
+
+			if( zNear <= tile.zMax1 )
+				return true;
+
+			// only hidden where the working layer covers every pixel of the box
+			int tileX = tx * TileWidth;
+			int lo = px0 > tileX ? px0 - tileX : 0;
+			int hi = px1 < tileX + TileWidth - 1 ? px1 - tileX + 1 : TileWidth;
+			DWORD bits = RowBits(lo, hi);
+
+			int r0 = py0 > ty * TileHeight ? py0 - ty * TileHeight : 0;
+			int r1 = py1 < ty * TileHeight + TileHeight - 1 ? py1 - ty * TileHeight : TileHeight - 1;
+			for(int r = r0; r <= r1; r++)
+			{
+				if( bits & ~tile.mask[r] )
+					return true;
+			}
+		}
+	}
+
+	_stats.boxesOccluded++;
+	return false;
+}
+
+int OcclusionBuffer::testBoxes(const d3d::BoundingBox* boxes, int count, std::vector<int>& visible)
+{
+	int found = 0;
+	for(int i = 0; i < count; i++)
+	{
+		if( isVisible(boxes[i]) )
+		{
+			visible.push_back(i);
+			found++;
+		}
+	}
+	return found;
+}
+
+//
+// Benchmark
+//
+
+namespace
+{
+	void AddBox(std::vector<D3DXVECTOR3>& positions, std::vector<DWORD>& indices, const D3DXVECTOR3& lo, const D3DXVECTOR3& hi)
+	{
+		DWORD base = (DWORD)positions.size();
+		for(int i = 0; i < 8; i++)
+		{
+			positions.push_back(D3DXVECTOR3(
+				i & 1 ? hi.x : lo.x,
+				i & 2 ? hi.y : lo.y,
+				i & 4 ? hi.z : lo.z));
+		}
+
+		// clockwise seen from outside
+		static const DWORD Faces[36] =
+		{
+			0, 2, 3,  0, 3, 1,   // -z
+			4, 5, 7,  4, 7, 6,   // +z
+			0, 4, 6,  0, 6, 2,   // -x
+			1, 3, 7,  1, 7, 5,   // +x
+			0, 1, 5,  0, 5, 4,   // -y
+			2, 6, 7,  2, 7, 3    // +y
+		};
+		for(int i = 0; i < 36; i++)
+			indices.push_back(base + Faces[i]);
+	}
+
+	// Full resolution depth of the same triangles, sampled at pixel centers.
+	void ReferenceRaster(
+		const std::vector<D3DXVECTOR3>& positions, const std::vector<DWORD>& indices,
+		const D3DXMATRIX& viewProj, int width, int height, std::vector<float>& depth)
+	{
+		depth.assign(width * height, 1.0f);
+
+		for(int t = 0; t < (int)indices.size() / 3; t++)
+		{
+			D3DXVECTOR3 p[3];
+			bool behind = false;
+			for(int i = 0; i < 3; i++)
+			{
+				D3DXVECTOR4 c;
+				D3DXVec3Transform(&c, &positions[indices[3 * t + i]], &viewProj);
+				if( c.z < 0.0f )
+					behind = true;
+				p[i] = D3DXVECTOR3(
+					(c.x / c.w *  0.5f + 0.5f) * width,
+					(c.y / c.w * -0.5f + 0.5f) * height,
+					c.z / c.w);
+			}
+			if( behind )
+				continue; // the benchmark keeps occluders in front of the eye
+
+			float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+			if( area <= 0.0f )
+				continue;
+
+			for(int y = 0; y < height; y++)
+			{
+				for(int x = 0; x < width; x++)
+				{
+					float px = x + 0.5f, py = y + 0.5f;
+					float w0 = (p[2].x - p[1].x) * (py - p[1].y) - (p[2].y - p[1].y) * (px - p[1].x);
+					float w1 = (p[0].x - p[2].x) * (py - p[2].y) - (p[0].y - p[2].y) * (px - p[2].x);
+					float w2 = (p[1].x - p[0].x) * (py - p[0].y) - (p[1].y - p[0].y) * (px - p[0].x);
+					if( w0 < 0.0f || w1 < 0.0f || w2 < 0.0f )
+						continue;
+
+					float z = (w0 * p[0].z + w1 * p[1].z + w2 * p[2].z) / area;
+					if( z < depth[y * width + x] )
+						depth[y * width + x] = z;
+				}
+			}
+		}
+	}
+}
+
+bool BenchmarkOcclusion(int numThreads, OcclusionBenchmark* result)
+{
+	if( !result )
+		return false;
+
+	//
+	// A wall with a gap, some pillars in front of it, and a field of crates
+	// behind them.
+	//
+
+	std::vector<D3DXVECTOR3> positions;
+	std::vector<DWORD>       indices;
+
+	for(int i = 0; i < 16; i++)
+	{
+		float x = -160.0f + i * 20.0f;
+		if( i == 9 )
+			continue; // the gap
+		AddBox(positions, indices, D3DXVECTOR3(x, -10.0f, 60.0f), D3DXVECTOR3(x + 20.0f, 25.0f, 62.0f));
+	}
+	for(int i = 0; i < 48; i++)
+	{
+		D3DXVECTOR3 base(Random(-120.0f, 120.0f), -10.0f, Random(20.0f, 55.0f));
+		AddBox(positions, indices, base, base + D3DXVECTOR3(3.0f, Random(5.0f, 40.0f), 3.0f));
+	}
+
+	std::vector<d3d::BoundingBox> boxes;
+	for(int z = 0; z < 64; z++)
+	{
+		for(int x = 0; x < 64; x++)
+		{
+			d3d::BoundingBox box;
+			box._min = D3DXVECTOR3(-160.0f + x * 5.0f, Random(-10.0f, 20.0f), 65.0f + z * 3.0f);
+			box._max = box._min + D3DXVECTOR3(1.5f, 1.5f, 1.5f);
+			boxes.push_back(box);
+		}
+	}
+
+	D3DXVECTOR3 eye(0.0f, 5.0f, 0.0f), at(0.0f, 5.0f, 1.0f), up(0.0f, 1.0f, 0.0f);
+	D3DXMATRIX view, proj;
+	D3DXMatrixLookAtLH(&view, &eye, &at, &up);
+	D3DXMatrixPerspectiveFovLH(&proj, D3DX_PI * 0.25f, 4.0f / 3.0f, 1.0f, 1000.0f);
+	D3DXMATRIX viewProj = view * proj;
+
+	D3DXMATRIX identity;
+	D3DXMatrixIdentity(&identity);
+
+	OcclusionBuffer buffer(320, 240, numThreads);
+
+	const int numFrames = 20;
+	double rasterMs = 0.0, testMs = 0.0;
+	std::vector<int> visible;
+
+	for(int frame = 0; frame < numFrames; frame++)
+	{
+		double start = Now();
+		buffer.begin(&viewProj);
+		buffer.addOccluder(&positions[0], (int)positions.size(), &indices[0], (int)indices.size() / 3, &identity, true);
+		buffer.rasterize();
+		rasterMs += Now() - start;
+
+		start = Now();
+		visible.clear();
+		buffer.testBoxes(&boxes[0], (int)boxes.size(), visible);
+		testMs += Now() - start;
+	}
+
+	//
+	// Check against the reference: a culled box must be hidden at every
+	// pixel it touches.
+	//
+
+	std::vector<float> depth;
+	ReferenceRaster(positions, indices, viewProj, buffer.getWidth(), buffer.getHeight(), depth);
+
+	std::vector<bool> culled(boxes.size(), true);
+	for(int i = 0; i < (int)visible.size(); i++)
+		culled[visible[i]] = false;
+
+	int referenceOccluded = 0, wrong = 0;
+	for(int b = 0; b < (int)boxes.size(); b++)
+	{
+		float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX, zNear = FLT_MAX;
+		for(int i = 0; i < 8; i++)
+		{
+			D3DXVECTOR3 corner(
+				i & 1 ? boxes[b]._max.x : boxes[b]._min.x,
+				i & 2 ? boxes[b]._max.y : boxes[b]._min.y,
+				i & 4 ? boxes[b]._max.z : boxes[b]._min.z);
+			D3DXVECTOR4 c;
+			D3DXVec3Transform(&c, &corner, &viewProj);
+			float sx = (c.x / c.w *  0.5f + 0.5f) * buffer.getWidth();
+			float sy = (c.y / c.w * -0.5f + 0.5f) * buffer.getHeight();
+			minX = sx < minX ? sx : minX; maxX = sx > maxX ? sx : maxX;
+			minY = sy < minY ? sy : minY; maxY = sy > maxY ? sy : maxY;
+			zNear = c.z / c.w < zNear ? c.z / c.w : zNear;
+		}
+
+		bool hidden = true;
+		for(int y = (int)floorf(minY); y <= (int)floorf(maxY) && hidden; y++)
+		{
+			for(int x = (int)floorf(minX); x <= (int)floorf(maxX) && hidden; x++)
+			{
+				if( x < 0 || y < 0 || x >= buffer.getWidth() || y >= buffer.getHeight() )
+					continue;
+				if( depth[y * buffer.getWidth() + x] >= zNear )
+					hidden = false;
+			}
+		}
+
+		if( hidden )
+			referenceOccluded++;
+		if( culled[b] && !hidden )
+			wrong++;
+	}
+
+	result->numOccluderTriangles = (int)indices.size() / 3;
+	result->numBoxes          = (int)boxes.size();
+	result->rasterMs          = (float)(rasterMs / numFrames);
+	result->testMs            = (float)(testMs / numFrames);
+	result->occluded          = (int)boxes.size() - (int)visible.size();
+	result->referenceOccluded = referenceOccluded;
+	result->wrong             = wrong;
+	return true;
+}
@@ -0,0 +1,138 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: occlusionCull.h
+//
+// Desc: Masked software occlusion culling.  A few occluder meshes are
+//       rasterized on the CPU into a small depth buffer of 32x8 pixel tiles.
+//       Each tile keeps a coverage mask with one depth for the covered pixels
+//       plus one depth for the whole tile, so it costs a few bytes instead of
+//       a float per pixel.  Object bounding boxes are then tested against
+//       the tiles.  Scanline spans are computed four rows at a time with SSE.
+//       The screen is split into bands of tile rows, and the bands are
+//       rasterized on worker threads.  Needs no device.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __occlusionCullH__
+#define __occlusionCullH__
+
+#include "d3dUtility.h"
+#include <vector>
+
+struct OcclusionStats
+{
+	OcclusionStats();
+
+	int   occluderTriangles;  // submitted
+	int   rasterTriangles;    // left after clipping and back face culling
+	int   binnedTriangles;    // counted once per band they touch
+	int   tileUpdates;
+	int   boxesTested;
+	int   boxesOccluded;
+	int   numThreads;
+	float setupMs;            // transform, clip and bin
+	float rasterMs;
+};
+
+class OcclusionBuffer
+{
+public:
+	// The size is rounded up to whole 32x8 tiles.  numThreads = 0 uses one
+	// thread per hardware thread.
+	OcclusionBuffer(int width, int height, int numThreads);
+	~OcclusionBuffer();
+
+	// Starts a frame: empties the buffer and the occluder list.
+	void begin(const D3DXMATRIX* viewProj);
+
+	// Queues occluder triangles.  The positions are transformed by world.
+	// Occluders must lie inside the objects they stand for, or visible
+	// objects may be culled.  With cullBackFaces, clockwise triangles (the
+	// D3D front faces) are kept.
+	void addOccluder(
+		const D3DXVECTOR3* positions, int numVertices,
+		const DWORD* indices, int numTriangles,
+		const D3DXMATRIX* world, bool cullBackFaces);
+
+	// Sets up, bins and rasterizes everything queued since begin().
+	void rasterize();
+
+	// Conservative: false only if the box is certainly hidden behind the
+	// occluders or entirely outside the view.
+	bool isVisible(const d3d::BoundingBox& box);
+
+	// Appends the indices of the boxes that may be visible.
+	int testBoxes(const d3d::BoundingBox* boxes, int count, std::vector<int>& visible);
+
+	int getWidth() const  { return _width; }
+	int getHeight() const { return _height; }
+
+	// Farthest occluder depth (z / w) that certainly covers the pixel, for
+	// debugging and for checking against a reference rasterizer.
+	float getDepth(int x, int y) const;
+
+	const OcclusionStats& getStats() const { return _stats; }
+
+	enum { TileWidth = 32, TileHeight = 8 };
+
+private:
+	struct Tile
+	{
+		DWORD mask[TileHeight];  // bit i of row r covers pixel (i, r)
+		float zMax0;             // the whole tile is covered at this depth or nearer
+		float zMax1;             // the masked pixels are covered at this depth or nearer
+	};
+
+	// A triangle after setup, in pixels.
+	struct ScreenTriangle
+	{
+		float edgeA[3], edgeB[3], edgeC[3]; // inside where A x + B y + C >= 0
+		float zA, zB, zC;                   // z / w = zA x + zB y + zC
+		float zMin, zMax;
+		int   minX, maxX, minY, maxY;       // pixel bounds, inclusive
+	};
+
+	int _width, _height;
+	int _tilesX, _tilesY;
+	int _numThreads;
+	int _numBands;          // horizontal bands of tile rows, one job each
+
+	std::vector<Tile>        _tiles;
+	D3DXMATRIX               _viewProj;
+
+	std::vector<D3DXVECTOR4> _clip;      // queued occluder vertices in clip space
+	std::vector<DWORD>       _indices;   // into _clip
+	std::vector<bool>        _cullBack;  // per queued triangle
+
+	// per setup thread: its triangles and, for each band, the ones touching it
+	std::vector< std::vector<ScreenTriangle> > _setup;
+	std::vector< std::vector< std::vector<int> > > _bins;
+
+	OcclusionStats _stats;
+
+	void setupRange(int thread, int first, int last);
+	void setupTriangle(int thread, const D3DXVECTOR4* v, bool cullBack);
+	void rasterizeBand(int band, int* tileUpdates);
+	void rasterizeTriangle(const ScreenTriangle& tri, int firstTileRow, int lastTileRow, int* tileUpdates);
+	void mergeTile(Tile& tile, const DWORD* mask, float zTri);
+};
+
+//
+// Headless benchmark: a wall of occluders in front of a grid of boxes.
+// The results are checked against a full resolution depth buffer.
+//
+
+struct OcclusionBenchmark
+{
+	int   numOccluderTriangles;
+	int   numBoxes;
+	float rasterMs;      // setup + rasterize
+	float testMs;        // all boxes
+	int   occluded;      // boxes culled
+	int   referenceOccluded;  // boxes hidden in the reference depth buffer
+	int   wrong;         // boxes culled that the reference shows as visible
+};
+
+bool BenchmarkOcclusion(int numThreads, OcclusionBenchmark* result);
+
+#endif // __occlusionCullH__
@@ -0,0 +1,1067 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: sweptCollision.cpp
+//
+// Desc: Moves spheres through the world without letting them pass through
+//       the terrain or the scene's bounding volumes, sliding along what
+//       they hit.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "sweptCollision.h"
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+
+namespace
+{
+	// Moves stop this far short of a surface, so the next sweep starts
+	// outside it.
+	const float Skin = 0.01f;
+
+	// Fewer agents than this per thread are not worth a thread.
+	const int MinAgentsPerThread = 64;
+
+	// The ground under a slope steeper than this is treated as this steep
+	// when keeping a sphere above it.
+	const float MinGroundNormalY = 0.25f;
+
+	double Now()
+	{
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+	}
+
+	float Random(float lo, float hi)
+	{
+		return lo + (hi - lo) * ((float)rand() / (float)RAND_MAX);
+	}
+
+	// First time in [0, 1] the moving point o + t * d comes within radius
+	// of center.
+	bool SweepPointSphere(const D3DXVECTOR3& o, const D3DXVECTOR3& d, const D3DXVECTOR3& center, float radius, float* t)
+	{
+		D3DXVECTOR3 m = o - center;
+
+		float c = D3DXVec3Dot(&m, &m) - radius * radius;
+		if( c <= 0.0f )
+		{
+			*t = 0.0f;
+			return true;
+		}
+
+		float a = D3DXVec3Dot(&d, &d);
+		float b = D3DXVec3Dot(&m, &d);
+		if( a < 1e-12f || b >= 0.0f )
+			return false;
+
+		float discriminant = b * b - a * c;
+		if( discriminant < 0.0f )
+			return false;
+
+		float hit = (-b - sqrtf(discriminant)) / a;
+		if( hit > 1.0f )
+			return false;
+
+		*t = hit;
+		return true;
+	}
+
+	// The same against the cylinder of radius around a box edge running
+	// along axis k through (ci, cj) on the other two axes, between lo and
+	// hi along k.
+	bool SweepPointEdge(const D3DXVECTOR3& o, const D3DXVECTOR3& d, int k, float ci, float cj, float lo, float hi, float radius, float* t)
+	{
+		int i = (k + 1) % 3, j = (k + 2) % 3;
+
+		float mi = o[i] - ci, mj = o[j] - cj;
+		float a  = d[i] * d[i] + d[j] * d[j];
+		float b  = mi * d[i] + mj * d[j];
+		float c  = mi * mi + mj * mj - radius * radius;
+
+		float hit;
+		if( c <= 0.0f )
+		{
+			hit = 0.0f;
+		}
+		else
+		{
+			if( a < 1e-12f || b >= 0.0f )
+				return false;
+
+			float discriminant = b * b - a * c;
+			if( discriminant < 0.0f )
+				return false;
+
+			hit = (-b - sqrtf(discriminant)) / a;
+			if( hit > 1.0f )
+				return false;
+		}
+
+		// past the end of the edge the corner spheres take over
+		float along = o[k] + d[k] * hit;
+		if( along < lo || along > hi )
+			return false;
+
+		*t = hit;
+		return true;
+	}
+
+	// First time in [0, 1] a sphere of radius moving from o by d touches the
+	// box: the box grown by radius, with its edges and corners rounded.  The
+	// grown box's slabs give the entry point; in an edge or corner region
+	// the rounded edges and corner decide (Ericson, Real-Time Collision
+	// Detection, 5.5.7).
+	bool SweepSphereBox(const D3DXVECTOR3& o, const D3DXVECTOR3& d, float radius, const d3d::BoundingBox& box, float* t)
+	{
+		float enter = -FLT_MAX, leave = FLT_MAX;
+		for(int i = 0; i < 3; i++)
+		{
+			float lo = box._min[i] - radius;
+			float hi = box._max[i] + radius;
+
+			if( fabsf(d[i]) < 1e-12f )
+			{
+				if( o[i] < lo || o[i] > hi )
+					return false;
+				continue;
+			}
+
+			float inv = 1.0f / d[i];
+			float t1  = (lo - o[i]) * inv;
+			float t2  = (hi - o[i]) * inv;
+			if( t1 > t2 )
+			{
+				float swap = t1; t1 = t2; t2 = swap;
+			}
+
+			enter = t1 > enter ? t1 : enter;
+			leave = t2 < leave ? t2 : leave;
+			if( enter > leave )
+				return false;
+		}
+
+		if( leave < 0.0f || enter > 1.0f )
+			return false;
+
+		float start = enter > 0.0f ? enter : 0.0f;
+		D3DXVECTOR3 p = o + d * start;
+
+		int outside = 0, aboveMask = 0;
+		for(int i = 0; i < 3; i++)
+		{
+			if( p[i] < box._min[i] )
+				outside |= 1 << i;
+			if( p[i] > box._max[i] )
+			{
+				outside   |= 1 << i;
+				aboveMask |= 1 << i;
+			}
+		}
+
+		int count = (outside & 1) + ((outside >> 1) & 1) + ((outside >> 2) & 1);
+		if( count <= 1 )
+		{
+			// a face: the grown box is the exact shape there
+			*t = start;
+			return true;
+		}
+
+		D3DXVECTOR3 corner;
+		for(int i = 0; i < 3; i++)
+			corner[i] = (aboveMask & (1 << i)) ? box._max[i] : box._min[i];
+
+		float best = FLT_MAX, hit;
+		if( count == 2 )
+		{
+			// an edge, along the one axis p is within
+			int k = (outside & 1) == 0 ? 0 : ((outside & 2) == 0 ? 1 : 2);
+			int i = (k + 1) % 3, j = (k + 2) % 3;
+
+			if( SweepPointEdge(o, d, k, corner[i], corner[j], box._min[k], box._max[k], radius, &hit) )
+				best = hit < best ? hit : best;
+
+			D3DXVECTOR3 end = corner;
+			end[k] = box._min[k];
+			if( SweepPointSphere(o, d, end, radius, &hit) )
+				best = hit < best ? hit : best;
+
+			end[k] = box._max[k];
+			if( SweepPointSphere(o, d, end, radius, &hit) )
+				best = hit < best ? hit : best;
+		}
+		else
+		{
+			// a corner and the three edges that meet there
+			for(int k = 0; k < 3; k++)
+			{
+				int i = (k + 1) % 3, j = (k + 2) % 3;
+				if( SweepPointEdge(o, d, k, corner[i], corner[j], box._min[k], box._max[k], radius, &hit) )
+					best = hit < best ? hit : best;
+			}
+
+			if( SweepPointSphere(o, d, corner, radius, &hit) )
+				best = hit < best ? hit : best;
+		}
+
+		if( best > 1.0f )
+			return false;
+
+		*t = best;
+		return true;
+	}
+
+	// The direction from the box to p, for a sphere centered at p touching
+	// it.  From inside, out through the nearest face.
+	void BoxNormal(const D3DXVECTOR3& p, const d3d::BoundingBox& box, D3DXVECTOR3* normal)
+	{
+		D3DXVECTOR3 q;
+		for(int i = 0; i < 3; i++)
+			q[i] = p[i] < box._min[i] ? box._min[i] : (p[i] > box._max[i] ? box._max[i] : p[i]);
+
+		D3DXVECTOR3 v = p - q;
+		float length = D3DXVec3Length(&v);
+		if( length > 1e-6f )
+		{
+			*normal = v / length;
+			return;
+		}
+
+		int   axis  = 0;
+		float depth = FLT_MAX, sign = 1.0f;
+		for(int i = 0; i < 3; i++)
+		{
+			float toMin = p[i] - box._min[i];
+			float toMax = box._max[i] - p[i];
+			if( toMin < depth ) { depth = toMin; axis = i; sign = -1.0f; }
+			if( toMax < depth ) { depth = toMax; axis = i; sign =  1.0f; }
+		}
+
+		*normal = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+		(*normal)[axis] = sign;
+	}
+
+	// Brute force, for the benchmark: does the sphere overlap any volume?
+	bool Overlaps(const D3DXVECTOR3& p, float radius,
+		const std::vector<d3d::BoundingBox>& boxes, const std::vector<d3d::BoundingSphere>& spheres)
+	{
+		for(int j = 0; j < (int)boxes.size(); j++)
+		{
+			D3DXVECTOR3 q;
+			for(int k = 0; k < 3; k++)
+				q[k] = p[k] < boxes[j]._min[k] ? boxes[j]._min[k] : (p[k] > boxes[j]._max[k] ? boxes[j]._max[k] : p[k]);
+
+			D3DXVECTOR3 v = p - q;
+			if( D3DXVec3Dot(&v, &v) < radius * radius )
+				return true;
+		}
+
+		for(int j = 0; j < (int)spheres.size(); j++)
+		{
+			D3DXVECTOR3 v = p - spheres[j]._center;
+			float reach = spheres[j]._radius + radius;
+			if( D3DXVec3Dot(&v, &v) < reach * reach )
+				return true;
+		}
+
+		return false;
+	}
+}
+
+SweepStats::SweepStats()
+{
+	agents        = 0;
+	touched       = 0;
+	slides        = 0;
+	obstacleTests = 0;
+	obstacleHits  = 0;
+	terrainHits   = 0;
+	numThreads    = 0;
+	moveMs        = 0.0f;
+}
+
+SweptCollider::SweptCollider()
+{
+	_numVertsPerRow = 0;
+	_numVertsPerCol = 0;
+	_cellSpacing    = 1.0f;
+	_width          = 0.0f;
+	_depth          = 0.0f;
+
+	_gridMinX = _gridMinZ = 0.0f;
+	_gridCell = 1.0f;
+	_gridCols = _gridRows = 0;
+}
+
+void SweptCollider::clear()
+{
+	_heights.clear();
+	_numVertsPerRow = _numVertsPerCol = 0;
+
+	_boxes.clear();
+	_spheres.clear();
+
+	_cellStart.clear();
+	_cellItems.clear();
+	_gridCols = _gridRows = 0;
+}
+
+//
+// Heightfield
+//
+
+void SweptCollider::setHeightfield(const std::vector<float>& heights, int numVertsPerRow, int numVertsPerCol, float cellSpacing)
+{
+	_heights        = heights;
+	_numVertsPerRow = numVertsPerRow;
+	_numVertsPerCol = numVertsPerCol;
+	_cellSpacing    = cellSpacing;
+	_width          = (numVertsPerRow - 1) * cellSpacing;
+	_depth          = (numVertsPerCol - 1) * cellSpacing;
+}
+
+float SweptCollider::heightAt(int row, int col) const
+{
+	return _heights[row * _numVertsPerRow + col];
+}
+
+// The height and the normal of the triangle under (x, z).
+void SweptCollider::groundAt(float x, float z, float* height, D3DXVECTOR3* normal) const
+{
+	// grid space: +x to the right, +z down the rows, one unit per cell
+	float gx = (x + _width * 0.5f) / _cellSpacing;
+	float gz = (_depth * 0.5f - z) / _cellSpacing;
+
+	float lastCol = (float)(_numVertsPerRow - 1);
+	float lastRow = (float)(_numVertsPerCol - 1);
+	gx = gx < 0.0f ? 0.0f : (gx > lastCol ? lastCol : gx);
+	gz = gz < 0.0f ? 0.0f : (gz > lastRow ? lastRow : gz);
+
+	int col = (int)gx;
+	int row = (int)gz;
+	col = col > _numVertsPerRow - 2 ? _numVertsPerRow - 2 : col;
+	row = row > _numVertsPerCol - 2 ? _numVertsPerCol - 2 : row;
+
+	float dx = gx - col;
+	float dz = gz - row;
+
+	//  A   B
+	//  *---*
+	//  | / |
+	//  *---*
+	//  C   D
+	float A = heightAt(row,     col);
+	float B = heightAt(row,     col + 1);
+	float C = heightAt(row + 1, col);
+	float D = heightAt(row + 1, col + 1);
+
+	// grid z runs against world z, hence the signs on the z slopes
+	D3DXVECTOR3 n;
+	if( dz < 1.0f - dx )
+	{
+		*height = A + (B - A) * dx + (C - A) * dz;
+		n = D3DXVECTOR3(A - B, _cellSpacing, C - A);
+	}
+	else
+	{
+		*height = D + (C - D) * (1.0f - dx) + (B - D) * (1.0f - dz);
+		n = D3DXVECTOR3(C - D, _cellSpacing, D - B);
+	}
+
+	if( normal )
+		D3DXVec3Normalize(normal, &n);
+}
+
+float SweptCollider::getHeight(float x, float z) const
+{
+	if( _heights.empty() )
+		return 0.0f;
+
+	float height;
+	groundAt(x, z, &height, 0);
+	return height;
+}
+
+void SweptCollider::getNormal(float x, float z, D3DXVECTOR3* normal) const
+{
+	if( _heights.empty() )
+	{
+		*normal = D3DXVECTOR3(0.0f, 1.0f, 0.0f);
+		return;
+	}
+
+	float height;
+	groundAt(x, z, &height, normal);
+}
+
+// How far p is above where a sphere of radius rests on the ground below it;
+// negative when the sphere is in the ground.  On a slope the sphere's
+// center sits radius / normal.y above the surface point under it.
+float SweptCollider::clearance(const D3DXVECTOR3& p, float radius) const
+{
+	float       height;
+	D3DXVECTOR3 n;
+	groundAt(p.x, p.z, &height, &n);
+
+	float ny = n.y > MinGroundNormalY ? n.y : MinGroundNormalY;
+	return p.y - height - radius / ny;
+}
+
+//
+// Volumes
+//
+
+int SweptCollider::addBox(const d3d::BoundingBox& box)
+{
+	_boxes.push_back(box);
+	return (int)_boxes.size() - 1;
+}
+
+int SweptCollider::addSphere(const d3d::BoundingSphere& sphere)
+{
+	_spheres.push_back(sphere);
+	return (int)_spheres.size() - 1;
+}
+
+void SweptCollider::build(float cellSize)
+{
+	int numBoxes = (int)_boxes.size();
+	int total    = numBoxes + (int)_spheres.size();
+
+	_cellStart.clear();
+	_cellItems.clear();
+	_gridCols = _gridRows = 0;
+
+	if( total == 0 )
+		return;
+
+	std::vector<float> minX(total), minZ(total), maxX(total), maxZ(total);
+	for(int i = 0; i < total; i++)
+	{
+		if( i < numBoxes )
+		{
+			minX[i] = _boxes[i]._min.x; maxX[i] = _boxes[i]._max.x;
+			minZ[i] = _boxes[i]._min.z; maxZ[i] = _boxes[i]._max.z;
+		}
+		else
+		{
+			const d3d::BoundingSphere& s = _spheres[i - numBoxes];
+			minX[i] = s._center.x - s._radius; maxX[i] = s._center.x + s._radius;
+			minZ[i] = s._center.z - s._radius; maxZ[i] = s._center.z + s._radius;
+		}
+	}
+
+	float loX = FLT_MAX, loZ = FLT_MAX, hiX = -FLT_MAX, hiZ = -FLT_MAX;
+	double widths = 0.0;
+	for(int i = 0; i < total; i++)
+	{
+		loX = minX[i] < loX ? minX[i] : loX;
+		loZ = minZ[i] < loZ ? minZ[i] : loZ;
+		hiX = maxX[i] > hiX ? maxX[i] : hiX;
+		hiZ = maxZ[i] > hiZ ? maxZ[i] : hiZ;
+
+		float w = maxX[i] - minX[i], dz = maxZ[i] - minZ[i];
+		widths += w > dz ? w : dz;
+	}
+
+	if( cellSize <= 0.0f )
+		cellSize = (float)(2.0 * widths / total);
+	if( cellSize <= 0.0f )
+		cellSize = 1.0f;
+
+	// keep the grid to 256 cells a side
+	float span = (hiX - loX) > (hiZ - loZ) ? (hiX - loX) : (hiZ - loZ);
+	if( span / cellSize > 255.0f )
+		cellSize = span / 255.0f;
+
+	_gridMinX = loX;
+	_gridMinZ = loZ;
+	_gridCell = cellSize;
+	_gridCols = (int)((hiX - loX) / cellSize) + 1;
+	_gridRows = (int)((hiZ - loZ) / cellSize) + 1;
+
+	// count, then place: each volume goes in every cell it overlaps
+	int numCells = _gridCols * _gridRows;
+	_cellStart.assign(numCells + 1, 0);
+
+	for(int pass = 0; pass < 2; pass++)
+	{
+		std::vector<int> fill;
+		if( pass == 1 )
+		{
+			for(int c = 0; c < numCells; c++)
+				_cellStart[c + 1] += _cellStart[c];
+			_cellItems.resize(_cellStart[numCells]);
+			fill.assign(_cellStart.begin(), _cellStart.end() - 1);
+		}
+
+		for(int i = 0; i < total; i++)
+		{
+			int c0 = (int)((minX[i] - loX) / cellSize), c1 = (int)((maxX[i] - loX) / cellSize);
+			int r0 = (int)((minZ[i] - loZ) / cellSize), r1 = (int)((maxZ[i] - loZ) / cellSize);
+
+			for(int r = r0; r <= r1; r++)
+			{
+				for(int c = c0; c <= c1; c++)
+				{
+					int cell = r * _gridCols + c;
+					if( pass == 0 )
+						_cellStart[cell + 1]++;
+					else
+						_cellItems[fill[cell]++] = i;
+				}
+			}
+		}
+	}
+}
+
+void SweptCollider::gather(float minX, float minZ, float maxX, float maxZ, Scratch& scratch, bool useGrid) const
+{
+	int total = (int)(_boxes.size() + _spheres.size());
+	scratch.candidates.clear();
+
+	if( !useGrid || _cellStart.empty() )
+	{
+		for(int i = 0; i < total; i++)
+			scratch.candidates.push_back(i);
+		return;
+	}
+
+	// a volume spanning several cells is gathered once per query
+	if( (int)scratch.visited.size() != total )
+		scratch.visited.assign(total, 0);
+	if( ++scratch.query == 0 )
+	{
+		scratch.visited.assign(total, 0);
+		scratch.query = 1;
+	}
+
+	int c0 = (int)floorf((minX - _gridMinX) / _gridCell), c1 = (int)floorf((maxX - _gridMinX) / _gridCell);
+	int r0 = (int)floorf((minZ - _gridMinZ) / _gridCell), r1 = (int)floorf((maxZ - _gridMinZ) / _gridCell);
+
+	if( c1 < 0 || r1 < 0 || c0 >= _gridCols || r0 >= _gridRows )
+		return;
+
+	c0 = c0 < 0 ? 0 : c0;  c1 = c1 >= _gridCols ? _gridCols - 1 : c1;
+	r0 = r0 < 0 ? 0 : r0;  r1 = r1 >= _gridRows ? _gridRows - 1 : r1;
+
+	for(int r = r0; r <= r1; r++)
+	{
+		for(int c = c0; c <= c1; c++)
+		{
+			int cell = r * _gridCols + c;
+			for(int k = _cellStart[cell]; k < _cellStart[cell + 1]; k++)
+			{
+				int id = _cellItems[k];
+				if( scratch.visited[id] != scratch.query )
+				{
+					scratch.visited[id] = scratch.query;
+					scratch.candidates.push_back(id);
+				}
+			}
+		}
+	}
+}
+
+//
+// Sweeps
+//
+
+bool SweptCollider::sweepObstacles(
+	const D3DXVECTOR3& from, float radius, const D3DXVECTOR3& displacement,
+	Scratch& scratch, bool useGrid, float* t, D3DXVECTOR3* normal) const
+{
+	D3DXVECTOR3 to = from + displacement;
+	gather(
+		(from.x < to.x ? from.x : to.x) - radius, (from.z < to.z ? from.z : to.z) - radius,
+		(from.x > to.x ? from.x : to.x) + radius, (from.z > to.z ? from.z : to.z) + radius,
+		scratch, useGrid);
+
+	int numBoxes = (int)_boxes.size();
+	int best = -1;
+	float bestT = FLT_MAX;
+
+	for(int k = 0; k < (int)scratch.candidates.size(); k++)
+	{
+		int id = scratch.candidates[k];
+
+		float hit;
+		bool  touches;
+		if( id < numBoxes )
+		{
+			touches = SweepSphereBox(from, displacement, radius, _boxes[id], &hit);
+		}
+		else
+		{
+			const d3d::BoundingSphere& s = _spheres[id - numBoxes];
+			touches = SweepPointSphere(from, displacement, s._center, s._radius + radius, &hit);
+		}
+
+		// ties go to the lower index, so the grid and the full list agree
+		if( touches && (hit < bestT || (hit == bestT && id < best)) )
+		{
+			bestT = hit;
+			best  = id;
+		}
+	}
+
+	scratch.obstacleTests += (int)scratch.candidates.size();
+	if( best < 0 )
+		return false;
+
+	D3DXVECTOR3 p = from + displacement * bestT;
+	if( best < numBoxes )
+	{
+		BoxNormal(p, _boxes[best], normal);
+	}
+	else
+	{
+		D3DXVECTOR3 v = p - _spheres[best - numBoxes]._center;
+		float length = D3DXVec3Length(&v);
+		*normal = length > 1e-6f ? v / length : D3DXVECTOR3(0.0f, 1.0f, 0.0f);
+	}
+
+	*t = bestT;
+	return true;
+}
+
+bool SweptCollider::sweepTerrain(
+	const D3DXVECTOR3& from, float radius, const D3DXVECTOR3& displacement,
+	float* t, D3DXVECTOR3* normal) const
+{
+	if( _heights.empty() )
+		return false;
+
+	float gFrom = clearance(from, radius);
+	if( gFrom < 0.0f )
+	{
+		*t = 0.0f;
+		getNormal(from.x, from.z, normal);
+		return true;
+	}
+
+	// Step along the move at most half a cell at a time, so the sweep does
+	// not step over a ridge.  Within a step the clearance is close to
+	// linear, so the first step that ends in the ground is narrowed down by
+	// false position, keeping the end still above it.
+	float horizontal = sqrtf(displacement.x * displacement.x + displacement.z * displacement.z);
+	int   steps      = 1 + (int)(horizontal / (_cellSpacing * 0.5f));
+
+	float previous = 0.0f, gPrevious = gFrom;
+	for(int i = 1; i <= steps; i++)
+	{
+		float ti = (float)i / (float)steps;
+		float gi = clearance(from + displacement * ti, radius);
+		if( gi < 0.0f )
+		{
+			float lo = previous, hi = ti, gLo = gPrevious, gHi = gi;
+			for(int k = 0; k < 4 && hi - lo > 1e-4f; k++)
+			{
+				float mid = lo + (hi - lo) * gLo / (gLo - gHi);
+				float g   = clearance(from + displacement * mid, radius);
+				if( g < 0.0f )
+				{
+					hi = mid; gHi = g;
+				}
+				else
+				{
+					lo = mid; gLo = g;
+				}
+			}
+
+			D3DXVECTOR3 p = from + displacement * lo;
+			getNormal(p.x, p.z, normal);
+			*t = lo;
+			return true;
+		}
+		previous  = ti;
+		gPrevious = gi;
+	}
+
+	return false;
+}
+
+bool SweptCollider::sweepAll(
+	const D3DXVECTOR3& from, float radius, const D3DXVECTOR3& displacement,
+	Scratch& scratch, bool useGrid, float* t, D3DXVECTOR3* normal) const
+{
+	float       obstacleT = FLT_MAX, terrainT = FLT_MAX;
+	D3DXVECTOR3 obstacleNormal, terrainNormal;
+
+	bool obstacle = sweepObstacles(from, radius, displacement, scratch, useGrid, &obstacleT, &obstacleNormal);
+	bool ground   = sweepTerrain(from, radius, displacement, &terrainT, &terrainNormal);
+
+	if( !obstacle && !ground )
+		return false;
+
+	if( obstacle && obstacleT <= terrainT )
+	{
+		scratch.obstacleHits++;
+		*t      = obstacleT;
+		*normal = obstacleNormal;
+	}
+	else
+	{
+		scratch.terrainHits++;
+		*t      = terrainT;
+		*normal = terrainNormal;
+	}
+
+	return true;
+}
+
+bool SweptCollider::sweep(
+	const D3DXVECTOR3& from, float radius, const D3DXVECTOR3& displacement,
+	float* t, D3DXVECTOR3* normal, bool useGrid) const
+{
+	return sweepAll(from, radius, displacement, _scratch, useGrid, t, normal);
+}
+
+//
+// Moves
+//
+
+bool SweptCollider::depenetrate(D3DXVECTOR3* position, float radius, Scratch& scratch) const
+{
+	D3DXVECTOR3& p = *position;
+	bool moved = false;
+
+	gather(p.x - radius, p.z - radius, p.x + radius, p.z + radius, scratch, true);
+
+	int numBoxes = (int)_boxes.size();
+	for(int k = 0; k < (int)scratch.candidates.size(); k++)
+	{
+		int id = scratch.candidates[k];
+
+		if( id < numBoxes )
+		{
+			const d3d::BoundingBox& box = _boxes[id];
+
+			D3DXVECTOR3 q;
+			for(int i = 0; i < 3; i++)
+				q[i] = p[i] < box._min[i] ? box._min[i] : (p[i] > box._max[i] ? box._max[i] : p[i]);
+
+			D3DXVECTOR3 v = p - q;
+			float distance = D3DXVec3Length(&v);
+			if( distance >= radius )
+				continue;
+
+			D3DXVECTOR3 n;
+			BoxNormal(p, box, &n);
+			if( distance > 1e-6f )
+			{
+				p += n * (radius - distance + Skin);
+			}
+			else
+			{
+				// the center is inside: out through the nearest face
+				int axis = n.x != 0.0f ? 0 : (n.y != 0.0f ? 1 : 2);
+				p[axis] = n[axis] > 0.0f ? box._max[axis] + radius + Skin : box._min[axis] - radius - Skin;
+			}
+			moved = true;
+		}
+		else
+		{
+			const d3d::BoundingSphere& s = _spheres[id - numBoxes];
+
+			D3DXVECTOR3 v = p - s._center;
+			float distance = D3DXVec3Length(&v);
+			float reach    = s._radius + radius;
+			if( distance >= reach )
+				continue;
+
+			D3DXVECTOR3 n = distance > 1e-6f ? v / distance : D3DXVECTOR3(0.0f, 1.0f, 0.0f);
+			p = s._center + n * (reach + Skin);
+			moved = true;
+		}
+	}
+
+	if( !_heights.empty() )
+	{
+		float below = clearance(p, radius);
+		if( below < 0.0f )
+		{
+			p.y += Skin - below;
+			moved = true;
+		}
+	}
+
+	return moved;
+}
+
+bool SweptCollider::moveOne(D3DXVECTOR3* position, float radius, const D3DXVECTOR3& displacement, Scratch& scratch) const
+{
+	bool touched = depenetrate(position, radius, scratch);
+
+	D3DXVECTOR3 p = *position;
+	D3DXVECTOR3 d = displacement;
+
+	for(int slide = 0; slide < MaxSlides; slide++)
+	{
+		float length = D3DXVec3Length(&d);
+		if( length < 1e-5f )
+			break;
+
+		if( slide > 0 )
+			scratch.slides++;
+
+		float       t;
+		D3DXVECTOR3 n;
+		if( !sweepAll(p, radius, d, scratch, true, &t, &n) )
+		{
+			p += d;
+			break;
+		}
+		touched = true;
+
+		// up to the surface, less the skin, then slide what is left along it
+		float travel = t - Skin / length;
+		travel = travel > 0.0f ? travel : 0.0f;
+		p += d * travel;
+
+		D3DXVECTOR3 rest = d * (1.0f - travel);
+		d = rest - n * D3DXVec3Dot(&rest, &n);
+	}
+
+	// The terrain sweep samples the move, and the ground's slope changes
+	// across triangle edges between samples; settle any dip on the ground.
+	if( !_heights.empty() )
+	{
+		float below = clearance(p, radius);
+		if( below < 0.0f )
+		{
+			p.y += Skin - below;
+			touched = true;
+		}
+	}
+
+	*position = p;
+	return touched;
+}
+
+bool SweptCollider::move(D3DXVECTOR3* position, float radius, const D3DXVECTOR3& displacement) const
+{
+	return moveOne(position, radius, displacement, _scratch);
+}
+
+void SweptCollider::moveRange(
+	D3DXVECTOR3* positions, const float* radii, const D3DXVECTOR3* displacements,
+	int begin, int end, BYTE* touched, Scratch* scratch, int* numTouched) const
+{
+	int count = 0;
+	for(int i = begin; i < end; i++)
+	{
+		bool hit = moveOne(&positions[i], radii[i], displacements[i], *scratch);
+		if( touched )
+			touched[i] = hit ? 1 : 0;
+		count += hit ? 1 : 0;
+	}
+	*numTouched = count;
+}
+
+int SweptCollider::moveAgents(
+	D3DXVECTOR3* positions, const float* radii, const D3DXVECTOR3* displacements,
+	int count, int numThreads, BYTE* touched)
+{
+	double start = Now();
+
+	if( numThreads <= 0 )
+		numThreads = (int)std::thread::hardware_concurrency();
+	if( numThreads <= 0 )
+		numThreads = 1;
+
+	int useful = count / MinAgentsPerThread;
+	if( useful < 1 )
+		useful = 1;
+	numThreads = numThreads < useful ? numThreads : useful;
+
+	if( (int)_agentScratch.size() < numThreads )
+		_agentScratch.resize(numThreads);
+	for(int t = 0; t < numThreads; t++)
+		_agentScratch[t].resetCounts();
+
+	std::vector<Scratch>& scratch = _agentScratch;
+	std::vector<int>      counts(numThreads, 0);
+	std::vector<std::thread> threads;
+
+	for(int t = 1; t < numThreads; t++)
+	{
+		int begin = (int)((long long)count * t / numThreads);
+		int end   = (int)((long long)count * (t + 1) / numThreads);
+		threads.push_back(std::thread(&SweptCollider::moveRange, this,
+			positions, radii, displacements, begin, end, touched, &scratch[t], &counts[t]));
+	}
+	moveRange(positions, radii, displacements, 0, count / numThreads, touched, &scratch[0], &counts[0]);
+
+	for(int t = 0; t < (int)threads.size(); t++)
+		threads[t].join();
+
+	_stats = SweepStats();
+	_stats.agents     = count;
+	_stats.numThreads = numThreads;
+	for(int t = 0; t < numThreads; t++)
+	{
+		_stats.touched       += counts[t];
+		_stats.slides        += scratch[t].slides;
+		_stats.obstacleTests += scratch[t].obstacleTests;
+		_stats.obstacleHits  += scratch[t].obstacleHits;
+		_stats.terrainHits   += scratch[t].terrainHits;
+	}
+	_stats.moveMs = (float)(Now() - start);
+
+	return _stats.touched;
+}
+
+//
+// Benchmark
+//
+
+bool BenchmarkSweptCollision(int numAgents, int numFrames, int numThreads, SweepBenchmark* result)
+{
+	if( !result || numAgents <= 0 || numFrames <= 0 )
+		return false;
+
+	srand(11);
+
+	// rolling hills the size of the fog sample's terrain
+	const int   numVerts    = 64;
+	const float cellSpacing = 6.0f;
+
+	std::vector<float> heights(numVerts * numVerts);
+	for(int row = 0; row < numVerts; row++)
+	{
+		for(int col = 0; col < numVerts; col++)
+		{
+			float x = col * cellSpacing, z = row * cellSpacing;
+			heights[row * numVerts + col] = 30.0f + 20.0f * sinf(x * 0.03f) * cosf(z * 0.025f) + 6.0f * sinf(x * 0.11f + z * 0.07f);
+		}
+	}
+
+	SweptCollider collider;
+	collider.setHeightfield(heights, numVerts, numVerts, cellSpacing);
+
+	// pillars like the fog sample's and a few boulders
+	std::vector<d3d::BoundingBox>    boxes(2000);
+	std::vector<d3d::BoundingSphere> spheres(200);
+	for(int i = 0; i < (int)boxes.size(); i++)
+	{
+		float x = Random(-180.0f, 180.0f);
+		float z = Random(-180.0f, 180.0f);
+		float y = collider.getHeight(x, z);
+
+		boxes[i]._min = D3DXVECTOR3(x - 1.0f, y - 1.0f, z - 1.0f);
+		boxes[i]._max = D3DXVECTOR3(x + 1.0f, y + 8.0f, z + 1.0f);
+		collider.addBox(boxes[i]);
+	}
+	for(int i = 0; i < (int)spheres.size(); i++)
+	{
+		float x = Random(-180.0f, 180.0f);
+		float z = Random(-180.0f, 180.0f);
+
+		spheres[i]._radius = Random(1.0f, 3.0f);
+		spheres[i]._center = D3DXVECTOR3(x, collider.getHeight(x, z) + 1.0f, z);
+		collider.addSphere(spheres[i]);
+	}
+	collider.build(0.0f);
+
+	std::vector<D3DXVECTOR3> positions(numAgents), displacements(numAgents), headings(numAgents);
+	std::vector<float>       radii(numAgents), speeds(numAgents);
+	std::vector<BYTE>        touched(numAgents);
+	for(int i = 0; i < numAgents; i++)
+	{
+		// start clear of everything
+		radii[i]  = Random(0.5f, 1.5f);
+		speeds[i] = Random(4.0f, 8.0f);
+		do
+		{
+			float x = Random(-170.0f, 170.0f);
+			float z = Random(-170.0f, 170.0f);
+			positions[i] = D3DXVECTOR3(x, collider.getHeight(x, z) + 3.0f, z);
+		}
+		while( Overlaps(positions[i], radii[i] + 0.1f, boxes, spheres) );
+
+		float angle = Random(0.0f, 2.0f * D3DX_PI);
+		headings[i] = D3DXVECTOR3(cosf(angle), 0.0f, sinf(angle));
+	}
+
+	const float timeDelta = 1.0f / 30.0f;
+	const float fallSpeed = 10.0f;
+
+	double moveMs = 0.0, tests = 0.0, hits = 0.0;
+	bool matches = true;
+
+	for(int frame = 0; frame < numFrames; frame++)
+	{
+		for(int i = 0; i < numAgents; i++)
+		{
+			// wander, turning back at the edge of the world
+			D3DXVECTOR3& p = positions[i];
+			if( (p.x < -170.0f && headings[i].x < 0.0f) || (p.x > 170.0f && headings[i].x > 0.0f) )
+				headings[i].x = -headings[i].x;
+			if( (p.z < -170.0f && headings[i].z < 0.0f) || (p.z > 170.0f && headings[i].z > 0.0f) )
+				headings[i].z = -headings[i].z;
+
+			if( touched[i] && rand() % 16 == 0 )
+			{
+				float angle = Random(0.0f, 2.0f * D3DX_PI);
+				headings[i] = D3DXVECTOR3(cosf(angle), 0.0f, sinf(angle));
+			}
+
+			displacements[i] = headings[i] * speeds[i] * timeDelta + D3DXVECTOR3(0.0f, -fallSpeed * timeDelta, 0.0f);
+		}
+
+		// the grid must find the same first contact as testing every volume
+		if( frame == numFrames / 2 )
+		{
+			for(int i = 0; i < numAgents && i < 256; i++)
+			{
+				float t0 = 0.0f, t1 = 0.0f;
+				D3DXVECTOR3 n0, n1;
+				D3DXVECTOR3 d = displacements[i] * 8.0f;
+
+				bool hit0 = collider.sweep(positions[i], radii[i], d, &t0, &n0, true);
+				bool hit1 = collider.sweep(positions[i], radii[i], d, &t1, &n1, false);
+				if( hit0 != hit1 || (hit0 && fabsf(t0 - t1) > 1e-6f) )
+					matches = false;
+			}
+		}
+
+		collider.moveAgents(&positions[0], &radii[0], &displacements[0], numAgents, numThreads, &touched[0]);
+
+		const SweepStats& stats = collider.getStats();
+		moveMs += stats.moveMs;
+		tests  += stats.obstacleTests;
+		hits   += stats.touched;
+	}
+
+	// no one may end up inside anything
+	int penetrations = 0;
+	const float tolerance = 0.01f;
+	for(int i = 0; i < numAgents; i++)
+	{
+		const D3DXVECTOR3& p = positions[i];
+		float r = radii[i] - tolerance;
+
+		// distance to the ground's plane under the agent
+		D3DXVECTOR3 n;
+		collider.getNormal(p.x, p.z, &n);
+		bool inside = (p.y - collider.getHeight(p.x, p.z)) * n.y < r || Overlaps(p, r, boxes, spheres);
+
+		if( inside )
+			penetrations++;
+	}
+
+	result->numAgents     = numAgents;
+	result->numObstacles  = (int)(boxes.size() + spheres.size());
+	result->numThreads    = collider.getStats().numThreads;
+	result->moveMs        = (float)(moveMs / numFrames);
+	result->obstacleTests = (float)(tests / numFrames);
+	result->touched       = (float)(hits / numFrames);
+	result->penetrations  = penetrations;
+	result->matches       = matches;
+	return true;
+}
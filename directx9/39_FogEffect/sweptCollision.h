@@ -0,0 +1,165 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: sweptCollision.h
+//
+// Desc: Moves spheres (the camera, characters) through the world without
+//       letting them pass through the terrain or the scene's bounding
+//       volumes.  Each move is swept: the sphere stops where it first
+//       touches something, and what is left of the move slides along the
+//       surface it hit.  The volumes never move, so a uniform grid over the
+//       xz plane finds the few near a move.  Many agents are moved in one
+//       call, split over threads.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __sweptCollisionH__
+#define __sweptCollisionH__
+
+#include "d3dUtility.h"
+#include <vector>
+
+struct SweepStats
+{
+	SweepStats();
+
+	int   agents;
+	int   touched;        // agents that hit something
+	int   slides;         // sweeps past the first, one per surface slid along
+	int   obstacleTests;  // swept tests against the volumes the grid returned
+	int   obstacleHits;
+	int   terrainHits;
+	int   numThreads;
+	float moveMs;
+};
+
+class SweptCollider
+{
+public:
+	// A move slides along at most this many surfaces before it stops.
+	enum { MaxSlides = 4 };
+
+	SweptCollider();
+
+	void clear();
+
+	// The ground, laid out like Terrain's heightmap: row 0 at z = +depth / 2
+	// and column 0 at x = -width / 2, split into triangles the same way.
+	// Outside it the edge heights carry on.
+	void  setHeightfield(const std::vector<float>& heights, int numVertsPerRow, int numVertsPerCol, float cellSpacing);
+	bool  hasHeightfield() const { return !_heights.empty(); }
+	float getHeight(float x, float z) const;
+	void  getNormal(float x, float z, D3DXVECTOR3* normal) const;
+
+	// Volumes to collide with; call build() after adding them.  Each returns
+	// the volume's index among its kind.
+	int addBox(const d3d::BoundingBox& box);
+	int addSphere(const d3d::BoundingSphere& sphere);
+
+	// Bins the volumes into the grid.  cellSize = 0 picks twice the average
+	// volume's width.
+	void build(float cellSize);
+
+	// The first contact of a sphere moving from from to from + displacement:
+	// t in [0, 1] and the surface normal there.  useGrid = false tests every
+	// volume, for checking the grid.
+	bool sweep(const D3DXVECTOR3& from, float radius, const D3DXVECTOR3& displacement,
+		float* t, D3DXVECTOR3* normal, bool useGrid) const;
+
+	// Moves the sphere as far along displacement as it goes, sliding along
+	// what it hits.  A sphere that starts inside the ground or a volume is
+	// pushed out first.  Returns true if it touched anything.  sweep() and
+	// move() share the collider's working memory, so only one thread may
+	// call them at a time.
+	bool move(D3DXVECTOR3* position, float radius, const D3DXVECTOR3& displacement) const;
+
+	// The same for count agents, updating positions in place.  touched, if
+	// given, gets 1 for each agent that hit something.  numThreads = 0 uses
+	// one thread per hardware thread.  Returns how many touched.
+	int moveAgents(D3DXVECTOR3* positions, const float* radii, const D3DXVECTOR3* displacements,
+		int count, int numThreads, BYTE* touched);
+
+	const SweepStats& getStats() const { return _stats; }
+
+private:
+	// heightfield
+	std::vector<float> _heights;
+	int   _numVertsPerRow;
+	int   _numVertsPerCol;
+	float _cellSpacing;
+	float _width;
+	float _depth;
+
+	// volumes; an obstacle index below _boxes.size() is a box, the rest are
+	// spheres after them
+	std::vector<d3d::BoundingBox>    _boxes;
+	std::vector<d3d::BoundingSphere> _spheres;
+
+	// broadphase: obstacle indices by grid cell over the xz plane
+	float            _gridMinX, _gridMinZ;
+	float            _gridCell;
+	int              _gridCols, _gridRows;
+	std::vector<int> _cellStart;  // _gridCols * _gridRows + 1
+	std::vector<int> _cellItems;
+
+	SweepStats _stats;
+
+	// per thread working memory
+	struct Scratch
+	{
+		Scratch() : query(0), slides(0), obstacleTests(0), obstacleHits(0), terrainHits(0) {}
+
+		std::vector<unsigned> visited;  // query number each obstacle was last gathered by
+		std::vector<int>      candidates;
+		unsigned query;
+
+		int slides;
+		int obstacleTests;
+		int obstacleHits;
+		int terrainHits;
+
+		void resetCounts() { slides = obstacleTests = obstacleHits = terrainHits = 0; }
+	};
+
+	// kept from call to call: one for sweep() and move(), one per thread
+	// for moveAgents
+	mutable Scratch      _scratch;
+	std::vector<Scratch> _agentScratch;
+
+	float heightAt(int row, int col) const;
+	void  groundAt(float x, float z, float* height, D3DXVECTOR3* normal) const;
+	float clearance(const D3DXVECTOR3& p, float radius) const;
+
+	void gather(float minX, float minZ, float maxX, float maxZ, Scratch& scratch, bool useGrid) const;
+	bool sweepObstacles(const D3DXVECTOR3& from, float radius, const D3DXVECTOR3& displacement,
+		Scratch& scratch, bool useGrid, float* t, D3DXVECTOR3* normal) const;
+	bool sweepTerrain(const D3DXVECTOR3& from, float radius, const D3DXVECTOR3& displacement,
+		float* t, D3DXVECTOR3* normal) const;
+	bool sweepAll(const D3DXVECTOR3& from, float radius, const D3DXVECTOR3& displacement,
+		Scratch& scratch, bool useGrid, float* t, D3DXVECTOR3* normal) const;
+
+	bool depenetrate(D3DXVECTOR3* position, float radius, Scratch& scratch) const;
+	bool moveOne(D3DXVECTOR3* position, float radius, const D3DXVECTOR3& displacement, Scratch& scratch) const;
+	void moveRange(D3DXVECTOR3* positions, const float* radii, const D3DXVECTOR3* displacements,
+		int begin, int end, BYTE* touched, Scratch* scratch, int* numTouched) const;
+};
+
+//
+// Headless benchmark: numAgents spheres walking over a hilly heightfield
+// scattered with pillars, like the fog sample's, for numFrames frames.
+//
+
+struct SweepBenchmark
+{
+	int   numAgents;
+	int   numObstacles;
+	int   numThreads;
+	float moveMs;          // average per frame
+	float obstacleTests;   // average per frame
+	float touched;         // average per frame
+	int   penetrations;    // agents left inside the ground or a volume, should be 0
+	bool  matches;         // grid against testing every volume, for a sample of sweeps
+};
+
+bool BenchmarkSweptCollision(int numAgents, int numFrames, int numThreads, SweepBenchmark* result);
+
+#endif // __sweptCollisionH__
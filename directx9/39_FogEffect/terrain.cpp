@@ -13,8 +13,22 @@
 #include "terrain.h"
 #include <fstream>
 #include <cmath>
+#include <thread>
+#include <xmmintrin.h>
+#include <emmintrin.h>
 
-const DWORD Terrain::TerrainVertex::FVF = D3DFVF_XYZ | D3DFVF_TEX1;
+const DWORD Terrain::TerrainVertex::FVF = D3DFVF_XYZ | D3DFVF_NORMAL | D3DFVF_TEX1;
+
+const D3DVERTEXELEMENT9 Terrain::CompactTerrainVertex::Decl[] =
+{
+	// stream 0: shared grid coordinates of one chunk
+	{0, 0, D3DDECLTYPE_SHORT2,  D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_POSITION, 0},
+
+	// stream 1: the heights and normals of the chunk being drawn
+	{1, 0, D3DDECLTYPE_FLOAT1,  D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_POSITION, 1},
+	{1, 4, D3DDECLTYPE_SHORT2N, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_NORMAL,   0},
+	D3DDECL_END()
+};
 
 Terrain::Terrain(IDirect3DDevice9* device,
 				 std::string heightmapFileName,
@@ -24,6 +38,17 @@ Terrain::Terrain(IDirect3DDevice9* device,
 				 float heightScale)
 {
 	_device         = device;
+	_tex            = 0;
+	_vb             = 0;
+	_ib             = 0;
+	_gridVB         = 0;
+	_chunkIB        = 0;
+	_compactVB      = 0;
+	_compactDecl    = 0;
+	_compactFX      = 0;
+	_chunkCells     = 0;
+	_numChunksPerRow = 0;
+	_numChunksPerCol = 0;
 	_numVertsPerRow = numVertsPerRow;
 	_numVertsPerCol = numVertsPerCol;
 	_cellSpacing    = cellSpacing;
@@ -50,6 +75,17 @@ Terrain::Terrain(IDirect3DDevice9* device,
 	for(int i = 0; i < _heightmap.size(); i++)
 		_heightmap[i] *= heightScale;
 
+	// compute the vertex normals
+	if( !computeNormals() )
+	{
+		::MessageBox(0, "computeNormals - FAILED", 0, 0);
+		::PostQuitMessage(0);
+	}
+
+	// with no device, only the heights are kept; nothing is drawn
+	if( !_device )
+		return;
+
 	// compute the vertices
 	if( !computeVertices() )
 	{
@@ -70,6 +106,11 @@ Terrain::~Terrain()
 	d3d::Release<IDirect3DVertexBuffer9*>(_vb);
 	d3d::Release<IDirect3DIndexBuffer9*>(_ib);
 	d3d::Release<IDirect3DTexture9*>(_tex);
+	d3d::Release<IDirect3DVertexBuffer9*>(_gridVB);
+	d3d::Release<IDirect3DIndexBuffer9*>(_chunkIB);
+	d3d::Release<IDirect3DVertexBuffer9*>(_compactVB);
+	d3d::Release<IDirect3DVertexDeclaration9*>(_compactDecl);
+	d3d::Release<ID3DXEffect*>(_compactFX);
 }
 
 int Terrain::getHeightmapEntry(int row, int col)
@@ -87,6 +128,126 @@ void Terrain::setHeightmapEntry(int row, int col, int value)
 	_heightmap[row * _numVertsPerRow + col] = value;
 }
 
+const D3DXVECTOR3& Terrain::getNormal(int row, int col)
+{
+	return _normals[row * _numVertsPerRow + col];
+}
+
+bool Terrain::computeNormals()
+{
+	_normals.resize(_numVertices);
+
+	// Rows are independent, so hand each thread a band of them.
+	int numThreads = (int)std::thread::hardware_concurrency();
+	if( numThreads < 1 )
+		numThreads = 1;
+	if( numThreads > _numVertsPerCol )
+		numThreads = _numVertsPerCol;
+
+	int rowsPerThread = (_numVertsPerCol + numThreads - 1) / numThreads;
+
+	std::vector<std::thread> workers;
+	for(int i = 1; i < numThreads; i++)
+	{
+		int first = i * rowsPerThread;
+		int last  = first + rowsPerThread < _numVertsPerCol ? first + rowsPerThread : _numVertsPerCol;
+		if( first < last )
+			workers.push_back(std::thread(&Terrain::computeNormalRows, this, first, last));
+	}
+
+	// the calling thread does the first band
+	computeNormalRows(0, rowsPerThread < _numVertsPerCol ? rowsPerThread : _numVertsPerCol);
+
+	for(int i = 0; i < (int)workers.size(); i++)
+		workers[i].join();
+
+	return true;
+}
+
+void Terrain::computeNormalRows(int firstRow, int lastRow)
+{
+	// Sobel filter on the heightmap.  With h = height(col, row):
+	//
+	//   gx = (right column) - (left column),  weighted 1 2 1
+	//   gz = (row below)    - (row above),    weighted 1 2 1
+	//
+	// Both span two cells with a total weight of 4, so dh/dcol = gx / 8.  Rows
+	// run towards -z, hence the normal is (-gx, 8 * cellSpacing, gz) normalized.
+
+	__m128 eightSpacing = _mm_set1_ps(8.0f * (float)_cellSpacing);
+
+	for(int row = firstRow; row < lastRow; row++)
+	{
+		int above = row > 0 ? row - 1 : 0;
+		int below = row < _numVertsPerCol - 1 ? row + 1 : _numVertsPerCol - 1;
+
+		const int* up   = &_heightmap[above * _numVertsPerRow];
+		const int* mid  = &_heightmap[row   * _numVertsPerRow];
+		const int* down = &_heightmap[below * _numVertsPerRow];
+
+		D3DXVECTOR3* out = &_normals[row * _numVertsPerRow];
+
+		// the first and last columns clamp, do them with the scalar version
+		out[0] = sobelNormal(row, 0);
+
+		int col = 1;
+		for(; col + 4 < _numVertsPerRow; col += 4)
+		{
+			__m128i ul = _mm_loadu_si128((const __m128i*)(up   + col - 1));
+			__m128i uc = _mm_loadu_si128((const __m128i*)(up   + col));
+			__m128i ur = _mm_loadu_si128((const __m128i*)(up   + col + 1));
+			__m128i ml = _mm_loadu_si128((const __m128i*)(mid  + col - 1));
+			__m128i mr = _mm_loadu_si128((const __m128i*)(mid  + col + 1));
+			__m128i dl = _mm_loadu_si128((const __m128i*)(down + col - 1));
+			__m128i dc = _mm_loadu_si128((const __m128i*)(down + col));
+			__m128i dr = _mm_loadu_si128((const __m128i*)(down + col + 1));
+
+			__m128i left   = _mm_add_epi32(_mm_add_epi32(ul, dl), _mm_slli_epi32(ml, 1));
+			__m128i right  = _mm_add_epi32(_mm_add_epi32(ur, dr), _mm_slli_epi32(mr, 1));
+			__m128i top    = _mm_add_epi32(_mm_add_epi32(ul, ur), _mm_slli_epi32(uc, 1));
+			__m128i bottom = _mm_add_epi32(_mm_add_epi32(dl, dr), _mm_slli_epi32(dc, 1));
+
+			__m128 nx = _mm_cvtepi32_ps(_mm_sub_epi32(left, right));
+			__m128 ny = eightSpacing;
+			__m128 nz = _mm_cvtepi32_ps(_mm_sub_epi32(bottom, top));
+
+			__m128 lenSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz));
+			__m128 invLen = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(lenSq));
+
+			float x[4], y[4], z[4];
+			_mm_storeu_ps(x, _mm_mul_ps(nx, invLen));
+			_mm_storeu_ps(y, _mm_mul_ps(ny, invLen));
+			_mm_storeu_ps(z, _mm_mul_ps(nz, invLen));
+
+			for(int k = 0; k < 4; k++)
+				out[col + k] = D3DXVECTOR3(x[k], y[k], z[k]);
+		}
+
+		for(; col < _numVertsPerRow; col++)
+			out[col] = sobelNormal(row, col);
+	}
+}
+
+D3DXVECTOR3 Terrain::sobelNormal(int row, int col)
+{
+	int r0 = row > 0 ? row - 1 : 0;
+	int r2 = row < _numVertsPerCol - 1 ? row + 1 : _numVertsPerCol - 1;
+	int c0 = col > 0 ? col - 1 : 0;
+	int c2 = col < _numVertsPerRow - 1 ? col + 1 : _numVertsPerRow - 1;
+
+	#define H(r, c) ((float)_heightmap[(r) * _numVertsPerRow + (c)])
+
+	float gx = (H(r0, c2) + 2.0f * H(row, c2) + H(r2, c2)) - (H(r0, c0) + 2.0f * H(row, c0) + H(r2, c0));
+	float gz = (H(r2, c0) + 2.0f * H(r2, col) + H(r2, c2)) - (H(r0, c0) + 2.0f * H(r0, col) + H(r0, c2));
+
+	#undef H
+
+	D3DXVECTOR3 n(-gx, 8.0f * (float)_cellSpacing, gz);
+	D3DXVec3Normalize(&n, &n);
+
+	return n;
+}
+
 bool Terrain::computeVertices()
 {
 	HRESULT hr = 0;
@@ -102,42 +263,19 @@ bool Terrain::computeVertices()
 	if(FAILED(hr))
 		return false;
 
-	// coordinates to start generating vertices at
-	int startX = -_width / 2;
-	int startZ =  _depth / 2;
-
-	// coordinates to end generating vertices at
-	int endX =  _width / 2;
-	int endZ = -_depth / 2;
-
-	// compute the increment size of the texture coordinates
-	// from one vertex to the next.
-	float uCoordIncrementSize = 1.0f / (float)_numCellsPerRow;
-	float vCoordIncrementSize = 1.0f / (float)_numCellsPerCol;
-
 	TerrainVertex* v = 0;
 	_vb->Lock(0, 0, (void**)&v, 0);
 
-	int i = 0;
-	for(int z = startZ; z >= endZ; z -= _cellSpacing)
+	for(int i = 0; i < _numVertsPerCol; i++)
 	{
-		int j = 0;
-		for(int x = startX; x <= endX; x += _cellSpacing)
+		for(int j = 0; j < _numVertsPerRow; j++)
 		{
 			// compute the correct index into the vertex buffer and heightmap
 			// based on where we are in the nested loop.
 			int index = i * _numVertsPerRow + j;
 
-			v[index] = TerrainVertex(
-				(float)x,
-				(float)_heightmap[index],
-				(float)z,
-				(float)j * uCoordIncrementSize,
-				(float)i * vCoordIncrementSize);
-
-			j++; // next column
+			v[index] = gridVertex(i, j);
 		}
-		i++; // next row
 	}
 
 	_vb->Unlock();
@@ -145,6 +283,28 @@ bool Terrain::computeVertices()
 	return true;
 }
 
+Terrain::TerrainVertex Terrain::gridVertex(int row, int col)
+{
+	// coordinates to start generating vertices at
+	int startX = -_width / 2;
+	int startZ =  _depth / 2;
+
+	// compute the increment size of the texture coordinates
+	// from one vertex to the next.
+	float uCoordIncrementSize = 1.0f / (float)_numCellsPerRow;
+	float vCoordIncrementSize = 1.0f / (float)_numCellsPerCol;
+
+	const D3DXVECTOR3& n = _normals[row * _numVertsPerRow + col];
+
+	return TerrainVertex(
+		(float)(startX + col * _cellSpacing),
+		(float)_heightmap[row * _numVertsPerRow + col],
+		(float)(startZ - row * _cellSpacing),
+		n.x, n.y, n.z,
+		(float)col * uCoordIncrementSize,
+		(float)row * vCoordIncrementSize);
+}
+
 bool Terrain::computeIndices()
 {
 	HRESULT hr = 0;
@@ -190,6 +350,353 @@ bool Terrain::computeIndices()
 	return true;
 }
 
+bool Terrain::simplify(float maxError, int tileCells, TinStats* stats)
+{
+	TinBuilder tin(_heightmap, _numVertsPerRow, _numVertsPerCol);
+
+	if( !tin.build(maxError, tileCells, 0) )
+		return false;
+
+	if( !createTinBuffers(tin) )
+		return false;
+
+	if( stats )
+		*stats = tin.getStats();
+
+	return true;
+}
+
+bool Terrain::createTinBuffers(const TinBuilder& tin)
+{
+	HRESULT hr = 0;
+
+	const std::vector<int>&   verts   = tin.getVertices();
+	const std::vector<DWORD>& indices = tin.getIndices();
+
+	IDirect3DVertexBuffer9* vb = 0;
+	IDirect3DIndexBuffer9*  ib = 0;
+
+	hr = _device->CreateVertexBuffer(
+		verts.size() * sizeof(TerrainVertex),
+		D3DUSAGE_WRITEONLY,
+		TerrainVertex::FVF,
+		D3DPOOL_MANAGED,
+		&vb,
+		0);
+
+	if(FAILED(hr))
+		return false;
+
+	// only fall back to 32 bit indices when 16 bits can't address every vertex
+	bool use32 = verts.size() > 0xffff;
+
+	hr = _device->CreateIndexBuffer(
+		indices.size() * (use32 ? sizeof(DWORD) : sizeof(WORD)),
+		D3DUSAGE_WRITEONLY,
+		use32 ? D3DFMT_INDEX32 : D3DFMT_INDEX16,
+		D3DPOOL_MANAGED,
+		&ib,
+		0);
+
+	if(FAILED(hr))
+	{
+		d3d::Release<IDirect3DVertexBuffer9*>(vb);
+		return false;
+	}
+
+	TerrainVertex* v = 0;
+	vb->Lock(0, 0, (void**)&v, 0);
+
+	for(int i = 0; i < verts.size(); i++)
+		v[i] = gridVertex(verts[i] / _numVertsPerRow, verts[i] % _numVertsPerRow);
+
+	vb->Unlock();
+
+	void* data = 0;
+	ib->Lock(0, 0, &data, 0);
+
+	if( use32 )
+	{
+		::memcpy(data, &indices[0], indices.size() * sizeof(DWORD));
+	}
+	else
+	{
+		WORD* w = (WORD*)data;
+		for(int i = 0; i < indices.size(); i++)
+			w[i] = (WORD)indices[i];
+	}
+
+	ib->Unlock();
+
+	// swap in the new buffers
+	d3d::Release<IDirect3DVertexBuffer9*>(_vb);
+	d3d::Release<IDirect3DIndexBuffer9*>(_ib);
+
+	_vb = vb;
+	_ib = ib;
+	_numVertices  = verts.size();
+	_numTriangles = indices.size() / 3;
+
+	return true;
+}
+
+// Octahedral normal encoding around +y: project onto the octahedron
+// |x| + |y| + |z| = 1, keep x and z, and fold the lower half over the upper.
+static void OctEncode(const D3DXVECTOR3& n, short* outX, short* outZ)
+{
+	float l1 = ::fabsf(n.x) + ::fabsf(n.y) + ::fabsf(n.z);
+	float x  = n.x / l1;
+	float z  = n.z / l1;
+
+	if( n.y < 0.0f )
+	{
+		float fx = (1.0f - ::fabsf(z)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float fz = (1.0f - ::fabsf(x)) * (z >= 0.0f ? 1.0f : -1.0f);
+		x = fx;
+		z = fz;
+	}
+
+	*outX = (short)::floorf(x * 32767.0f + 0.5f);
+	*outZ = (short)::floorf(z * 32767.0f + 0.5f);
+}
+
+bool Terrain::buildCompact(int chunkCells)
+{
+	HRESULT hr = 0;
+
+	// the shared chunk index list is 16 bit
+	if( chunkCells < 1 || (chunkCells + 1) * (chunkCells + 1) > 0x10000 )
+		return false;
+
+	_chunkCells      = chunkCells;
+	_numChunksPerRow = (_numCellsPerRow + chunkCells - 1) / chunkCells;
+	_numChunksPerCol = (_numCellsPerCol + chunkCells - 1) / chunkCells;
+
+	int chunkVerts   = chunkCells + 1;
+	int vertsInChunk = chunkVerts * chunkVerts;
+	int numChunks    = _numChunksPerRow * _numChunksPerCol;
+
+	//
+	// Shared grid stream and index list of one chunk.
+	//
+
+	hr = _device->CreateVertexBuffer(
+		vertsInChunk * sizeof(GridVertex),
+		D3DUSAGE_WRITEONLY,
+		0,
+		D3DPOOL_MANAGED,
+		&_gridVB,
+		0);
+
+	if(FAILED(hr))
+		return false;
+
+	GridVertex* g = 0;
+	_gridVB->Lock(0, 0, (void**)&g, 0);
+
+	for(int i = 0; i < chunkVerts; i++)
+	{
+		for(int j = 0; j < chunkVerts; j++)
+		{
+			g[i * chunkVerts + j]._col = (short)j;
+			g[i * chunkVerts + j]._row = (short)i;
+		}
+	}
+
+	_gridVB->Unlock();
+
+	hr = _device->CreateIndexBuffer(
+		chunkCells * chunkCells * 6 * sizeof(WORD),
+		D3DUSAGE_WRITEONLY,
+		D3DFMT_INDEX16,
+		D3DPOOL_MANAGED,
+		&_chunkIB,
+		0);
+
+	if(FAILED(hr))
+		return false;
+
+	WORD* indices = 0;
+	_chunkIB->Lock(0, 0, (void**)&indices, 0);
+
+	int baseIndex = 0;
+	for(int i = 0; i < chunkCells; i++)
+	{
+		for(int j = 0; j < chunkCells; j++)
+		{
+			indices[baseIndex]     =   i   * chunkVerts + j;
+			indices[baseIndex + 1] =   i   * chunkVerts + j + 1;
+			indices[baseIndex + 2] = (i+1) * chunkVerts + j;
+
+			indices[baseIndex + 3] = (i+1) * chunkVerts + j;
+			indices[baseIndex + 4] =   i   * chunkVerts + j + 1;
+			indices[baseIndex + 5] = (i+1) * chunkVerts + j + 1;
+
+			baseIndex += 6;
+		}
+	}
+
+	_chunkIB->Unlock();
+
+	//
+	// Per chunk heights and normals.  Chunks hanging over the far edges of the
+	// terrain repeat the last row/column; the shader clamps their grid
+	// coordinates too, so the padding collapses into degenerate triangles.
+	//
+
+	hr = _device->CreateVertexBuffer(
+		numChunks * vertsInChunk * sizeof(CompactTerrainVertex),
+		D3DUSAGE_WRITEONLY,
+		0,
+		D3DPOOL_MANAGED,
+		&_compactVB,
+		0);
+
+	if(FAILED(hr))
+		return false;
+
+	CompactTerrainVertex* v = 0;
+	_compactVB->Lock(0, 0, (void**)&v, 0);
+
+	for(int cr = 0; cr < _numChunksPerCol; cr++)
+	{
+		for(int cc = 0; cc < _numChunksPerRow; cc++)
+		{
+			for(int i = 0; i < chunkVerts; i++)
+			{
+				int row = cr * chunkCells + i;
+				if( row > _numCellsPerCol )
+					row = _numCellsPerCol;
+
+				for(int j = 0; j < chunkVerts; j++)
+				{
+					int col = cc * chunkCells + j;
+					if( col > _numCellsPerRow )
+						col = _numCellsPerRow;
+
+					int index = row * _numVertsPerRow + col;
+
+					v->_y = (float)_heightmap[index];
+					OctEncode(_normals[index], &v->_octX, &v->_octY);
+					v++;
+				}
+			}
+		}
+	}
+
+	_compactVB->Unlock();
+
+	hr = _device->CreateVertexDeclaration(CompactTerrainVertex::Decl, &_compactDecl);
+
+	if(FAILED(hr))
+		return false;
+
+	//
+	// Effect that decodes the compact format.
+	//
+
+	ID3DXBuffer* errorBuffer = 0;
+	hr = D3DXCreateEffectFromFile(
+		_device,
+		"terrainCompact.txt",
+		0,                // no preprocessor definitions
+		0,                // no ID3DXInclude interface
+		D3DXSHADER_DEBUG, // compile flags
+		0,                // don't share parameters
+		&_compactFX,
+		&errorBuffer);
+
+	// output any error messages
+	if( errorBuffer )
+	{
+		::MessageBox(0, (char*)errorBuffer->GetBufferPointer(), 0, 0);
+		d3d::Release<ID3DXBuffer*>(errorBuffer);
+	}
+
+	if(FAILED(hr))
+		return false;
+
+	return true;
+}
+
+bool Terrain::drawCompact(D3DXMATRIX* world, D3DXMATRIX* viewProj, D3DXVECTOR3* eyePos,
+						  D3DXVECTOR3* directionToLight)
+{
+	HRESULT hr = 0;
+
+	if( !_device || !_compactFX )
+		return false;
+
+	int chunkVerts   = _chunkCells + 1;
+	int vertsInChunk = chunkVerts * chunkVerts;
+
+	D3DXVECTOR4 gridToWorld(-(float)(_width / 2), (float)(_depth / 2), (float)_cellSpacing, 0.0f);
+	D3DXVECTOR4 gridToTex(
+		1.0f / (float)_numCellsPerRow, 1.0f / (float)_numCellsPerCol,
+		(float)_numCellsPerRow, (float)_numCellsPerCol);
+	D3DXVECTOR4 eye(eyePos->x, eyePos->y, eyePos->z, 1.0f);
+	D3DXVECTOR4 light(directionToLight->x, directionToLight->y, directionToLight->z, 0.0f);
+
+	_compactFX->SetTechnique("CompactTerrain");
+	_compactFX->SetMatrix("World", world);
+	_compactFX->SetMatrix("ViewProj", viewProj);
+	_compactFX->SetVector("GridToWorld", &gridToWorld);
+	_compactFX->SetVector("GridToTex", &gridToTex);
+	_compactFX->SetVector("EyePos", &eye);
+	_compactFX->SetVector("DirToLight", &light);
+	_compactFX->SetTexture("Tex", _tex);
+
+	_device->SetVertexDeclaration(_compactDecl);
+	_device->SetStreamSource(0, _gridVB, 0, sizeof(GridVertex));
+	_device->SetIndices(_chunkIB);
+
+	UINT numPasses = 0;
+	_compactFX->Begin(&numPasses, 0);
+
+	for(int p = 0; p < numPasses; p++)
+	{
+		_compactFX->BeginPass(p);
+
+		for(int cr = 0; cr < _numChunksPerCol; cr++)
+		{
+			for(int cc = 0; cc < _numChunksPerRow; cc++)
+			{
+				int chunk = cr * _numChunksPerRow + cc;
+
+				D3DXVECTOR4 offset((float)(cc * _chunkCells), (float)(cr * _chunkCells), 0.0f, 0.0f);
+				_compactFX->SetVector("ChunkOffset", &offset);
+				_compactFX->CommitChanges();
+
+				_device->SetStreamSource(
+					1,
+					_compactVB,
+					chunk * vertsInChunk * sizeof(CompactTerrainVertex),
+					sizeof(CompactTerrainVertex));
+
+				hr = _device->DrawIndexedPrimitive(
+					D3DPT_TRIANGLELIST,
+					0,
+					0,
+					vertsInChunk,
+					0,
+					_chunkCells * _chunkCells * 2);
+			}
+		}
+
+		_compactFX->EndPass();
+	}
+
+	_compactFX->End();
+
+	// leave stream 1 unbound for the FVF based draws
+	_device->SetStreamSource(1, 0, 0, 0);
+
+	if(FAILED(hr))
+		return false;
+
+	return true;
+}
+
 bool Terrain::loadTexture(std::string fileName)
 {
 	HRESULT hr = 0;
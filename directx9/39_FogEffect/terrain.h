@@ -14,12 +14,15 @@
 #define __terrainH__
 
 #include "d3dUtility.h"
+#include "terrainTin.h"
 #include <string>
 #include <vector>
 
 class Terrain
 {
 public:
+	// device may be 0 for the heightmap alone: getHeight() and
+	// getHeightmapEntry() work, nothing else does.
 	Terrain(
 		IDirect3DDevice9* device,
 		std::string heightmapFileName, 
@@ -39,6 +42,19 @@ public:
 	bool  genTexture(D3DXVECTOR3* directionToLight);
 	bool  draw(D3DXMATRIX* world, bool drawTris);
 
+	// Replaces the regular grid with an adaptive TIN that stays within
+	// maxError (in world units) of the heightmap.  tileCells controls the
+	// granularity of the per-tile multithreaded build.
+	bool  simplify(float maxError, int tileCells, TinStats* stats);
+
+	// Builds the compact vertex format (see CompactTerrainVertex) in chunks of
+	// chunkCells x chunkCells cells, and loads the effect that decodes it.
+	bool  buildCompact(int chunkCells);
+	bool  drawCompact(D3DXMATRIX* world, D3DXMATRIX* viewProj, D3DXVECTOR3* eyePos,
+		D3DXVECTOR3* directionToLight);
+
+	const D3DXVECTOR3& getNormal(int row, int col);
+
 private:
 	IDirect3DDevice9*       _device;
 	IDirect3DTexture9*      _tex;
@@ -58,27 +74,65 @@ private:
 
 	float _heightScale;
 
-	std::vector<int> _heightmap;
+	std::vector<int>         _heightmap;
+	std::vector<D3DXVECTOR3> _normals;
+
+	// compact format
+	IDirect3DVertexBuffer9*      _gridVB;    // shared (col, row) stream of one chunk
+	IDirect3DIndexBuffer9*       _chunkIB;   // shared index list of one chunk
+	IDirect3DVertexBuffer9*      _compactVB; // per vertex heights and normals, chunk by chunk
+	IDirect3DVertexDeclaration9* _compactDecl;
+	ID3DXEffect*                 _compactFX;
+	int _chunkCells;
+	int _numChunksPerRow;
+	int _numChunksPerCol;
 
 	// helper methods
 	bool  readRawFile(std::string fileName);
+	bool  computeNormals();
+	void  computeNormalRows(int firstRow, int lastRow);
+	D3DXVECTOR3 sobelNormal(int row, int col);
 	bool  computeVertices();
 	bool  computeIndices();
+	bool  createTinBuffers(const TinBuilder& tin);
 	bool  lightTerrain(D3DXVECTOR3* directionToLight);
 	float computeShade(int cellRow, int cellCol, D3DXVECTOR3* directionToLight);
 
 	struct TerrainVertex
 	{
 		TerrainVertex(){}
-		TerrainVertex(float x, float y, float z, float u, float v)
+		TerrainVertex(float x, float y, float z, 
+			float nx, float ny, float nz,
+			float u, float v)
 		{
-			_x = x; _y = y; _z = z; _u = u; _v = v;
+			_x  = x;  _y  = y;  _z  = z;
+			_nx = nx; _ny = ny; _nz = nz;
+			_u  = u;  _v  = v;
 		}
 		float _x, _y, _z;
+		float _nx, _ny, _nz;
 		float _u, _v;
 
 		static const DWORD FVF;
 	};
+
+	// 8 bytes instead of the 32 of TerrainVertex.  x and z are implied by the
+	// grid: they come from the shared (col, row) stream plus the chunk offset,
+	// and the texture coordinates are derived from them in the vertex shader.
+	struct CompactTerrainVertex
+	{
+		float _y;
+		short _octX, _octY; // octahedral encoded normal, SHORT2N
+
+		static const D3DVERTEXELEMENT9 Decl[];
+	};
+
+	struct GridVertex
+	{
+		short _col, _row;
+	};
+
+	TerrainVertex gridVertex(int row, int col);
 };
 
 #endif // __terrainH__
@@ -0,0 +1,739 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: terrainStream.cpp
+//
+// Desc: Out-of-core terrain.  See terrainStream.h.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "terrainStream.h"
+#include <algorithm>
+#include <cmath>
+
+const DWORD TerrainStreamer::StreamVertex::FVF = D3DFVF_XYZ | D3DFVF_NORMAL;
+
+namespace
+{
+	const DWORD TileFileVersion = 1;
+}
+
+StreamStats::StreamStats()
+{
+	frames        = 0;
+	requests      = 0;
+	loads         = 0;
+	evictions     = 0;
+	misses        = 0;
+	resident      = 0;
+	residentBytes = 0;
+	peakBytes     = 0;
+	loadMs        = 0.0f;
+}
+
+TerrainStreamer::TerrainStreamer(IDirect3DDevice9* device)
+{
+	_device          = device;
+	_ib              = 0;
+	_samplesPerSide  = 0;
+	_startX          = 0.0f;
+	_startZ          = 0.0f;
+	_tileSize        = 0.0f;
+	_budget          = 0;
+	_loadRadius      = 150.0f;
+	_prefetchSeconds = 1.0f;
+	_inFlight        = -1;
+	_quit            = false;
+
+	::ZeroMemory(&_header, sizeof(_header));
+}
+
+TerrainStreamer::~TerrainStreamer()
+{
+	close();
+}
+
+bool TerrainStreamer::ConvertRawFile(
+	std::string rawFileName,
+	int numVertsPerRow,
+	int numVertsPerCol,
+	float cellSpacing,
+	float heightScale,
+	int tileCells,
+	std::string tileFileName)
+{
+	std::ifstream in(rawFileName.c_str(), std::ios_base::binary);
+	if( !in.is_open() )
+		return false;
+
+	std::ofstream out(tileFileName.c_str(), std::ios_base::binary);
+	if( !out.is_open() )
+		return false;
+
+	TileFileHeader header;
+	header.magic[0] = 'T'; header.magic[1] = 'T'; header.magic[2] = 'I'; header.magic[3] = 'L';
+	header.version        = TileFileVersion;
+	header.tileCells      = tileCells;
+	header.numTilesX      = (numVertsPerRow - 1 + tileCells - 1) / tileCells;
+	header.numTilesZ      = (numVertsPerCol - 1 + tileCells - 1) / tileCells;
+	header.numVertsPerRow = numVertsPerRow;
+	header.numVertsPerCol = numVertsPerCol;
+	header.cellSpacing    = cellSpacing;
+	header.heightScale    = heightScale;
+
+	out.write((const char*)&header, sizeof(header));
+
+	int side = tileCells + 3;
+
+	// One band of source rows per row of tiles: tileCells + 1 rows plus the apron.
+	std::vector<BYTE> band(side * numVertsPerRow);
+	std::vector<WORD> tile(side * side);
+
+	for(int tz = 0; tz < (int)header.numTilesZ; tz++)
+	{
+		for(int i = 0; i < side; i++)
+		{
+			int row = tz * tileCells - 1 + i;
+			row = row < 0 ? 0 : (row > numVertsPerCol - 1 ? numVertsPerCol - 1 : row);
+
+			in.seekg((std::streamoff)row * numVertsPerRow);
+			in.read((char*)&band[i * numVertsPerRow], numVertsPerRow);
+		}
+
+		if( in.fail() )
+			return false;
+
+		for(int tx = 0; tx < (int)header.numTilesX; tx++)
+		{
+			for(int i = 0; i < side; i++)
+			{
+				for(int j = 0; j < side; j++)
+				{
+					int col = tx * tileCells - 1 + j;
+					col = col < 0 ? 0 : (col > numVertsPerRow - 1 ? numVertsPerRow - 1 : col);
+
+					tile[i * side + j] = band[i * numVertsPerRow + col];
+				}
+			}
+
+			out.write((const char*)&tile[0], tile.size() * sizeof(WORD));
+		}
+	}
+
+	return !out.fail();
+}
+
+bool TerrainStreamer::IsTileFileCurrent(
+	std::string rawFileName,
+	int numVertsPerRow,
+	int numVertsPerCol,
+	float cellSpacing,
+	float heightScale,
+	int tileCells,
+	std::string tileFileName)
+{
+	WIN32_FILE_ATTRIBUTE_DATA raw, tiles;
+	if( !::GetFileAttributesEx(rawFileName.c_str(), GetFileExInfoStandard, &raw) ||
+		!::GetFileAttributesEx(tileFileName.c_str(), GetFileExInfoStandard, &tiles) )
+		return false;
+
+	if( ::CompareFileTime(&tiles.ftLastWriteTime, &raw.ftLastWriteTime) < 0 )
+		return false;
+
+	std::ifstream in(tileFileName.c_str(), std::ios_base::binary);
+	TileFileHeader header;
+	in.read((char*)&header, sizeof(header));
+	if( in.fail() || ::memcmp(header.magic, "TTIL", 4) != 0 || header.version != TileFileVersion )
+		return false;
+
+	if( header.tileCells      != (DWORD)tileCells      ||
+		header.numVertsPerRow != (DWORD)numVertsPerRow ||
+		header.numVertsPerCol != (DWORD)numVertsPerCol ||
+		header.cellSpacing    != cellSpacing           ||
+		header.heightScale    != heightScale )
+		return false;
+
+	// a conversion that failed part way leaves the file short
+	ULONGLONG numTiles = (ULONGLONG)((numVertsPerRow - 1 + tileCells - 1) / tileCells) *
+		((numVertsPerCol - 1 + tileCells - 1) / tileCells);
+	ULONGLONG side = tileCells + 3;
+	ULONGLONG size = ((ULONGLONG)tiles.nFileSizeHigh << 32) | tiles.nFileSizeLow;
+	return size == sizeof(header) + numTiles * side * side * sizeof(WORD);
+}
+
+bool TerrainStreamer::open(std::string tileFileName, size_t memoryBudget)
+{
+	close();
+
+	std::ifstream file(tileFileName.c_str(), std::ios_base::binary);
+	if( !file.is_open() )
+		return false;
+
+	file.read((char*)&_header, sizeof(_header));
+	if( file.fail() || ::memcmp(_header.magic, "TTIL", 4) != 0 || _header.version != TileFileVersion )
+		return false;
+
+	// the shared tile index list is 16 bit
+	if( (_header.tileCells + 1) * (_header.tileCells + 1) > 0x10000 )
+		return false;
+
+	_fileName       = tileFileName;
+	_budget         = memoryBudget;
+	_samplesPerSide = _header.tileCells + 3;
+	_tileSize       = _header.tileCells * _header.cellSpacing;
+
+	// centered on the origin like Terrain
+	_startX = -(float)(_header.numVertsPerRow - 1) * _header.cellSpacing * 0.5f;
+	_startZ =  (float)(_header.numVertsPerCol - 1) * _header.cellSpacing * 0.5f;
+
+	_stats = StreamStats();
+
+	//
+	// Index list shared by every tile, same layout as Terrain::computeIndices.
+	//
+
+	if( _device )
+	{
+		int cells = _header.tileCells;
+		int verts = cells + 1;
+
+		HRESULT hr = _device->CreateIndexBuffer(
+			cells * cells * 6 * sizeof(WORD),
+			D3DUSAGE_WRITEONLY,
+			D3DFMT_INDEX16,
+			D3DPOOL_MANAGED,
+			&_ib,
+			0);
+
+		if(FAILED(hr))
+			return false;
+
+		WORD* indices = 0;
+		_ib->Lock(0, 0, (void**)&indices, 0);
+
+		int baseIndex = 0;
+		for(int i = 0; i < cells; i++)
+		{
+			for(int j = 0; j < cells; j++)
+			{
+				indices[baseIndex]     =   i   * verts + j;
+				indices[baseIndex + 1] =   i   * verts + j + 1;
+				indices[baseIndex + 2] = (i+1) * verts + j;
+
+				indices[baseIndex + 3] = (i+1) * verts + j;
+				indices[baseIndex + 4] =   i   * verts + j + 1;
+				indices[baseIndex + 5] = (i+1) * verts + j + 1;
+
+				baseIndex += 6;
+			}
+		}
+
+		_ib->Unlock();
+	}
+
+	_quit     = false;
+	_inFlight = -1;
+	_ioThread = std::thread(&TerrainStreamer::ioThreadMain, this);
+
+	return true;
+}
+
+void TerrainStreamer::close()
+{
+	if( _ioThread.joinable() )
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_quit = true;
+			_pending.clear();
+		}
+		_wake.notify_one();
+		_ioThread.join();
+	}
+
+	for(int i = 0; i < (int)_completed.size(); i++)
+		delete _completed[i];
+	_completed.clear();
+
+	while( !_tiles.empty() )
+		evictTile(_tiles.begin()->second);
+
+	_lru.clear();
+	_required.clear();
+
+	d3d::Release<IDirect3DIndexBuffer9*>(_ib);
+	_ib = 0;
+}
+
+void TerrainStreamer::setRadius(float loadRadius, float prefetchSeconds)
+{
+	_loadRadius      = loadRadius;
+	_prefetchSeconds = prefetchSeconds;
+}
+
+StreamStats TerrainStreamer::getStats() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _stats;
+}
+
+void TerrainStreamer::ioThreadMain()
+{
+	// The I/O thread owns its own file handle so it never contends with the
+	// main thread for anything but the two queues.
+	std::ifstream file(_fileName.c_str(), std::ios_base::binary);
+
+	for(;;)
+	{
+		int key = -1;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			while( !_quit && _pending.empty() )
+				_wake.wait(lock);
+
+			if( _quit )
+				break;
+
+			key = _pending.front();
+			_pending.pop_front();
+			_inFlight = key;
+		}
+
+		DWORD start = timeGetTime();
+		Tile* tile  = loadTile(file, key);
+		float ms    = (float)(timeGetTime() - start);
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if( tile )
+				_completed.push_back(tile);
+			_inFlight = -1;
+			_stats.loadMs += ms;
+		}
+	}
+}
+
+TerrainStreamer::Tile* TerrainStreamer::loadTile(std::ifstream& file, int key)
+{
+	int samples = _samplesPerSide * _samplesPerSide;
+
+	std::vector<WORD> raw(samples);
+
+	file.clear();
+	file.seekg(sizeof(TileFileHeader) + (std::streamoff)key * samples * sizeof(WORD));
+	file.read((char*)&raw[0], samples * sizeof(WORD));
+
+	if( file.fail() )
+		return 0;
+
+	Tile* tile = new Tile;
+	tile->key = key;
+	tile->vb  = 0;
+	tile->heights.resize(samples);
+
+	for(int i = 0; i < samples; i++)
+		tile->heights[i] = (float)raw[i] * _header.heightScale;
+
+	tile->bytes = samples * sizeof(float);
+
+	return tile;
+}
+
+void TerrainStreamer::update(const D3DXVECTOR3& position, const D3DXVECTOR3& velocity)
+{
+	_stats.frames++;
+
+	//
+	// Take the tiles the I/O thread finished.
+	//
+
+	std::vector<Tile*> completed;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		completed.swap(_completed);
+	}
+
+	for(int i = 0; i < (int)completed.size(); i++)
+	{
+		if( _tiles.find(completed[i]->key) != _tiles.end() )
+			delete completed[i];
+		else
+			addTile(completed[i]);
+	}
+
+	//
+	// Work out what this frame needs and what it will need soon.
+	//
+
+	_required.clear();
+	gatherTiles(position, _required);
+
+	D3DXVECTOR3 ahead = position + velocity * _prefetchSeconds;
+	std::vector<int> prefetch;
+	gatherTiles(ahead, prefetch);
+
+	// mark the required tiles as most recently used
+	for(int i = 0; i < (int)_required.size(); i++)
+	{
+		std::map<int, Tile*>::iterator it = _tiles.find(_required[i]);
+		if( it == _tiles.end() )
+		{
+			_stats.misses++;
+			continue;
+		}
+
+		_lru.erase(it->second->lru);
+		_lru.push_front(it->first);
+		it->second->lru = _lru.begin();
+	}
+
+	//
+	// Queue the missing tiles, nearest first, then the prefetch set.  The
+	// queue is rebuilt every frame so tiles the camera turned away from are
+	// dropped before they are read.
+	//
+
+	std::vector<std::pair<float, int> > order;
+	for(int i = 0; i < (int)_required.size(); i++)
+		order.push_back(std::make_pair(tileDistance(_required[i], position), _required[i]));
+	std::sort(order.begin(), order.end());
+
+	std::vector<std::pair<float, int> > later;
+	for(int i = 0; i < (int)prefetch.size(); i++)
+	{
+		if( std::find(_required.begin(), _required.end(), prefetch[i]) == _required.end() )
+			later.push_back(std::make_pair(tileDistance(prefetch[i], ahead), prefetch[i]));
+	}
+	std::sort(later.begin(), later.end());
+	order.insert(order.end(), later.begin(), later.end());
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		std::deque<int> pending;
+		for(int i = 0; i < (int)order.size(); i++)
+		{
+			int key = order[i].second;
+			if( key == _inFlight || _tiles.find(key) != _tiles.end() )
+				continue;
+
+			if( std::find(_pending.begin(), _pending.end(), key) == _pending.end() )
+				_stats.requests++;
+
+			pending.push_back(key);
+		}
+		_pending.swap(pending);
+	}
+	_wake.notify_one();
+
+	makeRoom(0);
+}
+
+void TerrainStreamer::addTile(Tile* tile)
+{
+	if( _device )
+		createTileBuffer(tile);
+
+	// room first, so the budget is only passed when the tiles the frame
+	// needs do not fit in it
+	makeRoom(tile->bytes);
+
+	_lru.push_front(tile->key);
+	tile->lru = _lru.begin();
+	_tiles[tile->key] = tile;
+
+	_stats.loads++;
+	_stats.resident++;
+	_stats.residentBytes += tile->bytes;
+	if( _stats.residentBytes > _stats.peakBytes )
+		_stats.peakBytes = _stats.residentBytes;
+}
+
+void TerrainStreamer::makeRoom(size_t bytes)
+{
+	//
+	// Evict least recently used tiles until bytes more fit in the budget.
+	// Tiles the current frame needs are never evicted, even if that means
+	// going over.
+	//
+
+	while( _stats.residentBytes + bytes > _budget && !_lru.empty() )
+	{
+		int key = _lru.back();
+		if( std::find(_required.begin(), _required.end(), key) != _required.end() )
+			break;
+
+		evictTile(_tiles[key]);
+		_stats.evictions++;
+	}
+}
+
+void TerrainStreamer::evictTile(Tile* tile)
+{
+	_lru.erase(tile->lru);
+	_tiles.erase(tile->key);
+
+	_stats.resident--;
+	_stats.residentBytes -= tile->bytes;
+
+	d3d::Release<IDirect3DVertexBuffer9*>(tile->vb);
+	delete tile;
+}
+
+bool TerrainStreamer::createTileBuffer(Tile* tile)
+{
+	int cells = _header.tileCells;
+	int verts = cells + 1;
+	int side  = _samplesPerSide;
+
+	HRESULT hr = _device->CreateVertexBuffer(
+		verts * verts * sizeof(StreamVertex),
+		D3DUSAGE_WRITEONLY,
+		StreamVertex::FVF,
+		D3DPOOL_MANAGED,
+		&tile->vb,
+		0);
+
+	if(FAILED(hr))
+	{
+		tile->vb = 0;
+		return false;
+	}
+
+	int tx = tile->key % _header.numTilesX;
+	int tz = tile->key / _header.numTilesX;
+
+	int lastCol = _header.numVertsPerRow - 1;
+	int lastRow = _header.numVertsPerCol - 1;
+
+	StreamVertex* v = 0;
+	tile->vb->Lock(0, 0, (void**)&v, 0);
+
+	const std::vector<float>& h = tile->heights;
+
+	for(int i = 0; i < verts; i++)
+	{
+		// vertices past the edge of the world collapse onto it
+		int row = tz * cells + i;
+		if( row > lastRow )
+			row = lastRow;
+
+		for(int j = 0; j < verts; j++)
+		{
+			int col = tx * cells + j;
+			if( col > lastCol )
+				col = lastCol;
+
+			// sample (i, j) sits at (i + 1, j + 1) because of the apron
+			int s = (i + 1) * side + (j + 1);
+
+			StreamVertex& out = v[i * verts + j];
+			out._x = _startX + col * _header.cellSpacing;
+			out._y = h[s];
+			out._z = _startZ - row * _header.cellSpacing;
+
+			// central differences, rows run towards -z
+			D3DXVECTOR3 n(
+				h[s - 1] - h[s + 1],
+				2.0f * _header.cellSpacing,
+				h[s + side] - h[s - side]);
+			D3DXVec3Normalize(&n, &n);
+
+			out._nx = n.x;
+			out._ny = n.y;
+			out._nz = n.z;
+		}
+	}
+
+	tile->vb->Unlock();
+
+	tile->bytes += verts * verts * sizeof(StreamVertex);
+
+	return true;
+}
+
+void TerrainStreamer::gatherTiles(const D3DXVECTOR3& center, std::vector<int>& keys)
+{
+	// tile range covering the circle, then the exact rectangle distance test
+	float fx = (center.x - _startX) / _tileSize;
+	float fz = (_startZ - center.z) / _tileSize;
+	float fr = _loadRadius / _tileSize;
+
+	int tx0 = (int)::floorf(fx - fr), tx1 = (int)::floorf(fx + fr);
+	int tz0 = (int)::floorf(fz - fr), tz1 = (int)::floorf(fz + fr);
+
+	tx0 = tx0 < 0 ? 0 : tx0;
+	tz0 = tz0 < 0 ? 0 : tz0;
+	tx1 = tx1 > (int)_header.numTilesX - 1 ? (int)_header.numTilesX - 1 : tx1;
+	tz1 = tz1 > (int)_header.numTilesZ - 1 ? (int)_header.numTilesZ - 1 : tz1;
+
+	for(int tz = tz0; tz <= tz1; tz++)
+	{
+		for(int tx = tx0; tx <= tx1; tx++)
+		{
+			int key = tz * _header.numTilesX + tx;
+			if( tileDistance(key, center) <= _loadRadius )
+				keys.push_back(key);
+		}
+	}
+}
+
+float TerrainStreamer::tileDistance(int key, const D3DXVECTOR3& p)
+{
+	// distance on the xz plane from p to the tile's rectangle
+	int tx = key % _header.numTilesX;
+	int tz = key / _header.numTilesX;
+
+	float minX = _startX + tx * _tileSize;
+	float maxX = minX + _tileSize;
+	float maxZ = _startZ - tz * _tileSize;
+	float minZ = maxZ - _tileSize;
+
+	float dx = p.x < minX ? minX - p.x : (p.x > maxX ? p.x - maxX : 0.0f);
+	float dz = p.z < minZ ? minZ - p.z : (p.z > maxZ ? p.z - maxZ : 0.0f);
+
+	return ::sqrtf(dx * dx + dz * dz);
+}
+
+bool TerrainStreamer::getHeight(float x, float z, float* height)
+{
+	// grid coordinates relative to the world's top left corner
+	float col = (x - _startX) / _header.cellSpacing;
+	float row = (_startZ - z) / _header.cellSpacing;
+
+	if( col < 0.0f || row < 0.0f ||
+		col > (float)(_header.numVertsPerRow - 1) || row > (float)(_header.numVertsPerCol - 1) )
+		return false;
+
+	int cells = _header.tileCells;
+	int tx = (int)col / cells;
+	int tz = (int)row / cells;
+	if( tx >= (int)_header.numTilesX ) tx = _header.numTilesX - 1;
+	if( tz >= (int)_header.numTilesZ ) tz = _header.numTilesZ - 1;
+
+	std::map<int, Tile*>::iterator it = _tiles.find(tz * _header.numTilesX + tx);
+	if( it == _tiles.end() )
+		return false;
+
+	// cell inside the tile, same triangle split as Terrain::getHeight
+	float lc = col - tx * cells;
+	float lr = row - tz * cells;
+	int c = (int)::floorf(lc);
+	int r = (int)::floorf(lr);
+	if( c >= cells ) c = cells - 1;
+	if( r >= cells ) r = cells - 1;
+
+	float dx = lc - c;
+	float dz = lr - r;
+
+	const std::vector<float>& h = it->second->heights;
+	int side = _samplesPerSide;
+	int s = (r + 1) * side + (c + 1);
+
+	float A = h[s];
+	float B = h[s + 1];
+	float C = h[s + side];
+	float D = h[s + side + 1];
+
+	if( dz < 1.0f - dx )
+		*height = A + (B - A) * dx + (C - A) * dz;
+	else
+		*height = D + (C - D) * (1.0f - dx) + (B - D) * (1.0f - dz);
+
+	return true;
+}
+
+bool TerrainStreamer::isIdle()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _pending.empty() && _inFlight < 0 && _completed.empty();
+}
+
+bool TerrainStreamer::draw(D3DXMATRIX* world)
+{
+	HRESULT hr = 0;
+
+	if( !_device )
+		return false;
+
+	int verts = _header.tileCells + 1;
+
+	_device->SetTransform(D3DTS_WORLD, world);
+	_device->SetFVF(StreamVertex::FVF);
+	_device->SetIndices(_ib);
+	_device->SetTexture(0, 0);
+	_device->SetMaterial(&d3d::WHITE_MTRL);
+
+	for(std::map<int, Tile*>::iterator it = _tiles.begin(); it != _tiles.end(); ++it)
+	{
+		if( !it->second->vb )
+			continue;
+
+		_device->SetStreamSource(0, it->second->vb, 0, sizeof(StreamVertex));
+
+		hr = _device->DrawIndexedPrimitive(
+			D3DPT_TRIANGLELIST,
+			0,
+			0,
+			verts * verts,
+			0,
+			_header.tileCells * _header.tileCells * 2);
+
+		if(FAILED(hr))
+			return false;
+	}
+
+	return true;
+}
+
+bool SimulateStreamingPath(
+	std::string tileFileName,
+	size_t memoryBudget,
+	float loadRadius,
+	float prefetchSeconds,
+	const std::vector<D3DXVECTOR3>& waypoints,
+	float speed,
+	float dt,
+	StreamStats* stats)
+{
+	if( waypoints.size() < 2 )
+		return false;
+
+	TerrainStreamer streamer(0);
+	if( !streamer.open(tileFileName, memoryBudget) )
+		return false;
+
+	streamer.setRadius(loadRadius, prefetchSeconds);
+
+	D3DXVECTOR3 pos = waypoints[0];
+	for(int i = 1; i < (int)waypoints.size(); i++)
+	{
+		D3DXVECTOR3 leg = waypoints[i] - pos;
+		float length = D3DXVec3Length(&leg);
+		if( length <= 0.0f )
+			continue;
+
+		D3DXVECTOR3 velocity = leg * (speed / length);
+		int steps = (int)::ceilf(length / (speed * dt));
+
+		for(int s = 0; s < steps; s++)
+		{
+			DWORD frameStart = timeGetTime();
+
+			pos += velocity * dt;
+			streamer.update(pos, velocity);
+
+			// hold the frame rate so the I/O thread sees real time
+			DWORD elapsed = timeGetTime() - frameStart;
+			DWORD frameMs = (DWORD)(dt * 1000.0f);
+			if( elapsed < frameMs )
+				::Sleep(frameMs - elapsed);
+		}
+
+		pos = waypoints[i];
+	}
+
+	if( stats )
+		*stats = streamer.getStats();
+
+	return true;
+}
@@ -0,0 +1,181 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: terrainStream.h
+//
+// Desc: Out-of-core terrain.  The heightmap lives on disk as fixed size tiles;
+//       a background thread loads the tiles around the camera (plus the ones
+//       it is heading towards) into an LRU cache bounded by a memory budget.
+//       Works without a device, so it can be driven headlessly by a scripted
+//       camera path.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __terrainStreamH__
+#define __terrainStreamH__
+
+#include "d3dUtility.h"
+#include <string>
+#include <fstream>
+#include <vector>
+#include <list>
+#include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//
+// On-disk format: a TileFileHeader followed by numTilesX * numTilesZ tiles in
+// row major order.  Every tile holds (tileCells + 3)^2 WORD heights: its
+// (tileCells + 1)^2 vertices plus a one sample apron on each side so normals
+// can be computed without the neighbouring tiles.  Samples past the edge of
+// the world repeat the last row/column.
+//
+
+struct TileFileHeader
+{
+	char  magic[4];       // "TTIL"
+	DWORD version;
+	DWORD tileCells;      // cells along a tile side
+	DWORD numTilesX;
+	DWORD numTilesZ;
+	DWORD numVertsPerRow; // size of the whole world
+	DWORD numVertsPerCol;
+	float cellSpacing;
+	float heightScale;
+};
+
+struct StreamStats
+{
+	StreamStats();
+
+	int    frames;
+	int    requests;    // tiles queued for loading
+	int    loads;       // tiles loaded by the I/O thread
+	int    evictions;
+	int    misses;      // frames x tiles that were needed but not resident
+	int    resident;
+	size_t residentBytes;
+	size_t peakBytes;
+	float  loadMs;      // total time spent in the I/O thread
+};
+
+class TerrainStreamer
+{
+public:
+	TerrainStreamer(IDirect3DDevice9* device); // device can be 0 for headless use
+	~TerrainStreamer();
+
+	// Converts an 8 bit RAW heightmap (as read by Terrain) into the tiled
+	// format.  Only tileCells + 3 rows of the source are in memory at a time.
+	static bool ConvertRawFile(
+		std::string rawFileName,
+		int numVertsPerRow,
+		int numVertsPerCol,
+		float cellSpacing,
+		float heightScale,
+		int tileCells,
+		std::string tileFileName);
+
+	// Whether tileFileName already holds rawFileName converted with these
+	// parameters: written in full, and since the heightmap last changed.
+	static bool IsTileFileCurrent(
+		std::string rawFileName,
+		int numVertsPerRow,
+		int numVertsPerCol,
+		float cellSpacing,
+		float heightScale,
+		int tileCells,
+		std::string tileFileName);
+
+	bool open(std::string tileFileName, size_t memoryBudget);
+	void close();
+
+	// loadRadius: tiles closer than this to the camera must be resident.
+	// prefetchSeconds: also load the tiles around where the camera will be
+	// after this long at its current velocity.
+	void setRadius(float loadRadius, float prefetchSeconds);
+
+	// Call once per frame.
+	void update(const D3DXVECTOR3& position, const D3DXVECTOR3& velocity);
+
+	bool getHeight(float x, float z, float* height);
+	bool isIdle();
+	bool draw(D3DXMATRIX* world);
+
+	// A copy: the I/O thread adds to loadMs as it goes.
+	StreamStats getStats() const;
+
+private:
+	struct Tile
+	{
+		int key;
+		std::vector<float>      heights; // (tileCells + 3)^2, with apron
+		IDirect3DVertexBuffer9* vb;
+		size_t                  bytes;
+		std::list<int>::iterator lru;
+	};
+
+	struct StreamVertex
+	{
+		float _x, _y, _z;
+		float _nx, _ny, _nz;
+
+		static const DWORD FVF;
+	};
+
+	IDirect3DDevice9*      _device;
+	IDirect3DIndexBuffer9* _ib;
+
+	std::string    _fileName;
+	TileFileHeader _header;
+	int            _samplesPerSide; // tileCells + 3
+	float          _startX;
+	float          _startZ;
+	float          _tileSize;       // world units along a tile side
+	size_t         _budget;
+	float          _loadRadius;
+	float          _prefetchSeconds;
+
+	std::map<int, Tile*> _tiles;    // resident tiles by key
+	std::list<int>       _lru;      // front = most recently used
+	std::vector<int>     _required; // tiles the current frame needs
+
+	// shared with the I/O thread
+	std::thread             _ioThread;
+	mutable std::mutex      _mutex;
+	std::condition_variable _wake;
+	std::deque<int>         _pending;
+	std::vector<Tile*>      _completed;
+	int                     _inFlight;
+	bool                    _quit;
+
+	StreamStats _stats;
+
+	void  ioThreadMain();
+	Tile* loadTile(std::ifstream& file, int key);
+	void  addTile(Tile* tile);
+	void  makeRoom(size_t bytes);
+	void  evictTile(Tile* tile);
+	bool  createTileBuffer(Tile* tile);
+	void  gatherTiles(const D3DXVECTOR3& center, std::vector<int>& keys);
+	float tileDistance(int key, const D3DXVECTOR3& p);
+};
+
+//
+// Headless driver: flies a camera along the waypoints at the given speed and
+// pumps the streamer every dt seconds in real time, so the I/O thread has to
+// keep up the way it would in the sample.
+//
+
+bool SimulateStreamingPath(
+	std::string tileFileName,
+	size_t memoryBudget,
+	float loadRadius,
+	float prefetchSeconds,
+	const std::vector<D3DXVECTOR3>& waypoints,
+	float speed,
+	float dt,
+	StreamStats* stats);
+
+#endif // __terrainStreamH__
@@ -0,0 +1,578 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: terrainTin.cpp
+//
+// Desc: Converts a regular heightmap grid into an adaptive triangulated irregular
+//       network (TIN).  See terrainTin.h.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "terrainTin.h"
+#include <queue>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cmath>
+
+TinStats::TinStats()
+{
+	numTiles      = 0;
+	gridTriangles = 0;
+	tinTriangles  = 0;
+	tinVertices   = 0;
+	reduction     = 1.0f;
+	maxError      = 0.0f;
+	buildMs       = 0.0f;
+}
+
+namespace
+{
+	// Incremental Delaunay triangulation of one tile.  Points live on the
+	// integer grid in tile local coordinates, so the orientation and in-circle
+	// predicates are exact in 64 bit integers.
+	class TileTriangulator
+	{
+	public:
+		TileTriangulator(const std::vector<int>& heightmap, int numVertsPerRow,
+			int r0, int c0, int r1, int c1)
+			: _heightmap(heightmap), _numVertsPerRow(numVertsPerRow),
+			  _r0(r0), _c0(c0), _r1(r1), _c1(c1)
+		{
+			int a = addPoint(0, 0);
+			int b = addPoint(c1 - c0, 0);
+			int c = addPoint(c1 - c0, r1 - r0);
+			int d = addPoint(0, r1 - r0);
+
+			// two triangles (a, b, c) and (a, c, d) that share the diagonal
+			int t0 = newTri(a, b, c);
+			int t1 = newTri(a, c, d);
+			_tris[t0].n[2] = t1;
+			_tris[t1].n[0] = t0;
+		}
+
+		// Inserts a point that lies on the tile border.  Used for the border
+		// vertices chosen by the 1D pass.
+		void insertBorder(int x, int y)
+		{
+			for(int t = 0; t < (int)_tris.size(); t++)
+			{
+				if( locate(t, x, y) >= 0 )
+				{
+					insert(t, x, y);
+					return;
+				}
+			}
+		}
+
+		// Greedy insertion of the worst interior point until every point is
+		// within maxError of the surface.
+		void refine(float maxError)
+		{
+			for(int t = 0; t < (int)_tris.size(); t++)
+				scan(t);
+
+			while( !_heap.empty() )
+			{
+				Candidate top = _heap.top();
+				_heap.pop();
+
+				const Tri& tri = _tris[top.tri];
+				if( tri.stamp != top.stamp )
+					continue; // stale
+
+				if( top.error <= maxError )
+					break;
+
+				_touched.clear();
+				insert(top.tri, tri.candX, tri.candY);
+
+				std::sort(_touched.begin(), _touched.end());
+				_touched.erase(std::unique(_touched.begin(), _touched.end()), _touched.end());
+				for(int i = 0; i < (int)_touched.size(); i++)
+					scan(_touched[i]);
+			}
+		}
+
+		// Appends the triangles as heightmap indices.
+		void emit(std::vector<int>& out) const
+		{
+			for(int t = 0; t < (int)_tris.size(); t++)
+			{
+				for(int k = 0; k < 3; k++)
+				{
+					const Point& p = _points[_tris[t].v[k]];
+					out.push_back((_r0 + p.y) * _numVertsPerRow + (_c0 + p.x));
+				}
+			}
+		}
+
+	private:
+		struct Point { int x, y; float h; };
+
+		// n[i] is the triangle across edge v[i] -> v[i+1], or -1 on the tile border.
+		struct Tri
+		{
+			int  v[3];
+			int  n[3];
+			int  stamp;
+			int  candX, candY;
+		};
+
+		struct Candidate
+		{
+			float error;
+			int   tri;
+			int   stamp;
+			bool operator<(const Candidate& rhs) const { return error < rhs.error; }
+		};
+
+		const std::vector<int>& _heightmap;
+		int _numVertsPerRow;
+		int _r0, _c0, _r1, _c1;
+
+		std::vector<Point>            _points;
+		std::vector<Tri>              _tris;
+		std::vector<int>              _touched;
+		std::vector<int>              _stack;
+		std::priority_queue<Candidate> _heap;
+
+		float height(int x, int y) const
+		{
+			return (float)_heightmap[(_r0 + y) * _numVertsPerRow + (_c0 + x)];
+		}
+
+		int addPoint(int x, int y)
+		{
+			Point p = { x, y, height(x, y) };
+			_points.push_back(p);
+			return (int)_points.size() - 1;
+		}
+
+		int newTri(int a, int b, int c)
+		{
+			Tri t;
+			t.v[0] = a; t.v[1] = b; t.v[2] = c;
+			t.n[0] = t.n[1] = t.n[2] = -1;
+			t.stamp = 0;
+			t.candX = t.candY = -1;
+			_tris.push_back(t);
+			return (int)_tris.size() - 1;
+		}
+
+		void setTri(int t, int a, int b, int c, int na, int nb, int nc)
+		{
+			Tri& tri = _tris[t];
+			tri.v[0] = a;  tri.v[1] = b;  tri.v[2] = c;
+			tri.n[0] = na; tri.n[1] = nb; tri.n[2] = nc;
+			tri.stamp++;
+			_touched.push_back(t);
+		}
+
+		void replaceNeighbor(int t, int oldN, int newN)
+		{
+			if( t < 0 )
+				return;
+
+			for(int k = 0; k < 3; k++)
+			{
+				if( _tris[t].n[k] == oldN )
+				{
+					_tris[t].n[k] = newN;
+					return;
+				}
+			}
+		}
+
+		static long long orient(int ax, int ay, int bx, int by, int cx, int cy)
+		{
+			return (long long)(bx - ax) * (cy - ay) - (long long)(by - ay) * (cx - ax);
+		}
+
+		// > 0 if d lies strictly inside the circumcircle of the ccw triangle abc.
+		bool inCircle(int a, int b, int c, int d) const
+		{
+			const Point& pd = _points[d];
+			long long adx = _points[a].x - pd.x, ady = _points[a].y - pd.y;
+			long long bdx = _points[b].x - pd.x, bdy = _points[b].y - pd.y;
+			long long cdx = _points[c].x - pd.x, cdy = _points[c].y - pd.y;
+
+			long long ad = adx * adx + ady * ady;
+			long long bd = bdx * bdx + bdy * bdy;
+			long long cd = cdx * cdx + cdy * cdy;
+
+			long long det =
+				adx * (bdy * cd - bd * cdy) -
+				ady * (bdx * cd - bd * cdx) +
+				ad  * (bdx * cdy - bdy * cdx);
+
+			return det > 0;
+		}
+
+		// Returns 3 if (x, y) is strictly inside triangle t, the edge index if it
+		// lies on an edge, or -1 if it is outside or on a vertex.
+		int locate(int t, int x, int y) const
+		{
+			const Tri& tri = _tris[t];
+			int onEdge = -1;
+			for(int k = 0; k < 3; k++)
+			{
+				const Point& a = _points[tri.v[k]];
+				const Point& b = _points[tri.v[(k + 1) % 3]];
+				long long o = orient(a.x, a.y, b.x, b.y, x, y);
+				if( o < 0 )
+					return -1;
+				if( o == 0 )
+				{
+					if( onEdge >= 0 )
+						return -1; // on a vertex
+					onEdge = k;
+				}
+			}
+			return onEdge >= 0 ? onEdge : 3;
+		}
+
+		void insert(int t, int x, int y)
+		{
+			int where = locate(t, x, y);
+			if( where < 0 )
+				return;
+
+			int p = addPoint(x, y);
+
+			if( where == 3 )
+				splitTriangle(t, p);
+			else
+				splitEdge(t, where, p);
+
+			legalize();
+		}
+
+		void splitTriangle(int t, int p)
+		{
+			Tri old = _tris[t];
+			int a = old.v[0], b = old.v[1], c = old.v[2];
+
+			int t1 = newTri(b, c, p);
+			int t2 = newTri(c, a, p);
+
+			setTri(t,  a, b, p, old.n[0], t1, t2);
+			setTri(t1, b, c, p, old.n[1], t2, t);
+			setTri(t2, c, a, p, old.n[2], t,  t1);
+
+			replaceNeighbor(old.n[1], t, t1);
+			replaceNeighbor(old.n[2], t, t2);
+
+			_stack.push_back(t);
+			_stack.push_back(t1);
+			_stack.push_back(t2);
+		}
+
+		void splitEdge(int t, int e, int p)
+		{
+			// rotate so the split edge is v[0] -> v[1]: t = (a, b, c)
+			Tri old = _tris[t];
+			int a = old.v[e], b = old.v[(e + 1) % 3], c = old.v[(e + 2) % 3];
+			int nbc = old.n[(e + 1) % 3], nca = old.n[(e + 2) % 3];
+			int u = old.n[e];
+
+			int t1 = newTri(p, b, c);
+			setTri(t,  a, p, c, -1, t1, nca);
+			setTri(t1, p, b, c, -1, nbc, t);
+			replaceNeighbor(nbc, t, t1);
+
+			_stack.push_back(t);
+			_stack.push_back(t1);
+
+			if( u < 0 )
+				return; // border edge, only one side
+
+			// neighbour u = (b, a, d)
+			Tri oldU = _tris[u];
+			int k = 0;
+			while( oldU.v[k] != b )
+				k++;
+			int d = oldU.v[(k + 2) % 3];
+			int nad = oldU.n[(k + 1) % 3], ndb = oldU.n[(k + 2) % 3];
+
+			int u1 = newTri(p, a, d);
+			setTri(u,  b, p, d, t1, u1, ndb);
+			setTri(u1, p, a, d, t,  nad, u);
+			replaceNeighbor(nad, u, u1);
+
+			_tris[t].n[0]  = u1;
+			_tris[t1].n[0] = u;
+
+			_stack.push_back(u);
+			_stack.push_back(u1);
+		}
+
+		// Rotates the vertex order of t so that p becomes v[2].
+		void rotateApex(int t, int p)
+		{
+			Tri& tri = _tris[t];
+			while( tri.v[2] != p )
+			{
+				int v0 = tri.v[0], n0 = tri.n[0];
+				tri.v[0] = tri.v[1]; tri.n[0] = tri.n[1];
+				tri.v[1] = tri.v[2]; tri.n[1] = tri.n[2];
+				tri.v[2] = v0;       tri.n[2] = n0;
+			}
+		}
+
+		// Lawson flips.  Every triangle on the stack contains the new point;
+		// it is rotated to v[2] so the edge to test is v[0] -> v[1].
+		void legalize()
+		{
+			int p = (int)_points.size() - 1;
+			for(int i = 0; i < (int)_stack.size(); i++)
+				rotateApex(_stack[i], p);
+
+			while( !_stack.empty() )
+			{
+				int t = _stack.back();
+				_stack.pop_back();
+
+				Tri tri = _tris[t];
+				int u = tri.n[0];
+				if( u < 0 )
+					continue;
+
+				int a = tri.v[0], b = tri.v[1], p = tri.v[2];
+
+				Tri utri = _tris[u];
+				int k = 0;
+				while( utri.v[k] != b )
+					k++;
+				int d = utri.v[(k + 2) % 3];
+
+				if( !inCircle(a, b, p, d) )
+					continue;
+
+				int nad = utri.n[(k + 1) % 3];
+				int ndb = utri.n[(k + 2) % 3];
+
+				// flip edge ab to pd
+				setTri(t, a, d, p, nad, u, tri.n[2]);
+				setTri(u, d, b, p, ndb, tri.n[1], t);
+				replaceNeighbor(nad, u, t);
+				replaceNeighbor(tri.n[1], t, u);
+
+				_stack.push_back(t);
+				_stack.push_back(u);
+			}
+		}
+
+		// Finds the grid point inside t with the largest vertical error.  Points
+		// on the tile border are owned by the 1D border pass and are skipped.
+		void scan(int t)
+		{
+			Tri& tri = _tris[t];
+			const Point& a = _points[tri.v[0]];
+			const Point& b = _points[tri.v[1]];
+			const Point& c = _points[tri.v[2]];
+
+			long long area = orient(a.x, a.y, b.x, b.y, c.x, c.y);
+			if( area <= 0 )
+				return;
+
+			int minX = a.x < b.x ? (a.x < c.x ? a.x : c.x) : (b.x < c.x ? b.x : c.x);
+			int maxX = a.x > b.x ? (a.x > c.x ? a.x : c.x) : (b.x > c.x ? b.x : c.x);
+			int minY = a.y < b.y ? (a.y < c.y ? a.y : c.y) : (b.y < c.y ? b.y : c.y);
+			int maxY = a.y > b.y ? (a.y > c.y ? a.y : c.y) : (b.y > c.y ? b.y : c.y);
+
+			if( minX < 1 ) minX = 1;
+			if( minY < 1 ) minY = 1;
+			if( maxX > _c1 - _c0 - 1 ) maxX = _c1 - _c0 - 1;
+			if( maxY > _r1 - _r0 - 1 ) maxY = _r1 - _r0 - 1;
+
+			float invArea = 1.0f / (float)area;
+			float best = -1.0f;
+
+			for(int y = minY; y <= maxY; y++)
+			{
+				for(int x = minX; x <= maxX; x++)
+				{
+					long long w0 = orient(b.x, b.y, c.x, c.y, x, y);
+					long long w1 = orient(c.x, c.y, a.x, a.y, x, y);
+					long long w2 = orient(a.x, a.y, b.x, b.y, x, y);
+					if( w0 < 0 || w1 < 0 || w2 < 0 )
+						continue;
+
+					float z = ((float)w0 * a.h + (float)w1 * b.h + (float)w2 * c.h) * invArea;
+					float error = ::fabsf(height(x, y) - z);
+					if( error > best )
+					{
+						best = error;
+						tri.candX = x;
+						tri.candY = y;
+					}
+				}
+			}
+
+			if( best > 0.0f )
+			{
+				Candidate cand = { best, t, tri.stamp };
+				_heap.push(cand);
+			}
+		}
+	};
+}
+
+TinBuilder::TinBuilder(
+	const std::vector<int>& heightmap,
+	int numVertsPerRow,
+	int numVertsPerCol)
+	: _heightmap(heightmap)
+{
+	_numVertsPerRow = numVertsPerRow;
+	_numVertsPerCol = numVertsPerCol;
+	_maxError       = 0.0f;
+}
+
+bool TinBuilder::build(float maxError, int tileCells, int numThreads)
+{
+	if( tileCells < 1 || _numVertsPerRow < 2 || _numVertsPerCol < 2 ||
+		(int)_heightmap.size() < _numVertsPerRow * _numVertsPerCol )
+		return false;
+
+	DWORD startTime = timeGetTime();
+
+	_maxError = maxError;
+
+	//
+	// Split the grid into tiles.  Neighbouring tiles share their border row/column.
+	//
+
+	_tiles.clear();
+	for(int r = 0; r < _numVertsPerCol - 1; r += tileCells)
+	{
+		for(int c = 0; c < _numVertsPerRow - 1; c += tileCells)
+		{
+			Tile tile;
+			tile.r0 = r;
+			tile.c0 = c;
+			tile.r1 = r + tileCells < _numVertsPerCol - 1 ? r + tileCells : _numVertsPerCol - 1;
+			tile.c1 = c + tileCells < _numVertsPerRow - 1 ? c + tileCells : _numVertsPerRow - 1;
+			_tiles.push_back(tile);
+		}
+	}
+
+	//
+	// Simplify the tiles in parallel.
+	//
+
+	if( numThreads <= 0 )
+		numThreads = (int)std::thread::hardware_concurrency();
+	if( numThreads <= 0 )
+		numThreads = 1;
+	if( numThreads > (int)_tiles.size() )
+		numThreads = (int)_tiles.size();
+
+	std::atomic<int> nextTile(0);
+	std::vector<std::thread> workers;
+	for(int i = 0; i < numThreads; i++)
+	{
+		workers.push_back(std::thread([this, &nextTile]()
+		{
+			int t;
+			while( (t = nextTile++) < (int)_tiles.size() )
+				buildTile(_tiles[t]);
+		}));
+	}
+	for(int i = 0; i < (int)workers.size(); i++)
+		workers[i].join();
+
+	//
+	// Merge the tiles into one indexed mesh.
+	//
+
+	std::vector<int> remap(_numVertsPerRow * _numVertsPerCol, -1);
+	_vertices.clear();
+	_indices.clear();
+
+	for(int t = 0; t < (int)_tiles.size(); t++)
+	{
+		const std::vector<int>& tris = _tiles[t].triangles;
+		for(int i = 0; i < (int)tris.size(); i++)
+		{
+			int gridIndex = tris[i];
+			if( remap[gridIndex] < 0 )
+			{
+				remap[gridIndex] = (int)_vertices.size();
+				_vertices.push_back(gridIndex);
+			}
+			_indices.push_back((DWORD)remap[gridIndex]);
+		}
+	}
+
+	_stats = TinStats();
+	_stats.numTiles      = (int)_tiles.size();
+	_stats.gridTriangles = (_numVertsPerRow - 1) * (_numVertsPerCol - 1) * 2;
+	_stats.tinTriangles  = (int)_indices.size() / 3;
+	_stats.tinVertices   = (int)_vertices.size();
+	_stats.reduction     = (float)_stats.gridTriangles / (float)_stats.tinTriangles;
+	_stats.maxError      = maxError;
+	_stats.buildMs       = (float)(timeGetTime() - startTime);
+
+	_tiles.clear();
+
+	return true;
+}
+
+void TinBuilder::buildTile(Tile& tile)
+{
+	TileTriangulator tri(_heightmap, _numVertsPerRow, tile.r0, tile.c0, tile.r1, tile.c1);
+
+	// Border vertices.  Each border is walked in increasing heightmap order so
+	// the tile on the other side of it picks exactly the same vertices.
+	std::vector<int> keep;
+	int top    = tile.r0 * _numVertsPerRow;
+	int bottom = tile.r1 * _numVertsPerRow;
+	simplifyBorder(top + tile.c0,    top + tile.c1,    1, keep);
+	simplifyBorder(bottom + tile.c0, bottom + tile.c1, 1, keep);
+	simplifyBorder(top + tile.c0,    bottom + tile.c0, _numVertsPerRow, keep);
+	simplifyBorder(top + tile.c1,    bottom + tile.c1, _numVertsPerRow, keep);
+
+	for(int i = 0; i < (int)keep.size(); i++)
+	{
+		int row = keep[i] / _numVertsPerRow;
+		int col = keep[i] % _numVertsPerRow;
+		tri.insertBorder(col - tile.c0, row - tile.r0);
+	}
+
+	tri.refine(_maxError);
+
+	tile.triangles.clear();
+	tri.emit(tile.triangles);
+}
+
+void TinBuilder::simplifyBorder(int first, int last, int step, std::vector<int>& keep)
+{
+	// Douglas-Peucker on the height profile between two kept vertices.
+	int count = (last - first) / step;
+	if( count < 2 )
+		return;
+
+	float h0 = (float)_heightmap[first];
+	float h1 = (float)_heightmap[last];
+
+	float best = _maxError;
+	int   bestIndex = -1;
+	for(int i = 1; i < count; i++)
+	{
+		float z = h0 + (h1 - h0) * ((float)i / (float)count);
+		float error = ::fabsf((float)_heightmap[first + i * step] - z);
+		if( error > best )
+		{
+			best = error;
+			bestIndex = first + i * step;
+		}
+	}
+
+	if( bestIndex < 0 )
+		return;
+
+	keep.push_back(bestIndex);
+	simplifyBorder(first, bestIndex, step, keep);
+	simplifyBorder(bestIndex, last, step, keep);
+}
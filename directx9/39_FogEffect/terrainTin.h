@@ -0,0 +1,72 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: terrainTin.h
+//
+// Desc: Converts a regular heightmap grid into an adaptive triangulated irregular
+//       network (TIN).  Each tile is simplified independently by greedy insertion
+//       with Delaunay refinement until no grid point is further than a given
+//       vertical error from the surface.  Tile borders are simplified first with
+//       a 1D pass that both neighbouring tiles compute identically, so the tiles
+//       meet without cracks.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __terrainTinH__
+#define __terrainTinH__
+
+#include "d3dUtility.h"
+#include <vector>
+
+struct TinStats
+{
+	TinStats();
+
+	int   numTiles;
+	int   gridTriangles; // triangles in the regular grid
+	int   tinTriangles;  // triangles in the TIN
+	int   tinVertices;
+	float reduction;     // gridTriangles / tinTriangles
+	float maxError;      // requested vertical error bound
+	float buildMs;
+};
+
+class TinBuilder
+{
+public:
+	TinBuilder(
+		const std::vector<int>& heightmap, // row major, numVertsPerRow * numVertsPerCol
+		int numVertsPerRow,
+		int numVertsPerCol);
+
+	// Builds the TIN.  tileCells is the number of cells along a tile side and
+	// numThreads = 0 uses one thread per hardware thread.
+	bool build(float maxError, int tileCells, int numThreads);
+
+	// Vertices are returned as heightmap indices (row * numVertsPerRow + col)
+	// so the caller can generate whatever vertex format it draws with.
+	const std::vector<int>&   getVertices() const { return _vertices; }
+	const std::vector<DWORD>& getIndices()  const { return _indices; }
+	const TinStats&           getStats()    const { return _stats; }
+
+private:
+	struct Tile
+	{
+		int r0, c0, r1, c1;            // inclusive vertex range
+		std::vector<int> triangles;    // heightmap indices, 3 per triangle
+	};
+
+	const std::vector<int>& _heightmap;
+	int _numVertsPerRow;
+	int _numVertsPerCol;
+	float _maxError;
+
+	std::vector<Tile>  _tiles;
+	std::vector<int>   _vertices;
+	std::vector<DWORD> _indices;
+	TinStats           _stats;
+
+	void buildTile(Tile& tile);
+	void simplifyBorder(int first, int last, int step, std::vector<int>& keep);
+};
+
+#endif // __terrainTinH__
@@ -0,0 +1,442 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: meshAnalysis.cpp
+//
+// Desc: Mesh statistics for the MeshStats tool.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "meshAnalysis.h"
+#include "meshOptimizer.h"
+#include "vertexCompression.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+const MeshCacheModel MeshCacheModels[NumMeshCacheModels] =
+{
+	{ MeshCacheFifo,  8, "fifo8"  },
+	{ MeshCacheFifo, 16, "fifo16" },
+	{ MeshCacheFifo, 24, "fifo24" },
+	{ MeshCacheFifo, 32, "fifo32" },
+	{ MeshCacheLru,  16, "lru16"  },
+	{ MeshCacheLru,  32, "lru32"  }
+};
+
+namespace
+{
+	// A face thinner than this fraction of the bounding box diagonal has no
+	// area to speak of.
+	const float ZeroAreaTolerance = 1e-6f;
+
+	double Now()
+	{
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+	}
+
+	int ResolveThreads(int numThreads)
+	{
+		if( numThreads <= 0 )
+			numThreads = (int)std::thread::hardware_concurrency();
+		if( numThreads <= 0 )
+			numThreads = 1;
+		return numThreads;
+	}
+
+	// Calls body(begin, end) over [0, count) split into numThreads ranges,
+	// the first on the calling thread.
+	template<class Body> void ParallelFor(int count, int numThreads, Body body)
+	{
+		std::vector<std::thread> threads;
+		for(int t = 1; t < numThreads; t++)
+			threads.push_back(std::thread(body, count * t / numThreads, count * (t + 1) / numThreads));
+		body(0, count / numThreads);
+
+		for(int t = 0; t < (int)threads.size(); t++)
+			threads[t].join();
+	}
+
+	const D3DXVECTOR3& PositionOf(const void* vertices, int stride, DWORD index)
+	{
+		return *(const D3DXVECTOR3*)((const BYTE*)vertices + (size_t)index * stride);
+	}
+
+	// A face's corners turned so the lowest index comes first, which keeps
+	// the winding; face breaks ties so the earliest copy sorts first.
+	struct FaceKey
+	{
+		DWORD a, b, c;
+		DWORD face;
+
+		bool operator<(const FaceKey& other) const
+		{
+			if( a != other.a ) return a < other.a;
+			if( b != other.b ) return b < other.b;
+			if( c != other.c ) return c < other.c;
+			return face < other.face;
+		}
+
+		bool sameCorners(const FaceKey& other) const
+		{
+			return a == other.a && b == other.b && c == other.c;
+		}
+	};
+
+	FaceKey MakeFaceKey(DWORD i0, DWORD i1, DWORD i2, DWORD face)
+	{
+		FaceKey key;
+		if( i0 < i1 && i0 < i2 )      { key.a = i0; key.b = i1; key.c = i2; }
+		else if( i1 < i2 )            { key.a = i1; key.b = i2; key.c = i0; }
+		else                          { key.a = i2; key.b = i0; key.c = i1; }
+		key.face = face;
+		return key;
+	}
+
+	// What a thread counts over its range of faces.
+	struct FaceCounts
+	{
+		FaceCounts() : degenerate(0), zeroArea(0), area(0.0) {}
+
+		int    degenerate;
+		int    zeroArea;
+		double area;
+	};
+
+	float AnalyzeLru(const DWORD* indices, int numIndices, int numVertices, int cacheSize,
+		float* atvr)
+	{
+		std::vector<DWORD> cache;
+		cache.reserve(cacheSize);
+		std::vector<BYTE> used(numVertices, 0);
+
+		int misses = 0, numUsed = 0;
+		for(int i = 0; i < numIndices; i++)
+		{
+			DWORD v = indices[i];
+
+			int slot = 0;
+			while( slot < (int)cache.size() && cache[slot] != v )
+				slot++;
+
+			if( slot == (int)cache.size() )
+			{
+				misses++;
+				if( (int)cache.size() < cacheSize )
+					cache.push_back(v);
+				slot = (int)cache.size() - 1;
+			}
+
+			// to the front, the least recently used falling off the back
+			for( ; slot > 0; slot--)
+				cache[slot] = cache[slot - 1];
+			cache[0] = v;
+
+			if( !used[v] )
+			{
+				used[v] = 1;
+				numUsed++;
+			}
+		}
+
+		*atvr = numUsed > 0 ? (float)misses / numUsed : 0.0f;
+		return numIndices >= 3 ? (float)misses / (numIndices / 3) : 0.0f;
+	}
+
+	DWORD HashBytes(const BYTE* p, int size)
+	{
+		// FNV-1a
+		DWORD hash = 2166136261u;
+		for(int i = 0; i < size; i++)
+			hash = (hash ^ p[i]) * 16777619u;
+		return hash;
+	}
+}
+
+MeshAnalysis::MeshAnalysis()
+{
+	faces             = 0;
+	vertices          = 0;
+	usedVertices      = 0;
+	unusedVertices    = 0;
+	duplicateVertices = 0;
+	degenerateFaces   = 0;
+	zeroAreaFaces     = 0;
+	duplicateFaces    = 0;
+	flippedFaces      = 0;
+	attributes        = 0;
+	attributeRuns     = 0;
+	vertexRangeRatio  = 0.0f;
+	boxMin            = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+	boxMax            = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+	sphereCenter      = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+	sphereRadius      = 0.0f;
+	surfaceArea       = 0.0f;
+	acmrBest          = 0.0f;
+	overdraw          = 0.0f;
+	numThreads        = 0;
+	facesMs           = 0.0f;
+	vertexMs          = 0.0f;
+	cacheMs           = 0.0f;
+	overdrawMs        = 0.0f;
+	totalMs           = 0.0f;
+
+	memset(cache, 0, sizeof(cache));
+	memset(&memory, 0, sizeof(memory));
+}
+
+bool AnalyzeMesh(const void* vertices, int numVertices, int stride,
+	const DWORD* indices, int numFaces, const DWORD* attributes, int numThreads,
+	MeshAnalysis* result)
+{
+	*result = MeshAnalysis();
+	result->faces    = numFaces;
+	result->vertices = numVertices;
+
+	int numIndices = numFaces * 3;
+	for(int i = 0; i < numIndices; i++)
+		if( indices[i] >= (DWORD)numVertices )
+			return false;
+
+	numThreads = ResolveThreads(numThreads);
+	result->numThreads = numThreads;
+
+	double start = Now();
+
+	//
+	// bounds
+	//
+
+	if( numVertices > 0 )
+	{
+		result->boxMin = result->boxMax = PositionOf(vertices, stride, 0);
+		for(int i = 1; i < numVertices; i++)
+		{
+			D3DXVec3Minimize(&result->boxMin, &result->boxMin, &PositionOf(vertices, stride, i));
+			D3DXVec3Maximize(&result->boxMax, &result->boxMax, &PositionOf(vertices, stride, i));
+		}
+
+		result->sphereCenter = (result->boxMin + result->boxMax) * 0.5f;
+		float radius2 = 0.0f;
+		for(int i = 0; i < numVertices; i++)
+		{
+			D3DXVECTOR3 d = PositionOf(vertices, stride, i) - result->sphereCenter;
+			radius2 = std::max(radius2, D3DXVec3LengthSq(&d));
+		}
+		result->sphereRadius = sqrtf(radius2);
+	}
+
+	D3DXVECTOR3 diagonal = result->boxMax - result->boxMin;
+	float thinnest = ZeroAreaTolerance * D3DXVec3Length(&diagonal);
+
+	//
+	// faces: degenerate, zero area and area in parallel, then duplicates
+	// by sorting
+	//
+
+	std::vector<FaceKey>    keys(numFaces);
+	std::vector<FaceCounts> counts(numThreads);
+	std::vector<BYTE>       valid(numFaces);
+
+	ParallelFor(numThreads, numThreads, [&](int first, int last)
+	{
+		FaceCounts& local = counts[first];
+		int begin = (int)((long long)numFaces * first / numThreads);
+		int end   = (int)((long long)numFaces * last / numThreads);
+		for(int f = begin; f < end; f++)
+		{
+			DWORD i0 = indices[f * 3], i1 = indices[f * 3 + 1], i2 = indices[f * 3 + 2];
+			keys[f]  = MakeFaceKey(i0, i1, i2, (DWORD)f);
+			valid[f] = 0;
+
+			if( i0 == i1 || i1 == i2 || i2 == i0 )
+			{
+				local.degenerate++;
+				continue;
+			}
+			valid[f] = 1;
+
+			const D3DXVECTOR3& p0 = PositionOf(vertices, stride, i0);
+			const D3DXVECTOR3& p1 = PositionOf(vertices, stride, i1);
+			const D3DXVECTOR3& p2 = PositionOf(vertices, stride, i2);
+
+			D3DXVECTOR3 e0 = p1 - p0, e1 = p2 - p1, e2 = p0 - p2, n;
+			D3DXVec3Cross(&n, &e0, &e1);
+			float twiceArea = D3DXVec3Length(&n);
+			local.area += 0.5 * twiceArea;
+
+			// height over the longest edge
+			float longest = sqrtf(std::max(D3DXVec3LengthSq(&e0),
+				std::max(D3DXVec3LengthSq(&e1), D3DXVec3LengthSq(&e2))));
+			if( twiceArea <= thinnest * longest )
+				local.zeroArea++;
+		}
+	});
+
+	double area = 0.0;
+	for(int t = 0; t < numThreads; t++)
+	{
+		result->degenerateFaces += counts[t].degenerate;
+		result->zeroAreaFaces   += counts[t].zeroArea;
+		area                    += counts[t].area;
+	}
+	result->surfaceArea = (float)area;
+
+	// Degenerate faces drop out here: only they can repeat an index.
+	int numKeys = 0;
+	for(int f = 0; f < numFaces; f++)
+		if( valid[f] )
+			keys[numKeys++] = keys[f];
+	keys.resize(numKeys);
+	std::sort(keys.begin(), keys.end());
+
+	for(int k = 1; k < numKeys; k++)
+		if( keys[k].sameCorners(keys[k - 1]) )
+			result->duplicateFaces++;
+
+	for(int k = 0; k < numKeys; k++)
+	{
+		FaceKey flipped = MakeFaceKey(keys[k].a, keys[k].c, keys[k].b, 0);
+		std::vector<FaceKey>::const_iterator found = std::lower_bound(keys.begin(), keys.end(), flipped);
+		if( found != keys.end() && found->sameCorners(flipped) )
+			result->flippedFaces++;
+	}
+
+	result->facesMs = (float)(Now() - start);
+
+	//
+	// vertices: use, duplicates, and the attribute runs
+	//
+
+	double vertexStart = Now();
+
+	std::vector<int> lastRun(numVertices, -1);
+	int numRuns = 0;
+	double spanned = 0.0, fetched = 0.0;
+	for(int f = 0; f < numFaces; )
+	{
+		DWORD id = attributes ? attributes[f] : 0;
+		int end = f + 1;
+		while( end < numFaces && (attributes ? attributes[end] : 0) == id )
+			end++;
+
+		DWORD lo = 0xffffffff, hi = 0;
+		for(int i = f * 3; i < end * 3; i++)
+		{
+			DWORD v = indices[i];
+			lo = std::min(lo, v);
+			hi = std::max(hi, v);
+			if( lastRun[v] != numRuns )
+			{
+				lastRun[v] = numRuns;
+				fetched += 1.0;
+			}
+		}
+		spanned += (double)(hi - lo + 1);
+
+		numRuns++;
+		f = end;
+	}
+	result->attributeRuns    = numRuns;
+	result->vertexRangeRatio = fetched > 0.0 ? (float)(spanned / fetched) : 0.0f;
+
+	if( attributes )
+	{
+		std::vector<DWORD> ids(attributes, attributes + numFaces);
+		std::sort(ids.begin(), ids.end());
+		result->attributes = (int)(std::unique(ids.begin(), ids.end()) - ids.begin());
+	}
+	else
+		result->attributes = numFaces > 0 ? 1 : 0;
+
+	for(int v = 0; v < numVertices; v++)
+		if( lastRun[v] >= 0 )
+			result->usedVertices++;
+	result->unusedVertices = numVertices - result->usedVertices;
+	result->acmrBest = numFaces > 0 ? (float)result->usedVertices / numFaces : 0.0f;
+
+	// Hash each vertex's bytes in parallel, sort by hash, and compare the
+	// vertices within each run of equal hashes.
+	std::vector<unsigned long long> hashes(numVertices);
+	ParallelFor(numVertices, numThreads, [&](int begin, int end)
+	{
+		for(int v = begin; v < end; v++)
+		{
+			DWORD hash = HashBytes((const BYTE*)vertices + (size_t)v * stride, stride);
+			hashes[v] = ((unsigned long long)hash << 32) | (DWORD)v;
+		}
+	});
+	std::sort(hashes.begin(), hashes.end());
+
+	for(int begin = 0; begin < numVertices; )
+	{
+		int end = begin + 1;
+		while( end < numVertices && (hashes[end] >> 32) == (hashes[begin] >> 32) )
+			end++;
+
+		// a vertex is a duplicate if it matches an earlier one that is not
+		for(int i = begin + 1; i < end; i++)
+		{
+			const BYTE* p = (const BYTE*)vertices + (size_t)(hashes[i] & 0xffffffff) * stride;
+			for(int j = begin; j < i; j++)
+			{
+				const BYTE* q = (const BYTE*)vertices + (size_t)(hashes[j] & 0xffffffff) * stride;
+				if( memcmp(p, q, stride) == 0 )
+				{
+					result->duplicateVertices++;
+					break;
+				}
+			}
+		}
+		begin = end;
+	}
+
+	result->vertexMs = (float)(Now() - vertexStart);
+
+	//
+	// the cache models, one to a thread
+	//
+
+	double cacheStart = Now();
+
+	ParallelFor(NumMeshCacheModels, std::min(numThreads, NumMeshCacheModels), [&](int begin, int end)
+	{
+		for(int m = begin; m < end; m++)
+		{
+			const MeshCacheModel& model = MeshCacheModels[m];
+			MeshCacheModelResult& out = result->cache[m];
+			if( model.kind == MeshCacheFifo )
+				AnalyzeVertexCache(indices, numIndices, numVertices, model.size, &out.acmr, &out.atvr);
+			else
+				out.acmr = AnalyzeLru(indices, numIndices, numVertices, model.size, &out.atvr);
+		}
+	});
+
+	result->cacheMs = (float)(Now() - cacheStart);
+
+	double overdrawStart = Now();
+	result->overdraw   = AnalyzeOverdraw(vertices, numVertices, stride, indices, numIndices, numThreads);
+	result->overdrawMs = (float)(Now() - overdrawStart);
+
+	//
+	// memory
+	//
+
+	MeshStreamMemory& memory = result->memory;
+	memory.indexSize          = numVertices <= 0xffff ? 2 : 4;
+	memory.vertices           = numVertices * stride;
+	memory.compressedVertices = numVertices * GetCompressedVertexSize(CompressedVertexFormat());
+	memory.indices            = numIndices * memory.indexSize;
+	memory.attributes         = numFaces * (int)sizeof(DWORD);
+	memory.adjacency          = numFaces * 3 * (int)sizeof(DWORD);
+	memory.attributeTable     = numRuns * (int)sizeof(D3DXATTRIBUTERANGE);
+	memory.total = memory.vertices + memory.indices + memory.attributes
+		+ memory.adjacency + memory.attributeTable;
+
+	result->totalMs = (float)(Now() - start);
+	return true;
+}
@@ -0,0 +1,107 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: meshAnalysis.h
+//
+// Desc: Figures for judging how well a triangle list will draw, without a
+//       device: vertex cache misses under several cache models, overdraw,
+//       how the attributes fragment it into draw calls, its bounds, the
+//       degenerate and duplicate triangles and vertices it carries, and
+//       what each of its streams costs in memory.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __meshAnalysisH__
+#define __meshAnalysisH__
+
+#include "d3dUtility.h"
+
+enum MeshCacheModelKind
+{
+	MeshCacheFifo = 0,   // a vertex stays for cacheSize misses after its own
+	MeshCacheLru  = 1    // a hit moves a vertex back to the front
+};
+
+struct MeshCacheModel
+{
+	int         kind;    // MeshCacheModelKind
+	int         size;    // vertices
+	const char* name;
+};
+
+// FIFO caches of 8, 16, 24 and 32 vertices, the range the hardware this
+// code targets has shipped with, and LRU caches of 16 and 32.
+const int NumMeshCacheModels = 6;
+extern const MeshCacheModel MeshCacheModels[NumMeshCacheModels];
+
+struct MeshCacheModelResult
+{
+	float acmr;   // misses per triangle
+	float atvr;   // misses per vertex used
+};
+
+// Bytes each stream takes, or would take if the mesh were stored that way.
+struct MeshStreamMemory
+{
+	int indexSize;            // 2 when every vertex fits in a 16 bit index
+	int vertices;             // at the given stride
+	int compressedVertices;   // in vertexCompression.h's default format
+	int indices;
+	int attributes;           // a D3DX attribute buffer, a DWORD a face
+	int adjacency;            // three DWORDs a face
+	int attributeTable;       // a D3DXATTRIBUTERANGE a run of attributes
+	int total;                // the uncompressed streams together
+};
+
+struct MeshAnalysis
+{
+	MeshAnalysis();
+
+	int   faces;
+	int   vertices;
+	int   usedVertices;
+	int   unusedVertices;      // no index refers to them
+	int   duplicateVertices;   // the same bytes as an earlier vertex
+
+	int   degenerateFaces;     // two corners with the same index
+	int   zeroAreaFaces;       // three indices, but thinner than a millionth
+	                           // of the bounding box diagonal
+	int   duplicateFaces;      // the same corners, winding and all, as an
+	                           // earlier face
+	int   flippedFaces;        // faces whose corners also appear wound the
+	                           // other way, which draws both sides
+
+	int   attributes;          // distinct attribute ids
+	int   attributeRuns;       // runs of one id in face order: the draw calls
+	                           // it takes without sorting
+	float vertexRangeRatio;    // the vertex ranges the runs span over the
+	                           // vertices they use; 1.0 at best
+
+	D3DXVECTOR3 boxMin;
+	D3DXVECTOR3 boxMax;
+	D3DXVECTOR3 sphereCenter;  // the center of the box
+	float       sphereRadius;
+	float       surfaceArea;
+
+	float acmrBest;            // usedVertices / faces: each vertex missed once
+	MeshCacheModelResult cache[NumMeshCacheModels];
+	float overdraw;            // see AnalyzeOverdraw
+
+	MeshStreamMemory memory;
+
+	int   numThreads;
+	float facesMs;             // degenerate, duplicate and area checks
+	float vertexMs;            // duplicate vertices, attribute runs
+	float cacheMs;
+	float overdrawMs;
+	float totalMs;
+};
+
+// Analyzes numFaces triangles over numVertices vertices of stride bytes,
+// positions first.  attributes holds an id per face, or is null for a
+// single subset.  False if an index is out of range.  numThreads = 0 uses
+// one thread per hardware thread.
+bool AnalyzeMesh(const void* vertices, int numVertices, int stride,
+	const DWORD* indices, int numFaces, const DWORD* attributes, int numThreads,
+	MeshAnalysis* result);
+
+#endif // __meshAnalysisH__
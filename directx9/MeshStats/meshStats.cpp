@@ -0,0 +1,471 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: meshStats.cpp
+//
+// Desc: A console tool for the asset pipeline: loads .x files and mesh
+//       cache files without a device and writes what meshAnalysis.h
+//       measures about them as JSON.
+//
+//       Usage: MeshStats [-o file.json] [-threads n] [-source] mesh ...
+//
+//       A .x file is reported as authored, its meshes merged as
+//       D3DXLoadMeshFromX merges them ("source"), and as the mesh cache
+//       would store it, welded and optimized ("optimized"); -source skips
+//       the second.  A .mshc file is reported as it is ("cache"), with its
+//       levels of detail.  The JSON is built in memory and written in one
+//       go, to the -o file or to standard output.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "d3dUtility.h"
+#include "meshAnalysis.h"
+#include "meshCache.h"
+#include "meshOptimizer.h"
+#include "xfileParser.h"
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+namespace
+{
+	double Now()
+	{
+		LARGE_INTEGER count, frequency;
+		::QueryPerformanceCounter(&count);
+		::QueryPerformanceFrequency(&frequency);
+		return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+	}
+
+	//
+	// JSON written into a string.  Commas are placed as values follow one
+	// another within an object or array.
+	//
+
+	class JsonWriter
+	{
+	public:
+		JsonWriter() : _first(true), _depth(0) { _out.reserve(1 << 16); }
+
+		void beginObject(const char* key = 0) { open(key, '{'); }
+		void endObject()                      { close('}'); }
+		void beginArray(const char* key = 0)  { open(key, '['); }
+		void endArray()                       { close(']'); }
+
+		void value(const char* key, const char* s)
+		{
+			prefix(key);
+			quote(s);
+		}
+
+		void value(const char* key, int i)
+		{
+			char text[32];
+			sprintf(text, "%d", i);
+			prefix(key);
+			_out += text;
+		}
+
+		void value(const char* key, float f)
+		{
+			prefix(key);
+			number(f);
+		}
+
+		void value(const char* key, bool b)
+		{
+			prefix(key);
+			_out += b ? "true" : "false";
+		}
+
+		// on one line
+		void value(const char* key, const D3DXVECTOR3& v)
+		{
+			prefix(key);
+			_out += '[';
+			number(v.x);
+			_out += ", ";
+			number(v.y);
+			_out += ", ";
+			number(v.z);
+			_out += ']';
+		}
+
+		const std::string& getText() const { return _out; }
+
+	private:
+		std::string _out;
+		bool        _first;   // nothing written yet in the open object or array
+		int         _depth;
+
+		void prefix(const char* key)
+		{
+			if( !_first )
+				_out += ',';
+			_out += '\n';
+			_out.append(_depth, '\t');
+			if( key )
+			{
+				quote(key);
+				_out += ": ";
+			}
+			_first = false;
+		}
+
+		// JSON has no infinities or NaNs
+		void number(float f)
+		{
+			char text[32];
+			if( f != f || f > 3.4e38f || f < -3.4e38f )
+				strcpy(text, "null");
+			else
+				sprintf(text, "%.6g", f);
+			_out += text;
+		}
+
+		void open(const char* key, char bracket)
+		{
+			if( _depth > 0 )
+				prefix(key);
+			_out += bracket;
+			_first = true;
+			_depth++;
+		}
+
+		void close(char bracket)
+		{
+			_depth--;
+			if( !_first )
+			{
+				_out += '\n';
+				_out.append(_depth, '\t');
+			}
+			_out += bracket;
+			_first = false;
+		}
+
+		void quote(const char* s)
+		{
+			_out += '"';
+			for( ; *s; s++)
+			{
+				unsigned char c = (unsigned char)*s;
+				if( c == '"' || c == '\\' )
+				{
+					_out += '\\';
+					_out += (char)c;
+				}
+				else if( c < 0x20 )
+				{
+					char escape[8];
+					sprintf(escape, "\\u%04x", c);
+					_out += escape;
+				}
+				else
+					_out += (char)c;
+			}
+			_out += '"';
+		}
+	};
+
+	void WriteAnalysis(JsonWriter& json, const char* key, const MeshAnalysis& a)
+	{
+		json.beginObject(key);
+
+		json.value("faces",             a.faces);
+		json.value("vertices",          a.vertices);
+		json.value("usedVertices",      a.usedVertices);
+		json.value("unusedVertices",    a.unusedVertices);
+		json.value("duplicateVertices", a.duplicateVertices);
+		json.value("degenerateFaces",   a.degenerateFaces);
+		json.value("zeroAreaFaces",     a.zeroAreaFaces);
+		json.value("duplicateFaces",    a.duplicateFaces);
+		json.value("flippedFaces",      a.flippedFaces);
+
+		json.beginObject("attributes");
+		json.value("ids",              a.attributes);
+		json.value("runs",             a.attributeRuns);
+		json.value("vertexRangeRatio", a.vertexRangeRatio);
+		json.endObject();
+
+		json.beginObject("bounds");
+		json.value("min",          a.boxMin);
+		json.value("max",          a.boxMax);
+		json.value("sphereCenter", a.sphereCenter);
+		json.value("sphereRadius", a.sphereRadius);
+		json.value("surfaceArea",  a.surfaceArea);
+		json.endObject();
+
+		json.beginObject("vertexCache");
+		json.value("acmrBest", a.acmrBest);
+		for(int m = 0; m < NumMeshCacheModels; m++)
+		{
+			json.beginObject(MeshCacheModels[m].name);
+			json.value("acmr", a.cache[m].acmr);
+			json.value("atvr", a.cache[m].atvr);
+			json.endObject();
+		}
+		json.endObject();
+
+		json.value("overdraw", a.overdraw);
+
+		json.beginObject("memory");
+		json.value("indexSize",          a.memory.indexSize);
+		json.value("vertices",           a.memory.vertices);
+		json.value("compressedVertices", a.memory.compressedVertices);
+		json.value("indices",            a.memory.indices);
+		json.value("attributes",         a.memory.attributes);
+		json.value("adjacency",          a.memory.adjacency);
+		json.value("attributeTable",     a.memory.attributeTable);
+		json.value("total",              a.memory.total);
+		json.endObject();
+
+		json.beginObject("ms");
+		json.value("faces",    a.facesMs);
+		json.value("vertices", a.vertexMs);
+		json.value("cache",    a.cacheMs);
+		json.value("overdraw", a.overdrawMs);
+		json.value("total",    a.totalMs);
+		json.endObject();
+
+		json.endObject();
+	}
+
+	bool EndsWith(const char* s, const char* suffix)
+	{
+		size_t n = strlen(s), m = strlen(suffix);
+		return n >= m && _stricmp(s + n - m, suffix) == 0;
+	}
+
+	bool ReportXFile(JsonWriter& json, const char* fileName, bool optimize, int numThreads)
+	{
+		json.value("format", "x");
+
+		XFileScene      scene;
+		XFileParseStats parse;
+		if( !LoadXFile(fileName, &scene, numThreads, &parse) )
+		{
+			json.value("error", parse.error.c_str());
+			return false;
+		}
+
+		json.value("binary",  parse.binary);
+		json.value("bytes",   (int)parse.bytes);
+		json.value("frames",  parse.frames);
+		json.value("meshes",  parse.meshes);
+		json.value("parseMs", parse.parseMs);
+
+		std::vector<MeshCacheVertex>   vertices;
+		std::vector<DWORD>             indices;
+		std::vector<DWORD>             attributes;
+		std::vector<MeshCacheMaterial> materials;
+		if( !MergeXFileScene(scene, &vertices, &indices, &attributes, &materials) )
+		{
+			json.value("error", "the file has no triangles");
+			return false;
+		}
+		json.value("materials", (int)materials.size());
+
+		MeshAnalysis analysis;
+		if( !AnalyzeMesh(&vertices[0], (int)vertices.size(), sizeof(MeshCacheVertex),
+			&indices[0], (int)indices.size() / 3, &attributes[0], numThreads, &analysis) )
+		{
+			json.value("error", "an index is out of range");
+			return false;
+		}
+		WriteAnalysis(json, "source", analysis);
+
+		if( !optimize )
+			return true;
+
+		MeshCacheData data;
+		MeshWeldStats weld;
+		double start = Now();
+		if( !BuildMeshCacheData(scene, &data, &weld) )
+		{
+			json.value("error", "the mesh could not be optimized");
+			return false;
+		}
+		float buildMs = (float)(Now() - start);
+
+		attributes.resize(data.indices.size() / 3);
+		for(int s = 0; s < (int)data.subsets.size(); s++)
+			for(DWORD f = 0; f < data.subsets[s].FaceCount; f++)
+				attributes[data.subsets[s].FaceStart + f] = data.subsets[s].AttribId;
+
+		AnalyzeMesh(&data.vertices[0], (int)data.vertices.size(), sizeof(MeshCacheVertex),
+			&data.indices[0], (int)data.indices.size() / 3, &attributes[0], numThreads, &analysis);
+		WriteAnalysis(json, "optimized", analysis);
+
+		json.beginObject("build");
+		json.value("weldedVertices", weld.verticesBefore - weld.verticesAfter);
+		json.value("weldMs",         weld.totalMs);
+		json.value("ms",             buildMs);
+		json.endObject();
+
+		return true;
+	}
+
+	bool ReportCacheFile(JsonWriter& json, const char* fileName, int numThreads)
+	{
+		json.value("format", "mshc");
+
+		MeshCacheView view;
+		if( !view.open(fileName, 0) )
+		{
+			json.value("error", "not a mesh cache file, or a damaged one");
+			return false;
+		}
+
+		const MeshCacheHeader& header = view.getHeader();
+		json.value("version",   (int)header.version);
+		json.value("bytes",     (int)header.fileSize);
+		json.value("materials", view.getNumMaterials());
+
+		int numFaces = view.getNumFaces();
+		std::vector<DWORD> indices(numFaces * 3);
+		for(int i = 0; i < numFaces * 3; i++)
+			indices[i] = view.getIndex(i);
+
+		std::vector<DWORD> attributes(numFaces, 0);
+		for(int s = 0; s < view.getNumSubsets(); s++)
+		{
+			const D3DXATTRIBUTERANGE& subset = view.getSubsets()[s];
+			for(DWORD f = 0; f < subset.FaceCount; f++)
+				attributes[subset.FaceStart + f] = subset.AttribId;
+		}
+
+		MeshAnalysis analysis;
+		AnalyzeMesh(view.getVertices(), view.getNumVertices(), sizeof(MeshCacheVertex),
+			&indices[0], numFaces, &attributes[0], numThreads, &analysis);
+		WriteAnalysis(json, "cache", analysis);
+
+		// Each level draws over the full vertex buffer.
+		json.beginArray("lods");
+		int lodIndexSize = (int)header.indexSize;
+		for(int l = 0; l < view.getNumLods(); l++)
+		{
+			const MeshCacheLod& lod = view.getLods()[l];
+
+			std::vector<DWORD> lodIndices(lod.numFaces * 3);
+			for(int i = 0; i < (int)lodIndices.size(); i++)
+			{
+				DWORD c = lod.indexStart + i;
+				lodIndices[i] = lodIndexSize == 2 ? ((const WORD*)view.getLodIndices())[c]
+				                                  : ((const DWORD*)view.getLodIndices())[c];
+			}
+
+			float acmr = 0.0f, atvr = 0.0f;
+			AnalyzeVertexCache(lodIndices.empty() ? 0 : &lodIndices[0], (int)lodIndices.size(),
+				view.getNumVertices(), MeshCacheSize, &acmr, &atvr);
+
+			json.beginObject();
+			json.value("faces",   (int)lod.numFaces);
+			json.value("error",   lod.error);
+			json.value("subsets", (int)lod.numSubsets);
+			json.value("acmr",    acmr);
+			json.value("atvr",    atvr);
+			json.value("indexBytes", (int)lod.numFaces * 3 * lodIndexSize);
+			json.endObject();
+		}
+		json.endArray();
+
+		return true;
+	}
+
+	void Usage()
+	{
+		fprintf(stderr,
+			"usage: MeshStats [-o file.json] [-threads n] [-source] mesh ...\n"
+			"  mesh      a .x file or a .mshc mesh cache file\n"
+			"  -o        write the JSON to a file instead of standard output\n"
+			"  -threads  threads to use, 0 for one per hardware thread\n"
+			"  -source   report .x files as authored only, not optimized\n");
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const char* outputFile = 0;
+	int  numThreads = 0;
+	bool optimize   = true;
+
+	std::vector<const char*> files;
+	for(int i = 1; i < argc; i++)
+	{
+		if( strcmp(argv[i], "-o") == 0 && i + 1 < argc )
+			outputFile = argv[++i];
+		else if( strcmp(argv[i], "-threads") == 0 && i + 1 < argc )
+			numThreads = atoi(argv[++i]);
+		else if( strcmp(argv[i], "-source") == 0 )
+			optimize = false;
+		else if( argv[i][0] == '-' )
+		{
+			Usage();
+			return 2;
+		}
+		else
+			files.push_back(argv[i]);
+	}
+
+	if( files.empty() )
+	{
+		Usage();
+		return 2;
+	}
+
+	double start = Now();
+
+	JsonWriter json;
+	json.beginObject();
+	json.value("tool", "MeshStats");
+	json.value("cacheVersion", (int)MeshCacheVersion);
+
+	int failures = 0;
+	json.beginArray("meshes");
+	for(int f = 0; f < (int)files.size(); f++)
+	{
+		json.beginObject();
+		json.value("file", files[f]);
+
+		bool ok;
+		if( EndsWith(files[f], ".mshc") )
+			ok = ReportCacheFile(json, files[f], numThreads);
+		else
+			ok = ReportXFile(json, files[f], optimize, numThreads);
+
+		if( !ok )
+		{
+			fprintf(stderr, "MeshStats: %s: failed\n", files[f]);
+			failures++;
+		}
+		json.endObject();
+	}
+	json.endArray();
+
+	json.value("ms", (float)(Now() - start));
+	json.endObject();
+
+	std::string text = json.getText() + "\n";
+
+	FILE* out = outputFile ? fopen(outputFile, "wb") : stdout;
+	if( !out )
+	{
+		fprintf(stderr, "MeshStats: could not create %s\n", outputFile);
+		return 1;
+	}
+	bool written = fwrite(text.data(), 1, text.size(), out) == text.size();
+	if( outputFile )
+		written = fclose(out) == 0 && written;
+	else
+		written = fflush(out) == 0 && written;
+
+	if( !written )
+	{
+		fprintf(stderr, "MeshStats: could not write the report\n");
+		return 1;
+	}
+
+	return failures > 0 ? 1 : 0;
+}